@@ -0,0 +1,178 @@
+#ifndef DC_SHELL_ARITH_H
+#define DC_SHELL_ARITH_H
+
+/*
+ * This file is part of dc_shell.
+ *
+ *  dc_shell is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Foobar is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dc_shell.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "variables.h"
+#include <dc_posix/dc_posix_env.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*! \enum arith_op
+    \brief The kinds of node in a parsed arithmetic expression.
+*/
+enum arith_op
+{
+    ARITH_NUMBER,           /**< a constant */
+    ARITH_VARIABLE,         /**< a variable, 0 if it is unset or empty */
+    ARITH_NEGATE,           /**< -left */
+    ARITH_PLUS,             /**< +left */
+    ARITH_NOT,              /**< !left */
+    ARITH_COMPLEMENT,       /**< ~left */
+    ARITH_PRE_INCREMENT,    /**< ++name */
+    ARITH_PRE_DECREMENT,    /**< --name */
+    ARITH_POST_INCREMENT,   /**< name++ */
+    ARITH_POST_DECREMENT,   /**< name-- */
+    ARITH_MULTIPLY,         /**< left * right */
+    ARITH_DIVIDE,           /**< left / right */
+    ARITH_REMAINDER,        /**< left % right */
+    ARITH_ADD,              /**< left + right */
+    ARITH_SUBTRACT,         /**< left - right */
+    ARITH_SHIFT_LEFT,       /**< left << right */
+    ARITH_SHIFT_RIGHT,      /**< left >> right */
+    ARITH_LESS,             /**< left < right */
+    ARITH_LESS_EQUAL,       /**< left <= right */
+    ARITH_GREATER,          /**< left > right */
+    ARITH_GREATER_EQUAL,    /**< left >= right */
+    ARITH_EQUAL,            /**< left == right */
+    ARITH_NOT_EQUAL,        /**< left != right */
+    ARITH_BIT_AND,          /**< left & right */
+    ARITH_BIT_XOR,          /**< left ^ right */
+    ARITH_BIT_OR,           /**< left | right */
+    ARITH_AND,              /**< left && right, right is only evaluated if left is not 0 */
+    ARITH_OR,               /**< left || right, right is only evaluated if left is 0 */
+    ARITH_CONDITIONAL,      /**< left ? right : third, only one of right and third is evaluated */
+    ARITH_ASSIGN,           /**< name = right, or name op= right */
+    ARITH_COMMA,            /**< left , right */
+};
+
+/*! \struct arith_node
+    \brief A node of a parsed arithmetic expression. An expression is parsed once and can be evaluated
+    as many times as needed, with the variables as they are each time.
+*/
+struct arith_node
+{
+    enum arith_op op;           /**< what the node is */
+    enum arith_op compound;     /**< ARITH_ASSIGN: the operator of op=, ARITH_ASSIGN for a plain = */
+    int64_t value;              /**< ARITH_NUMBER: the constant */
+    char *name;                 /**< the variable of ARITH_VARIABLE, an increment, decrement or assignment */
+    struct arith_node *left;    /**< the operand of a unary operator or the left operand of a binary one */
+    struct arith_node *right;   /**< the right operand of a binary operator or assignment */
+    struct arith_node *third;   /**< ARITH_CONDITIONAL: the value if left is 0 */
+};
+
+/*! \struct arith_entry
+    \brief A parsed expression and its text.
+*/
+struct arith_entry
+{
+    char *text;                 /**< the expression as written */
+    struct arith_node *tree;    /**< the parsed expression */
+    struct arith_entry *next;   /**< the next entry in the same bucket */
+};
+
+/*! \struct arith_cache
+    \brief The expressions that have been parsed, hashed by their text and kept for the whole session,
+    so the arithmetic in a loop or function is only parsed the first time it runs.
+*/
+struct arith_cache
+{
+    struct arith_entry **buckets;   /**< the hash table */
+    size_t bucket_count;            /**< the number of buckets (a power of 2) */
+    size_t count;                   /**< the number of expressions, there is a limit to how many are kept */
+    size_t hits;                    /**< the number of evaluations that found the expression already parsed */
+    size_t misses;                  /**< the number of evaluations that had to parse the expression */
+};
+
+/**
+ * Parse an arithmetic expression: 64-bit integers (decimal, 0 octal or 0x hexadecimal), variables
+ * (name, $name or ${name}), parentheses and the C operators the shell has, from the highest precedence:
+ * ++ -- (after a name), ++ -- + - ! ~ (before), * / %, + -, << >>, < <= > >=, == !=, &, ^, |, &&, ||, ?:,
+ * = *= /= %= += -= <<= >>= &= ^= |=, and ,.
+ *
+ * @param env the posix environment.
+ * @param err the error object, EINVAL for a syntax error.
+ * @param text the expression, with any other expansions already done.
+ * @return the expression (free with arith_destroy), NULL on error.
+ */
+struct arith_node *arith_parse(const struct dc_posix_env *env, struct dc_error *err, const char *text);
+
+/**
+ * Evaluate a parsed expression. Integers wrap around at 64 bits. The value of a variable must be an integer
+ * constant, an unset or empty variable is 0. Assignments set the variable to the new value in decimal.
+ *
+ * @param env the posix environment.
+ * @param err the error object, EINVAL for a variable that isn't a number or division by zero,
+ *            or the error from setting a variable.
+ * @param tree the expression.
+ * @param variables the shell variables.
+ * @return the value.
+ */
+int64_t arith_evaluate(const struct dc_posix_env *env, struct dc_error *err, const struct arith_node *tree,
+                       struct variables *variables);
+
+/**
+ * Free an expression and set it to NULL.
+ *
+ * @param env the posix environment.
+ * @param ptree the expression to destroy.
+ */
+void arith_destroy(const struct dc_posix_env *env, struct arith_node **ptree);
+
+/**
+ * Create an empty cache.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @return the cache (free with arith_cache_destroy).
+ */
+struct arith_cache *arith_cache_create(const struct dc_posix_env *env, struct dc_error *err);
+
+/**
+ * Free the cache and the expressions in it and set it to NULL.
+ *
+ * @param env the posix environment.
+ * @param pcache the cache to destroy.
+ */
+void arith_cache_destroy(const struct dc_posix_env *env, struct arith_cache **pcache);
+
+/**
+ * Evaluate an expression, parsing it only if the cache doesn't already have it (see arith_parse and
+ * arith_evaluate).
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param cache the cache, or NULL to parse the expression every time.
+ * @param variables the shell variables.
+ * @param text the expression.
+ * @return the value.
+ */
+int64_t arith_cache_evaluate(const struct dc_posix_env *env, struct dc_error *err, struct arith_cache *cache,
+                             struct variables *variables, const char *text);
+
+/**
+ * Does an expression need the other expansions before it can be parsed: does it have a $ that isn't
+ * $name or ${name}, a quote, a \\ or a `. Only the text of one that doesn't can be cached.
+ *
+ * @param text the expression.
+ * @return true if it has to be expanded first.
+ */
+bool arith_needs_expansion(const char *text);
+
+#endif // DC_SHELL_ARITH_H
@@ -0,0 +1,80 @@
+#ifndef DC_SHELL_AUDIT_H
+#define DC_SHELL_AUDIT_H
+
+/*
+ * This file is part of dc_shell.
+ *
+ *  dc_shell is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Foobar is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dc_shell.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <dc_posix/dc_posix_env.h>
+#include <stdbool.h>
+#include <sys/resource.h>
+#include <time.h>
+
+/*! \struct audit_mark
+    \brief When a command line started, and what the children had used by then.
+*/
+struct audit_mark
+{
+  struct timespec wall;       /**< the time of day it started (CLOCK_REALTIME) */
+  struct timespec monotonic;  /**< the same moment on a clock that does not jump, for the duration */
+  struct rusage children;     /**< the resources of the children waited for so far (see getrusage) */
+};
+
+/**
+ * Start recording every command line run into a JSON lines file, one object per line: the time it started,
+ * how long it took, the exit code, the line, and the resources its children used (see getrusage).
+ * The records are handed to a writer thread through a ring buffer without locks, so the prompt never
+ * waits for the file. The writer wakes up every so often and writes what has built up with one writev.
+ * There is one log per shell process, so it is kept here rather than in the state.
+ *
+ * @param env the posix environment.
+ * @param err the error object, set if the file can't be opened or the thread started.
+ * @param path the file, it is appended to.
+ */
+void audit_open(const struct dc_posix_env *env, struct dc_error *err, const char *path);
+
+/**
+ * Is a log being written by this process (a child the shell forked does not write to it).
+ *
+ * @return true if audit_command records the lines.
+ */
+bool audit_enabled(void);
+
+/**
+ * Mark the start of a command line.
+ *
+ * @param mark set to now.
+ */
+void audit_start(struct audit_mark *mark);
+
+/**
+ * Record a command line that has finished. The writer is woken up early once the ring is half full, only
+ * if it is full (lines finishing faster than the file can take them) does the shell wait for it.
+ *
+ * @param env the posix environment.
+ * @param mark when it started (see audit_start).
+ * @param line the line.
+ * @param exit_code its exit code.
+ */
+void audit_command(const struct dc_posix_env *env, const struct audit_mark *mark, const char *line, int exit_code);
+
+/**
+ * Write what is left, stop the writer thread and close the log.
+ */
+void audit_close(void);
+
+#endif // DC_SHELL_AUDIT_H
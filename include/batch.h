@@ -0,0 +1,114 @@
+#ifndef DC_SHELL_BATCH_H
+#define DC_SHELL_BATCH_H
+
+/*
+ * This file is part of dc_shell.
+ *
+ *  dc_shell is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Foobar is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dc_shell.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "command.h"
+#include "variables.h"
+#include <dc_posix/dc_posix_env.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*! \struct batch_options
+    \brief How an argument list is split into commands.
+*/
+struct batch_options
+{
+    size_t arg_max;     /**< the space exec has for the arguments and environment (see sysconf _SC_ARG_MAX) */
+    size_t max_bytes;   /**< the most space the arguments of one command can take, 0 for as much as fits */
+    size_t max_args;    /**< the most arguments from the list one command gets, 0 for as many as fit */
+    size_t jobs;        /**< the number of commands to run at once, 0 for one per processor */
+    const struct launch *launch; /**< how the commands are run, or NULL for the command's own launch */
+};
+
+/*! \struct batch_result
+    \brief What happened to the commands a list was split into.
+*/
+struct batch_result
+{
+    size_t batches;     /**< the number of commands run */
+    size_t failures;    /**< the number of commands that exited with a status other than 0 */
+    int worst;          /**< the largest exit status */
+};
+
+/**
+ * How much space an argument takes: the string, its NUL and the pointer to it.
+ *
+ * @param arg the argument.
+ * @return the number of bytes exec needs for it.
+ */
+size_t batch_argument_size(const char *arg);
+
+/**
+ * How much space is left for the arguments once the environment is in.
+ * 2048 bytes are kept back, as POSIX asks xargs to.
+ *
+ * @param envp the environment the command gets.
+ * @param arg_max the space exec has (see sysconf _SC_ARG_MAX).
+ * @return the space for the arguments, 0 if the environment is already too big.
+ */
+size_t batch_limit(char **envp, size_t arg_max);
+
+/**
+ * Split a list into the fewest runs that fit: each run takes as many arguments as fit after the fixed
+ * size, so no run could have taken the first argument of the next one. An argument too big to fit with
+ * anything is a run by itself.
+ *
+ * @param args the arguments.
+ * @param count the number of arguments.
+ * @param fixed_size the space the command and the arguments that are in every run take.
+ * @param limit the space a run can take (see batch_limit).
+ * @param max_args the most arguments in a run, 0 for no limit.
+ * @param ends set to the index after the last argument of each run, or NULL to just count the runs.
+ * @return the number of runs.
+ */
+size_t batch_split(char **args, size_t count, size_t fixed_size, size_t limit, size_t max_args, size_t *ends);
+
+/**
+ * Is a command too big to exec in one go.
+ *
+ * @param env the posix environment.
+ * @param command the command.
+ * @param path the directories to search for the command.
+ * @param envp the environment the command gets.
+ * @param arg_max the space exec has (see sysconf _SC_ARG_MAX).
+ * @return true if the arguments and environment need more than arg_max.
+ */
+bool batch_needed(const struct dc_posix_env *env, const struct command *command, char **path, char **envp,
+                  size_t arg_max);
+
+/**
+ * Run a command once per run of arguments (see batch_split), like xargs.
+ * argv[first..end) is split, the arguments before and after it are passed to every run.
+ * Redirected output is truncated once and then appended to by every run.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param command the command to run.
+ * @param first the index in argv of the first argument that can be split.
+ * @param end the index in argv after the last argument that can be split.
+ * @param path the directories to search for the command.
+ * @param variables the variables whose environment the command gets, or NULL to pass on the shell's environment.
+ * @param options the limits on each run, the number to run at once and how they are run.
+ * @param result set to the number of runs, failures and the worst exit status.
+ */
+void batch_execute(const struct dc_posix_env *env, struct dc_error *err, struct command *command, size_t first,
+                   size_t end, char **path, struct variables *variables, const struct batch_options *options,
+                   struct batch_result *result);
+
+#endif // DC_SHELL_BATCH_H
@@ -18,7 +18,9 @@
  *  along with dc_shell.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include "arith.h"
 #include "execute.h"
+#include "variables.h"
 #include <dc_posix/dc_posix_env.h>
 
 /**
@@ -35,4 +37,182 @@
 void builtin_cd(const struct dc_posix_env *env, struct dc_error *err,
                 struct command *command, FILE *errstream);
 
+/**
+ * Display the arguments separated by spaces and followed by a newline (not with -n as the first argument).
+ * The command->exit_code is set to 0, or 1 if the output could not be written.
+ *
+ * @param env the posix environment.
+ * @param err the error object
+ * @param command the command information
+ * @param outstream the stream to display the arguments on
+ */
+void builtin_echo(const struct dc_posix_env *env, struct dc_error *err, struct command *command, FILE *outstream);
+
+/**
+ * Display the working directory.
+ * The command->exit_code is set to 0 on success or 1 if the directory can't be found.
+ *
+ * @param env the posix environment.
+ * @param err the error object
+ * @param command the command information
+ * @param outstream the stream to display the directory on
+ * @param errstream the stream to print error messages to
+ */
+void builtin_pwd(const struct dc_posix_env *env, struct dc_error *err, struct command *command, FILE *outstream,
+                 FILE *errstream);
+
+/**
+ * Evaluate arithmetic expressions (see arith_parse), one per argument, for their assignments.
+ * The command->exit_code is set to 0 if the last expression is not 0, or 1 if it is 0 or an expression is bad.
+ *
+ * @param env the posix environment.
+ * @param err the error object
+ * @param command the command information
+ * @param cache the parsed expressions (see arith_cache_evaluate), may be NULL
+ * @param variables the shell variables
+ * @param errstream the stream to print error messages to
+ */
+void builtin_let(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                 struct arith_cache *cache, struct variables *variables, FILE *errstream);
+
+/**
+ * Export variables: each argument is NAME or NAME=value.
+ * With no arguments (or -p) the exported variables are displayed.
+ * The command->exit_code is set to 0 on success or 1 if any argument could not be exported.
+ *
+ * @param env the posix environment.
+ * @param err the error object
+ * @param command the command information
+ * @param variables the shell variables
+ * @param outstream the stream to display the variables on
+ * @param errstream the stream to print error messages to
+ */
+void builtin_export(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                    struct variables *variables, FILE *outstream, FILE *errstream);
+
+/**
+ * Make variables readonly: each argument is NAME or NAME=value.
+ * With no arguments (or -p) the readonly variables are displayed.
+ * The command->exit_code is set to 0 on success or 1 if any argument could not be made readonly.
+ *
+ * @param env the posix environment.
+ * @param err the error object
+ * @param command the command information
+ * @param variables the shell variables
+ * @param outstream the stream to display the variables on
+ * @param errstream the stream to print error messages to
+ */
+void builtin_readonly(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                      struct variables *variables, FILE *outstream, FILE *errstream);
+
+/**
+ * Remove variables: each argument is a NAME.
+ * The command->exit_code is set to 0 on success or 1 if any variable could not be removed.
+ *
+ * @param env the posix environment.
+ * @param err the error object
+ * @param command the command information
+ * @param variables the shell variables
+ * @param errstream the stream to print error messages to
+ */
+void builtin_unset(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                   struct variables *variables, FILE *errstream);
+
+/**
+ * exec [command [arguments]]: with a command, replace the shell with it (see execute_replace), it does not
+ * return. Without one the redirections are applied to the shell itself, so they stay for the commands
+ * after it (exec 3< file, exec 2> log, exec > a > b, see redirect_shell).
+ * The command->exit_code is set to 0, or 1 if a redirection failed.
+ *
+ * @param env the posix environment.
+ * @param err the error object
+ * @param command the command information
+ * @param path the directories to search for the command
+ * @param variables the shell variables
+ * @param outstream the shell's output, flushed before it is redirected
+ * @param errstream the stream to print error messages to
+ */
+void builtin_exec(const struct dc_posix_env *env, struct dc_error *err, struct command *command, char **path,
+                  struct variables *variables, FILE *outstream, FILE *errstream);
+
+/**
+ * timeout [-k KILL_AFTER] DURATION [-k KILL_AFTER] command [arguments]: run the program, sending it SIGTERM
+ * if it is still running after DURATION and SIGKILL KILL_AFTER after that (see execute_timed).
+ * The durations are numbers of seconds, or have an s, m, h or d suffix (see parse_duration).
+ * The command->exit_code is the program's, 124 if it timed out, 137 if it was killed, or 125 for a usage error.
+ *
+ * @param env the posix environment.
+ * @param err the error object
+ * @param command the command information
+ * @param path the directories to search for the command
+ * @param variables the shell variables
+ * @param errstream the stream to print error messages to
+ */
+void builtin_timeout(const struct dc_posix_env *env, struct dc_error *err, struct command *command, char **path,
+                     struct variables *variables, FILE *errstream);
+
+/**
+ * pin CPUS, nice [-n] [ADJUSTMENT] and ionice CLASS[:LEVEL] in front of a command: run the program on the
+ * CPUs (eg. 2-5 or 0,4-7), with ADJUSTMENT (10 if there is none) added to its nice value, or in the I/O
+ * class (idle, best-effort or realtime). They can be combined, with each other and with ulimit, in any order,
+ * eg. pin 2-5 nice 10 ulimit -v 1000000 ionice idle make.
+ * They are set in the child before the exec (see launch_apply), so no other program is run to do it.
+ * The command->exit_code is the program's, or 125 for a usage error or if they could not be set.
+ *
+ * @param env the posix environment.
+ * @param err the error object
+ * @param command the command information, the command->command is pin, nice or ionice
+ * @param path the directories to search for the command
+ * @param variables the shell variables
+ * @param outstream the stream a ulimit after them prints the limits to
+ * @param errstream the stream to print error messages to
+ */
+void builtin_launch(const struct dc_posix_env *env, struct dc_error *err, struct command *command, char **path,
+                    struct variables *variables, FILE *outstream, FILE *errstream);
+
+/**
+ * ulimit [-H | -S] [-a | -c | -d | -f | -n | -s | -t | -u | -v [VALUE]]... [command [arguments]]: show or set the
+ * resource limits programs are run with (see launch_parse_limit), -f if no resource is given. -H is the hard
+ * limit, -S the soft one, a VALUE without either sets both. -a shows all of them.
+ * Without a command the limits are kept for the session, and every program is run with them (see run_command).
+ * With a command they only apply to its program, on top of the session's, and the command can be pin, nice or
+ * ionice too (eg. ulimit -n 64 pin 0 make, see builtin_launch). Either way they are set in the child before
+ * the exec, so the shell itself is never limited.
+ * The command->exit_code is the program's, or 0, or 1 for a bad option or value.
+ *
+ * @param env the posix environment.
+ * @param err the error object
+ * @param command the command information
+ * @param limits the session's limits
+ * @param path the directories to search for the command
+ * @param variables the shell variables
+ * @param outstream the stream to print the limits to
+ * @param errstream the stream to print error messages to
+ */
+void builtin_ulimit(const struct dc_posix_env *env, struct dc_error *err, struct command *command, struct launch *limits,
+                    char **path, struct variables *variables, FILE *outstream, FILE *errstream);
+
+/**
+ * Run a command with arguments read from a file, as few times as the space exec has allows (see batch_execute).
+ * The items are separated by blanks and newlines, and can be quoted with ' or " or escaped with \.
+ * The options are -0 (the items are separated by '\0' instead), -n N (at most N items per command),
+ * -s N (at most N bytes of items per command) and -P N (run N commands at once, 0 for one per processor).
+ * The command is echo if none is given. The commands are run with the CPUs, nice value and I/O class from
+ * BATCH_PIN, BATCH_NICE and BATCH_IONICE (see launch_defaults).
+ * The command->exit_code is set the way xargs does: 0 if every command succeeded, 123 if any failed,
+ * 124 if one exited with 255, 125 if one was killed, and 126 or 127 if the command could not be run or found.
+ *
+ * @param env the posix environment.
+ * @param err the error object
+ * @param command the command information, the items are read from the command->here_document or
+ *                command->stdin_file if there is one
+ * @param path the directories to search for the command
+ * @param variables the shell variables
+ * @param arg_max the space exec has for the arguments and environment (see state max_line_length)
+ * @param instream the stream to read the items from if there is no here_document or stdin_file
+ * @param errstream the stream to print error messages to
+ */
+void builtin_xargs(const struct dc_posix_env *env, struct dc_error *err, struct command *command, char **path,
+                   struct variables *variables, size_t arg_max, FILE *instream, FILE *errstream);
+
 #endif // DC_SHELL_BUILTINS_H
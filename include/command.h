@@ -18,8 +18,44 @@
  *  along with dc_shell.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include "launch.h"
 #include "state.h"
 #include <dc_posix/dc_posix_env.h>
+#include <sys/types.h>
+
+/*! \enum redirection_type
+    \brief What a redirection does to its fd.
+*/
+enum redirection_type
+{
+  REDIRECT_INPUT,       /**< [n]<file, read the file */
+  REDIRECT_OUTPUT,      /**< [n]>file or [n]>|file, create or truncate the file */
+  REDIRECT_APPEND,      /**< [n]>>file, create or append to the file */
+  REDIRECT_READ_WRITE,  /**< [n]<>file, read and write the file, creating it */
+  REDIRECT_DUPLICATE,   /**< [n]>&m or [n]<&m, make n a copy of m */
+  REDIRECT_CLOSE,       /**< [n]>&- or [n]<&-, close n */
+  REDIRECT_HERE,        /**< [n]<<WORD, [n]<<-WORD or [n]<<<word, read the here_document */
+};
+
+/*! \struct redirection
+    \brief One redirection, they are applied in the order they are written.
+*/
+struct redirection
+{
+  int fd;                     /**< the fd that is redirected */
+  enum redirection_type type; /**< what is done to it */
+  char *target;               /**< the file for the file types, as written until expand_command, otherwise NULL */
+  int source;                 /**< the fd that is copied for REDIRECT_DUPLICATE */
+};
+
+/*! \struct process_substitution
+    \brief A <(commands) or >(commands) that is running while its command is.
+*/
+struct process_substitution
+{
+  int fd;       /**< the shell's end of the pipe, the command's program gets it as /dev/fd/fd */
+  pid_t pid;    /**< the child running the commands */
+};
 
 /*! \struct command
     \brief The commands to enter, currently there is only one.
@@ -32,11 +68,23 @@ struct command
   char *command;            /**< the program/builtin to run */
   size_t argc;              /**< the number of arguments to the command */
   char **argv;              /**< the arguments to the command, arg[0] must be NULL */
-  char *stdin_file;         /**< the file to redirect stdin from */
-  char *stdout_file;        /**< the file to redirect stdout to */
+  size_t pathname_first;    /**< the index in argv of the first argument pathname expansion produced */
+  size_t pathname_end;      /**< the index in argv after the last argument pathname expansion produced */
+  size_t assignment_count;  /**< the number of NAME=value words before the command */
+  char **assignments;       /**< the NAME=value words before the command, NULL terminated */
+  struct redirection *redirections; /**< the redirections, in the order they are applied */
+  size_t redirection_count; /**< the number of redirections */
+  char *stdin_file;         /**< the last file stdin is redirected from (see redirections) */
+  char *here_document;      /**< the text to redirect stdin from (<<WORD or <<<word) instead of a file */
+  bool here_string;         /**< is the here_document a <<<word (expanded as a word, with a newline added) */
+  bool here_expand;         /**< are the $, ` and \\ in the here_document expanded (false if WORD was quoted) */
+  char *stdout_file;        /**< the last file stdout is redirected to (see redirections) */
   bool stdout_overwrite;    /**< append or overwrite the stdout file (true = overwrite) */
-  char *stderr_file;        /**< the file to redirect strderr to */
+  char *stderr_file;        /**< the last file strderr is redirected to (see redirections) */
   bool stderr_overwrite;    /**< append or overwrite the strerr file (true = overwrite) */
+  struct process_substitution *substitutions; /**< the process substitutions of the words, see substitute_process */
+  size_t substitution_count; /**< the number of process substitutions */
+  const struct launch *launch; /**< the CPUs, priorities and limits the program gets, or NULL to keep the shell's */
   int exit_code;            /**< the exit code from the program/builtin */
 };
 
@@ -45,12 +93,75 @@ struct command
  *
  * @param env the posix environment.
  * @param err the error object.
- * @param state the current state, to set the fatal_error and access the command line and regex for redirection.
+ * @param state the current state, to set the fatal_error.
  * @param command the command to parse.
  */
 void parse_command(const struct dc_posix_env *env, struct dc_error *err,
                    struct state *state, struct command *command);
 
+/**
+ * The part of parse_command that only depends on the command->line: fill in the redirections
+ * and split the rest of the line into words (see split_words).
+ * The words can be expanded any number of times (see expand_command).
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param state the current state, to set the fatal_error.
+ * @param command the command to parse.
+ * @param count set to the number of words.
+ * @return the words as written (free with free_words).
+ */
+char **split_command(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                     struct command *command, size_t *count);
+
+/**
+ * The part of parse_command that depends on the variables and files: expand the words
+ * (see expand_words) into the command, assignments and arguments, the redirection targets and the
+ * here_document.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param state the current state, to set the fatal_error and expand the words.
+ * @param command the command to fill in.
+ * @param raw the words as written (see split_command), they are not changed.
+ * @param raw_count the number of words.
+ */
+void expand_command(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                    struct command *command, char **raw, size_t raw_count);
+
+/**
+ * A command that can't be expanded (eg. echo $((1/0)), or a glob in a directory that can't be listed) fails
+ * like a program would: $? is 1 and the shell carries on. A shell that is not interactive (a script) stops
+ * instead (see handle_error), as does any shell that ran out of memory.
+ *
+ * @param err the error the expansion raised.
+ * @param state the current state.
+ */
+void fail_command(const struct dc_error *err, struct state *state);
+
+/**
+ * The redirections to apply: the command's own, or for a command that was not split (see split_command),
+ * ones made from its stdin_file, here_document, stdout_file and stderr_file.
+ *
+ * @param command the command.
+ * @param files where the ones made from the files are put.
+ * @param count set to the number of redirections.
+ * @return the redirections, in the order they are applied.
+ */
+const struct redirection *command_redirections(const struct command *command, struct redirection files[4],
+                                               size_t *count);
+
+/**
+ * Copy the redirections and the here_document, as split_command left them, from one command to another.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param command the command to copy to, it has no redirections.
+ * @param from the command to copy from.
+ */
+void copy_redirections(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                       const struct command *from);
+
 /**
  *
  * @param env
@@ -0,0 +1,74 @@
+#ifndef DC_SHELL_COPY_H
+#define DC_SHELL_COPY_H
+
+/*
+ * This file is part of dc_shell.
+ *
+ *  dc_shell is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Foobar is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dc_shell.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "command.h"
+#include <dc_posix/dc_posix_env.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/*! \struct copy_stats
+    \brief How the data of the copies run in the shell was moved.
+*/
+struct copy_stats
+{
+    size_t commands;        /**< the number of commands run by copy_execute */
+    size_t kernel_bytes;    /**< the bytes copied by copy_file_range, sendfile or splice */
+    size_t buffered_bytes;  /**< the bytes copied with read and write */
+};
+
+/**
+ * Can the command be run in the shell as a copy: there is no command (only redirections), or the command
+ * is cat with no options, something to read (files or a < file) and only < and > or >> redirections.
+ *
+ * @param command the expanded command.
+ * @return true if copy_execute can run it.
+ */
+bool copy_applies(const struct command *command);
+
+/**
+ * Run a command that copy_applies to without a child process. The redirections are opened in order.
+ * Without a command, the < file is copied to the > files if there are both, otherwise the files are only
+ * opened (so > file creates or truncates it). cat copies each file, - for the < file, to the > files or to
+ * outstream. Every > file gets all of it (like zsh's multios). The data is copied by the kernel where it
+ * can be (copy_file_range, then sendfile or splice), otherwise by read and write.
+ * A command with a launch (eg. the limits set with ulimit) is copied by a child process that has them applied,
+ * the same as a program would be, so ulimit -f stops it with SIGXFSZ. Its bytes are not added to the stats.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param command the command, the exit_code is set.
+ * @param outstream where cat writes if it is not redirected.
+ * @param errstream where the errors are displayed.
+ * @param stats added to, or NULL.
+ */
+void copy_execute(const struct dc_posix_env *env, struct dc_error *err, struct command *command, FILE *outstream,
+                  FILE *errstream, struct copy_stats *stats);
+
+/**
+ * Copy everything from one fd to another, from and to their current offsets.
+ *
+ * @param in the fd to read.
+ * @param out the fd to write.
+ * @param stats added to, or NULL.
+ * @return 0, or the errno of the read or write that failed.
+ */
+int copy_fd(int in, int out, struct copy_stats *stats);
+
+#endif // DC_SHELL_COPY_H
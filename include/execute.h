@@ -19,19 +19,112 @@
  */
 
 #include "command.h"
+#include "variables.h"
 #include <dc_posix/dc_posix_env.h>
 #include <stdio.h>
+#include <sys/types.h>
+
+/*! \struct timeout
+    \brief How long a program can run before it is stopped (see execute_timed).
+*/
+struct timeout
+{
+    long duration;      /**< the milliseconds until it is sent SIGTERM, 0 for no limit */
+    long kill_after;    /**< the milliseconds from SIGTERM until it is sent SIGKILL, 0 to never send it */
+};
 
 /**
  * Create a child process, exec the command with any redirection, set the exit code.
  * If there is an err executing the command print an err message.
  * If the command cannot be found set the command->exit_code to 127.
+ * The command->assignments are applied to the variables in the child only, so they do not
+ * change the shell's variables.
+ *
+ * @param env the posix environment.
+ * @param err the err object
+ * @param command the command to execute
+ * @param path the directories to search for the command
+ * @param variables the variables whose environment the command gets, or NULL to pass on the shell's environment
+ */
+void execute(const struct dc_posix_env *env, struct dc_error *err, struct command *command, char **path,
+             struct variables *variables);
+
+/**
+ * Like execute, but the program is sent SIGTERM if it runs longer than the timeout->duration, and SIGKILL
+ * if it is still running timeout->kill_after after that. The shell waits in poll on a pidfd for the child,
+ * so there is no busy loop, and the signals can't reach another process that got the pid.
+ * The command->exit_code is 124 if the program timed out, or 137 if it had to be killed.
  *
  * @param env the posix environment.
  * @param err the err object
  * @param command the command to execute
  * @param path the directories to search for the command
+ * @param variables the variables whose environment the command gets, or NULL to pass on the shell's environment
+ * @param timeout the limits, or NULL for none
+ */
+void execute_timed(const struct dc_posix_env *env, struct dc_error *err, struct command *command, char **path,
+                   struct variables *variables, const struct timeout *timeout);
+
+/**
+ * Parse a duration: a number, with a fraction if needed, followed by s (the default), m, h or d.
+ *
+ * @param string the duration.
+ * @param milliseconds set to the duration.
+ * @return false if the string is not a duration.
+ */
+bool parse_duration(const char *string, long *milliseconds);
+
+/**
+ * Create a child process and exec the command with any redirection, without waiting for it.
+ * The child exits with the code from handle_run_error if the exec fails.
+ *
+ * @param env the posix environment.
+ * @param err the err object
+ * @param command the command to execute
+ * @param path the directories to search for the command
+ * @param variables the variables whose environment the command gets, or NULL to pass on the shell's environment
+ * @return the child's pid, or -1 if it could not be created
+ */
+pid_t execute_start(const struct dc_posix_env *env, struct dc_error *err, struct command *command, char **path,
+                    struct variables *variables);
+
+/**
+ * Replace the shell with the command's program, without a child process: the process substitutions and
+ * redirections are applied and the program is exec'd the same way execute does. It never returns, if the
+ * command can't be run the shell exits with the code from handle_run_error (126 for a redirection).
+ *
+ * @param env the posix environment.
+ * @param err the err object
+ * @param command the command to execute
+ * @param path the directories to search for the command
+ * @param variables the variables whose environment the command gets, or NULL to pass on the shell's environment
+ */
+_Noreturn void execute_replace(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                               char **path, struct variables *variables);
+
+/**
+ * Apply the command's redirections to this process, in order (see command_redirections). When an fd has
+ * more than one > or >> file in a row (cmd > a >> b) it gets all of them (like zsh's multios): the files are
+ * opened in order, the fd becomes a pipe, and this process becomes the pump that copies the pipe to the files
+ * while a child carries on (redirect returns in the child only). The pump passes SIGTERM on to the child, and
+ * on Linux the child is killed if the pump is.
+ *
+ * @param env the posix environment.
+ * @param err the err object, with the errno of the redirection that failed.
+ * @param command the command.
+ */
+void redirect(const struct dc_posix_env *env, struct dc_error *err, struct command *command);
+
+/**
+ * Apply the command's redirections to the shell itself (exec without a command), the same way as redirect,
+ * except that the shell keeps its pid: the pump of a fan out (exec > a > b) is started in the background
+ * (orphaned, so it never has to be reaped) and copies the pipe to the files until every copy of the
+ * write end is closed, when the shell exits or redirects the fd again.
+ *
+ * @param env the posix environment.
+ * @param err the err object, with the errno of the redirection that failed.
+ * @param command the command.
  */
-void execute(const struct dc_posix_env *env, struct dc_error *err, struct command *command, char **path);
+void redirect_shell(const struct dc_posix_env *env, struct dc_error *err, struct command *command);
 
 #endif // DC_SHELL_EXECUTE_H
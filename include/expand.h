@@ -0,0 +1,113 @@
+#ifndef DC_SHELL_EXPAND_H
+#define DC_SHELL_EXPAND_H
+
+/*
+ * This file is part of dc_shell.
+ *
+ *  dc_shell is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Foobar is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dc_shell.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "state.h"
+#include <dc_posix/dc_posix_env.h>
+#include <stddef.h>
+
+/**
+ * Break a line into words at the unquoted blanks. The words are returned as written,
+ * with their quotes, so they can be expanded later (see expand_words).
+ * An unterminated quote or an unquoted | & ; < > ( or ) is an EINVAL error.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param line the line to split.
+ * @param count set to the number of words.
+ * @return the NULL terminated words (free with free_words).
+ */
+char **split_words(const struct dc_posix_env *env, struct dc_error *err, const char *line, size_t *count);
+
+/**
+ * Expand words the way sh does: tilde expansion, parameter expansion, command substitution,
+ * field splitting (with IFS), pathname expansion and quote removal.
+ * Leading NAME=value words can be treated as assignments, which are expanded but not split
+ * or matched against files, and are returned first.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param state the state, for the variables, directory listings and last exit code.
+ * @param words the words to expand (see split_words).
+ * @param count the number of words.
+ * @param expanded_count set to the number of words after expansion.
+ * @param assignment_count set to the number of leading assignments, or NULL if there are no assignments.
+ * @param pathname_range set to the first and one past the last index of the words pathname expansion produced
+ *                       (the same index twice if it produced none), or NULL.
+ * @return the NULL terminated expanded words (free with free_words).
+ */
+char **expand_words(const struct dc_posix_env *env, struct dc_error *err, struct state *state, char **words,
+                    size_t count, size_t *expanded_count, size_t *assignment_count, size_t pathname_range[2]);
+
+/**
+ * Free the words returned by split_words or expand_words.
+ *
+ * @param env the posix environment.
+ * @param words the words.
+ * @param count the number of words.
+ */
+void free_words(const struct dc_posix_env *env, char **words, size_t count);
+
+/**
+ * Expand a word as a single string: no field splitting or pathname expansion (eg. the word of a case).
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param state the state, for the variables and last exit code.
+ * @param word the word to expand, as written.
+ * @return the expanded word.
+ */
+char *expand_string(const struct dc_posix_env *env, struct dc_error *err, struct state *state, const char *word);
+
+/**
+ * Expand a word as a pattern (see pathname_match): like expand_string, but the quoted * ? [ and \
+ * are escaped so they only match themselves.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param state the state, for the variables and last exit code.
+ * @param word the word to expand, as written.
+ * @return the pattern.
+ */
+char *expand_pattern(const struct dc_posix_env *env, struct dc_error *err, struct state *state, const char *word);
+
+/**
+ * Expand the body of a here-document: parameters, command substitutions and arithmetic are expanded and
+ * a \\ before $, ` or \\ is removed (a \\ before a newline removes both). Quotes are not special and
+ * nothing is split or matched against files.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param state the state, for the variables and last exit code.
+ * @param text the body, as written.
+ * @return the expanded body (free with dc_free).
+ */
+char *expand_here_document(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                           const char *text);
+
+/**
+ * Find the end of the character, quoted string or substitution at line[i].
+ *
+ * @param line the line.
+ * @param i the index of the character.
+ * @return the index just past it, or SIZE_MAX if it is not terminated.
+ */
+size_t skip_quoted(const char *line, size_t i);
+
+#endif // DC_SHELL_EXPAND_H
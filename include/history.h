@@ -0,0 +1,90 @@
+#ifndef DC_SHELL_HISTORY_H
+#define DC_SHELL_HISTORY_H
+
+/*
+ * This file is part of dc_shell.
+ *
+ *  dc_shell is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Foobar is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dc_shell.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <dc_posix/dc_posix_env.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*! \struct history
+    \brief The lines the user has entered, oldest first.
+
+    Stored as a ring so adding a line never moves the other lines.
+*/
+struct history
+{
+    char **lines;       /**< the ring of remembered lines */
+    size_t capacity;    /**< the maximum number of lines to remember */
+    size_t count;       /**< the number of lines currently remembered */
+    size_t first;       /**< the index in lines of the oldest line */
+    char *file;         /**< the file lines are loaded from and appended to, may be NULL */
+    bool loaded;        /**< has the file been read yet (true = read) */
+};
+
+/**
+ * Create an empty history. The file is not read until history_load (or history_add) is called.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param capacity the maximum number of lines to remember.
+ * @param file the file to load from and append to, or NULL to keep the history in memory only.
+ * @return the history.
+ */
+struct history *history_create(const struct dc_posix_env *env, struct dc_error *err, size_t capacity,
+                               const char *file);
+
+/**
+ * Free the history and set the pointer to NULL.
+ *
+ * @param env the posix environment.
+ * @param phistory the history to destroy.
+ */
+void history_destroy(const struct dc_posix_env *env, struct history **phistory);
+
+/**
+ * Read the history file, if there is one and it has not already been read.
+ * A missing file is not an error.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param history the history to fill in.
+ */
+void history_load(const struct dc_posix_env *env, struct dc_error *err, struct history *history);
+
+/**
+ * Remember a line. Empty lines and repeats of the newest line are ignored.
+ * The history file is read first, if it hasn't been, and the line is appended to it.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param history the history to add to.
+ * @param line the line to remember.
+ */
+void history_add(const struct dc_posix_env *env, struct dc_error *err, struct history *history, const char *line);
+
+/**
+ * Get a remembered line.
+ *
+ * @param history the history to look in.
+ * @param age how far back to look (0 = the newest line).
+ * @return the line or NULL if age is not less than history->count.
+ */
+const char *history_get(const struct history *history, size_t age);
+
+#endif // DC_SHELL_HISTORY_H
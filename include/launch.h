@@ -0,0 +1,173 @@
+#ifndef DC_SHELL_LAUNCH_H
+#define DC_SHELL_LAUNCH_H
+
+/*
+ * This file is part of dc_shell.
+ *
+ *  dc_shell is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Foobar is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dc_shell.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "variables.h"
+#include <dc_posix/dc_posix_env.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+// the most CPUs a program can be pinned to, the same as glibc's CPU_SETSIZE
+#define LAUNCH_MAX_CPUS 1024
+
+// the ulimit options of the resources a program's use of can be limited, in the order of launch limits
+#define LAUNCH_LIMIT_OPTIONS "cdfnstuv"
+#define LAUNCH_LIMIT_COUNT (sizeof(LAUNCH_LIMIT_OPTIONS) - 1)
+
+/*! \enum launch_io_class
+    \brief The I/O scheduling classes, with the values ioprio_set uses.
+*/
+enum launch_io_class
+{
+  LAUNCH_IO_UNCHANGED = 0,    /**< leave the class the shell has */
+  LAUNCH_IO_REALTIME = 1,     /**< always served first */
+  LAUNCH_IO_BEST_EFFORT = 2,  /**< the default, shared by level */
+  LAUNCH_IO_IDLE = 3,         /**< only served when no one else is using the disk */
+};
+
+/*! \struct launch_limit
+    \brief The limit on one resource (see setrlimit), the parts that are not set are left as the shell has them.
+*/
+struct launch_limit
+{
+  bool soft_set;  /**< is the soft limit changed */
+  rlim_t soft;    /**< the soft limit, the one the kernel enforces, RLIM_INFINITY for none */
+  bool hard_set;  /**< is the hard limit changed */
+  rlim_t hard;    /**< the hard limit, the most the soft limit can be raised to */
+};
+
+/*! \struct launch
+    \brief How a program is run: the CPUs, nice value and I/O class it gets, set in the child before the exec.
+*/
+struct launch
+{
+  bool pin;                                 /**< is the program limited to the cpus */
+  unsigned char cpus[LAUNCH_MAX_CPUS / 8];  /**< the CPUs it can run on, bit n % 8 of byte n / 8 for CPU n */
+  bool renice;                              /**< is the nice value changed */
+  int nice;                                 /**< the amount added to the nice value (see nice) */
+  enum launch_io_class io_class;            /**< the I/O scheduling class */
+  int io_level;                             /**< the level in the realtime and best-effort classes, 0 (first) to 7 */
+  struct launch_limit limits[LAUNCH_LIMIT_COUNT]; /**< the resource limits, in the order of LAUNCH_LIMIT_OPTIONS */
+};
+
+/**
+ * Set the launch to change nothing.
+ *
+ * @param launch the launch to set.
+ */
+void launch_init(struct launch *launch);
+
+/**
+ * Does the launch change anything.
+ *
+ * @param launch the launch.
+ * @return true if it pins, renices, changes the I/O class or limits a resource.
+ */
+bool launch_is_set(const struct launch *launch);
+
+/**
+ * Pin the program to a list of CPUs, like taskset -c: numbers and ranges separated by commas (eg. 2-5 or 0,4-7).
+ *
+ * @param launch the launch to change.
+ * @param list the CPU list.
+ * @return false if the list is not a CPU list (the launch is not changed).
+ */
+bool launch_parse_cpus(struct launch *launch, const char *list);
+
+/**
+ * Add to the program's nice value: a number from -20 to 19, with an optional sign. Like nice(1) run inside
+ * another, a second adjustment adds to the first (nice 5 nice 5 is 10), the kernel keeps the result in range.
+ *
+ * @param launch the launch to change.
+ * @param adjustment the number.
+ * @return false if it is not a number in range (the launch is not changed).
+ */
+bool launch_parse_nice(struct launch *launch, const char *adjustment);
+
+/**
+ * Set the program's I/O scheduling class: idle, best-effort or realtime (or 3, 2 or 1, like ionice -c),
+ * followed by :level for the last two (eg. best-effort:7).
+ *
+ * @param launch the launch to change.
+ * @param priority the class and level.
+ * @return false if it is not a class (the launch is not changed).
+ */
+bool launch_parse_ionice(struct launch *launch, const char *priority);
+
+/**
+ * Limit a resource, like ulimit: -c the core file size and -f the size of a file written (in 512 byte blocks),
+ * -d the data segment, -s the stack and -v the address space (in kilobytes), -n the number of open files,
+ * -t the CPU time (in seconds) and -u the number of processes the user can have.
+ *
+ * @param launch the launch to change.
+ * @param option the ulimit option (one of LAUNCH_LIMIT_OPTIONS).
+ * @param value a number in the option's units, or unlimited.
+ * @param soft change the soft limit.
+ * @param hard change the hard limit.
+ * @return false if the option or value is not one (the launch is not changed).
+ */
+bool launch_parse_limit(struct launch *launch, char option, const char *value, bool soft, bool hard);
+
+/**
+ * The limit a program run with the launch gets: the launch's, or if it does not change it the shell's own.
+ *
+ * @param launch the launch, or NULL for the shell's.
+ * @param option the ulimit option (one of LAUNCH_LIMIT_OPTIONS).
+ * @param hard get the hard limit instead of the soft one.
+ * @param value set to the limit in the option's units, RLIM_INFINITY for none.
+ * @return false if the option is not one.
+ */
+bool launch_get_limit(const struct launch *launch, char option, bool hard, rlim_t *value);
+
+/**
+ * What ulimit -a calls a resource, eg. "open files".
+ *
+ * @param option the ulimit option (one of LAUNCH_LIMIT_OPTIONS).
+ * @return the description and units, NULL if the option is not one.
+ */
+const char *launch_limit_description(char option);
+
+/**
+ * The launch the commands a batch is split into get (see batch_execute): BATCH_PIN is the CPU list,
+ * BATCH_NICE the nice adjustment and BATCH_IONICE the I/O class, on top of the command's own launch.
+ * A value that does not parse is ignored.
+ *
+ * @param env the posix environment.
+ * @param variables the shell variables, or NULL.
+ * @param base the command's launch, or NULL.
+ * @param launch set to the base with the defaults.
+ * @return true if any of them are set.
+ */
+bool launch_defaults(const struct dc_posix_env *env, struct variables *variables, const struct launch *base,
+                     struct launch *launch);
+
+/**
+ * Apply the launch to the calling process, in the child before the exec. The CPUs and I/O class can only
+ * be set on Linux, elsewhere they fail with ENOSYS. The limits are set with setrlimit, a hard limit lower
+ * than the soft one lowers that too.
+ *
+ * @param launch the launch.
+ * @param errstream where a failure is displayed.
+ * @return false if one of them could not be set.
+ */
+bool launch_apply(const struct launch *launch, FILE *errstream);
+
+#endif // DC_SHELL_LAUNCH_H
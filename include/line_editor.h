@@ -0,0 +1,150 @@
+#ifndef DC_SHELL_LINE_EDITOR_H
+#define DC_SHELL_LINE_EDITOR_H
+
+/*
+ * This file is part of dc_shell.
+ *
+ *  dc_shell is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Foobar is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dc_shell.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "history.h"
+#include <dc_posix/dc_posix_env.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <termios.h>
+
+/**
+ * Find the possible completions for the word line[word_start, cursor).
+ * Each completion is the whole word, not just the part still to be typed.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param line the line being edited.
+ * @param word_start the index of the first character of the word.
+ * @param cursor the index just past the last character of the word.
+ * @param count set to the number of completions.
+ * @param data the completion_data given to the editor.
+ * @return a sorted, NULL terminated, array of completions (free with line_editor_free_completions).
+ */
+typedef char **(*line_editor_completer)(const struct dc_posix_env *env, struct dc_error *err, const char *line,
+                                        size_t word_start, size_t cursor, size_t *count, void *data);
+
+/*! \struct line_editor
+    \brief A raw mode line editor with history and completion.
+
+    Input is processed a read() worth at a time and the terminal is only updated once per read,
+    so pasting a long line costs a single redraw.
+*/
+struct line_editor
+{
+    int in_fd;                          /**< the terminal to read keys from */
+    int out_fd;                         /**< the terminal to echo to */
+    struct termios original;            /**< the terminal settings to restore */
+    bool raw;                           /**< is the terminal currently in raw mode (true = raw) */
+    struct history *history;            /**< the lines available to up/down */
+    line_editor_completer completer;    /**< called when tab is pressed, may be NULL */
+    void *completion_data;              /**< passed to the completer */
+    const char *prompt;                 /**< the prompt that is on the screen, for full redraws */
+    size_t prompt_columns;              /**< the number of columns the prompt takes up */
+    size_t columns;                     /**< the terminal width */
+    char *line;                         /**< the line being edited (not NUL terminated while editing) */
+    size_t length;                      /**< the number of bytes in line */
+    size_t capacity;                    /**< the size of the line buffer */
+    size_t cursor;                      /**< the index in line of the cursor */
+    size_t shown_length;                /**< the number of bytes of line currently on the screen */
+    size_t shown_cursor;                /**< where the terminal cursor currently is */
+    size_t dirty;                       /**< the first index in line that differs from the screen */
+    char *output;                       /**< terminal output waiting to be written */
+    size_t output_length;               /**< the number of bytes in output */
+    size_t output_capacity;             /**< the size of the output buffer */
+    char input[4096];                   /**< bytes read but not yet processed */
+    size_t input_start;                 /**< the first unprocessed byte in input */
+    size_t input_length;                /**< the index just past the last unprocessed byte in input */
+    bool pasting;                       /**< inside a bracketed paste (true = insert everything literally) */
+    size_t history_age;                 /**< the history entry being shown (0 = the line being typed) */
+    char *saved_line;                   /**< the line being typed when history browsing started */
+    bool tab_pending;                   /**< was the last key a tab that could not extend the word */
+};
+
+/**
+ * Create a line editor.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param in_fd the file descriptor to read keys from.
+ * @param out_fd the file descriptor to echo to.
+ * @param history the lines to recall with up/down (not owned by the editor), may be NULL.
+ * @return the editor.
+ */
+struct line_editor *line_editor_create(const struct dc_posix_env *env, struct dc_error *err, int in_fd, int out_fd,
+                                       struct history *history);
+
+/**
+ * Free the editor, restoring the terminal if needed, and set the pointer to NULL.
+ *
+ * @param env the posix environment.
+ * @param peditor the editor to destroy.
+ */
+void line_editor_destroy(const struct dc_posix_env *env, struct line_editor **peditor);
+
+/**
+ * Set the function to call when tab is pressed.
+ *
+ * @param editor the editor.
+ * @param completer the function to find completions, NULL to turn completion off.
+ * @param data passed to the completer.
+ */
+void line_editor_set_completer(struct line_editor *editor, line_editor_completer completer, void *data);
+
+/**
+ * Read a line, letting the user edit it. The prompt must already be displayed,
+ * it is only used to redraw the line. If in_fd is a terminal it is put in raw mode
+ * (with bracketed paste on) for the duration of the call.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param editor the editor.
+ * @param prompt the prompt that was displayed.
+ * @param line_size set to the length of the line.
+ * @return the line (without the newline) or NULL at end of file.
+ */
+char *line_editor_read(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor,
+                       const char *prompt, size_t *line_size);
+
+/**
+ * Free the array returned by a completer.
+ *
+ * @param env the posix environment.
+ * @param completions the completions.
+ * @param count the number of completions.
+ */
+void line_editor_free_completions(const struct dc_posix_env *env, char **completions, size_t count);
+
+/**
+ * Complete a command name (from the path) or a file name (from the file system).
+ * data must be the NULL terminated array of directories to search for commands.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param line the line being edited.
+ * @param word_start the index of the first character of the word.
+ * @param cursor the index just past the last character of the word.
+ * @param count set to the number of completions.
+ * @param data a char *** pointing at the directories in the PATH.
+ * @return a sorted, NULL terminated, array of completions.
+ */
+char **complete_command_or_file(const struct dc_posix_env *env, struct dc_error *err, const char *line,
+                                size_t word_start, size_t cursor, size_t *count, void *data);
+
+#endif // DC_SHELL_LINE_EDITOR_H
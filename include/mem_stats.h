@@ -0,0 +1,156 @@
+#ifndef DC_SHELL_MEM_STATS_H
+#define DC_SHELL_MEM_STATS_H
+
+/*
+ * This file is part of dc_shell.
+ *
+ *  dc_shell is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Foobar is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dc_shell.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+
+#include <dc_posix/dc_posix_env.h>
+#include <dc_posix/dc_stdlib.h>
+#include <dc_posix/dc_string.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/*
+ * Every allocation the shell makes goes through one of these, so it can be counted by the line it is made
+ * on. The dc_posix headers are included first so that their prototypes are not renamed too.
+ */
+#define dc_malloc(env, err, size) mem_stats_malloc(env, err, size, __FILE__, __LINE__)
+#define dc_calloc(env, err, nelem, elsize) mem_stats_calloc(env, err, nelem, elsize, __FILE__, __LINE__)
+#define dc_realloc(env, err, ptr, size) mem_stats_realloc(env, err, ptr, size, __FILE__, __LINE__)
+#define dc_strdup(env, err, s) mem_stats_strdup(env, err, s, __FILE__, __LINE__)
+#define dc_strndup(env, err, s, size) mem_stats_strndup(env, err, s, size, __FILE__, __LINE__)
+#define dc_free(env, ptr, size) mem_stats_free(env, ptr, size, __FILE__, __LINE__)
+
+/**
+ * Start counting the memory the shell allocates (--mem-stats): the bytes and blocks live, and their peak,
+ * by the line they were allocated on and by the state the shell was in. Frees are checked against the size
+ * that was allocated. Until it is started the functions below only call their dc_posix function. There is
+ * one count per shell process, so it is kept here rather than in the state.
+ */
+void mem_stats_enable(void);
+
+/**
+ * Stop counting and forget what was counted.
+ */
+void mem_stats_disable(void);
+
+/**
+ * Is the memory being counted.
+ *
+ * @return true if mem_stats_enable was called.
+ */
+bool mem_stats_enabled(void);
+
+/**
+ * Set the state of the shell that the allocations from now on are counted under.
+ *
+ * @param name the state (eg. "EXECUTE_COMMANDS"), it is kept.
+ */
+void mem_stats_state(const char *name);
+
+/**
+ * Write what has been counted: the peak, the allocations by state, the lines that allocate the most, the
+ * frees given the wrong size, and the blocks still live (the leaks, once the shell has cleaned up). Only the
+ * process that started counting writes it.
+ *
+ * @param stream where to write it.
+ */
+void mem_stats_report(FILE *stream);
+
+/**
+ * dc_malloc, counted.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param size the bytes.
+ * @param file_name the file it is called from.
+ * @param line_number the line it is called from.
+ * @return the memory, or NULL.
+ */
+void *mem_stats_malloc(const struct dc_posix_env *env, struct dc_error *err, size_t size, const char *file_name,
+                       size_t line_number);
+
+/**
+ * dc_calloc, counted.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param nelem the number of elements.
+ * @param elsize the size of each.
+ * @param file_name the file it is called from.
+ * @param line_number the line it is called from.
+ * @return the memory, or NULL.
+ */
+void *mem_stats_calloc(const struct dc_posix_env *env, struct dc_error *err, size_t nelem, size_t elsize,
+                       const char *file_name, size_t line_number);
+
+/**
+ * dc_realloc, counted.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param ptr the memory, or NULL.
+ * @param size the new size.
+ * @param file_name the file it is called from.
+ * @param line_number the line it is called from.
+ * @return the memory, or NULL (ptr is left alone).
+ */
+void *mem_stats_realloc(const struct dc_posix_env *env, struct dc_error *err, void *ptr, size_t size,
+                        const char *file_name, size_t line_number);
+
+/**
+ * dc_strdup, counted.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param s the string.
+ * @param file_name the file it is called from.
+ * @param line_number the line it is called from.
+ * @return the copy, or NULL.
+ */
+char *mem_stats_strdup(const struct dc_posix_env *env, struct dc_error *err, const char *s, const char *file_name,
+                       size_t line_number);
+
+/**
+ * dc_strndup, counted.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param s the string.
+ * @param size the most characters to copy.
+ * @param file_name the file it is called from.
+ * @param line_number the line it is called from.
+ * @return the copy, or NULL.
+ */
+char *mem_stats_strndup(const struct dc_posix_env *env, struct dc_error *err, const char *s, size_t size,
+                        const char *file_name, size_t line_number);
+
+/**
+ * dc_free, counted. A size that is not what was allocated is reported against this line.
+ *
+ * @param env the posix environment.
+ * @param ptr the memory, or NULL.
+ * @param size the size it was allocated with.
+ * @param file_name the file it is called from.
+ * @param line_number the line it is called from.
+ */
+void mem_stats_free(const struct dc_posix_env *env, void *ptr, size_t size, const char *file_name,
+                    size_t line_number);
+
+#endif // DC_SHELL_MEM_STATS_H
@@ -0,0 +1,144 @@
+#ifndef DC_SHELL_PATHNAME_H
+#define DC_SHELL_PATHNAME_H
+
+/*
+ * This file is part of dc_shell.
+ *
+ *  dc_shell is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Foobar is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dc_shell.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <dc_posix/dc_posix_env.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*! \struct directory_listing
+    \brief The names in a directory, read once and shared by every pattern that needs them.
+
+    The names are packed one after another (each NUL terminated) so a directory with a
+    lot of entries is a few allocations rather than one per entry.
+*/
+struct directory_listing
+{
+    char *path;                         /**< the directory, "" for the working directory */
+    char *names;                        /**< the NUL terminated names, packed together */
+    size_t names_length;                /**< the number of bytes used in names */
+    size_t names_capacity;              /**< the size of names */
+    size_t *offsets;                    /**< the index in names of each name */
+    unsigned char *types;               /**< the d_type of each name (DT_UNKNOWN if the file system does not say) */
+    size_t count;                       /**< the number of names */
+    size_t capacity;                    /**< the number of names offsets and types have room for */
+    struct directory_listing *next;     /**< the next listing in the same bucket */
+};
+
+/*! \struct pathname_cache
+    \brief Directory listings, keyed by directory, that live until pathname_cache_clear.
+
+    The threads expanding a ** share it, so the table is only changed with lock held.
+*/
+struct pathname_cache
+{
+    struct directory_listing **buckets; /**< the hash table */
+    size_t bucket_count;                /**< the number of buckets (a power of 2) */
+    size_t count;                       /**< the number of listings */
+    size_t thread_count;                /**< the threads ** reads directories with (0 = one per processor, 1 = no threads) */
+    pthread_mutex_t lock;               /**< held while the table is looked in or changed */
+};
+
+/**
+ * Create an empty cache, with ** using one thread per processor.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @return the cache.
+ */
+struct pathname_cache *pathname_cache_create(const struct dc_posix_env *env, struct dc_error *err);
+
+/**
+ * Free the cache and set the pointer to NULL.
+ *
+ * @param env the posix environment.
+ * @param pcache the cache to destroy.
+ */
+void pathname_cache_destroy(const struct dc_posix_env *env, struct pathname_cache **pcache);
+
+/**
+ * Forget every listing, so the directories are read again the next time they are needed.
+ *
+ * @param env the posix environment.
+ * @param cache the cache to empty.
+ */
+void pathname_cache_clear(const struct dc_posix_env *env, struct pathname_cache *cache);
+
+/**
+ * Get the names in a directory, reading it if it is not already in the cache.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param cache the cache to look in and add to.
+ * @param path the directory ("" for the working directory).
+ * @return the listing (owned by the cache) or NULL if the directory does not exist or may not be read
+ *         (other failures, such as running out of file descriptors, are raised).
+ */
+const struct directory_listing *pathname_list(const struct dc_posix_env *env, struct dc_error *err,
+                                              struct pathname_cache *cache, const char *path);
+
+/**
+ * Does a pattern contain any of the special characters * ? or [ (that are not escaped with \).
+ *
+ * @param pattern the pattern to check.
+ * @return true if the pattern needs to be expanded.
+ */
+bool pathname_has_magic(const char *pattern);
+
+/**
+ * Does a name match a pattern (see fnmatch).
+ * * matches any string, ? any character, [...] any character in the set
+ * (with ranges, [:class:] and ! or ^ to negate) and \ makes the next character literal.
+ *
+ * @param pattern the pattern.
+ * @param name the name to check.
+ * @return true if the name matches.
+ */
+bool pathname_match(const char *pattern, const char *name);
+
+/**
+ * Find the files that match a pattern. Each / separated part of the pattern is matched
+ * against one directory level, except ** which matches any number of directories, including none
+ * (a ** after a directory matches the directory, with a / on the end, as well as everything below it,
+ * a ** on its own matches everything below the working directory).
+ * Names starting with . are only matched by a part that starts with a literal dot.
+ * The directories under a ** are read in parallel (see pathname_cache thread_count), the matches are
+ * sorted so the result does not depend on which thread found what.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param cache the directory listings to use.
+ * @param pattern the pattern.
+ * @param count set to the number of matches.
+ * @return the sorted, NULL terminated, matches, or NULL if nothing matched (free with pathname_free_matches).
+ */
+char **pathname_expand(const struct dc_posix_env *env, struct dc_error *err, struct pathname_cache *cache,
+                       const char *pattern, size_t *count);
+
+/**
+ * Free the array returned by pathname_expand.
+ *
+ * @param env the posix environment.
+ * @param matches the matches.
+ * @param count the number of matches.
+ */
+void pathname_free_matches(const struct dc_posix_env *env, char **matches, size_t count);
+
+#endif // DC_SHELL_PATHNAME_H
@@ -0,0 +1,161 @@
+#ifndef DC_SHELL_POSIX_DIRECT_H
+#define DC_SHELL_POSIX_DIRECT_H
+
+/*
+ * This file is part of dc_shell.
+ *
+ *  dc_shell is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Foobar is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dc_shell.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+
+#include <dc_error/error.h>
+#include <dc_posix/dc_posix_env.h>
+#include <dc_posix/dc_stdlib.h>
+#include <dc_posix/dc_string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Built with DC_SHELL_DIRECT_POSIX the dc_posix functions used on the hot paths (command.c, util.c and
+ * shell_impl.c) become inline calls straight to the C library. This skips the call through the library, the
+ * tracer and the error plumbing. A failure raises the same errno error the dc_posix function would,
+ * but the calls are not passed to env->tracer, so --trace does not see them. Without it (and the tests are
+ * always built without it) nothing here is defined and the instrumented functions are called.
+ *
+ * The allocations are left to mem_stats.h, which calls the posix_direct_ ones below when this is on.
+ * Like mem_stats.h, the dc_posix headers are included first so that their prototypes are not renamed.
+ */
+#ifdef DC_SHELL_DIRECT_POSIX
+
+static inline void *posix_direct_malloc(const struct dc_posix_env *env, struct dc_error *err, size_t size) {
+    void *ptr;
+
+    (void) env;
+    ptr = malloc(size);
+
+    if(ptr == NULL)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+
+    return ptr;
+}
+
+static inline void *posix_direct_calloc(const struct dc_posix_env *env, struct dc_error *err, size_t nelem,
+                                        size_t elsize) {
+    void *ptr;
+
+    (void) env;
+    ptr = calloc(nelem, elsize);
+
+    if(ptr == NULL)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+
+    return ptr;
+}
+
+static inline void *posix_direct_realloc(const struct dc_posix_env *env, struct dc_error *err, void *ptr,
+                                         size_t size) {
+    void *moved;
+
+    (void) env;
+    moved = realloc(ptr, size);
+
+    if(moved == NULL)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+
+    return moved;
+}
+
+static inline char *posix_direct_strdup(const struct dc_posix_env *env, struct dc_error *err, const char *s) {
+    char *copy;
+
+    (void) env;
+    copy = strdup(s);
+
+    if(copy == NULL)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+
+    return copy;
+}
+
+static inline char *posix_direct_strndup(const struct dc_posix_env *env, struct dc_error *err, const char *s,
+                                         size_t size) {
+    char *copy;
+
+    (void) env;
+    copy = strndup(s, size);
+
+    if(copy == NULL)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+
+    return copy;
+}
+
+static inline void posix_direct_free(const struct dc_posix_env *env, void *ptr, size_t size) {
+    (void) env;
+    (void) size;
+    free(ptr);
+}
+
+static inline size_t posix_direct_strlen(const struct dc_posix_env *env, const char *s) {
+    (void) env;
+
+    return strlen(s);
+}
+
+static inline int posix_direct_strcmp(const struct dc_posix_env *env, const char *s1, const char *s2) {
+    (void) env;
+
+    return strcmp(s1, s2);
+}
+
+static inline char *posix_direct_strtok_r(const struct dc_posix_env *env, char *s, const char *sep,
+                                          char **state) {
+    (void) env;
+
+    return strtok_r(s, sep, state);
+}
+
+static inline void *posix_direct_memset(const struct dc_posix_env *env, void *s, int c, size_t n) {
+    (void) env;
+
+    return memset(s, c, n);
+}
+
+static inline char *posix_direct_getenv(const struct dc_posix_env *env, const char *name) {
+    (void) env;
+
+    return getenv(name);
+}
+
+#define dc_strlen(env, s) posix_direct_strlen(env, s)
+#define dc_strcmp(env, s1, s2) posix_direct_strcmp(env, s1, s2)
+#define dc_strtok_r(env, s, sep, state) posix_direct_strtok_r(env, s, sep, state)
+#define dc_memset(env, s, c, n) posix_direct_memset(env, s, c, n)
+#define dc_getenv(env, name) posix_direct_getenv(env, name)
+
+#endif
+
+#endif // DC_SHELL_POSIX_DIRECT_H
@@ -0,0 +1,66 @@
+#ifndef DC_SHELL_SCAN_H
+#define DC_SHELL_SCAN_H
+
+/*
+ * This file is part of dc_shell.
+ *
+ *  dc_shell is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Foobar is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dc_shell.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// how far scan_special goes a byte at a time before the vectors, they only pay off on longer words (see scan_bench)
+#ifndef SCAN_VECTOR_AFTER
+#define SCAN_VECTOR_AFTER 32
+#endif
+
+/*! \enum scan_kind
+    \brief The ways scan_special can look at the line.
+*/
+enum scan_kind
+{
+    SCAN_SCALAR, /**< a byte at a time, everywhere */
+    SCAN_SSE2,   /**< 16 bytes at a time */
+    SCAN_AVX2,   /**< 32 bytes at a time */
+};
+
+/**
+ * Find the next character the tokenizer has to look at: a blank (space, tab or newline), a quote, \, $,
+ * an operator (| & ; < > ( or )) or the '\0' at the end of the line. Everything before it is an ordinary
+ * part of a word. The first SCAN_VECTOR_AFTER bytes are looked at one at a time, on x86 the rest of a longer
+ * word is read 16 or 32 bytes at a time, the widest the CPU has (found with cpuid the first time it is called).
+ *
+ * @param line the line.
+ * @param i the index to start at.
+ * @return the index of the character, i if line[i] is one.
+ */
+size_t scan_special(const char *line, size_t i);
+
+/**
+ * The way scan_special looks at the line.
+ *
+ * @return the kind being used.
+ */
+enum scan_kind scan_get_kind(void);
+
+/**
+ * Change the way scan_special looks at the line (for the tests and to compare them).
+ *
+ * @param kind the kind to use.
+ * @return false (and nothing is changed) if this CPU or build does not have it.
+ */
+bool scan_set_kind(enum scan_kind kind);
+
+#endif // DC_SHELL_SCAN_H
@@ -0,0 +1,186 @@
+#ifndef DC_SHELL_SCRIPT_H
+#define DC_SHELL_SCRIPT_H
+
+/*
+ * This file is part of dc_shell.
+ *
+ *  dc_shell is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Foobar is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dc_shell.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "command.h"
+#include "state.h"
+#include <dc_posix/dc_posix_env.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct arith_cache;
+struct source_cache;
+
+/*! \enum script_type
+    \brief The kinds of node in a parsed script.
+*/
+enum script_type
+{
+    SCRIPT_COMMAND,     /**< a simple command */
+    SCRIPT_LIST,        /**< commands run one after another */
+    SCRIPT_IF,          /**< if condition; then body; else otherwise; fi - an elif is an if in the otherwise */
+    SCRIPT_WHILE,       /**< while condition; do body; done */
+    SCRIPT_UNTIL,       /**< until condition; do body; done */
+    SCRIPT_FOR,         /**< for name in words; do body; done */
+    SCRIPT_CASE,        /**< case words[0] in children esac */
+    SCRIPT_CASE_ITEM,   /**< words) body ;; - the words are the patterns */
+    SCRIPT_FUNCTION,    /**< name() body */
+};
+
+/*! \enum script_flow
+    \brief What to do after running a node.
+*/
+enum script_flow
+{
+    SCRIPT_NEXT,        /**< carry on with the next command */
+    SCRIPT_BREAK,       /**< leave the enclosing loop(s) */
+    SCRIPT_CONTINUE,    /**< start the next iteration of the enclosing loop(s) */
+    SCRIPT_RETURN,      /**< leave the function */
+    SCRIPT_EXIT,        /**< the exit builtin was run */
+    SCRIPT_STOP,        /**< an error that stops the whole line */
+};
+
+/*! \struct script_node
+    \brief A node of a parsed script. The script is parsed once and the nodes are run as many times as needed,
+    so a loop body is never split into words again, only expanded.
+*/
+struct script_node
+{
+    enum script_type type;          /**< what the node is */
+    struct command *command;        /**< SCRIPT_COMMAND: the line and redirections (see split_command) */
+    char **words;                   /**< the words as written: the command, the for list, the case word or patterns */
+    size_t word_count;              /**< the number of words */
+    char *name;                     /**< the for variable or function name */
+    struct script_node *condition;  /**< the if, while or until condition */
+    struct script_node *body;       /**< the then part, the loop or function body or the case item commands */
+    struct script_node *otherwise;  /**< the else part of an if, or NULL */
+    struct script_node **children;  /**< the commands of a list or the items of a case */
+    size_t child_count;             /**< the number of children */
+    size_t references;              /**< the number of owners - a function body is shared with its definition */
+};
+
+/*! \struct script_function
+    \brief A defined function.
+*/
+struct script_function
+{
+    char *name;                     /**< the function name */
+    struct script_node *body;       /**< the commands to run (a reference to the node in the definition) */
+};
+
+/*! \struct script_context
+    \brief What is being run: the functions that have been defined and how deep in loops and functions it is.
+*/
+struct script_context
+{
+    struct script_function *functions;  /**< the functions, in the order they were defined */
+    size_t function_count;              /**< the number of functions */
+    size_t function_capacity;           /**< the number of functions there is room for */
+    size_t loop_depth;                  /**< the number of loops being run in the current function */
+    size_t function_depth;              /**< the number of function calls being run */
+    size_t levels;                      /**< the number of loops a break or continue still has to leave */
+    struct source_cache *sources;       /**< the scripts run by source, parsed once per change to the file */
+    struct arith_cache *arithmetic;     /**< the $(( )) and let expressions, parsed once per session */
+};
+
+/**
+ * Create the context for running scripts, with no functions and nothing sourced.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @return the context (free with script_context_destroy).
+ */
+struct script_context *script_context_create(const struct dc_posix_env *env, struct dc_error *err);
+
+/**
+ * Free the context and the functions in it and set it to NULL.
+ *
+ * @param env the posix environment.
+ * @param pcontext the context to destroy.
+ */
+void script_context_destroy(const struct dc_posix_env *env, struct script_context **pcontext);
+
+/**
+ * Find a function.
+ *
+ * @param context the context.
+ * @param name the function name.
+ * @return the function, or NULL if there is no function with that name.
+ */
+struct script_function *script_find_function(const struct script_context *context, const char *name);
+
+/**
+ * Parse a script: simple commands separated by ; or newlines, if, while, until, for, case, { }
+ * groups and function definitions. A # at the start of a word starts a comment.
+ * Each simple command is split into words now (see split_command), so running it only expands them.
+ *
+ * @param env the posix environment.
+ * @param err the error object, EINVAL for a syntax error.
+ * @param state the current state, to set the fatal_error.
+ * @param text the script.
+ * @return the script (free with script_destroy), a SCRIPT_COMMAND if it is only one command.
+ */
+struct script_node *script_parse(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                 const char *text);
+
+/**
+ * Is a script all there, or does it need more lines (eg. a while without its done, or an unterminated quote).
+ *
+ * @param env the posix environment.
+ * @param text the script so far.
+ * @return false if more lines could finish it, true if it is finished or has a syntax error more lines won't fix.
+ */
+bool script_is_complete(const struct dc_posix_env *env, const char *text);
+
+/**
+ * Free a script (or a reference to it) and set it to NULL.
+ *
+ * @param env the posix environment.
+ * @param pnode the script to destroy.
+ */
+void script_destroy(const struct dc_posix_env *env, struct script_node **pnode);
+
+/**
+ * Run a script. The state->command is used for each simple command and the state->exit_code is set as they run.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param state the current state.
+ * @param node the script to run.
+ * @return SCRIPT_NEXT, SCRIPT_EXIT if the exit builtin was run or SCRIPT_STOP if there was an error.
+ */
+enum script_flow script_execute(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                struct script_node *node);
+
+/**
+ * Run a parsed simple command: break, continue and return change what runs next, a function is called
+ * with the arguments as its positional parameters, source (or .) runs a file (see source_cache_load),
+ * anything else is run by run_command.
+ * The command->exit_code and state->exit_code are set.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param state the current state.
+ * @param command the command to run.
+ * @return what to run next.
+ */
+enum script_flow script_run_command(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                    struct command *command);
+
+#endif // DC_SHELL_SCRIPT_H
@@ -41,6 +41,71 @@ enum shell_states
   DESTROY_STATE,                  /**< destroy the state */             // 10
 };
 
+/**
+ * One past the highest state, the size of each side of the dispatch table.
+ */
+#define SHELL_STATE_COUNT (DESTROY_STATE + 1)
+
+/**
+ * The shell's transitions, each as TRANSITION(from, to, perform).
+ *
+ * Both the dc_fsm_run table and the direct dispatch table are made from this list, so there is only one place
+ * to change when a state is added.
+ */
+#define SHELL_TRANSITIONS(TRANSITION)                               \
+    TRANSITION(DC_FSM_INIT, INIT_STATE, init_state)                 \
+    TRANSITION(INIT_STATE, READ_COMMANDS, read_commands)            \
+    TRANSITION(INIT_STATE, ERROR, handle_error)                     \
+    TRANSITION(READ_COMMANDS, RESET_STATE, reset_state)             \
+    TRANSITION(READ_COMMANDS, SEPARATE_COMMANDS, separate_commands) \
+    TRANSITION(READ_COMMANDS, EXIT, do_exit)                        \
+    TRANSITION(READ_COMMANDS, ERROR, handle_error)                  \
+    TRANSITION(SEPARATE_COMMANDS, PARSE_COMMANDS, parse_commands)   \
+    TRANSITION(SEPARATE_COMMANDS, ERROR, handle_error)              \
+    TRANSITION(PARSE_COMMANDS, EXECUTE_COMMANDS, execute_commands)  \
+    TRANSITION(PARSE_COMMANDS, ERROR, handle_error)                 \
+    TRANSITION(EXECUTE_COMMANDS, RESET_STATE, reset_state)          \
+    TRANSITION(EXECUTE_COMMANDS, EXIT, do_exit)                     \
+    TRANSITION(EXECUTE_COMMANDS, ERROR, handle_error)               \
+    TRANSITION(RESET_STATE, READ_COMMANDS, read_commands)           \
+    TRANSITION(EXIT, DESTROY_STATE, destroy_state)                  \
+    TRANSITION(ERROR, RESET_STATE, reset_state)                     \
+    TRANSITION(ERROR, DESTROY_STATE, destroy_state)                 \
+    TRANSITION(DESTROY_STATE, DC_FSM_EXIT, NULL)
+
+/**
+ * A function run on a transition, returning the state to go to next.
+ */
+typedef int (*shell_perform)(const struct dc_posix_env *env, struct dc_error *err, void *arg);
+
+/**
+ * Look up the function for a transition in the direct dispatch table.
+ *
+ * @param from_state the state being left.
+ * @param to_state the state being entered.
+ *
+ * @return the function, or NULL if there is no such transition (or it is the one to DC_FSM_EXIT).
+ */
+shell_perform shell_transition(int from_state, int to_state);
+
+/**
+ * Run the states from a [from][to] table of functions the way dc_fsm_run runs a list of transitions: starting
+ * with the one from DC_FSM_INIT to start_state and stopping when a function returns DC_FSM_EXIT.
+ * run_shell uses it on the shell's own table when built with DC_SHELL_DIRECT_DISPATCH.
+ *
+ * @param env the posix environment.
+ * @param err the error object, passed to the functions.
+ * @param table the functions, NULL where there is no transition.
+ * @param start_state the state to go to from DC_FSM_INIT.
+ * @param from_state set to the last state left.
+ * @param to_state set to the last state entered (DC_FSM_EXIT unless there was no transition to it).
+ * @param arg passed to the functions.
+ * @return 0, or -1 if there is no transition from from_state to to_state (what dc_fsm_run returns).
+ */
+int shell_dispatch_run(const struct dc_posix_env *env, struct dc_error *err,
+                       const shell_perform table[][SHELL_STATE_COUNT], int start_state, int *from_state,
+                       int *to_state, void *arg);
+
 /**
  * Run the shell FSM.
  *
@@ -50,7 +115,7 @@ enum shell_states
  * @param out the keyboard (stdout) file
  * @param err the keyboard (stderr) file
  *
- * @return the exit code from the shell.
+ * @return the exit code from the shell, not 0 if an error ended it (see handle_error).
  */
 int run_shell(const struct dc_posix_env *env, struct dc_error *error, FILE *in, FILE *out, FILE *err);
 
@@ -23,12 +23,10 @@
 
 /**
  * Set up the initial state:
- *  - in_redirect_regex  "[ \t\f\v]<.*"
- *  - out_redirect_regex "[ \t\f\v][1^2]?>[>]?.*"
- *  - err_redirect_regex "[ \t\f\v]2>[>]?.*"
  *  - path the PATH environ var separated into directories
  *  - prompt the PS1 environ var or "$" if PS1 not set
  *  - max_line_length the value of _SC_ARG_MAX (see sysconf)
+ *  - variables the environment, with PATH and PS1 changes updating path and prompt
  *
  * @param env the posix environment.
  * @param err the error object
@@ -50,6 +48,7 @@ int destroy_state(const struct dc_posix_env *env, struct dc_error *err,
 
 /**
  * Reset the state for the next read (see do_reset_state).
+ * The path, prompt, variables, history, editor and functions are kept for the whole session.
  *
  * @param env the posix environment.
  * @param err the error object
@@ -61,19 +60,23 @@ int reset_state(const struct dc_posix_env *env, struct dc_error *err,
 
 /**
  * Prompt the user and read the command line (see read_command_line).
+ * When stdin is a terminal the line is read with the line editor (see line_editor_read) instead.
+ * If the line starts a script that isn't finished (eg. a while without its done) the next lines are
+ * read with the PS2 prompt and joined with newlines.
  * Sets the state->current_line and current_line_length.
  *
  * @param env the posix environment.
  * @param err the error object
  * @param arg the current struct state
- * @return SEPARATE_COMMANDS
+ * @return SEPARATE_COMMANDS, RESET_STATE (empty line) or EXIT (end of file)
  */
 int read_commands(const struct dc_posix_env *env, struct dc_error *err,
                   void *arg);
 
 /**
- * Separate the commands. In the current implementation there is only one command.
- * Sets the state->command.
+ * Separate the commands (see script_parse).
+ * Sets the state->command. If the line is more than one simple command (a list, loop, if, case or function)
+ * the parsed script is set in state->script and state->command is used for each command as it runs.
  *
  * @param env the posix environment.
  * @param err the error object
@@ -84,7 +87,7 @@ int separate_commands(const struct dc_posix_env *env, struct dc_error *err,
                       void *arg);
 
 /**
- * Parse the commands (see parse_command)
+ * Parse the commands (see parse_command), unless the line is a script.
  *
  * @param env the posix environment.
  * @param err the error object
@@ -96,17 +99,35 @@ int parse_commands(const struct dc_posix_env *env, struct dc_error *err,
 
 
 /**
- * Run the command (see execute).
- * If the command->command is cd run builtin_cd
+ * Run the command, or the script if the line is one (see script_execute and run_command).
+ * The exit code of the line (the last command run) is displayed.
+ * If there is an audit log (see audit_open) the line, how long it took and what its children used is recorded.
  *
  * @param env the posix environment.
  * @param err the error object
  * @param arg the current struct state
- * @return EXIT (if command->command is exit), RESET_STATE or EXECUTE_ERROR
+ * @return EXIT (if the exit builtin was run), RESET_STATE or EXECUTE_ERROR
  */
 int execute_commands(const struct dc_posix_env *env, struct dc_error *err,
                      void *arg);
 
+/**
+ * Run a simple command.
+ * If the command->command is :, cd, export, false, let, readonly, true, unset or xargs run the builtin.
+ * echo and pwd are builtins too, unless they are redirected.
+ * If there is no command->command the assignments set shell variables.
+ * If ARGBATCH is set to a number and the expanded pathnames do not fit in max_line_length the command
+ * is run as many times as it takes, ARGBATCH at a time (0 for one per processor), like xargs.
+ * Otherwise the program is run (see execute).
+ *
+ * @param env the posix environment.
+ * @param err the error object
+ * @param state the current state
+ * @param command the command to run
+ * @return true if the command is exit
+ */
+bool run_command(const struct dc_posix_env *env, struct dc_error *err, struct state *state, struct command *command);
+
 
 /**
  * Handle the exit command (see do_reset_state)
@@ -124,7 +145,8 @@ int do_exit(const struct dc_posix_env *env, struct dc_error *err, void *arg);
  * @param env the posix environment.
  * @param err the error object
  * @param arg the current struct state
- * @return RESET_STATE or DESTROY_STATE (if state->fatal_error is true)
+ * @return RESET_STATE or DESTROY_STATE (if state->fatal_error is true, the shell's exit_status is then the
+ *         state->exit_code, or EXIT_FAILURE if that is 0)
  */
 int handle_error(const struct dc_posix_env *env, struct dc_error *err,
                  void *arg);
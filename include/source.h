@@ -0,0 +1,133 @@
+#ifndef DC_SHELL_SOURCE_H
+#define DC_SHELL_SOURCE_H
+
+/*
+ * This file is part of dc_shell.
+ *
+ *  dc_shell is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Foobar is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dc_shell.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "script.h"
+#include "state.h"
+#include <dc_posix/dc_posix_env.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*! \struct source_key
+    \brief What a parsed script was parsed from: if any of it changes the script has to be parsed again.
+*/
+struct source_key
+{
+    uint64_t device;            /**< the st_dev of the file */
+    uint64_t inode;             /**< the st_ino of the file */
+    int64_t mtime_seconds;      /**< the st_mtim.tv_sec of the file */
+    int64_t mtime_nanoseconds;  /**< the st_mtim.tv_nsec of the file */
+    int64_t size;               /**< the st_size of the file */
+};
+
+/*! \struct source_entry
+    \brief A parsed script and the file it came from.
+*/
+struct source_entry
+{
+    char *path;                 /**< the real path of the file */
+    struct source_key key;      /**< the file when it was parsed */
+    struct script_node *script; /**< the parsed script (a reference) */
+};
+
+/*! \struct source_cache
+    \brief The scripts that have been sourced, kept in memory for the whole session and optionally on disk.
+*/
+struct source_cache
+{
+    struct source_entry *entries;   /**< the scripts, in the order they were first sourced */
+    size_t count;                   /**< the number of scripts */
+    size_t capacity;                /**< the number of scripts there is room for */
+    size_t hits;                    /**< the number of loads that found the script in memory */
+    size_t disk_hits;               /**< the number of loads that read the script from the disk cache */
+    size_t misses;                  /**< the number of loads that had to parse the file */
+};
+
+/**
+ * Create an empty cache.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @return the cache (free with source_cache_destroy).
+ */
+struct source_cache *source_cache_create(const struct dc_posix_env *env, struct dc_error *err);
+
+/**
+ * Free the cache and the scripts in it and set it to NULL.
+ *
+ * @param env the posix environment.
+ * @param pcache the cache to destroy.
+ */
+void source_cache_destroy(const struct dc_posix_env *env, struct source_cache **pcache);
+
+/**
+ * Get the parsed script in a file. The file is only read and parsed if it has changed (see source_key)
+ * since it was last parsed, by this shell or, when directory is not NULL, by any shell sharing the directory.
+ *
+ * @param env the posix environment.
+ * @param err the error object, with the errno if the file can't be read or EINVAL for a syntax error.
+ * @param cache the cache.
+ * @param state the current state, for parsing the script.
+ * @param path the file.
+ * @param directory where parsed scripts are saved, or NULL to only keep them in memory.
+ * @return the script (release it with script_destroy), NULL on error.
+ */
+struct script_node *source_cache_load(const struct dc_posix_env *env, struct dc_error *err,
+                                      struct source_cache *cache, struct state *state, const char *path,
+                                      const char *directory);
+
+/**
+ * Get the directory parsed scripts are saved in: $XDG_CACHE_HOME/dcshell or ~/.cache/dcshell.
+ * SOURCECACHE=memory keeps them in memory only.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param state the current state, for the variables.
+ * @return the directory (free with dc_free), NULL for none.
+ */
+char *source_cache_directory(const struct dc_posix_env *env, struct dc_error *err, struct state *state);
+
+/**
+ * Save a parsed script in the compact binary form source_cache_read reads.
+ *
+ * @param file where to write it.
+ * @param path the real path of the script.
+ * @param key the file the script was parsed from.
+ * @param script the script.
+ * @return true if it was all written.
+ */
+bool source_cache_write(FILE *file, const char *path, const struct source_key *key,
+                        const struct script_node *script);
+
+/**
+ * Read a script saved by source_cache_write, if it was saved for the same file.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param file where to read it from.
+ * @param path the real path of the script.
+ * @param key the file as it is now.
+ * @return the script (free with script_destroy), NULL if it is for a different or changed file or is damaged.
+ */
+struct script_node *source_cache_read(const struct dc_posix_env *env, struct dc_error *err, FILE *file,
+                                      const char *path, const struct source_key *key);
+
+#endif // DC_SHELL_SOURCE_H
@@ -0,0 +1,50 @@
+#ifndef DC_SHELL_STARTUP_H
+#define DC_SHELL_STARTUP_H
+
+/*
+ * This file is part of dc_shell.
+ *
+ *  dc_shell is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Foobar is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dc_shell.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+
+/**
+ * Start timing the startup, from main() to the first prompt. Nothing is reported until startup_profile_enable.
+ * There is one startup per process, so the times are kept here rather than in the state.
+ */
+void startup_profile_start(void);
+
+/**
+ * Report the phases from now on (--verbose).
+ *
+ * @param stream where to print the times.
+ */
+void startup_profile_enable(FILE *stream);
+
+/**
+ * End a phase: if reporting is enabled, print how long the phase and the whole startup so far took.
+ *
+ * @param phase the name of the phase that just ended.
+ */
+void startup_profile_phase(const char *phase);
+
+/**
+ * End the last phase (the first prompt is up) and stop reporting: later calls do nothing.
+ *
+ * @param phase the name of the phase that just ended.
+ */
+void startup_profile_finish(const char *phase);
+
+#endif // DC_SHELL_STARTUP_H
@@ -18,12 +18,18 @@
  *  along with dc_shell.  If not, see <https://www.gnu.org/licenses/>.
  */
 
-#include <regex.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <dc_posix/dc_posix_env.h>
+#include "launch.h"
 
 struct command;
+struct history;
+struct line_editor;
+struct pathname_cache;
+struct script_context;
+struct script_node;
+struct variables;
 
 /*! \struct state
     \brief The current FSM state.
@@ -35,9 +41,6 @@ struct state
   FILE *stdin;                  /** stream to read commands from */
   FILE *stdout;                 /** stream to print the prompt to */
   FILE *stderr;                 /** stream to print error messages to */
-  regex_t *in_redirect_regex;   /**< stdin regex */
-  regex_t *out_redirect_regex;  /**< stdout regex */
-  regex_t *err_redirect_regex;  /**< stderr regex */
   char **path;                  /**< PATH environ var broken up */
   char *prompt;                 /**< Prompt to display before a command is entered */
   size_t max_line_length;       /**< the largest possible line */
@@ -45,6 +48,19 @@ struct state
   size_t current_line_length;   /**< the length of the most recently line */
   struct command *command;      /**< the commands to execute - currently only one */
   bool fatal_error;             /**< should the error terminate the shell (true = terminate) */
+  bool interactive;             /**< is stdin a terminal, then a command that fails never ends the shell */
+  int exit_status;              /**< what run_shell returns, not 0 if the shell was ended by an error */
+  struct history *history;      /**< the lines entered so far, kept across resets */
+  struct line_editor *editor;   /**< the editor used when stdin is a terminal, kept across resets */
+  struct variables *variables;  /**< the shell variables, kept across resets */
+  struct pathname_cache *pathname_cache; /**< the directories read for pathname expansion, cleared on reset */
+  int exit_code;                /**< the exit code of the last command ($?) */
+  struct script_node *script;   /**< the parsed line when it is more than one simple command, NULL otherwise */
+  bool last_line;               /**< is the line being run the last one of a script file (see run_command) */
+  struct script_context *script_context; /**< the functions and loops being run, kept across resets */
+  char **positional;            /**< the positional parameters ($1 ...) of the function being run */
+  size_t positional_count;      /**< the number of positional parameters ($#) */
+  struct launch limits;         /**< the resource limits set with ulimit, every program is run with, kept across resets */
 };
 
 #endif // DC_SHELL_STATE_H
@@ -0,0 +1,70 @@
+#ifndef DC_SHELL_SUBSTITUTE_H
+#define DC_SHELL_SUBSTITUTE_H
+
+/*
+ * This file is part of dc_shell.
+ *
+ *  dc_shell is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Foobar is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dc_shell.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "state.h"
+#include <dc_posix/dc_posix_env.h>
+#include <stdbool.h>
+
+struct command;
+
+/**
+ * Run the commands of a command substitution ($(commands) or `commands`) and get what they wrote to
+ * their standard output, without the trailing newlines.
+ * A single echo, pwd, true, false or : is run in the shell, writing to memory. Anything else is run by
+ * the shell in a child process (so it can't change the shell's variables) with its output read through a pipe.
+ * No other shell is involved either way.
+ * The state->exit_code, and the exit_code of the state->command being expanded, are set to the exit code
+ * of the commands.
+ *
+ * @param env the posix environment.
+ * @param err the error object, EINVAL for a syntax error.
+ * @param state the current state.
+ * @param text the commands, with the $( ) or ` ` removed.
+ * @return the output (free with dc_free), NULL on error.
+ */
+char *substitute_command(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                         const char *text);
+
+/**
+ * Start the commands of a process substitution (<(commands) or >(commands)) in a child process, connected
+ * to the shell by a pipe, without waiting for them. The shell keeps its end of the pipe open, close on exec,
+ * until the state->command has run (see substitute_finish), only that command's program inherits it (see
+ * execute_start). The child closes the pipes of the command's other process substitutions.
+ *
+ * @param env the posix environment.
+ * @param err the error object, EINVAL for a syntax error.
+ * @param state the current state, state->command is the command being expanded.
+ * @param text the commands, with the <( ) or >( ) removed.
+ * @param input true for <(commands), the command reads their output, false for >(commands), it writes their input.
+ * @return the /dev/fd path of the shell's end of the pipe (free with dc_free), NULL on error.
+ */
+char *substitute_process(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                         const char *text, bool input);
+
+/**
+ * Close the shell's ends of the command's process substitution pipes and wait for their commands.
+ * A >(commands) gets to the end of its input, a <(commands) that is still writing gets SIGPIPE.
+ *
+ * @param env the posix environment.
+ * @param command the command.
+ */
+void substitute_finish(const struct dc_posix_env *env, struct command *command);
+
+#endif // DC_SHELL_SUBSTITUTE_H
@@ -0,0 +1,131 @@
+#ifndef DC_SHELL_THREAD_POOL_H
+#define DC_SHELL_THREAD_POOL_H
+
+/*
+ * This file is part of dc_shell.
+ *
+ *  dc_shell is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Foobar is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dc_shell.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <dc_posix/dc_posix_env.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct thread_pool;
+
+/**
+ * A piece of work. The err is the worker's own error object, a task that fails should
+ * leave it set, free what it owns and return (see thread_pool_cancelled).
+ *
+ * @param env the posix environment.
+ * @param err the worker's error object.
+ * @param pool the pool, to submit more tasks to.
+ * @param worker the worker running the task.
+ * @param arg the argument given to thread_pool_submit.
+ */
+typedef void (thread_pool_task)(const struct dc_posix_env *env, struct dc_error *err, struct thread_pool *pool,
+                                size_t worker, void *arg);
+
+/*! \struct thread_pool_job
+    \brief A task and its argument, waiting in a queue.
+*/
+struct thread_pool_job
+{
+    thread_pool_task *task; /**< the function to run */
+    void *arg;              /**< the argument to pass it */
+};
+
+/*! \struct thread_pool_queue
+    \brief The jobs one worker has submitted.
+
+    The worker takes its newest job (so it works depth first and its data stays in the cache),
+    idle workers steal the oldest one (which is usually the biggest piece of work).
+*/
+struct thread_pool_queue
+{
+    pthread_mutex_t lock;           /**< held while the queue is changed */
+    struct thread_pool_job *jobs;   /**< a ring of jobs */
+    size_t first;                   /**< the index of the oldest job */
+    size_t count;                   /**< the number of jobs */
+    size_t capacity;                /**< the size of jobs */
+};
+
+/*! \struct thread_pool
+    \brief Workers that run tasks until there are none left, stealing from each other when they run out.
+*/
+struct thread_pool
+{
+    const struct dc_posix_env *env; /**< the environment the tasks are run with */
+    size_t worker_count;            /**< the number of workers, including the thread that calls thread_pool_run */
+    struct thread_pool_queue *queues; /**< one queue per worker */
+    struct dc_error *errors;        /**< one error object per worker */
+    pthread_mutex_t lock;           /**< held while pending, sleeping or submitted are changed */
+    pthread_cond_t changed;         /**< signalled when a job is submitted or the last job finishes */
+    size_t pending;                 /**< the number of jobs submitted and not yet finished */
+    size_t sleeping;                /**< the number of workers waiting for a job */
+    size_t submitted;               /**< the number of jobs ever submitted, so a sleeper can tell it missed one */
+    bool cancelled;                 /**< has a task failed (true = failed) */
+};
+
+/**
+ * Create a pool. No threads are started until thread_pool_run.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param worker_count the number of workers, 0 for one per online processor.
+ * @return the pool.
+ */
+struct thread_pool *thread_pool_create(const struct dc_posix_env *env, struct dc_error *err, size_t worker_count);
+
+/**
+ * Free the pool and set the pointer to NULL. The pool must not be running.
+ *
+ * @param env the posix environment.
+ * @param ppool the pool to destroy.
+ */
+void thread_pool_destroy(const struct dc_posix_env *env, struct thread_pool **ppool);
+
+/**
+ * Add a task to a worker's queue. Tasks submit to their own worker, before thread_pool_run use worker 0.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param pool the pool.
+ * @param worker the worker whose queue the task goes on.
+ * @param task the function to run.
+ * @param arg the argument to pass it.
+ */
+void thread_pool_submit(const struct dc_posix_env *env, struct dc_error *err, struct thread_pool *pool, size_t worker,
+                        thread_pool_task *task, void *arg);
+
+/**
+ * Run the submitted tasks, and the tasks they submit, until there are none left.
+ * The calling thread is worker 0. If a task fails its error is copied to err.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param pool the pool.
+ */
+void thread_pool_run(const struct dc_posix_env *env, struct dc_error *err, struct thread_pool *pool);
+
+/**
+ * Has a task failed. Long running tasks can check this to give up early.
+ *
+ * @param pool the pool.
+ * @return true if a task has failed.
+ */
+bool thread_pool_cancelled(struct thread_pool *pool);
+
+#endif // DC_SHELL_THREAD_POOL_H
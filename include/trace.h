@@ -0,0 +1,73 @@
+#ifndef DC_SHELL_TRACE_H
+#define DC_SHELL_TRACE_H
+
+/*
+ * This file is part of dc_shell.
+ *
+ *  dc_shell is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Foobar is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dc_shell.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+
+#include <dc_posix/dc_posix_env.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/**
+ * Start recording every dc_posix call made through an environment that has trace_record as its tracer
+ * into a compact binary file (decode it with dc_trace_decode). Each call is 16 bytes: when it was made,
+ * which function, and the line the tracer was called from. The records are kept in a ring per thread,
+ * without locks, and a full ring is written with one write. A child the shell forks traces into the same
+ * file, and writes its ring before it calls exec. There is one trace per shell process, so it is kept
+ * here rather than in the state.
+ *
+ * @param path the file, it is appended to.
+ * @return 0, or the errno if the file can't be opened.
+ */
+int trace_open(const char *path);
+
+/**
+ * The dc_posix_tracer that records a call, it does nothing unless the trace is open. The tracer is called
+ * as the function is entered, so the result is not known.
+ *
+ * @param env the posix environment.
+ * @param file_name the file the call is in.
+ * @param function_name the function called.
+ * @param line_number the line the tracer was called from.
+ */
+void trace_record(const struct dc_posix_env *env, const char *file_name, const char *function_name,
+                  size_t line_number);
+
+/**
+ * Write what the calling thread has recorded so far, and the names of the functions.
+ */
+void trace_flush(void);
+
+/**
+ * Write what every thread has recorded and close the file. The other threads must have stopped tracing.
+ */
+void trace_close(void);
+
+/**
+ * Turn a trace file into text: one line per call, in the order they were made, with the time in seconds
+ * since the trace was opened, the process and thread, the function and where the tracer was called from.
+ *
+ * @param in the trace file.
+ * @param out where the text goes.
+ * @param summary print how many times each function was called instead, the most called first.
+ * @return false if the file is not a trace.
+ */
+bool trace_decode(FILE *in, FILE *out, bool summary);
+
+#endif // DC_SHELL_TRACE_H
@@ -55,7 +55,8 @@ char **parse_path(const struct dc_posix_env *env, struct dc_error *err,
                   const char *path_str);
 
 /**
- * Reset the state for the next read, freeing any dynamically allocated memory.
+ * Reset the state for the next read, freeing the memory used by the last line.
+ * The path, prompt and max_line_length last for the whole session and are kept.
  *
  * @param env the posix environment.
  * @param err the error object
@@ -0,0 +1,229 @@
+#ifndef DC_SHELL_VARIABLES_H
+#define DC_SHELL_VARIABLES_H
+
+/*
+ * This file is part of dc_shell.
+ *
+ *  dc_shell is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Foobar is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dc_shell.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <dc_posix/dc_posix_env.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * Called after a variable is set or unset.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param name the name of the variable.
+ * @param value the new value, NULL if the variable was unset.
+ * @param data the data given to variables_set_listener.
+ */
+typedef void (*variable_listener)(const struct dc_posix_env *env, struct dc_error *err, const char *name,
+                                  const char *value, void *data);
+
+/*! \struct variable
+    \brief A shell variable.
+
+    The value lives inside entry ("name=value") so an exported variable can put entry
+    straight into the environment without copying it.
+*/
+struct variable
+{
+    char *name;             /**< the name of the variable */
+    char *entry;            /**< "name=value", NULL if the variable has no value */
+    char *value;            /**< points into entry just past the '=', NULL if the variable has no value */
+    bool exported;          /**< passed to commands (true = passed) */
+    bool readonly;          /**< can the variable be changed or unset (true = cannot) */
+    size_t env_index;       /**< the index of entry in the environment, only valid if it is in the environment */
+    struct variable *next;  /**< the next variable in the same bucket */
+};
+
+/*! \struct variables
+    \brief The shell variables, hashed by name.
+
+    The exported variables are also kept in envp, which is updated as variables change
+    so it is ready to give to execve without being rebuilt.
+*/
+struct variables
+{
+    struct variable **buckets;  /**< the hash table */
+    size_t bucket_count;        /**< the number of buckets (a power of 2) */
+    size_t count;               /**< the number of variables */
+    char **envp;                /**< the NULL terminated environment for commands */
+    struct variable **owners;   /**< the variable that owns each envp entry, NULL for one that is not a variable */
+    size_t env_count;           /**< the number of entries in envp */
+    size_t env_capacity;        /**< the number of entries (including the NULL) envp has room for */
+    variable_listener listener; /**< called when a variable changes, may be NULL */
+    void *listener_data;        /**< passed to the listener */
+};
+
+/*! \enum variables_filter
+    \brief Which variables variables_print displays.
+*/
+enum variables_filter
+{
+    VARIABLES_EXPORTED, /**< the exported variables */
+    VARIABLES_READONLY, /**< the readonly variables */
+};
+
+/**
+ * Create an empty set of variables.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @return the variables.
+ */
+struct variables *variables_create(const struct dc_posix_env *env, struct dc_error *err);
+
+/**
+ * Free the variables and set the pointer to NULL.
+ *
+ * @param env the posix environment.
+ * @param pvariables the variables to destroy.
+ */
+void variables_destroy(const struct dc_posix_env *env, struct variables **pvariables);
+
+/**
+ * Add each "name=value" string in an environment as an exported variable. An entry whose name is not a valid
+ * one (eg. a-b=1) can't be a variable, but it is kept in the envp, so the programs run still get it.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param variables the variables to add to.
+ * @param environment the NULL terminated environment (eg. environ).
+ */
+void variables_import(const struct dc_posix_env *env, struct dc_error *err, struct variables *variables,
+                      char **environment);
+
+/**
+ * Set the function to call after a variable changes.
+ *
+ * @param variables the variables.
+ * @param listener the function to call, or NULL for none.
+ * @param data passed to the listener.
+ */
+void variables_set_listener(struct variables *variables, variable_listener listener, void *data);
+
+/**
+ * Get the value of a variable.
+ *
+ * @param env the posix environment.
+ * @param variables the variables to look in.
+ * @param name the name of the variable.
+ * @return the value, or NULL if the variable is not set.
+ */
+const char *variables_get(const struct dc_posix_env *env, const struct variables *variables, const char *name);
+
+/**
+ * Set the value of a variable. It stays exported if it already was.
+ * Setting a readonly variable is an EPERM error.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param variables the variables.
+ * @param name the name of the variable.
+ * @param value the value.
+ */
+void variables_set(const struct dc_posix_env *env, struct dc_error *err, struct variables *variables,
+                   const char *name, const char *value);
+
+/**
+ * Export a variable, optionally setting it at the same time.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param variables the variables.
+ * @param name the name of the variable.
+ * @param value the value, or NULL to keep the current value.
+ */
+void variables_export(const struct dc_posix_env *env, struct dc_error *err, struct variables *variables,
+                      const char *name, const char *value);
+
+/**
+ * Make a variable readonly, optionally setting it at the same time.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param variables the variables.
+ * @param name the name of the variable.
+ * @param value the value, or NULL to keep the current value.
+ */
+void variables_readonly(const struct dc_posix_env *env, struct dc_error *err, struct variables *variables,
+                        const char *name, const char *value);
+
+/**
+ * Remove a variable. Removing a readonly variable is an EPERM error.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param variables the variables.
+ * @param name the name of the variable.
+ */
+void variables_unset(const struct dc_posix_env *env, struct dc_error *err, struct variables *variables,
+                     const char *name);
+
+/**
+ * Apply a "name=value" assignment.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param variables the variables.
+ * @param assignment the assignment.
+ * @param export should the variable also be exported (true = export).
+ */
+void variables_assign(const struct dc_posix_env *env, struct dc_error *err, struct variables *variables,
+                      const char *assignment, bool export);
+
+/**
+ * Get the environment to give to commands. It is owned by the variables and changes as they change.
+ *
+ * @param variables the variables.
+ * @return the NULL terminated "name=value" strings for the exported variables.
+ */
+char **variables_environ(const struct variables *variables);
+
+/**
+ * Is the string a valid variable name ([A-Za-z_][A-Za-z0-9_]*).
+ *
+ * @param str the string to check.
+ * @param length the number of characters of str to check.
+ * @return true if it is a name.
+ */
+bool variables_is_name(const char *str, size_t length);
+
+/**
+ * Is the string an assignment (a name followed by =).
+ *
+ * @param env the posix environment.
+ * @param str the string to check.
+ * @return true if it is an assignment.
+ */
+bool variables_is_assignment(const struct dc_posix_env *env, const char *str);
+
+/**
+ * Display variables as the commands that would recreate them, sorted by name.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param variables the variables.
+ * @param filter which variables to display.
+ * @param stream where to display them.
+ */
+void variables_print(const struct dc_posix_env *env, struct dc_error *err, const struct variables *variables,
+                     enum variables_filter filter, FILE *stream);
+
+#endif // DC_SHELL_VARIABLES_H
@@ -0,0 +1,991 @@
+#include <dc_posix/dc_stdlib.h>
+#include <dc_posix/dc_string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "arith.h"
+#include "mem_stats.h"
+
+#define BUCKET_COUNT 256
+#define MAX_ENTRIES 4096
+
+/*! \struct arith_parser
+    \brief Where arith_parse is in the text.
+*/
+struct arith_parser
+{
+    const struct dc_posix_env *env; /**< the posix environment */
+    struct dc_error *err;           /**< the error object */
+    const char *text;               /**< the expression */
+    size_t position;                /**< the index in the text of the next character to parse */
+};
+
+/*! \struct arith_operator
+    \brief An operator and how it binds.
+*/
+struct arith_operator
+{
+    const char *text;       /**< how it is written */
+    enum arith_op op;       /**< the node it makes */
+    int precedence;         /**< how tightly a binary operator binds (higher is tighter), 0 if it isn't one */
+    bool assignment;        /**< is it = or op= */
+};
+
+/*
+ * Longest first, so the first match is the right one.
+ */
+static const struct arith_operator operators[] = {
+    { "<<=", ARITH_SHIFT_LEFT, 0, true },
+    { ">>=", ARITH_SHIFT_RIGHT, 0, true },
+    { "||", ARITH_OR, 1, false },
+    { "&&", ARITH_AND, 2, false },
+    { "==", ARITH_EQUAL, 6, false },
+    { "!=", ARITH_NOT_EQUAL, 6, false },
+    { "<=", ARITH_LESS_EQUAL, 7, false },
+    { ">=", ARITH_GREATER_EQUAL, 7, false },
+    { "<<", ARITH_SHIFT_LEFT, 8, false },
+    { ">>", ARITH_SHIFT_RIGHT, 8, false },
+    { "++", ARITH_PRE_INCREMENT, 0, false },
+    { "--", ARITH_PRE_DECREMENT, 0, false },
+    { "*=", ARITH_MULTIPLY, 0, true },
+    { "/=", ARITH_DIVIDE, 0, true },
+    { "%=", ARITH_REMAINDER, 0, true },
+    { "+=", ARITH_ADD, 0, true },
+    { "-=", ARITH_SUBTRACT, 0, true },
+    { "&=", ARITH_BIT_AND, 0, true },
+    { "^=", ARITH_BIT_XOR, 0, true },
+    { "|=", ARITH_BIT_OR, 0, true },
+    { "|", ARITH_BIT_OR, 3, false },
+    { "^", ARITH_BIT_XOR, 4, false },
+    { "&", ARITH_BIT_AND, 5, false },
+    { "<", ARITH_LESS, 7, false },
+    { ">", ARITH_GREATER, 7, false },
+    { "+", ARITH_ADD, 9, false },
+    { "-", ARITH_SUBTRACT, 9, false },
+    { "*", ARITH_MULTIPLY, 10, false },
+    { "/", ARITH_DIVIDE, 10, false },
+    { "%", ARITH_REMAINDER, 10, false },
+    { "=", ARITH_ASSIGN, 0, true },
+    { NULL, ARITH_NUMBER, 0, false },
+};
+
+static struct arith_node *parse_comma(struct arith_parser *parser);
+static struct arith_node *parse_assignment(struct arith_parser *parser);
+static struct arith_node *parse_conditional(struct arith_parser *parser);
+static struct arith_node *parse_binary(struct arith_parser *parser, int precedence);
+static struct arith_node *parse_unary(struct arith_parser *parser);
+static struct arith_node *parse_primary(struct arith_parser *parser);
+static char *parse_name(struct arith_parser *parser);
+static const struct arith_operator *peek_operator(struct arith_parser *parser, bool binary);
+static bool accept(struct arith_parser *parser, char c);
+static void skip_blanks(struct arith_parser *parser);
+static struct arith_node *create_node(struct arith_parser *parser, enum arith_op op, struct arith_node *left,
+                                      struct arith_node *right);
+static void syntax_error(struct arith_parser *parser, const char *message);
+static size_t parse_number(const char *str, int64_t *value);
+static bool is_name_char(char c, bool first);
+static int64_t get_value(const struct dc_posix_env *env, struct dc_error *err, struct variables *variables,
+                         const char *name);
+static void set_value(const struct dc_posix_env *env, struct dc_error *err, struct variables *variables,
+                      const char *name, int64_t value);
+static int64_t apply(struct dc_error *err, enum arith_op op, int64_t left, int64_t right);
+static size_t hash_text(const char *text);
+
+/**
+ * Parse an arithmetic expression: 64-bit integers (decimal, 0 octal or 0x hexadecimal), variables
+ * (name, $name or ${name}), parentheses and the C operators the shell has, from the highest precedence:
+ * ++ -- (after a name), ++ -- + - ! ~ (before), * / %, + -, << >>, < <= > >=, == !=, &, ^, |, &&, ||, ?:,
+ * = *= /= %= += -= <<= >>= &= ^= |=, and ,.
+ *
+ * @param env the posix environment.
+ * @param err the error object, EINVAL for a syntax error.
+ * @param text the expression, with any other expansions already done.
+ * @return the expression (free with arith_destroy), NULL on error.
+ */
+struct arith_node *arith_parse(const struct dc_posix_env *env, struct dc_error *err, const char *text) {
+    struct arith_parser parser;
+    struct arith_node *tree;
+
+    parser.env = env;
+    parser.err = err;
+    parser.text = text;
+    parser.position = 0;
+
+    skip_blanks(&parser);
+
+    // $(( )) is 0
+    if (text[parser.position] == '\0') {
+        return create_node(&parser, ARITH_NUMBER, NULL, NULL);
+    }
+
+    tree = parse_comma(&parser);
+    skip_blanks(&parser);
+
+    if (tree != NULL && text[parser.position] != '\0') {
+        syntax_error(&parser, "arithmetic syntax error: unexpected character");
+    }
+
+    if (dc_error_has_error(err)) {
+        arith_destroy(env, &tree);
+        return NULL;
+    }
+
+    return tree;
+}
+
+/**
+ * Evaluate a parsed expression. Integers wrap around at 64 bits. The value of a variable must be an integer
+ * constant, an unset or empty variable is 0. Assignments set the variable to the new value in decimal.
+ *
+ * @param env the posix environment.
+ * @param err the error object, EINVAL for a variable that isn't a number or division by zero,
+ *            or the error from setting a variable.
+ * @param tree the expression.
+ * @param variables the shell variables.
+ * @return the value.
+ */
+int64_t arith_evaluate(const struct dc_posix_env *env, struct dc_error *err, const struct arith_node *tree,
+                       struct variables *variables) {
+    int64_t left;
+    int64_t right;
+    int64_t value;
+
+    switch (tree->op) {
+        case ARITH_NUMBER:
+            return tree->value;
+        case ARITH_VARIABLE:
+            return get_value(env, err, variables, tree->name);
+        case ARITH_PRE_INCREMENT:
+        case ARITH_PRE_DECREMENT:
+        case ARITH_POST_INCREMENT:
+        case ARITH_POST_DECREMENT:
+            left = get_value(env, err, variables, tree->name);
+            if (dc_error_has_error(err)) {
+                return 0;
+            }
+
+            value = apply(err, tree->op == ARITH_PRE_INCREMENT || tree->op == ARITH_POST_INCREMENT
+                               ? ARITH_ADD : ARITH_SUBTRACT, left, 1);
+            set_value(env, err, variables, tree->name, value);
+
+            return tree->op == ARITH_PRE_INCREMENT || tree->op == ARITH_PRE_DECREMENT ? value : left;
+        case ARITH_ASSIGN:
+            right = arith_evaluate(env, err, tree->right, variables);
+            if (dc_error_has_error(err)) {
+                return 0;
+            }
+
+            if (tree->compound != ARITH_ASSIGN) {
+                left = get_value(env, err, variables, tree->name);
+                if (dc_error_has_error(err)) {
+                    return 0;
+                }
+
+                right = apply(err, tree->compound, left, right);
+                if (dc_error_has_error(err)) {
+                    return 0;
+                }
+            }
+
+            set_value(env, err, variables, tree->name, right);
+
+            return right;
+        case ARITH_AND:
+        case ARITH_OR:
+            left = arith_evaluate(env, err, tree->left, variables);
+            if (dc_error_has_error(err) || (tree->op == ARITH_AND) == (left == 0)) {
+                return tree->op == ARITH_OR;
+            }
+
+            return arith_evaluate(env, err, tree->right, variables) != 0;
+        case ARITH_CONDITIONAL:
+            left = arith_evaluate(env, err, tree->left, variables);
+            if (dc_error_has_error(err)) {
+                return 0;
+            }
+
+            return arith_evaluate(env, err, left != 0 ? tree->right : tree->third, variables);
+        case ARITH_COMMA:
+            arith_evaluate(env, err, tree->left, variables);
+            if (dc_error_has_error(err)) {
+                return 0;
+            }
+
+            return arith_evaluate(env, err, tree->right, variables);
+        case ARITH_NEGATE:
+        case ARITH_PLUS:
+        case ARITH_NOT:
+        case ARITH_COMPLEMENT:
+            left = arith_evaluate(env, err, tree->left, variables);
+            if (dc_error_has_error(err)) {
+                return 0;
+            }
+
+            return apply(err, tree->op, left, 0);
+        case ARITH_MULTIPLY:
+        case ARITH_DIVIDE:
+        case ARITH_REMAINDER:
+        case ARITH_ADD:
+        case ARITH_SUBTRACT:
+        case ARITH_SHIFT_LEFT:
+        case ARITH_SHIFT_RIGHT:
+        case ARITH_LESS:
+        case ARITH_LESS_EQUAL:
+        case ARITH_GREATER:
+        case ARITH_GREATER_EQUAL:
+        case ARITH_EQUAL:
+        case ARITH_NOT_EQUAL:
+        case ARITH_BIT_AND:
+        case ARITH_BIT_XOR:
+        case ARITH_BIT_OR:
+            left = arith_evaluate(env, err, tree->left, variables);
+            if (dc_error_has_error(err)) {
+                return 0;
+            }
+
+            right = arith_evaluate(env, err, tree->right, variables);
+            if (dc_error_has_error(err)) {
+                return 0;
+            }
+
+            return apply(err, tree->op, left, right);
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Free an expression and set it to NULL.
+ *
+ * @param env the posix environment.
+ * @param ptree the expression to destroy.
+ */
+void arith_destroy(const struct dc_posix_env *env, struct arith_node **ptree) {
+    struct arith_node *tree;
+
+    tree = *ptree;
+
+    if (tree == NULL) {
+        return;
+    }
+
+    if (tree->name != NULL) {
+        dc_free(env, tree->name, strlen(tree->name) + 1);
+    }
+
+    arith_destroy(env, &tree->left);
+    arith_destroy(env, &tree->right);
+    arith_destroy(env, &tree->third);
+    dc_free(env, tree, sizeof(struct arith_node));
+    *ptree = NULL;
+}
+
+/**
+ * Create an empty cache.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @return the cache (free with arith_cache_destroy).
+ */
+struct arith_cache *arith_cache_create(const struct dc_posix_env *env, struct dc_error *err) {
+    struct arith_cache *cache;
+
+    cache = dc_calloc(env, err, 1, sizeof(struct arith_cache));
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    cache->buckets = dc_calloc(env, err, BUCKET_COUNT, sizeof(struct arith_entry *));
+    if (dc_error_has_error(err)) {
+        dc_free(env, cache, sizeof(struct arith_cache));
+        return NULL;
+    }
+
+    cache->bucket_count = BUCKET_COUNT;
+
+    return cache;
+}
+
+/**
+ * Free the cache and the expressions in it and set it to NULL.
+ *
+ * @param env the posix environment.
+ * @param pcache the cache to destroy.
+ */
+void arith_cache_destroy(const struct dc_posix_env *env, struct arith_cache **pcache) {
+    struct arith_cache *cache;
+
+    cache = *pcache;
+
+    for (size_t i = 0; i < cache->bucket_count; i++) {
+        struct arith_entry *entry;
+
+        entry = cache->buckets[i];
+
+        while (entry != NULL) {
+            struct arith_entry *next;
+
+            next = entry->next;
+            dc_free(env, entry->text, strlen(entry->text) + 1);
+            arith_destroy(env, &entry->tree);
+            dc_free(env, entry, sizeof(struct arith_entry));
+            entry = next;
+        }
+    }
+
+    dc_free(env, cache->buckets, cache->bucket_count * sizeof(struct arith_entry *));
+    dc_free(env, cache, sizeof(struct arith_cache));
+    *pcache = NULL;
+}
+
+/**
+ * Evaluate an expression, parsing it only if the cache doesn't already have it (see arith_parse and
+ * arith_evaluate).
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param cache the cache, or NULL to parse the expression every time.
+ * @param variables the shell variables.
+ * @param text the expression.
+ * @return the value.
+ */
+int64_t arith_cache_evaluate(const struct dc_posix_env *env, struct dc_error *err, struct arith_cache *cache,
+                             struct variables *variables, const char *text) {
+    struct arith_node *tree;
+    struct arith_entry *entry;
+    size_t bucket;
+    int64_t value;
+
+    if (cache != NULL) {
+        bucket = hash_text(text) & (cache->bucket_count - 1);
+
+        for (entry = cache->buckets[bucket]; entry != NULL; entry = entry->next) {
+            if (dc_strcmp(env, entry->text, text) == 0) {
+                cache->hits++;
+                return arith_evaluate(env, err, entry->tree, variables);
+            }
+        }
+
+        cache->misses++;
+    }
+
+    tree = arith_parse(env, err, text);
+    if (dc_error_has_error(err)) {
+        return 0;
+    }
+
+    value = arith_evaluate(env, err, tree, variables);
+
+    // the cache is full (or not wanted) - the expression is only used this once
+    if (cache == NULL || cache->count >= MAX_ENTRIES) {
+        arith_destroy(env, &tree);
+        return value;
+    }
+
+    entry = dc_calloc(env, err, 1, sizeof(struct arith_entry));
+    if (dc_error_has_error(err)) {
+        arith_destroy(env, &tree);
+        return 0;
+    }
+
+    entry->text = dc_strdup(env, err, text);
+    if (dc_error_has_error(err)) {
+        arith_destroy(env, &tree);
+        dc_free(env, entry, sizeof(struct arith_entry));
+        return 0;
+    }
+
+    entry->tree = tree;
+    entry->next = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    cache->count++;
+
+    return value;
+}
+
+/**
+ * Does an expression need the other expansions before it can be parsed: does it have a $ that isn't
+ * $name or ${name}, a quote, a \\ or a `. Only the text of one that doesn't can be cached.
+ *
+ * @param text the expression.
+ * @return true if it has to be expanded first.
+ */
+bool arith_needs_expansion(const char *text) {
+    for (size_t i = 0; text[i] != '\0'; i++) {
+        char c;
+
+        c = text[i];
+
+        if (c == '\'' || c == '"' || c == '\\' || c == '`') {
+            return true;
+        }
+
+        if (c != '$') {
+            continue;
+        }
+
+        if (text[i + 1] == '{') {
+            size_t end;
+
+            end = i + 2;
+
+            while (is_name_char(text[end], end == i + 2)) {
+                end++;
+            }
+
+            if (end == i + 2 || text[end] != '}') {
+                return true;
+            }
+
+            i = end;
+        } else if (!is_name_char(text[i + 1], true)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static struct arith_node *parse_comma(struct arith_parser *parser) {
+    struct arith_node *node;
+
+    node = parse_assignment(parser);
+
+    while (node != NULL && accept(parser, ',')) {
+        node = create_node(parser, ARITH_COMMA, node, parse_assignment(parser));
+    }
+
+    return node;
+}
+
+/*
+ * An assignment is a name followed by = or op=, anything else is a conditional expression.
+ */
+static struct arith_node *parse_assignment(struct arith_parser *parser) {
+    struct arith_node *node;
+    const struct arith_operator *operator;
+    size_t start;
+    char *name;
+
+    skip_blanks(parser);
+    start = parser->position;
+
+    if (!is_name_char(parser->text[start], true) && parser->text[start] != '$') {
+        return parse_conditional(parser);
+    }
+
+    name = parse_name(parser);
+    if (name == NULL) {
+        return NULL;
+    }
+
+    operator = peek_operator(parser, false);
+
+    if (operator == NULL || !operator->assignment) {
+        dc_free(parser->env, name, strlen(name) + 1);
+        parser->position = start;
+        return parse_conditional(parser);
+    }
+
+    parser->position += strlen(operator->text);
+    node = create_node(parser, ARITH_ASSIGN, NULL, parse_assignment(parser));
+
+    if (node == NULL) {
+        dc_free(parser->env, name, strlen(name) + 1);
+        return NULL;
+    }
+
+    node->compound = operator->op;
+    node->name = name;
+
+    return node;
+}
+
+static struct arith_node *parse_conditional(struct arith_parser *parser) {
+    struct arith_node *node;
+
+    node = parse_binary(parser, 1);
+
+    if (node == NULL || !accept(parser, '?')) {
+        return node;
+    }
+
+    node = create_node(parser, ARITH_CONDITIONAL, node, parse_comma(parser));
+
+    if (node != NULL && !accept(parser, ':')) {
+        syntax_error(parser, "arithmetic syntax error: expected :");
+    }
+
+    if (dc_error_has_error(parser->err)) {
+        arith_destroy(parser->env, &node);
+        return NULL;
+    }
+
+    node->third = parse_conditional(parser);
+
+    if (node->third == NULL) {
+        arith_destroy(parser->env, &node);
+    }
+
+    return node;
+}
+
+/*
+ * Precedence climbing: the operands of an operator are the expressions of the operators that bind tighter.
+ */
+static struct arith_node *parse_binary(struct arith_parser *parser, int precedence) {
+    struct arith_node *node;
+
+    node = parse_unary(parser);
+
+    while (node != NULL) {
+        const struct arith_operator *operator;
+
+        operator = peek_operator(parser, true);
+
+        if (operator == NULL || operator->precedence < precedence) {
+            break;
+        }
+
+        parser->position += strlen(operator->text);
+        node = create_node(parser, operator->op, node, parse_binary(parser, operator->precedence + 1));
+    }
+
+    return node;
+}
+
+static struct arith_node *parse_unary(struct arith_parser *parser) {
+    struct arith_node *node;
+    const char *str;
+    enum arith_op op;
+
+    skip_blanks(parser);
+    str = &parser->text[parser->position];
+
+    if ((str[0] == '+' || str[0] == '-') && str[1] == str[0]) {
+        parser->position += 2;
+        skip_blanks(parser);
+        node = create_node(parser, str[0] == '+' ? ARITH_PRE_INCREMENT : ARITH_PRE_DECREMENT, NULL, NULL);
+
+        if (node != NULL) {
+            node->name = parse_name(parser);
+
+            if (node->name == NULL) {
+                arith_destroy(parser->env, &node);
+            }
+        }
+
+        return node;
+    }
+
+    switch (str[0]) {
+        case '-':
+            op = ARITH_NEGATE;
+            break;
+        case '+':
+            op = ARITH_PLUS;
+            break;
+        case '!':
+            op = ARITH_NOT;
+            break;
+        case '~':
+            op = ARITH_COMPLEMENT;
+            break;
+        default:
+            return parse_primary(parser);
+    }
+
+    parser->position++;
+
+    return create_node(parser, op, parse_unary(parser), NULL);
+}
+
+static struct arith_node *parse_primary(struct arith_parser *parser) {
+    struct arith_node *node;
+    const char *str;
+    size_t length;
+
+    str = &parser->text[parser->position];
+
+    if (str[0] == '(') {
+        parser->position++;
+        node = parse_comma(parser);
+
+        if (node != NULL && !accept(parser, ')')) {
+            syntax_error(parser, "arithmetic syntax error: expected )");
+            arith_destroy(parser->env, &node);
+        }
+
+        return node;
+    }
+
+    if (str[0] >= '0' && str[0] <= '9') {
+        node = create_node(parser, ARITH_NUMBER, NULL, NULL);
+        if (node == NULL) {
+            return NULL;
+        }
+
+        length = parse_number(str, &node->value);
+
+        if (length == 0) {
+            syntax_error(parser, "arithmetic syntax error: invalid number");
+            arith_destroy(parser->env, &node);
+            return NULL;
+        }
+
+        parser->position += length;
+
+        return node;
+    }
+
+    if (!is_name_char(str[0], true) && str[0] != '$') {
+        syntax_error(parser, "arithmetic syntax error: expected an operand");
+        return NULL;
+    }
+
+    node = create_node(parser, ARITH_VARIABLE, NULL, NULL);
+    if (node == NULL) {
+        return NULL;
+    }
+
+    node->name = parse_name(parser);
+    if (node->name == NULL) {
+        arith_destroy(parser->env, &node);
+        return NULL;
+    }
+
+    skip_blanks(parser);
+    str = &parser->text[parser->position];
+
+    if ((str[0] == '+' || str[0] == '-') && str[1] == str[0]) {
+        node->op = str[0] == '+' ? ARITH_POST_INCREMENT : ARITH_POST_DECREMENT;
+        parser->position += 2;
+    }
+
+    return node;
+}
+
+/*
+ * name, $name or ${name}.
+ */
+static char *parse_name(struct arith_parser *parser) {
+    const char *str;
+    size_t start;
+    size_t length;
+    bool braced;
+    char *name;
+
+    str = parser->text;
+    start = parser->position;
+    braced = false;
+
+    if (str[start] == '$') {
+        start++;
+        braced = str[start] == '{';
+
+        if (braced) {
+            start++;
+        }
+    }
+
+    length = 0;
+
+    while (is_name_char(str[start + length], length == 0)) {
+        length++;
+    }
+
+    if (length == 0 || (braced && str[start + length] != '}')) {
+        parser->position = start + length;
+        syntax_error(parser, "arithmetic syntax error: expected a variable name");
+        return NULL;
+    }
+
+    name = dc_strndup(parser->env, parser->err, &str[start], length);
+    if (dc_error_has_error(parser->err)) {
+        return NULL;
+    }
+
+    parser->position = start + length + (braced ? 1 : 0);
+
+    return name;
+}
+
+/*
+ * The operator at the current position, if there is one. Between two operands ++ and -- are
+ * + and - followed by a unary + or -.
+ */
+static const struct arith_operator *peek_operator(struct arith_parser *parser, bool binary) {
+    const char *str;
+
+    skip_blanks(parser);
+    str = &parser->text[parser->position];
+
+    for (size_t i = 0; operators[i].text != NULL; i++) {
+        const char *text;
+        size_t length;
+
+        text = operators[i].text;
+        length = strlen(text);
+
+        if (binary && (operators[i].op == ARITH_PRE_INCREMENT || operators[i].op == ARITH_PRE_DECREMENT)) {
+            continue;
+        }
+
+        if (dc_strncmp(parser->env, str, text, length) == 0) {
+            return &operators[i];
+        }
+    }
+
+    return NULL;
+}
+
+static bool accept(struct arith_parser *parser, char c) {
+    skip_blanks(parser);
+
+    if (parser->text[parser->position] != c) {
+        return false;
+    }
+
+    parser->position++;
+
+    return true;
+}
+
+static void skip_blanks(struct arith_parser *parser) {
+    while (parser->text[parser->position] == ' ' || parser->text[parser->position] == '\t' ||
+           parser->text[parser->position] == '\n') {
+        parser->position++;
+    }
+}
+
+/*
+ * A node with its operands - if an operand failed to parse the node is not made and the other is freed.
+ */
+static struct arith_node *create_node(struct arith_parser *parser, enum arith_op op, struct arith_node *left,
+                                      struct arith_node *right) {
+    struct arith_node *node;
+
+    if (dc_error_has_error(parser->err)) {
+        arith_destroy(parser->env, &left);
+        arith_destroy(parser->env, &right);
+        return NULL;
+    }
+
+    node = dc_calloc(parser->env, parser->err, 1, sizeof(struct arith_node));
+    if (dc_error_has_error(parser->err)) {
+        arith_destroy(parser->env, &left);
+        arith_destroy(parser->env, &right);
+        return NULL;
+    }
+
+    node->op = op;
+    node->left = left;
+    node->right = right;
+
+    return node;
+}
+
+static void syntax_error(struct arith_parser *parser, const char *message) {
+    if (dc_error_has_error(parser->err)) {
+        return;
+    }
+
+    DC_ERROR_RAISE_USER(parser->err, message, EINVAL);
+}
+
+/*
+ * A decimal, 0 octal or 0x hexadecimal constant, wrapping around at 64 bits.
+ * Returns the number of characters in it, 0 if it isn't a valid constant.
+ */
+static size_t parse_number(const char *str, int64_t *value) {
+    uint64_t number;
+    unsigned base;
+    size_t start;
+    size_t i;
+
+    base = 10;
+    start = 0;
+
+    if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+        base = 16;
+        start = 2;
+    } else if (str[0] == '0') {
+        base = 8;
+    }
+
+    number = 0;
+
+    for (i = start; is_name_char(str[i], false); i++) {
+        unsigned digit;
+        char c;
+
+        c = str[i];
+
+        if (c >= '0' && c <= '9') {
+            digit = (unsigned) (c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            digit = (unsigned) (c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            digit = (unsigned) (c - 'A' + 10);
+        } else {
+            return 0;
+        }
+
+        if (digit >= base) {
+            return 0;
+        }
+
+        number = number * base + digit;
+    }
+
+    if (i == start) {
+        return 0;
+    }
+
+    *value = (int64_t) number;
+
+    return i;
+}
+
+static bool is_name_char(char c, bool first) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || (!first && c >= '0' && c <= '9');
+}
+
+/*
+ * The value of a variable is an integer constant, with an optional sign and blanks around it.
+ */
+static int64_t get_value(const struct dc_posix_env *env, struct dc_error *err, struct variables *variables,
+                         const char *name) {
+    const char *value;
+    int64_t number;
+    size_t i;
+    size_t length;
+    bool negative;
+
+    value = variables == NULL ? NULL : variables_get(env, variables, name);
+
+    if (value == NULL) {
+        return 0;
+    }
+
+    for (i = 0; value[i] == ' ' || value[i] == '\t' || value[i] == '\n'; i++) {
+    }
+
+    if (value[i] == '\0') {
+        return 0;
+    }
+
+    negative = value[i] == '-';
+
+    if (value[i] == '-' || value[i] == '+') {
+        i++;
+    }
+
+    length = parse_number(&value[i], &number);
+
+    for (i += length; length > 0 && (value[i] == ' ' || value[i] == '\t' || value[i] == '\n'); i++) {
+    }
+
+    if (length == 0 || value[i] != '\0') {
+        DC_ERROR_RAISE_USER(err, "arithmetic: variable is not a number", EINVAL);
+        return 0;
+    }
+
+    return negative ? (int64_t) (0 - (uint64_t) number) : number;
+}
+
+static void set_value(const struct dc_posix_env *env, struct dc_error *err, struct variables *variables,
+                      const char *name, int64_t value) {
+    char text[32];
+
+    if (variables == NULL || dc_error_has_error(err)) {
+        return;
+    }
+
+    snprintf(text, sizeof(text), "%" PRId64, value);
+    variables_set(env, err, variables, name, text);
+}
+
+/*
+ * The unary and binary operators, on 64-bit integers that wrap around. Shifts use the low 6 bits of the count.
+ */
+static int64_t apply(struct dc_error *err, enum arith_op op, int64_t left, int64_t right) {
+    switch (op) {
+        case ARITH_NEGATE:
+            return (int64_t) (0 - (uint64_t) left);
+        case ARITH_PLUS:
+            return left;
+        case ARITH_NOT:
+            return left == 0;
+        case ARITH_COMPLEMENT:
+            return ~left;
+        case ARITH_MULTIPLY:
+            return (int64_t) ((uint64_t) left * (uint64_t) right);
+        case ARITH_DIVIDE:
+        case ARITH_REMAINDER:
+            if (right == 0) {
+                DC_ERROR_RAISE_USER(err, "arithmetic: division by zero", EINVAL);
+                return 0;
+            }
+
+            // the one quotient that doesn't fit
+            if (left == INT64_MIN && right == -1) {
+                return op == ARITH_DIVIDE ? INT64_MIN : 0;
+            }
+
+            return op == ARITH_DIVIDE ? left / right : left % right;
+        case ARITH_ADD:
+            return (int64_t) ((uint64_t) left + (uint64_t) right);
+        case ARITH_SUBTRACT:
+            return (int64_t) ((uint64_t) left - (uint64_t) right);
+        case ARITH_SHIFT_LEFT:
+            return (int64_t) ((uint64_t) left << (right & 63));
+        case ARITH_SHIFT_RIGHT:
+            return left >> (right & 63);
+        case ARITH_LESS:
+            return left < right;
+        case ARITH_LESS_EQUAL:
+            return left <= right;
+        case ARITH_GREATER:
+            return left > right;
+        case ARITH_GREATER_EQUAL:
+            return left >= right;
+        case ARITH_EQUAL:
+            return left == right;
+        case ARITH_NOT_EQUAL:
+            return left != right;
+        case ARITH_BIT_AND:
+            return left & right;
+        case ARITH_BIT_XOR:
+            return left ^ right;
+        case ARITH_BIT_OR:
+            return left | right;
+        case ARITH_NUMBER:
+        case ARITH_VARIABLE:
+        case ARITH_PRE_INCREMENT:
+        case ARITH_PRE_DECREMENT:
+        case ARITH_POST_INCREMENT:
+        case ARITH_POST_DECREMENT:
+        case ARITH_AND:
+        case ARITH_OR:
+        case ARITH_CONDITIONAL:
+        case ARITH_ASSIGN:
+        case ARITH_COMMA:
+        default:
+            return 0;
+    }
+}
+
+static size_t hash_text(const char *text) {
+    uint64_t hash;
+
+    // FNV-1a
+    hash = UINT64_C(14695981039346656037);
+
+    for (size_t i = 0; text[i] != '\0'; i++) {
+        hash ^= (unsigned char) text[i];
+        hash *= UINT64_C(1099511628211);
+    }
+
+    return (size_t) hash;
+}
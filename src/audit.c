@@ -0,0 +1,414 @@
+#include "audit.h"
+#include "mem_stats.h"
+#include <dc_posix/dc_stdlib.h>
+#include <dc_posix/dc_string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// the records that can be waiting for the writer, a power of 2 so the indexes can wrap
+#define AUDIT_RING_SIZE 1024
+
+// how long the writer sleeps between flushes
+#define AUDIT_FLUSH_MS 200
+
+// the most records one writev writes
+#define AUDIT_BATCH 64
+
+/*
+ * One command line, as the shell hands it to the writer.
+ */
+struct audit_record
+{
+    char *line;                 // the line, the writer frees it
+    struct timespec started;    // the time of day it started
+    long duration;              // how long it took in microseconds
+    int exit_code;              // its exit code
+    struct rusage usage;        // what its children used, ru_maxrss is the largest child so far
+};
+
+/*
+ * The shell is the only producer and the writer the only consumer, so each index has one writer: head is
+ * only stored by the shell and tail only by the writer.
+ */
+struct audit_log
+{
+    const struct dc_posix_env *env; // the environment the log was opened with
+    int fd;                         // the log file
+    int wake[2];                    // a pipe that wakes the writer up early
+    pid_t pid;                      // the shell that opened it
+    pthread_t writer;               // the writer thread
+    bool open;                      // is the log being written
+    atomic_bool stopping;           // set by audit_close, the writer exits once the ring is empty
+    atomic_size_t head;             // the count of records ever added
+    atomic_size_t tail;             // the count of records ever written
+    struct audit_record records[AUDIT_RING_SIZE]; // the ring
+};
+
+static void *write_records(void *arg);
+static void wake_writer(void);
+static size_t flush_records(struct dc_error *err);
+static char *format_record(struct dc_error *err, const struct audit_record *record, size_t *size, size_t *length);
+static void append_json_string(char *buffer, size_t *length, const char *text);
+static bool writev_all(int fd, struct iovec *iov, int count);
+static long microseconds_between(const struct timespec *from, const struct timespec *to);
+static double milliseconds(const struct timeval *time);
+static void subtract_rusage(struct rusage *usage, const struct rusage *before);
+
+static struct audit_log audit;
+
+/**
+ * Start recording every command line run into a JSON lines file, one object per line: the time it started,
+ * how long it took, the exit code, the line, and the resources its children used (see getrusage).
+ * The records are handed to a writer thread through a ring buffer without locks, so the prompt never
+ * waits for the file. The writer wakes up every so often and writes what has built up with one writev.
+ * There is one log per shell process, so it is kept here rather than in the state.
+ *
+ * @param env the posix environment.
+ * @param err the error object, set if the file can't be opened or the thread started.
+ * @param path the file, it is appended to.
+ */
+void audit_open(const struct dc_posix_env *env, struct dc_error *err, const char *path) {
+    int error;
+
+    audit.fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR);
+
+    if (audit.fd == -1) {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+        return;
+    }
+
+    if (pipe(audit.wake) == -1) {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+        close(audit.fd);
+        return;
+    }
+
+    // the programs the shell runs don't get them, and a wake up that is already pending is enough
+    fcntl(audit.wake[0], F_SETFD, FD_CLOEXEC);
+    fcntl(audit.wake[1], F_SETFD, FD_CLOEXEC);
+    fcntl(audit.wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(audit.wake[1], F_SETFL, O_NONBLOCK);
+
+    audit.env = env;
+    audit.pid = getpid();
+    atomic_init(&audit.stopping, false);
+    atomic_init(&audit.head, 0);
+    atomic_init(&audit.tail, 0);
+    error = pthread_create(&audit.writer, NULL, write_records, NULL);
+
+    if (error != 0) {
+        DC_ERROR_RAISE_ERRNO(err, error);
+        close(audit.wake[0]);
+        close(audit.wake[1]);
+        close(audit.fd);
+        return;
+    }
+
+    audit.open = true;
+}
+
+/**
+ * Is a log being written by this process (a child the shell forked does not write to it).
+ *
+ * @return true if audit_command records the lines.
+ */
+bool audit_enabled(void) {
+    return audit.open && audit.pid == getpid();
+}
+
+/**
+ * Mark the start of a command line.
+ *
+ * @param mark set to now.
+ */
+void audit_start(struct audit_mark *mark) {
+    if (!audit_enabled()) {
+        return;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &mark->wall);
+    clock_gettime(CLOCK_MONOTONIC, &mark->monotonic);
+    getrusage(RUSAGE_CHILDREN, &mark->children);
+}
+
+/**
+ * Record a command line that has finished. The writer is woken up early once the ring is half full, only
+ * if it is full (lines finishing faster than the file can take them) does the shell wait for it.
+ *
+ * @param env the posix environment.
+ * @param mark when it started (see audit_start).
+ * @param line the line.
+ * @param exit_code its exit code.
+ */
+void audit_command(const struct dc_posix_env *env, const struct audit_mark *mark, const char *line, int exit_code) {
+    struct audit_record *record;
+    struct timespec now;
+    struct dc_error err;
+    size_t head;
+    size_t waiting;
+
+    if (!audit_enabled()) {
+        return;
+    }
+
+    head = atomic_load_explicit(&audit.head, memory_order_relaxed);
+    waiting = head - atomic_load_explicit(&audit.tail, memory_order_acquire);
+
+    // a record is for compliance, so it is never dropped
+    while (waiting == AUDIT_RING_SIZE) {
+        wake_writer();
+        poll(NULL, 0, 1);
+        waiting = head - atomic_load_explicit(&audit.tail, memory_order_acquire);
+    }
+
+    record = &audit.records[head % AUDIT_RING_SIZE];
+    dc_error_init(&err, NULL);
+    record->line = dc_strdup(env, &err, line == NULL ? "" : line);
+
+    if (dc_error_has_error(&err)) {
+        dc_error_reset(&err);
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    getrusage(RUSAGE_CHILDREN, &record->usage);
+    subtract_rusage(&record->usage, &mark->children);
+    record->started = mark->wall;
+    record->duration = microseconds_between(&mark->monotonic, &now);
+    record->exit_code = exit_code;
+
+    // the record is filled in before the writer can see it
+    atomic_store_explicit(&audit.head, head + 1, memory_order_release);
+
+    if (waiting + 1 == AUDIT_RING_SIZE / 2) {
+        wake_writer();
+    }
+}
+
+/**
+ * Write what is left, stop the writer thread and close the log.
+ */
+void audit_close(void) {
+    if (!audit_enabled()) {
+        return;
+    }
+
+    atomic_store(&audit.stopping, true);
+
+    wake_writer();
+    pthread_join(audit.writer, NULL);
+    close(audit.wake[0]);
+    close(audit.wake[1]);
+    close(audit.fd);
+    audit.open = false;
+}
+
+/*
+ * The writer thread: flush, then sleep until the next flush or until audit_close wakes it.
+ */
+static void *write_records(void *arg) {
+    struct pollfd wake;
+    struct dc_error err;
+
+    (void) arg;
+    dc_error_init(&err, NULL);
+    wake.fd = audit.wake[0];
+    wake.events = POLLIN;
+
+    for (;;) {
+        bool stopping;
+
+        // read before the flush, so nothing added before audit_close is left behind
+        stopping = atomic_load(&audit.stopping);
+
+        while (flush_records(&err) == AUDIT_BATCH) {
+        }
+
+        dc_error_reset(&err);
+
+        if (stopping) {
+            return NULL;
+        }
+
+        if (poll(&wake, 1, AUDIT_FLUSH_MS) > 0) {
+            char buffer[64];
+
+            while (read(audit.wake[0], buffer, sizeof(buffer)) > 0) {
+            }
+        }
+    }
+}
+
+/*
+ * The writer may be asleep in poll.
+ */
+static void wake_writer(void) {
+    while (write(audit.wake[1], "", 1) == -1 && errno == EINTR) {
+    }
+}
+
+/*
+ * Write up to AUDIT_BATCH records, returns how many there were. A record that can't be formatted (out of
+ * memory) is left out, and a failed write (eg. the disk is full) is not retried.
+ */
+static size_t flush_records(struct dc_error *err) {
+    struct iovec iov[AUDIT_BATCH];
+    size_t sizes[AUDIT_BATCH];
+    size_t tail;
+    size_t head;
+    size_t count;
+    int iov_count;
+
+    tail = atomic_load_explicit(&audit.tail, memory_order_relaxed);
+    head = atomic_load_explicit(&audit.head, memory_order_acquire);
+    count = head - tail < AUDIT_BATCH ? head - tail : AUDIT_BATCH;
+    iov_count = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        struct audit_record *record;
+        size_t length;
+        char *text;
+
+        record = &audit.records[(tail + i) % AUDIT_RING_SIZE];
+        text = format_record(err, record, &sizes[iov_count], &length);
+        dc_free(audit.env, record->line, strlen(record->line) + 1);
+
+        if (text != NULL) {
+            iov[iov_count].iov_base = text;
+            iov[iov_count].iov_len = length;
+            iov_count++;
+        }
+    }
+
+    // the slots can be reused as soon as the lines are copied out of them
+    atomic_store_explicit(&audit.tail, tail + count, memory_order_release);
+    writev_all(audit.fd, iov, iov_count);
+
+    for (int i = 0; i < iov_count; i++) {
+        dc_free(audit.env, iov[i].iov_base, sizes[i]);
+    }
+
+    return count;
+}
+
+/*
+ * The record as one line of JSON, with the newline. size is set to the size of the buffer.
+ */
+static char *format_record(struct dc_error *err, const struct audit_record *record, size_t *size, size_t *length) {
+    struct tm time;
+    char *buffer;
+    char date[32];
+
+    // every character of the line can take 6 to escape, the rest is less than 512
+    *size = strlen(record->line) * 6 + 512;
+    buffer = dc_malloc(audit.env, err, *size);
+
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    gmtime_r(&record->started.tv_sec, &time);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &time);
+    *length = (size_t) sprintf(buffer, "{\"time\":\"%s.%06ldZ\",\"pid\":%ld,\"line\":", date,
+                               record->started.tv_nsec / 1000, (long) audit.pid);
+    append_json_string(buffer, length, record->line);
+    *length += (size_t) sprintf(&buffer[*length],
+                                ",\"exit\":%d,\"duration_ms\":%.3f,\"user_ms\":%.3f,\"system_ms\":%.3f,"
+                                "\"max_rss_kb\":%ld,\"minor_faults\":%ld,\"major_faults\":%ld,"
+                                "\"voluntary_switches\":%ld,\"involuntary_switches\":%ld}\n",
+                                record->exit_code, (double) record->duration / 1000.0,
+                                milliseconds(&record->usage.ru_utime), milliseconds(&record->usage.ru_stime),
+                                record->usage.ru_maxrss, record->usage.ru_minflt, record->usage.ru_majflt,
+                                record->usage.ru_nvcsw, record->usage.ru_nivcsw);
+
+    return buffer;
+}
+
+static void append_json_string(char *buffer, size_t *length, const char *text) {
+    buffer[(*length)++] = '"';
+
+    for (const unsigned char *c = (const unsigned char *) text; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            buffer[(*length)++] = '\\';
+            buffer[(*length)++] = (char) *c;
+        } else if (*c < 0x20) {
+            *length += (size_t) sprintf(&buffer[*length], "\\u%04x", *c);
+        } else {
+            buffer[(*length)++] = (char) *c;
+        }
+    }
+
+    buffer[(*length)++] = '"';
+    buffer[*length] = '\0';
+}
+
+/*
+ * writev can stop part way through, like write.
+ */
+static bool writev_all(int fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t written;
+
+        written = writev(fd, iov, count);
+
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return false;
+        }
+
+        while (count > 0 && (size_t) written >= iov->iov_len) {
+            written -= (ssize_t) iov->iov_len;
+            iov++;
+            count--;
+        }
+
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= (size_t) written;
+        }
+    }
+
+    return true;
+}
+
+static long microseconds_between(const struct timespec *from, const struct timespec *to) {
+    return (long) (to->tv_sec - from->tv_sec) * 1000000 + (to->tv_nsec - from->tv_nsec) / 1000;
+}
+
+static double milliseconds(const struct timeval *time) {
+    return (double) time->tv_sec * 1000.0 + (double) time->tv_usec / 1000.0;
+}
+
+static void subtract_rusage(struct rusage *usage, const struct rusage *before) {
+    usage->ru_utime.tv_sec -= before->ru_utime.tv_sec;
+    usage->ru_utime.tv_usec -= before->ru_utime.tv_usec;
+
+    if (usage->ru_utime.tv_usec < 0) {
+        usage->ru_utime.tv_sec--;
+        usage->ru_utime.tv_usec += 1000000;
+    }
+
+    usage->ru_stime.tv_sec -= before->ru_stime.tv_sec;
+    usage->ru_stime.tv_usec -= before->ru_stime.tv_usec;
+
+    if (usage->ru_stime.tv_usec < 0) {
+        usage->ru_stime.tv_sec--;
+        usage->ru_stime.tv_usec += 1000000;
+    }
+
+    usage->ru_minflt -= before->ru_minflt;
+    usage->ru_majflt -= before->ru_majflt;
+    usage->ru_nvcsw -= before->ru_nvcsw;
+    usage->ru_nivcsw -= before->ru_nivcsw;
+}
@@ -0,0 +1,408 @@
+#include <dc_posix/dc_stdlib.h>
+#include <dc_posix/dc_string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "batch.h"
+#include "execute.h"
+#include "mem_stats.h"
+
+#define POSIX_HEADROOM 2048
+
+extern char **environ;
+
+static size_t run_end(char **args, size_t count, size_t fixed_size, size_t limit, size_t max_args);
+static size_t fixed_size(const struct command *command, char **path, size_t first, size_t end);
+static struct redirection *truncate_output(const struct dc_posix_env *env, struct dc_error *err,
+                                           struct command *command);
+static void wait_for_one(pid_t *children, size_t count, struct batch_result *result);
+static void record(int status, struct batch_result *result);
+
+/**
+ * How much space an argument takes: the string, its NUL and the pointer to it.
+ *
+ * @param arg the argument.
+ * @return the number of bytes exec needs for it.
+ */
+size_t batch_argument_size(const char *arg) {
+    return strlen(arg) + 1 + sizeof(char *);
+}
+
+/**
+ * How much space is left for the arguments once the environment is in.
+ * 2048 bytes are kept back, as POSIX asks xargs to.
+ *
+ * @param envp the environment the command gets.
+ * @param arg_max the space exec has (see sysconf _SC_ARG_MAX).
+ * @return the space for the arguments, 0 if the environment is already too big.
+ */
+size_t batch_limit(char **envp, size_t arg_max) {
+    size_t used;
+
+    // the NULL at the end of the environment
+    used = POSIX_HEADROOM + sizeof(char *);
+
+    for (size_t i = 0; envp != NULL && envp[i] != NULL; i++) {
+        used += batch_argument_size(envp[i]);
+    }
+
+    return used >= arg_max ? 0 : arg_max - used;
+}
+
+/**
+ * Split a list into the fewest runs that fit: each run takes as many arguments as fit after the fixed
+ * size, so no run could have taken the first argument of the next one. An argument too big to fit with
+ * anything is a run by itself.
+ *
+ * @param args the arguments.
+ * @param count the number of arguments.
+ * @param fixed_size the space the command and the arguments that are in every run take.
+ * @param limit the space a run can take (see batch_limit).
+ * @param max_args the most arguments in a run, 0 for no limit.
+ * @param ends set to the index after the last argument of each run, or NULL to just count the runs.
+ * @return the number of runs.
+ */
+size_t batch_split(char **args, size_t count, size_t fixed_size, size_t limit, size_t max_args, size_t *ends) {
+    size_t runs;
+    size_t start;
+
+    runs = 0;
+    start = 0;
+
+    while (start < count) {
+        start += run_end(&args[start], count - start, fixed_size, limit, max_args);
+
+        if (ends != NULL) {
+            ends[runs] = start;
+        }
+
+        runs++;
+    }
+
+    return runs;
+}
+
+/**
+ * Is a command too big to exec in one go.
+ *
+ * @param env the posix environment.
+ * @param command the command.
+ * @param path the directories to search for the command.
+ * @param envp the environment the command gets.
+ * @param arg_max the space exec has (see sysconf _SC_ARG_MAX).
+ * @return true if the arguments and environment need more than arg_max.
+ */
+bool batch_needed(const struct dc_posix_env *env, const struct command *command, char **path, char **envp,
+                  size_t arg_max) {
+    size_t size;
+    size_t limit;
+
+    (void) env;
+    limit = batch_limit(envp, arg_max);
+    size = fixed_size(command, path, command->pathname_first, command->pathname_end);
+
+    for (size_t i = command->pathname_first; i < command->pathname_end && size <= limit; i++) {
+        size += batch_argument_size(command->argv[i]);
+    }
+
+    for (size_t i = 0; i < command->assignment_count && size <= limit; i++) {
+        size += batch_argument_size(command->assignments[i]);
+    }
+
+    return size > limit;
+}
+
+/**
+ * Run a command once per run of arguments (see batch_split), like xargs.
+ * argv[first..end) is split, the arguments before and after it are passed to every run.
+ * Redirected output is truncated once and then appended to by every run.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param command the command to run.
+ * @param first the index in argv of the first argument that can be split.
+ * @param end the index in argv after the last argument that can be split.
+ * @param path the directories to search for the command.
+ * @param variables the variables whose environment the command gets, or NULL to pass on the shell's environment.
+ * @param options the limits on each run, the number to run at once and how they are run.
+ * @param result set to the number of runs, failures and the worst exit status.
+ */
+void batch_execute(const struct dc_posix_env *env, struct dc_error *err, struct command *command, size_t first,
+                   size_t end, char **path, struct variables *variables, const struct batch_options *options,
+                   struct batch_result *result) {
+    struct command batch;
+    char **argv;
+    pid_t *children;
+    size_t jobs;
+    size_t running;
+    size_t limit;
+    size_t fixed;
+    size_t start;
+
+    result->batches = 0;
+    result->failures = 0;
+    result->worst = 0;
+
+    jobs = options->jobs;
+
+    if (jobs == 0) {
+        long processors;
+
+        processors = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = processors < 1 ? 1 : (size_t) processors;
+    }
+
+    limit = batch_limit(variables == NULL ? environ : variables_environ(variables), options->arg_max);
+
+    // the assignments are added to the command's environment
+    for (size_t i = 0; i < command->assignment_count; i++) {
+        size_t size;
+
+        size = batch_argument_size(command->assignments[i]);
+        limit = size >= limit ? 0 : limit - size;
+    }
+
+    if (options->max_bytes > 0 && options->max_bytes < limit) {
+        limit = options->max_bytes;
+    }
+
+    fixed = fixed_size(command, path, first, end);
+
+    // no run has more arguments than the whole command
+    argv = dc_malloc(env, err, (command->argc + 1) * sizeof(char *));
+    if (dc_error_has_error(err)) {
+        return;
+    }
+
+    children = dc_calloc(env, err, jobs, sizeof(pid_t));
+    if (dc_error_has_error(err)) {
+        dc_free(env, argv, (command->argc + 1) * sizeof(char *));
+        return;
+    }
+
+    batch = *command;
+    batch.argv = argv;
+
+    if (options->launch != NULL) {
+        batch.launch = options->launch;
+    }
+    batch.redirections = truncate_output(env, err, &batch);
+    if (dc_error_has_error(err)) {
+        dc_free(env, children, jobs * sizeof(pid_t));
+        dc_free(env, argv, (command->argc + 1) * sizeof(char *));
+        return;
+    }
+
+    running = 0;
+    start = first;
+
+    // an empty list still runs the command once, like xargs
+    do {
+        size_t stop;
+        size_t argc;
+        pid_t child;
+
+        stop = start + run_end(&command->argv[start], end - start, fixed, limit, options->max_args);
+        argc = 0;
+        argv[argc++] = NULL;
+
+        for (size_t i = 1; i < first; i++) {
+            argv[argc++] = command->argv[i];
+        }
+
+        for (size_t i = start; i < stop; i++) {
+            argv[argc++] = command->argv[i];
+        }
+
+        for (size_t i = end; i < command->argc; i++) {
+            argv[argc++] = command->argv[i];
+        }
+
+        argv[argc] = NULL;
+        batch.argc = argc;
+
+        if (running == jobs) {
+            wait_for_one(children, jobs, result);
+            running--;
+        }
+
+        child = execute_start(env, err, &batch, path, variables);
+
+        if (child == -1) {
+            break;
+        }
+
+        for (size_t i = 0; i < jobs; i++) {
+            if (children[i] == 0) {
+                children[i] = child;
+                break;
+            }
+        }
+
+        running++;
+        result->batches++;
+        start = stop;
+    } while (start < end);
+
+    while (running > 0) {
+        wait_for_one(children, jobs, result);
+        running--;
+    }
+
+    if (batch.redirections != NULL) {
+        dc_free(env, batch.redirections, batch.redirection_count * sizeof(struct redirection));
+    }
+
+    dc_free(env, children, jobs * sizeof(pid_t));
+    dc_free(env, argv, (command->argc + 1) * sizeof(char *));
+}
+
+/*
+ * The number of arguments from the start of args that fit in one run (at least 1).
+ */
+static size_t run_end(char **args, size_t count, size_t fixed_size, size_t limit, size_t max_args) {
+    size_t size;
+    size_t taken;
+
+    size = fixed_size;
+    taken = 0;
+
+    while (taken < count && (max_args == 0 || taken < max_args)) {
+        size_t arg_size;
+
+        arg_size = batch_argument_size(args[taken]);
+
+        // a run has to have something in it, even if it is too big - exec reports the E2BIG
+        if (taken > 0 && size + arg_size > limit) {
+            break;
+        }
+
+        size += arg_size;
+        taken++;
+    }
+
+    return taken;
+}
+
+/*
+ * The space taken by the program name, the arguments outside the list and the NULL after the last argument.
+ * The name is the longest one the search of the path can try.
+ */
+static size_t fixed_size(const struct command *command, char **path, size_t first, size_t end) {
+    size_t size;
+    size_t longest;
+
+    longest = 0;
+
+    if (strchr(command->command, '/') == NULL) {
+        for (size_t i = 0; path != NULL && path[i] != NULL; i++) {
+            size_t length;
+
+            length = strlen(path[i]) + 1;
+            longest = length > longest ? length : longest;
+        }
+    }
+
+    size = longest + batch_argument_size(command->command) + sizeof(char *);
+
+    for (size_t i = 1; i < command->argc; i++) {
+        if (i < first || i >= end) {
+            size += batch_argument_size(command->argv[i]);
+        }
+    }
+
+    return size;
+}
+
+/*
+ * Every run appends, so a > file is truncated once here rather than by each run. The runs get a copy of
+ * the redirections (see command_redirections) with the > changed to >>, the files are shared with the
+ * command's.
+ */
+static struct redirection *truncate_output(const struct dc_posix_env *env, struct dc_error *err,
+                                           struct command *command) {
+    const struct redirection *original;
+    struct redirection *redirections;
+    struct redirection files[4];
+    size_t count;
+
+    original = command_redirections(command, files, &count);
+    command->redirection_count = 0;
+
+    if (count == 0) {
+        return NULL;
+    }
+
+    redirections = dc_malloc(env, err, count * sizeof(struct redirection));
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    dc_memcpy(env, redirections, original, count * sizeof(struct redirection));
+    command->redirection_count = count;
+
+    for (size_t i = 0; i < count; i++) {
+        if (redirections[i].type == REDIRECT_OUTPUT) {
+            int fd;
+
+            fd = open(redirections[i].target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                      S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+            if (fd != -1) {
+                close(fd);
+            }
+
+            redirections[i].type = REDIRECT_APPEND;
+        }
+    }
+
+    return redirections;
+}
+
+static void wait_for_one(pid_t *children, size_t count, struct batch_result *result) {
+    for (;;) {
+        pid_t child;
+        int status;
+
+        child = waitpid(-1, &status, 0);
+
+        if (child == -1) {
+            // nothing left to wait for (ECHILD), so the table is out of date
+            if (errno != EINTR) {
+                memset(children, 0, count * sizeof(pid_t));
+                return;
+            }
+
+            continue;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            if (children[i] == child) {
+                children[i] = 0;
+                record(status, result);
+                return;
+            }
+        }
+    }
+}
+
+static void record(int status, struct batch_result *result) {
+    int code;
+
+    if (WIFEXITED(status)) {
+        code = WEXITSTATUS(status);
+    } else {
+        code = 128 + WTERMSIG(status);
+    }
+
+    if (code != 0) {
+        result->failures++;
+    }
+
+    if (code > result->worst) {
+        result->worst = code;
+    }
+}
@@ -2,9 +2,40 @@
 #include <dc_posix/dc_unistd.h>
 #include <dc_posix/dc_stdlib.h>
 #include <dc_posix/dc_stdio.h>
+#include <dc_util/filesystem.h>
 #include <dc_util/path.h>
+#include <inttypes.h>
+#include <stdlib.h>
 #include <wordexp.h>
+#include "batch.h"
 #include "builtins.h"
+#include "mem_stats.h"
+
+static void declare(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                    struct variables *variables, enum variables_filter filter, FILE *outstream, FILE *errstream);
+static void report(struct dc_error *err, struct command *command, const char *name, FILE *errstream);
+static bool parse_size(const char *string, size_t *value);
+static char **read_items(const struct dc_posix_env *env, struct dc_error *err, FILE *stream, bool nul,
+                         size_t *count);
+static void add_item_char(const struct dc_posix_env *env, struct dc_error *err, char **item, size_t *length,
+                          size_t *capacity, char c);
+static void add_item(const struct dc_posix_env *env, struct dc_error *err, char ***items, size_t *count,
+                     size_t *capacity, char **item, size_t *length);
+static void free_items(const struct dc_posix_env *env, char **items, size_t count);
+static int xargs_status(const struct batch_result *result);
+static size_t parse_kill_after(struct command *command, size_t i, struct timeout *timeout, bool *ok);
+static bool is_launch_prefix(const struct dc_posix_env *env, const char *word);
+static void run_launched(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                         struct launch *launch, char **path, struct variables *variables, FILE *outstream,
+                         FILE *errstream);
+static size_t ulimit_end(const struct command *command, size_t first);
+static bool parse_ulimit(struct command *command, size_t first, size_t end, struct launch *target, FILE *outstream,
+                         FILE *errstream);
+static bool is_limit_value(const char *word);
+static void show_limit(const struct launch *launch, char option, bool hard, bool described, FILE *outstream);
+static void run_program(const struct dc_posix_env *env, struct dc_error *err, struct command *command, size_t first,
+                        char **path, struct variables *variables, const struct timeout *timeout,
+                        const struct launch *launch);
 
 
 /**
@@ -32,8 +63,13 @@ void builtin_cd(const struct dc_posix_env *env, struct dc_error *err,
         path = dc_strdup(env, err, command->argv[1]);
     }
 
+    // the expanded path is a new string, the one it replaces is freed
     if (dc_strstr(env, path, "~") != NULL) {
-        dc_expand_path(env, err, &path, "~");
+        char *expanded;
+
+        dc_expand_path(env, err, &expanded, "~");
+        dc_free(env, path, strlen(path) + 1);
+        path = expanded;
     }
 
 
@@ -59,12 +95,983 @@ void builtin_cd(const struct dc_posix_env *env, struct dc_error *err,
         fprintf(errstream, "%s\n", string);
         command->exit_code = 1;
 
-        dc_free(env, string, strlen(string));
-        dc_free(env, message   , strlen(message));
+        dc_free(env, string, strlen(string) + 1);
+        dc_free(env, message   , strlen(message) + 1);
     } else {
         command->exit_code = 0;
     }
 
-    dc_free(env, path, strlen(path));
+    dc_free(env, path, strlen(path) + 1);
+
+}
+
+/**
+ * Display the arguments separated by spaces and followed by a newline (not with -n as the first argument).
+ * The command->exit_code is set to 0, or 1 if the output could not be written.
+ *
+ * @param env the posix environment.
+ * @param err the error object
+ * @param command the command information
+ * @param outstream the stream to display the arguments on
+ */
+void builtin_echo(const struct dc_posix_env *env, __attribute__((unused)) struct dc_error *err, struct command *command,
+                  FILE *outstream) {
+    size_t first;
+    bool newline;
+
+    first = 1;
+    newline = true;
+
+    if (command->argc > 1 && dc_strcmp(env, command->argv[1], "-n") == 0) {
+        first = 2;
+        newline = false;
+    }
+
+    for (size_t i = first; i < command->argc; i++) {
+        if (i > first) {
+            fputc(' ', outstream);
+        }
+
+        fputs(command->argv[i], outstream);
+    }
+
+    if (newline) {
+        fputc('\n', outstream);
+    }
+
+    // a command run after this one writes to the file directly, so nothing can be left in the buffer
+    fflush(outstream);
+    command->exit_code = ferror(outstream) ? 1 : 0;
+}
+
+/**
+ * Display the working directory.
+ * The command->exit_code is set to 0 on success or 1 if the directory can't be found.
+ *
+ * @param env the posix environment.
+ * @param err the error object
+ * @param command the command information
+ * @param outstream the stream to display the directory on
+ * @param errstream the stream to print error messages to
+ */
+void builtin_pwd(const struct dc_posix_env *env, struct dc_error *err, struct command *command, FILE *outstream,
+                 FILE *errstream) {
+    char *cwd;
+
+    cwd = dc_get_working_dir(env, err);
+
+    if (dc_error_has_error(err)) {
+        report(err, command, "pwd", errstream);
+        return;
+    }
+
+    fprintf(outstream, "%s\n", cwd);
+    fflush(outstream);
+    dc_free(env, cwd, strlen(cwd) + 1);
+    command->exit_code = 0;
+}
+
+/**
+ * Evaluate arithmetic expressions (see arith_parse), one per argument, for their assignments.
+ * The command->exit_code is set to 0 if the last expression is not 0, or 1 if it is 0 or an expression is bad.
+ *
+ * @param env the posix environment.
+ * @param err the error object
+ * @param command the command information
+ * @param cache the parsed expressions (see arith_cache_evaluate), may be NULL
+ * @param variables the shell variables
+ * @param errstream the stream to print error messages to
+ */
+void builtin_let(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                 struct arith_cache *cache, struct variables *variables, FILE *errstream) {
+    int64_t value;
+
+    if (command->argc < 2) {
+        fprintf(errstream, "let: expression expected\n");
+        command->exit_code = 1;
+        return;
+    }
+
+    value = 0;
+
+    for (size_t i = 1; i < command->argc; i++) {
+        value = arith_cache_evaluate(env, err, cache, variables, command->argv[i]);
+
+        if (dc_error_has_error(err)) {
+            report(err, command, "let", errstream);
+            return;
+        }
+    }
+
+    command->exit_code = value == 0 ? 1 : 0;
+}
+
+/**
+ * Export variables: each argument is NAME or NAME=value.
+ * With no arguments (or -p) the exported variables are displayed.
+ * The command->exit_code is set to 0 on success or 1 if any argument could not be exported.
+ *
+ * @param env the posix environment.
+ * @param err the error object
+ * @param command the command information
+ * @param variables the shell variables
+ * @param outstream the stream to display the variables on
+ * @param errstream the stream to print error messages to
+ */
+void builtin_export(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                    struct variables *variables, FILE *outstream, FILE *errstream) {
+    declare(env, err, command, variables, VARIABLES_EXPORTED, outstream, errstream);
+}
+
+/**
+ * Make variables readonly: each argument is NAME or NAME=value.
+ * With no arguments (or -p) the readonly variables are displayed.
+ * The command->exit_code is set to 0 on success or 1 if any argument could not be made readonly.
+ *
+ * @param env the posix environment.
+ * @param err the error object
+ * @param command the command information
+ * @param variables the shell variables
+ * @param outstream the stream to display the variables on
+ * @param errstream the stream to print error messages to
+ */
+void builtin_readonly(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                      struct variables *variables, FILE *outstream, FILE *errstream) {
+    declare(env, err, command, variables, VARIABLES_READONLY, outstream, errstream);
+}
+
+/**
+ * Remove variables: each argument is a NAME.
+ * The command->exit_code is set to 0 on success or 1 if any variable could not be removed.
+ *
+ * @param env the posix environment.
+ * @param err the error object
+ * @param command the command information
+ * @param variables the shell variables
+ * @param errstream the stream to print error messages to
+ */
+void builtin_unset(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                   struct variables *variables, FILE *errstream) {
+    command->exit_code = 0;
+
+    for (size_t i = 1; i < command->argc; i++) {
+        if (!variables_is_name(command->argv[i], strlen(command->argv[i]))) {
+            fprintf(errstream, "unset: %s: not a valid identifier\n", command->argv[i]);
+            command->exit_code = 1;
+            continue;
+        }
+
+        variables_unset(env, err, variables, command->argv[i]);
+        report(err, command, command->argv[i], errstream);
+    }
+}
+
+/**
+ * exec [command [arguments]]: with a command, replace the shell with it (see execute_replace), it does not
+ * return. Without one the redirections are applied to the shell itself, so they stay for the commands
+ * after it (exec 3< file, exec 2> log, exec > a > b, see redirect_shell).
+ * The command->exit_code is set to 0, or 1 if a redirection failed.
+ *
+ * @param env the posix environment.
+ * @param err the error object
+ * @param command the command information
+ * @param path the directories to search for the command
+ * @param variables the shell variables
+ * @param outstream the shell's output, flushed before it is redirected
+ * @param errstream the stream to print error messages to
+ */
+void builtin_exec(const struct dc_posix_env *env, struct dc_error *err, struct command *command, char **path,
+                  struct variables *variables, FILE *outstream, FILE *errstream) {
+    if (command->argc < 2) {
+        // what the shell has buffered goes where it was going
+        fflush(outstream);
+        fflush(errstream);
+        redirect_shell(env, err, command);
+
+        if (dc_error_has_error(err)) {
+            fprintf(errstream, "exec: %s\n", err->message);
+            dc_error_reset(err);
+            command->exit_code = 1;
+            return;
+        }
+
+        command->exit_code = 0;
+        return;
+    }
+
+    // the first argument is the command, the rest are its arguments
+    dc_free(env, command->command, strlen(command->command) + 1);
+    command->command = command->argv[1];
+
+    for (size_t i = 1; i < command->argc; i++) {
+        command->argv[i] = command->argv[i + 1];
+    }
+
+    command->argc--;
+    execute_replace(env, err, command, path, variables);
+}
+
+/**
+ * timeout [-k KILL_AFTER] DURATION [-k KILL_AFTER] command [arguments]: run the program, sending it SIGTERM
+ * if it is still running after DURATION and SIGKILL KILL_AFTER after that (see execute_timed).
+ * The durations are numbers of seconds, or have an s, m, h or d suffix (see parse_duration).
+ * The command->exit_code is the program's, 124 if it timed out, 137 if it was killed, or 125 for a usage error.
+ *
+ * @param env the posix environment.
+ * @param err the error object
+ * @param command the command information
+ * @param path the directories to search for the command
+ * @param variables the shell variables
+ * @param errstream the stream to print error messages to
+ */
+void builtin_timeout(const struct dc_posix_env *env, struct dc_error *err, struct command *command, char **path,
+                     struct variables *variables, FILE *errstream) {
+    struct timeout timeout;
+    size_t i;
+    bool ok;
+
+    timeout.kill_after = 0;
+    ok = true;
+    i = parse_kill_after(command, 1, &timeout, &ok);
+    ok = ok && i < command->argc && parse_duration(command->argv[i], &timeout.duration);
+    i = ok ? parse_kill_after(command, i + 1, &timeout, &ok) : i;
+
+    if (!ok || i >= command->argc) {
+        fprintf(errstream, "timeout: usage: timeout [-k KILL_AFTER] DURATION command [arguments]\n");
+        command->exit_code = 125;
+        return;
+    }
+
+    run_program(env, err, command, i, path, variables, &timeout, NULL);
+}
+
+/**
+ * pin CPUS, nice [-n] [ADJUSTMENT] and ionice CLASS[:LEVEL] in front of a command: run the program on the
+ * CPUs (eg. 2-5 or 0,4-7), with ADJUSTMENT (10 if there is none) added to its nice value, or in the I/O
+ * class (idle, best-effort or realtime). They can be combined, with each other and with ulimit, in any order,
+ * eg. pin 2-5 nice 10 ulimit -v 1000000 ionice idle make.
+ * They are set in the child before the exec (see launch_apply), so no other program is run to do it.
+ * The command->exit_code is the program's, or 125 for a usage error or if they could not be set.
+ *
+ * @param env the posix environment.
+ * @param err the error object
+ * @param command the command information, the command->command is pin, nice or ionice
+ * @param path the directories to search for the command
+ * @param variables the shell variables
+ * @param outstream the stream a ulimit after them prints the limits to
+ * @param errstream the stream to print error messages to
+ */
+void builtin_launch(const struct dc_posix_env *env, struct dc_error *err, struct command *command, char **path,
+                    struct variables *variables, FILE *outstream, FILE *errstream) {
+    struct launch launch;
+
+    // the prefixes add to the limits the command already has
+    if (command->launch == NULL) {
+        launch_init(&launch);
+    } else {
+        launch = *command->launch;
+    }
+
+    run_launched(env, err, command, &launch, path, variables, outstream, errstream);
+}
+
+/**
+ * ulimit [-H | -S] [-a | -c | -d | -f | -n | -s | -t | -u | -v [VALUE]]... [command [arguments]]: show or set the
+ * resource limits programs are run with (see launch_parse_limit), -f if no resource is given. -H is the hard
+ * limit, -S the soft one, a VALUE without either sets both. -a shows all of them.
+ * Without a command the limits are kept for the session, and every program is run with them (see run_command).
+ * With a command they only apply to its program, on top of the session's, and the command can be pin, nice or
+ * ionice too (eg. ulimit -n 64 pin 0 make, see builtin_launch). Either way they are set in the child before
+ * the exec, so the shell itself is never limited.
+ * The command->exit_code is the program's, or 0, or 1 for a bad option or value.
+ *
+ * @param env the posix environment.
+ * @param err the error object
+ * @param command the command information
+ * @param limits the session's limits
+ * @param path the directories to search for the command
+ * @param variables the shell variables
+ * @param outstream the stream to print the limits to
+ * @param errstream the stream to print error messages to
+ */
+void builtin_ulimit(const struct dc_posix_env *env, struct dc_error *err, struct command *command, struct launch *limits,
+                    char **path, struct variables *variables, FILE *outstream, FILE *errstream) {
+    struct launch program_limits;
+
+    if (ulimit_end(command, 1) < command->argc) {
+        if (command->launch == NULL) {
+            launch_init(&program_limits);
+        } else {
+            program_limits = *command->launch;
+        }
+
+        run_launched(env, err, command, &program_limits, path, variables, outstream, errstream);
+        return;
+    }
+
+    command->exit_code = 0;
+    parse_ulimit(command, 1, command->argc, limits, outstream, errstream);
+}
+
+/**
+ * Run a command with arguments read from a file, as few times as the space exec has allows (see batch_execute).
+ * The items are separated by blanks and newlines, and can be quoted with ' or " or escaped with \\.
+ * The options are -0 (the items are separated by '\\0' instead), -n N (at most N items per command),
+ * -s N (at most N bytes of items per command) and -P N (run N commands at once, 0 for one per processor).
+ * The command is echo if none is given. The commands are run with the CPUs, nice value and I/O class from
+ * BATCH_PIN, BATCH_NICE and BATCH_IONICE (see launch_defaults).
+ * The command->exit_code is set the way xargs does: 0 if every command succeeded, 123 if any failed,
+ * 124 if one exited with 255, 125 if one was killed, and 126 or 127 if the command could not be run or found.
+ *
+ * @param env the posix environment.
+ * @param err the error object
+ * @param command the command information, the items are read from the command->here_document or
+ *                command->stdin_file if there is one
+ * @param path the directories to search for the command
+ * @param variables the shell variables
+ * @param arg_max the space exec has for the arguments and environment (see state max_line_length)
+ * @param instream the stream to read the items from if there is no here_document or stdin_file
+ * @param errstream the stream to print error messages to
+ */
+void builtin_xargs(const struct dc_posix_env *env, struct dc_error *err, struct command *command, char **path,
+                   struct variables *variables, size_t arg_max, FILE *instream, FILE *errstream) {
+    struct batch_options options;
+    struct batch_result result;
+    struct launch launch;
+    struct command batch;
+    char echo_name[] = "echo";
+    char dev_null[] = "/dev/null";
+    char *echo[] = { echo_name, NULL };
+    char **words;
+    char **items;
+    size_t word_count;
+    size_t item_count;
+    size_t i;
+    bool nul;
+    FILE *input;
+    const struct redirection *redirections;
+    struct redirection files[4];
+    size_t count;
+
+    command->exit_code = 1;
+    options.arg_max = arg_max;
+    options.max_bytes = 0;
+    options.max_args = 0;
+    options.jobs = 1;
+    options.launch = launch_defaults(env, variables, command->launch, &launch) ? &launch : NULL;
+    nul = false;
+
+    for (i = 1; i < command->argc && command->argv[i][0] == '-'; i++) {
+        const char *option;
+        size_t *value;
+
+        option = command->argv[i];
+
+        if (dc_strcmp(env, option, "--") == 0) {
+            i++;
+            break;
+        }
+
+        if (dc_strcmp(env, option, "-0") == 0) {
+            nul = true;
+            continue;
+        }
+
+        if (dc_strcmp(env, option, "-n") == 0) {
+            value = &options.max_args;
+        } else if (dc_strcmp(env, option, "-s") == 0) {
+            value = &options.max_bytes;
+        } else if (dc_strcmp(env, option, "-P") == 0) {
+            value = &options.jobs;
+        } else {
+            fprintf(errstream, "xargs: %s: unknown option\n", option);
+            return;
+        }
+
+        if (i + 1 >= command->argc || !parse_size(command->argv[i + 1], value)) {
+            fprintf(errstream, "xargs: %s: needs a number\n", option);
+            return;
+        }
+
+        i++;
+    }
+
+    if (i < command->argc) {
+        words = &command->argv[i];
+        word_count = command->argc - i;
+    } else {
+        words = echo;
+        word_count = 1;
+    }
+
+    if (command->here_document != NULL) {
+        // fmemopen can't open an empty buffer
+        input = command->here_document[0] == '\0' ? fopen(dev_null, "r") :
+                fmemopen(command->here_document, strlen(command->here_document), "r");
+
+        if (input == NULL) {
+            fprintf(errstream, "xargs: %s\n", strerror(errno));
+            return;
+        }
+    } else if (command->stdin_file == NULL) {
+        input = instream;
+    } else {
+        input = fopen(command->stdin_file, "r");
+
+        if (input == NULL) {
+            fprintf(errstream, "xargs: %s: %s\n", command->stdin_file, strerror(errno));
+            return;
+        }
+    }
+
+    items = read_items(env, err, input, nul, &item_count);
+
+    if (input != instream) {
+        fclose(input);
+    }
+
+    if (dc_error_has_error(err)) {
+        return;
+    }
+
+    // argv[0] is filled in by the search of the path
+    dc_memset(env, &batch, 0, sizeof(struct command));
+    batch.argc = word_count + item_count;
+    batch.argv = dc_malloc(env, err, (batch.argc + 1) * sizeof(char *));
+    if (dc_error_has_error(err)) {
+        free_items(env, items, item_count);
+        return;
+    }
+
+    batch.command = words[0];
+    batch.argv[0] = NULL;
+    dc_memcpy(env, &batch.argv[1], &words[1], (word_count - 1) * sizeof(char *));
+
+    if (item_count > 0) {
+        dc_memcpy(env, &batch.argv[word_count], items, item_count * sizeof(char *));
+    }
+
+    batch.argv[batch.argc] = NULL;
+
+    // the commands do not get the items as their input, the rest of the redirections are shared
+    redirections = command_redirections(command, files, &count);
+    batch.redirections = dc_malloc(env, err, (count + 1) * sizeof(struct redirection));
+    if (dc_error_has_error(err)) {
+        dc_free(env, batch.argv, (batch.argc + 1) * sizeof(char *));
+        free_items(env, items, item_count);
+        return;
+    }
+
+    batch.redirections[0].fd = 0;
+    batch.redirections[0].type = REDIRECT_INPUT;
+    batch.redirections[0].target = dev_null;
+    batch.redirections[0].source = -1;
+    batch.redirection_count = 1;
+
+    for (i = 0; i < count; i++) {
+        if (redirections[i].fd != 0) {
+            batch.redirections[batch.redirection_count++] = redirections[i];
+        }
+    }
+
+    batch.assignments = command->assignments;
+    batch.assignment_count = command->assignment_count;
+
+    batch_execute(env, err, &batch, word_count, batch.argc, path, variables, &options, &result);
+
+    if (dc_error_has_no_error(err)) {
+        command->exit_code = xargs_status(&result);
+    }
+
+    dc_free(env, batch.redirections, (count + 1) * sizeof(struct redirection));
+    dc_free(env, batch.argv, (batch.argc + 1) * sizeof(char *));
+    free_items(env, items, item_count);
+}
+
+static void declare(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                    struct variables *variables, enum variables_filter filter, FILE *outstream, FILE *errstream) {
+    const char *builtin;
+
+    builtin = filter == VARIABLES_EXPORTED ? "export" : "readonly";
+    command->exit_code = 0;
+
+    if (command->argc < 2 || (command->argc == 2 && dc_strcmp(env, command->argv[1], "-p") == 0)) {
+        variables_print(env, err, variables, filter, outstream);
+        report(err, command, builtin, errstream);
+        return;
+    }
+
+    for (size_t i = 1; i < command->argc; i++) {
+        char *name;
+        char *value;
+        char *equals;
+
+        name = dc_strdup(env, err, command->argv[i]);
+        if (dc_error_has_error(err)) {
+            return;
+        }
+
+        equals = dc_strchr(env, name, '=');
+        value = NULL;
+
+        if (equals != NULL) {
+            *equals = '\0';
+            value = equals + 1;
+        }
+
+        if (!variables_is_name(name, strlen(name))) {
+            fprintf(errstream, "%s: %s: not a valid identifier\n", builtin, name);
+            command->exit_code = 1;
+        } else {
+            if (filter == VARIABLES_EXPORTED) {
+                variables_export(env, err, variables, name, value);
+            } else {
+                variables_readonly(env, err, variables, name, value);
+            }
+
+            report(err, command, name, errstream);
+        }
+
+        // the string was split in two by the '\0'
+        dc_free(env, name, strlen(command->argv[i]) + 1);
+    }
+}
+
+/*
+ * A bad variable fails the builtin, not the shell, so the error is displayed and cleared.
+ */
+static void report(struct dc_error *err, struct command *command, const char *name, FILE *errstream) {
+    if (dc_error_has_no_error(err)) {
+        return;
+    }
+
+    fprintf(errstream, "%s: %s\n", name, err->message);
+    command->exit_code = 1;
+    dc_error_reset(err);
+}
+
+static bool parse_size(const char *string, size_t *value) {
+    char *end;
+    unsigned long number;
+
+    if (*string < '0' || *string > '9') {
+        return false;
+    }
+
+    errno = 0;
+    number = strtoul(string, &end, 10);
+
+    if (*end != '\0' || errno != 0) {
+        return false;
+    }
+
+    *value = number;
+
+    return true;
+}
+
+/*
+ * Read the whole stream, splitting it into items the way xargs does.
+ */
+static char **read_items(const struct dc_posix_env *env, struct dc_error *err, FILE *stream, bool nul,
+                         size_t *count) {
+    char **items;
+    char *item;
+    size_t capacity;
+    size_t length;
+    size_t item_capacity;
+    int quote;
+    bool escaped;
+    bool started;
+    int c;
+
+    items = NULL;
+    item = NULL;
+    *count = 0;
+    capacity = 0;
+    length = 0;
+    item_capacity = 0;
+    quote = '\0';
+    escaped = false;
+    started = false;
+
+    while ((c = getc(stream)) != EOF && dc_error_has_no_error(err)) {
+        if (nul) {
+            if (c == '\0') {
+                add_item(env, err, &items, count, &capacity, &item, &length);
+            } else {
+                add_item_char(env, err, &item, &length, &item_capacity, (char) c);
+            }
+        } else if (escaped) {
+            add_item_char(env, err, &item, &length, &item_capacity, (char) c);
+            escaped = false;
+        } else if (quote != '\0') {
+            if (c == quote) {
+                quote = '\0';
+            } else {
+                add_item_char(env, err, &item, &length, &item_capacity, (char) c);
+            }
+        } else if (c == '\\') {
+            escaped = true;
+            started = true;
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+            started = true;
+        } else if (c == ' ' || c == '\t' || c == '\n') {
+            if (started || length > 0) {
+                add_item(env, err, &items, count, &capacity, &item, &length);
+                started = false;
+            }
+        } else {
+            add_item_char(env, err, &item, &length, &item_capacity, (char) c);
+        }
+    }
+
+    // the last item does not have to be terminated
+    if ((started || length > 0) && dc_error_has_no_error(err)) {
+        add_item(env, err, &items, count, &capacity, &item, &length);
+    }
+
+    if (item != NULL) {
+        dc_free(env, item, item_capacity);
+    }
+
+    // free_items only knows the count
+    if (items != NULL && dc_error_has_no_error(err)) {
+        char **trimmed;
+
+        trimmed = dc_realloc(env, err, items, (*count + 1) * sizeof(char *));
+
+        if (trimmed != NULL) {
+            items = trimmed;
+        }
+    }
+
+    if (dc_error_has_error(err)) {
+        free_items(env, items, *count);
+        *count = 0;
+        return NULL;
+    }
+
+    return items;
+}
+
+static void add_item_char(const struct dc_posix_env *env, struct dc_error *err, char **item, size_t *length,
+                          size_t *capacity, char c) {
+    if (*length + 1 >= *capacity) {
+        size_t new_capacity;
+        char *new_item;
+
+        new_capacity = *capacity == 0 ? 32 : *capacity * 2;
+        new_item = dc_realloc(env, err, *item, new_capacity);
+        if (dc_error_has_error(err)) {
+            return;
+        }
+
+        *item = new_item;
+        *capacity = new_capacity;
+    }
+
+    (*item)[(*length)++] = c;
+}
+
+static void add_item(const struct dc_posix_env *env, struct dc_error *err, char ***items, size_t *count,
+                     size_t *capacity, char **item, size_t *length) {
+    char *copy;
+
+    if (*count + 1 >= *capacity) {
+        size_t new_capacity;
+        char **new_items;
+
+        new_capacity = *capacity == 0 ? 64 : *capacity * 2;
+        new_items = dc_realloc(env, err, *items, new_capacity * sizeof(char *));
+        if (dc_error_has_error(err)) {
+            return;
+        }
+
+        *items = new_items;
+        *capacity = new_capacity;
+    }
+
+    copy = dc_strndup(env, err, *item == NULL ? "" : *item, *length);
+    if (dc_error_has_error(err)) {
+        return;
+    }
+
+    (*items)[(*count)++] = copy;
+    (*items)[*count] = NULL;
+    *length = 0;
+}
+
+static void free_items(const struct dc_posix_env *env, char **items, size_t count) {
+    if (items == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        dc_free(env, items[i], strlen(items[i]) + 1);
+    }
+
+    dc_free(env, items, (count + 1) * sizeof(char *));
+}
+
+static int xargs_status(const struct batch_result *result) {
+    if (result->failures == 0) {
+        return 0;
+    }
+
+    if (result->worst == 255) {
+        return 124;
+    }
+
+    if (result->worst == 126 || result->worst == 127) {
+        return result->worst;
+    }
+
+    if (result->worst > 128) {
+        return 125;
+    }
+
+    return 123;
+}
+
+/*
+ * -k KILL_AFTER at argv[i], returns the index after it (i if there is none).
+ */
+static size_t parse_kill_after(struct command *command, size_t i, struct timeout *timeout, bool *ok) {
+    if (i >= command->argc || strcmp(command->argv[i], "-k") != 0) {
+        return i;
+    }
+
+    if (i + 1 >= command->argc || !parse_duration(command->argv[i + 1], &timeout->kill_after)) {
+        *ok = false;
+        return i;
+    }
+
+    return i + 2;
+}
+
+static bool is_launch_prefix(const struct dc_posix_env *env, const char *word) {
+    return dc_strcmp(env, word, "pin") == 0 || dc_strcmp(env, word, "nice") == 0 ||
+           dc_strcmp(env, word, "ionice") == 0 || dc_strcmp(env, word, "ulimit") == 0;
+}
+
+/*
+ * Run the program after the prefixes, the first of which is the command->command: pin, nice, ionice and
+ * ulimit, in any order (eg. ulimit -n 10 pin 0 make or pin 0 ulimit -n 10 make). Each one adds to the launch.
+ */
+static void run_launched(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                         struct launch *launch, char **path, struct variables *variables, FILE *outstream,
+                         FILE *errstream) {
+    const char *name;
+    size_t i;
+
+    name = command->command;
+    i = 1;
+
+    for (;;) {
+        bool ok;
+
+        if (dc_strcmp(env, name, "pin") == 0) {
+            ok = i < command->argc && launch_parse_cpus(launch, command->argv[i]);
+            i++;
+        } else if (dc_strcmp(env, name, "nice") == 0) {
+            if (i < command->argc && dc_strcmp(env, command->argv[i], "-n") == 0) {
+                ok = i + 1 < command->argc && launch_parse_nice(launch, command->argv[i + 1]);
+                i += 2;
+            } else {
+                ok = true;
+
+                if (i < command->argc && launch_parse_nice(launch, command->argv[i])) {
+                    i++;
+                } else {
+                    launch_parse_nice(launch, "10");
+                }
+            }
+        } else if (dc_strcmp(env, name, "ionice") == 0) {
+            ok = i < command->argc && launch_parse_ionice(launch, command->argv[i]);
+            i++;
+        } else {
+            size_t end;
+
+            // as a prefix the limits are only for the program, so there has to be one
+            end = ulimit_end(command, i);
+            ok = end < command->argc;
+
+            if (ok && !parse_ulimit(command, i, end, launch, outstream, errstream)) {
+                return;
+            }
+
+            i = end;
+        }
+
+        if (!ok || i >= command->argc) {
+            fprintf(errstream, "%s: usage: [pin CPUS] [nice [-n] ADJUSTMENT] [ionice CLASS[:LEVEL]] [ulimit LIMITS] "
+                               "command [arguments]\n", name);
+            command->exit_code = 125;
+            return;
+        }
+
+        if (!is_launch_prefix(env, command->argv[i])) {
+            break;
+        }
+
+        name = command->argv[i];
+        i++;
+    }
+
+    run_program(env, err, command, i, path, variables, NULL, launch);
+}
+
+/*
+ * The words from first up to the first one that is not an option or a value are the ulimit's.
+ */
+static size_t ulimit_end(const struct command *command, size_t first) {
+    size_t end;
+
+    end = first;
+
+    while (end < command->argc) {
+        const char *word;
+
+        word = command->argv[end];
+
+        if ((word[0] == '-' && word[1] != '\0') || is_limit_value(word)) {
+            end++;
+        } else {
+            break;
+        }
+    }
+
+    return end;
+}
+
+/*
+ * Set or show the limits in the ulimit's words, from first to end. If there is no program after them
+ * (end is the command->argc) and they show nothing the file size is shown, like POSIX ulimit.
+ * A bad option or value is displayed and the command->exit_code set to 1.
+ */
+static bool parse_ulimit(struct command *command, size_t first, size_t end, struct launch *target, FILE *outstream,
+                         FILE *errstream) {
+    bool soft;
+    bool hard;
+    bool shown;
+
+    soft = false;
+    hard = false;
+    shown = false;
+
+    for (size_t i = first; i < end; i++) {
+        const char *option;
+
+        // a value on its own is for the file size, like POSIX ulimit
+        if (is_limit_value(command->argv[i])) {
+            if (!launch_parse_limit(target, 'f', command->argv[i], soft || !hard, hard || !soft)) {
+                fprintf(errstream, "ulimit: %s: invalid number\n", command->argv[i]);
+                command->exit_code = 1;
+                return false;
+            }
+
+            shown = true;
+            continue;
+        }
+
+        for (option = &command->argv[i][1]; *option != '\0'; option++) {
+            if (*option == 'H') {
+                hard = true;
+            } else if (*option == 'S') {
+                soft = true;
+            } else if (*option == 'a') {
+                for (const char *all = LAUNCH_LIMIT_OPTIONS; *all != '\0'; all++) {
+                    show_limit(target, *all, hard, true, outstream);
+                }
+
+                shown = true;
+            } else if (launch_limit_description(*option) == NULL) {
+                fprintf(errstream, "ulimit: -%c: invalid option\n", *option);
+                command->exit_code = 1;
+                return false;
+            } else if (option[1] == '\0' && i + 1 < end && is_limit_value(command->argv[i + 1])) {
+                i++;
+
+                if (!launch_parse_limit(target, *option, command->argv[i], soft || !hard, hard || !soft)) {
+                    fprintf(errstream, "ulimit: %s: invalid number\n", command->argv[i]);
+                    command->exit_code = 1;
+                    return false;
+                }
+
+                shown = true;
+            } else {
+                show_limit(target, *option, hard, false, outstream);
+                shown = true;
+            }
+        }
+    }
+
+    if (!shown && end == command->argc) {
+        show_limit(target, 'f', hard, false, outstream);
+    }
+
+    return true;
+}
+
+/*
+ * A negative number is taken as a value too, so it is an invalid number rather than an invalid option.
+ */
+static bool is_limit_value(const char *word) {
+    const char *digits;
+
+    digits = word[0] == '-' ? &word[1] : word;
+
+    return (digits[0] >= '0' && digits[0] <= '9') || strcmp(word, "unlimited") == 0;
+}
+
+/*
+ * ulimit -a shows each limit with what it is and its option, bash style.
+ */
+static void show_limit(const struct launch *launch, char option, bool hard, bool described, FILE *outstream) {
+    rlim_t value;
+
+    launch_get_limit(launch, option, hard, &value);
+
+    if (described) {
+        fprintf(outstream, "%-32s(-%c) ", launch_limit_description(option), option);
+    }
+
+    if (value == RLIM_INFINITY) {
+        fprintf(outstream, "unlimited\n");
+    } else {
+        fprintf(outstream, "%" PRIuMAX "\n", (uintmax_t) value);
+    }
+}
+
+/*
+ * Run argv[first] with the rest of the arguments. The program shares everything but the words with the
+ * command, its argv[0] is filled in by the child.
+ */
+static void run_program(const struct dc_posix_env *env, struct dc_error *err, struct command *command, size_t first,
+                        char **path, struct variables *variables, const struct timeout *timeout,
+                        const struct launch *launch) {
+    struct command program;
+
+    program = *command;
+    program.command = command->argv[first];
+    program.argc = command->argc - first;
+    program.argv = dc_calloc(env, err, program.argc + 1, sizeof(char *));
+
+    if (dc_error_has_error(err)) {
+        return;
+    }
+
+    for (size_t i = 1; i < program.argc; i++) {
+        program.argv[i] = command->argv[first + i];
+    }
+
+    if (launch != NULL) {
+        program.launch = launch;
+    }
 
+    execute_timed(env, err, &program, path, variables, timeout);
+    command->exit_code = program.exit_code;
+    dc_free(env, program.argv, (program.argc + 1) * sizeof(char *));
 }
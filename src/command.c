@@ -1,280 +1,754 @@
 #include <dc_posix/dc_stdlib.h>
-#include <dc_posix/dc_regex.h>
 #include <dc_posix/dc_string.h>
-#include <dc_posix/dc_wordexp.h>
 #include <dc_util/strings.h>
 #include "command.h"
-
-
-char *trim_string_left_arrow(const struct dc_posix_env *env, char *str);
+#include "expand.h"
+#include "mem_stats.h"
+#include "posix_direct.h"
+#include "scan.h"
+#include "substitute.h"
+#include "util.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+
+static bool is_blank(char c);
+static void split_redirections(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                               char *line);
+static size_t split_redirection(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                                char *line, size_t start, size_t i, int fd);
+static bool add_redirection(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                            const struct redirection *redirection);
+static size_t redirection_word_end(const char *line, size_t i);
+static void set_redirect_files(const struct dc_posix_env *env, struct dc_error *err, struct command *command);
+static void expand_redirections(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                struct command *command);
+static void expand_here(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                        struct command *command);
 
 /**
  * Parse the command. Take the command->line and use it to fill in all of the fields.
  *
  * @param env the posix environment.
  * @param err the error object.
- * @param state the current state, to set the fatal_error and access the command line and regex for redirection.
+ * @param state the current state, to set the fatal_error.
  * @param command the command to parse.
  */
 void parse_command(const struct dc_posix_env *env, struct dc_error *err,
                    struct state *state, struct command *command) {
+    char **raw;
+    size_t raw_count;
+
+    raw = split_command(env, err, state, command, &raw_count);
+    if (dc_error_has_error(err)) {
+        return;
+    }
 
-    regex_t *in_regex;
-    regex_t *out_regex;
-    regex_t *err_regex;
-    regmatch_t match;
-    int matched;
+    expand_command(env, err, state, command, raw, raw_count);
+    free_words(env, raw, raw_count);
+}
+
+/**
+ * The part of parse_command that only depends on the command->line: fill in the redirections
+ * and split the rest of the line into words (see split_words).
+ * The words can be expanded any number of times (see expand_command).
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param state the current state, to set the fatal_error.
+ * @param command the command to parse.
+ * @param count set to the number of words.
+ * @return the words as written (free with free_words).
+ */
+char **split_command(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                     struct command *command, size_t *count) {
     char* command_line;
-    size_t original_argc;
+    char **raw;
 
-    err_regex = state->err_redirect_regex;
     command_line = dc_strdup(env, err, command->line);
     if (dc_error_has_error(err)) {
         state->fatal_error = true;
+        return NULL;
     }
-    matched = dc_regexec(env, err_regex, command_line, 1, &match, 0);
-    if (matched == 0)
-    {
-        char *str;
-        regoff_t length;
-
-        length = match.rm_eo - match.rm_so;
-        str = dc_malloc(env , err, (size_t) length + 1);
-        if (dc_error_has_error(err)) {
-            state->fatal_error = true;
-        }
-        dc_strncpy(env, str, &command_line[match.rm_so], (size_t) length);
-        str[length] = '\0';
-        command_line[match.rm_so] = '\0';
 
-        if (dc_strstr(env, str, ">>") != NULL) {
-            command->stderr_overwrite = true;
-        }
-
-        str = trim_string_left_arrow(env, str);
-
-        if (dc_strstr(env, str, "~") != NULL) {
-            wordexp_t exp;
-            dc_wordexp(env, err, str, &exp, 0);
-            if (dc_error_has_error(err)) {
-                state->fatal_error = true;
-            }
-            command->stderr_file = dc_strdup(env, err, exp.we_wordv[0]);
-            if (dc_error_has_error(err)) {
-                state->fatal_error = true;
-            }
-
-//            wordfree(&exp);
-        } else {
-            command->stderr_file = dc_strdup(env, err, str);
-            if (dc_error_has_error(err)) {
-                state->fatal_error = true;
-            }
-        }
-
-        dc_free(env, str, strlen(str));
+    split_redirections(env, err, command, command_line);
+    if (dc_error_has_error(err)) {
+        dc_free(env, command_line, strlen(command_line) + 1);
+        return NULL;
     }
 
-    out_regex = state->out_redirect_regex;
-    matched = dc_regexec(env, out_regex, command_line, 1, &match, 0);
-    if (matched == 0)
-    {
-        char *str;
-        regoff_t length;
-
-        length = match.rm_eo - match.rm_so;
-        str = dc_malloc(env, err, (size_t) length + 1);
-        if (dc_error_has_error(err)) {
-            state->fatal_error = true;
-        }
-        dc_strncpy(env, str, &command_line[match.rm_so], (size_t) length);
-        command_line[match.rm_so] = '\0';
-        str[length] = '\0';
+    set_redirect_files(env, err, command);
+    if (dc_error_has_error(err)) {
+        state->fatal_error = true;
+    }
 
-        if (dc_strstr(env, str, ">>") != NULL) {
-            command->stdout_overwrite = true;
-        }
+    raw = split_words(env, err, command_line, count);
+    if (dc_error_has_error(err)) {
+        state->fatal_error = true;
+    }
 
-        str = trim_string_left_arrow(env, str);
+    dc_free(env, command_line, strlen(command_line) + 1);
 
+    return raw;
+}
 
-        if (dc_strstr(env, str, "~") != NULL) {
-            wordexp_t exp;
-            dc_wordexp(env, err, str, &exp, 0);
-            if (dc_error_has_error(err)) {
-                state->fatal_error = true;
-            }
-            command->stdout_file = dc_strdup(env, err, exp.we_wordv[0]);
-            if (dc_error_has_error(err)) {
-                state->fatal_error = true;
-            }
-//            wordfree(&exp);
-        } else {
-            command->stdout_file = dc_strdup(env, err, str);
-            if (dc_error_has_error(err)) {
-                state->fatal_error = true;
-            }
-        }
+/**
+ * The part of parse_command that depends on the variables and files: expand the words
+ * (see expand_words) into the command, assignments and arguments, the redirection targets and the
+ * here_document.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param state the current state, to set the fatal_error and expand the words.
+ * @param command the command to fill in.
+ * @param raw the words as written (see split_command), they are not changed.
+ * @param raw_count the number of words.
+ */
+void expand_command(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                    struct command *command, char **raw, size_t raw_count) {
+    char **words;
+    size_t word_count;
+    size_t original_argc;
+    size_t first;
+    size_t range[2];
 
-        dc_free(env, str, strlen(str));
+    words = expand_words(env, err, state, raw, raw_count, &word_count, &first, range);
+    if (dc_error_has_error(err)) {
+        fail_command(err, state);
+        return;
     }
 
-    in_regex = state->in_redirect_regex;
-    matched = dc_regexec(env, in_regex, command_line, 1, &match, 0);
-    if (matched == 0)
-    {
-        char *str;
-        regoff_t length;
-
-        length = match.rm_eo - match.rm_so;
-        str = malloc((size_t) length + 1);
-        dc_strncpy(env, str, &command_line[match.rm_so], (size_t) length);
-        str[length] = '\0';
-        command_line[match.rm_so] = '\0';
-
-        str = trim_string_left_arrow(env, str);
-        str = dc_str_left_trim(env, str);
-
-        if (dc_strstr(env, str, "~") != NULL) {
-            wordexp_t exp;
-            dc_wordexp(env, err, str, &exp, 0);
-            if (dc_error_has_error(err)) {
-                state->fatal_error = true;
-            }
-            command->stdin_file = dc_strdup(env, err, exp.we_wordv[0]);
-//            wordfree(&exp);
-        } else {
-            command->stdin_file = dc_strdup(env, err, str);
+    // leading NAME=value words are assignments for the command, not the command itself
+    if (command->assignments != NULL) {
+        for (size_t i = 0; i < command->assignment_count; ++i) {
+            dc_free(env, command->assignments[i], strlen(command->assignments[i]) + 1);
         }
-
-        dc_free(env, str, strlen(str));
+        dc_free(env, command->assignments, (command->assignment_count + 1) * sizeof(char *));
+        command->assignments = NULL;
+        command->assignment_count = 0;
     }
-
-    wordexp_t exp;
-    dc_wordexp(env, err, command_line, &exp, 0);
+    command->assignments = dc_malloc(env, err, (first + 1) * sizeof(char *));
     if (dc_error_has_error(err)) {
         state->fatal_error = true;
+        free_words(env, words, word_count);
+        return;
     }
 
+    // the expanded words are moved into the command, only the array is freed
+    command->assignment_count = first;
+    for (size_t i = 0; i < first; ++i) {
+        command->assignments[i] = words[i];
+    }
+    command->assignments[first] = NULL;
+
     original_argc = command->argc;
-    command->argc = exp.we_wordc;
-    if (original_argc > 0) {
-        for (int i = 0; command->argv[i]; ++i) {
-            dc_free(env, command->argv[i], strlen(command->argv[i]));
+    command->argc = word_count - first;
+    if (command->argv != NULL) {
+        for (size_t i = 1; i < original_argc; ++i) {
+            dc_free(env, command->argv[i], strlen(command->argv[i]) + 1);
         }
-        dc_free(env, command->argv, original_argc);
+        dc_free(env, command->argv, (original_argc + 1) * sizeof(char *));
     }
-    command->argv = dc_malloc(env, err, exp.we_wordc + 2);
+    command->argv = dc_malloc(env, err, (command->argc + 1) * sizeof(char *));
     if (dc_error_has_error(err)) {
         state->fatal_error = true;
+        for (size_t i = first; i < word_count; ++i) {
+            dc_free(env, words[i], strlen(words[i]) + 1);
+        }
+        command->argc = 0;
+        dc_free(env, words, (word_count + 1) * sizeof(char *));
+        return;
     }
     command->argv[0] = NULL;
-    if (command->argc > 1) {
-        for (int i = 1; i < (int) exp.we_wordc; ++i) {
-            command->argv[i] = dc_strdup(env, err, exp.we_wordv[i]);
-            if (dc_error_has_error(err)) {
-                state->fatal_error = true;
-            }
-        }
+    for (size_t i = 1; i < command->argc; ++i) {
+        command->argv[i] = words[first + i];
+    }
+    command->argv[command->argc] = NULL;
+
+    // where the list can be split if it is too long to exec (see batch_execute), all of it if nothing matched
+    command->pathname_first = command->argc > 0 ? 1 : 0;
+    command->pathname_end = command->argc;
 
+    if (range[0] < range[1] && range[1] > first + 1) {
+        command->pathname_first = range[0] > first ? range[0] - first : 1;
+        command->pathname_end = range[1] - first;
     }
-    command->argv[exp.we_wordc] = NULL;
 
-    if (exp.we_wordv[0] != NULL) {
+    if (first < word_count) {
         if (command->command != NULL) {
-            dc_free(env, command->command, strlen(command->command));
-        }
-        command->command = dc_strdup(env, err, exp.we_wordv[0]);
-        if (dc_error_has_error(err)) {
-            state->fatal_error = true;
+            dc_free(env, command->command, strlen(command->command) + 1);
         }
+        command->command = words[first];
     }
 
-//    wordfree(&exp);
-    if (command_line != NULL) {
-        dc_free(env, command_line, strlen(command_line));
+    dc_free(env, words, (word_count + 1) * sizeof(char *));
+
+    expand_redirections(env, err, state, command);
+    if (dc_error_has_error(err)) {
+        return;
     }
+
+    expand_here(env, err, state, command);
 }
 
-char *trim_string_left_arrow(const struct dc_posix_env *env, char *str) {
-    str = dc_str_left_trim(env, str);
-    int counter;
+/**
+ * A command that can't be expanded (eg. echo $((1/0)), or a glob in a directory that can't be listed) fails
+ * like a program would: $? is 1 and the shell carries on. A shell that is not interactive (a script) stops
+ * instead (see handle_error), as does any shell that ran out of memory.
+ *
+ * @param err the error the expansion raised.
+ * @param state the current state.
+ */
+void fail_command(const struct dc_error *err, struct state *state) {
+    state->exit_code = 1;
 
-    counter = 0;
+    if (!state->interactive || dc_error_is_errno(err, ENOMEM)) {
+        state->fatal_error = true;
+    }
+}
 
-    while (counter < 1) {
-        if (str[0] == '>' || str[0] == '<') {
-            counter++;
-        }
-//        if (dc_strcmp(env, &str[0], "<") == 0 || dc_strcmp(env, &str[0], ">") == 0) {
-//            counter++;
-//        }
-        dc_memmove(env, str, str+1, strlen(str));
+/**
+ * The redirections to apply: the command's own, or for a command that was not split (see split_command),
+ * ones made from its stdin_file, here_document, stdout_file and stderr_file.
+ *
+ * @param command the command.
+ * @param files where the ones made from the files are put.
+ * @param count set to the number of redirections.
+ * @return the redirections, in the order they are applied.
+ */
+const struct redirection *command_redirections(const struct command *command, struct redirection files[4],
+                                               size_t *count) {
+    *count = 0;
+
+    if (command->redirection_count > 0) {
+        *count = command->redirection_count;
+        return command->redirections;
     }
 
-    if (str[0] == '>' || str[0] == '<') {
-        dc_memmove(env, str, str+1, strlen(str));
+    if (command->stdin_file != NULL) {
+        files[*count].fd = 0;
+        files[*count].type = REDIRECT_INPUT;
+        files[*count].target = command->stdin_file;
+        files[*count].source = -1;
+        (*count)++;
     }
-//    if (dc_strcmp(env, &str[0], "<") == 0 || dc_strcmp(env, &str[0], ">") == 0) {
-//        dc_memmove(env, str, str+1, strlen(str));
-//    }
-    str = dc_str_left_trim(env, str);
 
+    if (command->here_document != NULL) {
+        files[*count].fd = 0;
+        files[*count].type = REDIRECT_HERE;
+        files[*count].target = NULL;
+        files[*count].source = -1;
+        (*count)++;
+    }
+
+    if (command->stdout_file != NULL) {
+        files[*count].fd = 1;
+        files[*count].type = command->stdout_overwrite ? REDIRECT_APPEND : REDIRECT_OUTPUT;
+        files[*count].target = command->stdout_file;
+        files[*count].source = -1;
+        (*count)++;
+    }
 
-    return str;
+    if (command->stderr_file != NULL) {
+        files[*count].fd = 2;
+        files[*count].type = command->stderr_overwrite ? REDIRECT_APPEND : REDIRECT_OUTPUT;
+        files[*count].target = command->stderr_file;
+        files[*count].source = -1;
+        (*count)++;
+    }
+
+    return files;
 }
 
+/**
+ * Copy the redirections and the here_document, as split_command left them, from one command to another.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param command the command to copy to, it has no redirections.
+ * @param from the command to copy from.
+ */
+void copy_redirections(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                       const struct command *from) {
+    if (from->redirection_count > 0) {
+        command->redirections = dc_calloc(env, err, from->redirection_count, sizeof(struct redirection));
+        if (dc_error_has_error(err)) {
+            return;
+        }
+
+        command->redirection_count = from->redirection_count;
+
+        for (size_t i = 0; i < from->redirection_count; i++) {
+            command->redirections[i] = from->redirections[i];
+            command->redirections[i].target = NULL;
 
+            if (from->redirections[i].target != NULL) {
+                command->redirections[i].target = dc_strdup(env, err, from->redirections[i].target);
+                if (dc_error_has_error(err)) {
+                    return;
+                }
+            }
+        }
+    }
 
+    if (from->here_document != NULL) {
+        command->here_document = dc_strdup(env, err, from->here_document);
+        if (dc_error_has_error(err)) {
+            return;
+        }
+    }
+
+    command->here_string = from->here_string;
+    command->here_expand = from->here_expand;
+    set_redirect_files(env, err, command);
+}
 
 /**
+ * Free the dynamically allocated fields of the command and reset them to NULL, 0 or false.
+ * Any process substitutions still open are finished (see substitute_finish).
  *
- * @param env
- * @param command
+ * @param env the posix environment.
+ * @param command the command to clear.
  */
 void destroy_command(const struct dc_posix_env *env, struct command *command) {
     if (command->line != NULL) {
-        dc_free(env, command->line, strlen(command->line));
+        dc_free(env, command->line, strlen(command->line) + 1);
         command->line = NULL;
     }
 
     if (command->command != NULL) {
-        dc_free(env, command->command, strlen(command->command));
+        dc_free(env, command->command, strlen(command->command) + 1);
         command->command = NULL;
     }
 
 
     if (command->argv != NULL) {
-        int pos = 0;
-        while (command->argv[pos] != NULL) {
-            dc_free(env, command->argv[pos], strlen(command->argv[pos]));
-            pos++;
+        for (size_t i = 0; i < command->argc; i++) {
+            if (command->argv[i] != NULL) {
+                dc_free(env, command->argv[i], strlen(command->argv[i]) + 1);
+            }
         }
-        dc_free(env, command->argv, command->argc);
+        dc_free(env, command->argv, (command->argc + 1) * sizeof(char *));
         command->argv = NULL;
     }
     command->argc = 0;
+    command->pathname_first = 0;
+    command->pathname_end = 0;
+
+    if (command->assignments != NULL) {
+        for (size_t i = 0; i < command->assignment_count; i++) {
+            dc_free(env, command->assignments[i], strlen(command->assignments[i]) + 1);
+        }
+        dc_free(env, command->assignments, (command->assignment_count + 1) * sizeof(char *));
+        command->assignments = NULL;
+    }
+    command->assignment_count = 0;
+
+    if (command->redirections != NULL) {
+        for (size_t i = 0; i < command->redirection_count; i++) {
+            if (command->redirections[i].target != NULL) {
+                dc_free(env, command->redirections[i].target, strlen(command->redirections[i].target) + 1);
+            }
+        }
+        dc_free(env, command->redirections, command->redirection_count * sizeof(struct redirection));
+        command->redirections = NULL;
+    }
+    command->redirection_count = 0;
 
     if (command->stdin_file != NULL) {
-        dc_free(env, command->stdin_file, strlen(command->stdin_file));
+        dc_free(env, command->stdin_file, strlen(command->stdin_file) + 1);
         command->stdin_file = NULL;
     }
 
     if (command->stdout_file != NULL) {
-        dc_free(env, command->stdout_file, strlen(command->stdout_file));
+        dc_free(env, command->stdout_file, strlen(command->stdout_file) + 1);
         command->stdout_file = NULL;
     }
 
     command->stdout_overwrite = false;
 
     if (command->stderr_file != NULL) {
-        dc_free(env, command->stderr_file, strlen(command->stderr_file));
+        dc_free(env, command->stderr_file, strlen(command->stderr_file) + 1);
         command->stderr_file = NULL;
     }
 
     command->stderr_overwrite = false;
+
+    if (command->here_document != NULL) {
+        dc_free(env, command->here_document, strlen(command->here_document) + 1);
+        command->here_document = NULL;
+    }
+
+    command->here_string = false;
+    command->here_expand = false;
+    substitute_finish(env, command);
     command->exit_code = 0;
 
 
 }
 
+/*
+ * A here-string is expanded like a word, with a newline added. A here-document has its $, ` and \
+ * expanded unless the WORD was quoted. The text is replaced, so it is only expanded once.
+ */
+static void expand_here(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                        struct command *command) {
+    char *expanded;
+    char *text;
+
+    if (command->here_document == NULL || !(command->here_string || command->here_expand)) {
+        return;
+    }
+
+    if (command->here_string) {
+        expanded = expand_string(env, err, state, command->here_document);
+    } else {
+        expanded = expand_here_document(env, err, state, command->here_document);
+    }
+
+    if (dc_error_has_error(err)) {
+        fail_command(err, state);
+        return;
+    }
+
+    text = expanded;
+
+    if (command->here_string) {
+        text = dc_malloc(env, err, strlen(expanded) + 2);
+
+        if (dc_error_has_no_error(err)) {
+            sprintf(text, "%s\n", expanded);
+        }
+
+        dc_free(env, expanded, strlen(expanded) + 1);
+
+        if (dc_error_has_error(err)) {
+            return;
+        }
+    }
+
+    dc_free(env, command->here_document, strlen(command->here_document) + 1);
+    command->here_document = text;
+    command->here_string = false;
+    command->here_expand = false;
+}
+
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+/*
+ * Each redirection is taken out of the line (it is replaced with blanks) and added to the redirections in
+ * the order it is written. A number in front of the operator is the fd, if it starts the word.
+ * Anything quoted is skipped, an unterminated quote is left for split_words to report.
+ */
+static void split_redirections(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                               char *line) {
+    size_t i;
+
+    i = 0;
+
+    while (dc_error_has_no_error(err) && line[i] != '\0') {
+        size_t start;
+        int fd;
+
+        start = i;
+        fd = -1;
+
+        if (line[i] >= '0' && line[i] <= '9' && (i == 0 || is_blank(line[i - 1]))) {
+            long number;
+
+            number = 0;
+
+            while (line[i] >= '0' && line[i] <= '9') {
+                if (number <= INT_MAX / 10) {
+                    number = number * 10 + (line[i] - '0');
+                } else {
+                    number = (long) INT_MAX + 1;
+                }
+
+                i++;
+            }
+
+            if (line[i] != '<' && line[i] != '>') {
+                continue;
+            }
+
+            if (number > INT_MAX) {
+                DC_ERROR_RAISE_USER(err, "syntax error: bad file descriptor", EINVAL);
+                return;
+            }
+
+            fd = (int) number;
+        }
+
+        // <(commands) and >(commands) starting a word are process substitutions, not redirections
+        if ((line[i] == '<' || line[i] == '>') && !(line[i + 1] == '(' && (i == 0 || is_blank(line[i - 1])))) {
+            i = split_redirection(env, err, command, line, start, i, fd);
+        } else {
+            i = skip_quoted(line, i);
+
+            if (i == SIZE_MAX) {
+                return;
+            }
+
+            // only a word's first character can be an fd, the rest of the word can be skipped to an operator
+            if (!is_blank(line[i - 1])) {
+                i = scan_special(line, i);
+            }
+        }
+    }
+}
+
+/*
+ * line[i] is the operator, line[start] the fd in front of it (or the operator), fd is -1 without one.
+ * Returns the index just past the redirection's word.
+ */
+static size_t split_redirection(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                                char *line, size_t start, size_t i, int fd) {
+    struct redirection redirection;
+    bool here_string;
+    size_t word;
+    size_t end;
+
+    redirection.fd = fd;
+    redirection.target = NULL;
+    redirection.source = -1;
+    here_string = false;
+
+    if (line[i] == '<') {
+        if (redirection.fd == -1) {
+            redirection.fd = 0;
+        }
+
+        if (line[i + 1] == '<') {
+            redirection.type = REDIRECT_HERE;
+            here_string = line[i + 2] == '<';
+            i += line[i + 2] == '<' || line[i + 2] == '-' ? 3 : 2;
+        } else if (line[i + 1] == '>') {
+            redirection.type = REDIRECT_READ_WRITE;
+            i += 2;
+        } else if (line[i + 1] == '&') {
+            redirection.type = REDIRECT_DUPLICATE;
+            i += 2;
+        } else {
+            redirection.type = REDIRECT_INPUT;
+            i++;
+        }
+    } else {
+        if (redirection.fd == -1) {
+            redirection.fd = 1;
+        }
+
+        if (line[i + 1] == '>') {
+            redirection.type = REDIRECT_APPEND;
+            i += 2;
+        } else if (line[i + 1] == '&') {
+            redirection.type = REDIRECT_DUPLICATE;
+            i += 2;
+        } else {
+            redirection.type = REDIRECT_OUTPUT;
+            i += line[i + 1] == '|' ? 2 : 1;
+        }
+    }
+
+    while (is_blank(line[i])) {
+        i++;
+    }
+
+    word = i;
+    end = redirection_word_end(line, i);
+
+    if (end == SIZE_MAX) {
+        DC_ERROR_RAISE_USER(err, "syntax error: unterminated quote", EINVAL);
+        return SIZE_MAX;
+    }
+
+    if (end == word) {
+        DC_ERROR_RAISE_USER(err, "syntax error: redirection without a word", EINVAL);
+        return SIZE_MAX;
+    }
+
+    switch (redirection.type) {
+        case REDIRECT_DUPLICATE:
+            if (end == word + 1 && line[word] == '-') {
+                redirection.type = REDIRECT_CLOSE;
+                break;
+            }
+
+            redirection.source = 0;
+
+            for (size_t j = word; j < end; j++) {
+                if (line[j] < '0' || line[j] > '9' || redirection.source > INT_MAX / 10 - 1) {
+                    DC_ERROR_RAISE_USER(err, "syntax error: bad file descriptor", EINVAL);
+                    return SIZE_MAX;
+                }
+
+                redirection.source = redirection.source * 10 + (line[j] - '0');
+            }
+            break;
+        case REDIRECT_HERE:
+            // the body of a <<WORD is on the lines after the command, the script parser fills it in
+            if (here_string) {
+                if (command->here_document != NULL) {
+                    dc_free(env, command->here_document, strlen(command->here_document) + 1);
+                }
+
+                command->here_document = dc_strndup(env, err, &line[word], end - word);
+                command->here_string = true;
+            }
+            break;
+        case REDIRECT_INPUT:
+        case REDIRECT_OUTPUT:
+        case REDIRECT_APPEND:
+        case REDIRECT_READ_WRITE:
+            redirection.target = dc_strndup(env, err, &line[word], end - word);
+            break;
+        case REDIRECT_CLOSE:
+        default:
+            break;
+    }
+
+    if (dc_error_has_error(err)) {
+        return SIZE_MAX;
+    }
+
+    if (!add_redirection(env, err, command, &redirection)) {
+        if (redirection.target != NULL) {
+            dc_free(env, redirection.target, strlen(redirection.target) + 1);
+        }
+
+        return SIZE_MAX;
+    }
+
+    dc_memset(env, &line[start], ' ', end - start);
+
+    return end;
+}
+
+/*
+ * There are only ever a few, so they are added one at a time.
+ */
+static bool add_redirection(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                            const struct redirection *redirection) {
+    struct redirection *redirections;
+
+    redirections = dc_realloc(env, err, command->redirections,
+                              (command->redirection_count + 1) * sizeof(struct redirection));
+    if (dc_error_has_error(err)) {
+        return false;
+    }
+
+    command->redirections = redirections;
+    command->redirections[command->redirection_count] = *redirection;
+    command->redirection_count++;
+
+    return true;
+}
+
+/*
+ * The word ends at a blank or an unquoted operator, returns SIZE_MAX if a quote is not terminated.
+ * It can be a process substitution (cat < <(commands)).
+ */
+static size_t redirection_word_end(const char *line, size_t i) {
+    if ((line[i] == '<' || line[i] == '>') && line[i + 1] == '(') {
+        i = skip_quoted(line, i);
+    }
+
+    while (i != SIZE_MAX) {
+        i = scan_special(line, i);
+
+        if (line[i] == '\0' || is_blank(line[i]) || strchr("<>|&;()", line[i]) != NULL) {
+            break;
+        }
+
+        i = skip_quoted(line, i);
+    }
+
+    return i;
+}
+
+/*
+ * The stdin_file, stdout_file and stderr_file are the last file each of them is redirected to.
+ */
+static void set_redirect_files(const struct dc_posix_env *env, struct dc_error *err, struct command *command) {
+    struct redirection *files[3];
+
+    if (command->stdin_file != NULL) {
+        dc_free(env, command->stdin_file, strlen(command->stdin_file) + 1);
+        command->stdin_file = NULL;
+    }
+
+    if (command->stdout_file != NULL) {
+        dc_free(env, command->stdout_file, strlen(command->stdout_file) + 1);
+        command->stdout_file = NULL;
+    }
+
+    if (command->stderr_file != NULL) {
+        dc_free(env, command->stderr_file, strlen(command->stderr_file) + 1);
+        command->stderr_file = NULL;
+    }
+
+    command->stdout_overwrite = false;
+    command->stderr_overwrite = false;
+    files[0] = NULL;
+    files[1] = NULL;
+    files[2] = NULL;
+
+    for (size_t i = 0; i < command->redirection_count; i++) {
+        struct redirection *redirection;
+
+        redirection = &command->redirections[i];
+
+        if ((redirection->fd == 0 && redirection->type == REDIRECT_INPUT) ||
+            ((redirection->fd == 1 || redirection->fd == 2) &&
+             (redirection->type == REDIRECT_OUTPUT || redirection->type == REDIRECT_APPEND))) {
+            files[redirection->fd] = redirection;
+        }
+    }
+
+    if (files[0] != NULL) {
+        command->stdin_file = dc_strdup(env, err, files[0]->target);
+    }
+
+    if (files[1] != NULL && dc_error_has_no_error(err)) {
+        command->stdout_file = dc_strdup(env, err, files[1]->target);
+        command->stdout_overwrite = files[1]->type == REDIRECT_APPEND;
+    }
+
+    if (files[2] != NULL && dc_error_has_no_error(err)) {
+        command->stderr_file = dc_strdup(env, err, files[2]->target);
+        command->stderr_overwrite = files[2]->type == REDIRECT_APPEND;
+    }
+}
+
+/*
+ * The files are expanded like a word, but not split or matched against files.
+ */
+static void expand_redirections(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                struct command *command) {
+    for (size_t i = 0; i < command->redirection_count; i++) {
+        struct redirection *redirection;
+        char *expanded;
+
+        redirection = &command->redirections[i];
+
+        if (redirection->target == NULL) {
+            continue;
+        }
+
+        expanded = expand_string(env, err, state, redirection->target);
+        if (dc_error_has_error(err)) {
+            fail_command(err, state);
+            return;
+        }
+
+        dc_free(env, redirection->target, strlen(redirection->target) + 1);
+        redirection->target = expanded;
+    }
+
+    set_redirect_files(env, err, command);
+    if (dc_error_has_error(err)) {
+        state->fatal_error = true;
+    }
+}
@@ -0,0 +1,533 @@
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <dc_posix/dc_stdlib.h>
+#include <dc_posix/dc_string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+#include "copy.h"
+#include "mem_stats.h"
+
+#if defined(__linux__)
+// how much one system call is asked to copy
+#define COPY_CHUNK (1024 * 1024)
+#endif
+
+#define BUFFER_SIZE (64 * 1024)
+
+static void copy_in_child(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                          FILE *outstream, FILE *errstream, struct copy_stats *stats);
+static bool is_copy_redirection(const struct redirection *redirection);
+static bool open_redirections(const struct command *command, int *in, int *outs, size_t *out_count,
+                              FILE *errstream);
+static int open_redirection(const struct redirection *redirection);
+static void cat_file(const char *name, int in, const int *outs, size_t out_count, FILE *errstream,
+                     int *exit_code, struct copy_stats *stats);
+static int copy_to_all(int in, const int *outs, size_t out_count, struct copy_stats *stats);
+#if defined(__linux__)
+static bool kernel_copy(int in, int out, int *error, struct copy_stats *stats);
+static bool at_end(int fd);
+#endif
+static int buffered_copy(int in, const int *outs, size_t out_count, struct copy_stats *stats);
+
+/**
+ * Can the command be run in the shell as a copy: there is no command (only redirections), or the command
+ * is cat with no options, something to read (files or a < file) and only < and > or >> redirections.
+ *
+ * @param command the expanded command.
+ * @return true if copy_execute can run it.
+ */
+bool copy_applies(const struct command *command) {
+    bool input;
+
+    if (command->command == NULL) {
+        return command->redirection_count > 0;
+    }
+
+    if (strcmp(command->command, "cat") != 0) {
+        return false;
+    }
+
+    input = command->argc > 1;
+
+    for (size_t i = 1; i < command->argc; i++) {
+        if (command->argv[i][0] == '-' && command->argv[i][1] != '\0') {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < command->redirection_count; i++) {
+        if (!is_copy_redirection(&command->redirections[i])) {
+            return false;
+        }
+
+        if (command->redirections[i].fd == 0) {
+            input = true;
+        }
+    }
+
+    // without anything to read, cat reads the shell's own input: that is left to the program
+    if (!input) {
+        return false;
+    }
+
+    for (size_t i = 1; i < command->argc; i++) {
+        if (strcmp(command->argv[i], "-") == 0 && command->stdin_file == NULL) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Run a command that copy_applies to without a child process. The redirections are opened in order.
+ * Without a command, the < file is copied to the > files if there are both, otherwise the files are only
+ * opened (so > file creates or truncates it). cat copies each file, - for the < file, to the > files or to
+ * outstream. Every > file gets all of it (like zsh's multios). The data is copied by the kernel where it
+ * can be (copy_file_range, then sendfile or splice), otherwise by read and write.
+ * A command with a launch (eg. the limits set with ulimit) is copied by a child process that has them applied,
+ * the same as a program would be, so ulimit -f stops it with SIGXFSZ. Its bytes are not added to the stats.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param command the command, the exit_code is set.
+ * @param outstream where cat writes if it is not redirected.
+ * @param errstream where the errors are displayed.
+ * @param stats added to, or NULL.
+ */
+void copy_execute(const struct dc_posix_env *env, struct dc_error *err, struct command *command, FILE *outstream,
+                  FILE *errstream, struct copy_stats *stats) {
+    int in;
+    int *outs;
+    size_t out_count;
+    size_t opened;
+    int exit_code;
+
+    if (command->launch != NULL) {
+        copy_in_child(env, err, command, outstream, errstream, stats);
+        return;
+    }
+
+    outs = dc_malloc(env, err, (command->redirection_count + 1) * sizeof(int));
+    if (dc_error_has_error(err)) {
+        return;
+    }
+
+    if (stats != NULL) {
+        stats->commands++;
+    }
+
+    in = -1;
+    out_count = 0;
+
+    if (!open_redirections(command, &in, outs, &out_count, errstream)) {
+        dc_free(env, outs, (command->redirection_count + 1) * sizeof(int));
+        command->exit_code = 1;
+        return;
+    }
+
+    exit_code = 0;
+    opened = out_count;
+
+    if (command->command == NULL) {
+        if (in != -1 && out_count > 0) {
+            cat_file("-", in, outs, out_count, errstream, &exit_code, stats);
+        }
+    } else {
+        // what is already buffered comes first
+        if (out_count == 0) {
+            fflush(outstream);
+            outs[out_count++] = fileno(outstream);
+        }
+
+        for (size_t i = 1; i < command->argc; i++) {
+            if (dc_strcmp(env, command->argv[i], "-") == 0) {
+                cat_file("-", in, outs, out_count, errstream, &exit_code, stats);
+            } else {
+                int fd;
+
+                fd = open(command->argv[i], O_RDONLY | O_CLOEXEC);
+
+                if (fd == -1) {
+                    fprintf(errstream, "cat: %s: %s\n", command->argv[i], strerror(errno));
+                    exit_code = 1;
+                    continue;
+                }
+
+                cat_file(command->argv[i], fd, outs, out_count, errstream, &exit_code, stats);
+                close(fd);
+            }
+        }
+
+        if (command->argc == 1) {
+            cat_file("-", in, outs, out_count, errstream, &exit_code, stats);
+        }
+    }
+
+    if (in != -1) {
+        close(in);
+    }
+
+    for (size_t i = 0; i < opened; i++) {
+        close(outs[i]);
+    }
+
+    dc_free(env, outs, (command->redirection_count + 1) * sizeof(int));
+    command->exit_code = exit_code;
+}
+
+/**
+ * Copy everything from one fd to another, from and to their current offsets.
+ *
+ * @param in the fd to read.
+ * @param out the fd to write.
+ * @param stats added to, or NULL.
+ * @return 0, or the errno of the read or write that failed.
+ */
+int copy_fd(int in, int out, struct copy_stats *stats) {
+#if defined(__linux__)
+    int error;
+
+    if (kernel_copy(in, out, &error, stats)) {
+        return error;
+    }
+#endif
+
+    return buffered_copy(in, &out, 1, stats);
+}
+
+/*
+ * The limits are only ever applied to children (see launch_apply), so the shell keeps its own.
+ */
+static void copy_in_child(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                          FILE *outstream, FILE *errstream, struct copy_stats *stats) {
+    const struct launch *launch;
+    pid_t child;
+    int status;
+
+    if (stats != NULL) {
+        stats->commands++;
+    }
+
+    // so the child doesn't write what is buffered a second time
+    fflush(outstream);
+    fflush(errstream);
+    child = fork();
+
+    if (child == -1) {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+        return;
+    }
+
+    if (child == 0) {
+        launch = command->launch;
+        command->launch = NULL;
+
+        if (!launch_apply(launch, errstream)) {
+            fflush(errstream);
+            _exit(125);
+        }
+
+        copy_execute(env, err, command, outstream, errstream, NULL);
+        fflush(errstream);
+        _exit(dc_error_has_error(err) ? 126 : command->exit_code);
+    }
+
+    while (waitpid(child, &status, 0) == -1) {
+        if (errno != EINTR) {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+            return;
+        }
+    }
+
+    if (WIFSIGNALED(status)) {
+        // eg. SIGXFSZ from ulimit -f
+        command->exit_code = 128 + WTERMSIG(status);
+    } else {
+        command->exit_code = WEXITSTATUS(status);
+    }
+}
+
+static bool is_copy_redirection(const struct redirection *redirection) {
+    switch (redirection->type) {
+        case REDIRECT_INPUT:
+            return redirection->fd == 0;
+        case REDIRECT_OUTPUT:
+        case REDIRECT_APPEND:
+            return redirection->fd == 1;
+        case REDIRECT_READ_WRITE:
+        case REDIRECT_DUPLICATE:
+        case REDIRECT_CLOSE:
+        case REDIRECT_HERE:
+        default:
+            return false;
+    }
+}
+
+/*
+ * Like redirect, each file is opened in turn, so they are created and truncated the same way. Only the last
+ * < file is kept, and all of the > files. Redirections of other fds only matter to a program, so without
+ * one they are skipped.
+ */
+static bool open_redirections(const struct command *command, int *in, int *outs, size_t *out_count,
+                              FILE *errstream) {
+    for (size_t i = 0; i < command->redirection_count; i++) {
+        const struct redirection *redirection;
+        int fd;
+
+        redirection = &command->redirections[i];
+
+        if (!is_copy_redirection(redirection)) {
+            continue;
+        }
+
+        fd = open_redirection(redirection);
+
+        if (fd == -1) {
+            fprintf(errstream, "%s: %s\n", redirection->target, strerror(errno));
+
+            if (*in != -1) {
+                close(*in);
+            }
+
+            for (size_t j = 0; j < *out_count; j++) {
+                close(outs[j]);
+            }
+
+            return false;
+        }
+
+        if (redirection->fd == 0) {
+            if (*in != -1) {
+                close(*in);
+            }
+
+            *in = fd;
+        } else {
+            outs[(*out_count)++] = fd;
+        }
+    }
+
+    return true;
+}
+
+static int open_redirection(const struct redirection *redirection) {
+    switch (redirection->type) {
+        case REDIRECT_INPUT:
+            return open(redirection->target, O_RDONLY | O_CLOEXEC);
+        case REDIRECT_OUTPUT:
+            return open(redirection->target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                        S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        case REDIRECT_APPEND:
+            return open(redirection->target, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                        S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        case REDIRECT_READ_WRITE:
+        case REDIRECT_DUPLICATE:
+        case REDIRECT_CLOSE:
+        case REDIRECT_HERE:
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+}
+
+static void cat_file(const char *name, int in, const int *outs, size_t out_count, FILE *errstream,
+                     int *exit_code, struct copy_stats *stats) {
+    int error;
+
+    error = copy_to_all(in, outs, out_count, stats);
+
+    if (error != 0) {
+        fprintf(errstream, "cat: %s: %s\n", name, strerror(error));
+        *exit_code = 1;
+    }
+}
+
+/*
+ * A file is copied to each output in turn, from the same offset. Anything else can only be read once, so
+ * each block is written to all of them.
+ */
+static int copy_to_all(int in, const int *outs, size_t out_count, struct copy_stats *stats) {
+    off_t start;
+
+    if (out_count == 1) {
+        return copy_fd(in, outs[0], stats);
+    }
+
+    start = lseek(in, 0, SEEK_CUR);
+
+    if (start == -1) {
+        return buffered_copy(in, outs, out_count, stats);
+    }
+
+    for (size_t i = 0; i < out_count; i++) {
+        int error;
+
+        if (lseek(in, start, SEEK_SET) == -1) {
+            return errno;
+        }
+
+        error = copy_fd(in, outs[i], stats);
+
+        if (error != 0) {
+            return error;
+        }
+    }
+
+    return 0;
+}
+
+#if defined(__linux__)
+/*
+ * Returns false if the kernel can't copy between these fds (nothing was copied), true if it copied all of
+ * it or failed part way (error is set). copy_file_range only works between regular files (and fails for
+ * an O_APPEND one), sendfile needs a regular file to read, and splice a pipe on one side. A file that says
+ * it is empty may not be (eg. in /proc), so that is left to read.
+ */
+static bool kernel_copy(int in, int out, int *error, struct copy_stats *stats) {
+    struct stat in_stat;
+    struct stat out_stat;
+    bool started;
+    ssize_t copied;
+
+    *error = 0;
+
+    if (fstat(in, &in_stat) == -1 || fstat(out, &out_stat) == -1) {
+        return false;
+    }
+
+    started = false;
+    copied = -1;
+
+    if (S_ISREG(in_stat.st_mode) && in_stat.st_size > 0) {
+        if (S_ISREG(out_stat.st_mode)) {
+            while ((copied = copy_file_range(in, NULL, out, NULL, COPY_CHUNK, 0)) > 0 ||
+                   (copied == -1 && errno == EINTR)) {
+                if (copied > 0) {
+                    started = true;
+
+                    if (stats != NULL) {
+                        stats->kernel_bytes += (size_t) copied;
+                    }
+
+                    // copy_file_range checks the write against ulimit -f before it finds there is nothing
+                    // left to read, so a file that exactly fits would get SIGXFSZ on the call that returns 0
+                    if (at_end(in)) {
+                        return true;
+                    }
+                }
+            }
+
+            if (copied == 0) {
+                return true;
+            }
+
+            if (started) {
+                *error = errno;
+                return true;
+            }
+        }
+
+        while ((copied = sendfile(out, in, NULL, COPY_CHUNK)) > 0 || (copied == -1 && errno == EINTR)) {
+            if (copied > 0) {
+                started = true;
+
+                if (stats != NULL) {
+                    stats->kernel_bytes += (size_t) copied;
+                }
+            }
+        }
+    } else if (S_ISFIFO(in_stat.st_mode) || S_ISFIFO(out_stat.st_mode)) {
+        while ((copied = splice(in, NULL, out, NULL, COPY_CHUNK, SPLICE_F_MOVE)) > 0 ||
+               (copied == -1 && errno == EINTR)) {
+            if (copied > 0) {
+                started = true;
+
+                if (stats != NULL) {
+                    stats->kernel_bytes += (size_t) copied;
+                }
+            }
+        }
+    }
+
+    if (copied == 0) {
+        return true;
+    }
+
+    if (started) {
+        *error = errno;
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Has everything in a regular file been read, as a read that returned 0 would say.
+ */
+static bool at_end(int fd) {
+    struct stat info;
+    off_t offset;
+
+    offset = lseek(fd, 0, SEEK_CUR);
+
+    return offset != -1 && fstat(fd, &info) == 0 && offset >= info.st_size;
+}
+#endif
+
+static int buffered_copy(int in, const int *outs, size_t out_count, struct copy_stats *stats) {
+    char buffer[BUFFER_SIZE];
+
+    for (;;) {
+        ssize_t bytes;
+        ssize_t written;
+
+        bytes = read(in, buffer, sizeof(buffer));
+
+        if (bytes == 0) {
+            return 0;
+        }
+
+        if (bytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return errno;
+        }
+
+        for (size_t i = 0; i < out_count; i++) {
+            written = 0;
+
+            while (written < bytes) {
+                ssize_t count;
+
+                count = write(outs[i], &buffer[written], (size_t) (bytes - written));
+
+                if (count == -1) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+
+                    return errno;
+                }
+
+                written += count;
+            }
+        }
+
+        if (stats != NULL) {
+            stats->buffered_bytes += (size_t) bytes;
+        }
+    }
+}
@@ -1,14 +1,94 @@
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
 #include "execute.h"
 #include <dc_posix/dc_unistd.h>
 #include <dc_posix/dc_stdio.h>
+#include <dc_posix/dc_fcntl.h>
+#include <dc_posix/sys/dc_wait.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <dc_posix/dc_string.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
+#include <time.h>
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#endif
 #include <dc_posix/dc_stdlib.h>
+#include "audit.h"
+#include "util.h"
+#include "mem_stats.h"
+
+#if !defined(__linux__)
+// _GNU_SOURCE already declares it
+extern char **environ;
+#endif
+
+// how much one pass of the fan out pump moves
+#define PUMP_CHUNK (64 * 1024)
+
+/*
+ * The > files of one fd (cmd > a > b): the program writes to a pipe and the pump copies it to each file.
+ */
+struct fan_out
+{
+    int fd;         // the fd the program writes to
+    size_t first;   // the index of the first of the redirections
+    size_t last;    // the index of the last of the redirections
+    int pipe;       // the read end of the pipe
+    int *files;     // the files, in order
+    size_t count;   // the number of files
+};
+
+// the program the pump passes SIGTERM on to
+static volatile pid_t pump_child;
 
-void redirect(const struct dc_posix_env *env, struct dc_error *err, struct command *command);
-void run(const struct dc_posix_env *env, struct dc_error *err, struct command *command, char **path);
+static bool wait_timed(const struct dc_posix_env *env, struct dc_error *err, pid_t child,
+                       const struct timeout *timeout);
+#if defined(__linux__) && defined(SYS_pidfd_open)
+static bool wait_pidfd(int pidfd, long milliseconds);
+#endif
+static long elapsed_since(const struct timespec *start);
+_Noreturn static void run_in_process(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                                     char **path, struct variables *variables);
+_Noreturn static void exit_child(int status);
+static size_t fan_out_size(const struct redirection *redirections, size_t count, size_t first, size_t *last);
+static bool is_fanned_out(const struct fan_out *fan_outs, size_t fan_out_count, const struct redirection *redirection,
+                          size_t index);
+static int open_output(const struct dc_posix_env *env, struct dc_error *err, const struct redirection *redirection);
+static int start_fan_out(const struct dc_posix_env *env, struct dc_error *err, const struct redirection *redirections,
+                         size_t first, size_t last, struct fan_out *fan_out);
+static void apply_redirections(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                               bool in_shell);
+static void run_fan_outs(const struct dc_posix_env *env, struct dc_error *err, struct fan_out *fan_outs,
+                         size_t fan_out_count);
+static void start_pump(const struct dc_posix_env *env, struct dc_error *err, struct fan_out *fan_outs,
+                       size_t fan_out_count);
+static bool pump_all(const struct dc_posix_env *env, struct dc_error *err, struct fan_out *fan_outs,
+                     size_t fan_out_count);
+static void release_fan_outs(const struct dc_posix_env *env, struct dc_error *err, struct fan_out *fan_outs,
+                             size_t fan_out_count, size_t capacity);
+static void forward_signal(int signal_number);
+static bool pump(const struct dc_posix_env *env, struct dc_error *err, const struct fan_out *fan_out,
+                 const int *aux, char *buffer);
+#if defined(__linux__)
+static bool can_splice(const struct fan_out *fan_out);
+static bool splice_all(int in, int out, size_t length);
+#endif
+static void move_fd(const struct dc_posix_env *env, struct dc_error *err, int fd, int to);
+static int here_document_fd(const struct dc_posix_env *env, struct dc_error *err, const char *text);
+static bool write_all(const struct dc_posix_env *env, struct dc_error *err, int fd, const char *text, size_t length);
+void run(const struct dc_posix_env *env, struct dc_error *err, struct command *command, char **path, char **envp);
+static char **apply_assignments(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                                struct variables *variables, char **path);
 int handle_run_error(struct dc_error *err);
 bool is_path_empty(char **path);
 
@@ -16,37 +96,333 @@ bool is_path_empty(char **path);
  * Create a child process, exec the command with any redirection, set the exit code.
  * If there is an err executing the command print an err message.
  * If the command cannot be found set the command->exit_code to 127.
+ * The command->assignments are applied to the variables in the child only, so they do not
+ * change the shell's variables.
  *
  * @param env the posix environment.
  * @param err the err object
  * @param command the command to execute
  * @param path the directories to search for the command
+ * @param variables the variables whose environment the command gets, or NULL to pass on the shell's environment
  */
-void execute(const struct dc_posix_env *env, struct dc_error *err, struct command *command, char **path)
+void execute(const struct dc_posix_env *env, struct dc_error *err, struct command *command, char **path,
+             struct variables *variables)
 {
+    execute_timed(env, err, command, path, variables, NULL);
+}
+
+/**
+ * Like execute, but the program is sent SIGTERM if it runs longer than the timeout->duration, and SIGKILL
+ * if it is still running timeout->kill_after after that. The shell waits in poll on a pidfd for the child,
+ * so there is no busy loop, and the signals can't reach another process that got the pid.
+ * The command->exit_code is 124 if the program timed out, or 137 if it had to be killed.
+ *
+ * @param env the posix environment.
+ * @param err the err object
+ * @param command the command to execute
+ * @param path the directories to search for the command
+ * @param variables the variables whose environment the command gets, or NULL to pass on the shell's environment
+ * @param timeout the limits, or NULL for none
+ */
+void execute_timed(const struct dc_posix_env *env, struct dc_error *err, struct command *command, char **path,
+                   struct variables *variables, const struct timeout *timeout) {
     pid_t child;
     int status;
+    bool timed_out;
+
+    child = execute_start(env, err, command, path, variables);
+
+    if (child == -1) {
+        return;
+    }
+
+    timed_out = timeout != NULL && timeout->duration > 0 && wait_timed(env, err, child, timeout);
+
+    while (dc_waitpid(env, err, child, &status, WUNTRACED) == -1) {
+        if (!dc_error_is_errno(err, EINTR)) {
+            return;
+        }
+
+        dc_error_reset(err);
+    }
+
+    if (timed_out) {
+        command->exit_code = WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL ? 128 + SIGKILL : 124;
+    } else if (WIFSIGNALED(status)) {
+        // eg. SIGXCPU or SIGXFSZ from a limit (see builtin_ulimit)
+        command->exit_code = 128 + WTERMSIG(status);
+    } else {
+        command->exit_code = WEXITSTATUS(status);
+    }
+}
+
+/**
+ * Parse a duration: a number, with a fraction if needed, followed by s (the default), m, h or d.
+ *
+ * @param string the duration.
+ * @param milliseconds set to the duration.
+ * @return false if the string is not a duration.
+ */
+bool parse_duration(const char *string, long *milliseconds) {
+    char *end;
+    double value;
+    double unit;
+
+    // strtod would also take a sign, blanks, inf and nan
+    if ((*string < '0' || *string > '9') && *string != '.') {
+        return false;
+    }
+
+    value = strtod(string, &end);
+
+    if (end == string) {
+        return false;
+    }
+
+    switch (*end) {
+        case '\0':
+        case 's':
+            unit = 1000;
+            break;
+        case 'm':
+            unit = 60 * 1000;
+            break;
+        case 'h':
+            unit = 60 * 60 * 1000;
+            break;
+        case 'd':
+            unit = 24 * 60 * 60 * 1000;
+            break;
+        default:
+            return false;
+    }
+
+    if (*end != '\0' && end[1] != '\0') {
+        return false;
+    }
+
+    value *= unit;
+
+    if (value > (double) LONG_MAX) {
+        return false;
+    }
+
+    // a limit that rounds down to nothing would be no limit at all
+    *milliseconds = value > 0 && value < 1 ? 1 : (long) value;
+
+    return true;
+}
+
+/*
+ * Returns true if the child ran out of time and was signalled. It is not reaped here either way, so until the
+ * caller's waitpid its pid can't be reused. Without pidfds it checks every 10ms.
+ */
+static bool wait_timed(const struct dc_posix_env *env, struct dc_error *err, pid_t child,
+                       const struct timeout *timeout) {
+    struct timespec start;
+    long limit;
+    int signal_number;
+
+#if defined(__linux__) && defined(SYS_pidfd_open)
+    int pidfd;
+
+    pidfd = (int) syscall(SYS_pidfd_open, child, 0);
+
+    if (pidfd != -1) {
+        bool timed_out;
+
+        timed_out = !wait_pidfd(pidfd, timeout->duration);
+
+        if (timed_out) {
+            syscall(SYS_pidfd_send_signal, pidfd, SIGTERM, NULL, 0);
+
+            if (timeout->kill_after > 0 && !wait_pidfd(pidfd, timeout->kill_after)) {
+                syscall(SYS_pidfd_send_signal, pidfd, SIGKILL, NULL, 0);
+            }
+        }
+
+        dc_close(env, err, pidfd);
+
+        return timed_out;
+    }
+#endif
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    limit = timeout->duration;
+    signal_number = SIGTERM;
+
+    for (;;) {
+        siginfo_t info;
+
+        // WNOWAIT leaves the child to be reaped by the caller
+        info.si_pid = 0;
+
+        if (waitid(P_PID, (id_t) child, &info, WEXITED | WNOHANG | WNOWAIT) == -1 && errno != EINTR) {
+            return signal_number != SIGTERM;
+        }
+
+        if (info.si_pid == child) {
+            return signal_number != SIGTERM;
+        }
+
+        if (elapsed_since(&start) >= limit) {
+            kill(child, signal_number);
+
+            if (signal_number == SIGKILL || timeout->kill_after == 0) {
+                return true;
+            }
+
+            signal_number = SIGKILL;
+            limit += timeout->kill_after;
+        }
+
+        poll(NULL, 0, 10);
+    }
+}
+
+#if defined(__linux__) && defined(SYS_pidfd_open)
+/*
+ * A pidfd is readable once the process has exited. Returns false if it is still running after the time.
+ */
+static bool wait_pidfd(int pidfd, long milliseconds) {
+    struct pollfd fd;
+    struct timespec start;
+
+    fd.fd = pidfd;
+    fd.events = POLLIN;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (;;) {
+        long remaining;
+        int ready;
+
+        remaining = milliseconds - elapsed_since(&start);
+
+        if (remaining < 0) {
+            remaining = 0;
+        }
+
+        ready = poll(&fd, 1, remaining > INT_MAX ? INT_MAX : (int) remaining);
+
+        if (ready > 0) {
+            return true;
+        }
+
+        if (ready == 0 && remaining <= INT_MAX) {
+            return false;
+        }
+
+        // interrupted by a signal (or a wait longer than poll takes), what is left is worked out again
+        if (ready == -1 && errno != EINTR) {
+            return true;
+        }
+    }
+}
+#endif
+
+static long elapsed_since(const struct timespec *start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (long) (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/**
+ * Create a child process and exec the command with any redirection, without waiting for it.
+ * The child exits with the code from handle_run_error if the exec fails.
+ *
+ * @param env the posix environment.
+ * @param err the err object
+ * @param command the command to execute
+ * @param path the directories to search for the command
+ * @param variables the variables whose environment the command gets, or NULL to pass on the shell's environment
+ * @return the child's pid, or -1 if it could not be created
+ */
+pid_t execute_start(const struct dc_posix_env *env, struct dc_error *err, struct command *command, char **path,
+                    struct variables *variables)
+{
+    pid_t child;
 
     child = dc_fork(env, err);
     if (child == -1) {
         perror("NO\n");
     }
     if (child == 0) {
+        run_in_process(env, err, command, path, variables);
+    }
+
+    return child;
+}
+
+/**
+ * Replace the shell with the command's program, without a child process: the process substitutions and
+ * redirections are applied and the program is exec'd the same way execute does. It never returns, if the
+ * command can't be run the shell exits with the code from handle_run_error (126 for a redirection).
+ *
+ * @param env the posix environment.
+ * @param err the err object
+ * @param command the command to execute
+ * @param path the directories to search for the command
+ * @param variables the variables whose environment the command gets, or NULL to pass on the shell's environment
+ */
+_Noreturn void execute_replace(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                               char **path, struct variables *variables) {
+    // anything still buffered, or recorded (see audit_command), is written before the program takes over
+    fflush(NULL);
+    audit_close();
+    run_in_process(env, err, command, path, variables);
+}
+
+/*
+ * The child of execute_start, or the shell itself for execute_replace: exec the program or exit.
+ */
+_Noreturn static void run_in_process(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                                     char **path, struct variables *variables) {
+    int status;
+
+    // the process substitutions are close on exec everywhere else, this program gets them
+    for (size_t i = 0; i < command->substitution_count && dc_error_has_no_error(err); i++) {
+        dc_fcntl(env, err, command->substitutions[i].fd, F_SETFD, 0);
+    }
+
+    if (dc_error_has_no_error(err)) {
         redirect(env, err, command);
+    }
 
-        if (dc_error_has_error(err)) {
-            exit(126);
-        }
+    if (dc_error_has_error(err)) {
+        exit_child(126);
+    }
 
-        run(env, err, command, path);
+    // after the redirections, so a failure goes where the program's errors would
+    if (command->launch != NULL && !launch_apply(command->launch, stderr)) {
+        exit_child(125);
+    }
 
-        status = handle_run_error(err);
-        exit(status);
+    if (variables == NULL) {
+        run(env, err, command, path, environ);
     } else {
-        waitpid(child, &status, WUNTRACED);
-        command->exit_code = WEXITSTATUS(status);
+        path = apply_assignments(env, err, command, variables, path);
+
+        if (dc_error_has_error(err)) {
+            exit_child(126);
+        }
+
+        run(env, err, command, path, variables_environ(variables));
     }
 
+    status = handle_run_error(err);
+    exit_child(status);
+}
+
+/*
+ * _exit, not exit: exit would also flush the FILE the shell reads its script from, which seeks the offset
+ * the child shares with the shell back to the end of what was read, so the shell would read those lines again.
+ */
+_Noreturn static void exit_child(int status) {
+    fflush(stdout);
+    fflush(stderr);
+    _exit(status);
 }
 
 int handle_run_error(struct dc_error *err) {
@@ -99,7 +475,38 @@ bool is_path_empty(char **path) {
     return to_return;
 }
 
-void run(const struct dc_posix_env *env, struct dc_error *err, struct command *command, char **path) {
+/*
+ * Called in the child: the variables are a copy, so changing them only affects the command.
+ * Returns the path to search, which is new if the assignments changed PATH.
+ */
+static char **apply_assignments(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                                struct variables *variables, char **path) {
+    bool path_changed;
+
+    // the shell's listener would update the shell's copy of the path, which the caller is still using
+    variables_set_listener(variables, NULL, NULL);
+    path_changed = false;
+
+    for (size_t i = 0; i < command->assignment_count; i++) {
+        variables_assign(env, err, variables, command->assignments[i], true);
+
+        if (dc_error_has_error(err)) {
+            return path;
+        }
+
+        if (dc_strncmp(env, command->assignments[i], "PATH=", 5) == 0) {
+            path_changed = true;
+        }
+    }
+
+    if (path_changed) {
+        path = parse_path(env, err, variables_get(env, variables, "PATH"));
+    }
+
+    return path;
+}
+
+void run(const struct dc_posix_env *env, struct dc_error *err, struct command *command, char **path, char **envp) {
     char *cmd;
 
     if (dc_strstr(env, command->command, "/") != NULL){
@@ -107,7 +514,7 @@ void run(const struct dc_posix_env *env, struct dc_error *err, struct command *c
          * perhaps stdup?
          */
         command->argv[0] = command->command;
-        dc_execv(env, err, command->argv[0], command->argv);
+        dc_execve(env, err, command->argv[0], command->argv, envp);
 
     } else {
         if (*path == NULL) {
@@ -123,10 +530,10 @@ void run(const struct dc_posix_env *env, struct dc_error *err, struct command *c
                 cmd[length] = '\0';
 
                 if (command->argv[0] != NULL) {
-                    dc_free(env, command->argv[0], strlen(command->argv[0]));
+                    dc_free(env, command->argv[0], strlen(command->argv[0]) + 1);
                 }
                 command->argv[0] = cmd;
-                execv_val = dc_execv(env, err, command->argv[0], command->argv);
+                execv_val = dc_execve(env, err, command->argv[0], command->argv, envp);
 
                 if(execv_val == ENOENT) {
                     break;
@@ -137,53 +544,638 @@ void run(const struct dc_posix_env *env, struct dc_error *err, struct command *c
     }
 }
 
+/**
+ * Apply the command's redirections to this process, in order (see command_redirections). When an fd has
+ * more than one > or >> file in a row (cmd > a >> b) it gets all of them (like zsh's multios): the files are
+ * opened in order, the fd becomes a pipe, and this process becomes the pump that copies the pipe to the files
+ * while a child carries on (redirect returns in the child only). The pump passes SIGTERM on to the child, and
+ * on Linux the child is killed if the pump is.
+ *
+ * @param env the posix environment.
+ * @param err the err object, with the errno of the redirection that failed.
+ * @param command the command.
+ */
 void redirect(const struct dc_posix_env *env, struct dc_error *err, struct command *command) {
-    int fd;
+    apply_redirections(env, err, command, false);
+}
+
+/**
+ * Apply the command's redirections to the shell itself (exec without a command), the same way as redirect,
+ * except that the shell keeps its pid: the pump of a fan out (exec > a > b) is started in the background
+ * (orphaned, so it never has to be reaped) and copies the pipe to the files until every copy of the
+ * write end is closed, when the shell exits or redirects the fd again.
+ *
+ * @param env the posix environment.
+ * @param err the err object, with the errno of the redirection that failed.
+ * @param command the command.
+ */
+void redirect_shell(const struct dc_posix_env *env, struct dc_error *err, struct command *command) {
+    apply_redirections(env, err, command, true);
+}
 
-    if (command->stdin_file != NULL) {
+static void apply_redirections(const struct dc_posix_env *env, struct dc_error *err, struct command *command,
+                               bool in_shell) {
+    const struct redirection *redirections;
+    struct redirection files[4];
+    size_t count;
+    struct fan_out *fan_outs;
+    size_t fan_out_count;
 
-        fd = open(command->stdin_file, O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    redirections = command_redirections(command, files, &count);
+    fan_outs = NULL;
+    fan_out_count = 0;
 
-        if (dc_error_has_error(err))
-        {
-            dc_close(env, err, fd);
-            return;
+    for (size_t i = 0; i < count && dc_error_has_no_error(err); i++) {
+        const struct redirection *redirection;
+        size_t last;
+        int fd;
+
+        redirection = &redirections[i];
+
+        switch (redirection->type) {
+            case REDIRECT_INPUT:
+                fd = dc_open(env, err, redirection->target, O_RDONLY | O_CLOEXEC);
+                break;
+            case REDIRECT_OUTPUT:
+            case REDIRECT_APPEND:
+                if (is_fanned_out(fan_outs, fan_out_count, redirection, i)) {
+                    continue;
+                }
+
+                if (fan_out_size(redirections, count, i, &last) > 1) {
+                    if (fan_outs == NULL) {
+                        fan_outs = dc_calloc(env, err, count, sizeof(struct fan_out));
+
+                        if (dc_error_has_error(err)) {
+                            return;
+                        }
+                    }
+
+                    // counted even if it fails, so what it did open is closed
+                    fd = start_fan_out(env, err, redirections, i, last, &fan_outs[fan_out_count]);
+                    fan_out_count++;
+                } else {
+                    fd = open_output(env, err, redirection);
+                }
+                break;
+            case REDIRECT_READ_WRITE:
+                fd = dc_open(env, err, redirection->target, O_RDWR | O_CREAT | O_CLOEXEC,
+                             S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+                break;
+            case REDIRECT_HERE:
+                // a <<WORD that was not read by the script parser is empty
+                fd = here_document_fd(env, err, command->here_document == NULL ? "" : command->here_document);
+                break;
+            case REDIRECT_DUPLICATE:
+                // dup2 does not copy the close on exec flag, so the copy stays open
+                if (redirection->source != redirection->fd) {
+                    dc_dup2(env, err, redirection->source, redirection->fd);
+                } else {
+                    // only checks that it is open
+                    dc_fcntl(env, err, redirection->fd, F_GETFD);
+                }
+                continue;
+            case REDIRECT_CLOSE:
+                dc_close(env, err, redirection->fd);
+
+                // closing a closed fd is not an error
+                if (dc_error_is_errno(err, EBADF)) {
+                    dc_error_reset(err);
+                }
+                continue;
+            default:
+                continue;
         }
 
-        dc_dup2(env, err, fd, 0);
-    }
+        if (fd == -1) {
+            break;
+        }
 
-    if (command->stdout_file != NULL) {
-        if (command->stdout_overwrite) {
-            fd = open(command->stdout_file, O_WRONLY | O_CREAT| O_APPEND, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        move_fd(env, err, fd, redirection->fd);
+    }
 
+    if (fan_out_count > 0 && dc_error_has_no_error(err)) {
+        if (in_shell) {
+            start_pump(env, err, fan_outs, fan_out_count);
         } else {
-            fd = open(command->stdout_file, O_WRONLY | O_CREAT| O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+            run_fan_outs(env, err, fan_outs, fan_out_count);
         }
+    }
 
-        if (dc_error_has_error(err))
-        {
-            dc_close(env, err, fd);
-            return;
+    // a program is about to be exec'd or exit, which closes the rest, the shell has to do it itself
+    if (in_shell && fan_outs != NULL) {
+        release_fan_outs(env, err, fan_outs, fan_out_count, count);
+    }
+}
+
+/*
+ * The number of > and >> files for the fd of redirections[first] before a redirection of that fd to
+ * something else, and the index of the last of them.
+ */
+static size_t fan_out_size(const struct redirection *redirections, size_t count, size_t first, size_t *last) {
+    size_t size;
+
+    size = 0;
+    *last = first;
+
+    for (size_t i = first; i < count; i++) {
+        if (redirections[i].fd != redirections[first].fd) {
+            continue;
+        }
+
+        if (redirections[i].type != REDIRECT_OUTPUT && redirections[i].type != REDIRECT_APPEND) {
+            break;
         }
 
-        dc_dup2(env, err, fd, 1);
+        size++;
+        *last = i;
     }
 
-    if (command->stderr_file != NULL) {
-        if (command->stderr_overwrite) {
-            fd = open(command->stderr_file, O_WRONLY | O_CREAT| O_APPEND, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    return size;
+}
 
-        } else {
-            fd = open(command->stderr_file, O_WRONLY | O_CREAT| O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+/*
+ * Was the redirection at index already opened as part of an earlier one's fan out.
+ */
+static bool is_fanned_out(const struct fan_out *fan_outs, size_t fan_out_count, const struct redirection *redirection,
+                          size_t index) {
+    for (size_t i = 0; i < fan_out_count; i++) {
+        if (fan_outs[i].fd == redirection->fd && index > fan_outs[i].first && index <= fan_outs[i].last) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int open_output(const struct dc_posix_env *env, struct dc_error *err, const struct redirection *redirection) {
+    if (redirection->type == REDIRECT_APPEND) {
+        return dc_open(env, err, redirection->target, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                       S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    }
+
+    return dc_open(env, err, redirection->target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                   S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+}
+
+/*
+ * Opens the files of the fan out, returns the write end of its pipe (or -1). Everything is close on exec,
+ * the program only keeps the write end once it is moved to the fd.
+ */
+static int start_fan_out(const struct dc_posix_env *env, struct dc_error *err, const struct redirection *redirections,
+                         size_t first, size_t last, struct fan_out *fan_out) {
+    int fds[2];
+
+    fan_out->fd = redirections[first].fd;
+    fan_out->first = first;
+    fan_out->last = last;
+    fan_out->pipe = -1;
+    fan_out->count = 0;
+    fan_out->files = dc_calloc(env, err, last - first + 1, sizeof(int));
+
+    if (dc_error_has_error(err)) {
+        return -1;
+    }
+
+    for (size_t i = first; i <= last; i++) {
+        int fd;
+
+        if (redirections[i].fd != fan_out->fd) {
+            continue;
+        }
+
+        fd = open_output(env, err, &redirections[i]);
+
+        if (dc_error_has_error(err)) {
+            return -1;
+        }
+
+        fan_out->files[fan_out->count++] = fd;
+    }
+
+    dc_pipe(env, err, fds);
+
+    if (dc_error_has_error(err)) {
+        return -1;
+    }
+
+    fan_out->pipe = fds[0];
+
+    dc_fcntl(env, err, fds[0], F_SETFD, FD_CLOEXEC);
+
+    if (dc_error_has_no_error(err)) {
+        dc_fcntl(env, err, fds[1], F_SETFD, FD_CLOEXEC);
+    }
+
+    if (dc_error_has_error(err)) {
+        dc_close(env, err, fds[1]);
+        return -1;
+    }
+
+    return fds[1];
+}
+
+/*
+ * The child returns to exec the program. This process copies the pipes to the files (see pump_all), then exits
+ * with the program's exit code. Waiting for it means waiting for all of the output.
+ * As it is the pid that is waited for, it is also the one that is signalled (eg. by execute_timed): it passes
+ * SIGTERM on to the program, and on Linux the program is killed when the pump is (SIGKILL can't be caught).
+ */
+static void run_fan_outs(const struct dc_posix_env *env, struct dc_error *err, struct fan_out *fan_outs,
+                         size_t fan_out_count) {
+    pid_t pump_pid;
+    pid_t child;
+    int status;
+    sigset_t term;
+    sigset_t saved;
+    struct sigaction action;
+
+    // a SIGTERM that comes before the pump can pass it on waits until it can
+    sigemptyset(&term);
+    sigaddset(&term, SIGTERM);
+    sigprocmask(SIG_BLOCK, &term, &saved);
+    pump_pid = getpid();
+    child = dc_fork(env, err);
+
+    if (child == 0) {
+#if defined(__linux__)
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+        // the pump was killed before the prctl
+        if (getppid() != pump_pid) {
+            raise(SIGKILL);
+        }
+#else
+        (void) pump_pid;
+#endif
+        sigprocmask(SIG_SETMASK, &saved, NULL);
+        return;
+    }
+
+    if (dc_error_has_error(err)) {
+        sigprocmask(SIG_SETMASK, &saved, NULL);
+        return;
+    }
+
+    pump_child = child;
+    action.sa_handler = forward_signal;
+    action.sa_flags = 0;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGTERM, &action, NULL);
+    sigprocmask(SIG_SETMASK, &saved, NULL);
+
+    if (!pump_all(env, err, fan_outs, fan_out_count)) {
+        _exit(126);
+    }
+
+    while (dc_waitpid(env, err, child, &status, 0) == -1) {
+        if (!dc_error_is_errno(err, EINTR)) {
+            _exit(126);
         }
-        if (dc_error_has_error(err))
-        {
-            dc_close(env, err, fd);
+
+        dc_error_reset(err);
+    }
+
+    if (WIFSIGNALED(status)) {
+        _exit(128 + WTERMSIG(status));
+    }
+
+    _exit(WEXITSTATUS(status));
+}
+
+/*
+ * The child of the shell forks the pump and exits, so the pump is orphaned. If it can't, the shell
+ * gets the errno as its exit code, rather than an fd no one reads.
+ */
+static void start_pump(const struct dc_posix_env *env, struct dc_error *err, struct fan_out *fan_outs,
+                       size_t fan_out_count) {
+    pid_t child;
+    int status;
+
+    child = dc_fork(env, err);
+
+    if (dc_error_has_error(err)) {
+        return;
+    }
+
+    if (child == 0) {
+        pid_t pump_pid;
+
+        pump_pid = dc_fork(env, err);
+
+        if (pump_pid != 0) {
+            _exit(pump_pid == -1 ? err->err_code : 0);
+        }
+
+        _exit(pump_all(env, err, fan_outs, fan_out_count) ? 0 : 126);
+    }
+
+    while (dc_waitpid(env, err, child, &status, 0) == -1) {
+        if (!dc_error_is_errno(err, EINTR)) {
             return;
         }
 
-        dc_dup2(env, err, fd, 2);
+        dc_error_reset(err);
+    }
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        DC_ERROR_RAISE_ERRNO(err, WIFEXITED(status) ? WEXITSTATUS(status) : ECHILD);
+    }
+}
+
+/*
+ * Close this process's copy of the write ends (so the pipes end when the program, and anything it started,
+ * is done with them) and copy the pipes to the files until they do. Returns false if it could not start.
+ */
+static bool pump_all(const struct dc_posix_env *env, struct dc_error *err, struct fan_out *fan_outs,
+                     size_t fan_out_count) {
+    struct pollfd *fds;
+    char *buffer;
+    size_t open_count;
+    int aux_fds[2];
+    int *aux;
+
+    fds = dc_calloc(env, err, fan_out_count, sizeof(struct pollfd));
+    buffer = dc_malloc(env, err, PUMP_CHUNK);
+
+    if (dc_error_has_error(err)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < fan_out_count; i++) {
+        dc_close(env, err, fan_outs[i].fd);
+        fds[i].fd = fan_outs[i].pipe;
+        fds[i].events = POLLIN;
+    }
+
+    // tee needs a second pipe to hold what it copies, it is emptied each time
+    aux = NULL;
+#if defined(__linux__)
+    if (dc_pipe(env, err, aux_fds) == 0) {
+        aux = aux_fds;
+    }
+
+    // without it everything is read and written
+    dc_error_reset(err);
+#else
+    (void) aux_fds;
+#endif
+
+    open_count = fan_out_count;
+
+    while (open_count > 0) {
+        if (poll(fds, fan_out_count, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            break;
+        }
+
+        for (size_t i = 0; i < fan_out_count; i++) {
+            if (fds[i].fd == -1 || fds[i].revents == 0) {
+                continue;
+            }
+
+            // at the end, or a file can't be written: the program gets SIGPIPE if it writes more, the
+            // other fds carry on
+            if (!pump(env, err, &fan_outs[i], aux, buffer)) {
+                dc_error_reset(err);
+                dc_close(env, err, fds[i].fd);
+                fds[i].fd = -1;
+                open_count--;
+            }
+        }
+    }
+
+    return true;
+}
+
+static void release_fan_outs(const struct dc_posix_env *env, struct dc_error *err, struct fan_out *fan_outs,
+                             size_t fan_out_count, size_t capacity) {
+    for (size_t i = 0; i < fan_out_count; i++) {
+        if (fan_outs[i].pipe != -1) {
+            dc_close(env, err, fan_outs[i].pipe);
+        }
+
+        if (fan_outs[i].files != NULL) {
+            for (size_t j = 0; j < fan_outs[i].count; j++) {
+                dc_close(env, err, fan_outs[i].files[j]);
+            }
+
+            dc_free(env, fan_outs[i].files, (fan_outs[i].last - fan_outs[i].first + 1) * sizeof(int));
+        }
+    }
+
+    dc_free(env, fan_outs, capacity * sizeof(struct fan_out));
+}
+
+static void forward_signal(int signal_number) {
+    kill(pump_child, signal_number);
+}
+
+/*
+ * Copy what is in the pipe to each of the files, returns false at the end or on an error. tee copies the
+ * pipe to another pipe without using it up, so all but the last file are spliced from the copy, and the
+ * last from the pipe itself. Files opened with >> (splice refuses O_APPEND) and terminals are written.
+ */
+static bool pump(const struct dc_posix_env *env, struct dc_error *err, const struct fan_out *fan_out,
+                 const int *aux, char *buffer) {
+    ssize_t bytes;
+
+#if defined(__linux__)
+    if (aux != NULL && can_splice(fan_out)) {
+        bytes = 0;
+
+        for (size_t i = 0; i + 1 < fan_out->count; i++) {
+            ssize_t copied;
+
+            // the first tee decides how much this pass moves, the rest copy the same start of the pipe
+            do {
+                copied = tee(fan_out->pipe, aux[1], i == 0 ? PUMP_CHUNK : (size_t) bytes, 0);
+            } while (copied == -1 && errno == EINTR);
+
+            if (copied <= 0 || (i > 0 && copied != bytes)) {
+                return false;
+            }
+
+            bytes = copied;
+
+            if (!splice_all(aux[0], fan_out->files[i], (size_t) bytes)) {
+                return false;
+            }
+        }
+
+        return splice_all(fan_out->pipe, fan_out->files[fan_out->count - 1], (size_t) bytes);
+    }
+#else
+    (void) aux;
+#endif
+
+    bytes = dc_read(env, err, fan_out->pipe, buffer, PUMP_CHUNK);
+
+    if (dc_error_is_errno(err, EINTR)) {
+        dc_error_reset(err);
+        return true;
+    }
+
+    if (bytes <= 0) {
+        return false;
+    }
+
+    for (size_t i = 0; i < fan_out->count; i++) {
+        if (!write_all(env, err, fan_out->files[i], buffer, (size_t) bytes)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#if defined(__linux__)
+/*
+ * splice writes to pipes and to files that are not O_APPEND.
+ */
+static bool can_splice(const struct fan_out *fan_out) {
+    for (size_t i = 0; i < fan_out->count; i++) {
+        struct stat file_stat;
+        int flags;
+
+        flags = fcntl(fan_out->files[i], F_GETFL);
+
+        if (flags == -1 || (flags & O_APPEND) || fstat(fan_out->files[i], &file_stat) == -1 ||
+            !(S_ISREG(file_stat.st_mode) || S_ISFIFO(file_stat.st_mode))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool splice_all(int in, int out, size_t length) {
+    while (length > 0) {
+        ssize_t bytes;
+
+        bytes = splice(in, NULL, out, NULL, length, SPLICE_F_MOVE);
+
+        if (bytes == -1 && errno == EINTR) {
+            continue;
+        }
+
+        if (bytes <= 0) {
+            return false;
+        }
+
+        length -= (size_t) bytes;
+    }
+
+    return true;
+}
+#endif
+
+/*
+ * The fds are opened close on exec, so only the ones the redirections asked for are left open.
+ */
+static void move_fd(const struct dc_posix_env *env, struct dc_error *err, int fd, int to) {
+    if (fd == to) {
+        // it was closed, so open took its place, the flag has to be cleared by hand
+        dc_fcntl(env, err, fd, F_SETFD, 0);
+
+        return;
+    }
+
+    dc_dup2(env, err, fd, to);
+    dc_close(env, err, fd);
+}
+
+/*
+ * The here-document is kept in memory, never in a file: a pipe if it fits in the pipe's buffer (so writing
+ * it all before the command runs can't block), otherwise an anonymous memory file.
+ */
+static int here_document_fd(const struct dc_posix_env *env, struct dc_error *err, const char *text) {
+    size_t length;
+    size_t capacity;
+    int fds[2];
+    int fd;
+
+    length = strlen(text);
+    dc_pipe(env, err, fds);
+
+    if (dc_error_has_error(err)) {
+        return -1;
+    }
+
+    capacity = PIPE_BUF;
+#if defined(__linux__)
+    {
+        int size;
+
+        size = fcntl(fds[1], F_GETPIPE_SZ);
+
+        if (size > 0) {
+            capacity = (size_t) size;
+        }
+    }
+#endif
+
+    if (length <= capacity) {
+        write_all(env, err, fds[1], text, length);
+        dc_close(env, err, fds[1]);
+
+        return fds[0];
+    }
+
+    dc_close(env, err, fds[0]);
+    dc_close(env, err, fds[1]);
+
+#if defined(__linux__)
+    fd = memfd_create("here-document", MFD_CLOEXEC);
+#else
+    {
+        char template[] = "/tmp/dc_shell_here_XXXXXX";
+
+        // there is no memory file, so the file is removed as soon as it is open
+        fd = mkstemp(template);
+
+        if (fd != -1) {
+            unlink(template);
+        }
+    }
+#endif
+
+    if (fd == -1) {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+        return -1;
+    }
+
+    if (!write_all(env, err, fd, text, length) || lseek(fd, 0, SEEK_SET) == -1) {
+        if (dc_error_has_no_error(err)) {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+        }
+
+        dc_close(env, err, fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static bool write_all(const struct dc_posix_env *env, struct dc_error *err, int fd, const char *text, size_t length) {
+    size_t written;
+
+    written = 0;
+
+    while (written < length) {
+        ssize_t bytes;
+
+        bytes = dc_write(env, err, fd, &text[written], length - written);
+
+        if (dc_error_has_error(err)) {
+            return false;
+        }
+
+        written += (size_t) bytes;
     }
 
+    return true;
 }
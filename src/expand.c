@@ -0,0 +1,1253 @@
+#include <dc_posix/dc_stdlib.h>
+#include <dc_posix/dc_string.h>
+#include <dc_posix/dc_unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pwd.h>
+#include <stdint.h>
+#include "arith.h"
+#include "expand.h"
+#include "mem_stats.h"
+#include "pathname.h"
+#include "scan.h"
+#include "script.h"
+#include "substitute.h"
+#include "variables.h"
+
+#define DEFAULT_IFS " \t\n"
+#define SHELL_NAME "dc_shell"
+#define INITIAL_SIZE 64
+
+/*! \struct buffer
+    \brief A growable string.
+*/
+struct buffer
+{
+    char *data;         /**< the characters, NUL terminated */
+    size_t length;      /**< the number of characters */
+    size_t capacity;    /**< the size of data */
+};
+
+/*! \struct field
+    \brief The field being built by expand_word.
+*/
+struct field
+{
+    struct buffer text;     /**< the field with the quotes removed */
+    struct buffer pattern;  /**< the field as a pattern, with quoted special characters escaped */
+    bool magic;             /**< does the pattern have an unquoted * ? or [ */
+    bool present;           /**< is there a field, even an empty one (eg. from "") */
+};
+
+/*! \struct word_list
+    \brief A growable array of words.
+*/
+struct word_list
+{
+    char **words;       /**< the words, there is always room for a NULL after the last one */
+    size_t count;       /**< the number of words */
+    size_t capacity;    /**< the number of words there is room for */
+    size_t first_match; /**< the index of the first word pathname expansion produced, SIZE_MAX if there is none */
+    size_t end_match;   /**< the index after the last word pathname expansion produced */
+};
+
+/*! \enum expand_mode
+    \brief What a word is being expanded for.
+*/
+enum expand_mode
+{
+    EXPAND_FIELDS,      /**< a command word - split into fields and matched against files */
+    EXPAND_ASSIGNMENT,  /**< a NAME=value word - expanded as a single string, tilde after the = too */
+    EXPAND_STRING,      /**< the word in ${NAME-word} - expanded as a single string */
+    EXPAND_PATTERN,     /**< a case pattern - expanded as a single string with the quoted special characters escaped */
+};
+
+static size_t skip_parenthesised(const char *line, size_t i);
+static char *expand_single(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                           const char *word, enum expand_mode mode);
+static bool is_blank(char c);
+static void expand_word(const struct dc_posix_env *env, struct dc_error *err, struct state *state, const char *word,
+                        enum expand_mode mode, struct word_list *out);
+static size_t expand_tilde(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                           const char *word, struct field *field);
+static size_t expand_dollar(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                            const char *str, char **value);
+static size_t expand_braces(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                            const char *str, char **value);
+static char *expand_substitution(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                 const char *str, size_t length);
+static char *expand_arithmetic(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                               const char *str, size_t length);
+static char *expand_process(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                            const char *str, size_t length);
+static char *special_parameter(const struct dc_posix_env *env, struct dc_error *err, struct state *state, char c);
+static char *join_positional(const struct dc_posix_env *env, struct dc_error *err, struct state *state);
+static const char *get_variable(const struct dc_posix_env *env, struct state *state, const char *name);
+static void add_value(const struct dc_posix_env *env, struct dc_error *err, struct state *state, struct field *field,
+                      const char *value, bool quoted, enum expand_mode mode, struct word_list *out);
+static void add_char(const struct dc_posix_env *env, struct dc_error *err, struct field *field, char c, bool quoted);
+static void finish_field(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                         struct field *field, enum expand_mode mode, struct word_list *out);
+static void append(const struct dc_posix_env *env, struct dc_error *err, struct buffer *buffer, char c);
+static void add_word(const struct dc_posix_env *env, struct dc_error *err, struct word_list *list, char *word);
+static char *copy_buffer(const struct dc_posix_env *env, struct dc_error *err, const struct buffer *buffer);
+static void free_buffer(const struct dc_posix_env *env, struct buffer *buffer);
+static void fit_list(const struct dc_posix_env *env, struct word_list *list);
+static void free_list(const struct dc_posix_env *env, struct word_list *list);
+
+/**
+ * Break a line into words at the unquoted blanks. The words are returned as written,
+ * with their quotes, so they can be expanded later (see expand_words).
+ * An unterminated quote or an unquoted | & ; < > ( or ) is an EINVAL error.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param line the line to split.
+ * @param count set to the number of words.
+ * @return the NULL terminated words (free with free_words).
+ */
+char **split_words(const struct dc_posix_env *env, struct dc_error *err, const char *line, size_t *count) {
+    struct word_list list;
+    size_t i;
+
+    list.words = NULL;
+    list.count = 0;
+    list.capacity = 0;
+    list.first_match = SIZE_MAX;
+    list.end_match = 0;
+    i = 0;
+    *count = 0;
+
+    while (dc_error_has_no_error(err)) {
+        size_t start;
+        char *word;
+
+        while (is_blank(line[i])) {
+            i++;
+        }
+
+        if (line[i] == '\0') {
+            break;
+        }
+
+        start = i;
+
+        // the ordinary characters are skipped in bulk, the loop only sees the ones that can end the word
+        for (i = scan_special(line, i); line[i] != '\0' && !is_blank(line[i]); i = scan_special(line, i)) {
+            // a word can start with a process substitution
+            if (dc_strchr(env, "|&;<>()", line[i]) != NULL &&
+                !(i == start && (line[i] == '<' || line[i] == '>') && line[i + 1] == '(')) {
+                DC_ERROR_RAISE_USER(err, "syntax error: unexpected operator", EINVAL);
+                break;
+            }
+
+            i = skip_quoted(line, i);
+
+            if (i == SIZE_MAX) {
+                DC_ERROR_RAISE_USER(err, "syntax error: unterminated quote", EINVAL);
+                break;
+            }
+        }
+
+        if (dc_error_has_error(err)) {
+            break;
+        }
+
+        word = dc_strndup(env, err, &line[start], i - start);
+        if (dc_error_has_error(err)) {
+            break;
+        }
+
+        add_word(env, err, &list, word);
+    }
+
+    // an empty line still gets an array
+    if (dc_error_has_no_error(err) && list.words == NULL) {
+        list.words = dc_malloc(env, err, sizeof(char *));
+        list.capacity = 1;
+    }
+
+    if (dc_error_has_error(err)) {
+        free_list(env, &list);
+        return NULL;
+    }
+
+    fit_list(env, &list);
+    list.words[list.count] = NULL;
+    *count = list.count;
+
+    return list.words;
+}
+
+/**
+ * Expand words the way sh does: tilde expansion, parameter expansion, command substitution,
+ * field splitting (with IFS), pathname expansion and quote removal.
+ * Leading NAME=value words can be treated as assignments, which are expanded but not split
+ * or matched against files, and are returned first.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param state the state, for the variables, directory listings and last exit code.
+ * @param words the words to expand (see split_words).
+ * @param count the number of words.
+ * @param expanded_count set to the number of words after expansion.
+ * @param assignment_count set to the number of leading assignments, or NULL if there are no assignments.
+ * @param pathname_range set to the first and one past the last index of the words pathname expansion produced
+ *                       (the same index twice if it produced none), or NULL.
+ * @return the NULL terminated expanded words (free with free_words).
+ */
+char **expand_words(const struct dc_posix_env *env, struct dc_error *err, struct state *state, char **words,
+                    size_t count, size_t *expanded_count, size_t *assignment_count, size_t pathname_range[2]) {
+    struct word_list out;
+    size_t i;
+
+    out.words = NULL;
+    out.count = 0;
+    out.capacity = 0;
+    out.first_match = SIZE_MAX;
+    out.end_match = 0;
+    i = 0;
+    *expanded_count = 0;
+
+    if (assignment_count != NULL) {
+        // the name can't be quoted, so this works on the word as written
+        while (i < count && variables_is_assignment(env, words[i])) {
+            expand_word(env, err, state, words[i], EXPAND_ASSIGNMENT, &out);
+            i++;
+        }
+
+        *assignment_count = i;
+    }
+
+    for (; i < count && dc_error_has_no_error(err); i++) {
+        expand_word(env, err, state, words[i], EXPAND_FIELDS, &out);
+    }
+
+    if (dc_error_has_no_error(err) && out.words == NULL) {
+        out.words = dc_malloc(env, err, sizeof(char *));
+        out.capacity = 1;
+    }
+
+    if (dc_error_has_error(err)) {
+        free_list(env, &out);
+        return NULL;
+    }
+
+    fit_list(env, &out);
+    out.words[out.count] = NULL;
+    *expanded_count = out.count;
+
+    if (pathname_range != NULL) {
+        pathname_range[0] = out.first_match == SIZE_MAX ? out.count : out.first_match;
+        pathname_range[1] = out.first_match == SIZE_MAX ? out.count : out.end_match;
+    }
+
+    return out.words;
+}
+
+/**
+ * Free the words returned by split_words or expand_words.
+ *
+ * @param env the posix environment.
+ * @param words the words.
+ * @param count the number of words.
+ */
+void free_words(const struct dc_posix_env *env, char **words, size_t count) {
+    if (words == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        dc_free(env, words[i], strlen(words[i]) + 1);
+    }
+
+    dc_free(env, words, (count + 1) * sizeof(char *));
+}
+
+/**
+ * Expand a word as a single string: no field splitting or pathname expansion (eg. the word of a case).
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param state the state, for the variables and last exit code.
+ * @param word the word to expand, as written.
+ * @return the expanded word.
+ */
+char *expand_string(const struct dc_posix_env *env, struct dc_error *err, struct state *state, const char *word) {
+    return expand_single(env, err, state, word, EXPAND_STRING);
+}
+
+/**
+ * Expand a word as a pattern (see pathname_match): like expand_string, but the quoted * ? [ and \
+ * are escaped so they only match themselves.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param state the state, for the variables and last exit code.
+ * @param word the word to expand, as written.
+ * @return the pattern.
+ */
+char *expand_pattern(const struct dc_posix_env *env, struct dc_error *err, struct state *state, const char *word) {
+    return expand_single(env, err, state, word, EXPAND_PATTERN);
+}
+
+/**
+ * Expand the body of a here-document: parameters, command substitutions and arithmetic are expanded and
+ * a \\ before $, ` or \\ is removed (a \\ before a newline removes both). Quotes are not special and
+ * nothing is split or matched against files.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param state the state, for the variables and last exit code.
+ * @param text the body, as written.
+ * @return the expanded body (free with dc_free).
+ */
+char *expand_here_document(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                           const char *text) {
+    struct buffer buffer;
+    char *expanded;
+    size_t i;
+
+    dc_memset(env, &buffer, 0, sizeof(struct buffer));
+    i = 0;
+
+    while (text[i] != '\0' && dc_error_has_no_error(err)) {
+        char c;
+
+        c = text[i];
+
+        if (c == '\\' && text[i + 1] == '\n') {
+            i += 2;
+        } else if (c == '\\' && text[i + 1] != '\0' && dc_strchr(env, "$`\\", text[i + 1]) != NULL) {
+            append(env, err, &buffer, text[i + 1]);
+            i += 2;
+        } else if (c == '$' || c == '`') {
+            char *value;
+            size_t consumed;
+
+            consumed = expand_dollar(env, err, state, &text[i], &value);
+
+            if (consumed == 0) {
+                append(env, err, &buffer, c);
+                i++;
+            } else {
+                if (value != NULL) {
+                    for (size_t j = 0; value[j] != '\0'; j++) {
+                        append(env, err, &buffer, value[j]);
+                    }
+
+                    dc_free(env, value, strlen(value) + 1);
+                }
+
+                i += consumed;
+            }
+        } else {
+            append(env, err, &buffer, c);
+            i++;
+        }
+    }
+
+    expanded = dc_error_has_error(err) ? NULL : copy_buffer(env, err, &buffer);
+    free_buffer(env, &buffer);
+
+    return expanded;
+}
+
+/**
+ * Find the end of the character, quoted string or substitution at line[i].
+ *
+ * @param line the line.
+ * @param i the index of the character.
+ * @return the index just past it, or SIZE_MAX if it is not terminated.
+ */
+size_t skip_quoted(const char *line, size_t i) {
+    switch (line[i]) {
+        case '\\':
+            return line[i + 1] == '\0' ? i + 1 : i + 2;
+        case '\'':
+            for (i++; line[i] != '\''; i++) {
+                if (line[i] == '\0') {
+                    return SIZE_MAX;
+                }
+            }
+
+            return i + 1;
+        case '"':
+            for (i++; line[i] != '"';) {
+                if (line[i] == '\0') {
+                    return SIZE_MAX;
+                }
+
+                if (line[i] == '\\' || line[i] == '$' || line[i] == '`') {
+                    i = skip_quoted(line, i);
+
+                    if (i == SIZE_MAX) {
+                        return SIZE_MAX;
+                    }
+                } else {
+                    i++;
+                }
+            }
+
+            return i + 1;
+        case '`':
+            for (i++; line[i] != '`'; i++) {
+                if (line[i] == '\0') {
+                    return SIZE_MAX;
+                }
+
+                if (line[i] == '\\' && line[i + 1] != '\0') {
+                    i++;
+                }
+            }
+
+            return i + 1;
+        case '$':
+            if (line[i + 1] == '(' || line[i + 1] == '{') {
+                return skip_parenthesised(line, i + 1);
+            }
+
+            return i + 1;
+        case '<':
+        case '>':
+            // a process substitution is skipped like $(...), what is not one is an operator to the caller
+            if (line[i + 1] == '(') {
+                return skip_parenthesised(line, i + 1);
+            }
+
+            return i + 1;
+        default:
+            return i + 1;
+    }
+}
+
+/*
+ * line[i] is ( or {, returns the index just past the matching ) or }.
+ */
+static size_t skip_parenthesised(const char *line, size_t i) {
+    char open;
+    char close;
+    size_t depth;
+
+    open = line[i];
+    close = open == '(' ? ')' : '}';
+    depth = 1;
+    i++;
+
+    while (depth > 0) {
+        if (line[i] == '\0') {
+            return SIZE_MAX;
+        }
+
+        if (line[i] == open) {
+            depth++;
+            i++;
+        } else if (line[i] == close) {
+            depth--;
+            i++;
+        } else {
+            i = skip_quoted(line, i);
+
+            if (i == SIZE_MAX) {
+                return SIZE_MAX;
+            }
+        }
+    }
+
+    return i;
+}
+
+static char *expand_single(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                           const char *word, enum expand_mode mode) {
+    struct word_list words;
+    char *value;
+
+    words.words = NULL;
+    words.count = 0;
+    words.capacity = 0;
+    words.first_match = SIZE_MAX;
+    words.end_match = 0;
+    expand_word(env, err, state, word, mode, &words);
+
+    if (dc_error_has_error(err)) {
+        free_list(env, &words);
+        return NULL;
+    }
+
+    // a single string is always one field
+    value = words.words[0];
+    words.words[0] = NULL;
+    words.count = 0;
+    free_list(env, &words);
+
+    return value;
+}
+
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+static void expand_word(const struct dc_posix_env *env, struct dc_error *err, struct state *state, const char *word,
+                        enum expand_mode mode, struct word_list *out) {
+    struct field field;
+    bool quoted;
+    size_t i;
+
+    dc_memset(env, &field, 0, sizeof(struct field));
+    quoted = false;
+    i = 0;
+
+    if (mode == EXPAND_ASSIGNMENT) {
+        // the name and = are copied as they are, the value can start with a ~
+        while (word[i] != '=') {
+            add_char(env, err, &field, word[i], true);
+            i++;
+        }
+
+        add_char(env, err, &field, '=', true);
+        i++;
+    }
+
+    if (word[i] == '~') {
+        i += expand_tilde(env, err, state, &word[i], &field);
+    }
+
+    while (word[i] != '\0' && dc_error_has_no_error(err)) {
+        char c;
+
+        c = word[i];
+
+        if (c == '\\') {
+            char next;
+
+            next = word[i + 1];
+
+            if (next == '\0') {
+                add_char(env, err, &field, c, true);
+                i++;
+            } else if (next == '\n') {
+                // a line continuation
+                i += 2;
+            } else if (quoted && dc_strchr(env, "$`\"\\", next) == NULL) {
+                // inside "" the \ is only special before the characters that are special there
+                add_char(env, err, &field, c, true);
+                i++;
+            } else {
+                add_char(env, err, &field, next, true);
+                i += 2;
+            }
+        } else if (c == '\'' && !quoted) {
+            field.present = true;
+
+            for (i++; word[i] != '\''; i++) {
+                add_char(env, err, &field, word[i], true);
+            }
+
+            i++;
+        } else if (c == '"') {
+            field.present = true;
+            quoted = !quoted;
+            i++;
+        } else if ((c == '<' || c == '>') && word[i + 1] == '(' && !quoted &&
+                   (mode == EXPAND_FIELDS || mode == EXPAND_STRING)) {
+            char *value;
+            size_t consumed;
+
+            consumed = skip_quoted(word, i);
+            value = expand_process(env, err, state, &word[i], consumed);
+
+            if (value == NULL) {
+                break;
+            }
+
+            // the path is one field, it is not split or matched against files
+            for (size_t j = 0; value[j] != '\0'; j++) {
+                add_char(env, err, &field, value[j], true);
+            }
+
+            field.present = true;
+            dc_free(env, value, strlen(value) + 1);
+            i += consumed;
+        } else if (c == '$' || c == '`') {
+            char *value;
+            size_t consumed;
+
+            consumed = expand_dollar(env, err, state, &word[i], &value);
+
+            if (consumed == 0) {
+                add_char(env, err, &field, c, quoted);
+                i++;
+            } else {
+                if (value != NULL) {
+                    add_value(env, err, state, &field, value, quoted, mode, out);
+                    dc_free(env, value, strlen(value) + 1);
+                }
+
+                i += consumed;
+            }
+        } else {
+            add_char(env, err, &field, c, quoted);
+            i++;
+        }
+    }
+
+    // "" and '' are an empty field, but an unquoted empty expansion is no field at all
+    if (mode != EXPAND_FIELDS) {
+        field.present = true;
+    }
+
+    finish_field(env, err, state, &field, mode, out);
+    free_buffer(env, &field.text);
+    free_buffer(env, &field.pattern);
+}
+
+static size_t expand_tilde(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                           const char *word, struct field *field) {
+    size_t length;
+    const char *home;
+
+    length = 1;
+
+    while (word[length] != '\0' && word[length] != '/') {
+        // ~"user" is not a tilde expansion
+        if (dc_strchr(env, "\\'\"$`", word[length]) != NULL) {
+            return 0;
+        }
+
+        length++;
+    }
+
+    if (length == 1) {
+        home = get_variable(env, state, "HOME");
+
+        if (home == NULL) {
+            struct passwd *user;
+
+            user = getpwuid(getuid());
+            home = user == NULL ? NULL : user->pw_dir;
+        }
+    } else {
+        char *name;
+        struct passwd *user;
+
+        name = dc_strndup(env, err, &word[1], length - 1);
+        if (dc_error_has_error(err)) {
+            return 0;
+        }
+
+        user = getpwnam(name);
+        dc_free(env, name, length);
+        home = user == NULL ? NULL : user->pw_dir;
+    }
+
+    if (home == NULL) {
+        return 0;
+    }
+
+    // the directory is used as is, it is not split or matched against files
+    for (size_t i = 0; home[i] != '\0'; i++) {
+        add_char(env, err, field, home[i], true);
+    }
+
+    field->present = true;
+
+    return length;
+}
+
+/*
+ * str starts with $ or `, returns the number of characters used (0 if it is just a $)
+ * and sets value to the expansion (NULL if it is unset).
+ */
+static size_t expand_dollar(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                            const char *str, char **value) {
+    size_t length;
+
+    *value = NULL;
+
+    if (str[0] == '`' || str[1] == '(') {
+        length = skip_quoted(str, 0);
+        *value = expand_substitution(env, err, state, str, length);
+
+        return length;
+    }
+
+    if (str[1] == '{') {
+        return expand_braces(env, err, state, str, value);
+    }
+
+    if (variables_is_name(&str[1], 1)) {
+        const char *variable;
+        char *name;
+
+        length = 1;
+
+        while (variables_is_name(&str[1], length + 1)) {
+            length++;
+        }
+
+        name = dc_strndup(env, err, &str[1], length);
+        if (dc_error_has_error(err)) {
+            return 0;
+        }
+
+        variable = get_variable(env, state, name);
+        dc_free(env, name, length + 1);
+
+        if (variable != NULL) {
+            *value = dc_strdup(env, err, variable);
+        }
+
+        return length + 1;
+    }
+
+    if (str[1] != '\0' && dc_strchr(env, "?$#!-*@0123456789", str[1]) != NULL) {
+        *value = special_parameter(env, err, state, str[1]);
+
+        return 2;
+    }
+
+    return 0;
+}
+
+/*
+ * ${NAME}, ${#NAME}, and ${NAME-word} with the -, =, + and ? operators (with or without a :).
+ */
+static size_t expand_braces(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                            const char *str, char **value) {
+    size_t end;
+    size_t name_length;
+    size_t start;
+    bool length_of;
+    bool colon;
+    char operation;
+    char *name;
+    const char *current;
+    bool use_word;
+
+    end = skip_quoted(str, 0);
+
+    if (end == SIZE_MAX) {
+        DC_ERROR_RAISE_USER(err, "syntax error: unterminated ${", EINVAL);
+        return 0;
+    }
+
+    start = 2;
+    length_of = str[start] == '#' && str[start + 1] != '}';
+
+    if (length_of) {
+        start++;
+    }
+
+    name_length = 0;
+
+    if (str[start] != '\0' && dc_strchr(env, "?$#!-*@0123456789", str[start]) != NULL) {
+        name_length = 1;
+    } else {
+        while (variables_is_name(&str[start], name_length + 1)) {
+            name_length++;
+        }
+    }
+
+    colon = str[start + name_length] == ':';
+    operation = str[start + name_length + colon];
+
+    if (name_length == 0 || (operation != '}' && dc_strchr(env, "-=+?", operation) == NULL) ||
+        (length_of && operation != '}') || (colon && operation == '}')) {
+        DC_ERROR_RAISE_USER(err, "bad substitution", EINVAL);
+        return 0;
+    }
+
+    name = dc_strndup(env, err, &str[start], name_length);
+    if (dc_error_has_error(err)) {
+        return 0;
+    }
+
+    if (name_length == 1 && !variables_is_name(name, 1)) {
+        *value = special_parameter(env, err, state, name[0]);
+        current = *value;
+    } else {
+        current = get_variable(env, state, name);
+    }
+
+    if (length_of) {
+        char number[32];
+
+        sprintf(number, "%zu", current == NULL ? (size_t) 0 : strlen(current));
+
+        if (*value != NULL) {
+            dc_free(env, *value, strlen(*value) + 1);
+        }
+
+        *value = dc_strdup(env, err, number);
+        dc_free(env, name, name_length + 1);
+
+        return end;
+    }
+
+    if (operation == '}') {
+        if (*value == NULL && current != NULL) {
+            *value = dc_strdup(env, err, current);
+        }
+
+        dc_free(env, name, name_length + 1);
+
+        return end;
+    }
+
+    // with the : an empty value counts as unset
+    if (operation == '+') {
+        use_word = current != NULL && (!colon || current[0] != '\0');
+    } else {
+        use_word = current == NULL || (colon && current[0] == '\0');
+    }
+
+    if (use_word) {
+        struct word_list words;
+        char *word;
+
+        word = dc_strndup(env, err, &str[start + name_length + colon + 1], end - (start + name_length + colon + 1) - 1);
+        if (dc_error_has_error(err)) {
+            dc_free(env, name, name_length + 1);
+            return 0;
+        }
+
+        words.words = NULL;
+        words.count = 0;
+        words.capacity = 0;
+        words.first_match = SIZE_MAX;
+        words.end_match = 0;
+        expand_word(env, err, state, word, EXPAND_STRING, &words);
+        dc_free(env, word, strlen(word) + 1);
+
+        if (*value != NULL) {
+            dc_free(env, *value, strlen(*value) + 1);
+            *value = NULL;
+        }
+
+        if (dc_error_has_no_error(err)) {
+            if (operation == '=' && state->variables != NULL) {
+                variables_set(env, err, state->variables, name, words.words[0]);
+            }
+
+            if (operation == '?') {
+                DC_ERROR_RAISE_USER(err, "parameter null or not set", EINVAL);
+            } else if (operation != '+' || use_word) {
+                *value = words.words[0];
+                words.words[0] = NULL;
+                words.count = 0;
+            }
+        }
+
+        free_list(env, &words);
+    } else if (operation == '+') {
+        if (*value != NULL) {
+            dc_free(env, *value, strlen(*value) + 1);
+            *value = NULL;
+        }
+    } else if (*value == NULL) {
+        *value = dc_strdup(env, err, current);
+    }
+
+    dc_free(env, name, name_length + 1);
+
+    return end;
+}
+
+/*
+ * $(...) and `...` are run by the shell itself (see substitute_command).
+ * Inside `...` a \ only escapes $, ` and \, which are unescaped before the commands are parsed.
+ */
+static char *expand_substitution(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                 const char *str, size_t length) {
+    char *text;
+    char *output;
+    size_t text_length;
+
+    if (length == SIZE_MAX) {
+        DC_ERROR_RAISE_USER(err, "syntax error: unterminated substitution", EINVAL);
+        return NULL;
+    }
+
+    if (str[0] == '$' && str[2] == '(' && str[length - 2] == ')') {
+        return expand_arithmetic(env, err, state, str, length);
+    }
+
+    text = dc_malloc(env, err, length);
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    text_length = 0;
+
+    if (str[0] == '`') {
+        for (size_t i = 1; i < length - 1; i++) {
+            if (str[i] == '\\' && i + 1 < length - 1 && dc_strchr(env, "$`\\", str[i + 1]) != NULL) {
+                i++;
+            }
+
+            text[text_length] = str[i];
+            text_length++;
+        }
+    } else {
+        text_length = length - 3;
+        dc_memcpy(env, text, &str[2], text_length);
+    }
+
+    text[text_length] = '\0';
+    output = substitute_command(env, err, state, text);
+    dc_free(env, text, length);
+
+    return output;
+}
+
+/*
+ * <(...) and >(...) are started by the shell (see substitute_process), the value is the /dev/fd path of the
+ * pipe to them.
+ */
+static char *expand_process(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                            const char *str, size_t length) {
+    char *text;
+    char *path;
+
+    if (length == SIZE_MAX) {
+        DC_ERROR_RAISE_USER(err, "syntax error: unterminated substitution", EINVAL);
+        return NULL;
+    }
+
+    text = dc_strndup(env, err, &str[2], length - 3);
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    path = substitute_process(env, err, state, text, str[0] == '<');
+    dc_free(env, text, length - 2);
+
+    return path;
+}
+
+/*
+ * $((...)) is evaluated by the shell (see arith_parse). An expression that is only numbers, operators and
+ * $name variables is parsed the first time it is seen and kept in the script context, anything else
+ * is expanded first and parsed every time.
+ */
+static char *expand_arithmetic(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                               const char *str, size_t length) {
+    struct arith_cache *cache;
+    char *text;
+    char *expanded;
+    char output[32];
+    int64_t value;
+
+    text = dc_strndup(env, err, &str[3], length - 5);
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    cache = state->script_context == NULL ? NULL : state->script_context->arithmetic;
+
+    if (arith_needs_expansion(text)) {
+        expanded = expand_string(env, err, state, text);
+        dc_free(env, text, length - 4);
+
+        if (dc_error_has_error(err)) {
+            return NULL;
+        }
+
+        value = arith_cache_evaluate(env, err, NULL, state->variables, expanded);
+        dc_free(env, expanded, strlen(expanded) + 1);
+    } else {
+        value = arith_cache_evaluate(env, err, cache, state->variables, text);
+        dc_free(env, text, length - 4);
+    }
+
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    snprintf(output, sizeof(output), "%" PRId64, value);
+
+    return dc_strdup(env, err, output);
+}
+
+static char *special_parameter(const struct dc_posix_env *env, struct dc_error *err, struct state *state, char c) {
+    char number[32];
+    long pid;
+
+    switch (c) {
+        case '?':
+            sprintf(number, "%d", state->exit_code);
+            break;
+        case '$':
+            pid = getpid();
+            sprintf(number, "%ld", pid);
+            break;
+        case '#':
+            sprintf(number, "%zu", state->positional_count);
+            break;
+        case '0':
+            return dc_strdup(env, err, SHELL_NAME);
+        case '@':
+        case '*':
+            return join_positional(env, err, state);
+        default:
+            if (c >= '1' && c <= '9') {
+                size_t index;
+
+                index = (size_t) (c - '1');
+
+                return index < state->positional_count ? dc_strdup(env, err, state->positional[index]) : NULL;
+            }
+
+            return NULL;
+    }
+
+    return dc_strdup(env, err, number);
+}
+
+/*
+ * $@ and $* are the positional parameters separated by spaces, so "$@" is one field.
+ */
+static char *join_positional(const struct dc_posix_env *env, struct dc_error *err, struct state *state) {
+    char *joined;
+    size_t length;
+
+    length = 0;
+
+    for (size_t i = 0; i < state->positional_count; i++) {
+        length += strlen(state->positional[i]) + 1;
+    }
+
+    joined = dc_malloc(env, err, length + 1);
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    joined[0] = '\0';
+
+    for (size_t i = 0; i < state->positional_count; i++) {
+        if (i > 0) {
+            strcat(joined, " ");
+        }
+
+        strcat(joined, state->positional[i]);
+    }
+
+    return joined;
+}
+
+static const char *get_variable(const struct dc_posix_env *env, struct state *state, const char *name) {
+    if (state->variables == NULL) {
+        return NULL;
+    }
+
+    return variables_get(env, state->variables, name);
+}
+
+/*
+ * An expansion outside double quotes is split at the IFS characters and can match files.
+ */
+static void add_value(const struct dc_posix_env *env, struct dc_error *err, struct state *state, struct field *field,
+                      const char *value, bool quoted, enum expand_mode mode, struct word_list *out) {
+    const char *ifs;
+
+    if (quoted || mode != EXPAND_FIELDS) {
+        // an unquoted expansion in a pattern can have special characters of its own
+        for (size_t i = 0; value[i] != '\0'; i++) {
+            add_char(env, err, field, value[i], quoted || mode != EXPAND_PATTERN);
+        }
+
+        field->present = field->present || quoted;
+        return;
+    }
+
+    ifs = get_variable(env, state, "IFS");
+
+    if (ifs == NULL) {
+        ifs = DEFAULT_IFS;
+    }
+
+    for (size_t i = 0; value[i] != '\0' && dc_error_has_no_error(err); i++) {
+        if (strchr(ifs, value[i]) != NULL) {
+            // white space separators run together, any other separator always ends a field (even an empty one)
+            if (!is_blank(value[i])) {
+                field->present = true;
+            }
+
+            finish_field(env, err, state, field, mode, out);
+        } else {
+            add_char(env, err, field, value[i], false);
+        }
+    }
+}
+
+static void add_char(const struct dc_posix_env *env, struct dc_error *err, struct field *field, char c, bool quoted) {
+    if (dc_strchr(env, "*?[", c) != NULL) {
+        if (quoted) {
+            append(env, err, &field->pattern, '\\');
+        } else {
+            field->magic = true;
+        }
+    } else if (c == '\\') {
+        append(env, err, &field->pattern, '\\');
+    }
+
+    append(env, err, &field->text, c);
+    append(env, err, &field->pattern, c);
+    field->present = true;
+}
+
+static void finish_field(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                         struct field *field, enum expand_mode mode, struct word_list *out) {
+    if (field->present && dc_error_has_no_error(err)) {
+        char **matches;
+        size_t count;
+
+        matches = NULL;
+        count = 0;
+
+        if (mode == EXPAND_FIELDS && field->magic && state->pathname_cache != NULL) {
+            matches = pathname_expand(env, err, state->pathname_cache, field->pattern.data, &count);
+        }
+
+        if (matches != NULL) {
+            if (out->first_match == SIZE_MAX) {
+                out->first_match = out->count;
+            }
+
+            // the matches are moved into the output, only the array is freed
+            for (size_t i = 0; i < count; i++) {
+                add_word(env, err, out, matches[i]);
+            }
+
+            out->end_match = out->count;
+
+            dc_free(env, matches, (count + 1) * sizeof(char *));
+        } else if (mode == EXPAND_PATTERN) {
+            add_word(env, err, out, copy_buffer(env, err, &field->pattern));
+        } else if (dc_error_has_no_error(err)) {
+            // a pattern that does not match anything is left as it is
+            add_word(env, err, out, copy_buffer(env, err, &field->text));
+        }
+    }
+
+    // the buffers are reused for the next field
+    if (field->text.data != NULL) {
+        field->text.data[0] = '\0';
+        field->pattern.data[0] = '\0';
+    }
+
+    field->text.length = 0;
+    field->pattern.length = 0;
+    field->magic = false;
+    field->present = false;
+}
+
+static void append(const struct dc_posix_env *env, struct dc_error *err, struct buffer *buffer, char c) {
+    if (dc_error_has_error(err)) {
+        return;
+    }
+
+    if (buffer->length + 1 >= buffer->capacity) {
+        char *data;
+        size_t capacity;
+
+        capacity = buffer->capacity == 0 ? INITIAL_SIZE : buffer->capacity * 2;
+        data = dc_realloc(env, err, buffer->data, capacity);
+        if (dc_error_has_error(err)) {
+            return;
+        }
+
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+
+    buffer->data[buffer->length] = c;
+    buffer->length++;
+    buffer->data[buffer->length] = '\0';
+}
+
+static void add_word(const struct dc_posix_env *env, struct dc_error *err, struct word_list *list, char *word) {
+    if (word == NULL) {
+        return;
+    }
+
+    if (dc_error_has_error(err)) {
+        dc_free(env, word, strlen(word) + 1);
+        return;
+    }
+
+    // there is always room for the NULL at the end
+    if (list->count + 1 >= list->capacity) {
+        char **words;
+        size_t capacity;
+
+        capacity = list->capacity == 0 ? INITIAL_SIZE : list->capacity * 2;
+        words = dc_realloc(env, err, list->words, capacity * sizeof(char *));
+        if (dc_error_has_error(err)) {
+            dc_free(env, word, strlen(word) + 1);
+            return;
+        }
+
+        list->words = words;
+        list->capacity = capacity;
+    }
+
+    list->words[list->count] = word;
+    list->count++;
+    list->words[list->count] = NULL;
+}
+
+static char *copy_buffer(const struct dc_posix_env *env, struct dc_error *err, const struct buffer *buffer) {
+    if (buffer->data == NULL) {
+        return dc_strdup(env, err, "");
+    }
+
+    return dc_strndup(env, err, buffer->data, buffer->length);
+}
+
+static void free_buffer(const struct dc_posix_env *env, struct buffer *buffer) {
+    if (buffer->data != NULL) {
+        dc_free(env, buffer->data, buffer->capacity);
+        buffer->data = NULL;
+    }
+}
+
+/*
+ * Cut a list down to its words and the NULL, the caller frees it by its count (see free_words). If it
+ * can't be made smaller it is left as it is.
+ */
+static void fit_list(const struct dc_posix_env *env, struct word_list *list) {
+    struct dc_error err;
+    char **words;
+
+    if (list->capacity <= list->count + 1) {
+        return;
+    }
+
+    dc_error_init(&err, NULL);
+    words = dc_realloc(env, &err, list->words, (list->count + 1) * sizeof(char *));
+
+    if (dc_error_has_no_error(&err)) {
+        list->words = words;
+        list->capacity = list->count + 1;
+    }
+
+    dc_error_reset(&err);
+}
+
+/*
+ * Free a list that is not being returned, and its words.
+ */
+static void free_list(const struct dc_posix_env *env, struct word_list *list) {
+    for (size_t i = 0; i < list->count; i++) {
+        dc_free(env, list->words[i], strlen(list->words[i]) + 1);
+    }
+
+    if (list->words != NULL) {
+        dc_free(env, list->words, list->capacity * sizeof(char *));
+    }
+
+    list->words = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
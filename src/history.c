@@ -0,0 +1,204 @@
+#include <dc_posix/dc_stdlib.h>
+#include <dc_posix/dc_string.h>
+#include <dc_posix/dc_stdio.h>
+#include <dc_posix/dc_unistd.h>
+#include <dc_posix/dc_fcntl.h>
+#include <dc_util/strings.h>
+#include "history.h"
+#include "mem_stats.h"
+
+static void remember(const struct dc_posix_env *env, struct dc_error *err, struct history *history, const char *line);
+
+/**
+ * Create an empty history. The file is not read until history_load (or history_add) is called.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param capacity the maximum number of lines to remember.
+ * @param file the file to load from and append to, or NULL to keep the history in memory only.
+ * @return the history.
+ */
+struct history *history_create(const struct dc_posix_env *env, struct dc_error *err, size_t capacity,
+                               const char *file) {
+    struct history *history;
+
+    history = dc_malloc(env, err, sizeof(struct history));
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    history->lines = dc_calloc(env, err, capacity, sizeof(char *));
+    if (dc_error_has_error(err)) {
+        dc_free(env, history, sizeof(struct history));
+        return NULL;
+    }
+
+    history->capacity = capacity;
+    history->count = 0;
+    history->first = 0;
+    history->loaded = false;
+    history->file = NULL;
+
+    if (file != NULL) {
+        history->file = dc_strdup(env, err, file);
+    }
+
+    return history;
+}
+
+/**
+ * Free the history and set the pointer to NULL.
+ *
+ * @param env the posix environment.
+ * @param phistory the history to destroy.
+ */
+void history_destroy(const struct dc_posix_env *env, struct history **phistory) {
+    struct history *history;
+
+    history = *phistory;
+
+    for (size_t i = 0; i < history->capacity; i++) {
+        if (history->lines[i] != NULL) {
+            dc_free(env, history->lines[i], strlen(history->lines[i]) + 1);
+        }
+    }
+
+    dc_free(env, history->lines, history->capacity * sizeof(char *));
+
+    if (history->file != NULL) {
+        dc_free(env, history->file, strlen(history->file) + 1);
+    }
+
+    dc_free(env, history, sizeof(struct history));
+    *phistory = NULL;
+}
+
+/**
+ * Read the history file, if there is one and it has not already been read.
+ * A missing file is not an error.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param history the history to fill in.
+ */
+void history_load(const struct dc_posix_env *env, struct dc_error *err, struct history *history) {
+    FILE *file;
+    char *line;
+    size_t line_size;
+
+    if (history->loaded || history->file == NULL) {
+        return;
+    }
+
+    history->loaded = true;
+    file = fopen(history->file, "r");
+
+    if (file == NULL) {
+        return;
+    }
+
+    line = NULL;
+    line_size = 0;
+
+    while (getline(&line, &line_size, file) != -1) {
+        dc_str_trim(env, line);
+        remember(env, err, history, line);
+
+        if (dc_error_has_error(err)) {
+            break;
+        }
+    }
+
+    free(line);
+    fclose(file);
+}
+
+/**
+ * Remember a line. Empty lines and repeats of the newest line are ignored.
+ * The history file is read first, if it hasn't been, and the line is appended to it.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param history the history to add to.
+ * @param line the line to remember.
+ */
+void history_add(const struct dc_posix_env *env, struct dc_error *err, struct history *history, const char *line) {
+    const char *newest;
+    char *record;
+    size_t length;
+    int fd;
+
+    // the file is read the first time it is needed, so it doesn't hold up the first prompt
+    history_load(env, err, history);
+    newest = history_get(history, 0);
+
+    if (line[0] == '\0' || (newest != NULL && dc_strcmp(env, newest, line) == 0)) {
+        return;
+    }
+
+    remember(env, err, history, line);
+
+    if (history->file == NULL || dc_error_has_error(err)) {
+        return;
+    }
+
+    fd = open(history->file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR);
+
+    if (fd == -1) {
+        // not being able to save the history should not stop the shell
+        return;
+    }
+
+    // one write per line so concurrent shells don't interleave their entries
+    length = strlen(line);
+    record = dc_malloc(env, err, length + 1);
+    if (dc_error_has_no_error(err)) {
+        dc_memcpy(env, record, line, length);
+        record[length] = '\n';
+        dc_write(env, err, fd, record, length + 1);
+        dc_free(env, record, length + 1);
+    }
+
+    dc_close(env, err, fd);
+}
+
+/**
+ * Get a remembered line.
+ *
+ * @param history the history to look in.
+ * @param age how far back to look (0 = the newest line).
+ * @return the line or NULL if age is not less than history->count.
+ */
+const char *history_get(const struct history *history, size_t age) {
+    if (age >= history->count) {
+        return NULL;
+    }
+
+    return history->lines[(history->first + history->count - 1 - age) % history->capacity];
+}
+
+static void remember(const struct dc_posix_env *env, struct dc_error *err, struct history *history, const char *line) {
+    size_t slot;
+    char *copy;
+
+    if (history->capacity == 0 || line[0] == '\0') {
+        return;
+    }
+
+    copy = dc_strdup(env, err, line);
+    if (dc_error_has_error(err)) {
+        return;
+    }
+
+    if (history->count == history->capacity) {
+        // full - the oldest line is overwritten
+        slot = history->first;
+        dc_free(env, history->lines[slot], strlen(history->lines[slot]) + 1);
+        history->first = (history->first + 1) % history->capacity;
+    } else {
+        slot = (history->first + history->count) % history->capacity;
+        history->count++;
+    }
+
+    history->lines[slot] = copy;
+}
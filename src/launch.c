@@ -0,0 +1,541 @@
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+#include "launch.h"
+
+// the nice values a process can have
+#define NICE_MIN (-20)
+#define NICE_MAX 19
+
+// how ioprio_set packs the class and level together
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+#define IO_LEVEL_MAX 7
+
+/*
+ * A resource ulimit can limit, in the order of LAUNCH_LIMIT_OPTIONS.
+ */
+struct resource
+{
+    int resource;               // the setrlimit resource
+    rlim_t unit;                // the bytes (or count) one of the ulimit units is
+    const char *description;    // what ulimit -a shows
+};
+
+static const struct resource resources[LAUNCH_LIMIT_COUNT] = {
+    { RLIMIT_CORE, 512, "core file size (blocks)" },
+    { RLIMIT_DATA, 1024, "data seg size (kbytes)" },
+    { RLIMIT_FSIZE, 512, "file size (blocks)" },
+    { RLIMIT_NOFILE, 1, "open files" },
+    { RLIMIT_STACK, 1024, "stack size (kbytes)" },
+    { RLIMIT_CPU, 1, "cpu time (seconds)" },
+    { RLIMIT_NPROC, 1, "max user processes" },
+    { RLIMIT_AS, 1024, "virtual memory (kbytes)" },
+};
+
+static bool set_cpus(const struct launch *launch);
+static bool set_io_class(const struct launch *launch);
+static bool set_limits(const struct launch *launch, char *failed);
+static int limit_index(char option);
+static bool parse_number(const char *string, long min, long max, long *value, const char **end);
+
+/**
+ * Set the launch to change nothing.
+ *
+ * @param launch the launch to set.
+ */
+void launch_init(struct launch *launch) {
+    memset(launch, 0, sizeof(struct launch));
+    launch->io_class = LAUNCH_IO_UNCHANGED;
+}
+
+/**
+ * Does the launch change anything.
+ *
+ * @param launch the launch.
+ * @return true if it pins, renices or changes the I/O class.
+ */
+bool launch_is_set(const struct launch *launch) {
+    if (launch->pin || launch->renice || launch->io_class != LAUNCH_IO_UNCHANGED) {
+        return true;
+    }
+
+    for (size_t i = 0; i < LAUNCH_LIMIT_COUNT; i++) {
+        if (launch->limits[i].soft_set || launch->limits[i].hard_set) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Pin the program to a list of CPUs, like taskset -c: numbers and ranges separated by commas (eg. 2-5 or 0,4-7).
+ *
+ * @param launch the launch to change.
+ * @param list the CPU list.
+ * @return false if the list is not a CPU list (the launch is not changed).
+ */
+bool launch_parse_cpus(struct launch *launch, const char *list) {
+    unsigned char cpus[LAUNCH_MAX_CPUS / 8];
+    const char *next;
+
+    memset(cpus, 0, sizeof(cpus));
+    next = list;
+
+    for (;;) {
+        long first;
+        long last;
+
+        if (!parse_number(next, 0, LAUNCH_MAX_CPUS - 1, &first, &next)) {
+            return false;
+        }
+
+        last = first;
+
+        if (*next == '-' && !parse_number(next + 1, first, LAUNCH_MAX_CPUS - 1, &last, &next)) {
+            return false;
+        }
+
+        for (long cpu = first; cpu <= last; cpu++) {
+            cpus[cpu / 8] |= (unsigned char) (1U << (cpu % 8));
+        }
+
+        if (*next == '\0') {
+            break;
+        }
+
+        if (*next != ',') {
+            return false;
+        }
+
+        next++;
+    }
+
+    memcpy(launch->cpus, cpus, sizeof(cpus));
+    launch->pin = true;
+
+    return true;
+}
+
+/**
+ * Add to the program's nice value: a number from -20 to 19, with an optional sign. Like nice(1) run inside
+ * another, a second adjustment adds to the first (nice 5 nice 5 is 10), the kernel keeps the result in range.
+ *
+ * @param launch the launch to change.
+ * @param adjustment the number.
+ * @return false if it is not a number in range (the launch is not changed).
+ */
+bool launch_parse_nice(struct launch *launch, const char *adjustment) {
+    const char *digits;
+    const char *end;
+    long value;
+
+    digits = *adjustment == '-' || *adjustment == '+' ? adjustment + 1 : adjustment;
+
+    if (!parse_number(digits, 0, -NICE_MIN, &value, &end) || *end != '\0') {
+        return false;
+    }
+
+    if (*adjustment == '-') {
+        value = -value;
+    } else if (value > NICE_MAX) {
+        return false;
+    }
+
+    // nice values only go from NICE_MIN to NICE_MAX, so nothing further apart than that can matter
+    if (launch->renice) {
+        value += launch->nice;
+        value = value < NICE_MIN - NICE_MAX ? NICE_MIN - NICE_MAX : value;
+        value = value > NICE_MAX - NICE_MIN ? NICE_MAX - NICE_MIN : value;
+    }
+
+    launch->nice = (int) value;
+    launch->renice = true;
+
+    return true;
+}
+
+/**
+ * Set the program's I/O scheduling class: idle, best-effort or realtime (or 3, 2 or 1, like ionice -c),
+ * followed by :level for the last two (eg. best-effort:7).
+ *
+ * @param launch the launch to change.
+ * @param priority the class and level.
+ * @return false if it is not a class (the launch is not changed).
+ */
+bool launch_parse_ionice(struct launch *launch, const char *priority) {
+    static const struct
+    {
+        const char *name;
+        enum launch_io_class io_class;
+    } classes[] = {
+        { "realtime", LAUNCH_IO_REALTIME },
+        { "1", LAUNCH_IO_REALTIME },
+        { "best-effort", LAUNCH_IO_BEST_EFFORT },
+        { "2", LAUNCH_IO_BEST_EFFORT },
+        { "idle", LAUNCH_IO_IDLE },
+        { "3", LAUNCH_IO_IDLE },
+    };
+    size_t length;
+    long level;
+
+    length = strcspn(priority, ":");
+
+    // the kernel's default level for the class
+    level = 4;
+
+    if (priority[length] == ':') {
+        const char *end;
+
+        if (!parse_number(&priority[length + 1], 0, IO_LEVEL_MAX, &level, &end) || *end != '\0') {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        if (strlen(classes[i].name) != length || strncmp(classes[i].name, priority, length) != 0) {
+            continue;
+        }
+
+        // the idle class has no levels
+        if (classes[i].io_class == LAUNCH_IO_IDLE) {
+            if (priority[length] == ':') {
+                return false;
+            }
+
+            level = 0;
+        }
+
+        launch->io_class = classes[i].io_class;
+        launch->io_level = (int) level;
+
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Limit a resource, like ulimit: -c the core file size and -f the size of a file written (in 512 byte blocks),
+ * -d the data segment, -s the stack and -v the address space (in kilobytes), -n the number of open files,
+ * -t the CPU time (in seconds) and -u the number of processes the user can have.
+ *
+ * @param launch the launch to change.
+ * @param option the ulimit option (one of LAUNCH_LIMIT_OPTIONS).
+ * @param value a number in the option's units, or unlimited.
+ * @param soft change the soft limit.
+ * @param hard change the hard limit.
+ * @return false if the option or value is not one (the launch is not changed).
+ */
+bool launch_parse_limit(struct launch *launch, char option, const char *value, bool soft, bool hard) {
+    struct launch_limit *limit;
+    rlim_t limit_value;
+    int index;
+
+    index = limit_index(option);
+
+    if (index == -1) {
+        return false;
+    }
+
+    if (strcmp(value, "unlimited") == 0) {
+        limit_value = RLIM_INFINITY;
+    } else {
+        uintmax_t number;
+        char *end;
+
+        if (*value < '0' || *value > '9') {
+            return false;
+        }
+
+        errno = 0;
+        number = strtoumax(value, &end, 10);
+
+        // one that does not fit in an rlim_t (or is RLIM_INFINITY) would not be the limit asked for
+        if (errno != 0 || *end != '\0' || number > (RLIM_INFINITY - 1) / resources[index].unit) {
+            return false;
+        }
+
+        limit_value = (rlim_t) number * resources[index].unit;
+    }
+
+    limit = &launch->limits[index];
+
+    if (soft) {
+        limit->soft_set = true;
+        limit->soft = limit_value;
+    }
+
+    if (hard) {
+        limit->hard_set = true;
+        limit->hard = limit_value;
+    }
+
+    return true;
+}
+
+/**
+ * The limit a program run with the launch gets: the launch's, or if it does not change it the shell's own.
+ *
+ * @param launch the launch, or NULL for the shell's.
+ * @param option the ulimit option (one of LAUNCH_LIMIT_OPTIONS).
+ * @param hard get the hard limit instead of the soft one.
+ * @param value set to the limit in the option's units, RLIM_INFINITY for none.
+ * @return false if the option is not one.
+ */
+bool launch_get_limit(const struct launch *launch, char option, bool hard, rlim_t *value) {
+    struct rlimit current;
+    int index;
+
+    index = limit_index(option);
+
+    if (index == -1) {
+        return false;
+    }
+
+    if (getrlimit(resources[index].resource, &current) == -1) {
+        current.rlim_cur = RLIM_INFINITY;
+        current.rlim_max = RLIM_INFINITY;
+    }
+
+    if (launch != NULL) {
+        const struct launch_limit *limit;
+
+        limit = &launch->limits[index];
+
+        if (limit->hard_set) {
+            current.rlim_max = limit->hard;
+
+            // see set_limits
+            if (!limit->soft_set && current.rlim_cur > limit->hard) {
+                current.rlim_cur = limit->hard;
+            }
+        }
+
+        if (limit->soft_set) {
+            current.rlim_cur = limit->soft;
+        }
+    }
+
+    *value = hard ? current.rlim_max : current.rlim_cur;
+
+    if (*value != RLIM_INFINITY) {
+        *value /= resources[index].unit;
+    }
+
+    return true;
+}
+
+/**
+ * What ulimit -a calls a resource, eg. "open files".
+ *
+ * @param option the ulimit option (one of LAUNCH_LIMIT_OPTIONS).
+ * @return the description and units, NULL if the option is not one.
+ */
+const char *launch_limit_description(char option) {
+    int index;
+
+    index = limit_index(option);
+
+    return index == -1 ? NULL : resources[index].description;
+}
+
+/**
+ * The launch the commands a batch is split into get (see batch_execute): BATCH_PIN is the CPU list,
+ * BATCH_NICE the nice adjustment and BATCH_IONICE the I/O class, on top of the command's own launch.
+ * A value that does not parse is ignored.
+ *
+ * @param env the posix environment.
+ * @param variables the shell variables, or NULL.
+ * @param base the command's launch, or NULL.
+ * @param launch set to the base with the defaults.
+ * @return true if any of them are set.
+ */
+bool launch_defaults(const struct dc_posix_env *env, struct variables *variables, const struct launch *base,
+                     struct launch *launch) {
+    const char *value;
+
+    if (base == NULL) {
+        launch_init(launch);
+    } else {
+        *launch = *base;
+    }
+
+    if (variables == NULL) {
+        return launch_is_set(launch);
+    }
+
+    value = variables_get(env, variables, "BATCH_PIN");
+
+    if (value != NULL) {
+        launch_parse_cpus(launch, value);
+    }
+
+    value = variables_get(env, variables, "BATCH_NICE");
+
+    if (value != NULL) {
+        launch_parse_nice(launch, value);
+    }
+
+    value = variables_get(env, variables, "BATCH_IONICE");
+
+    if (value != NULL) {
+        launch_parse_ionice(launch, value);
+    }
+
+    return launch_is_set(launch);
+}
+
+/**
+ * Apply the launch to the calling process, in the child before the exec. The CPUs and I/O class can only
+ * be set on Linux, elsewhere they fail with ENOSYS. The limits are set with setrlimit, a hard limit lower
+ * than the soft one lowers that too.
+ *
+ * @param launch the launch.
+ * @param errstream where a failure is displayed.
+ * @return false if one of them could not be set.
+ */
+bool launch_apply(const struct launch *launch, FILE *errstream) {
+    char failed;
+
+    // first, so a limit on the processes or files can't be dodged by what the rest do
+    if (!set_limits(launch, &failed)) {
+        fprintf(errstream, "ulimit: -%c: %s\n", failed, strerror(errno));
+        return false;
+    }
+
+    if (launch->pin && !set_cpus(launch)) {
+        fprintf(errstream, "pin: %s\n", strerror(errno));
+        return false;
+    }
+
+    if (launch->renice) {
+        // -1 is also a nice value, only errno tells them apart
+        errno = 0;
+
+        if (nice(launch->nice) == -1 && errno != 0) {
+            fprintf(errstream, "nice: %s\n", strerror(errno));
+            return false;
+        }
+    }
+
+    if (launch->io_class != LAUNCH_IO_UNCHANGED && !set_io_class(launch)) {
+        fprintf(errstream, "ionice: %s\n", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+static bool set_cpus(const struct launch *launch) {
+#if defined(__linux__)
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+
+    for (size_t cpu = 0; cpu < LAUNCH_MAX_CPUS && cpu < (size_t) CPU_SETSIZE; cpu++) {
+        if (launch->cpus[cpu / 8] & (1U << (cpu % 8))) {
+            CPU_SET(cpu, &set);
+        }
+    }
+
+    return sched_setaffinity(0, sizeof(cpu_set_t), &set) == 0;
+#else
+    (void) launch;
+    errno = ENOSYS;
+
+    return false;
+#endif
+}
+
+static bool set_io_class(const struct launch *launch) {
+#if defined(__linux__) && defined(SYS_ioprio_set)
+    int priority;
+
+    priority = ((int) launch->io_class << IOPRIO_CLASS_SHIFT) | launch->io_level;
+
+    return syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, priority) == 0;
+#else
+    (void) launch;
+    errno = ENOSYS;
+
+    return false;
+#endif
+}
+
+/*
+ * Only the parts of each limit the launch sets are changed, failed is set to the option of one that can't be.
+ */
+static bool set_limits(const struct launch *launch, char *failed) {
+    for (size_t i = 0; i < LAUNCH_LIMIT_COUNT; i++) {
+        const struct launch_limit *limit;
+        struct rlimit current;
+
+        limit = &launch->limits[i];
+
+        if (!limit->soft_set && !limit->hard_set) {
+            continue;
+        }
+
+        if (getrlimit(resources[i].resource, &current) == -1) {
+            *failed = LAUNCH_LIMIT_OPTIONS[i];
+            return false;
+        }
+
+        if (limit->hard_set) {
+            current.rlim_max = limit->hard;
+
+            // the soft limit can't be above the hard one, lowering the hard limit is what was asked for
+            if (!limit->soft_set && current.rlim_cur > limit->hard) {
+                current.rlim_cur = limit->hard;
+            }
+        }
+
+        if (limit->soft_set) {
+            current.rlim_cur = limit->soft;
+        }
+
+        if (setrlimit(resources[i].resource, &current) == -1) {
+            *failed = LAUNCH_LIMIT_OPTIONS[i];
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static int limit_index(char option) {
+    const char *found;
+
+    found = option == '\0' ? NULL : strchr(LAUNCH_LIMIT_OPTIONS, option);
+
+    return found == NULL ? -1 : (int) (found - LAUNCH_LIMIT_OPTIONS);
+}
+
+/*
+ * Decimal digits only, no sign or blanks, from min to max. end is set to the first character after them.
+ */
+static bool parse_number(const char *string, long min, long max, long *value, const char **end) {
+    char *stop;
+
+    if (*string < '0' || *string > '9') {
+        return false;
+    }
+
+    errno = 0;
+    *value = strtol(string, &stop, 10);
+    *end = stop;
+
+    return errno == 0 && *value >= min && *value <= max;
+}
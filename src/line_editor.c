@@ -0,0 +1,1284 @@
+#include <dc_posix/dc_stdlib.h>
+#include <dc_posix/dc_string.h>
+#include <dc_posix/dc_unistd.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include "line_editor.h"
+#include "mem_stats.h"
+
+#define DEFAULT_COLUMNS 80
+#define KEY_CTRL(c) ((c) & 0x1f)
+#define KEY_ESCAPE 0x1b
+#define KEY_BACKSPACE 0x7f
+#define PASTE_END "\x1b[201~"
+#define CLEAN SIZE_MAX
+
+enum key_result
+{
+    KEY_CONTINUE,   /**< keep reading */
+    KEY_ACCEPT,     /**< the line is finished */
+    KEY_CANCEL,     /**< the line was abandoned (^C) */
+    KEY_EOF,        /**< end of file on an empty line (^D) */
+    KEY_INCOMPLETE, /**< an escape sequence was cut off by the end of the input buffer */
+};
+
+static void enter_raw_mode(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor);
+static void leave_raw_mode(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor);
+static int get_terminal(const struct dc_posix_env *env, struct dc_error *err, int fd, struct termios *attributes);
+static int set_terminal(const struct dc_posix_env *env, struct dc_error *err, int fd,
+                        const struct termios *attributes);
+static size_t terminal_columns(int fd);
+static size_t count_columns(const char *str, size_t length);
+static void reserve_line(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor,
+                         size_t needed);
+static void emit(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor, const char *bytes,
+                 size_t length);
+static void emit_string(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor,
+                        const char *str);
+static void emit_move(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor, size_t from,
+                      size_t to);
+static void flush_output(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor);
+static void refresh(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor);
+static void redraw_all(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor);
+static void mark_dirty(struct line_editor *editor, size_t index);
+static void insert_bytes(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor,
+                         const char *bytes, size_t length);
+static void delete_bytes(const struct dc_posix_env *env, struct line_editor *editor, size_t start, size_t length);
+static void replace_line(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor,
+                         const char *str);
+static void history_move(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor,
+                         bool older);
+static void complete(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor);
+static void list_completions(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor,
+                             char **completions, size_t count);
+static enum key_result process_input(const struct dc_posix_env *env, struct dc_error *err,
+                                     struct line_editor *editor);
+static enum key_result process_paste(const struct dc_posix_env *env, struct dc_error *err,
+                                     struct line_editor *editor);
+static enum key_result process_escape(const struct dc_posix_env *env, struct dc_error *err,
+                                      struct line_editor *editor);
+static enum key_result process_control(const struct dc_posix_env *env, struct dc_error *err,
+                                       struct line_editor *editor, char key);
+static size_t previous_character(const struct line_editor *editor, size_t index);
+static size_t next_character(const struct line_editor *editor, size_t index);
+static int compare_strings(const void *a, const void *b);
+static void add_completion(const struct dc_posix_env *env, struct dc_error *err, char ***completions, size_t *count,
+                           size_t *capacity, const char *prefix, size_t prefix_length, const char *name,
+                           const char *suffix);
+static void complete_from_directory(const struct dc_posix_env *env, struct dc_error *err, const char *dir,
+                                    const char *shown_dir, size_t shown_dir_length, const char *prefix,
+                                    bool commands, char ***completions, size_t *count, size_t *capacity);
+
+/**
+ * Create a line editor.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param in_fd the file descriptor to read keys from.
+ * @param out_fd the file descriptor to echo to.
+ * @param history the lines to recall with up/down (not owned by the editor), may be NULL.
+ * @return the editor.
+ */
+struct line_editor *line_editor_create(const struct dc_posix_env *env, struct dc_error *err, int in_fd, int out_fd,
+                                       struct history *history) {
+    struct line_editor *editor;
+
+    editor = dc_calloc(env, err, 1, sizeof(struct line_editor));
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    editor->in_fd = in_fd;
+    editor->out_fd = out_fd;
+    editor->history = history;
+    editor->raw = false;
+    editor->columns = DEFAULT_COLUMNS;
+    editor->dirty = CLEAN;
+
+    return editor;
+}
+
+/**
+ * Free the editor, restoring the terminal if needed, and set the pointer to NULL.
+ *
+ * @param env the posix environment.
+ * @param peditor the editor to destroy.
+ */
+void line_editor_destroy(const struct dc_posix_env *env, struct line_editor **peditor) {
+    struct line_editor *editor;
+    struct dc_error err;
+
+    editor = *peditor;
+    dc_error_init(&err, NULL);
+    leave_raw_mode(env, &err, editor);
+    dc_error_reset(&err);
+
+    if (editor->line != NULL) {
+        dc_free(env, editor->line, editor->capacity);
+    }
+
+    if (editor->output != NULL) {
+        dc_free(env, editor->output, editor->output_capacity);
+    }
+
+    if (editor->saved_line != NULL) {
+        dc_free(env, editor->saved_line, strlen(editor->saved_line) + 1);
+    }
+
+    dc_free(env, editor, sizeof(struct line_editor));
+    *peditor = NULL;
+}
+
+/**
+ * Set the function to call when tab is pressed.
+ *
+ * @param editor the editor.
+ * @param completer the function to find completions, NULL to turn completion off.
+ * @param data passed to the completer.
+ */
+void line_editor_set_completer(struct line_editor *editor, line_editor_completer completer, void *data) {
+    editor->completer = completer;
+    editor->completion_data = data;
+}
+
+/**
+ * Read a line, letting the user edit it. The prompt must already be displayed,
+ * it is only used to redraw the line. If in_fd is a terminal it is put in raw mode
+ * (with bracketed paste on) for the duration of the call.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param editor the editor.
+ * @param prompt the prompt that was displayed.
+ * @param line_size set to the length of the line.
+ * @return the line (without the newline) or NULL at end of file.
+ */
+char *line_editor_read(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor,
+                       const char *prompt, size_t *line_size) {
+    enum key_result result;
+    char *line;
+
+    editor->prompt = prompt;
+    editor->prompt_columns = count_columns(prompt, strlen(prompt));
+    editor->columns = terminal_columns(editor->out_fd);
+    editor->length = 0;
+    editor->cursor = 0;
+    editor->shown_length = 0;
+    editor->shown_cursor = 0;
+    editor->dirty = CLEAN;
+    editor->history_age = 0;
+    editor->tab_pending = false;
+    *line_size = 0;
+
+    enter_raw_mode(env, err, editor);
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    result = KEY_CONTINUE;
+
+    while (result == KEY_CONTINUE || result == KEY_INCOMPLETE) {
+        // leftovers from the last read (eg. the rest of a paste) are handled before reading again
+        if (editor->input_start == editor->input_length || result == KEY_INCOMPLETE) {
+            ssize_t nread;
+
+            if (editor->input_start > 0) {
+                dc_memmove(env, editor->input, &editor->input[editor->input_start],
+                           editor->input_length - editor->input_start);
+                editor->input_length -= editor->input_start;
+                editor->input_start = 0;
+            }
+
+            nread = dc_read(env, err, editor->in_fd, &editor->input[editor->input_length],
+                            sizeof(editor->input) - editor->input_length);
+
+            if (dc_error_is_errno(err, EINTR)) {
+                dc_error_reset(err);
+                continue;
+            }
+
+            if (nread == -1) {
+                break;
+            }
+
+            if (nread == 0) {
+                // end of file - a partial line is still a line
+                editor->input_start = 0;
+                editor->input_length = 0;
+                result = editor->length == 0 ? KEY_EOF : KEY_ACCEPT;
+                break;
+            }
+
+            editor->input_length += (size_t) nread;
+        }
+
+        result = process_input(env, err, editor);
+
+        if (dc_error_has_error(err)) {
+            break;
+        }
+
+        if (result == KEY_ACCEPT || result == KEY_CANCEL) {
+            editor->cursor = editor->length;
+        }
+
+        // one redraw for everything that arrived in the read
+        refresh(env, err, editor);
+        flush_output(env, err, editor);
+    }
+
+    if (result == KEY_ACCEPT || result == KEY_CANCEL) {
+        emit_move(env, err, editor, editor->shown_cursor, editor->length);
+        emit_string(env, err, editor, result == KEY_CANCEL ? "^C\r\n" : "\r\n");
+    }
+
+    flush_output(env, err, editor);
+    leave_raw_mode(env, err, editor);
+
+    if (result == KEY_EOF || dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    if (result == KEY_CANCEL) {
+        editor->length = 0;
+    }
+
+    line = dc_malloc(env, err, editor->length + 1);
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    if (editor->length > 0) {
+        dc_memcpy(env, line, editor->line, editor->length);
+    }
+    line[editor->length] = '\0';
+    *line_size = editor->length;
+
+    if (editor->history != NULL) {
+        history_add(env, err, editor->history, line);
+    }
+
+    return line;
+}
+
+/**
+ * Free the array returned by a completer.
+ *
+ * @param env the posix environment.
+ * @param completions the completions.
+ * @param count the number of completions.
+ */
+void line_editor_free_completions(const struct dc_posix_env *env, char **completions, size_t count) {
+    if (completions == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        dc_free(env, completions[i], strlen(completions[i]) + 1);
+    }
+
+    dc_free(env, completions, (count + 1) * sizeof(char *));
+}
+
+/**
+ * Complete a command name (from the path) or a file name (from the file system).
+ * data must be the NULL terminated array of directories to search for commands.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param line the line being edited.
+ * @param word_start the index of the first character of the word.
+ * @param cursor the index just past the last character of the word.
+ * @param count set to the number of completions.
+ * @param data a char *** pointing at the directories in the PATH.
+ * @return a sorted, NULL terminated, array of completions.
+ */
+char **complete_command_or_file(const struct dc_posix_env *env, struct dc_error *err, const char *line,
+                                size_t word_start, size_t cursor, size_t *count, void *data) {
+    char ***path;
+    char **completions;
+    char *word;
+    char *slash;
+    size_t capacity;
+    size_t unique;
+    bool first_word;
+
+    path = (char ***) data;
+    completions = NULL;
+    capacity = 0;
+    *count = 0;
+
+    word = dc_malloc(env, err, cursor - word_start + 1);
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+    dc_memcpy(env, word, &line[word_start], cursor - word_start);
+    word[cursor - word_start] = '\0';
+
+    first_word = true;
+    for (size_t i = 0; i < word_start; i++) {
+        if (line[i] != ' ' && line[i] != '\t') {
+            first_word = false;
+            break;
+        }
+    }
+
+    slash = dc_strrchr(env, word, '/');
+
+    if (first_word && slash == NULL) {
+        if (path != NULL && *path != NULL) {
+            for (size_t i = 0; (*path)[i] != NULL; i++) {
+                complete_from_directory(env, err, (*path)[i], "", 0, word, true, &completions, count, &capacity);
+            }
+        }
+    } else if (slash == NULL) {
+        complete_from_directory(env, err, ".", "", 0, word, false, &completions, count, &capacity);
+    } else {
+        char *dir;
+        size_t dir_length;
+
+        dir_length = (size_t) (slash - word) + 1;
+
+        if (word[0] == '~' && (word[1] == '/' || word[1] == '\0') && dc_getenv(env, "HOME") != NULL) {
+            const char *home;
+
+            home = dc_getenv(env, "HOME");
+            dir = dc_malloc(env, err, strlen(home) + dir_length);
+            if (dc_error_has_no_error(err)) {
+                sprintf(dir, "%s%.*s", home, (int) (dir_length - 1), &word[1]);
+            }
+        } else {
+            dir = dc_malloc(env, err, dir_length + 1);
+            if (dc_error_has_no_error(err)) {
+                dc_memcpy(env, dir, word, dir_length);
+                dir[dir_length] = '\0';
+            }
+        }
+
+        if (dc_error_has_no_error(err)) {
+            complete_from_directory(env, err, dir, word, dir_length, slash + 1, false, &completions, count,
+                                    &capacity);
+            dc_free(env, dir, strlen(dir) + 1);
+        }
+    }
+
+    dc_free(env, word, cursor - word_start);
+
+    if (completions == NULL) {
+        completions = dc_calloc(env, err, 1, sizeof(char *));
+        *count = 0;
+        return completions;
+    }
+
+    qsort(completions, *count, sizeof(char *), compare_strings);
+
+    // the same command can be in more than one directory in the path
+    unique = 0;
+    for (size_t i = 0; i < *count; i++) {
+        if (unique > 0 && dc_strcmp(env, completions[unique - 1], completions[i]) == 0) {
+            dc_free(env, completions[i], strlen(completions[i]) + 1);
+        } else {
+            completions[unique] = completions[i];
+            unique++;
+        }
+    }
+
+    *count = unique;
+    completions[unique] = NULL;
+
+    return completions;
+}
+
+static void enter_raw_mode(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor) {
+    struct termios raw;
+
+    if (editor->raw) {
+        return;
+    }
+
+    if (!dc_isatty(env, err, editor->in_fd)) {
+        // the line is read as it is, not being a terminal is not an error
+        if (dc_error_is_errno(err, ENOTTY)) {
+            dc_error_reset(err);
+        }
+
+        return;
+    }
+
+    if (get_terminal(env, err, editor->in_fd, &editor->original) == -1) {
+        return;
+    }
+
+    raw = editor->original;
+    raw.c_iflag &= ~(tcflag_t) (BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_cflag |= (tcflag_t) CS8;
+    raw.c_lflag &= ~(tcflag_t) (ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+
+    if (set_terminal(env, err, editor->in_fd, &raw) == -1) {
+        return;
+    }
+
+    editor->raw = true;
+    emit_string(env, err, editor, "\x1b[?2004h");
+    flush_output(env, err, editor);
+}
+
+static void leave_raw_mode(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor) {
+    if (!editor->raw) {
+        return;
+    }
+
+    emit_string(env, err, editor, "\x1b[?2004l");
+    flush_output(env, err, editor);
+
+    set_terminal(env, err, editor->in_fd, &editor->original);
+    editor->raw = false;
+}
+
+/*
+ * dc_posix has no termios functions, these do what its wrappers do: trace the call and raise the errno.
+ */
+static int get_terminal(const struct dc_posix_env *env, struct dc_error *err, int fd, struct termios *attributes) {
+    int ret_val;
+
+    DC_TRACE(env);
+    ret_val = tcgetattr(fd, attributes);
+
+    if (ret_val == -1) {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+
+    return ret_val;
+}
+
+// TCSAFLUSH: input typed before the change is dropped, it was meant for the other mode
+static int set_terminal(const struct dc_posix_env *env, struct dc_error *err, int fd,
+                        const struct termios *attributes) {
+    int ret_val;
+
+    DC_TRACE(env);
+    ret_val = tcsetattr(fd, TCSAFLUSH, attributes);
+
+    if (ret_val == -1) {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+
+    return ret_val;
+}
+
+static size_t terminal_columns(int fd) {
+    struct winsize size;
+
+    if (ioctl(fd, TIOCGWINSZ, &size) == -1 || size.ws_col == 0) {
+        return DEFAULT_COLUMNS;
+    }
+
+    return size.ws_col;
+}
+
+static size_t count_columns(const char *str, size_t length) {
+    size_t columns;
+
+    // UTF-8 continuation bytes don't take up a column
+    columns = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (((unsigned char) str[i] & 0xC0) != 0x80) {
+            columns++;
+        }
+    }
+
+    return columns;
+}
+
+static void reserve_line(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor,
+                         size_t needed) {
+    size_t capacity;
+    char *line;
+
+    // + 1 so the line can always be NUL terminated for the completer
+    if (needed + 1 <= editor->capacity) {
+        return;
+    }
+
+    capacity = editor->capacity == 0 ? 128 : editor->capacity;
+    while (capacity < needed + 1) {
+        capacity *= 2;
+    }
+
+    line = dc_realloc(env, err, editor->line, capacity);
+    if (dc_error_has_error(err)) {
+        return;
+    }
+
+    editor->line = line;
+    editor->capacity = capacity;
+}
+
+static void emit(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor, const char *bytes,
+                 size_t length) {
+    if (editor->output_length + length > editor->output_capacity) {
+        size_t capacity;
+        char *output;
+
+        capacity = editor->output_capacity == 0 ? 256 : editor->output_capacity;
+        while (capacity < editor->output_length + length) {
+            capacity *= 2;
+        }
+
+        output = dc_realloc(env, err, editor->output, capacity);
+        if (dc_error_has_error(err)) {
+            return;
+        }
+
+        editor->output = output;
+        editor->output_capacity = capacity;
+    }
+
+    dc_memcpy(env, &editor->output[editor->output_length], bytes, length);
+    editor->output_length += length;
+}
+
+static void emit_string(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor,
+                        const char *str) {
+    emit(env, err, editor, str, strlen(str));
+}
+
+static void emit_move(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor, size_t from,
+                      size_t to) {
+    size_t from_column;
+    size_t to_column;
+    size_t from_row;
+    size_t to_row;
+    char sequence[32];
+
+    if (from == to) {
+        return;
+    }
+
+    // positions are absolute columns from the start of the prompt, the line may wrap
+    from_column = editor->prompt_columns + count_columns(editor->line, from);
+    to_column = editor->prompt_columns + count_columns(editor->line, to);
+    from_row = from_column / editor->columns;
+    to_row = to_column / editor->columns;
+    from_column %= editor->columns;
+    to_column %= editor->columns;
+
+    if (to_row < from_row) {
+        sprintf(sequence, "\x1b[%zuA", from_row - to_row);
+        emit_string(env, err, editor, sequence);
+    } else if (to_row > from_row) {
+        sprintf(sequence, "\x1b[%zuB", to_row - from_row);
+        emit_string(env, err, editor, sequence);
+    }
+
+    if (to_column > from_column) {
+        sprintf(sequence, "\x1b[%zuC", to_column - from_column);
+        emit_string(env, err, editor, sequence);
+    } else if (to_column < from_column) {
+        sprintf(sequence, "\x1b[%zuD", from_column - to_column);
+        emit_string(env, err, editor, sequence);
+    }
+}
+
+static void flush_output(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor) {
+    size_t written;
+
+    written = 0;
+    while (written < editor->output_length) {
+        ssize_t nwrote;
+
+        nwrote = dc_write(env, err, editor->out_fd, &editor->output[written], editor->output_length - written);
+
+        if (dc_error_is_errno(err, EINTR)) {
+            dc_error_reset(err);
+            continue;
+        }
+
+        if (nwrote == -1) {
+            break;
+        }
+
+        written += (size_t) nwrote;
+    }
+
+    editor->output_length = 0;
+}
+
+static void refresh(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor) {
+    // only the part of the line after the first change is re-emitted
+    if (editor->dirty != CLEAN) {
+        size_t from;
+
+        from = editor->dirty;
+        if (from > editor->length) {
+            from = editor->length;
+        }
+        if (from > editor->shown_length) {
+            from = editor->shown_length;
+        }
+
+        emit_move(env, err, editor, editor->shown_cursor, from);
+        emit(env, err, editor, &editor->line[from], editor->length - from);
+
+        if (editor->shown_length > editor->length) {
+            emit_string(env, err, editor, "\x1b[J");
+        }
+
+        // the terminal leaves the cursor on the last column rather than wrapping, force the wrap
+        if (editor->length > from &&
+            (editor->prompt_columns + count_columns(editor->line, editor->length)) % editor->columns == 0) {
+            emit_string(env, err, editor, "\r\n");
+        }
+
+        editor->shown_cursor = editor->length;
+        editor->shown_length = editor->length;
+        editor->dirty = CLEAN;
+    }
+
+    emit_move(env, err, editor, editor->shown_cursor, editor->cursor);
+    editor->shown_cursor = editor->cursor;
+}
+
+static void redraw_all(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor) {
+    emit_string(env, err, editor, editor->prompt);
+    editor->shown_length = 0;
+    editor->shown_cursor = 0;
+    editor->dirty = 0;
+    refresh(env, err, editor);
+}
+
+static void mark_dirty(struct line_editor *editor, size_t index) {
+    if (editor->dirty == CLEAN || index < editor->dirty) {
+        editor->dirty = index;
+    }
+}
+
+static void insert_bytes(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor,
+                         const char *bytes, size_t length) {
+    if (length == 0) {
+        return;
+    }
+
+    reserve_line(env, err, editor, editor->length + length);
+    if (dc_error_has_error(err)) {
+        return;
+    }
+
+    if (editor->cursor < editor->length) {
+        dc_memmove(env, &editor->line[editor->cursor + length], &editor->line[editor->cursor],
+                   editor->length - editor->cursor);
+    }
+
+    dc_memcpy(env, &editor->line[editor->cursor], bytes, length);
+    mark_dirty(editor, editor->cursor);
+    editor->length += length;
+    editor->cursor += length;
+}
+
+static void delete_bytes(const struct dc_posix_env *env, struct line_editor *editor, size_t start, size_t length) {
+    if (length == 0) {
+        return;
+    }
+
+    dc_memmove(env, &editor->line[start], &editor->line[start + length], editor->length - start - length);
+    editor->length -= length;
+    mark_dirty(editor, start);
+
+    if (editor->cursor > start + length) {
+        editor->cursor -= length;
+    } else if (editor->cursor > start) {
+        editor->cursor = start;
+    }
+}
+
+static void replace_line(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor,
+                         const char *str) {
+    size_t length;
+    size_t same;
+
+    length = strlen(str);
+    reserve_line(env, err, editor, length);
+    if (dc_error_has_error(err)) {
+        return;
+    }
+
+    // lines recalled from the history often share a prefix with what is on the screen
+    same = 0;
+    while (same < length && same < editor->length && editor->line[same] == str[same]) {
+        same++;
+    }
+
+    dc_memcpy(env, editor->line, str, length);
+    editor->length = length;
+    editor->cursor = length;
+    mark_dirty(editor, same);
+}
+
+static void history_move(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor,
+                         bool older) {
+    const char *line;
+
+    if (editor->history == NULL) {
+        return;
+    }
+
+    history_load(env, err, editor->history);
+
+    if (older) {
+        line = history_get(editor->history, editor->history_age);
+
+        if (line == NULL) {
+            return;
+        }
+
+        if (editor->history_age == 0) {
+            if (editor->saved_line != NULL) {
+                dc_free(env, editor->saved_line, strlen(editor->saved_line) + 1);
+            }
+
+            editor->saved_line = dc_malloc(env, err, editor->length + 1);
+            if (dc_error_has_error(err)) {
+                return;
+            }
+
+            if (editor->length > 0) {
+                dc_memcpy(env, editor->saved_line, editor->line, editor->length);
+            }
+            editor->saved_line[editor->length] = '\0';
+        }
+
+        editor->history_age++;
+        replace_line(env, err, editor, line);
+    } else {
+        if (editor->history_age == 0) {
+            return;
+        }
+
+        editor->history_age--;
+
+        if (editor->history_age == 0) {
+            replace_line(env, err, editor, editor->saved_line == NULL ? "" : editor->saved_line);
+        } else {
+            replace_line(env, err, editor, history_get(editor->history, editor->history_age - 1));
+        }
+    }
+}
+
+static void complete(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor) {
+    char **completions;
+    size_t count;
+    size_t start;
+    size_t word_length;
+    size_t common;
+
+    if (editor->completer == NULL) {
+        return;
+    }
+
+    start = editor->cursor;
+    while (start > 0 && editor->line[start - 1] != ' ' && editor->line[start - 1] != '\t') {
+        start--;
+    }
+
+    reserve_line(env, err, editor, editor->length);
+    if (dc_error_has_error(err)) {
+        return;
+    }
+
+    editor->line[editor->length] = '\0';
+    completions = editor->completer(env, err, editor->line, start, editor->cursor, &count,
+                                    editor->completion_data);
+
+    if (dc_error_has_error(err) || completions == NULL) {
+        return;
+    }
+
+    word_length = editor->cursor - start;
+
+    if (count == 0) {
+        emit_string(env, err, editor, "\a");
+    } else if (count == 1) {
+        size_t length;
+
+        length = strlen(completions[0]);
+        if (length > word_length) {
+            insert_bytes(env, err, editor, &completions[0][word_length], length - word_length);
+        }
+
+        if (length == 0 || completions[0][length - 1] != '/') {
+            insert_bytes(env, err, editor, " ", 1);
+        }
+    } else {
+        // extend the word as far as all of the completions agree
+        common = strlen(completions[0]);
+        for (size_t i = 1; i < count; i++) {
+            size_t same;
+
+            same = 0;
+            while (same < common && completions[i][same] == completions[0][same]) {
+                same++;
+            }
+
+            common = same;
+        }
+
+        if (common > word_length) {
+            insert_bytes(env, err, editor, &completions[0][word_length], common - word_length);
+        } else if (editor->tab_pending) {
+            list_completions(env, err, editor, completions, count);
+        } else {
+            editor->tab_pending = true;
+            emit_string(env, err, editor, "\a");
+            line_editor_free_completions(env, completions, count);
+            return;
+        }
+    }
+
+    editor->tab_pending = false;
+    line_editor_free_completions(env, completions, count);
+}
+
+static void list_completions(const struct dc_posix_env *env, struct dc_error *err, struct line_editor *editor,
+                             char **completions, size_t count) {
+    size_t column;
+
+    refresh(env, err, editor);
+    emit_move(env, err, editor, editor->shown_cursor, editor->length);
+    emit_string(env, err, editor, "\r\n");
+
+    column = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t width;
+
+        width = count_columns(completions[i], strlen(completions[i]));
+
+        if (column > 0 && column + 2 + width > editor->columns) {
+            emit_string(env, err, editor, "\r\n");
+            column = 0;
+        } else if (column > 0) {
+            emit_string(env, err, editor, "  ");
+            column += 2;
+        }
+
+        emit_string(env, err, editor, completions[i]);
+        column += width;
+    }
+
+    emit_string(env, err, editor, "\r\n");
+    redraw_all(env, err, editor);
+}
+
+static enum key_result process_input(const struct dc_posix_env *env, struct dc_error *err,
+                                     struct line_editor *editor) {
+    enum key_result result;
+
+    result = KEY_CONTINUE;
+
+    while (result == KEY_CONTINUE && editor->input_start < editor->input_length && dc_error_has_no_error(err)) {
+        char key;
+
+        if (editor->pasting) {
+            result = process_paste(env, err, editor);
+            continue;
+        }
+
+        key = editor->input[editor->input_start];
+
+        if ((unsigned char) key >= ' ' && key != KEY_BACKSPACE) {
+            size_t end;
+
+            // insert a whole run of ordinary characters at once, terminals without bracketed paste send pastes this way
+            end = editor->input_start + 1;
+            while (end < editor->input_length && (unsigned char) editor->input[end] >= ' ' &&
+                   editor->input[end] != KEY_BACKSPACE) {
+                end++;
+            }
+
+            insert_bytes(env, err, editor, &editor->input[editor->input_start], end - editor->input_start);
+            editor->input_start = end;
+            editor->tab_pending = false;
+        } else if (key == KEY_ESCAPE) {
+            result = process_escape(env, err, editor);
+        } else {
+            editor->input_start++;
+            result = process_control(env, err, editor, key);
+        }
+    }
+
+    return result;
+}
+
+static enum key_result process_paste(const struct dc_posix_env *env, struct dc_error *err,
+                                     struct line_editor *editor) {
+    size_t end;
+    size_t marker_length;
+
+    marker_length = strlen(PASTE_END);
+    end = editor->input_start;
+
+    while (end < editor->input_length) {
+        char byte;
+
+        byte = editor->input[end];
+
+        if (byte == KEY_ESCAPE) {
+            break;
+        }
+
+        if (byte == '\r' || byte == '\n') {
+            // a pasted newline runs the line, the rest of the paste is kept for the next read
+            insert_bytes(env, err, editor, &editor->input[editor->input_start], end - editor->input_start);
+            editor->input_start = end + 1;
+
+            if (byte == '\r' && editor->input_start < editor->input_length &&
+                editor->input[editor->input_start] == '\n') {
+                editor->input_start++;
+            }
+
+            return KEY_ACCEPT;
+        }
+
+        if ((unsigned char) byte < ' ' || byte == KEY_BACKSPACE) {
+            // tabs become spaces and other control characters are dropped so the line stays printable
+            insert_bytes(env, err, editor, &editor->input[editor->input_start], end - editor->input_start);
+
+            if (byte == '\t') {
+                insert_bytes(env, err, editor, " ", 1);
+            }
+
+            editor->input_start = end + 1;
+        }
+
+        end++;
+    }
+
+    insert_bytes(env, err, editor, &editor->input[editor->input_start], end - editor->input_start);
+    editor->input_start = end;
+
+    if (end == editor->input_length) {
+        return KEY_CONTINUE;
+    }
+
+    // an escape - either the end of the paste or something to drop
+    if (editor->input_length - end < marker_length) {
+        if (memcmp(&editor->input[end], PASTE_END, editor->input_length - end) == 0 &&
+            editor->input_length - end < sizeof(editor->input)) {
+            return KEY_INCOMPLETE;
+        }
+    } else if (memcmp(&editor->input[end], PASTE_END, marker_length) == 0) {
+        editor->input_start = end + marker_length;
+        editor->pasting = false;
+        return KEY_CONTINUE;
+    }
+
+    editor->input_start = end + 1;
+
+    return KEY_CONTINUE;
+}
+
+static enum key_result process_escape(const struct dc_posix_env *env, struct dc_error *err,
+                                      struct line_editor *editor) {
+    size_t available;
+    size_t end;
+    char kind;
+    char final;
+    long parameter;
+
+    available = editor->input_length - editor->input_start;
+    editor->tab_pending = false;
+
+    if (available < 2) {
+        return KEY_INCOMPLETE;
+    }
+
+    kind = editor->input[editor->input_start + 1];
+    parameter = 0;
+
+    if (kind == '[') {
+        // CSI: ESC [ parameters final
+        end = editor->input_start + 2;
+        while (end < editor->input_length && editor->input[end] >= '0' && editor->input[end] <= '?') {
+            if (editor->input[end] >= '0' && editor->input[end] <= '9' && parameter < 10000) {
+                parameter = parameter * 10 + (editor->input[end] - '0');
+            }
+
+            end++;
+        }
+
+        if (end == editor->input_length) {
+            if (available == sizeof(editor->input)) {
+                // garbage that fills the buffer, drop the escape and carry on
+                editor->input_start++;
+                return KEY_CONTINUE;
+            }
+
+            return KEY_INCOMPLETE;
+        }
+    } else if (kind == 'O') {
+        // SS3: ESC O final
+        if (available < 3) {
+            return KEY_INCOMPLETE;
+        }
+
+        end = editor->input_start + 2;
+    } else {
+        // alt + key
+        end = editor->input_start + 1;
+    }
+
+    final = editor->input[end];
+    editor->input_start = end + 1;
+
+    if (kind != '[' && kind != 'O') {
+        if (final == 'b') {
+            while (editor->cursor > 0 && editor->line[editor->cursor - 1] == ' ') {
+                editor->cursor--;
+            }
+            while (editor->cursor > 0 && editor->line[editor->cursor - 1] != ' ') {
+                editor->cursor--;
+            }
+        } else if (final == 'f') {
+            while (editor->cursor < editor->length && editor->line[editor->cursor] == ' ') {
+                editor->cursor++;
+            }
+            while (editor->cursor < editor->length && editor->line[editor->cursor] != ' ') {
+                editor->cursor++;
+            }
+        }
+
+        return KEY_CONTINUE;
+    }
+
+    switch (final) {
+        case 'A':
+            history_move(env, err, editor, true);
+            break;
+        case 'B':
+            history_move(env, err, editor, false);
+            break;
+        case 'C':
+            editor->cursor = next_character(editor, editor->cursor);
+            break;
+        case 'D':
+            editor->cursor = previous_character(editor, editor->cursor);
+            break;
+        case 'H':
+            editor->cursor = 0;
+            break;
+        case 'F':
+            editor->cursor = editor->length;
+            break;
+        case '~':
+            if (parameter == 1 || parameter == 7) {
+                editor->cursor = 0;
+            } else if (parameter == 4 || parameter == 8) {
+                editor->cursor = editor->length;
+            } else if (parameter == 3) {
+                delete_bytes(env, editor, editor->cursor, next_character(editor, editor->cursor) - editor->cursor);
+            } else if (parameter == 200) {
+                editor->pasting = true;
+            }
+            break;
+        default:
+            break;
+    }
+
+    return KEY_CONTINUE;
+}
+
+static enum key_result process_control(const struct dc_posix_env *env, struct dc_error *err,
+                                       struct line_editor *editor, char key) {
+    size_t start;
+
+    if (key != '\t') {
+        editor->tab_pending = false;
+    }
+
+    switch (key) {
+        case '\r':
+            // a pipe or a terminal with ICRNL off can send \r\n
+            if (editor->input_start < editor->input_length && editor->input[editor->input_start] == '\n') {
+                editor->input_start++;
+            }
+            return KEY_ACCEPT;
+        case '\n':
+            return KEY_ACCEPT;
+        case '\t':
+            complete(env, err, editor);
+            break;
+        case KEY_CTRL('A'):
+            editor->cursor = 0;
+            break;
+        case KEY_CTRL('E'):
+            editor->cursor = editor->length;
+            break;
+        case KEY_CTRL('B'):
+            editor->cursor = previous_character(editor, editor->cursor);
+            break;
+        case KEY_CTRL('F'):
+            editor->cursor = next_character(editor, editor->cursor);
+            break;
+        case KEY_CTRL('P'):
+            history_move(env, err, editor, true);
+            break;
+        case KEY_CTRL('N'):
+            history_move(env, err, editor, false);
+            break;
+        case KEY_CTRL('K'):
+            delete_bytes(env, editor, editor->cursor, editor->length - editor->cursor);
+            break;
+        case KEY_CTRL('U'):
+            delete_bytes(env, editor, 0, editor->cursor);
+            break;
+        case KEY_CTRL('W'):
+            start = editor->cursor;
+            while (start > 0 && editor->line[start - 1] == ' ') {
+                start--;
+            }
+            while (start > 0 && editor->line[start - 1] != ' ') {
+                start--;
+            }
+            delete_bytes(env, editor, start, editor->cursor - start);
+            break;
+        case KEY_CTRL('L'):
+            refresh(env, err, editor);
+            emit_string(env, err, editor, "\x1b[H\x1b[2J");
+            redraw_all(env, err, editor);
+            break;
+        case KEY_CTRL('C'):
+            return KEY_CANCEL;
+        case KEY_CTRL('D'):
+            if (editor->length == 0) {
+                return KEY_EOF;
+            }
+            delete_bytes(env, editor, editor->cursor, next_character(editor, editor->cursor) - editor->cursor);
+            break;
+        case KEY_CTRL('H'):
+        case KEY_BACKSPACE:
+            start = previous_character(editor, editor->cursor);
+            delete_bytes(env, editor, start, editor->cursor - start);
+            break;
+        default:
+            break;
+    }
+
+    return KEY_CONTINUE;
+}
+
+static size_t previous_character(const struct line_editor *editor, size_t index) {
+    if (index == 0) {
+        return 0;
+    }
+
+    index--;
+    while (index > 0 && ((unsigned char) editor->line[index] & 0xC0) == 0x80) {
+        index--;
+    }
+
+    return index;
+}
+
+static size_t next_character(const struct line_editor *editor, size_t index) {
+    if (index >= editor->length) {
+        return editor->length;
+    }
+
+    index++;
+    while (index < editor->length && ((unsigned char) editor->line[index] & 0xC0) == 0x80) {
+        index++;
+    }
+
+    return index;
+}
+
+static void complete_from_directory(const struct dc_posix_env *env, struct dc_error *err, const char *dir,
+                                    const char *shown_dir, size_t shown_dir_length, const char *prefix,
+                                    bool commands, char ***completions, size_t *count, size_t *capacity) {
+    DIR *stream;
+    struct dirent *entry;
+    size_t prefix_length;
+    size_t dir_length;
+
+    stream = opendir(dir);
+    if (stream == NULL) {
+        // unreadable directories in the path are not an error
+        return;
+    }
+
+    prefix_length = strlen(prefix);
+    dir_length = strlen(dir);
+
+    while ((entry = readdir(stream)) != NULL && dc_error_has_no_error(err)) {
+        struct stat status;
+        char *full_path;
+        bool is_dir;
+
+        if (dc_strncmp(env, entry->d_name, prefix, prefix_length) != 0) {
+            continue;
+        }
+
+        // dot files only when asked for, and never . or ..
+        if (entry->d_name[0] == '.' && (prefix_length == 0 || dc_strcmp(env, entry->d_name, ".") == 0 ||
+                                        dc_strcmp(env, entry->d_name, "..") == 0)) {
+            continue;
+        }
+
+        full_path = dc_malloc(env, err, dir_length + 1 + strlen(entry->d_name) + 1);
+        if (dc_error_has_error(err)) {
+            break;
+        }
+
+        sprintf(full_path, "%s/%s", dir, entry->d_name);
+        is_dir = stat(full_path, &status) == 0 && S_ISDIR(status.st_mode);
+
+        if (!commands) {
+            add_completion(env, err, completions, count, capacity, shown_dir, shown_dir_length, entry->d_name,
+                           is_dir ? "/" : "");
+        } else if (!is_dir && access(full_path, X_OK) == 0) {
+            add_completion(env, err, completions, count, capacity, shown_dir, shown_dir_length, entry->d_name, "");
+        }
+
+        dc_free(env, full_path, strlen(full_path) + 1);
+    }
+
+    closedir(stream);
+}
+
+static void add_completion(const struct dc_posix_env *env, struct dc_error *err, char ***completions, size_t *count,
+                           size_t *capacity, const char *prefix, size_t prefix_length, const char *name,
+                           const char *suffix) {
+    char *completion;
+
+    // always room for the NULL at the end
+    if (*count + 1 >= *capacity) {
+        size_t new_capacity;
+        char **new_completions;
+
+        new_capacity = *capacity == 0 ? 16 : *capacity * 2;
+        new_completions = dc_realloc(env, err, *completions, new_capacity * sizeof(char *));
+        if (dc_error_has_error(err)) {
+            return;
+        }
+
+        *completions = new_completions;
+        *capacity = new_capacity;
+    }
+
+    completion = dc_malloc(env, err, prefix_length + strlen(name) + strlen(suffix) + 1);
+    if (dc_error_has_error(err)) {
+        return;
+    }
+
+    sprintf(completion, "%.*s%s%s", (int) prefix_length, prefix, name, suffix);
+    (*completions)[*count] = completion;
+    (*count)++;
+    (*completions)[*count] = NULL;
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
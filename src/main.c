@@ -15,18 +15,28 @@
  *  along with dc_shell.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include "audit.h"
+#include "mem_stats.h"
 #include "shell.h"
+#include "startup.h"
+#include "trace.h"
 #include <dc_application/command_line.h>
 #include <dc_application/config.h>
 #include <dc_application/options.h>
 #include <dc_posix/dc_stdlib.h>
 #include <dc_posix/dc_string.h>
 #include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
 
 struct application_settings
 {
     struct dc_opt_settings  opts;
     struct dc_setting_bool *verbose;
+    struct dc_setting_path *rc;
+    struct dc_setting_path *audit_log;
+    struct dc_setting_path *trace;
+    struct dc_setting_bool *mem_stats;
 };
 
 static struct dc_application_settings *create_settings(const struct dc_posix_env *env, struct dc_error *err);
@@ -36,6 +46,8 @@ destroy_settings(const struct dc_posix_env *env, struct dc_error *err, struct dc
 
 static int run(const struct dc_posix_env *env, struct dc_error *err, struct dc_application_settings *settings);
 
+static const char *trace_path(int argc, char *argv[]);
+
 int        main(int argc, char *argv[])
 {
     dc_posix_tracer             tracer;
@@ -45,8 +57,29 @@ int        main(int argc, char *argv[])
     struct dc_application_info *info;
     int                         ret_val;
 
+    const char                 *trace;
+    int                         trace_error;
+
+    startup_profile_start();
     tracer   = NULL;
     // tracer   = dc_posix_default_tracer;
+    trace    = trace_path(argc, argv);
+
+    // the tracer has to be in the environment before anything uses it, so it is found before the options
+    if(trace != NULL)
+    {
+        trace_error = trace_open(trace);
+
+        if(trace_error == 0)
+        {
+            tracer = trace_record;
+        }
+        else
+        {
+            fprintf(stderr, "%s: %s\n", trace, strerror(trace_error));
+        }
+    }
+
     reporter = NULL;
     // reporter = dc_error_default_error_reporter;
     dc_posix_env_init(&env, tracer);
@@ -65,6 +98,7 @@ int        main(int argc, char *argv[])
                                  argv);
     dc_application_info_destroy(&env, &info);
     dc_error_reset(&err);
+    trace_close();
 
     return ret_val;
 }
@@ -72,6 +106,7 @@ int        main(int argc, char *argv[])
 static struct dc_application_settings *create_settings(const struct dc_posix_env *env, struct dc_error *err)
 {
     static bool                  default_verbose = false;
+    static bool                  default_mem_stats = false;
     struct application_settings *settings;
 
     DC_TRACE(env);
@@ -84,6 +119,10 @@ static struct dc_application_settings *create_settings(const struct dc_posix_env
 
     settings->opts.parent.config_path = dc_setting_path_create(env, err);
     settings->verbose                 = dc_setting_bool_create(env, err);
+    settings->rc                      = dc_setting_path_create(env, err);
+    settings->audit_log               = dc_setting_path_create(env, err);
+    settings->trace                   = dc_setting_path_create(env, err);
+    settings->mem_stats               = dc_setting_bool_create(env, err);
 
     struct options opts[]             = {
         {(struct dc_setting *)settings->opts.parent.config_path,
@@ -106,6 +145,47 @@ static struct dc_application_settings *create_settings(const struct dc_posix_env
          "verbose",
          dc_flag_from_config,
          &default_verbose},
+        {(struct dc_setting *)settings->rc,
+         dc_options_set_path,
+         "rc",
+         required_argument,
+         'r',
+         "RC",
+         dc_string_from_string,
+         "rc",
+         dc_string_from_config,
+         NULL},
+        {(struct dc_setting *)settings->audit_log,
+         dc_options_set_path,
+         "audit-log",
+         required_argument,
+         'a',
+         "AUDIT_LOG",
+         dc_string_from_string,
+         "audit-log",
+         dc_string_from_config,
+         NULL},
+        // read by trace_path, it is here so that it is accepted (the config file is read too late for it)
+        {(struct dc_setting *)settings->trace,
+         dc_options_set_path,
+         "trace",
+         required_argument,
+         't',
+         "TRACE",
+         dc_string_from_string,
+         NULL,
+         dc_string_from_config,
+         NULL},
+        {(struct dc_setting *)settings->mem_stats,
+         dc_options_set_bool,
+         "mem-stats",
+         no_argument,
+         'm',
+         "MEM_STATS",
+         dc_flag_from_string,
+         "mem-stats",
+         dc_flag_from_config,
+         &default_mem_stats},
     };
 
     // note the trick here - we use calloc and add 1 to ensure the last line is all 0/NULL
@@ -113,7 +193,7 @@ static struct dc_application_settings *create_settings(const struct dc_posix_env
     settings->opts.opts_size  = sizeof(struct options);
     settings->opts.opts       = dc_calloc(env, err, settings->opts.opts_count, settings->opts.opts_size);
     dc_memcpy(env, settings->opts.opts, opts, sizeof(opts));
-    settings->opts.flags      = "c:v:";
+    settings->opts.flags      = "c:v:r:a:t:m";
     settings->opts.env_prefix = "DC_SHELL_";
 
     return (struct dc_application_settings *)settings;
@@ -128,6 +208,10 @@ static int destroy_settings(const struct dc_posix_env               *env,
     DC_TRACE(env);
     app_settings = (struct application_settings *)*psettings;
     dc_setting_bool_destroy(env, &app_settings->verbose);
+    dc_setting_path_destroy(env, &app_settings->rc);
+    dc_setting_path_destroy(env, &app_settings->audit_log);
+    dc_setting_path_destroy(env, &app_settings->trace);
+    dc_setting_bool_destroy(env, &app_settings->mem_stats);
     dc_free(env, app_settings->opts.opts, app_settings->opts.opts_count);
     dc_free(env, *psettings, sizeof(struct application_settings));
 
@@ -139,14 +223,85 @@ static int destroy_settings(const struct dc_posix_env               *env,
     return 0;
 }
 
-static int run(const struct dc_posix_env                              *env,
-               struct dc_error                                        *err,
-               __attribute__((unused)) struct dc_application_settings *settings)
+static int run(const struct dc_posix_env *env, struct dc_error *err, struct dc_application_settings *settings)
 {
-    int ret_val;
+    struct application_settings *app_settings;
+    const char                  *rc;
+    const char                  *audit_log;
+    int                          ret_val;
 
     DC_TRACE(env);
+    app_settings = (struct application_settings *)settings;
+    rc           = dc_setting_path_get(env, app_settings->rc);
+    audit_log    = dc_setting_path_get(env, app_settings->audit_log);
+
+    // the options, environment and config file have been read, time the rest of the way to the first prompt
+    if(dc_setting_bool_get(env, app_settings->verbose))
+    {
+        startup_profile_enable(stderr);
+    }
+
+    startup_profile_phase("settings");
+
+    // the shell sources $ENV at startup, the rc setting (eg. rc=~/.dcshellrc in the config file) sets it
+    if(rc != NULL)
+    {
+        dc_setenv(env, err, "ENV", rc, true);
+    }
+
+    // every line run is recorded (--audit-log, DC_SHELL_AUDIT_LOG or audit-log= in the config file)
+    if(audit_log != NULL)
+    {
+        audit_open(env, err, audit_log);
+
+        // the shell runs without it rather than not at all
+        if(dc_error_has_error(err))
+        {
+            fprintf(stderr, "%s: %s\n", audit_log, err->message);
+            dc_error_reset(err);
+        }
+    }
+
+    // the allocations are counted from here, the report is written when the shell's state is destroyed
+    if(dc_setting_bool_get(env, app_settings->mem_stats))
+    {
+        mem_stats_enable();
+    }
+
     ret_val = run_shell(env, err, stdin, stdout, stderr);
+    audit_close();
 
     return ret_val;
 }
+
+/*
+ * The file to trace to: --trace=FILE, --trace FILE, -t FILE or DC_SHELL_TRACE, the command line first.
+ * Returns NULL if there is none.
+ */
+static const char *trace_path(int argc, char *argv[])
+{
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--") == 0)
+        {
+            break;
+        }
+
+        if(strncmp(argv[i], "--trace=", 8) == 0)
+        {
+            return argv[i] + 8;
+        }
+
+        if((strcmp(argv[i], "--trace") == 0 || strcmp(argv[i], "-t") == 0) && i + 1 < argc)
+        {
+            return argv[i + 1];
+        }
+
+        if(strncmp(argv[i], "-t", 2) == 0 && argv[i][2] != '\0')
+        {
+            return argv[i] + 2;
+        }
+    }
+
+    return getenv("DC_SHELL_TRACE");
+}
@@ -0,0 +1,613 @@
+#include "mem_stats.h"
+#include "posix_direct.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * The dc_posix functions are called as (dc_malloc)(...) here, the parentheses stop the macros in
+ * mem_stats.h from turning them back into these. Built with DC_SHELL_DIRECT_POSIX the posix_direct_ ones
+ * are called instead. What is kept about the blocks is allocated with the C library so it is not counted
+ * itself.
+ */
+#ifdef DC_SHELL_DIRECT_POSIX
+#define MEM_STATS_CALL(name) posix_direct_##name
+#else
+#define MEM_STATS_CALL(name) (dc_##name)
+#endif
+
+// the lists the live blocks are hashed into, a power of 2
+#define MEM_STATS_BUCKETS 4096
+
+// the lines that can be told apart, a power of 2 so the hash can wrap
+#define MEM_STATS_SITES 1024
+
+// the states that can be told apart
+#define MEM_STATS_STATES 16
+
+// the lines listed in each part of the report
+#define MEM_STATS_TOP 20
+
+/*
+ * A line that allocates or frees.
+ */
+struct mem_site
+{
+    const char *file;       // the file, NULL if the slot is free
+    size_t line;            // the line
+    size_t allocations;     // the blocks allocated on it
+    size_t bytes;           // the bytes allocated on it
+    size_t live_blocks;     // the blocks allocated on it that are not freed
+    size_t live_bytes;      // and their bytes
+    size_t wrong_frees;     // the frees on it given the wrong size
+    size_t wrong_size;      // the size the last of them was given
+    size_t actual_size;     // the size that block had
+    struct mem_site *origin;// and where it was allocated
+};
+
+/*
+ * A state of the shell.
+ */
+struct mem_state
+{
+    const char *name;       // the state
+    size_t allocations;     // the blocks allocated in it
+    size_t bytes;           // the bytes allocated in it
+    size_t live_bytes;      // the bytes allocated in it that are not freed
+};
+
+/*
+ * A live block.
+ */
+struct mem_block
+{
+    struct mem_block *next;     // the next in the bucket
+    const void *ptr;            // the memory
+    size_t size;                // its size
+    struct mem_site *site;      // where it was allocated
+    struct mem_state *state;    // what state the shell was in
+};
+
+/*
+ * The glob walk allocates on other threads, so everything is changed under the lock.
+ */
+struct mem_stats
+{
+    atomic_bool enabled;                        // is the memory being counted
+    pid_t pid;                                  // the process that started counting
+    pthread_mutex_t lock;                       // for the rest
+    struct mem_block *blocks[MEM_STATS_BUCKETS];// the live blocks
+    struct mem_site sites[MEM_STATS_SITES];     // the lines
+    struct mem_site *unknown_site;              // where lines go if there are too many
+    struct mem_state states[MEM_STATS_STATES];  // the states in the order they were first seen
+    size_t state_count;                         // how many
+    struct mem_state *state;                    // the current state, or NULL
+    size_t allocations;                         // the blocks allocated
+    size_t frees;                               // the blocks freed
+    size_t unknown_frees;                       // memory freed that was not counted
+    size_t live_blocks;                         // the blocks not freed
+    size_t live_bytes;                          // and their bytes
+    size_t peak_blocks;                         // the most blocks live at once
+    size_t peak_bytes;                          // the most bytes live at once
+};
+
+static void add_block(const void *ptr, size_t size, const char *file_name, size_t line_number);
+static struct mem_block *remove_block(const void *ptr);
+static void forget_block(struct mem_block *block);
+static struct mem_site *find_site(const char *file_name, size_t line_number);
+static size_t bucket_of(const void *ptr);
+static void print_sites(FILE *stream, struct mem_site **sites, size_t count, bool live);
+static int compare_bytes(const void *a, const void *b);
+static int compare_live_bytes(const void *a, const void *b);
+
+static struct mem_stats stats = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+/**
+ * Start counting the memory the shell allocates (--mem-stats): the bytes and blocks live, and their peak,
+ * by the line they were allocated on and by the state the shell was in. Frees are checked against the size
+ * that was allocated. Until it is started the functions below only call their dc_posix function. There is
+ * one count per shell process, so it is kept here rather than in the state.
+ */
+void mem_stats_enable(void) {
+    mem_stats_disable();
+    pthread_mutex_lock(&stats.lock);
+    stats.pid = getpid();
+    atomic_store(&stats.enabled, true);
+    pthread_mutex_unlock(&stats.lock);
+}
+
+/**
+ * Stop counting and forget what was counted.
+ */
+void mem_stats_disable(void) {
+    pthread_mutex_lock(&stats.lock);
+    atomic_store(&stats.enabled, false);
+
+    for (size_t i = 0; i < MEM_STATS_BUCKETS; i++) {
+        while (stats.blocks[i] != NULL) {
+            struct mem_block *block;
+
+            block = stats.blocks[i];
+            stats.blocks[i] = block->next;
+            free(block);
+        }
+    }
+
+    memset(stats.sites, 0, sizeof(stats.sites));
+    memset(stats.states, 0, sizeof(stats.states));
+    stats.unknown_site = NULL;
+    stats.state_count = 0;
+    stats.state = NULL;
+    stats.allocations = 0;
+    stats.frees = 0;
+    stats.unknown_frees = 0;
+    stats.live_blocks = 0;
+    stats.live_bytes = 0;
+    stats.peak_blocks = 0;
+    stats.peak_bytes = 0;
+    pthread_mutex_unlock(&stats.lock);
+}
+
+/**
+ * Is the memory being counted.
+ *
+ * @return true if mem_stats_enable was called.
+ */
+bool mem_stats_enabled(void) {
+    return atomic_load_explicit(&stats.enabled, memory_order_relaxed);
+}
+
+/**
+ * Set the state of the shell that the allocations from now on are counted under.
+ *
+ * @param name the state (eg. "EXECUTE_COMMANDS"), it is kept.
+ */
+void mem_stats_state(const char *name) {
+    size_t i;
+
+    if (!mem_stats_enabled()) {
+        return;
+    }
+
+    pthread_mutex_lock(&stats.lock);
+    i = 0;
+
+    while (i < stats.state_count && strcmp(stats.states[i].name, name) != 0) {
+        i++;
+    }
+
+    if (i == stats.state_count && i < MEM_STATS_STATES) {
+        stats.states[i].name = name;
+        stats.state_count++;
+    }
+
+    stats.state = i < MEM_STATS_STATES ? &stats.states[i] : NULL;
+    pthread_mutex_unlock(&stats.lock);
+}
+
+/**
+ * Write what has been counted: the peak, the allocations by state, the lines that allocate the most, the
+ * frees given the wrong size, and the blocks still live (the leaks, once the shell has cleaned up). Only the
+ * process that started counting writes it.
+ *
+ * @param stream where to write it.
+ */
+void mem_stats_report(FILE *stream) {
+    struct mem_site *sites[MEM_STATS_SITES];
+    size_t count;
+    size_t wrong;
+
+    if (!mem_stats_enabled() || stats.pid != getpid()) {
+        return;
+    }
+
+    pthread_mutex_lock(&stats.lock);
+    fprintf(stream, "mem-stats: %zu allocations, %zu frees, peak %zu bytes in %zu blocks\n", stats.allocations,
+            stats.frees, stats.peak_bytes, stats.peak_blocks);
+
+    if (stats.unknown_frees > 0) {
+        fprintf(stream, "mem-stats: %zu frees of memory that was not counted (allocated before counting started, "
+                        "or by a library)\n", stats.unknown_frees);
+    }
+
+    fprintf(stream, "mem-stats: by state\n");
+
+    for (size_t i = 0; i < stats.state_count; i++) {
+        fprintf(stream, "  %-20s %10zu allocations %12zu bytes %10zu live\n", stats.states[i].name,
+                stats.states[i].allocations, stats.states[i].bytes, stats.states[i].live_bytes);
+    }
+
+    count = 0;
+    wrong = 0;
+
+    for (size_t i = 0; i < MEM_STATS_SITES; i++) {
+        if (stats.sites[i].file != NULL) {
+            sites[count++] = &stats.sites[i];
+        }
+    }
+
+    qsort(sites, count, sizeof(struct mem_site *), compare_bytes);
+    fprintf(stream, "mem-stats: the lines that allocate the most\n");
+    print_sites(stream, sites, count, false);
+
+    for (size_t i = 0; i < count; i++) {
+        if (sites[i]->wrong_frees > 0) {
+            if (wrong++ == 0) {
+                fprintf(stream, "mem-stats: freed with the wrong size\n");
+            }
+
+            fprintf(stream, "  %s:%zu %zu times, the last given %zu for %zu bytes allocated at %s:%zu\n",
+                    sites[i]->file, sites[i]->line, sites[i]->wrong_frees, sites[i]->wrong_size,
+                    sites[i]->actual_size, sites[i]->origin->file, sites[i]->origin->line);
+        }
+    }
+
+    qsort(sites, count, sizeof(struct mem_site *), compare_live_bytes);
+    fprintf(stream, "mem-stats: %zu bytes in %zu blocks not freed\n", stats.live_bytes, stats.live_blocks);
+    print_sites(stream, sites, count, true);
+    pthread_mutex_unlock(&stats.lock);
+}
+
+/**
+ * dc_malloc, counted.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param size the bytes.
+ * @param file_name the file it is called from.
+ * @param line_number the line it is called from.
+ * @return the memory, or NULL.
+ */
+void *mem_stats_malloc(const struct dc_posix_env *env, struct dc_error *err, size_t size, const char *file_name,
+                       size_t line_number) {
+    void *ptr;
+
+    ptr = MEM_STATS_CALL(malloc)(env, err, size);
+
+    if (ptr != NULL && mem_stats_enabled()) {
+        add_block(ptr, size, file_name, line_number);
+    }
+
+    return ptr;
+}
+
+/**
+ * dc_calloc, counted.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param nelem the number of elements.
+ * @param elsize the size of each.
+ * @param file_name the file it is called from.
+ * @param line_number the line it is called from.
+ * @return the memory, or NULL.
+ */
+void *mem_stats_calloc(const struct dc_posix_env *env, struct dc_error *err, size_t nelem, size_t elsize,
+                       const char *file_name, size_t line_number) {
+    void *ptr;
+
+    ptr = MEM_STATS_CALL(calloc)(env, err, nelem, elsize);
+
+    // calloc fails if the product does not fit
+    if (ptr != NULL && mem_stats_enabled()) {
+        add_block(ptr, nelem * elsize, file_name, line_number);
+    }
+
+    return ptr;
+}
+
+/**
+ * dc_realloc, counted.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param ptr the memory, or NULL.
+ * @param size the new size.
+ * @param file_name the file it is called from.
+ * @param line_number the line it is called from.
+ * @return the memory, or NULL (ptr is left alone).
+ */
+void *mem_stats_realloc(const struct dc_posix_env *env, struct dc_error *err, void *ptr, size_t size,
+                        const char *file_name, size_t line_number) {
+    void *moved;
+
+    moved = MEM_STATS_CALL(realloc)(env, err, ptr, size);
+
+    // the block is counted as allocated again, on this line
+    if (moved != NULL && mem_stats_enabled()) {
+        if (ptr != NULL) {
+            struct mem_block *block;
+
+            pthread_mutex_lock(&stats.lock);
+            block = remove_block(ptr);
+
+            if (block != NULL) {
+                stats.frees++;
+                forget_block(block);
+            }
+
+            pthread_mutex_unlock(&stats.lock);
+        }
+
+        add_block(moved, size, file_name, line_number);
+    }
+
+    return moved;
+}
+
+/**
+ * dc_strdup, counted.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param s the string.
+ * @param file_name the file it is called from.
+ * @param line_number the line it is called from.
+ * @return the copy, or NULL.
+ */
+char *mem_stats_strdup(const struct dc_posix_env *env, struct dc_error *err, const char *s, const char *file_name,
+                       size_t line_number) {
+    char *copy;
+
+    copy = MEM_STATS_CALL(strdup)(env, err, s);
+
+    if (copy != NULL && mem_stats_enabled()) {
+        add_block(copy, strlen(copy) + 1, file_name, line_number);
+    }
+
+    return copy;
+}
+
+/**
+ * dc_strndup, counted.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param s the string.
+ * @param size the most characters to copy.
+ * @param file_name the file it is called from.
+ * @param line_number the line it is called from.
+ * @return the copy, or NULL.
+ */
+char *mem_stats_strndup(const struct dc_posix_env *env, struct dc_error *err, const char *s, size_t size,
+                        const char *file_name, size_t line_number) {
+    char *copy;
+
+    copy = MEM_STATS_CALL(strndup)(env, err, s, size);
+
+    if (copy != NULL && mem_stats_enabled()) {
+        add_block(copy, strlen(copy) + 1, file_name, line_number);
+    }
+
+    return copy;
+}
+
+/**
+ * dc_free, counted. A size that is not what was allocated is reported against this line.
+ *
+ * @param env the posix environment.
+ * @param ptr the memory, or NULL.
+ * @param size the size it was allocated with.
+ * @param file_name the file it is called from.
+ * @param line_number the line it is called from.
+ */
+void mem_stats_free(const struct dc_posix_env *env, void *ptr, size_t size, const char *file_name,
+                    size_t line_number) {
+    if (ptr != NULL && mem_stats_enabled()) {
+        struct mem_block *block;
+
+        pthread_mutex_lock(&stats.lock);
+        block = remove_block(ptr);
+
+        if (block == NULL) {
+            stats.unknown_frees++;
+        } else {
+            if (size != block->size) {
+                struct mem_site *site;
+
+                site = find_site(file_name, line_number);
+                site->wrong_frees++;
+                site->wrong_size = size;
+                site->actual_size = block->size;
+                site->origin = block->site;
+            }
+
+            stats.frees++;
+            forget_block(block);
+        }
+
+        pthread_mutex_unlock(&stats.lock);
+    }
+
+    MEM_STATS_CALL(free)(env, ptr, size);
+}
+
+/*
+ * Count a block that was just allocated.
+ */
+static void add_block(const void *ptr, size_t size, const char *file_name, size_t line_number) {
+    struct mem_block *block;
+    size_t bucket;
+
+    block = malloc(sizeof(struct mem_block));
+
+    if (block == NULL) {
+        return;
+    }
+
+    bucket = bucket_of(ptr);
+    block->ptr = ptr;
+    block->size = size;
+    pthread_mutex_lock(&stats.lock);
+    block->site = find_site(file_name, line_number);
+    block->state = stats.state;
+    block->next = stats.blocks[bucket];
+    stats.blocks[bucket] = block;
+    block->site->allocations++;
+    block->site->bytes += size;
+    block->site->live_blocks++;
+    block->site->live_bytes += size;
+
+    if (block->state != NULL) {
+        block->state->allocations++;
+        block->state->bytes += size;
+        block->state->live_bytes += size;
+    }
+
+    stats.allocations++;
+    stats.live_blocks++;
+    stats.live_bytes += size;
+
+    if (stats.live_bytes > stats.peak_bytes) {
+        stats.peak_bytes = stats.live_bytes;
+    }
+
+    if (stats.live_blocks > stats.peak_blocks) {
+        stats.peak_blocks = stats.live_blocks;
+    }
+
+    pthread_mutex_unlock(&stats.lock);
+}
+
+/*
+ * Take a block out of the live ones, NULL if it is not there. Called with the lock held.
+ */
+static struct mem_block *remove_block(const void *ptr) {
+    struct mem_block **link;
+
+    for (link = &stats.blocks[bucket_of(ptr)]; *link != NULL; link = &(*link)->next) {
+        if ((*link)->ptr == ptr) {
+            struct mem_block *block;
+
+            block = *link;
+            *link = block->next;
+
+            return block;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Take a removed block off the live counts and free it. Called with the lock held.
+ */
+static void forget_block(struct mem_block *block) {
+    if (block == NULL) {
+        return;
+    }
+
+    block->site->live_blocks--;
+    block->site->live_bytes -= block->size;
+
+    if (block->state != NULL) {
+        block->state->live_bytes -= block->size;
+    }
+
+    stats.live_blocks--;
+    stats.live_bytes -= block->size;
+    free(block);
+}
+
+/*
+ * The slot for a line, claimed the first time. The files are told apart by the address of their name.
+ * Called with the lock held.
+ */
+static struct mem_site *find_site(const char *file_name, size_t line_number) {
+    size_t hash;
+
+    hash = (size_t)(((uintptr_t)file_name >> 3U) * 31U + line_number) * 0x9E3779B1U;
+
+    for (size_t i = 0; i < MEM_STATS_SITES; i++) {
+        struct mem_site *site;
+
+        site = &stats.sites[(hash + i) & (MEM_STATS_SITES - 1)];
+
+        if (site->file == NULL) {
+            site->file = file_name;
+            site->line = line_number;
+
+            return site;
+        }
+
+        if (site->file == file_name && site->line == line_number) {
+            return site;
+        }
+    }
+
+    // every slot is taken, the last one takes the rest
+    if (stats.unknown_site == NULL) {
+        stats.unknown_site = &stats.sites[hash & (MEM_STATS_SITES - 1)];
+    }
+
+    return stats.unknown_site;
+}
+
+/*
+ * The bucket for a block, the low bits of an address are the same for every block.
+ */
+static size_t bucket_of(const void *ptr) {
+    return (size_t)(((uintptr_t)ptr >> 4U) & (MEM_STATS_BUCKETS - 1));
+}
+
+/*
+ * The first MEM_STATS_TOP lines that allocated something (or that have something live).
+ */
+static void print_sites(FILE *stream, struct mem_site **sites, size_t count, bool live) {
+    size_t printed;
+
+    printed = 0;
+
+    for (size_t i = 0; i < count && printed < MEM_STATS_TOP; i++) {
+        if (live ? sites[i]->live_blocks == 0 : sites[i]->allocations == 0) {
+            continue;
+        }
+
+        if (live) {
+            fprintf(stream, "  %s:%zu %zu bytes in %zu blocks\n", sites[i]->file, sites[i]->line,
+                    sites[i]->live_bytes, sites[i]->live_blocks);
+        } else {
+            fprintf(stream, "  %s:%zu %zu bytes in %zu allocations\n", sites[i]->file, sites[i]->line,
+                    sites[i]->bytes, sites[i]->allocations);
+        }
+
+        printed++;
+    }
+}
+
+/*
+ * The most bytes allocated first.
+ */
+static int compare_bytes(const void *a, const void *b) {
+    const struct mem_site *first;
+    const struct mem_site *second;
+
+    first = *(struct mem_site *const *)a;
+    second = *(struct mem_site *const *)b;
+
+    if (first->bytes != second->bytes) {
+        return first->bytes > second->bytes ? -1 : 1;
+    }
+
+    return first->line < second->line ? -1 : (first->line > second->line);
+}
+
+/*
+ * The most bytes live first.
+ */
+static int compare_live_bytes(const void *a, const void *b) {
+    const struct mem_site *first;
+    const struct mem_site *second;
+
+    first = *(struct mem_site *const *)a;
+    second = *(struct mem_site *const *)b;
+
+    if (first->live_bytes != second->live_bytes) {
+        return first->live_bytes > second->live_bytes ? -1 : 1;
+    }
+
+    return first->line < second->line ? -1 : (first->line > second->line);
+}
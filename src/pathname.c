@@ -0,0 +1,1373 @@
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <dc_posix/dc_stdlib.h>
+#include <dc_posix/dc_string.h>
+#include <dc_posix/dc_unistd.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#include "mem_stats.h"
+#include "pathname.h"
+#include "thread_pool.h"
+
+#define INITIAL_BUCKETS 64
+#define INITIAL_NAMES_SIZE 4096
+#define INITIAL_ENTRIES 64
+#define READ_BATCH_SIZE (256 * 1024)
+
+/*! \struct matches
+    \brief The paths found so far by pathname_expand.
+*/
+struct matches
+{
+    char **paths;       /**< the paths */
+    size_t count;       /**< the number of paths */
+    size_t capacity;    /**< the number of paths there is room for */
+};
+
+/*! \struct walk
+    \brief A ** being expanded by a thread pool, shared by every job.
+*/
+struct walk
+{
+    char **components;              /**< the parts of the pattern */
+    size_t index;                   /**< the index of the ** part */
+    size_t count;                   /**< the number of parts */
+    bool dirs_only;                 /**< does the pattern end in a / */
+    struct pathname_cache *cache;   /**< the listings, shared with the rest of the line */
+    struct matches *matches;        /**< the matches found by each worker */
+};
+
+/*! \struct walk_directory
+    \brief An open directory whose subdirectories are still waiting to be opened relative to it.
+*/
+struct walk_directory
+{
+    int fd;                     /**< the directory */
+    atomic_size_t references;   /**< the jobs that still need the fd, it is closed when this gets to 0 */
+};
+
+/*! \struct walk_job
+    \brief One directory for the pool to read.
+*/
+struct walk_job
+{
+    struct walk *walk;              /**< the expansion the directory is part of */
+    struct walk_directory *parent;  /**< the directory it is in, NULL for the directory the ** starts at */
+    char *path;                     /**< the directory as it appears in the matches */
+    size_t name_offset;             /**< the index in path of the name in the parent */
+};
+
+#if defined(__linux__)
+/*! \struct linux_dirent64
+    \brief The records getdents64 fills the buffer with.
+*/
+struct linux_dirent64
+{
+    uint64_t d_ino;             /**< the inode */
+    int64_t d_off;              /**< the offset of the next record */
+    unsigned short d_reclen;    /**< the size of this record */
+    unsigned char d_type;       /**< the type of file */
+    char d_name[];              /**< the NUL terminated name */
+};
+#endif
+
+static size_t hash_path(const char *path);
+static struct directory_listing *find_listing(const struct dc_posix_env *env, struct pathname_cache *cache,
+                                              const char *path);
+static struct directory_listing *cache_listing(const struct dc_posix_env *env, struct dc_error *err,
+                                               struct pathname_cache *cache, struct directory_listing *listing);
+static struct directory_listing *read_listing(const struct dc_posix_env *env, struct dc_error *err, const char *path);
+static bool is_unreadable(int error);
+static struct directory_listing *list_directory(const struct dc_posix_env *env, struct dc_error *err, int fd,
+                                                const char *path);
+static void add_name(const struct dc_posix_env *env, struct dc_error *err, struct directory_listing *listing,
+                     const char *name, unsigned char type);
+static void free_listing(const struct dc_posix_env *env, struct directory_listing *listing);
+static int match_bracket(const char *pattern, unsigned char c, size_t *length);
+static bool match_class(const char *name, size_t length, unsigned char c, bool *valid);
+static void expand_components(const struct dc_posix_env *env, struct dc_error *err, struct pathname_cache *cache,
+                              const char *prefix, char **components, size_t index, size_t count, bool dirs_only,
+                              bool threaded, struct matches *matches);
+static void expand_recursive(const struct dc_posix_env *env, struct dc_error *err, struct pathname_cache *cache,
+                             const char *prefix, char **components, size_t index, size_t count, bool dirs_only,
+                             struct matches *matches);
+static void expand_parallel(const struct dc_posix_env *env, struct dc_error *err, struct pathname_cache *cache,
+                            const char *prefix, char **components, size_t index, size_t count, bool dirs_only,
+                            struct matches *matches);
+static void walk_directory(const struct dc_posix_env *env, struct dc_error *err, struct thread_pool *pool,
+                           size_t worker, void *arg);
+static void walk_rest(const struct dc_posix_env *env, struct dc_error *err, struct walk *walk, size_t worker, int fd,
+                      const char *path, const struct directory_listing *listing);
+static void submit_subdirectory(const struct dc_posix_env *env, struct dc_error *err, struct thread_pool *pool,
+                                size_t worker, struct walk *walk, struct walk_directory *parent, const char *path,
+                                const char *name);
+static void release_directory(const struct dc_posix_env *env, struct walk_directory *directory);
+static char *join(const struct dc_posix_env *env, struct dc_error *err, const char *prefix, const char *name,
+                  bool slash);
+static char *unescape(const struct dc_posix_env *env, struct dc_error *err, const char *pattern);
+static bool is_directory(int dir_fd, const char *path, unsigned char type, bool follow);
+static bool exists(const char *path, bool dirs_only);
+static void add_match(const struct dc_posix_env *env, struct dc_error *err, struct matches *matches, char *path);
+static int compare_paths(const void *a, const void *b);
+
+/**
+ * Create an empty cache, with ** using one thread per processor.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @return the cache.
+ */
+struct pathname_cache *pathname_cache_create(const struct dc_posix_env *env, struct dc_error *err) {
+    struct pathname_cache *cache;
+
+    cache = dc_malloc(env, err, sizeof(struct pathname_cache));
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    cache->buckets = dc_calloc(env, err, INITIAL_BUCKETS, sizeof(struct directory_listing *));
+    if (dc_error_has_error(err)) {
+        dc_free(env, cache, sizeof(struct pathname_cache));
+        return NULL;
+    }
+
+    cache->bucket_count = INITIAL_BUCKETS;
+    cache->count = 0;
+    cache->thread_count = 0;
+    pthread_mutex_init(&cache->lock, NULL);
+
+    return cache;
+}
+
+/**
+ * Free the cache and set the pointer to NULL.
+ *
+ * @param env the posix environment.
+ * @param pcache the cache to destroy.
+ */
+void pathname_cache_destroy(const struct dc_posix_env *env, struct pathname_cache **pcache) {
+    struct pathname_cache *cache;
+
+    cache = *pcache;
+    pathname_cache_clear(env, cache);
+    pthread_mutex_destroy(&cache->lock);
+    dc_free(env, cache->buckets, cache->bucket_count * sizeof(struct directory_listing *));
+    dc_free(env, cache, sizeof(struct pathname_cache));
+    *pcache = NULL;
+}
+
+/**
+ * Forget every listing, so the directories are read again the next time they are needed.
+ *
+ * @param env the posix environment.
+ * @param cache the cache to empty.
+ */
+void pathname_cache_clear(const struct dc_posix_env *env, struct pathname_cache *cache) {
+    if (cache->count == 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < cache->bucket_count; i++) {
+        struct directory_listing *listing;
+
+        listing = cache->buckets[i];
+
+        while (listing != NULL) {
+            struct directory_listing *next;
+
+            next = listing->next;
+            free_listing(env, listing);
+            listing = next;
+        }
+
+        cache->buckets[i] = NULL;
+    }
+
+    cache->count = 0;
+}
+
+/**
+ * Get the names in a directory, reading it if it is not already in the cache.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param cache the cache to look in and add to.
+ * @param path the directory ("" for the working directory).
+ * @return the listing (owned by the cache) or NULL if the directory does not exist or may not be read
+ *         (other failures, such as running out of file descriptors, are raised).
+ */
+const struct directory_listing *pathname_list(const struct dc_posix_env *env, struct dc_error *err,
+                                              struct pathname_cache *cache, const char *path) {
+    struct directory_listing *listing;
+
+    pthread_mutex_lock(&cache->lock);
+    listing = find_listing(env, cache, path);
+    pthread_mutex_unlock(&cache->lock);
+
+    if (listing != NULL) {
+        return listing;
+    }
+
+    // the directory is read without the lock, so the threads under a ** don't wait for each other's reads
+    listing = read_listing(env, err, path);
+
+    if (listing == NULL) {
+        return NULL;
+    }
+
+    return cache_listing(env, err, cache, listing);
+}
+
+/**
+ * Does a pattern contain any of the special characters * ? or [ (that are not escaped with \).
+ *
+ * @param pattern the pattern to check.
+ * @return true if the pattern needs to be expanded.
+ */
+bool pathname_has_magic(const char *pattern) {
+    for (size_t i = 0; pattern[i] != '\0'; i++) {
+        if (pattern[i] == '\\' && pattern[i + 1] != '\0') {
+            i++;
+        } else if (pattern[i] == '*' || pattern[i] == '?' || pattern[i] == '[') {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Does a name match a pattern (see fnmatch).
+ * * matches any string, ? any character, [...] any character in the set
+ * (with ranges, [:class:] and ! or ^ to negate) and \ makes the next character literal.
+ *
+ * @param pattern the pattern.
+ * @param name the name to check.
+ * @return true if the name matches.
+ */
+bool pathname_match(const char *pattern, const char *name) {
+    const char *star_pattern;
+    const char *star_name;
+
+    // the last * seen - on a mismatch it is made to match one more character and matching resumes after it
+    star_pattern = NULL;
+    star_name = NULL;
+
+    while (*name != '\0') {
+        bool matched;
+
+        matched = false;
+
+        if (*pattern == '*') {
+            while (*pattern == '*') {
+                pattern++;
+            }
+
+            star_pattern = pattern;
+            star_name = name;
+            continue;
+        }
+
+        if (*pattern == '?') {
+            pattern++;
+            name++;
+            continue;
+        }
+
+        if (*pattern == '[') {
+            size_t length;
+            int result;
+
+            result = match_bracket(pattern, (unsigned char) *name, &length);
+
+            if (result == 1) {
+                pattern += length;
+                name++;
+                continue;
+            }
+
+            // an unterminated [ is just a [
+            if (result == -1 && *name == '[') {
+                pattern++;
+                name++;
+                continue;
+            }
+        } else {
+            const char *literal;
+
+            literal = pattern;
+
+            if (*literal == '\\' && literal[1] != '\0') {
+                literal++;
+            }
+
+            if (*literal != '\0' && *literal == *name) {
+                pattern = literal + 1;
+                name++;
+                matched = true;
+            }
+        }
+
+        if (!matched) {
+            if (star_pattern == NULL) {
+                return false;
+            }
+
+            star_name++;
+            pattern = star_pattern;
+            name = star_name;
+        }
+    }
+
+    while (*pattern == '*') {
+        pattern++;
+    }
+
+    return *pattern == '\0';
+}
+
+/**
+ * Find the files that match a pattern. Each / separated part of the pattern is matched
+ * against one directory level, except ** which matches any number of directories, including none
+ * (a ** after a directory matches the directory, with a / on the end, as well as everything below it,
+ * a ** on its own matches everything below the working directory).
+ * Names starting with . are only matched by a part that starts with a literal dot.
+ * The directories under a ** are read in parallel (see pathname_cache thread_count), the matches are
+ * sorted so the result does not depend on which thread found what.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param cache the directory listings to use.
+ * @param pattern the pattern.
+ * @param count set to the number of matches.
+ * @return the sorted, NULL terminated, matches, or NULL if nothing matched (free with pathname_free_matches).
+ */
+char **pathname_expand(const struct dc_posix_env *env, struct dc_error *err, struct pathname_cache *cache,
+                       const char *pattern, size_t *count) {
+    char *copy;
+    char **components;
+    size_t component_count;
+    size_t length;
+    bool dirs_only;
+    struct matches matches;
+    char *state;
+    char *token;
+
+    *count = 0;
+    length = dc_strlen(env, pattern);
+    copy = dc_strdup(env, err, pattern);
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    // there can't be more parts than half the characters, rounded up
+    components = dc_malloc(env, err, (length / 2 + 2) * sizeof(char *));
+    if (dc_error_has_error(err)) {
+        dc_free(env, copy, length + 1);
+        return NULL;
+    }
+
+    component_count = 0;
+    state = copy;
+
+    while ((token = dc_strtok_r(env, state, "/", &state)) != NULL) {
+        components[component_count] = token;
+        component_count++;
+    }
+
+    // "dir/*/" only matches directories, and keeps the trailing /
+    dirs_only = length > 0 && pattern[length - 1] == '/';
+    matches.paths = NULL;
+    matches.count = 0;
+    matches.capacity = 0;
+
+    if (component_count > 0) {
+        expand_components(env, err, cache, pattern[0] == '/' ? "/" : "", components, 0, component_count, dirs_only,
+                          cache->thread_count != 1, &matches);
+    }
+
+    dc_free(env, components, (length / 2 + 2) * sizeof(char *));
+    dc_free(env, copy, length + 1);
+
+    if (dc_error_has_error(err) || matches.count == 0) {
+        for (size_t i = 0; i < matches.count; i++) {
+            dc_free(env, matches.paths[i], strlen(matches.paths[i]) + 1);
+        }
+
+        if (matches.paths != NULL) {
+            dc_free(env, matches.paths, matches.capacity * sizeof(char *));
+        }
+
+        return NULL;
+    }
+
+    qsort(matches.paths, matches.count, sizeof(char *), compare_paths);
+
+    // overlapping ** parts can find the same path twice
+    length = 1;
+
+    for (size_t i = 1; i < matches.count; i++) {
+        if (dc_strcmp(env, matches.paths[i], matches.paths[length - 1]) == 0) {
+            dc_free(env, matches.paths[i], strlen(matches.paths[i]) + 1);
+        } else {
+            matches.paths[length] = matches.paths[i];
+            length++;
+        }
+    }
+
+    matches.count = length;
+
+    // the caller frees it by its count (see pathname_free_matches), so it is cut down to that
+    if (matches.capacity > matches.count + 1) {
+        char **paths;
+        struct dc_error shrink_err;
+
+        dc_error_init(&shrink_err, NULL);
+        paths = dc_realloc(env, &shrink_err, matches.paths, (matches.count + 1) * sizeof(char *));
+
+        if (dc_error_has_no_error(&shrink_err)) {
+            matches.paths = paths;
+            matches.capacity = matches.count + 1;
+        }
+
+        dc_error_reset(&shrink_err);
+    }
+
+    matches.paths[matches.count] = NULL;
+    *count = matches.count;
+
+    return matches.paths;
+}
+
+/**
+ * Free the array returned by pathname_expand.
+ *
+ * @param env the posix environment.
+ * @param matches the matches.
+ * @param count the number of matches.
+ */
+void pathname_free_matches(const struct dc_posix_env *env, char **matches, size_t count) {
+    if (matches == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        dc_free(env, matches[i], strlen(matches[i]) + 1);
+    }
+
+    dc_free(env, matches, (count + 1) * sizeof(char *));
+}
+
+static size_t hash_path(const char *path) {
+    uint64_t hash;
+
+    // FNV-1a
+    hash = UINT64_C(14695981039346656037);
+
+    for (size_t i = 0; path[i] != '\0'; i++) {
+        hash ^= (unsigned char) path[i];
+        hash *= UINT64_C(1099511628211);
+    }
+
+    return (size_t) hash;
+}
+
+/*
+ * The cache's lock must be held.
+ */
+static struct directory_listing *find_listing(const struct dc_posix_env *env, struct pathname_cache *cache,
+                                              const char *path) {
+    struct directory_listing *listing;
+    size_t bucket;
+
+    bucket = hash_path(path) & (cache->bucket_count - 1);
+
+    for (listing = cache->buckets[bucket]; listing != NULL; listing = listing->next) {
+        if (dc_strcmp(env, listing->path, path) == 0) {
+            return listing;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Add a listing that has just been read to the cache and return the one the cache keeps. Another thread
+ * may have read the same directory in the meantime, then the new listing is freed and the cached one is returned.
+ */
+static struct directory_listing *cache_listing(const struct dc_posix_env *env, struct dc_error *err,
+                                               struct pathname_cache *cache, struct directory_listing *listing) {
+    struct directory_listing *cached;
+    size_t bucket;
+
+    pthread_mutex_lock(&cache->lock);
+    cached = find_listing(env, cache, listing->path);
+
+    if (cached != NULL) {
+        pthread_mutex_unlock(&cache->lock);
+        free_listing(env, listing);
+        return cached;
+    }
+
+    // a recursive pattern can visit a lot of directories, so the chains are kept short
+    if (cache->count + 1 > cache->bucket_count) {
+        struct directory_listing **buckets;
+        size_t bucket_count;
+
+        bucket_count = cache->bucket_count * 2;
+        buckets = dc_calloc(env, err, bucket_count, sizeof(struct directory_listing *));
+        if (dc_error_has_error(err)) {
+            pthread_mutex_unlock(&cache->lock);
+            free_listing(env, listing);
+            return NULL;
+        }
+
+        for (size_t i = 0; i < cache->bucket_count; i++) {
+            struct directory_listing *old;
+
+            old = cache->buckets[i];
+
+            while (old != NULL) {
+                struct directory_listing *next;
+                size_t new_bucket;
+
+                next = old->next;
+                new_bucket = hash_path(old->path) & (bucket_count - 1);
+                old->next = buckets[new_bucket];
+                buckets[new_bucket] = old;
+                old = next;
+            }
+        }
+
+        dc_free(env, cache->buckets, cache->bucket_count * sizeof(struct directory_listing *));
+        cache->buckets = buckets;
+        cache->bucket_count = bucket_count;
+    }
+
+    bucket = hash_path(listing->path) & (cache->bucket_count - 1);
+    listing->next = cache->buckets[bucket];
+    cache->buckets[bucket] = listing;
+    cache->count++;
+    pthread_mutex_unlock(&cache->lock);
+
+    return listing;
+}
+
+static struct directory_listing *read_listing(const struct dc_posix_env *env, struct dc_error *err, const char *path) {
+    struct directory_listing *listing;
+    int fd;
+
+    fd = open(path[0] == '\0' ? "." : path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (fd == -1) {
+        if (!is_unreadable(errno)) {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+        }
+
+        return NULL;
+    }
+
+    listing = list_directory(env, err, fd, path);
+    close(fd);
+
+    return listing;
+}
+
+/*
+ * A directory that is gone, is not a directory or may not be read has nothing in it that can match.
+ * Anything else (running out of file descriptors or memory) is an error, rather than quietly leaving
+ * part of the tree out of the matches.
+ */
+static bool is_unreadable(int error) {
+    return error == ENOENT || error == ENOTDIR || error == EACCES || error == ELOOP || error == ENAMETOOLONG;
+}
+
+/*
+ * Read the names in an open directory, the fd is left open.
+ */
+static struct directory_listing *list_directory(const struct dc_posix_env *env, struct dc_error *err, int fd,
+                                                const char *path) {
+    struct directory_listing *listing;
+
+    listing = dc_calloc(env, err, 1, sizeof(struct directory_listing));
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    listing->path = dc_strdup(env, err, path);
+    if (dc_error_has_error(err)) {
+        dc_free(env, listing, sizeof(struct directory_listing));
+        return NULL;
+    }
+
+#if defined(__linux__)
+    {
+        char *buffer;
+        long bytes;
+
+        // one system call returns hundreds of entries rather than readdir's one at a time interface
+        buffer = dc_malloc(env, err, READ_BATCH_SIZE);
+
+        while (dc_error_has_no_error(err) &&
+               (bytes = syscall(SYS_getdents64, fd, buffer, READ_BATCH_SIZE)) > 0) {
+            for (long offset = 0; offset < bytes && dc_error_has_no_error(err);) {
+                struct linux_dirent64 *entry;
+
+                entry = (struct linux_dirent64 *) (void *) &buffer[offset];
+                add_name(env, err, listing, entry->d_name, entry->d_type);
+                offset += entry->d_reclen;
+            }
+        }
+
+        // half a listing would silently leave names out of the matches
+        if (dc_error_has_no_error(err) && bytes == -1) {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+        }
+
+        if (buffer != NULL) {
+            dc_free(env, buffer, READ_BATCH_SIZE);
+        }
+    }
+#else
+    {
+        DIR *dir;
+        struct dirent *entry;
+        int copy;
+
+        // closedir closes the fd it was given, so it gets a copy
+        copy = dup(fd);
+        dir = copy == -1 ? NULL : fdopendir(copy);
+
+        if (dir != NULL) {
+            errno = 0;
+
+            while (dc_error_has_no_error(err) && (entry = readdir(dir)) != NULL) {
+                add_name(env, err, listing, entry->d_name, entry->d_type);
+            }
+
+            // half a listing would silently leave names out of the matches
+            if (dc_error_has_no_error(err) && errno != 0) {
+                DC_ERROR_RAISE_ERRNO(err, errno);
+            }
+
+            closedir(dir);
+        } else {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+
+            if (copy != -1) {
+                close(copy);
+            }
+        }
+    }
+#endif
+
+    if (dc_error_has_error(err)) {
+        free_listing(env, listing);
+        return NULL;
+    }
+
+    return listing;
+}
+
+static void add_name(const struct dc_posix_env *env, struct dc_error *err, struct directory_listing *listing,
+                     const char *name, unsigned char type) {
+    size_t length;
+
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+        return;
+    }
+
+    length = strlen(name) + 1;
+
+    if (listing->names_length + length > listing->names_capacity) {
+        char *names;
+        size_t capacity;
+
+        capacity = listing->names_capacity == 0 ? INITIAL_NAMES_SIZE : listing->names_capacity;
+
+        while (capacity < listing->names_length + length) {
+            capacity *= 2;
+        }
+
+        names = dc_realloc(env, err, listing->names, capacity);
+        if (dc_error_has_error(err)) {
+            return;
+        }
+
+        listing->names = names;
+        listing->names_capacity = capacity;
+    }
+
+    if (listing->count == listing->capacity) {
+        size_t capacity;
+        size_t *offsets;
+        unsigned char *types;
+
+        capacity = listing->capacity == 0 ? INITIAL_ENTRIES : listing->capacity * 2;
+        offsets = dc_realloc(env, err, listing->offsets, capacity * sizeof(size_t));
+        if (dc_error_has_error(err)) {
+            return;
+        }
+
+        listing->offsets = offsets;
+        types = dc_realloc(env, err, listing->types, capacity);
+        if (dc_error_has_error(err)) {
+            return;
+        }
+
+        listing->types = types;
+        listing->capacity = capacity;
+    }
+
+    dc_memcpy(env, &listing->names[listing->names_length], name, length);
+    listing->offsets[listing->count] = listing->names_length;
+    listing->types[listing->count] = type;
+    listing->names_length += length;
+    listing->count++;
+}
+
+static void free_listing(const struct dc_posix_env *env, struct directory_listing *listing) {
+    if (listing->names != NULL) {
+        dc_free(env, listing->names, listing->names_capacity);
+    }
+
+    if (listing->offsets != NULL) {
+        dc_free(env, listing->offsets, listing->capacity * sizeof(size_t));
+    }
+
+    if (listing->types != NULL) {
+        dc_free(env, listing->types, listing->capacity);
+    }
+
+    dc_free(env, listing->path, strlen(listing->path) + 1);
+    dc_free(env, listing, sizeof(struct directory_listing));
+}
+
+/*
+ * Returns 1 if c is in the [...] set at the start of pattern, 0 if it is not, -1 if there is no closing ].
+ */
+static int match_bracket(const char *pattern, unsigned char c, size_t *length) {
+    const char *p;
+    bool negate;
+    bool matched;
+    bool first;
+
+    p = pattern + 1;
+    negate = *p == '!' || *p == '^';
+
+    if (negate) {
+        p++;
+    }
+
+    matched = false;
+    first = true;
+
+    // a ] straight after the [ (or [!) is part of the set
+    while (*p != ']' || first) {
+        unsigned char low;
+
+        if (*p == '\0') {
+            return -1;
+        }
+
+        if (*p == '[' && p[1] == ':') {
+            const char *end;
+
+            end = strstr(p + 2, ":]");
+
+            if (end != NULL) {
+                bool valid;
+                bool in_class;
+
+                in_class = match_class(p + 2, (size_t) (end - (p + 2)), c, &valid);
+
+                if (valid) {
+                    matched = matched || in_class;
+                    p = end + 2;
+                    first = false;
+                    continue;
+                }
+            }
+        }
+
+        if (*p == '\\' && p[1] != '\0') {
+            p++;
+        }
+
+        low = (unsigned char) *p;
+        p++;
+
+        if (*p == '-' && p[1] != ']' && p[1] != '\0') {
+            unsigned char high;
+
+            p++;
+
+            if (*p == '\\' && p[1] != '\0') {
+                p++;
+            }
+
+            high = (unsigned char) *p;
+            p++;
+            matched = matched || (c >= low && c <= high);
+        } else {
+            matched = matched || c == low;
+        }
+
+        first = false;
+    }
+
+    *length = (size_t) (p + 1 - pattern);
+
+    return matched != negate ? 1 : 0;
+}
+
+static bool match_class(const char *name, size_t length, unsigned char c, bool *valid) {
+    static const char *const names[] = {"alnum", "alpha", "blank", "cntrl", "digit", "graph",
+                                        "lower", "print", "punct", "space", "upper", "xdigit"};
+    int (*const tests[])(int) = {isalnum, isalpha, isblank, iscntrl, isdigit, isgraph,
+                                 islower, isprint, ispunct, isspace, isupper, isxdigit};
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strlen(names[i]) == length && strncmp(names[i], name, length) == 0) {
+            *valid = true;
+            return tests[i](c) != 0;
+        }
+    }
+
+    *valid = false;
+
+    return false;
+}
+
+/*
+ * threaded is false for the parts after a ** that is already being expanded by a thread pool.
+ */
+static void expand_components(const struct dc_posix_env *env, struct dc_error *err, struct pathname_cache *cache,
+                              const char *prefix, char **components, size_t index, size_t count, bool dirs_only,
+                              bool threaded, struct matches *matches) {
+    const char *component;
+    const struct directory_listing *listing;
+    bool last;
+
+    component = components[index];
+    last = index + 1 == count;
+
+    if (dc_strcmp(env, component, "**") == 0) {
+        // as in bash, "dir/**" and "dir/**/" start with "dir/" itself (a bare ** does not match the working directory)
+        if (last && prefix[0] != '\0' && exists(prefix, true)) {
+            add_match(env, err, matches, join(env, err, prefix, "", prefix[strlen(prefix) - 1] != '/'));
+            if (dc_error_has_error(err)) {
+                return;
+            }
+        }
+
+        if (!threaded) {
+            expand_recursive(env, err, cache, prefix, components, index, count, dirs_only, matches);
+        } else {
+            expand_parallel(env, err, cache, prefix, components, index, count, dirs_only, matches);
+        }
+
+        return;
+    }
+
+    if (!pathname_has_magic(component)) {
+        char *literal;
+        char *path;
+
+        // no need to read the directory, the name is already known
+        literal = unescape(env, err, component);
+        if (dc_error_has_error(err)) {
+            return;
+        }
+
+        path = join(env, err, prefix, literal, last && dirs_only);
+        dc_free(env, literal, strlen(literal) + 1);
+        if (dc_error_has_error(err)) {
+            return;
+        }
+
+        if (!last) {
+            expand_components(env, err, cache, path, components, index + 1, count, dirs_only, threaded, matches);
+            dc_free(env, path, strlen(path) + 1);
+        } else if (exists(path, dirs_only)) {
+            add_match(env, err, matches, path);
+        } else {
+            dc_free(env, path, strlen(path) + 1);
+        }
+
+        return;
+    }
+
+    listing = pathname_list(env, err, cache, prefix);
+
+    if (listing == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < listing->count && dc_error_has_no_error(err); i++) {
+        const char *name;
+        char *path;
+
+        name = &listing->names[listing->offsets[i]];
+
+        // hidden files have to be asked for
+        if (name[0] == '.' && component[0] != '.' && !(component[0] == '\\' && component[1] == '.')) {
+            continue;
+        }
+
+        if (!pathname_match(component, name)) {
+            continue;
+        }
+
+        path = join(env, err, prefix, name, false);
+        if (dc_error_has_error(err)) {
+            return;
+        }
+
+        if (last && !dirs_only) {
+            add_match(env, err, matches, path);
+        } else if (is_directory(AT_FDCWD, path, listing->types[i], true)) {
+            if (last) {
+                char *with_slash;
+
+                with_slash = join(env, err, path, "", true);
+                dc_free(env, path, strlen(path) + 1);
+                if (dc_error_has_error(err)) {
+                    return;
+                }
+
+                add_match(env, err, matches, with_slash);
+            } else {
+                expand_components(env, err, cache, path, components, index + 1, count, dirs_only, threaded, matches);
+                dc_free(env, path, strlen(path) + 1);
+            }
+        } else {
+            dc_free(env, path, strlen(path) + 1);
+        }
+    }
+}
+
+/*
+ * ** matches the directory itself and every directory below it (without following symbolic links).
+ * As the last part it matches everything below the directory (expand_components adds the directory).
+ */
+static void expand_recursive(const struct dc_posix_env *env, struct dc_error *err, struct pathname_cache *cache,
+                             const char *prefix, char **components, size_t index, size_t count, bool dirs_only,
+                             struct matches *matches) {
+    const struct directory_listing *listing;
+    bool last;
+
+    last = index + 1 == count;
+
+    if (!last) {
+        expand_components(env, err, cache, prefix, components, index + 1, count, dirs_only, false, matches);
+    }
+
+    listing = pathname_list(env, err, cache, prefix);
+
+    if (listing == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < listing->count && dc_error_has_no_error(err); i++) {
+        const char *name;
+        char *path;
+        bool directory;
+
+        name = &listing->names[listing->offsets[i]];
+
+        if (name[0] == '.') {
+            continue;
+        }
+
+        path = join(env, err, prefix, name, false);
+        if (dc_error_has_error(err)) {
+            return;
+        }
+
+        directory = is_directory(AT_FDCWD, path, listing->types[i], false);
+
+        if (last && (directory || !dirs_only)) {
+            char *match;
+
+            match = join(env, err, path, "", dirs_only);
+            if (dc_error_has_error(err)) {
+                dc_free(env, path, strlen(path) + 1);
+                return;
+            }
+
+            add_match(env, err, matches, match);
+        }
+
+        if (directory) {
+            expand_recursive(env, err, cache, path, components, index, count, dirs_only, matches);
+        }
+
+        dc_free(env, path, strlen(path) + 1);
+    }
+}
+
+/*
+ * The same as expand_recursive, but each directory is a job for a thread pool. The directories are opened
+ * relative to their parent's fd, so the kernel doesn't look up the whole path again at every level.
+ * The listings go in the same cache the rest of the line uses, so a directory is read once however it is reached.
+ * The workers find the matches in whatever order they get to them, pathname_expand sorts them.
+ * A worker that fails leaves its error for thread_pool_run to raise once the pool has stopped.
+ */
+static void expand_parallel(const struct dc_posix_env *env, struct dc_error *err, struct pathname_cache *cache,
+                            const char *prefix, char **components, size_t index, size_t count, bool dirs_only,
+                            struct matches *matches) {
+    struct thread_pool *pool;
+    struct walk walk;
+    size_t worker_count;
+
+    pool = thread_pool_create(env, err, cache->thread_count);
+    if (dc_error_has_error(err)) {
+        return;
+    }
+
+    worker_count = pool->worker_count;
+
+    if (worker_count == 1) {
+        thread_pool_destroy(env, &pool);
+        expand_recursive(env, err, cache, prefix, components, index, count, dirs_only, matches);
+        return;
+    }
+
+    walk.components = components;
+    walk.index = index;
+    walk.count = count;
+    walk.dirs_only = dirs_only;
+    walk.cache = cache;
+    walk.matches = dc_calloc(env, err, worker_count, sizeof(struct matches));
+
+    if (dc_error_has_no_error(err)) {
+        submit_subdirectory(env, err, pool, 0, &walk, NULL, prefix, "");
+    }
+
+    if (dc_error_has_no_error(err)) {
+        thread_pool_run(env, err, pool);
+    }
+
+    thread_pool_destroy(env, &pool);
+
+    for (size_t i = 0; walk.matches != NULL && i < worker_count; i++) {
+        struct matches *found;
+
+        found = &walk.matches[i];
+
+        for (size_t j = 0; j < found->count; j++) {
+            if (dc_error_has_error(err)) {
+                dc_free(env, found->paths[j], strlen(found->paths[j]) + 1);
+            } else {
+                add_match(env, err, matches, found->paths[j]);
+            }
+        }
+
+        if (found->paths != NULL) {
+            dc_free(env, found->paths, found->capacity * sizeof(char *));
+        }
+    }
+
+    if (walk.matches != NULL) {
+        dc_free(env, walk.matches, worker_count * sizeof(struct matches));
+    }
+}
+
+/*
+ * A thread pool task: match the rest of the pattern in a directory and submit a job for each subdirectory.
+ */
+static void walk_directory(const struct dc_posix_env *env, struct dc_error *err, struct thread_pool *pool,
+                           size_t worker, void *arg) {
+    struct walk_job *job;
+    struct walk_directory *directory;
+    const struct directory_listing *listing;
+    int fd;
+
+    job = (struct walk_job *) arg;
+    directory = NULL;
+    listing = NULL;
+
+    if (job->parent == NULL) {
+        fd = open(job->path[0] == '\0' ? "." : job->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    } else {
+        // O_NOFOLLOW as ** does not follow symbolic links, even if one replaced the directory after it was listed
+        fd = openat(job->parent->fd, &job->path[job->name_offset], O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        release_directory(env, job->parent);
+    }
+
+    if (fd == -1) {
+        if (!is_unreadable(errno)) {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+        }
+    } else if (dc_error_has_no_error(err) && !thread_pool_cancelled(pool)) {
+        pthread_mutex_lock(&job->walk->cache->lock);
+        listing = find_listing(env, job->walk->cache, job->path);
+        pthread_mutex_unlock(&job->walk->cache->lock);
+
+        if (listing == NULL) {
+            struct directory_listing *read;
+
+            read = list_directory(env, err, fd, job->path);
+
+            if (read != NULL) {
+                listing = cache_listing(env, err, job->walk->cache, read);
+            }
+        }
+    }
+
+    if (listing != NULL) {
+        walk_rest(env, err, job->walk, worker, fd, job->path, listing);
+
+        for (size_t i = 0; i < listing->count && dc_error_has_no_error(err); i++) {
+            const char *name;
+
+            name = &listing->names[listing->offsets[i]];
+
+            if (name[0] == '.' || !is_directory(fd, name, listing->types[i], false)) {
+                continue;
+            }
+
+            // the subdirectories share this fd, the last one to open itself closes it
+            if (directory == NULL) {
+                directory = dc_malloc(env, err, sizeof(struct walk_directory));
+                if (dc_error_has_error(err)) {
+                    break;
+                }
+
+                directory->fd = fd;
+                atomic_init(&directory->references, 1);
+            }
+
+            submit_subdirectory(env, err, pool, worker, job->walk, directory, job->path, name);
+        }
+    }
+
+    if (directory != NULL) {
+        release_directory(env, directory);
+    } else if (fd != -1) {
+        close(fd);
+    }
+
+    dc_free(env, job->path, strlen(job->path) + 1);
+    dc_free(env, job, sizeof(struct walk_job));
+}
+
+/*
+ * Match the parts after the ** against a directory the ** matched.
+ */
+static void walk_rest(const struct dc_posix_env *env, struct dc_error *err, struct walk *walk, size_t worker, int fd,
+                      const char *path, const struct directory_listing *listing) {
+    struct matches *matches;
+    const char *component;
+
+    matches = &walk->matches[worker];
+
+    // the listing has already been read, so the common **, **/ and **/*.c cases don't need to read it again
+    if (walk->index + 1 == walk->count) {
+        for (size_t i = 0; i < listing->count && dc_error_has_no_error(err); i++) {
+            const char *name;
+
+            name = &listing->names[listing->offsets[i]];
+
+            if (name[0] != '.' && (!walk->dirs_only || is_directory(fd, name, listing->types[i], false))) {
+                add_match(env, err, matches, join(env, err, path, name, walk->dirs_only));
+            }
+        }
+
+        return;
+    }
+
+    component = walk->components[walk->index + 1];
+
+    if (walk->index + 2 == walk->count && pathname_has_magic(component)) {
+        for (size_t i = 0; i < listing->count && dc_error_has_no_error(err); i++) {
+            const char *name;
+
+            name = &listing->names[listing->offsets[i]];
+
+            if (name[0] == '.' && component[0] != '.' && !(component[0] == '\\' && component[1] == '.')) {
+                continue;
+            }
+
+            if (!pathname_match(component, name)) {
+                continue;
+            }
+
+            if (!walk->dirs_only || is_directory(fd, name, listing->types[i], true)) {
+                add_match(env, err, matches, join(env, err, path, name, walk->dirs_only));
+            }
+        }
+
+        return;
+    }
+
+    // anything else goes through the usual code, in this worker (it is already one of the pool's threads)
+    expand_components(env, err, walk->cache, path, walk->components, walk->index + 1, walk->count, walk->dirs_only,
+                      false, matches);
+}
+
+static void submit_subdirectory(const struct dc_posix_env *env, struct dc_error *err, struct thread_pool *pool,
+                                size_t worker, struct walk *walk, struct walk_directory *parent, const char *path,
+                                const char *name) {
+    struct walk_job *job;
+
+    job = dc_malloc(env, err, sizeof(struct walk_job));
+    if (dc_error_has_error(err)) {
+        return;
+    }
+
+    job->path = join(env, err, path, name, false);
+    if (dc_error_has_error(err)) {
+        dc_free(env, job, sizeof(struct walk_job));
+        return;
+    }
+
+    job->walk = walk;
+    job->parent = parent;
+    job->name_offset = strlen(job->path) - strlen(name);
+
+    if (parent != NULL) {
+        atomic_fetch_add(&parent->references, 1);
+    }
+
+    thread_pool_submit(env, err, pool, worker, walk_directory, job);
+
+    if (dc_error_has_error(err)) {
+        if (parent != NULL) {
+            release_directory(env, parent);
+        }
+
+        dc_free(env, job->path, strlen(job->path) + 1);
+        dc_free(env, job, sizeof(struct walk_job));
+    }
+}
+
+static void release_directory(const struct dc_posix_env *env, struct walk_directory *directory) {
+    if (atomic_fetch_sub(&directory->references, 1) == 1) {
+        close(directory->fd);
+        dc_free(env, directory, sizeof(struct walk_directory));
+    }
+}
+
+static char *join(const struct dc_posix_env *env, struct dc_error *err, const char *prefix, const char *name,
+                  bool slash) {
+    size_t prefix_length;
+    size_t name_length;
+    bool separator;
+    char *path;
+
+    prefix_length = strlen(prefix);
+    name_length = strlen(name);
+    separator = prefix_length > 0 && prefix[prefix_length - 1] != '/' && name_length > 0;
+    path = dc_malloc(env, err, prefix_length + separator + name_length + slash + 1);
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    dc_memcpy(env, path, prefix, prefix_length);
+
+    if (separator) {
+        path[prefix_length] = '/';
+    }
+
+    dc_memcpy(env, &path[prefix_length + separator], name, name_length);
+
+    if (slash) {
+        path[prefix_length + separator + name_length] = '/';
+    }
+
+    path[prefix_length + separator + name_length + slash] = '\0';
+
+    return path;
+}
+
+static char *unescape(const struct dc_posix_env *env, struct dc_error *err, const char *pattern) {
+    char *literal;
+    size_t length;
+
+    literal = dc_malloc(env, err, strlen(pattern) + 1);
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    length = 0;
+
+    for (size_t i = 0; pattern[i] != '\0'; i++) {
+        if (pattern[i] == '\\' && pattern[i + 1] != '\0') {
+            i++;
+        }
+
+        literal[length] = pattern[i];
+        length++;
+    }
+
+    literal[length] = '\0';
+
+    return literal;
+}
+
+static bool is_directory(int dir_fd, const char *path, unsigned char type, bool follow) {
+    struct stat info;
+
+    if (type == DT_DIR) {
+        return true;
+    }
+
+    // the type is only a hint - links and file systems that do not fill it in need a stat
+    if (type != DT_UNKNOWN && (type != DT_LNK || !follow)) {
+        return false;
+    }
+
+    return fstatat(dir_fd, path, &info, follow ? 0 : AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(info.st_mode);
+}
+
+static bool exists(const char *path, bool dirs_only) {
+    struct stat info;
+
+    if (dirs_only) {
+        return stat(path, &info) == 0 && S_ISDIR(info.st_mode);
+    }
+
+    return lstat(path, &info) == 0;
+}
+
+static void add_match(const struct dc_posix_env *env, struct dc_error *err, struct matches *matches, char *path) {
+    // join failed, the error is already set
+    if (path == NULL) {
+        return;
+    }
+
+    // there is always room for the NULL at the end
+    if (matches->count + 1 >= matches->capacity) {
+        char **paths;
+        size_t capacity;
+
+        capacity = matches->capacity == 0 ? INITIAL_ENTRIES : matches->capacity * 2;
+        paths = dc_realloc(env, err, matches->paths, capacity * sizeof(char *));
+        if (dc_error_has_error(err)) {
+            dc_free(env, path, strlen(path) + 1);
+            return;
+        }
+
+        matches->paths = paths;
+        matches->capacity = capacity;
+    }
+
+    matches->paths[matches->count] = path;
+    matches->count++;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
@@ -0,0 +1,257 @@
+#include "scan.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && defined(__GNUC__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+typedef size_t (*scan_function)(const char *line, size_t i);
+
+static scan_function choose_scan(void);
+static scan_function scan_function_of(enum scan_kind kind);
+static size_t scan_scalar(const char *line, size_t i);
+#ifdef SCAN_X86
+static size_t scan_sse2(const char *line, size_t i);
+static size_t scan_avx2(const char *line, size_t i);
+#endif
+
+// the bytes scan_special stops at, the '\0' is the end of the string
+static const bool is_special[256] = {
+        ['\0'] = true, [' '] = true, ['\t'] = true, ['\n'] = true, ['\''] = true, ['"'] = true, ['`'] = true,
+        ['\\'] = true, ['$'] = true, ['|'] = true, ['&'] = true, [';'] = true, ['<'] = true, ['>'] = true,
+        ['('] = true, [')'] = true,
+};
+
+// NULL until the first scan picks one, the tests can change it while other threads are scanning
+static _Atomic(scan_function) scanner = NULL;
+
+/**
+ * Find the next character the tokenizer has to look at: a blank (space, tab or newline), a quote, \, $,
+ * an operator (| & ; < > ( or )) or the '\0' at the end of the line. Everything before it is an ordinary
+ * part of a word. The first SCAN_VECTOR_AFTER bytes are looked at one at a time, on x86 the rest of a longer
+ * word is read 16 or 32 bytes at a time, the widest the CPU has (found with cpuid the first time it is called).
+ *
+ * @param line the line.
+ * @param i the index to start at.
+ * @return the index of the character, i if line[i] is one.
+ */
+size_t scan_special(const char *line, size_t i) {
+    scan_function scan;
+    size_t end;
+
+    // most words are short, so they are done before going to the vectors
+    for (end = i + SCAN_VECTOR_AFTER; i < end; i++) {
+        if (is_special[(unsigned char) line[i]]) {
+            return i;
+        }
+    }
+
+    scan = atomic_load_explicit(&scanner, memory_order_relaxed);
+
+    if (scan == NULL) {
+        scan = choose_scan();
+        atomic_store_explicit(&scanner, scan, memory_order_relaxed);
+    }
+
+    return scan(line, i);
+}
+
+/**
+ * The way scan_special looks at the line.
+ *
+ * @return the kind being used.
+ */
+enum scan_kind scan_get_kind(void) {
+    scan_function scan;
+
+    scan = atomic_load_explicit(&scanner, memory_order_relaxed);
+
+    if (scan == NULL) {
+        scan = choose_scan();
+    }
+
+#ifdef SCAN_X86
+    if (scan == scan_avx2) {
+        return SCAN_AVX2;
+    }
+
+    if (scan == scan_sse2) {
+        return SCAN_SSE2;
+    }
+#endif
+
+    return SCAN_SCALAR;
+}
+
+/**
+ * Change the way scan_special looks at the line (for the tests and to compare them).
+ *
+ * @param kind the kind to use.
+ * @return false (and nothing is changed) if this CPU or build does not have it.
+ */
+bool scan_set_kind(enum scan_kind kind) {
+    scan_function scan;
+
+    scan = scan_function_of(kind);
+
+    if (scan == NULL) {
+        return false;
+    }
+
+    atomic_store_explicit(&scanner, scan, memory_order_relaxed);
+
+    return true;
+}
+
+/*
+ * The widest one this CPU has. SSE2 is part of x86-64, AVX2 has to be asked for. Either is only used past
+ * SCAN_VECTOR_AFTER, where it is no slower than a byte at a time (see scan_bench).
+ */
+static scan_function choose_scan(void) {
+    scan_function scan;
+
+    scan = scan_function_of(SCAN_AVX2);
+
+    if (scan == NULL) {
+        scan = scan_function_of(SCAN_SSE2);
+    }
+
+    if (scan == NULL) {
+        scan = scan_scalar;
+    }
+
+    return scan;
+}
+
+/*
+ * The function for a kind, or NULL if this CPU or build does not have it.
+ */
+static scan_function scan_function_of(enum scan_kind kind) {
+    switch (kind) {
+        case SCAN_SCALAR:
+            return scan_scalar;
+#ifdef SCAN_X86
+        case SCAN_SSE2:
+            return scan_sse2;
+        case SCAN_AVX2:
+            // cpuid, and whether the OS saves the ymm registers
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") ? scan_avx2 : NULL;
+#else
+        case SCAN_SSE2:
+        case SCAN_AVX2:
+            return NULL;
+#endif
+        default:
+            return NULL;
+    }
+}
+
+/*
+ * A byte at a time through the table.
+ */
+static size_t scan_scalar(const char *line, size_t i) {
+    while (!is_special[(unsigned char) line[i]]) {
+        i++;
+    }
+
+    return i;
+}
+
+#ifdef SCAN_X86
+/*
+ * A byte at a time up to a 16 byte boundary (a short word ends before it), then 16 at a time. The loads
+ * are aligned so they never cross into a page the line does not reach. Reading past the '\0' that way is
+ * fine for the CPU but not for ASan, so it is not instrumented (the C library's strlen does the same).
+ */
+__attribute__((no_sanitize_address))
+static size_t scan_sse2(const char *line, size_t i) {
+    while (((uintptr_t) &line[i] & 15U) != 0) {
+        if (is_special[(unsigned char) line[i]]) {
+            return i;
+        }
+
+        i++;
+    }
+
+    for (;; i += 16) {
+        __m128i bytes;
+        __m128i found;
+        unsigned int mask;
+
+        // SSE2 has no byte shuffle, so the bytes are compared, the runs as signed ranges (a byte past 127 is
+        // negative so it is in none of them)
+        bytes = _mm_load_si128((const __m128i *) (const void *) &line[i]);
+        found = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_setzero_si128()),
+                                          _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' '))),
+                             _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('"')),
+                                          _mm_cmpeq_epi8(bytes, _mm_set1_epi8('$'))));
+        found = _mm_or_si128(found, _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('>')),
+                                                              _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\\'))),
+                                                 _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('`')),
+                                                              _mm_cmpeq_epi8(bytes, _mm_set1_epi8('|')))));
+        found = _mm_or_si128(found, _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8('\t' - 1)),
+                                                  _mm_cmplt_epi8(bytes, _mm_set1_epi8('\n' + 1))));
+        found = _mm_or_si128(found, _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8('&' - 1)),
+                                                  _mm_cmplt_epi8(bytes, _mm_set1_epi8(')' + 1))));
+        found = _mm_or_si128(found, _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(';' - 1)),
+                                                  _mm_cmplt_epi8(bytes, _mm_set1_epi8('<' + 1))));
+        mask = (unsigned int) _mm_movemask_epi8(found);
+
+        if (mask != 0) {
+            return i + (size_t) __builtin_ctz(mask);
+        }
+    }
+}
+
+/*
+ * scan_sse2 32 bytes at a time, only called when cpuid says the CPU has AVX2. The bytes are looked up by
+ * their low and high nibbles, each special has a bit set in both of its entries:
+ *
+ *   high 0: '\0' '\t' '\n'               bit 0x01
+ *   high 2: ' ' '"' '$' '&' '\'' '(' ')' bit 0x02
+ *   high 3: ';' '<' '>'                  bit 0x04
+ *   high 5 and 7: '\\' '|'               bit 0x08
+ *   high 6: '`'                          bit 0x10
+ *
+ * A byte past 127 has a high nibble of 8 or more, which has no bits.
+ */
+__attribute__((no_sanitize_address, target("avx2")))
+static size_t scan_avx2(const char *line, size_t i) {
+    __m256i low_bits;
+    __m256i high_bits;
+    __m256i nibble;
+
+    while (((uintptr_t) &line[i] & 31U) != 0) {
+        if (is_special[(unsigned char) line[i]]) {
+            return i;
+        }
+
+        i++;
+    }
+
+    low_bits = _mm256_setr_epi8(0x13, 0, 0x02, 0, 0x02, 0, 0x02, 0x02, 0x02, 0x03, 0x01, 0x04, 0x0C, 0, 0x04, 0,
+                                0x13, 0, 0x02, 0, 0x02, 0, 0x02, 0x02, 0x02, 0x03, 0x01, 0x04, 0x0C, 0, 0x04, 0);
+    high_bits = _mm256_setr_epi8(0x01, 0, 0x02, 0x04, 0, 0x08, 0x10, 0x08, 0, 0, 0, 0, 0, 0, 0, 0,
+                                 0x01, 0, 0x02, 0x04, 0, 0x08, 0x10, 0x08, 0, 0, 0, 0, 0, 0, 0, 0);
+    nibble = _mm256_set1_epi8(0x0F);
+
+    for (;; i += 32) {
+        __m256i bytes;
+        __m256i found;
+        unsigned int mask;
+
+        bytes = _mm256_load_si256((const __m256i *) (const void *) &line[i]);
+        found = _mm256_and_si256(_mm256_shuffle_epi8(low_bits, _mm256_and_si256(bytes, nibble)),
+                                 _mm256_shuffle_epi8(high_bits,
+                                                     _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble)));
+        mask = ~(unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(found, _mm256_setzero_si256()));
+
+        if (mask != 0) {
+            return i + (size_t) __builtin_ctz(mask);
+        }
+    }
+}
+#endif
@@ -0,0 +1,134 @@
+#include "scan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// the size of the line each word length is measured on, and the best of how many runs is kept
+#define LINE_SIZE 65536
+#define RUNS 7
+#define PASSES 50
+
+static double seconds(void);
+static double time_words(const char *line, size_t words);
+
+// the result goes here so the scans are not optimised away
+static volatile size_t sink;
+
+/*
+ * How long scan_special takes over a word for each way it can look at the line: dc_scan_bench prints the
+ * nanoseconds per word for words of 1 to 256 bytes, the kinds this CPU does not have are left blank.
+ * It is what SCAN_VECTOR_AFTER and choose_scan are set from, build it with -DSCAN_VECTOR_AFTER=0 to see
+ * the vectors on their own. At -O2 on an AVX2 machine, with 0 both vectors lost to scalar on words of up to
+ * 24 bytes, with 32 they are as fast on the short words and, on words of 96 bytes or more, SSE2 is 1.2 to 1.7
+ * and AVX2 1.5 to 4 times faster.
+ */
+int main(void) {
+    static const size_t lengths[] = { 1, 2, 4, 8, 16, 24, 32, 48, 64, 96, 128, 256 };
+    static const struct
+    {
+        enum scan_kind kind;
+        const char *name;
+    } kinds[] = {
+        { SCAN_SCALAR, "scalar" },
+        { SCAN_SSE2, "sse2" },
+        { SCAN_AVX2, "avx2" },
+    };
+    char *line;
+
+    line = malloc(LINE_SIZE + 1);
+
+    if (line == NULL) {
+        perror("dc_scan_bench");
+        return EXIT_FAILURE;
+    }
+
+    printf("SCAN_VECTOR_AFTER %d, ns per word\nbytes", SCAN_VECTOR_AFTER);
+
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+        printf(" %8s", kinds[k].name);
+    }
+
+    printf("\n");
+
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        size_t used;
+        size_t words;
+
+        // the words are separated by a space, so each one is a call
+        used = 0;
+        words = 0;
+
+        while (used + lengths[l] + 1 < LINE_SIZE) {
+            memset(&line[used], 'a', lengths[l]);
+            used += lengths[l];
+            line[used++] = ' ';
+            words++;
+        }
+
+        line[used] = '\0';
+        printf("%5zu", lengths[l]);
+
+        for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+            if (scan_set_kind(kinds[k].kind)) {
+                printf(" %8.2f", time_words(line, words));
+            } else {
+                printf(" %8s", "");
+            }
+        }
+
+        printf("\n");
+    }
+
+    free(line);
+
+    return EXIT_SUCCESS;
+}
+
+static double seconds(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+/*
+ * The fastest of the runs, each one scanning the line PASSES times.
+ */
+static double time_words(const char *line, size_t words) {
+    double best;
+
+    best = 0;
+
+    for (int run = 0; run < RUNS; run++) {
+        double start;
+        double taken;
+
+        start = seconds();
+
+        for (int pass = 0; pass < PASSES; pass++) {
+            size_t i;
+
+            i = 0;
+
+            while (line[i] != '\0') {
+                i = scan_special(line, i);
+
+                if (line[i] != '\0') {
+                    i++;
+                }
+            }
+
+            sink += i;
+        }
+
+        taken = (seconds() - start) / PASSES / (double) words * 1e9;
+
+        if (run == 0 || taken < best) {
+            best = taken;
+        }
+    }
+
+    return best;
+}
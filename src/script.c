@@ -0,0 +1,1890 @@
+#include <dc_posix/dc_stdlib.h>
+#include <dc_posix/dc_string.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "arith.h"
+#include "expand.h"
+#include "mem_stats.h"
+#include "pathname.h"
+#include "script.h"
+#include "shell_impl.h"
+#include "source.h"
+#include "substitute.h"
+#include "variables.h"
+
+#define MAX_FUNCTION_DEPTH 1000
+
+/*! \struct here_pending
+    \brief A here-document whose body is on the lines after the current one.
+*/
+struct here_pending
+{
+    struct command *command;    /**< the command the body is for */
+    char *delimiter;            /**< the WORD that ends the body, with its quotes removed */
+    bool strip_tabs;            /**< was it <<- (the leading tabs of the body and delimiter lines are removed) */
+};
+
+/*! \struct parser
+    \brief Where script_parse is in the text.
+*/
+struct parser
+{
+    const struct dc_posix_env *env; /**< the posix environment */
+    struct dc_error *err;           /**< the error object */
+    struct state *state;            /**< the state for split_command, NULL to only check the syntax */
+    const char *text;               /**< the script */
+    size_t position;                /**< the index in the text of the next character to parse */
+    bool incomplete;                /**< did the text end before the script did */
+    struct here_pending *pending;   /**< the here-documents of the current line, read at the end of it */
+    size_t pending_count;           /**< the number of here-documents */
+};
+
+static const char *then_words[] = { "then", NULL };
+static const char *else_words[] = { "elif", "else", "fi", NULL };
+static const char *fi_words[] = { "fi", NULL };
+static const char *do_words[] = { "do", NULL };
+static const char *done_words[] = { "done", NULL };
+static const char *esac_words[] = { "esac", NULL };
+static const char *group_words[] = { "}", NULL };
+static const char *reserved_words[] = { "then", "elif", "else", "fi", "do", "done", "esac", "}", "in", NULL };
+
+static struct script_node *parse(struct parser *parser);
+static struct script_node *parse_list(struct parser *parser, const char **terminators, bool case_item);
+static struct script_node *parse_script_command(struct parser *parser);
+static struct script_node *parse_simple_command(struct parser *parser);
+static struct script_node *parse_if(struct parser *parser);
+static struct script_node *parse_loop(struct parser *parser, enum script_type type);
+static struct script_node *parse_for(struct parser *parser);
+static struct script_node *parse_case(struct parser *parser);
+static struct script_node *parse_case_item(struct parser *parser);
+static struct script_node *parse_group(struct parser *parser);
+static struct script_node *parse_function(struct parser *parser, size_t name_length);
+static size_t function_name_length(const struct parser *parser, bool keyword);
+static void end_compound(struct parser *parser, struct script_node **node);
+static size_t scan_span(struct parser *parser);
+static void find_here_documents(struct parser *parser, struct command *command, size_t start, size_t end);
+static char *here_delimiter(struct parser *parser, size_t *position, size_t end, bool *quoted);
+static void read_here_documents(struct parser *parser);
+static void free_here_documents(struct parser *parser);
+static char **split_span(struct parser *parser, size_t start, size_t end, size_t *count);
+static void skip_space(struct parser *parser);
+static void skip_separators(struct parser *parser);
+static bool is_keyword(struct parser *parser, const char *word);
+static const char *find_keyword(struct parser *parser, const char **words);
+static void expect_keyword(struct parser *parser, const char *word);
+static void syntax_error(struct parser *parser, const char *message);
+static struct script_node *create_node(struct parser *parser, enum script_type type);
+static void add_child(struct parser *parser, struct script_node *node, struct script_node *child);
+static bool is_blank(char c);
+static enum script_flow run_parsed(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                   struct command *command);
+static enum script_flow execute_simple(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                       struct script_node *node);
+static enum script_flow execute_list(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                     struct script_node *node);
+static enum script_flow execute_if(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                   struct script_node *node);
+static enum script_flow execute_loop(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                     struct script_node *node);
+static enum script_flow execute_for(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                    struct script_node *node);
+static enum script_flow execute_case(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                     struct script_node *node);
+static enum script_flow define_function(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                        struct script_node *node);
+static enum script_flow call_function(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                      struct script_node *body, struct command *command, size_t first_argument);
+static enum script_flow source_file(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                    struct command *command);
+static char *find_file(const struct dc_posix_env *env, struct dc_error *err, struct state *state, const char *name);
+static enum script_flow loop_control(struct state *state, struct command *command, enum script_flow flow);
+static enum script_flow return_from_function(struct state *state, struct command *command);
+static bool leave_loop(struct script_context *context, enum script_flow *flow);
+static bool parse_number(const char *string, long *number);
+static char **copy_words(const struct dc_posix_env *env, struct dc_error *err, char **words, size_t count);
+
+/**
+ * Create the context for running scripts, with no functions and nothing sourced.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @return the context (free with script_context_destroy).
+ */
+struct script_context *script_context_create(const struct dc_posix_env *env, struct dc_error *err) {
+    struct script_context *context;
+
+    context = dc_calloc(env, err, 1, sizeof(struct script_context));
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    context->sources = source_cache_create(env, err);
+    if (dc_error_has_error(err)) {
+        dc_free(env, context, sizeof(struct script_context));
+        return NULL;
+    }
+
+    context->arithmetic = arith_cache_create(env, err);
+    if (dc_error_has_error(err)) {
+        source_cache_destroy(env, &context->sources);
+        dc_free(env, context, sizeof(struct script_context));
+        return NULL;
+    }
+
+    return context;
+}
+
+/**
+ * Free the context and the functions in it and set it to NULL.
+ *
+ * @param env the posix environment.
+ * @param pcontext the context to destroy.
+ */
+void script_context_destroy(const struct dc_posix_env *env, struct script_context **pcontext) {
+    struct script_context *context;
+
+    context = *pcontext;
+
+    for (size_t i = 0; i < context->function_count; i++) {
+        dc_free(env, context->functions[i].name, strlen(context->functions[i].name) + 1);
+        script_destroy(env, &context->functions[i].body);
+    }
+
+    if (context->functions != NULL) {
+        dc_free(env, context->functions, context->function_capacity * sizeof(struct script_function));
+    }
+
+    if (context->sources != NULL) {
+        source_cache_destroy(env, &context->sources);
+    }
+
+    if (context->arithmetic != NULL) {
+        arith_cache_destroy(env, &context->arithmetic);
+    }
+
+    dc_free(env, context, sizeof(struct script_context));
+    *pcontext = NULL;
+}
+
+/**
+ * Find a function.
+ *
+ * @param context the context.
+ * @param name the function name.
+ * @return the function, or NULL if there is no function with that name.
+ */
+struct script_function *script_find_function(const struct script_context *context, const char *name) {
+    for (size_t i = 0; i < context->function_count; i++) {
+        if (strcmp(context->functions[i].name, name) == 0) {
+            return &context->functions[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Parse a script: simple commands separated by ; or newlines, if, while, until, for, case, { }
+ * groups and function definitions. A # at the start of a word starts a comment.
+ * Each simple command is split into words now (see split_command), so running it only expands them.
+ *
+ * @param env the posix environment.
+ * @param err the error object, EINVAL for a syntax error.
+ * @param state the current state, to set the fatal_error.
+ * @param text the script.
+ * @return the script (free with script_destroy), a SCRIPT_COMMAND if it is only one command.
+ */
+struct script_node *script_parse(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                 const char *text) {
+    struct parser parser;
+
+    parser.env = env;
+    parser.err = err;
+    parser.state = state;
+    parser.text = text;
+    parser.position = 0;
+    parser.incomplete = false;
+    parser.pending = NULL;
+    parser.pending_count = 0;
+
+    return parse(&parser);
+}
+
+/**
+ * Is a script all there, or does it need more lines (eg. a while without its done, or an unterminated quote).
+ *
+ * @param env the posix environment.
+ * @param text the script so far.
+ * @return false if more lines could finish it, true if it is finished or has a syntax error more lines won't fix.
+ */
+bool script_is_complete(const struct dc_posix_env *env, const char *text) {
+    struct parser parser;
+    struct dc_error err;
+    struct script_node *node;
+
+    dc_error_init(&err, NULL);
+    parser.env = env;
+    parser.err = &err;
+    parser.state = NULL;
+    parser.text = text;
+    parser.position = 0;
+    parser.incomplete = false;
+    parser.pending = NULL;
+    parser.pending_count = 0;
+
+    node = parse(&parser);
+    script_destroy(env, &node);
+    dc_error_reset(&err);
+
+    return !parser.incomplete;
+}
+
+/**
+ * Free a script (or a reference to it) and set it to NULL.
+ *
+ * @param env the posix environment.
+ * @param pnode the script to destroy.
+ */
+void script_destroy(const struct dc_posix_env *env, struct script_node **pnode) {
+    struct script_node *node;
+
+    node = *pnode;
+    *pnode = NULL;
+
+    if (node == NULL) {
+        return;
+    }
+
+    node->references--;
+
+    if (node->references > 0) {
+        return;
+    }
+
+    if (node->command != NULL) {
+        destroy_command(env, node->command);
+        dc_free(env, node->command, sizeof(struct command));
+    }
+
+    if (node->words != NULL) {
+        free_words(env, node->words, node->word_count);
+    }
+
+    if (node->name != NULL) {
+        dc_free(env, node->name, strlen(node->name) + 1);
+    }
+
+    script_destroy(env, &node->condition);
+    script_destroy(env, &node->body);
+    script_destroy(env, &node->otherwise);
+
+    for (size_t i = 0; i < node->child_count; i++) {
+        script_destroy(env, &node->children[i]);
+    }
+
+    if (node->children != NULL) {
+        dc_free(env, node->children, node->child_count * sizeof(struct script_node *));
+    }
+
+    dc_free(env, node, sizeof(struct script_node));
+}
+
+/**
+ * Run a script. The state->command is used for each simple command and the state->exit_code is set as they run.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param state the current state.
+ * @param node the script to run.
+ * @return SCRIPT_NEXT, SCRIPT_EXIT if the exit builtin was run or SCRIPT_STOP if there was an error.
+ */
+enum script_flow script_execute(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                struct script_node *node) {
+    switch (node->type) {
+        case SCRIPT_COMMAND:
+            return execute_simple(env, err, state, node);
+        case SCRIPT_LIST:
+            return execute_list(env, err, state, node);
+        case SCRIPT_IF:
+            return execute_if(env, err, state, node);
+        case SCRIPT_WHILE:
+        case SCRIPT_UNTIL:
+            return execute_loop(env, err, state, node);
+        case SCRIPT_FOR:
+            return execute_for(env, err, state, node);
+        case SCRIPT_CASE:
+            return execute_case(env, err, state, node);
+        case SCRIPT_CASE_ITEM:
+            return script_execute(env, err, state, node->body);
+        case SCRIPT_FUNCTION:
+            return define_function(env, err, state, node);
+        default:
+            return SCRIPT_NEXT;
+    }
+}
+
+/**
+ * Run a parsed simple command: break, continue and return change what runs next, a function is called
+ * with the arguments as its positional parameters, source (or .) runs a file (see source_cache_load),
+ * anything else is run by run_command. Its process substitutions are finished when it is done (see
+ * substitute_finish).
+ * The command->exit_code and state->exit_code are set.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param state the current state.
+ * @param command the command to run.
+ * @return what to run next.
+ */
+enum script_flow script_run_command(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                    struct command *command) {
+    enum script_flow flow;
+
+    flow = run_parsed(env, err, state, command);
+    substitute_finish(env, command);
+
+    return flow;
+}
+
+static enum script_flow run_parsed(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                   struct command *command) {
+    struct script_function *function;
+
+    if (command->command != NULL) {
+        if (strcmp(command->command, "break") == 0) {
+            return loop_control(state, command, SCRIPT_BREAK);
+        }
+
+        if (strcmp(command->command, "continue") == 0) {
+            return loop_control(state, command, SCRIPT_CONTINUE);
+        }
+
+        if (strcmp(command->command, "return") == 0) {
+            return return_from_function(state, command);
+        }
+
+        if (strcmp(command->command, "source") == 0 || strcmp(command->command, ".") == 0) {
+            return source_file(env, err, state, command);
+        }
+
+        function = script_find_function(state->script_context, command->command);
+
+        if (function != NULL) {
+            return call_function(env, err, state, function->body, command, 1);
+        }
+    }
+
+    if (run_command(env, err, state, command)) {
+        return SCRIPT_EXIT;
+    }
+
+    if (dc_error_has_error(err)) {
+        return SCRIPT_STOP;
+    }
+
+    state->exit_code = command->exit_code;
+
+    return SCRIPT_NEXT;
+}
+
+static struct script_node *parse(struct parser *parser) {
+    struct script_node *node;
+
+    node = parse_list(parser, NULL, false);
+
+    // the last line had a here-document and there are no lines after it
+    if (node != NULL && parser->pending_count > 0) {
+        parser->position += strlen(&parser->text[parser->position]);
+        syntax_error(parser, "syntax error: unterminated here-document");
+        script_destroy(parser->env, &node);
+    }
+
+    free_here_documents(parser);
+
+    if (node == NULL) {
+        return NULL;
+    }
+
+    // a line with one command is run the same way as before there were scripts
+    if (node->child_count == 1) {
+        struct script_node *child;
+
+        child = node->children[0];
+        node->children[0] = NULL;
+        script_destroy(parser->env, &node);
+
+        return child;
+    }
+
+    return node;
+}
+
+/*
+ * Commands up to one of the terminators (which is not consumed), or the end of the text if there are none.
+ * A case item also ends at ;;.
+ */
+static struct script_node *parse_list(struct parser *parser, const char **terminators, bool case_item) {
+    struct script_node *node;
+
+    node = create_node(parser, SCRIPT_LIST);
+
+    while (dc_error_has_no_error(parser->err)) {
+        struct script_node *child;
+
+        skip_separators(parser);
+
+        if (parser->text[parser->position] == '\0') {
+            if (terminators != NULL) {
+                syntax_error(parser, "syntax error: unexpected end of file");
+            }
+
+            break;
+        }
+
+        if (terminators != NULL && find_keyword(parser, terminators) != NULL) {
+            break;
+        }
+
+        if (parser->text[parser->position] == ';') {
+            if (!case_item) {
+                syntax_error(parser, "syntax error: unexpected ;;");
+            }
+
+            break;
+        }
+
+        child = parse_script_command(parser);
+        add_child(parser, node, child);
+    }
+
+    if (dc_error_has_error(parser->err)) {
+        script_destroy(parser->env, &node);
+    }
+
+    return node;
+}
+
+static struct script_node *parse_script_command(struct parser *parser) {
+    struct script_node *node;
+    size_t name_length;
+
+    if (find_keyword(parser, reserved_words) != NULL) {
+        syntax_error(parser, "syntax error: unexpected reserved word");
+        return NULL;
+    }
+
+    if (is_keyword(parser, "if")) {
+        parser->position += 2;
+        node = parse_if(parser);
+    } else if (is_keyword(parser, "while")) {
+        node = parse_loop(parser, SCRIPT_WHILE);
+    } else if (is_keyword(parser, "until")) {
+        node = parse_loop(parser, SCRIPT_UNTIL);
+    } else if (is_keyword(parser, "for")) {
+        node = parse_for(parser);
+    } else if (is_keyword(parser, "case")) {
+        node = parse_case(parser);
+    } else if (is_keyword(parser, "{")) {
+        node = parse_group(parser);
+    } else if (is_keyword(parser, "function")) {
+        parser->position += strlen("function");
+        skip_space(parser);
+        name_length = function_name_length(parser, true);
+
+        if (name_length == 0) {
+            syntax_error(parser, "syntax error: bad function name");
+            return NULL;
+        }
+
+        return parse_function(parser, name_length);
+    } else {
+        name_length = function_name_length(parser, false);
+
+        if (name_length > 0) {
+            return parse_function(parser, name_length);
+        }
+
+        return parse_simple_command(parser);
+    }
+
+    end_compound(parser, &node);
+
+    return node;
+}
+
+/*
+ * The text up to the next ; newline or comment is one command, which is split into words now
+ * so running it only has to expand them.
+ */
+static struct script_node *parse_simple_command(struct parser *parser) {
+    struct script_node *node;
+    struct command *command;
+    size_t start;
+    size_t end;
+    bool fatal_error;
+
+    start = parser->position;
+    end = scan_span(parser);
+
+    if (dc_error_has_error(parser->err)) {
+        return NULL;
+    }
+
+    node = create_node(parser, SCRIPT_COMMAND);
+    if (dc_error_has_error(parser->err)) {
+        return NULL;
+    }
+
+    command = dc_calloc(parser->env, parser->err, 1, sizeof(struct command));
+    if (dc_error_has_error(parser->err)) {
+        script_destroy(parser->env, &node);
+        return NULL;
+    }
+
+    node->command = command;
+    command->line = dc_strndup(parser->env, parser->err, &parser->text[start], end - start);
+    find_here_documents(parser, command, start, end);
+
+    if (parser->state == NULL) {
+        return node;
+    }
+
+    // a syntax error is reported like any other, it does not end the shell
+    fatal_error = parser->state->fatal_error;
+    node->words = split_command(parser->env, parser->err, parser->state, command, &node->word_count);
+    parser->state->fatal_error = fatal_error;
+
+    if (dc_error_has_error(parser->err)) {
+        script_destroy(parser->env, &node);
+    }
+
+    return node;
+}
+
+/*
+ * The if (or elif) has been read, an elif is parsed as an if in the otherwise part.
+ */
+static struct script_node *parse_if(struct parser *parser) {
+    struct script_node *node;
+    const char *word;
+
+    node = create_node(parser, SCRIPT_IF);
+    if (dc_error_has_error(parser->err)) {
+        return NULL;
+    }
+
+    node->condition = parse_list(parser, then_words, false);
+    expect_keyword(parser, "then");
+    node->body = parse_list(parser, else_words, false);
+    word = dc_error_has_no_error(parser->err) ? find_keyword(parser, else_words) : NULL;
+
+    if (word != NULL) {
+        parser->position += strlen(word);
+
+        if (strcmp(word, "elif") == 0) {
+            node->otherwise = parse_if(parser);
+        } else if (strcmp(word, "else") == 0) {
+            node->otherwise = parse_list(parser, fi_words, false);
+            expect_keyword(parser, "fi");
+        }
+    }
+
+    if (dc_error_has_error(parser->err)) {
+        script_destroy(parser->env, &node);
+    }
+
+    return node;
+}
+
+static struct script_node *parse_loop(struct parser *parser, enum script_type type) {
+    struct script_node *node;
+
+    parser->position += strlen(type == SCRIPT_WHILE ? "while" : "until");
+    node = create_node(parser, type);
+    if (dc_error_has_error(parser->err)) {
+        return NULL;
+    }
+
+    node->condition = parse_list(parser, do_words, false);
+    expect_keyword(parser, "do");
+    node->body = parse_list(parser, done_words, false);
+    expect_keyword(parser, "done");
+
+    if (dc_error_has_error(parser->err)) {
+        script_destroy(parser->env, &node);
+    }
+
+    return node;
+}
+
+/*
+ * for NAME in words; do ...; done - without the in the words are the positional parameters.
+ */
+static struct script_node *parse_for(struct parser *parser) {
+    struct script_node *node;
+    size_t start;
+
+    parser->position += strlen("for");
+    skip_space(parser);
+    start = parser->position;
+
+    while (variables_is_name(&parser->text[start], parser->position - start + 1)) {
+        parser->position++;
+    }
+
+    if (parser->position == start) {
+        syntax_error(parser, "syntax error: bad for loop variable");
+        return NULL;
+    }
+
+    node = create_node(parser, SCRIPT_FOR);
+    if (dc_error_has_error(parser->err)) {
+        return NULL;
+    }
+
+    node->name = dc_strndup(parser->env, parser->err, &parser->text[start], parser->position - start);
+    skip_space(parser);
+
+    if (dc_error_has_no_error(parser->err) && is_keyword(parser, "in")) {
+        size_t end;
+
+        parser->position += strlen("in");
+        start = parser->position;
+        end = scan_span(parser);
+
+        if (dc_error_has_no_error(parser->err)) {
+            node->words = split_span(parser, start, end, &node->word_count);
+        }
+    }
+
+    skip_separators(parser);
+    expect_keyword(parser, "do");
+    node->body = parse_list(parser, done_words, false);
+    expect_keyword(parser, "done");
+
+    if (dc_error_has_error(parser->err)) {
+        script_destroy(parser->env, &node);
+    }
+
+    return node;
+}
+
+/*
+ * case word in pattern|pattern) commands ;; ... esac
+ */
+static struct script_node *parse_case(struct parser *parser) {
+    struct script_node *node;
+    size_t start;
+
+    parser->position += strlen("case");
+    skip_space(parser);
+    start = parser->position;
+
+    while (parser->text[parser->position] != '\0' && !is_blank(parser->text[parser->position]) &&
+           parser->text[parser->position] != ';') {
+        parser->position = skip_quoted(parser->text, parser->position);
+
+        if (parser->position == SIZE_MAX) {
+            parser->position = start + strlen(&parser->text[start]);
+            syntax_error(parser, "syntax error: unterminated quote");
+            return NULL;
+        }
+    }
+
+    if (parser->position == start) {
+        syntax_error(parser, "syntax error: case needs a word");
+        return NULL;
+    }
+
+    node = create_node(parser, SCRIPT_CASE);
+    if (dc_error_has_error(parser->err)) {
+        return NULL;
+    }
+
+    node->words = split_span(parser, start, parser->position, &node->word_count);
+    skip_separators(parser);
+    expect_keyword(parser, "in");
+
+    while (dc_error_has_no_error(parser->err)) {
+        skip_separators(parser);
+
+        if (is_keyword(parser, "esac")) {
+            parser->position += strlen("esac");
+            break;
+        }
+
+        add_child(parser, node, parse_case_item(parser));
+    }
+
+    if (dc_error_has_error(parser->err)) {
+        script_destroy(parser->env, &node);
+    }
+
+    return node;
+}
+
+static struct script_node *parse_case_item(struct parser *parser) {
+    struct script_node *node;
+    const char *text;
+
+    text = parser->text;
+
+    if (text[parser->position] == '\0') {
+        syntax_error(parser, "syntax error: unexpected end of file");
+        return NULL;
+    }
+
+    node = create_node(parser, SCRIPT_CASE_ITEM);
+    if (dc_error_has_error(parser->err)) {
+        return NULL;
+    }
+
+    if (text[parser->position] == '(') {
+        parser->position++;
+    }
+
+    // the patterns are split at the unquoted | and end at the unquoted )
+    while (dc_error_has_no_error(parser->err)) {
+        size_t start;
+        char **words;
+        size_t count;
+
+        skip_space(parser);
+        start = parser->position;
+
+        while (text[parser->position] != '\0' && !is_blank(text[parser->position]) &&
+               dc_strchr(parser->env, "|);\n", text[parser->position]) == NULL) {
+            parser->position = skip_quoted(text, parser->position);
+
+            if (parser->position == SIZE_MAX) {
+                parser->position = start + strlen(&text[start]);
+                syntax_error(parser, "syntax error: unterminated quote");
+                break;
+            }
+        }
+
+        if (dc_error_has_error(parser->err)) {
+            break;
+        }
+
+        if (parser->position == start) {
+            syntax_error(parser, "syntax error: case needs a pattern");
+            break;
+        }
+
+        words = split_span(parser, start, parser->position, &count);
+        if (dc_error_has_error(parser->err)) {
+            break;
+        }
+
+        node->words = dc_realloc(parser->env, parser->err, node->words, (node->word_count + 2) * sizeof(char *));
+        if (dc_error_has_error(parser->err)) {
+            free_words(parser->env, words, count);
+            break;
+        }
+
+        node->words[node->word_count++] = words[0];
+        node->words[node->word_count] = NULL;
+        dc_free(parser->env, words, (count + 1) * sizeof(char *));
+        skip_space(parser);
+
+        if (text[parser->position] == ')') {
+            parser->position++;
+            break;
+        }
+
+        if (text[parser->position] != '|') {
+            syntax_error(parser, "syntax error: case pattern needs a )");
+            break;
+        }
+
+        parser->position++;
+    }
+
+    if (dc_error_has_no_error(parser->err)) {
+        node->body = parse_list(parser, esac_words, true);
+    }
+
+    if (dc_error_has_no_error(parser->err) && strncmp(&text[parser->position], ";;", 2) == 0) {
+        parser->position += 2;
+    }
+
+    if (dc_error_has_error(parser->err)) {
+        script_destroy(parser->env, &node);
+    }
+
+    return node;
+}
+
+static struct script_node *parse_group(struct parser *parser) {
+    struct script_node *node;
+
+    parser->position++;
+    node = parse_list(parser, group_words, false);
+    expect_keyword(parser, "}");
+
+    if (dc_error_has_error(parser->err)) {
+        script_destroy(parser->env, &node);
+    }
+
+    return node;
+}
+
+/*
+ * NAME() body, where the body is a compound command (usually a { } group).
+ */
+static struct script_node *parse_function(struct parser *parser, size_t name_length) {
+    struct script_node *node;
+    size_t start;
+
+    start = parser->position;
+    parser->position += name_length;
+    skip_space(parser);
+
+    if (parser->text[parser->position] == '(') {
+        parser->position++;
+        skip_space(parser);
+
+        if (parser->text[parser->position] != ')') {
+            syntax_error(parser, "syntax error: expected )");
+            return NULL;
+        }
+
+        parser->position++;
+    }
+
+    node = create_node(parser, SCRIPT_FUNCTION);
+    if (dc_error_has_error(parser->err)) {
+        return NULL;
+    }
+
+    node->name = dc_strndup(parser->env, parser->err, &parser->text[start], name_length);
+    skip_separators(parser);
+
+    if (dc_error_has_no_error(parser->err)) {
+        if (parser->text[parser->position] == '\0') {
+            syntax_error(parser, "syntax error: unexpected end of file");
+        } else {
+            node->body = parse_script_command(parser);
+        }
+    }
+
+    if (dc_error_has_error(parser->err)) {
+        script_destroy(parser->env, &node);
+    }
+
+    return node;
+}
+
+/*
+ * The length of the NAME if the command is NAME() (or the name after function), otherwise 0.
+ */
+static size_t function_name_length(const struct parser *parser, bool keyword) {
+    const char *text;
+    size_t length;
+    size_t i;
+
+    text = &parser->text[parser->position];
+    length = 0;
+
+    while (variables_is_name(text, length + 1)) {
+        length++;
+    }
+
+    // after the function keyword the () is optional
+    if (length == 0 || keyword) {
+        return length;
+    }
+
+    for (i = length; text[i] == ' ' || text[i] == '\t'; i++) {
+    }
+
+    if (text[i] != '(') {
+        return 0;
+    }
+
+    for (i++; text[i] == ' ' || text[i] == '\t'; i++) {
+    }
+
+    return text[i] == ')' ? length : 0;
+}
+
+/*
+ * A compound command has to be followed by a separator (redirecting one is not supported).
+ */
+static void end_compound(struct parser *parser, struct script_node **node) {
+    char c;
+
+    if (*node == NULL) {
+        return;
+    }
+
+    skip_space(parser);
+    c = parser->text[parser->position];
+
+    if (c != '\0' && c != '\n' && c != ';' && c != ')') {
+        syntax_error(parser, "syntax error: unexpected word after compound command");
+        script_destroy(parser->env, node);
+    }
+}
+
+/*
+ * Move past the text of a simple command: up to the unquoted ; or newline or a comment.
+ * Returns the end of the command without the trailing blanks.
+ */
+static size_t scan_span(struct parser *parser) {
+    const char *text;
+    size_t start;
+    size_t i;
+    size_t end;
+
+    text = parser->text;
+    start = parser->position;
+    i = start;
+
+    while (text[i] != '\0' && text[i] != ';' && text[i] != '\n') {
+        if (text[i] == '#' && (i == start || is_blank(text[i - 1]))) {
+            break;
+        }
+
+        i = skip_quoted(text, i);
+
+        if (i == SIZE_MAX) {
+            parser->position = start + strlen(&text[start]);
+            syntax_error(parser, "syntax error: unterminated quote");
+            return start;
+        }
+    }
+
+    end = i;
+
+    while (end > start && is_blank(text[end - 1])) {
+        end--;
+    }
+
+    parser->position = i;
+    skip_space(parser);
+
+    return end;
+}
+
+/*
+ * Each <<WORD or <<-WORD in the command (not <<<word, see split_command) has its body read from the lines
+ * after the current one, when the parser gets to the end of it (see read_here_documents).
+ */
+static void find_here_documents(struct parser *parser, struct command *command, size_t start, size_t end) {
+    const char *text;
+    size_t i;
+
+    text = parser->text;
+    i = start;
+
+    while (i < end && dc_error_has_no_error(parser->err)) {
+        struct here_pending *pending;
+        bool strip_tabs;
+        bool quoted;
+        char *delimiter;
+
+        // like the other redirections, it has to come after a blank
+        if (text[i] != '<' || text[i + 1] != '<' || text[i + 2] == '<' || i == start || !is_blank(text[i - 1])) {
+            i = skip_quoted(text, i);
+
+            if (i == SIZE_MAX) {
+                return;
+            }
+
+            continue;
+        }
+
+        i += 2;
+        strip_tabs = text[i] == '-';
+
+        if (strip_tabs) {
+            i++;
+        }
+
+        while (i < end && is_blank(text[i])) {
+            i++;
+        }
+
+        delimiter = here_delimiter(parser, &i, end, &quoted);
+        if (delimiter == NULL) {
+            return;
+        }
+
+        pending = dc_realloc(parser->env, parser->err, parser->pending,
+                             (parser->pending_count + 1) * sizeof(struct here_pending));
+        if (dc_error_has_error(parser->err)) {
+            dc_free(parser->env, delimiter, strlen(delimiter) + 1);
+            return;
+        }
+
+        parser->pending = pending;
+        pending[parser->pending_count].command = command;
+        pending[parser->pending_count].delimiter = delimiter;
+        pending[parser->pending_count].strip_tabs = strip_tabs;
+        parser->pending_count++;
+        command->here_expand = !quoted;
+    }
+}
+
+/*
+ * The WORD after a << with its quotes removed. If any of it was quoted the body is not expanded.
+ */
+static char *here_delimiter(struct parser *parser, size_t *position, size_t end, bool *quoted) {
+    const char *text;
+    char *delimiter;
+    size_t size;
+    size_t length;
+    size_t i;
+
+    text = parser->text;
+    size = end - *position + 1;
+    delimiter = dc_malloc(parser->env, parser->err, size);
+    if (dc_error_has_error(parser->err)) {
+        return NULL;
+    }
+
+    length = 0;
+    *quoted = false;
+
+    for (i = *position; i < end && !is_blank(text[i]) && dc_strchr(parser->env, ";&|<>()", text[i]) == NULL; i++) {
+        char quote;
+
+        quote = text[i];
+
+        if (quote == '\\' && i + 1 < end) {
+            *quoted = true;
+            i++;
+            delimiter[length++] = text[i];
+        } else if (quote == '\'' || quote == '"') {
+            *quoted = true;
+
+            for (i++; i < end && text[i] != quote; i++) {
+                delimiter[length++] = text[i];
+            }
+        } else {
+            delimiter[length++] = quote;
+        }
+    }
+
+    delimiter[length] = '\0';
+    *position = i;
+
+    if (length == 0 && !*quoted) {
+        dc_free(parser->env, delimiter, size);
+        parser->position = i;
+        syntax_error(parser, "syntax error: missing here-document delimiter");
+        return NULL;
+    }
+
+    // it is freed as a string
+    return dc_realloc(parser->env, parser->err, delimiter, length + 1);
+}
+
+/*
+ * The line with the here-documents has ended: their bodies are the lines that follow, each up to
+ * a line that is just its delimiter.
+ */
+static void read_here_documents(struct parser *parser) {
+    const char *text;
+
+    text = parser->text;
+
+    for (size_t i = 0; i < parser->pending_count && dc_error_has_no_error(parser->err); i++) {
+        struct here_pending *pending;
+        size_t delimiter_length;
+        size_t length;
+        char *body;
+
+        pending = &parser->pending[i];
+        delimiter_length = strlen(pending->delimiter);
+        body = dc_strdup(parser->env, parser->err, "");
+        length = 0;
+
+        while (dc_error_has_no_error(parser->err)) {
+            size_t start;
+            size_t end;
+            char *grown;
+
+            start = parser->position;
+
+            while (pending->strip_tabs && text[start] == '\t') {
+                start++;
+            }
+
+            for (end = start; text[end] != '\0' && text[end] != '\n'; end++) {
+            }
+
+            if (end - start == delimiter_length && strncmp(&text[start], pending->delimiter, delimiter_length) == 0) {
+                parser->position = text[end] == '\n' ? end + 1 : end;
+                break;
+            }
+
+            if (text[end] == '\0') {
+                // more lines can finish it
+                parser->position = end;
+                syntax_error(parser, "syntax error: unterminated here-document");
+                break;
+            }
+
+            grown = dc_realloc(parser->env, parser->err, body, length + (end - start) + 2);
+            if (dc_error_has_error(parser->err)) {
+                break;
+            }
+
+            body = grown;
+            dc_memcpy(parser->env, &body[length], &text[start], end - start + 1);
+            length += end - start + 1;
+            body[length] = '\0';
+            parser->position = end + 1;
+        }
+
+        if (dc_error_has_error(parser->err)) {
+            dc_free(parser->env, body, length + 1);
+            break;
+        }
+
+        // with more than one, the last one is used
+        if (pending->command->here_document != NULL) {
+            dc_free(parser->env, pending->command->here_document, strlen(pending->command->here_document) + 1);
+        }
+
+        pending->command->here_document = body;
+    }
+
+    free_here_documents(parser);
+}
+
+static void free_here_documents(struct parser *parser) {
+    for (size_t i = 0; i < parser->pending_count; i++) {
+        dc_free(parser->env, parser->pending[i].delimiter, strlen(parser->pending[i].delimiter) + 1);
+    }
+
+    if (parser->pending != NULL) {
+        dc_free(parser->env, parser->pending, parser->pending_count * sizeof(struct here_pending));
+    }
+
+    parser->pending = NULL;
+    parser->pending_count = 0;
+}
+
+static char **split_span(struct parser *parser, size_t start, size_t end, size_t *count) {
+    char *span;
+    char **words;
+
+    span = dc_strndup(parser->env, parser->err, &parser->text[start], end - start);
+    if (dc_error_has_error(parser->err)) {
+        return NULL;
+    }
+
+    words = split_words(parser->env, parser->err, span, count);
+    dc_free(parser->env, span, end - start + 1);
+
+    return words;
+}
+
+/*
+ * Skip the blanks and a comment, but not the newline.
+ */
+static void skip_space(struct parser *parser) {
+    const char *text;
+
+    text = parser->text;
+
+    for (;;) {
+        if (text[parser->position] == ' ' || text[parser->position] == '\t') {
+            parser->position++;
+        } else if (text[parser->position] == '\\' && text[parser->position + 1] == '\n') {
+            parser->position += 2;
+        } else if (text[parser->position] == '#') {
+            while (text[parser->position] != '\0' && text[parser->position] != '\n') {
+                parser->position++;
+            }
+        } else {
+            break;
+        }
+    }
+}
+
+/*
+ * Skip the blanks, comments, newlines and ; between commands, but not a ;; that ends a case item.
+ */
+static void skip_separators(struct parser *parser) {
+    for (;;) {
+        skip_space(parser);
+
+        if (parser->text[parser->position] == '\n') {
+            parser->position++;
+            read_here_documents(parser);
+        } else if (parser->text[parser->position] == ';' && parser->text[parser->position + 1] != ';') {
+            parser->position++;
+        } else {
+            break;
+        }
+    }
+}
+
+/*
+ * A reserved word is only recognised as a whole word in the place of a command.
+ */
+static bool is_keyword(struct parser *parser, const char *word) {
+    size_t length;
+    char next;
+
+    skip_space(parser);
+    length = strlen(word);
+
+    if (strncmp(&parser->text[parser->position], word, length) != 0) {
+        return false;
+    }
+
+    next = parser->text[parser->position + length];
+
+    return next == '\0' || is_blank(next) || next == ';';
+}
+
+static const char *find_keyword(struct parser *parser, const char **words) {
+    for (size_t i = 0; words[i] != NULL; i++) {
+        if (is_keyword(parser, words[i])) {
+            return words[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void expect_keyword(struct parser *parser, const char *word) {
+    if (dc_error_has_error(parser->err)) {
+        return;
+    }
+
+    if (!is_keyword(parser, word)) {
+        char message[64];
+
+        if (parser->text[parser->position] == '\0') {
+            syntax_error(parser, "syntax error: unexpected end of file");
+        } else {
+            sprintf(message, "syntax error: expected %s", word);
+            syntax_error(parser, message);
+        }
+
+        return;
+    }
+
+    parser->position += strlen(word);
+}
+
+static void syntax_error(struct parser *parser, const char *message) {
+    if (dc_error_has_error(parser->err)) {
+        return;
+    }
+
+    // more lines can finish the script
+    parser->incomplete = parser->text[parser->position] == '\0';
+    DC_ERROR_RAISE_USER(parser->err, message, EINVAL);
+}
+
+static struct script_node *create_node(struct parser *parser, enum script_type type) {
+    struct script_node *node;
+
+    node = dc_calloc(parser->env, parser->err, 1, sizeof(struct script_node));
+    if (dc_error_has_error(parser->err)) {
+        return NULL;
+    }
+
+    node->type = type;
+    node->references = 1;
+
+    return node;
+}
+
+static void add_child(struct parser *parser, struct script_node *node, struct script_node *child) {
+    struct script_node **children;
+
+    if (child == NULL) {
+        return;
+    }
+
+    if (dc_error_has_error(parser->err)) {
+        script_destroy(parser->env, &child);
+        return;
+    }
+
+    // the script is only parsed once, so growing one at a time does not matter
+    children = dc_realloc(parser->env, parser->err, node->children,
+                          (node->child_count + 1) * sizeof(struct script_node *));
+    if (dc_error_has_error(parser->err)) {
+        script_destroy(parser->env, &child);
+        return;
+    }
+
+    node->children = children;
+    node->children[node->child_count] = child;
+    node->child_count++;
+}
+
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+/*
+ * The words were split when the script was parsed, only the expansion is done each time.
+ */
+static enum script_flow execute_simple(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                       struct script_node *node) {
+    struct command *command;
+    struct command *parsed;
+
+    command = state->command;
+    parsed = node->command;
+    destroy_command(env, command);
+    command->line = dc_strdup(env, err, parsed->line);
+
+    if (dc_error_has_no_error(err)) {
+        copy_redirections(env, err, command, parsed);
+    }
+
+    if (dc_error_has_error(err)) {
+        state->fatal_error = true;
+        return SCRIPT_STOP;
+    }
+
+    expand_command(env, err, state, command, node->words, node->word_count);
+
+    if (dc_error_has_error(err)) {
+        return SCRIPT_STOP;
+    }
+
+    return script_run_command(env, err, state, command);
+}
+
+static enum script_flow execute_list(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                     struct script_node *node) {
+    for (size_t i = 0; i < node->child_count; i++) {
+        enum script_flow flow;
+
+        flow = script_execute(env, err, state, node->children[i]);
+
+        if (flow != SCRIPT_NEXT) {
+            return flow;
+        }
+    }
+
+    return SCRIPT_NEXT;
+}
+
+static enum script_flow execute_if(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                   struct script_node *node) {
+    enum script_flow flow;
+
+    flow = script_execute(env, err, state, node->condition);
+
+    if (flow != SCRIPT_NEXT) {
+        return flow;
+    }
+
+    if (state->exit_code == 0) {
+        return script_execute(env, err, state, node->body);
+    }
+
+    if (node->otherwise != NULL) {
+        return script_execute(env, err, state, node->otherwise);
+    }
+
+    state->exit_code = 0;
+
+    return SCRIPT_NEXT;
+}
+
+/*
+ * while runs the body as long as the condition succeeds, until as long as it fails.
+ * The exit code is the body's last one, or 0 if it never ran.
+ */
+static enum script_flow execute_loop(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                     struct script_node *node) {
+    struct script_context *context;
+    enum script_flow flow;
+    int status;
+
+    context = state->script_context;
+    context->loop_depth++;
+    status = 0;
+
+    for (;;) {
+        flow = script_execute(env, err, state, node->condition);
+
+        if (flow != SCRIPT_NEXT) {
+            if (leave_loop(context, &flow)) {
+                break;
+            }
+
+            continue;
+        }
+
+        if ((state->exit_code == 0) != (node->type == SCRIPT_WHILE)) {
+            break;
+        }
+
+        flow = script_execute(env, err, state, node->body);
+        status = state->exit_code;
+
+        if (leave_loop(context, &flow)) {
+            break;
+        }
+    }
+
+    context->loop_depth--;
+
+    if (flow == SCRIPT_NEXT) {
+        state->exit_code = status;
+    }
+
+    return flow;
+}
+
+/*
+ * The words are expanded once, before the first iteration.
+ */
+static enum script_flow execute_for(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                    struct script_node *node) {
+    struct script_context *context;
+    enum script_flow flow;
+    char **values;
+    size_t count;
+    int status;
+
+    if (node->words == NULL) {
+        count = state->positional_count;
+        values = copy_words(env, err, state->positional, count);
+    } else {
+        values = expand_words(env, err, state, node->words, node->word_count, &count, NULL, NULL);
+    }
+
+    if (dc_error_has_error(err)) {
+        fail_command(err, state);
+        return SCRIPT_STOP;
+    }
+
+    context = state->script_context;
+    context->loop_depth++;
+    flow = SCRIPT_NEXT;
+    status = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        variables_set(env, err, state->variables, node->name, values[i]);
+
+        // a readonly variable fails the loop, not the shell
+        if (dc_error_has_error(err)) {
+            fprintf(state->stderr, "%s: %s\n", node->name, err->message);
+            dc_error_reset(err);
+            status = 1;
+            break;
+        }
+
+        flow = script_execute(env, err, state, node->body);
+        status = state->exit_code;
+
+        if (leave_loop(context, &flow)) {
+            break;
+        }
+    }
+
+    context->loop_depth--;
+    free_words(env, values, count);
+
+    if (flow == SCRIPT_NEXT) {
+        state->exit_code = status;
+    }
+
+    return flow;
+}
+
+/*
+ * The first item with a pattern that matches the word is run, the exit code is 0 if none match.
+ */
+static enum script_flow execute_case(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                     struct script_node *node) {
+    char *word;
+
+    word = expand_string(env, err, state, node->words[0]);
+
+    if (dc_error_has_error(err)) {
+        fail_command(err, state);
+        return SCRIPT_STOP;
+    }
+
+    for (size_t i = 0; i < node->child_count; i++) {
+        struct script_node *item;
+
+        item = node->children[i];
+
+        for (size_t j = 0; j < item->word_count; j++) {
+            char *pattern;
+            bool matched;
+
+            pattern = expand_pattern(env, err, state, item->words[j]);
+
+            if (dc_error_has_error(err)) {
+                dc_free(env, word, strlen(word) + 1);
+                fail_command(err, state);
+                return SCRIPT_STOP;
+            }
+
+            matched = pathname_match(pattern, word);
+            dc_free(env, pattern, strlen(pattern) + 1);
+
+            if (matched) {
+                dc_free(env, word, strlen(word) + 1);
+                state->exit_code = 0;
+
+                return script_execute(env, err, state, item->body);
+            }
+        }
+    }
+
+    dc_free(env, word, strlen(word) + 1);
+    state->exit_code = 0;
+
+    return SCRIPT_NEXT;
+}
+
+/*
+ * The function shares the body with the definition, so the line can be freed after it has run.
+ */
+static enum script_flow define_function(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                        struct script_node *node) {
+    struct script_context *context;
+    struct script_function *function;
+
+    context = state->script_context;
+    function = script_find_function(context, node->name);
+
+    if (function == NULL) {
+        if (context->function_count == context->function_capacity) {
+            struct script_function *functions;
+            size_t capacity;
+
+            capacity = context->function_capacity == 0 ? 8 : context->function_capacity * 2;
+            functions = dc_realloc(env, err, context->functions, capacity * sizeof(struct script_function));
+            if (dc_error_has_error(err)) {
+                state->fatal_error = true;
+                return SCRIPT_STOP;
+            }
+
+            context->functions = functions;
+            context->function_capacity = capacity;
+        }
+
+        function = &context->functions[context->function_count];
+        function->name = dc_strdup(env, err, node->name);
+        if (dc_error_has_error(err)) {
+            state->fatal_error = true;
+            return SCRIPT_STOP;
+        }
+
+        function->body = NULL;
+        context->function_count++;
+    } else {
+        script_destroy(env, &function->body);
+    }
+
+    function->body = node->body;
+    node->body->references++;
+    state->exit_code = 0;
+
+    return SCRIPT_NEXT;
+}
+
+/*
+ * The arguments from argv[first_argument] on become the positional parameters while the body runs
+ * (0 keeps the ones there are). A break or continue can't leave the function, and a return stops at it.
+ */
+static enum script_flow call_function(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                      struct script_node *body, struct command *command, size_t first_argument) {
+    struct script_context *context;
+    enum script_flow flow;
+    char **positional;
+    size_t positional_count;
+    size_t loop_depth;
+    size_t argument_count;
+    struct process_substitution *substitutions;
+    size_t substitution_count;
+
+    context = state->script_context;
+
+    if (context->function_depth >= MAX_FUNCTION_DEPTH) {
+        fprintf(state->stderr, "%s: maximum function nesting level exceeded\n", command->command);
+        command->exit_code = 1;
+        state->exit_code = 1;
+
+        return SCRIPT_NEXT;
+    }
+
+    positional = state->positional;
+    positional_count = state->positional_count;
+
+    if (first_argument == 0) {
+        argument_count = positional_count;
+        state->positional = copy_words(env, err, positional, positional_count);
+    } else {
+        argument_count = command->argc > first_argument ? command->argc - first_argument : 0;
+        state->positional = copy_words(env, err, &command->argv[first_argument], argument_count);
+    }
+
+    if (dc_error_has_error(err)) {
+        state->positional = positional;
+        state->fatal_error = true;
+        return SCRIPT_STOP;
+    }
+
+    state->positional_count = argument_count;
+
+    // the body uses the command for its own commands, the process substitutions are kept apart until it is
+    // done, and are inherited by its programs
+    substitutions = command->substitutions;
+    substitution_count = command->substitution_count;
+    command->substitutions = NULL;
+    command->substitution_count = 0;
+
+    for (size_t i = 0; i < substitution_count; i++) {
+        fcntl(substitutions[i].fd, F_SETFD, 0);
+    }
+
+    // the function could be redefined while it runs
+    body->references++;
+    loop_depth = context->loop_depth;
+    context->loop_depth = 0;
+    context->function_depth++;
+
+    flow = script_execute(env, err, state, body);
+    substitute_finish(env, command);
+    command->substitutions = substitutions;
+    command->substitution_count = substitution_count;
+
+    context->function_depth--;
+    context->loop_depth = loop_depth;
+    script_destroy(env, &body);
+    free_words(env, state->positional, state->positional_count);
+    state->positional = positional;
+    state->positional_count = positional_count;
+
+    if (flow == SCRIPT_RETURN || flow == SCRIPT_BREAK || flow == SCRIPT_CONTINUE) {
+        flow = SCRIPT_NEXT;
+        context->levels = 0;
+    }
+
+    // the body used the command for its own commands, only the exit code is left to set
+    command->exit_code = state->exit_code;
+
+    return flow;
+}
+
+/*
+ * source file [arguments] runs the file like a function: return leaves it, and the arguments (if there are any)
+ * are the positional parameters while it runs. The parsed file is cached, so sourcing it again only
+ * costs a stat until it changes.
+ */
+static enum script_flow source_file(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                                    struct command *command) {
+    struct script_node *script;
+    enum script_flow flow;
+    char *file;
+    char *directory;
+
+    if (command->argc < 2) {
+        fprintf(state->stderr, "%s: filename argument required\n", command->command);
+        command->exit_code = 2;
+        state->exit_code = 2;
+
+        return SCRIPT_NEXT;
+    }
+
+    file = find_file(env, err, state, command->argv[1]);
+    if (dc_error_has_error(err)) {
+        state->fatal_error = true;
+        return SCRIPT_STOP;
+    }
+
+    directory = source_cache_directory(env, err, state);
+    script = NULL;
+
+    if (dc_error_has_no_error(err)) {
+        script = source_cache_load(env, err, state->script_context->sources, state, file, directory);
+    }
+
+    if (directory != NULL) {
+        dc_free(env, directory, strlen(directory) + 1);
+    }
+
+    dc_free(env, file, strlen(file) + 1);
+
+    // a missing file or a syntax error fails the command, not the shell
+    if (script == NULL) {
+        command->exit_code = err->err_code == EINVAL ? 2 : 1;
+        state->exit_code = command->exit_code;
+        fprintf(state->stderr, "%s: %s: %s\n", command->command, command->argv[1], err->message);
+        dc_error_reset(err);
+
+        return SCRIPT_NEXT;
+    }
+
+    flow = call_function(env, err, state, script, command, command->argc > 2 ? 2 : 0);
+    script_destroy(env, &script);
+
+    return flow;
+}
+
+/*
+ * A name without a / is looked for in the PATH, then the working directory.
+ */
+static char *find_file(const struct dc_posix_env *env, struct dc_error *err, struct state *state, const char *name) {
+    if (strchr(name, '/') == NULL) {
+        for (size_t i = 0; state->path != NULL && state->path[i] != NULL; i++) {
+            struct stat status;
+            char *file;
+
+            file = dc_malloc(env, err, strlen(state->path[i]) + 1 + strlen(name) + 1);
+            if (dc_error_has_error(err)) {
+                return NULL;
+            }
+
+            sprintf(file, "%s/%s", state->path[i], name);
+
+            if (stat(file, &status) == 0 && S_ISREG(status.st_mode) && access(file, R_OK) == 0) {
+                return file;
+            }
+
+            dc_free(env, file, strlen(file) + 1);
+        }
+    }
+
+    return dc_strdup(env, err, name);
+}
+
+/*
+ * break [n] and continue [n], outside a loop they do nothing.
+ */
+static enum script_flow loop_control(struct state *state, struct command *command, enum script_flow flow) {
+    struct script_context *context;
+    long levels;
+
+    context = state->script_context;
+    levels = 1;
+
+    if (command->argc > 1 && (!parse_number(command->argv[1], &levels) || levels < 1)) {
+        fprintf(state->stderr, "%s: %s: loop count out of range\n", command->command, command->argv[1]);
+        command->exit_code = 1;
+        state->exit_code = 1;
+
+        return SCRIPT_NEXT;
+    }
+
+    command->exit_code = 0;
+    state->exit_code = 0;
+
+    if (context->loop_depth == 0) {
+        return SCRIPT_NEXT;
+    }
+
+    context->levels = (size_t) levels > context->loop_depth ? context->loop_depth : (size_t) levels;
+
+    return flow;
+}
+
+/*
+ * return [n], the exit code is n or the last command's.
+ */
+static enum script_flow return_from_function(struct state *state, struct command *command) {
+    long status;
+
+    if (state->script_context->function_depth == 0) {
+        fprintf(state->stderr, "return: can only return from a function\n");
+        command->exit_code = 1;
+        state->exit_code = 1;
+
+        return SCRIPT_NEXT;
+    }
+
+    status = state->exit_code;
+
+    if (command->argc > 1 && !parse_number(command->argv[1], &status)) {
+        fprintf(state->stderr, "return: %s: numeric argument required\n", command->argv[1]);
+        status = 2;
+    }
+
+    command->exit_code = (int) (status & 0xFF);
+    state->exit_code = command->exit_code;
+
+    return SCRIPT_RETURN;
+}
+
+/*
+ * After a loop body: true if the loop has to stop, with the flow set to what the loop returns.
+ * A break or continue for more than one loop is passed on to the loop around this one.
+ */
+static bool leave_loop(struct script_context *context, enum script_flow *flow) {
+    switch (*flow) {
+        case SCRIPT_NEXT:
+            return false;
+        case SCRIPT_BREAK:
+            context->levels--;
+
+            if (context->levels == 0) {
+                *flow = SCRIPT_NEXT;
+            }
+
+            return true;
+        case SCRIPT_CONTINUE:
+            context->levels--;
+
+            if (context->levels == 0) {
+                *flow = SCRIPT_NEXT;
+                return false;
+            }
+
+            return true;
+        case SCRIPT_RETURN:
+        case SCRIPT_EXIT:
+        case SCRIPT_STOP:
+        default:
+            return true;
+    }
+}
+
+static bool parse_number(const char *string, long *number) {
+    char *end;
+
+    if (*string == '\0') {
+        return false;
+    }
+
+    *number = strtol(string, &end, 10);
+
+    return *end == '\0';
+}
+
+static char **copy_words(const struct dc_posix_env *env, struct dc_error *err, char **words, size_t count) {
+    char **copy;
+
+    copy = dc_malloc(env, err, (count + 1) * sizeof(char *));
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        copy[i] = dc_strdup(env, err, words[i]);
+
+        if (dc_error_has_error(err)) {
+            free_words(env, copy, i);
+            return NULL;
+        }
+    }
+
+    copy[count] = NULL;
+
+    return copy;
+}
@@ -4,39 +4,35 @@
 #include "shell_impl.h"
 #include <stdlib.h>
 
+/* the transitions as dc_fsm_run wants them */
+static struct dc_fsm_transition transitions[] = {
+#define TRANSITION(from, to, perform) {from, to, perform},
+        SHELL_TRANSITIONS(TRANSITION)
+#undef TRANSITION
+};
+
+/* the same transitions indexed by [from][to], anything not in the list is NULL */
+static const shell_perform dispatch[SHELL_STATE_COUNT][SHELL_STATE_COUNT] = {
+#define TRANSITION(from, to, perform) [from][to] = perform,
+        SHELL_TRANSITIONS(TRANSITION)
+#undef TRANSITION
+};
+
 /**
  * Run the shell FSM.
  *
+ * Built with DC_SHELL_DIRECT_DISPATCH the next function is taken straight from the [from][to] table instead of
+ * having dc_fsm_run search the transitions on every step.
+ *
  * @param env the posix environment.
  * @param error the error object
  * @param in the keyboard (stdin) file
  * @param out the keyboard (stdout) file
  * @param err the keyboard (stderr) file
  *
- * @return the exit code from the shell.
+ * @return the exit code from the shell, not 0 if an error ended it (see handle_error).
  */
 int run_shell(const struct dc_posix_env *env, struct dc_error *error, FILE *in, FILE *out, FILE *err) {
-    static struct dc_fsm_transition transitions[] = {
-            {DC_FSM_INIT, INIT_STATE, init_state},
-            {INIT_STATE, READ_COMMANDS, read_commands},
-            {INIT_STATE, ERROR, handle_error},
-            {READ_COMMANDS, RESET_STATE, reset_state},
-            {READ_COMMANDS, SEPARATE_COMMANDS, separate_commands},
-            {READ_COMMANDS, ERROR, handle_error},
-            {SEPARATE_COMMANDS, PARSE_COMMANDS, parse_commands},
-            {SEPARATE_COMMANDS, ERROR, handle_error},
-            {PARSE_COMMANDS, EXECUTE_COMMANDS, execute_commands},
-            {PARSE_COMMANDS, ERROR, handle_error},
-            {EXECUTE_COMMANDS, RESET_STATE, reset_state},
-            {EXECUTE_COMMANDS, EXIT, do_exit},
-            {EXECUTE_COMMANDS, ERROR, handle_error},
-            {RESET_STATE, READ_COMMANDS, read_commands},
-            {EXIT, DESTROY_STATE, destroy_state},
-            {ERROR, RESET_STATE, reset_state},
-            {ERROR, DESTROY_STATE, destroy_state},
-            {DESTROY_STATE, DC_FSM_EXIT, NULL},
-    };
-
     int ret_val;
     struct dc_fsm_info *fsm_info;
     struct state shell_state;
@@ -54,11 +50,79 @@ int run_shell(const struct dc_posix_env *env, struct dc_error *error, FILE *in,
         int from_state;
         int to_state;
 
+#ifdef DC_SHELL_DIRECT_DISPATCH
+        ret_val = shell_dispatch_run(env, error, dispatch, transitions[0].to_id, &from_state, &to_state,
+                                     &shell_state);
+#else
         ret_val = dc_fsm_run(env, error, fsm_info, &from_state, &to_state, &shell_state, transitions);
+#endif
         dc_fsm_info_destroy(env, &fsm_info);
+
+        if (ret_val == EXIT_SUCCESS) {
+            ret_val = shell_state.exit_status;
+        }
     }
 
     return ret_val;
 }
 
+/**
+ * Look up the function for a transition in the direct dispatch table.
+ *
+ * @param from_state the state being left.
+ * @param to_state the state being entered.
+ *
+ * @return the function, or NULL if there is no such transition (or it is the one to DC_FSM_EXIT).
+ */
+shell_perform shell_transition(int from_state, int to_state) {
+    if(from_state < 0 || from_state >= SHELL_STATE_COUNT || to_state < 0 || to_state >= SHELL_STATE_COUNT)
+    {
+        return NULL;
+    }
+
+    return dispatch[from_state][to_state];
+}
+
+/**
+ * Run the states from a [from][to] table of functions the way dc_fsm_run runs a list of transitions: starting
+ * with the one from DC_FSM_INIT to start_state and stopping when a function returns DC_FSM_EXIT.
+ * run_shell uses it on the shell's own table when built with DC_SHELL_DIRECT_DISPATCH.
+ *
+ * @param env the posix environment.
+ * @param err the error object, passed to the functions.
+ * @param table the functions, NULL where there is no transition.
+ * @param start_state the state to go to from DC_FSM_INIT.
+ * @param from_state set to the last state left.
+ * @param to_state set to the last state entered (DC_FSM_EXIT unless there was no transition to it).
+ * @param arg passed to the functions.
+ * @return 0, or -1 if there is no transition from from_state to to_state (what dc_fsm_run returns).
+ */
+int shell_dispatch_run(const struct dc_posix_env *env, struct dc_error *err,
+                       const shell_perform table[][SHELL_STATE_COUNT], int start_state, int *from_state,
+                       int *to_state, void *arg) {
+    *from_state = DC_FSM_INIT;
+    *to_state = start_state;
+
+    while(*to_state != DC_FSM_EXIT)
+    {
+        shell_perform perform;
 
+        perform = NULL;
+
+        if(*to_state >= 0 && *to_state < SHELL_STATE_COUNT)
+        {
+            perform = table[*from_state][*to_state];
+        }
+
+        // like dc_fsm_run, stop with the states at the missing transition
+        if(perform == NULL)
+        {
+            return -1;
+        }
+
+        *from_state = *to_state;
+        *to_state = perform(env, err, arg);
+    }
+
+    return 0;
+}
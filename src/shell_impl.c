@@ -1,6 +1,7 @@
+#include <stdlib.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <dc_posix/dc_stdlib.h>
-#include <dc_posix/dc_regex.h>
 #include <dc_util/filesystem.h>
 #include <dc_posix/dc_stdio.h>
 #include <dc_posix/dc_string.h>
@@ -8,16 +9,53 @@
 #include "shell_impl.h"
 #include "util.h"
 #include "input.h"
+#include "audit.h"
+#include "batch.h"
 #include "builtins.h"
+#include "copy.h"
+#include "line_editor.h"
+#include "pathname.h"
+#include "script.h"
+#include "startup.h"
+#include "variables.h"
+#include "mem_stats.h"
+#include "posix_direct.h"
+
+#define HISTORY_FILE ".dcshell_history"
+#define HISTORY_CAPACITY 1000
+#define CONTINUATION_PROMPT "> "
+
+extern char **environ;
+
+static struct line_editor *create_line_editor(const struct dc_posix_env *env, struct dc_error *err,
+                                              struct state *state);
+static void variable_changed(const struct dc_posix_env *env, struct dc_error *err, const char *name,
+                             const char *value, void *data);
+static void destroy_path(const struct dc_posix_env *env, char **path);
+static void assign_variables(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                             struct command *command);
+static bool execute_batched(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                            struct command *command);
+static char *read_continuation(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                               char *line);
+static bool is_simple_line(const struct script_node *script, const char *line);
+static bool is_redirected(const struct command *command);
+static bool is_last_line(struct state *state);
+static bool session_timeout(const struct dc_posix_env *env, struct state *state, struct timeout *timeout);
+static void source_startup(const struct dc_posix_env *env, struct dc_error *err, struct state *state);
 
 /**
  * Set up the initial state:
- *  - in_redirect_regex  "[ \t\f\v]<.*"
- *  - out_redirect_regex "[ \t\f\v][1^2]?>[>]?.*"
- *  - err_redirect_regex "[ \t\f\v]2>[>]?.*"
  *  - path the PATH environ var separated into directories
  *  - prompt the PS1 environ var or "$" if PS1 not set
  *  - max_line_length the value of _SC_ARG_MAX (see sysconf)
+ *  - variables the environment, with PATH and PS1 changes updating path and prompt
+ *  - pathname_cache an empty cache of the directories read for pathname expansion
+ *  - script_context no functions defined, and no positional parameters
+ *  - limits no resource limits (see builtin_ulimit)
+ * Then the file named by the ENV variable, if it is set, is sourced.
+ * The history file is not read until it is needed, after the first prompt.
+ * With --verbose the time each part takes is reported (see startup_profile_phase).
  *
  * @param env the posix environment.
  * @param err the error object
@@ -32,58 +70,123 @@ int init_state(const struct dc_posix_env *env, struct dc_error *err, void *arg){
     char *ps1_env_var;
 
     state_arg = (struct state *) arg;
+    mem_stats_state("INIT_STATE");
 
     state_arg->max_line_length = (size_t) sysconf(_SC_ARG_MAX);
 
-    state_arg->in_redirect_regex = dc_malloc(env, err, sizeof (regex_t));
+    path = get_path(env, err);
     if (dc_error_has_error(err)) {
         state_arg->fatal_error = true;
     }
-    state_arg->out_redirect_regex = dc_malloc(env, err, sizeof (regex_t));
+    path_array = parse_path(env, err, path == NULL ? "" : path);
     if (dc_error_has_error(err)) {
         state_arg->fatal_error = true;
     }
-    state_arg->err_redirect_regex = dc_malloc(env, err, sizeof (regex_t));
+    state_arg->path = path_array;
+
+    ps1_env_var = get_prompt(env, err);
     if (dc_error_has_error(err)) {
         state_arg->fatal_error = true;
     }
-    dc_regcomp(env, err, state_arg->in_redirect_regex, "[ \\t\\f\\v]<.*", REG_EXTENDED);
-    if (dc_error_has_error(err)) {
-        state_arg->fatal_error = true;
+    state_arg->prompt = ps1_env_var;
+
+    state_arg->current_line_length = 0;
+    state_arg->current_line = NULL;
+    state_arg->command = NULL;
+    state_arg->fatal_error = false;
+    state_arg->interactive = state_arg->stdin != NULL && isatty(fileno(state_arg->stdin)) == 1;
+    state_arg->exit_status = EXIT_SUCCESS;
+    state_arg->history = NULL;
+    state_arg->editor = NULL;
+    state_arg->exit_code = 0;
+    state_arg->script = NULL;
+    state_arg->last_line = false;
+    state_arg->positional = NULL;
+    state_arg->positional_count = 0;
+    launch_init(&state_arg->limits);
+
+    if (path != NULL) {
+        dc_free(env, path, strlen(path) + 1);
     }
-    dc_regcomp(env, err, state_arg->out_redirect_regex, "[ \\t\\f\\v][1^2]?>[>]?.*", REG_EXTENDED);
+
+    state_arg->pathname_cache = pathname_cache_create(env, err);
     if (dc_error_has_error(err)) {
         state_arg->fatal_error = true;
     }
-    dc_regcomp(env, err, state_arg->err_redirect_regex, "[ \\t\\f\\v]2>[>]?.*", REG_EXTENDED);
+
+    state_arg->script_context = script_context_create(env, err);
     if (dc_error_has_error(err)) {
         state_arg->fatal_error = true;
     }
 
-    path = get_path(env, err);
+    state_arg->variables = variables_create(env, err);
     if (dc_error_has_error(err)) {
         state_arg->fatal_error = true;
+        return READ_COMMANDS;
     }
-    path_array = parse_path(env, err, path);
+
+    variables_import(env, err, state_arg->variables, environ);
     if (dc_error_has_error(err)) {
         state_arg->fatal_error = true;
     }
-    state_arg->path = path_array;
 
-    ps1_env_var = get_prompt(env, err);
+    // the path and prompt are only rebuilt when the variables they come from change
+    variables_set_listener(state_arg->variables, variable_changed, state_arg);
+
+    startup_profile_phase("init_state");
+
+    if (!state_arg->fatal_error) {
+        source_startup(env, err, state_arg);
+    }
+
+    return READ_COMMANDS;
+}
+
+/*
+ * Run ". $ENV" before the first line is read. A problem with the file is reported but doesn't stop the shell.
+ */
+static void source_startup(const struct dc_posix_env *env, struct dc_error *err, struct state *state) {
+    struct command *command;
+    const char *file;
+    char dot[] = ".";
+
+    file = variables_get(env, state->variables, "ENV");
+
+    if (file == NULL || file[0] == '\0') {
+        return;
+    }
+
+    command = dc_calloc(env, err, 1, sizeof(struct command));
     if (dc_error_has_error(err)) {
-        state_arg->fatal_error = true;
+        dc_error_reset(err);
+        return;
     }
-    state_arg->prompt = ps1_env_var;
 
-    state_arg->current_line_length = 0;
-    state_arg->current_line = NULL;
-    state_arg->command = NULL;
-    state_arg->fatal_error = false;
+    command->command = dc_strdup(env, err, dot);
+    command->argv = dc_calloc(env, err, 3, sizeof(char *));
 
-    dc_free(env, path, strlen(path));
+    if (dc_error_has_no_error(err)) {
+        command->argc = 2;
+        command->argv[1] = dc_strdup(env, err, file);
+    }
 
-    return READ_COMMANDS;
+    // the file's commands use the state's command, like the commands of a line
+    state->command = command;
+
+    if (dc_error_has_no_error(err)) {
+        script_run_command(env, err, state, command);
+    }
+
+    if (dc_error_has_error(err)) {
+        fprintf(state->stderr, "%s: %s\n", file, err->message);
+        dc_error_reset(err);
+    }
+
+    destroy_command(env, state->command);
+    dc_free(env, state->command, sizeof(struct command));
+    state->command = NULL;
+    state->fatal_error = false;
+    startup_profile_phase("ENV");
 }
 
 /**
@@ -99,82 +202,69 @@ int destroy_state(const struct dc_posix_env *env, struct dc_error *err,
 
     struct state *state_arg;
     struct command *command;
-    size_t pos;
 
     state_arg = (struct state *) arg;
+    mem_stats_state("DESTROY_STATE");
 
     state_arg->fatal_error = false;
     //dc_free(env, state_arg->command, sizeof(struct command));
     state_arg->current_line_length = 0;
     if (state_arg->current_line != NULL) {
-        dc_free(env, state_arg->current_line, strlen(state_arg->current_line));
+        dc_free(env, state_arg->current_line, strlen(state_arg->current_line) + 1);
     }
     state_arg->max_line_length = 0;
     if (state_arg->prompt != NULL) {
-        dc_free(env, state_arg->prompt, strlen(state_arg->prompt));
+        dc_free(env, state_arg->prompt, strlen(state_arg->prompt) + 1);
     }
-    pos = 0;
     if (state_arg->path != NULL) {
-        while (state_arg->path[pos] != NULL) {
-            pos++;
-        }
-        dc_strs_destroy_array(env, pos, state_arg->path);
-        dc_free(env, state_arg->path, sizeof(char **));
+        destroy_path(env, state_arg->path);
     }
 
-//    dc_free(env, state_arg->err_redirect_regex, sizeof(regex_t));
-//    dc_free(env, state_arg->in_redirect_regex, sizeof(regex_t));
-//    dc_free(env, state_arg->out_redirect_regex, sizeof(regex_t));
-    free(state_arg->err_redirect_regex);
-    free(state_arg->in_redirect_regex);
-    free(state_arg->out_redirect_regex);
-
     command = state_arg->command;
     if (command != NULL) {
-        if (command->line != NULL){
-            dc_free(env, command->line, strlen(command->line));
-        }
-        if (command->command != NULL){
-            dc_free(env, command->command, strlen(command->command));
-        }
-        for (size_t i = 0; i < command->argc; ++i) {
-            if (command->argv[i] != NULL) {
-                dc_free(env, command->argv[i], strlen(command->argv[i]));
-            }
-        }
+        destroy_command(env, command);
+        dc_free(env, command, sizeof(struct command));
+    }
 
-        if (command->stdin_file != NULL){
-            dc_free(env, command->stdin_file, strlen(command->stdin_file));
-        }
-        if (command->stdout_file != NULL){
-            dc_free(env, command->stdout_file, strlen(command->stdout_file));
-        }
 
-        if (command->stderr_file != NULL){
-            dc_free(env, command->stderr_file, strlen(command->stderr_file));
-        }
+    if (state_arg->editor != NULL) {
+        line_editor_destroy(env, &state_arg->editor);
+    }
 
-        dc_free(env, command, sizeof(struct command));
+    if (state_arg->history != NULL) {
+        history_destroy(env, &state_arg->history);
+    }
+
+    if (state_arg->variables != NULL) {
+        variables_destroy(env, &state_arg->variables);
+    }
+
+    if (state_arg->pathname_cache != NULL) {
+        pathname_cache_destroy(env, &state_arg->pathname_cache);
     }
 
+    script_destroy(env, &state_arg->script);
+
+    if (state_arg->script_context != NULL) {
+        script_context_destroy(env, &state_arg->script_context);
+    }
 
     state_arg->command = NULL;
     state_arg->current_line = NULL;
     state_arg->prompt = NULL;
-    state_arg->err_redirect_regex = NULL;
-    state_arg->in_redirect_regex = NULL;
-    state_arg->out_redirect_regex = NULL;
     state_arg->path = NULL;
 
-
-
-
+    // what is still allocated now is a leak (--mem-stats)
+    mem_stats_report(state_arg->stderr);
 
     return DC_FSM_EXIT;
 }
 
 /**
  * Reset the state for the next read (see do_reset_state).
+ * The path, prompt, variables, history and editor are kept for the whole session.
+ * The directory listings and the parsed script are only good for one line, so they are dropped.
+ * The functions the script defined are kept.
  *
  * @param env the posix environment.
  * @param err the error object
@@ -186,16 +276,21 @@ int reset_state(const struct dc_posix_env *env, struct dc_error *err,
     struct state *state_arg;
 
     state_arg = (struct state *) arg;
-
+    mem_stats_state("RESET_STATE");
     do_reset_state(env, err, state_arg);
+    script_destroy(env, &state_arg->script);
 
-    init_state(env, err, state_arg);
+    if (state_arg->pathname_cache != NULL) {
+        pathname_cache_clear(env, state_arg->pathname_cache);
+    }
 
     return READ_COMMANDS;
 }
 
 /**
  * Prompt the user and read the command line (see read_command_line).
+ * If the line starts a script that isn't finished (eg. a while without its done) the next lines are
+ * read with the PS2 prompt and joined with newlines.
  * Sets the state->current_line and current_line_length.
  *
  * @param env the posix environment.
@@ -214,6 +309,7 @@ int read_commands(const struct dc_posix_env *env, struct dc_error *err,
     size_t line_length_of_prompt;
 
     state_arg = (struct state *) arg;
+    mem_stats_state("READ_COMMANDS");
 
     line_length_pointer = &line_length;
 
@@ -234,19 +330,32 @@ int read_commands(const struct dc_posix_env *env, struct dc_error *err,
     sprintf(prompt, "[%s] %s", cwd, state_arg->prompt);
 
     fprintf(state_arg->stdout, "%s", prompt);
-    dc_free(env, prompt, strlen(prompt));
-    dc_free(env, cwd, strlen(cwd));
+    dc_free(env, cwd, strlen(cwd) + 1);
 
     fflush(state_arg->stdout);
 
     if (dc_error_has_error(err))
     {
+        dc_free(env, prompt, line_length_of_prompt);
         state_arg->fatal_error = true;
 
         return ERROR;
     }
 
-    line = read_command_line(env, err, state_arg->stdin, line_length_pointer);
+    if (state_arg->editor == NULL && state_arg->interactive) {
+        state_arg->editor = create_line_editor(env, err, state_arg);
+    }
+
+    startup_profile_finish("first prompt");
+
+    if (state_arg->editor != NULL) {
+        line = line_editor_read(env, err, state_arg->editor, prompt, line_length_pointer);
+    } else {
+        line = read_command_line(env, err, state_arg->stdin, line_length_pointer);
+    }
+
+    dc_free(env, prompt, line_length_of_prompt);
+
     if (dc_error_has_error(err))
     {
         state_arg->fatal_error = true;
@@ -254,6 +363,25 @@ int read_commands(const struct dc_posix_env *env, struct dc_error *err,
         return ERROR;
     }
 
+    // ^D from the editor, or nothing left to read from a file/pipe
+    if (line == NULL) {
+        fprintf(state_arg->stdout, "\n");
+        return EXIT;
+    }
+
+    if (line[0] == '\0' && feof(state_arg->stdin)) {
+        dc_free(env, line, strlen(line) + 1);
+        return EXIT;
+    }
+
+    line = read_continuation(env, err, state_arg, line);
+
+    if (dc_error_has_error(err))
+    {
+        state_arg->fatal_error = true;
+        return ERROR;
+    }
+
     if (state_arg->current_line != NULL) {
 //        dc_free(env, state_arg->current_line, sizeof(state_arg->current_line));
         state_arg->current_line = NULL;
@@ -262,18 +390,112 @@ int read_commands(const struct dc_posix_env *env, struct dc_error *err,
     state_arg->current_line = dc_strdup(env, err, line);
 
     if (dc_strlen(env, line) == 0) {
+        dc_free(env, line, strlen(line) + 1);
         return RESET_STATE;
     }
 
     state_arg->current_line_length = dc_strlen(env, line);
 
-    dc_free(env, line, line_length_of_prompt);
+    dc_free(env, line, strlen(line) + 1);
     return SEPARATE_COMMANDS;
 }
 
+static struct line_editor *create_line_editor(const struct dc_posix_env *env, struct dc_error *err,
+                                              struct state *state) {
+    struct line_editor *editor;
+    char *history_file;
+    char *home;
+
+    home = dc_getenv(env, "HOME");
+    history_file = NULL;
+
+    if (home != NULL) {
+        history_file = dc_malloc(env, err, strlen(home) + 1 + strlen(HISTORY_FILE) + 1);
+        if (dc_error_has_error(err)) {
+            return NULL;
+        }
+
+        sprintf(history_file, "%s/%s", home, HISTORY_FILE);
+    }
+
+    state->history = history_create(env, err, HISTORY_CAPACITY, history_file);
+
+    if (history_file != NULL) {
+        dc_free(env, history_file, strlen(history_file) + 1);
+    }
+
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    // the history file is read when it is first needed (up/down or the first line), after the prompt is up
+    editor = line_editor_create(env, err, fileno(state->stdin), fileno(state->stdout), state->history);
+
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    // the path is replaced when PATH changes so the completer is given where to find it, not the path itself
+    line_editor_set_completer(editor, complete_command_or_file, &state->path);
+
+    return editor;
+}
+
+/*
+ * Keep reading lines until the script is finished, or there is nothing left to read
+ * (then parsing it reports the error).
+ */
+static char *read_continuation(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                               char *line) {
+    while (!script_is_complete(env, line)) {
+        const char *prompt;
+        char *next;
+        char *joined;
+        size_t length;
+
+        prompt = variables_get(env, state->variables, "PS2");
+
+        if (prompt == NULL) {
+            prompt = CONTINUATION_PROMPT;
+        }
+
+        fprintf(state->stdout, "%s", prompt);
+        fflush(state->stdout);
+
+        if (state->editor != NULL) {
+            next = line_editor_read(env, err, state->editor, prompt, &length);
+        } else {
+            next = read_command_line(env, err, state->stdin, &length);
+        }
+
+        if (dc_error_has_error(err) || next == NULL) {
+            return line;
+        }
+
+        if (next[0] == '\0' && feof(state->stdin)) {
+            dc_free(env, next, strlen(next) + 1);
+            return line;
+        }
+
+        joined = dc_malloc(env, err, strlen(line) + 1 + strlen(next) + 1);
+        if (dc_error_has_error(err)) {
+            dc_free(env, next, strlen(next) + 1);
+            return line;
+        }
+
+        sprintf(joined, "%s\n%s", line, next);
+        dc_free(env, line, strlen(line) + 1);
+        dc_free(env, next, strlen(next) + 1);
+        line = joined;
+    }
+
+    return line;
+}
+
 /**
- * Separate the commands. In the current implementation there is only one command.
- * Sets the state->command.
+ * Separate the commands (see script_parse).
+ * Sets the state->command. If the line is more than one simple command (a list, loop, if, case or function)
+ * the parsed script is set in state->script and state->command is used for each command as it runs.
  *
  * @param env the posix environment.
  * @param err the error object
@@ -285,38 +507,17 @@ int separate_commands(const struct dc_posix_env *env, struct dc_error *err,
     struct state *state_arg;
     struct command *command;
     struct command *new_command;
+    struct script_node *script;
 
 
     state_arg = (struct state *) arg;
+    mem_stats_state("SEPARATE_COMMANDS");
 
     command = state_arg->command;
 
     if (command != NULL) {
-        if (command->line != NULL){
-            dc_free(env, command->line, strlen(command->line));
-        }
-        if (command->command != NULL){
-            dc_free(env, command->command, strlen(command->command));
-        }
-        if (command->argv != NULL) {
-            for (int i = 0; command->argv[i]; ++i) {
-                dc_free(env, command->argv[i], strlen(command->argv[i]));
-            }
-            dc_free(env, command->argv, sizeof(char **));
-        }
-
-        if (command->stdin_file != NULL){
-            dc_free(env, command->stdin_file, strlen(command->stdin_file));
-        }
-        if (command->stdout_file != NULL){
-            dc_free(env, command->stdout_file, strlen(command->stdout_file));
-        }
-
-        if (command->stderr_file != NULL){
-            dc_free(env, command->stderr_file, strlen(command->stderr_file));
-        }
+        destroy_command(env, command);
         dc_free(env, command, sizeof(struct command));
-
     }
     command = NULL;
 
@@ -334,25 +535,71 @@ int separate_commands(const struct dc_posix_env *env, struct dc_error *err,
     new_command->line = dc_strdup(env, err, state_arg->current_line);
 //    new_command->line = state_arg->current_line;
 
-//    new_command->command = NULL;
-
+    new_command->command = NULL;
     new_command->argc = 0;
+    new_command->pathname_first = 0;
+    new_command->pathname_end = 0;
     new_command->argv = NULL;
+    new_command->assignment_count = 0;
+    new_command->assignments = NULL;
+    new_command->redirections = NULL;
+    new_command->redirection_count = 0;
     new_command->stdin_file = NULL;
+    new_command->here_document = NULL;
+    new_command->here_string = false;
+    new_command->here_expand = false;
     new_command->stdout_file = NULL;
     new_command->stdout_overwrite = false;
     new_command->stderr_file = NULL;
     new_command->stderr_overwrite = false;
+    new_command->substitutions = NULL;
+    new_command->substitution_count = 0;
+    new_command->launch = NULL;
     new_command->exit_code = 0;
 
+    script = script_parse(env, err, state_arg, state_arg->current_line);
 
+    // a syntax error only fails the line
+    if (dc_error_has_error(err))
+    {
+        return ERROR;
+    }
+
+    if (is_simple_line(script, state_arg->current_line)) {
+        script_destroy(env, &script);
+    }
 
+    state_arg->script = script;
 
     return PARSE_COMMANDS;
 }
 
+/*
+ * A line that is one simple command is parsed and run the way it always was, so the whole
+ * line is the command (a script would stop it at a ; or #).
+ */
+static bool is_simple_line(const struct script_node *script, const char *line) {
+    size_t length;
+
+    if (script->type == SCRIPT_LIST) {
+        return script->child_count == 0;
+    }
+
+    if (script->type != SCRIPT_COMMAND) {
+        return false;
+    }
+
+    length = strlen(line);
+
+    while (length > 0 && (line[length - 1] == ' ' || line[length - 1] == '\t')) {
+        length--;
+    }
+
+    return strlen(script->command->line) == length && strncmp(script->command->line, line, length) == 0;
+}
+
 /**
- * Parse the commands (see parse_command)
+ * Parse the commands (see parse_command), unless the line is a script.
  *
  * @param env the posix environment.
  * @param err the error object
@@ -364,11 +611,18 @@ int parse_commands(const struct dc_posix_env *env, struct dc_error *err,
     struct state *state_arg;
 
     state_arg = (struct state *) arg;
+    mem_stats_state("PARSE_COMMANDS");
+
+    // each command of a script is expanded as it runs
+    if (state_arg->script != NULL) {
+        return EXECUTE_COMMANDS;
+    }
+
     parse_command(env, err, state_arg, state_arg->command);
 
     if (dc_error_has_error(err))
     {
-        state_arg->fatal_error = true;
+        fail_command(err, state_arg);
         return ERROR;
     }
 
@@ -377,39 +631,335 @@ int parse_commands(const struct dc_posix_env *env, struct dc_error *err,
 
 
 /**
- * Run the command (see execute).
- * If the command->command is cd run builtin_cd
+ * Run the command, or the script if the line is one (see script_execute and run_command).
+ * The exit code of the line (the last command run) is displayed.
+ * If there is an audit log (see audit_open) the line, how long it took and what its children used is recorded.
  *
  * @param env the posix environment.
  * @param err the error object
  * @param arg the current struct state
- * @return EXIT (if command->command is exit), RESET_STATE or EXECUTE_ERROR
+ * @return EXIT (if the exit builtin was run), RESET_STATE or EXECUTE_ERROR
  */
 int execute_commands(const struct dc_posix_env *env, struct dc_error *err,
                      void *arg) {
     struct state *state_arg;
+    struct command *command;
+    enum script_flow flow;
+    struct audit_mark mark;
+
     state_arg = (struct state *) arg;
+    mem_stats_state("EXECUTE_COMMANDS");
+    command = state_arg->command;
+    audit_start(&mark);
+
+    if (state_arg->script != NULL) {
+        flow = script_execute(env, err, state_arg, state_arg->script);
+        command->exit_code = state_arg->exit_code;
+    } else {
+        state_arg->last_line = is_last_line(state_arg);
+        flow = script_run_command(env, err, state_arg, command);
+        state_arg->last_line = false;
+    }
 
-    if (dc_strstr(env, state_arg->command->command, "cd") != NULL) {
-        builtin_cd(env, err, state_arg->command, state_arg->stderr);
-    } else if (dc_strstr(env, state_arg->command->command, "exit") != NULL) {
+    audit_command(env, &mark, state_arg->current_line, command->exit_code);
+
+    if (flow == SCRIPT_EXIT) {
         return EXIT;
+    }
+
+    fprintf(state_arg->stdout, "%d\n", command->exit_code);
+    state_arg->exit_code = command->exit_code;
+
+    if (state_arg->fatal_error || flow == SCRIPT_STOP) {
+        return ERROR;
+    }
+
+    return RESET_STATE;
+}
+
+/**
+ * Run a simple command.
+ * If the command->command is :, cd, exec, export, false, ionice, let, nice, pin, readonly, timeout, true,
+ * ulimit, unset or xargs run the builtin.
+ * Every program is run with the resource limits set by ulimit (see state limits).
+ * echo and pwd are builtins too, unless they are redirected.
+ * If there is no command->command the assignments set shell variables, and a < file is copied to the > file.
+ * cat with only files to copy is run in the shell too (see copy_execute), so nothing is forked.
+ * If ARGBATCH is set to a number and the expanded pathnames do not fit in max_line_length the command
+ * is run as many times as it takes, ARGBATCH at a time (0 for one per processor), like xargs, with the
+ * CPUs, nice value and I/O class from BATCH_PIN, BATCH_NICE and BATCH_IONICE (see launch_defaults).
+ * Otherwise the program is run (see execute). On the last line of a script file (see state last_line) it
+ * replaces the shell instead (see execute_replace), which saves the fork and the wait.
+ * If TIMEOUT is set to a duration (see parse_duration) the program is sent SIGTERM when it runs longer than
+ * that, and SIGKILL TIMEOUT_KILL later if that is set too (see execute_timed).
+ *
+ * @param env the posix environment.
+ * @param err the error object
+ * @param state the current state
+ * @param command the command to run
+ * @return true if the command is exit
+ */
+bool run_command(const struct dc_posix_env *env, struct dc_error *err, struct state *state, struct command *command) {
+    if (command->launch == NULL && launch_is_set(&state->limits)) {
+        command->launch = &state->limits;
+    }
+
+    if (command->command == NULL) {
+        assign_variables(env, err, state, command);
+
+        if (command->redirection_count > 0) {
+            int exit_code;
+
+            // the exit code of a command substitution in the assignments is kept, unless the copy fails
+            exit_code = command->exit_code;
+            copy_execute(env, err, command, state->stdout, state->stderr, NULL);
+
+            if (command->exit_code == 0) {
+                command->exit_code = exit_code;
+            }
+        }
+    } else if (dc_strcmp(env, command->command, ":") == 0 || dc_strcmp(env, command->command, "true") == 0) {
+        command->exit_code = 0;
+    } else if (dc_strcmp(env, command->command, "false") == 0) {
+        command->exit_code = 1;
+    } else if (dc_strcmp(env, command->command, "cd") == 0) {
+        builtin_cd(env, err, command, state->stderr);
+
+        // the message has already been displayed, a bad directory only fails the command
+        dc_error_reset(err);
+    } else if (dc_strcmp(env, command->command, "exit") == 0) {
+        return true;
+    } else if (dc_strcmp(env, command->command, "exec") == 0) {
+        builtin_exec(env, err, command, state->path, state->variables, state->stdout, state->stderr);
+    } else if (dc_strcmp(env, command->command, "echo") == 0 && !is_redirected(command)) {
+        builtin_echo(env, err, command, state->stdout);
+    } else if (dc_strcmp(env, command->command, "pwd") == 0 && !is_redirected(command)) {
+        builtin_pwd(env, err, command, state->stdout, state->stderr);
+    } else if (dc_strcmp(env, command->command, "let") == 0) {
+        builtin_let(env, err, command, state->script_context == NULL ? NULL : state->script_context->arithmetic,
+                    state->variables, state->stderr);
+    } else if (dc_strcmp(env, command->command, "export") == 0) {
+        builtin_export(env, err, command, state->variables, state->stdout, state->stderr);
+    } else if (dc_strcmp(env, command->command, "readonly") == 0) {
+        builtin_readonly(env, err, command, state->variables, state->stdout, state->stderr);
+    } else if (dc_strcmp(env, command->command, "unset") == 0) {
+        builtin_unset(env, err, command, state->variables, state->stderr);
+    } else if (dc_strcmp(env, command->command, "timeout") == 0) {
+        builtin_timeout(env, err, command, state->path, state->variables, state->stderr);
+
+        if (dc_error_has_error(err))
+        {
+            state->fatal_error = true;
+        }
+    } else if (dc_strcmp(env, command->command, "pin") == 0 || dc_strcmp(env, command->command, "nice") == 0 ||
+               dc_strcmp(env, command->command, "ionice") == 0) {
+        builtin_launch(env, err, command, state->path, state->variables, state->stdout, state->stderr);
+
+        if (dc_error_has_error(err))
+        {
+            state->fatal_error = true;
+        }
+    } else if (dc_strcmp(env, command->command, "ulimit") == 0) {
+        builtin_ulimit(env, err, command, &state->limits, state->path, state->variables, state->stdout,
+                       state->stderr);
+
+        if (dc_error_has_error(err))
+        {
+            state->fatal_error = true;
+        }
+    } else if (dc_strcmp(env, command->command, "xargs") == 0) {
+        builtin_xargs(env, err, command, state->path, state->variables, state->max_line_length,
+                      state->stdin, state->stderr);
+
+        if (dc_error_has_error(err))
+        {
+            state->fatal_error = true;
+        }
+    } else if (copy_applies(command)) {
+        copy_execute(env, err, command, state->stdout, state->stderr, NULL);
     } else {
-        execute(env, err, state_arg->command, state_arg->path);
+        if (!execute_batched(env, err, state, command)) {
+            struct timeout timeout;
+
+            if (session_timeout(env, state, &timeout)) {
+                execute_timed(env, err, command, state->path, state->variables, &timeout);
+            } else {
+                // nothing is left to run after the last line of a script file, so the program can take the
+                // shell's place
+                // an audited line is recorded after it has run, so the shell has to be there
+                if (state->last_line && state->script_context->function_depth == 0 && !audit_enabled()) {
+                    execute_replace(env, err, command, state->path, state->variables);
+                }
+
+                execute(env, err, command, state->path, state->variables);
+            }
+        }
 
         if (dc_error_has_error(err))
         {
-            state_arg->fatal_error = true;
+            state->fatal_error = true;
         }
     }
 
-    fprintf(state_arg->stdout, "%d\n", state_arg->command->exit_code);
+    return false;
+}
 
-    if (state_arg->fatal_error) {
-        return ERROR;
+/*
+ * echo and pwd are run in the shell unless they are redirected, then the programs are run instead.
+ */
+static bool is_redirected(const struct command *command) {
+    return command->redirection_count > 0;
+}
+
+/*
+ * Only a file can be looked ahead in, a pipe or terminal would wait for the next line.
+ */
+static bool is_last_line(struct state *state) {
+    struct stat input_stat;
+    int c;
+
+    if (state->editor != NULL || fstat(fileno(state->stdin), &input_stat) == -1 || !S_ISREG(input_stat.st_mode)) {
+        return false;
     }
 
-    return RESET_STATE;
+    c = getc(state->stdin);
+
+    if (c == EOF) {
+        return true;
+    }
+
+    ungetc(c, state->stdin);
+
+    return false;
+}
+
+/*
+ * Like ARGBATCH, a TIMEOUT (or TIMEOUT_KILL) that is not a duration is ignored.
+ */
+static bool session_timeout(const struct dc_posix_env *env, struct state *state, struct timeout *timeout) {
+    const char *duration;
+    const char *kill_after;
+
+    duration = variables_get(env, state->variables, "TIMEOUT");
+
+    if (duration == NULL || !parse_duration(duration, &timeout->duration) || timeout->duration == 0) {
+        return false;
+    }
+
+    kill_after = variables_get(env, state->variables, "TIMEOUT_KILL");
+
+    if (kill_after == NULL || !parse_duration(kill_after, &timeout->kill_after)) {
+        timeout->kill_after = 0;
+    }
+
+    return true;
+}
+
+static void assign_variables(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                             struct command *command) {
+    // the exit code is already 0, or the exit code of the last command substitution in the assignments
+    for (size_t i = 0; i < command->assignment_count; i++) {
+        variables_assign(env, err, state->variables, command->assignments[i], false);
+
+        // a readonly variable fails the assignment, not the shell
+        if (dc_error_has_error(err)) {
+            fprintf(state->stderr, "%.*s: %s\n", (int) strcspn(command->assignments[i], "="),
+                    command->assignments[i], err->message);
+            command->exit_code = 1;
+            dc_error_reset(err);
+        }
+    }
+}
+
+/*
+ * Batching is opt in: the output of the runs can interleave, which a single command's cannot.
+ * Only the words from pathname expansion are split, the other arguments are passed to every run.
+ * The exit code is the largest one of the runs.
+ */
+static bool execute_batched(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                            struct command *command) {
+    struct batch_options options;
+    struct batch_result result;
+    struct launch launch;
+    const char *jobs;
+    char *end;
+
+    jobs = variables_get(env, state->variables, "ARGBATCH");
+
+    if (jobs == NULL || *jobs < '0' || *jobs > '9') {
+        return false;
+    }
+
+    options.jobs = strtoul(jobs, &end, 10);
+
+    if (*end != '\0') {
+        return false;
+    }
+
+    if (!batch_needed(env, command, state->path, variables_environ(state->variables), state->max_line_length)) {
+        return false;
+    }
+
+    options.arg_max = state->max_line_length;
+    options.max_bytes = 0;
+    options.max_args = 0;
+    options.launch = launch_defaults(env, state->variables, command->launch, &launch) ? &launch : NULL;
+    batch_execute(env, err, command, command->pathname_first, command->pathname_end, state->path,
+                  state->variables, &options, &result);
+    command->exit_code = result.worst;
+
+    return true;
+}
+
+static void variable_changed(const struct dc_posix_env *env, struct dc_error *err, const char *name,
+                             const char *value, void *data) {
+    struct state *state;
+
+    state = (struct state *) data;
+
+    if (dc_strcmp(env, name, "PATH") == 0) {
+        char **path;
+
+        path = parse_path(env, err, value == NULL ? "" : value);
+        if (dc_error_has_error(err)) {
+            return;
+        }
+
+        if (state->path != NULL) {
+            destroy_path(env, state->path);
+        }
+
+        state->path = path;
+    } else if (dc_strcmp(env, name, "PS1") == 0) {
+        char *prompt;
+
+        prompt = dc_strdup(env, err, value == NULL ? "$ " : value);
+        if (dc_error_has_error(err)) {
+            return;
+        }
+
+        if (state->prompt != NULL) {
+            dc_free(env, state->prompt, strlen(state->prompt) + 1);
+        }
+
+        state->prompt = prompt;
+    }
+}
+
+static void destroy_path(const struct dc_posix_env *env, char **path) {
+    size_t pos;
+
+    pos = 0;
+    while (path[pos] != NULL) {
+        pos++;
+    }
+
+    // freed here rather than by dc_strs_destroy_array so --mem-stats sees them go
+    for (size_t i = 0; i < pos; i++) {
+        dc_free(env, path[i], strlen(path[i]) + 1);
+    }
+
+    dc_free(env, path, (pos + 1) * sizeof(char *));
 }
 
 
@@ -425,6 +975,7 @@ int do_exit(const struct dc_posix_env *env, struct dc_error *err, void *arg) {
     struct state *state_arg;
 
     state_arg = (struct state *) arg;
+    mem_stats_state("EXIT");
     do_reset_state(env, err, state_arg);
     return DESTROY_STATE;
 }
@@ -435,13 +986,15 @@ int do_exit(const struct dc_posix_env *env, struct dc_error *err, void *arg) {
  * @param env the posix environment.
  * @param err the error object
  * @param arg the current struct state
- * @return RESET_STATE or DESTROY_STATE (if state->fatal_error is true)
+ * @return RESET_STATE or DESTROY_STATE (if state->fatal_error is true, the shell's exit_status is then the
+ *         state->exit_code, or EXIT_FAILURE if that is 0)
  */
 int handle_error(const struct dc_posix_env *env, struct dc_error *err,
                  void *arg) {
     struct state *state_arg;
 
     state_arg = (struct state *) arg;
+    mem_stats_state("ERROR");
 
 
     if (state_arg->current_line == NULL) {
@@ -455,6 +1008,9 @@ int handle_error(const struct dc_posix_env *env, struct dc_error *err,
 
 
     if (state_arg->fatal_error) {
+        // the shell's own exit status says why it stopped
+        state_arg->exit_status = state_arg->exit_code != 0 ? state_arg->exit_code : EXIT_FAILURE;
+
         return DESTROY_STATE;
     }
 
@@ -0,0 +1,1025 @@
+#include <dc_posix/dc_stdlib.h>
+#include <dc_posix/dc_string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "expand.h"
+#include "mem_stats.h"
+#include "source.h"
+#include "variables.h"
+
+#define CACHE_MAGIC "DCSC"
+#define CACHE_VERSION 4
+// the length and hash after the script
+#define TRAILER_SIZE 16
+#define CACHE_SUFFIX ".dcs"
+#define CACHE_DIRECTORY "dcshell"
+#define NO_STRING UINT32_MAX
+#define MAX_STRING_LENGTH (1U << 24)
+#define MAX_DEPTH 1000
+#define FNV_OFFSET UINT64_C(14695981039346656037)
+#define FNV_PRIME UINT64_C(1099511628211)
+
+static void make_key(const struct stat *status, struct source_key *key);
+static bool same_key(const struct source_key *a, const struct source_key *b);
+static struct source_entry *find_entry(struct source_cache *cache, const char *path);
+static void remember(const struct dc_posix_env *env, struct dc_error *err, struct source_cache *cache,
+                     const char *path, const struct source_key *key, struct script_node *script);
+static char *read_file(const struct dc_posix_env *env, struct dc_error *err, const char *path,
+                       struct source_key *key);
+static uint64_t hash_bytes(const char *bytes, size_t length);
+static char *cache_file_name(const struct dc_posix_env *env, struct dc_error *err, const char *directory,
+                             const char *path);
+static struct script_node *load_saved(const struct dc_posix_env *env, struct dc_error *err, const char *file_name,
+                                      const char *path, const struct source_key *key);
+static void save(const struct dc_posix_env *env, struct dc_error *err, const char *directory, const char *file_name,
+                 const char *path, const struct source_key *key, const struct script_node *script);
+static struct script_node *read_script(const struct dc_posix_env *env, struct dc_error *err, FILE *file,
+                                       const char *path, const struct source_key *key);
+static char *read_checked(FILE *file, size_t *size);
+static uint64_t decode_u64(const char *bytes);
+static bool write_u32(FILE *file, uint32_t value);
+static bool write_u64(FILE *file, uint64_t value);
+static bool write_string(FILE *file, const char *string);
+static bool write_words(FILE *file, char **words, size_t count);
+static bool write_redirections(FILE *file, const struct command *command);
+static bool write_node(FILE *file, const struct script_node *node);
+static bool read_u32(FILE *file, uint32_t *value);
+static bool read_u64(FILE *file, uint64_t *value);
+static bool read_string(const struct dc_posix_env *env, struct dc_error *err, FILE *file, char **string);
+static bool read_words(const struct dc_posix_env *env, struct dc_error *err, FILE *file, char ***words,
+                       size_t *count);
+static bool read_redirections(const struct dc_posix_env *env, struct dc_error *err, FILE *file,
+                              struct command *command);
+static bool read_node(const struct dc_posix_env *env, struct dc_error *err, FILE *file, size_t depth,
+                      struct script_node **pnode);
+static bool is_complete(const struct script_node *node);
+
+/**
+ * Create an empty cache.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @return the cache (free with source_cache_destroy).
+ */
+struct source_cache *source_cache_create(const struct dc_posix_env *env, struct dc_error *err) {
+    return dc_calloc(env, err, 1, sizeof(struct source_cache));
+}
+
+/**
+ * Free the cache and the scripts in it and set it to NULL.
+ *
+ * @param env the posix environment.
+ * @param pcache the cache to destroy.
+ */
+void source_cache_destroy(const struct dc_posix_env *env, struct source_cache **pcache) {
+    struct source_cache *cache;
+
+    cache = *pcache;
+
+    for (size_t i = 0; i < cache->count; i++) {
+        dc_free(env, cache->entries[i].path, strlen(cache->entries[i].path) + 1);
+        script_destroy(env, &cache->entries[i].script);
+    }
+
+    if (cache->entries != NULL) {
+        dc_free(env, cache->entries, cache->capacity * sizeof(struct source_entry));
+    }
+
+    dc_free(env, cache, sizeof(struct source_cache));
+    *pcache = NULL;
+}
+
+/**
+ * Get the parsed script in a file. The file is only read and parsed if it has changed (see source_key)
+ * since it was last parsed, by this shell or, when directory is not NULL, by any shell sharing the directory.
+ *
+ * @param env the posix environment.
+ * @param err the error object, with the errno if the file can't be read or EINVAL for a syntax error.
+ * @param cache the cache.
+ * @param state the current state, for parsing the script.
+ * @param path the file.
+ * @param directory where parsed scripts are saved, or NULL to only keep them in memory.
+ * @return the script (release it with script_destroy), NULL on error.
+ */
+struct script_node *source_cache_load(const struct dc_posix_env *env, struct dc_error *err,
+                                      struct source_cache *cache, struct state *state, const char *path,
+                                      const char *directory) {
+    struct source_entry *entry;
+    struct script_node *script;
+    struct source_key key;
+    struct stat status;
+    char *real_path;
+    char *file_name;
+    char *text;
+
+    // the same file can be sourced by different names, and a relative name depends on the directory
+    real_path = realpath(path, NULL);
+
+    if (real_path == NULL || stat(real_path, &status) == -1) {
+        DC_ERROR_RAISE_USER(err, strerror(errno), errno);
+        free(real_path);
+        return NULL;
+    }
+
+    make_key(&status, &key);
+    entry = find_entry(cache, real_path);
+
+    if (entry != NULL && same_key(&entry->key, &key)) {
+        free(real_path);
+        cache->hits++;
+        entry->script->references++;
+
+        return entry->script;
+    }
+
+    file_name = NULL;
+    script = NULL;
+
+    if (directory != NULL) {
+        file_name = cache_file_name(env, err, directory, real_path);
+
+        if (file_name != NULL) {
+            script = load_saved(env, err, file_name, real_path, &key);
+        }
+    }
+
+    if (script != NULL) {
+        cache->disk_hits++;
+    } else if (dc_error_has_no_error(err)) {
+        // the key is taken from the open file, so a change while it is read is seen next time
+        text = read_file(env, err, real_path, &key);
+
+        if (text != NULL) {
+            script = script_parse(env, err, state, text);
+            dc_free(env, text, strlen(text) + 1);
+        }
+
+        if (script != NULL) {
+            cache->misses++;
+
+            if (file_name != NULL) {
+                save(env, err, directory, file_name, real_path, &key, script);
+            }
+        }
+    }
+
+    if (script != NULL) {
+        remember(env, err, cache, real_path, &key, script);
+    }
+
+    if (file_name != NULL) {
+        dc_free(env, file_name, strlen(file_name) + 1);
+    }
+
+    free(real_path);
+
+    return script;
+}
+
+/**
+ * Get the directory parsed scripts are saved in: $XDG_CACHE_HOME/dcshell or ~/.cache/dcshell.
+ * SOURCECACHE=memory keeps them in memory only.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param state the current state, for the variables.
+ * @return the directory (free with dc_free), NULL for none.
+ */
+char *source_cache_directory(const struct dc_posix_env *env, struct dc_error *err, struct state *state) {
+    const char *mode;
+    const char *base;
+    const char *home;
+    char *directory;
+
+    mode = variables_get(env, state->variables, "SOURCECACHE");
+
+    if (mode != NULL && strcmp(mode, "memory") == 0) {
+        return NULL;
+    }
+
+    base = variables_get(env, state->variables, "XDG_CACHE_HOME");
+
+    if (base != NULL && base[0] == '/') {
+        directory = dc_malloc(env, err, strlen(base) + 1 + strlen(CACHE_DIRECTORY) + 1);
+
+        if (directory != NULL) {
+            sprintf(directory, "%s/%s", base, CACHE_DIRECTORY);
+        }
+
+        return directory;
+    }
+
+    home = variables_get(env, state->variables, "HOME");
+
+    if (home == NULL || home[0] != '/') {
+        return NULL;
+    }
+
+    directory = dc_malloc(env, err, strlen(home) + strlen("/.cache/") + strlen(CACHE_DIRECTORY) + 1);
+
+    if (directory != NULL) {
+        sprintf(directory, "%s/.cache/%s", home, CACHE_DIRECTORY);
+    }
+
+    return directory;
+}
+
+/**
+ * Save a parsed script in the compact binary form source_cache_read reads. It is followed by its length and
+ * an FNV-1a hash of it, so a file that was cut short or damaged is not read.
+ *
+ * @param file where to write it.
+ * @param path the real path of the script.
+ * @param key the file the script was parsed from.
+ * @param script the script.
+ * @return true if it was all written.
+ */
+bool source_cache_write(FILE *file, const char *path, const struct source_key *key,
+                        const struct script_node *script) {
+    FILE *stream;
+    char *data;
+    size_t size;
+    bool written;
+
+    // the hash needs all of it, so it is put together in memory first
+    data = NULL;
+    size = 0;
+    stream = open_memstream(&data, &size);
+
+    if (stream == NULL) {
+        return false;
+    }
+
+    written = fwrite(CACHE_MAGIC, 1, strlen(CACHE_MAGIC), stream) == strlen(CACHE_MAGIC) &&
+              write_u32(stream, CACHE_VERSION) &&
+              write_u64(stream, key->device) &&
+              write_u64(stream, key->inode) &&
+              write_u64(stream, (uint64_t) key->mtime_seconds) &&
+              write_u64(stream, (uint64_t) key->mtime_nanoseconds) &&
+              write_u64(stream, (uint64_t) key->size) &&
+              write_string(stream, path) &&
+              write_node(stream, script);
+    written = fclose(stream) == 0 && written &&
+              fwrite(data, 1, size, file) == size &&
+              write_u64(file, (uint64_t) size) &&
+              write_u64(file, hash_bytes(data, size));
+    free(data);
+
+    return written;
+}
+
+/**
+ * Read a script saved by source_cache_write, if it was saved for the same file. A file whose length or hash
+ * does not match, or with a node that is missing what it needs to run (eg. an if without a condition), is damaged.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param file where to read it from.
+ * @param path the real path of the script.
+ * @param key the file as it is now.
+ * @return the script (free with script_destroy), NULL if it is for a different or changed file or is damaged.
+ */
+struct script_node *source_cache_read(const struct dc_posix_env *env, struct dc_error *err, FILE *file,
+                                      const char *path, const struct source_key *key) {
+    struct script_node *script;
+    FILE *stream;
+    char *data;
+    size_t size;
+
+    data = read_checked(file, &size);
+
+    if (data == NULL) {
+        return NULL;
+    }
+
+    script = NULL;
+    stream = fmemopen(data, size, "rb");
+
+    if (stream != NULL) {
+        script = read_script(env, err, stream, path, key);
+        fclose(stream);
+    }
+
+    free(data);
+
+    return script;
+}
+
+static struct script_node *read_script(const struct dc_posix_env *env, struct dc_error *err, FILE *file,
+                                       const char *path, const struct source_key *key) {
+    char magic[sizeof(CACHE_MAGIC)];
+    struct source_key saved;
+    struct script_node *script;
+    char *saved_path;
+    uint32_t version;
+    bool same;
+
+    if (fread(magic, 1, strlen(CACHE_MAGIC), file) != strlen(CACHE_MAGIC) ||
+        memcmp(magic, CACHE_MAGIC, strlen(CACHE_MAGIC)) != 0 ||
+        !read_u32(file, &version) || version != CACHE_VERSION ||
+        !read_u64(file, &saved.device) ||
+        !read_u64(file, &saved.inode) ||
+        !read_u64(file, (uint64_t *) &saved.mtime_seconds) ||
+        !read_u64(file, (uint64_t *) &saved.mtime_nanoseconds) ||
+        !read_u64(file, (uint64_t *) &saved.size) ||
+        !same_key(&saved, key)) {
+        return NULL;
+    }
+
+    // two paths can hash to the same cache file
+    if (!read_string(env, err, file, &saved_path) || saved_path == NULL) {
+        return NULL;
+    }
+
+    same = strcmp(saved_path, path) == 0;
+    dc_free(env, saved_path, strlen(saved_path) + 1);
+
+    if (!same || !read_node(env, err, file, 0, &script)) {
+        return NULL;
+    }
+
+    // the hash matched, but what it covers has to be exactly the script
+    if (script == NULL || fgetc(file) != EOF) {
+        script_destroy(env, &script);
+        return NULL;
+    }
+
+    return script;
+}
+
+/*
+ * The whole file, if the length and hash at the end are right for the rest of it (free with free).
+ */
+static char *read_checked(FILE *file, size_t *size) {
+    char buffer[4096];
+    FILE *stream;
+    char *data;
+    size_t total;
+    size_t count;
+    bool ok;
+
+    data = NULL;
+    total = 0;
+    stream = open_memstream(&data, &total);
+
+    if (stream == NULL) {
+        return NULL;
+    }
+
+    ok = true;
+
+    while (ok && (count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        ok = fwrite(buffer, 1, count, stream) == count;
+    }
+
+    ok = fclose(stream) == 0 && ok && !ferror(file) && total > TRAILER_SIZE;
+
+    if (ok) {
+        *size = total - TRAILER_SIZE;
+        ok = decode_u64(&data[*size]) == *size && decode_u64(&data[*size + 8]) == hash_bytes(data, *size);
+    }
+
+    if (!ok) {
+        free(data);
+        return NULL;
+    }
+
+    return data;
+}
+
+static void make_key(const struct stat *status, struct source_key *key) {
+    key->device = (uint64_t) status->st_dev;
+    key->inode = (uint64_t) status->st_ino;
+    key->mtime_seconds = (int64_t) status->st_mtim.tv_sec;
+    key->mtime_nanoseconds = (int64_t) status->st_mtim.tv_nsec;
+    key->size = (int64_t) status->st_size;
+}
+
+static bool same_key(const struct source_key *a, const struct source_key *b) {
+    return a->device == b->device && a->inode == b->inode && a->mtime_seconds == b->mtime_seconds &&
+           a->mtime_nanoseconds == b->mtime_nanoseconds && a->size == b->size;
+}
+
+static struct source_entry *find_entry(struct source_cache *cache, const char *path) {
+    for (size_t i = 0; i < cache->count; i++) {
+        if (strcmp(cache->entries[i].path, path) == 0) {
+            return &cache->entries[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * The cache keeps its own reference, the caller's is the one that was passed in.
+ */
+static void remember(const struct dc_posix_env *env, struct dc_error *err, struct source_cache *cache,
+                     const char *path, const struct source_key *key, struct script_node *script) {
+    struct source_entry *entry;
+
+    entry = find_entry(cache, path);
+
+    if (entry == NULL) {
+        if (cache->count == cache->capacity) {
+            struct source_entry *entries;
+            size_t capacity;
+
+            capacity = cache->capacity == 0 ? 8 : cache->capacity * 2;
+            entries = dc_realloc(env, err, cache->entries, capacity * sizeof(struct source_entry));
+            if (dc_error_has_error(err)) {
+                return;
+            }
+
+            cache->entries = entries;
+            cache->capacity = capacity;
+        }
+
+        entry = &cache->entries[cache->count];
+        entry->path = dc_strdup(env, err, path);
+        if (dc_error_has_error(err)) {
+            return;
+        }
+
+        entry->script = NULL;
+        cache->count++;
+    } else {
+        script_destroy(env, &entry->script);
+    }
+
+    entry->key = *key;
+    entry->script = script;
+    script->references++;
+}
+
+static char *read_file(const struct dc_posix_env *env, struct dc_error *err, const char *path,
+                       struct source_key *key) {
+    struct stat status;
+    char *text;
+    size_t length;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1 || fstat(fd, &status) == -1) {
+        DC_ERROR_RAISE_USER(err, strerror(errno), errno);
+
+        if (fd != -1) {
+            close(fd);
+        }
+
+        return NULL;
+    }
+
+    if (S_ISDIR(status.st_mode)) {
+        DC_ERROR_RAISE_USER(err, strerror(EISDIR), EISDIR);
+        close(fd);
+        return NULL;
+    }
+
+    make_key(&status, key);
+    text = dc_malloc(env, err, (size_t) status.st_size + 1);
+    if (dc_error_has_error(err)) {
+        close(fd);
+        return NULL;
+    }
+
+    length = 0;
+
+    while (length < (size_t) status.st_size) {
+        ssize_t count;
+
+        count = read(fd, &text[length], (size_t) status.st_size - length);
+
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+
+        if (count <= 0) {
+            break;
+        }
+
+        length += (size_t) count;
+    }
+
+    close(fd);
+
+    // a file that shrank while it was read is parsed as far as it got, and the key won't match next time
+    text[length] = '\0';
+
+    return text;
+}
+
+static uint64_t hash_bytes(const char *bytes, size_t length) {
+    uint64_t hash;
+
+    hash = FNV_OFFSET;
+
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char) bytes[i]) * FNV_PRIME;
+    }
+
+    return hash;
+}
+
+/*
+ * One file per script, named for an FNV-1a hash of its path.
+ */
+static char *cache_file_name(const struct dc_posix_env *env, struct dc_error *err, const char *directory,
+                             const char *path) {
+    uint64_t hash;
+    char *file_name;
+
+    hash = hash_bytes(path, strlen(path));
+    file_name = dc_malloc(env, err, strlen(directory) + 1 + 16 + strlen(CACHE_SUFFIX) + 1);
+
+    if (file_name != NULL) {
+        sprintf(file_name, "%s/%016" PRIx64 "%s", directory, hash, CACHE_SUFFIX);
+    }
+
+    return file_name;
+}
+
+static struct script_node *load_saved(const struct dc_posix_env *env, struct dc_error *err, const char *file_name,
+                                      const char *path, const struct source_key *key) {
+    struct script_node *script;
+    FILE *file;
+
+    file = fopen(file_name, "rb");
+
+    if (file == NULL) {
+        return NULL;
+    }
+
+    script = source_cache_read(env, err, file, path, key);
+    fclose(file);
+
+    // one that is out of date or damaged is replaced when the script is saved, unless it no longer parses
+    if (script == NULL && dc_error_has_no_error(err)) {
+        unlink(file_name);
+    }
+
+    return script;
+}
+
+/*
+ * Written to a temporary file that is renamed into place, so another shell never reads half a script.
+ * Not being able to save the script should not stop it being run.
+ */
+static void save(const struct dc_posix_env *env, struct dc_error *err, const char *directory, const char *file_name,
+                 const char *path, const struct source_key *key, const struct script_node *script) {
+    char *parent;
+    char *temporary;
+    FILE *file;
+    bool written;
+    int fd;
+
+    if (mkdir(directory, S_IRWXU) == -1 && errno == ENOENT) {
+        // ~/.cache may not be there yet
+        parent = dc_strdup(env, err, directory);
+        if (dc_error_has_error(err)) {
+            return;
+        }
+
+        *strrchr(parent, '/') = '\0';
+        mkdir(parent, S_IRWXU);
+        dc_free(env, parent, strlen(directory) + 1);
+        mkdir(directory, S_IRWXU);
+    }
+
+    temporary = dc_malloc(env, err, strlen(file_name) + strlen(".XXXXXX") + 1);
+    if (dc_error_has_error(err)) {
+        return;
+    }
+
+    sprintf(temporary, "%s.XXXXXX", file_name);
+    fd = mkstemp(temporary);
+
+    if (fd == -1) {
+        dc_free(env, temporary, strlen(temporary) + 1);
+        return;
+    }
+
+    file = fdopen(fd, "wb");
+
+    if (file == NULL) {
+        close(fd);
+        unlink(temporary);
+        dc_free(env, temporary, strlen(temporary) + 1);
+        return;
+    }
+
+    written = source_cache_write(file, path, key, script);
+
+    if (fclose(file) != 0 || !written || rename(temporary, file_name) == -1) {
+        unlink(temporary);
+    }
+
+    dc_free(env, temporary, strlen(temporary) + 1);
+}
+
+/*
+ * The numbers are little endian, whatever the machine, so the format is the same everywhere.
+ */
+static bool write_u32(FILE *file, uint32_t value) {
+    unsigned char bytes[4];
+
+    for (size_t i = 0; i < sizeof(bytes); i++) {
+        bytes[i] = (unsigned char) (value >> (8 * i));
+    }
+
+    return fwrite(bytes, 1, sizeof(bytes), file) == sizeof(bytes);
+}
+
+static bool write_u64(FILE *file, uint64_t value) {
+    return write_u32(file, (uint32_t) value) && write_u32(file, (uint32_t) (value >> 32));
+}
+
+static bool write_string(FILE *file, const char *string) {
+    size_t length;
+
+    if (string == NULL) {
+        return write_u32(file, NO_STRING);
+    }
+
+    length = strlen(string);
+
+    return write_u32(file, (uint32_t) length) && fwrite(string, 1, length, file) == length;
+}
+
+static bool write_words(FILE *file, char **words, size_t count) {
+    if (words == NULL) {
+        return write_u32(file, NO_STRING);
+    }
+
+    if (!write_u32(file, (uint32_t) count)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (!write_string(file, words[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * The count, then each redirection's fd, type, target and source (-1 is saved as 0xffffffff).
+ */
+static bool write_redirections(FILE *file, const struct command *command) {
+    if (!write_u32(file, (uint32_t) command->redirection_count)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < command->redirection_count; i++) {
+        const struct redirection *redirection;
+
+        redirection = &command->redirections[i];
+
+        if (!write_u32(file, (uint32_t) redirection->fd) ||
+            !write_u32(file, (uint32_t) redirection->type) ||
+            !write_string(file, redirection->target) ||
+            !write_u32(file, (uint32_t) redirection->source)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * A node is a presence byte, then its type and each field. A simple command is saved already split
+ * into words, so loading it needs no lexing.
+ */
+static bool write_node(FILE *file, const struct script_node *node) {
+    const struct command *command;
+
+    if (node == NULL) {
+        return fputc(0, file) != EOF;
+    }
+
+    if (fputc(1, file) == EOF || !write_u32(file, (uint32_t) node->type)) {
+        return false;
+    }
+
+    command = node->command;
+
+    if (command == NULL) {
+        if (fputc(0, file) == EOF) {
+            return false;
+        }
+    } else if (fputc(1, file) == EOF ||
+               !write_string(file, command->line) ||
+               !write_string(file, command->stdin_file) ||
+               !write_string(file, command->stdout_file) ||
+               fputc(command->stdout_overwrite, file) == EOF ||
+               !write_string(file, command->stderr_file) ||
+               fputc(command->stderr_overwrite, file) == EOF ||
+               !write_redirections(file, command) ||
+               !write_string(file, command->here_document) ||
+               fputc(command->here_string, file) == EOF ||
+               fputc(command->here_expand, file) == EOF) {
+        return false;
+    }
+
+    if (!write_words(file, node->words, node->word_count) ||
+        !write_string(file, node->name) ||
+        !write_node(file, node->condition) ||
+        !write_node(file, node->body) ||
+        !write_node(file, node->otherwise) ||
+        !write_u32(file, (uint32_t) node->child_count)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < node->child_count; i++) {
+        if (!write_node(file, node->children[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static uint64_t decode_u64(const char *bytes) {
+    uint64_t value;
+
+    value = 0;
+
+    for (size_t i = 0; i < 8; i++) {
+        value |= (uint64_t) (unsigned char) bytes[i] << (8 * i);
+    }
+
+    return value;
+}
+
+static bool read_u32(FILE *file, uint32_t *value) {
+    unsigned char bytes[4];
+
+    if (fread(bytes, 1, sizeof(bytes), file) != sizeof(bytes)) {
+        return false;
+    }
+
+    *value = 0;
+
+    for (size_t i = 0; i < sizeof(bytes); i++) {
+        *value |= (uint32_t) bytes[i] << (8 * i);
+    }
+
+    return true;
+}
+
+static bool read_u64(FILE *file, uint64_t *value) {
+    uint32_t low;
+    uint32_t high;
+
+    if (!read_u32(file, &low) || !read_u32(file, &high)) {
+        return false;
+    }
+
+    *value = (uint64_t) high << 32 | low;
+
+    return true;
+}
+
+static bool read_string(const struct dc_posix_env *env, struct dc_error *err, FILE *file, char **string) {
+    uint32_t length;
+
+    *string = NULL;
+
+    if (!read_u32(file, &length)) {
+        return false;
+    }
+
+    if (length == NO_STRING) {
+        return true;
+    }
+
+    if (length > MAX_STRING_LENGTH) {
+        return false;
+    }
+
+    *string = dc_malloc(env, err, length + 1);
+    if (dc_error_has_error(err)) {
+        return false;
+    }
+
+    if (fread(*string, 1, length, file) != length || memchr(*string, '\0', length) != NULL) {
+        dc_free(env, *string, length + 1);
+        *string = NULL;
+        return false;
+    }
+
+    (*string)[length] = '\0';
+
+    return true;
+}
+
+static bool read_words(const struct dc_posix_env *env, struct dc_error *err, FILE *file, char ***words,
+                       size_t *count) {
+    uint32_t saved_count;
+
+    *words = NULL;
+    *count = 0;
+
+    if (!read_u32(file, &saved_count)) {
+        return false;
+    }
+
+    if (saved_count == NO_STRING) {
+        return true;
+    }
+
+    if (saved_count > MAX_STRING_LENGTH) {
+        return false;
+    }
+
+    *words = dc_calloc(env, err, saved_count + 1, sizeof(char *));
+    if (dc_error_has_error(err)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < saved_count; i++) {
+        if (!read_string(env, err, file, &(*words)[i]) || (*words)[i] == NULL) {
+            free_words(env, *words, i);
+            *words = NULL;
+            return false;
+        }
+    }
+
+    *count = saved_count;
+
+    return true;
+}
+
+static bool read_redirections(const struct dc_posix_env *env, struct dc_error *err, FILE *file,
+                              struct command *command) {
+    uint32_t count;
+
+    if (!read_u32(file, &count) || count > MAX_STRING_LENGTH) {
+        return false;
+    }
+
+    if (count == 0) {
+        return true;
+    }
+
+    command->redirections = dc_calloc(env, err, count, sizeof(struct redirection));
+    if (dc_error_has_error(err)) {
+        return false;
+    }
+
+    // counted now, so destroy_command frees what was read if the rest is damaged
+    command->redirection_count = count;
+
+    for (size_t i = 0; i < count; i++) {
+        struct redirection *redirection;
+        uint32_t fd;
+        uint32_t type;
+        uint32_t source;
+
+        redirection = &command->redirections[i];
+
+        if (!read_u32(file, &fd) || fd > INT_MAX || !read_u32(file, &type) || type > REDIRECT_HERE ||
+            !read_string(env, err, file, &redirection->target) || !read_u32(file, &source)) {
+            return false;
+        }
+
+        redirection->fd = (int) fd;
+        redirection->type = (enum redirection_type) type;
+        redirection->source = (int) source;
+    }
+
+    return true;
+}
+
+static bool read_node(const struct dc_posix_env *env, struct dc_error *err, FILE *file, size_t depth,
+                      struct script_node **pnode) {
+    struct script_node *node;
+    uint32_t type;
+    uint32_t child_count;
+    int present;
+    bool ok;
+
+    *pnode = NULL;
+    present = fgetc(file);
+
+    if (present == 0) {
+        return true;
+    }
+
+    if (present != 1 || depth > MAX_DEPTH || !read_u32(file, &type) || type > SCRIPT_FUNCTION) {
+        return false;
+    }
+
+    node = dc_calloc(env, err, 1, sizeof(struct script_node));
+    if (dc_error_has_error(err)) {
+        return false;
+    }
+
+    node->type = (enum script_type) type;
+    node->references = 1;
+    present = fgetc(file);
+    ok = present == 0 || present == 1;
+
+    if (ok && present == 1) {
+        struct command *command;
+        int stdout_overwrite;
+        int stderr_overwrite;
+        int here_string;
+        int here_expand;
+
+        command = dc_calloc(env, err, 1, sizeof(struct command));
+        node->command = command;
+        ok = command != NULL &&
+             read_string(env, err, file, &command->line) && command->line != NULL &&
+             read_string(env, err, file, &command->stdin_file) &&
+             read_string(env, err, file, &command->stdout_file);
+        stdout_overwrite = ok ? fgetc(file) : EOF;
+        ok = ok && stdout_overwrite != EOF && read_string(env, err, file, &command->stderr_file);
+        stderr_overwrite = ok ? fgetc(file) : EOF;
+        ok = ok && stderr_overwrite != EOF && read_redirections(env, err, file, command) &&
+             read_string(env, err, file, &command->here_document);
+        here_string = ok ? fgetc(file) : EOF;
+        here_expand = here_string != EOF ? fgetc(file) : EOF;
+        ok = ok && here_expand != EOF;
+
+        if (ok) {
+            command->stdout_overwrite = stdout_overwrite != 0;
+            command->stderr_overwrite = stderr_overwrite != 0;
+            command->here_string = here_string != 0;
+            command->here_expand = here_expand != 0;
+        }
+    }
+
+    ok = ok &&
+         read_words(env, err, file, &node->words, &node->word_count) &&
+         read_string(env, err, file, &node->name) &&
+         read_node(env, err, file, depth + 1, &node->condition) &&
+         read_node(env, err, file, depth + 1, &node->body) &&
+         read_node(env, err, file, depth + 1, &node->otherwise) &&
+         read_u32(file, &child_count) && child_count <= MAX_STRING_LENGTH;
+
+    if (ok && child_count > 0) {
+        node->children = dc_calloc(env, err, child_count, sizeof(struct script_node *));
+        ok = node->children != NULL;
+
+        if (ok) {
+            node->child_count = child_count;
+        }
+
+        for (size_t i = 0; ok && i < child_count; i++) {
+            ok = read_node(env, err, file, depth + 1, &node->children[i]) && node->children[i] != NULL;
+        }
+    }
+
+    if (!ok || !is_complete(node)) {
+        script_destroy(env, &node);
+        return false;
+    }
+
+    *pnode = node;
+
+    return true;
+}
+
+/*
+ * What script_execute needs each type of node to have, a damaged file could leave any of it out.
+ */
+static bool is_complete(const struct script_node *node) {
+    switch (node->type) {
+        case SCRIPT_COMMAND:
+            return node->command != NULL;
+        case SCRIPT_LIST:
+            return true;
+        case SCRIPT_IF:
+        case SCRIPT_WHILE:
+        case SCRIPT_UNTIL:
+            return node->condition != NULL && node->body != NULL;
+        case SCRIPT_FOR:
+        case SCRIPT_FUNCTION:
+            return node->name != NULL && node->body != NULL;
+        case SCRIPT_CASE:
+            if (node->word_count == 0) {
+                return false;
+            }
+
+            for (size_t i = 0; i < node->child_count; i++) {
+                if (node->children[i]->type != SCRIPT_CASE_ITEM) {
+                    return false;
+                }
+            }
+
+            return true;
+        case SCRIPT_CASE_ITEM:
+            return node->word_count > 0 && node->body != NULL;
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,71 @@
+#include "startup.h"
+#include <stdbool.h>
+#include <time.h>
+
+/*! \struct startup_profile
+    \brief How long each part of starting the shell took.
+*/
+struct startup_profile
+{
+    FILE *stream;           /**< where to report the phases, NULL to not report them */
+    bool finished;          /**< has the first prompt been shown (true = stop timing) */
+    struct timespec start;  /**< when the shell started */
+    struct timespec last;   /**< when the last phase ended */
+};
+
+static double milliseconds_between(const struct timespec *from, const struct timespec *to);
+
+static struct startup_profile profile;
+
+/**
+ * Start timing the startup, from main() to the first prompt. Nothing is reported until startup_profile_enable.
+ * There is one startup per process, so the times are kept here rather than in the state.
+ */
+void startup_profile_start(void) {
+    profile.stream = NULL;
+    profile.finished = false;
+    clock_gettime(CLOCK_MONOTONIC, &profile.start);
+    profile.last = profile.start;
+}
+
+/**
+ * Report the phases from now on (--verbose).
+ *
+ * @param stream where to print the times.
+ */
+void startup_profile_enable(FILE *stream) {
+    profile.stream = stream;
+}
+
+/**
+ * End a phase: if reporting is enabled, print how long the phase and the whole startup so far took.
+ *
+ * @param phase the name of the phase that just ended.
+ */
+void startup_profile_phase(const char *phase) {
+    struct timespec now;
+
+    if (profile.stream == NULL || profile.finished) {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    fprintf(profile.stream, "startup: %-12s %8.3f ms (%.3f ms total)\n", phase,
+            milliseconds_between(&profile.last, &now), milliseconds_between(&profile.start, &now));
+    fflush(profile.stream);
+    profile.last = now;
+}
+
+/**
+ * End the last phase (the first prompt is up) and stop reporting: later calls do nothing.
+ *
+ * @param phase the name of the phase that just ended.
+ */
+void startup_profile_finish(const char *phase) {
+    startup_profile_phase(phase);
+    profile.finished = true;
+}
+
+static double milliseconds_between(const struct timespec *from, const struct timespec *to) {
+    return (double) (to->tv_sec - from->tv_sec) * 1000.0 + (double) (to->tv_nsec - from->tv_nsec) / 1000000.0;
+}
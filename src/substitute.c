@@ -0,0 +1,417 @@
+#include <dc_posix/dc_stdlib.h>
+#include <dc_posix/dc_string.h>
+#include <dc_posix/dc_unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include "command.h"
+#include "mem_stats.h"
+#include "script.h"
+#include "substitute.h"
+
+#define INITIAL_SIZE 256
+// "/dev/fd/" and an int
+#define FD_PATH_SIZE 32
+
+static bool runs_in_shell(const struct script_node *script);
+static char *capture_in_shell(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                              struct script_node *script);
+static char *capture_in_child(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                              struct script_node *script);
+static void run_in_child(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                         struct script_node *script);
+static char *read_output(const struct dc_posix_env *env, struct dc_error *err, int fd);
+static char *trim_newlines(const struct dc_posix_env *env, char *output);
+
+/*
+ * The builtins that only write to their standard output, so running them in the shell can't change it.
+ */
+static const char *const output_builtins[] = {":", "echo", "false", "pwd", "true", NULL};
+
+/**
+ * Run the commands of a command substitution ($(commands) or `commands`) and get what they wrote to
+ * their standard output, without the trailing newlines.
+ * A single echo, pwd, true, false or : is run in the shell, writing to memory. Anything else is run by
+ * the shell in a child process (so it can't change the shell's variables) with its output read through a pipe.
+ * No other shell is involved either way.
+ * The state->exit_code, and the exit_code of the state->command being expanded, are set to the exit code
+ * of the commands.
+ *
+ * @param env the posix environment.
+ * @param err the error object, EINVAL for a syntax error.
+ * @param state the current state.
+ * @param text the commands, with the $( ) or ` ` removed.
+ * @return the output (free with dc_free), NULL on error.
+ */
+char *substitute_command(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                         const char *text) {
+    struct script_node *script;
+    struct command *command;
+    struct command *expanding;
+    char *output;
+
+    script = script_parse(env, err, state, text);
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    command = dc_calloc(env, err, 1, sizeof(struct command));
+    if (dc_error_has_error(err)) {
+        script_destroy(env, &script);
+        return NULL;
+    }
+
+    // the state's command is the one being expanded, the substitution's commands need one of their own
+    expanding = state->command;
+    state->command = command;
+    state->exit_code = 0;
+
+    if (runs_in_shell(script)) {
+        output = capture_in_shell(env, err, state, script);
+    } else {
+        output = capture_in_child(env, err, state, script);
+    }
+
+    destroy_command(env, command);
+    dc_free(env, command, sizeof(struct command));
+    state->command = expanding;
+
+    // a command that is only assignments exits with the exit code of its last substitution
+    if (expanding != NULL) {
+        expanding->exit_code = state->exit_code;
+    }
+    script_destroy(env, &script);
+
+    if (output != NULL) {
+        output = trim_newlines(env, output);
+    }
+
+    return output;
+}
+
+/**
+ * Start the commands of a process substitution (<(commands) or >(commands)) in a child process, connected
+ * to the shell by a pipe, without waiting for them. The shell keeps its end of the pipe open, close on exec,
+ * until the state->command has run (see substitute_finish), only that command's program inherits it (see
+ * execute_start). The child closes the pipes of the command's other process substitutions.
+ *
+ * @param env the posix environment.
+ * @param err the error object, EINVAL for a syntax error.
+ * @param state the current state, state->command is the command being expanded.
+ * @param text the commands, with the <( ) or >( ) removed.
+ * @param input true for <(commands), the command reads their output, false for >(commands), it writes their input.
+ * @return the /dev/fd path of the shell's end of the pipe (free with dc_free), NULL on error.
+ */
+char *substitute_process(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                         const char *text, bool input) {
+    struct script_node *script;
+    struct command *expanding;
+    struct process_substitution *substitutions;
+    struct command *command;
+    int fds[2];
+    int keep;
+    int give;
+    pid_t child;
+    char path[FD_PATH_SIZE];
+
+    expanding = state->command;
+
+    if (expanding == NULL) {
+        DC_ERROR_RAISE_USER(err, "process substitution outside of a command", EINVAL);
+        return NULL;
+    }
+
+    script = script_parse(env, err, state, text);
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    // grown before the fork, so the child is never started without being recorded
+    substitutions = dc_realloc(env, err, expanding->substitutions,
+                               (expanding->substitution_count + 1) * sizeof(struct process_substitution));
+    if (dc_error_has_error(err)) {
+        script_destroy(env, &script);
+        return NULL;
+    }
+
+    expanding->substitutions = substitutions;
+    dc_pipe(env, err, fds);
+
+    if (dc_error_has_error(err)) {
+        script_destroy(env, &script);
+        return NULL;
+    }
+
+    keep = input ? fds[0] : fds[1];
+    give = input ? fds[1] : fds[0];
+    fcntl(keep, F_SETFD, FD_CLOEXEC);
+
+    // anything still buffered would be written by the child as well
+    fflush(NULL);
+    child = dc_fork(env, err);
+
+    if (dc_error_has_error(err)) {
+        close(fds[0]);
+        close(fds[1]);
+        script_destroy(env, &script);
+        return NULL;
+    }
+
+    if (child == 0) {
+        close(keep);
+
+        for (size_t i = 0; i < expanding->substitution_count; i++) {
+            close(expanding->substitutions[i].fd);
+        }
+
+        dup2(give, input ? STDOUT_FILENO : STDIN_FILENO);
+        close(give);
+
+        // the commands get a command of their own, the one being expanded is never run here
+        command = dc_calloc(env, err, 1, sizeof(struct command));
+        if (dc_error_has_error(err)) {
+            dc__exit(env, 1);
+        }
+
+        state->command = command;
+        state->exit_code = 0;
+        run_in_child(env, err, state, script);
+    }
+
+    close(give);
+    script_destroy(env, &script);
+    expanding->substitutions[expanding->substitution_count].fd = keep;
+    expanding->substitutions[expanding->substitution_count].pid = child;
+    expanding->substitution_count++;
+    snprintf(path, sizeof(path), "/dev/fd/%d", keep);
+
+    return dc_strdup(env, err, path);
+}
+
+/**
+ * Close the shell's ends of the command's process substitution pipes and wait for their commands.
+ * A >(commands) gets to the end of its input, a <(commands) that is still writing gets SIGPIPE.
+ *
+ * @param env the posix environment.
+ * @param command the command.
+ */
+void substitute_finish(const struct dc_posix_env *env, struct command *command) {
+    for (size_t i = 0; i < command->substitution_count; i++) {
+        close(command->substitutions[i].fd);
+    }
+
+    for (size_t i = 0; i < command->substitution_count; i++) {
+        int status;
+
+        while (waitpid(command->substitutions[i].pid, &status, 0) == -1 && errno == EINTR) {
+        }
+    }
+
+    if (command->substitutions != NULL) {
+        dc_free(env, command->substitutions, command->substitution_count * sizeof(struct process_substitution));
+        command->substitutions = NULL;
+    }
+
+    command->substitution_count = 0;
+}
+
+static bool runs_in_shell(const struct script_node *script) {
+    const struct command *command;
+
+    if (script->type != SCRIPT_COMMAND || script->word_count == 0) {
+        return false;
+    }
+
+    command = script->command;
+
+    // a redirection has to be done in a child, so it doesn't change the shell's own files
+    if (command->redirection_count > 0) {
+        return false;
+    }
+
+    // the name as written: "echo" runs in the shell, e"c"ho or $cmd are left to the child
+    for (size_t i = 0; output_builtins[i] != NULL; i++) {
+        if (strcmp(script->words[0], output_builtins[i]) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static char *capture_in_shell(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                              struct script_node *script) {
+    FILE *stream;
+    FILE *stdout_stream;
+    char *data;
+    size_t size;
+    char *output;
+
+    data = NULL;
+    size = 0;
+    stream = open_memstream(&data, &size);
+
+    if (stream == NULL) {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+        return NULL;
+    }
+
+    stdout_stream = state->stdout;
+    state->stdout = stream;
+    script_execute(env, err, state, script);
+    state->stdout = stdout_stream;
+    fclose(stream);
+
+    output = NULL;
+
+    if (dc_error_has_no_error(err)) {
+        output = dc_strndup(env, err, data, size);
+    }
+
+    free(data);
+
+    return output;
+}
+
+static char *capture_in_child(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                              struct script_node *script) {
+    int fds[2];
+    pid_t child;
+    int status;
+    char *output;
+
+    dc_pipe(env, err, fds);
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    // anything still buffered would be written by the child as well
+    fflush(NULL);
+    child = dc_fork(env, err);
+
+    if (dc_error_has_error(err)) {
+        close(fds[0]);
+        close(fds[1]);
+        return NULL;
+    }
+
+    if (child == 0) {
+        close(fds[0]);
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[1]);
+        run_in_child(env, err, state, script);
+    }
+
+    close(fds[1]);
+    output = read_output(env, err, fds[0]);
+    close(fds[0]);
+
+    // the child is waited for even if the output couldn't be read, so it doesn't become a zombie
+    while (waitpid(child, &status, 0) == -1 && errno == EINTR) {
+    }
+
+    state->exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+
+    return output;
+}
+
+/*
+ * The child runs the commands with the standard files it was given, then exits with their exit code.
+ */
+static void run_in_child(const struct dc_posix_env *env, struct dc_error *err, struct state *state,
+                         struct script_node *script) {
+    state->stdout = stdout;
+    script_execute(env, err, state, script);
+
+    if (dc_error_has_error(err)) {
+        fprintf(state->stderr, "%s\n", err->message);
+        state->exit_code = 1;
+    }
+
+    fflush(NULL);
+    dc__exit(env, state->exit_code);
+}
+
+/*
+ * Read until the end of the pipe into a buffer that doubles when it is full.
+ */
+static char *read_output(const struct dc_posix_env *env, struct dc_error *err, int fd) {
+    char *output;
+    size_t length;
+    size_t capacity;
+    ssize_t count;
+
+    capacity = INITIAL_SIZE;
+    length = 0;
+    output = dc_malloc(env, err, capacity);
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    for (;;) {
+        if (length + 1 == capacity) {
+            char *bigger;
+
+            bigger = dc_realloc(env, err, output, capacity * 2);
+            if (dc_error_has_error(err)) {
+                dc_free(env, output, capacity);
+                return NULL;
+            }
+
+            output = bigger;
+            capacity *= 2;
+        }
+
+        count = read(fd, &output[length], capacity - length - 1);
+
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+
+        if (count == -1) {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+            dc_free(env, output, capacity);
+            return NULL;
+        }
+
+        if (count == 0) {
+            break;
+        }
+
+        length += (size_t) count;
+    }
+
+    output[length] = '\0';
+
+    return output;
+}
+
+/*
+ * Remove the newlines at the end, and cut the memory down to what is left so it can be freed by its length
+ * (read_output leaves room to spare). If it can't be made smaller it is left as it is.
+ */
+static char *trim_newlines(const struct dc_posix_env *env, char *output) {
+    struct dc_error err;
+    char *trimmed;
+    size_t length;
+
+    length = strlen(output);
+
+    while (length > 0 && output[length - 1] == '\n') {
+        length--;
+    }
+
+    output[length] = '\0';
+    dc_error_init(&err, NULL);
+    trimmed = dc_realloc(env, &err, output, length + 1);
+
+    if (dc_error_has_error(&err)) {
+        trimmed = output;
+    }
+
+    dc_error_reset(&err);
+
+    return trimmed;
+}
@@ -0,0 +1,355 @@
+#include <dc_posix/dc_stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include "mem_stats.h"
+#include "thread_pool.h"
+
+#define INITIAL_JOBS 64
+
+/*! \struct worker_start
+    \brief What a worker thread needs to know when it starts.
+*/
+struct worker_start
+{
+    struct thread_pool *pool;   /**< the pool the thread works for */
+    size_t worker;              /**< the worker the thread is */
+};
+
+static void *start_worker(void *arg);
+static void work(struct thread_pool *pool, size_t worker);
+static bool take(struct thread_pool *pool, size_t worker, struct thread_pool_job *job);
+static void finish(struct thread_pool *pool, const struct dc_error *err);
+static void grow_queue(const struct dc_posix_env *env, struct dc_error *err, struct thread_pool_queue *queue);
+
+/**
+ * Create a pool. No threads are started until thread_pool_run.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param worker_count the number of workers, 0 for one per online processor.
+ * @return the pool.
+ */
+struct thread_pool *thread_pool_create(const struct dc_posix_env *env, struct dc_error *err, size_t worker_count) {
+    struct thread_pool *pool;
+
+    if (worker_count == 0) {
+        long processors;
+
+        processors = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = processors < 1 ? 1 : (size_t) processors;
+    }
+
+    pool = dc_calloc(env, err, 1, sizeof(struct thread_pool));
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    pool->queues = dc_calloc(env, err, worker_count, sizeof(struct thread_pool_queue));
+    if (dc_error_has_error(err)) {
+        dc_free(env, pool, sizeof(struct thread_pool));
+        return NULL;
+    }
+
+    pool->errors = dc_calloc(env, err, worker_count, sizeof(struct dc_error));
+    if (dc_error_has_error(err)) {
+        dc_free(env, pool->queues, worker_count * sizeof(struct thread_pool_queue));
+        dc_free(env, pool, sizeof(struct thread_pool));
+        return NULL;
+    }
+
+    for (size_t i = 0; i < worker_count; i++) {
+        pthread_mutex_init(&pool->queues[i].lock, NULL);
+        dc_error_init(&pool->errors[i], NULL);
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->changed, NULL);
+    pool->env = env;
+    pool->worker_count = worker_count;
+
+    return pool;
+}
+
+/**
+ * Free the pool and set the pointer to NULL. The pool must not be running.
+ *
+ * @param env the posix environment.
+ * @param ppool the pool to destroy.
+ */
+void thread_pool_destroy(const struct dc_posix_env *env, struct thread_pool **ppool) {
+    struct thread_pool *pool;
+
+    pool = *ppool;
+
+    for (size_t i = 0; i < pool->worker_count; i++) {
+        struct thread_pool_queue *queue;
+
+        queue = &pool->queues[i];
+
+        if (queue->jobs != NULL) {
+            dc_free(env, queue->jobs, queue->capacity * sizeof(struct thread_pool_job));
+        }
+
+        pthread_mutex_destroy(&queue->lock);
+        dc_error_reset(&pool->errors[i]);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->changed);
+    dc_free(env, pool->errors, pool->worker_count * sizeof(struct dc_error));
+    dc_free(env, pool->queues, pool->worker_count * sizeof(struct thread_pool_queue));
+    dc_free(env, pool, sizeof(struct thread_pool));
+    *ppool = NULL;
+}
+
+/**
+ * Add a task to a worker's queue. Tasks submit to their own worker, before thread_pool_run use worker 0.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param pool the pool.
+ * @param worker the worker whose queue the task goes on.
+ * @param task the function to run.
+ * @param arg the argument to pass it.
+ */
+void thread_pool_submit(const struct dc_posix_env *env, struct dc_error *err, struct thread_pool *pool, size_t worker,
+                        thread_pool_task *task, void *arg) {
+    struct thread_pool_queue *queue;
+
+    queue = &pool->queues[worker];
+    pthread_mutex_lock(&queue->lock);
+
+    if (queue->count == queue->capacity) {
+        grow_queue(env, err, queue);
+
+        if (dc_error_has_error(err)) {
+            pthread_mutex_unlock(&queue->lock);
+            return;
+        }
+    }
+
+    queue->jobs[(queue->first + queue->count) % queue->capacity].task = task;
+    queue->jobs[(queue->first + queue->count) % queue->capacity].arg = arg;
+    queue->count++;
+    pthread_mutex_unlock(&queue->lock);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->pending++;
+    pool->submitted++;
+
+    if (pool->sleeping > 0) {
+        pthread_cond_signal(&pool->changed);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Run the submitted tasks, and the tasks they submit, until there are none left.
+ * The calling thread is worker 0. If a task fails its error is copied to err.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param pool the pool.
+ */
+void thread_pool_run(const struct dc_posix_env *env, struct dc_error *err, struct thread_pool *pool) {
+    pthread_t *threads;
+    struct worker_start *starts;
+    size_t started;
+
+    threads = NULL;
+    starts = NULL;
+    started = 0;
+
+    if (pool->worker_count > 1) {
+        threads = dc_malloc(env, err, (pool->worker_count - 1) * sizeof(pthread_t));
+        if (dc_error_has_error(err)) {
+            return;
+        }
+
+        starts = dc_malloc(env, err, (pool->worker_count - 1) * sizeof(struct worker_start));
+        if (dc_error_has_error(err)) {
+            dc_free(env, threads, (pool->worker_count - 1) * sizeof(pthread_t));
+            return;
+        }
+
+        // if a thread can't be started the others do its share, its queue is always empty
+        for (size_t i = 0; i < pool->worker_count - 1; i++) {
+            starts[started].pool = pool;
+            starts[started].worker = started + 1;
+
+            if (pthread_create(&threads[started], NULL, start_worker, &starts[started]) != 0) {
+                break;
+            }
+
+            started++;
+        }
+    }
+
+    work(pool, 0);
+
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (threads != NULL) {
+        dc_free(env, threads, (pool->worker_count - 1) * sizeof(pthread_t));
+        dc_free(env, starts, (pool->worker_count - 1) * sizeof(struct worker_start));
+    }
+
+    for (size_t i = 0; i < pool->worker_count; i++) {
+        struct dc_error *worker_err;
+
+        worker_err = &pool->errors[i];
+
+        if (dc_error_has_error(worker_err) && dc_error_has_no_error(err)) {
+            if (worker_err->type == DC_ERROR_ERRNO) {
+                DC_ERROR_RAISE_ERRNO(err, worker_err->err_code);
+            } else {
+                DC_ERROR_RAISE_USER(err, worker_err->message, worker_err->err_code);
+            }
+        }
+
+        dc_error_reset(worker_err);
+    }
+
+    pool->cancelled = false;
+}
+
+/**
+ * Has a task failed. Long running tasks can check this to give up early.
+ *
+ * @param pool the pool.
+ * @return true if a task has failed.
+ */
+bool thread_pool_cancelled(struct thread_pool *pool) {
+    bool cancelled;
+
+    pthread_mutex_lock(&pool->lock);
+    cancelled = pool->cancelled;
+    pthread_mutex_unlock(&pool->lock);
+
+    return cancelled;
+}
+
+static void *start_worker(void *arg) {
+    struct worker_start *start;
+    sigset_t signals;
+
+    // signals are for the shell, not the workers
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    start = (struct worker_start *) arg;
+    work(start->pool, start->worker);
+
+    return NULL;
+}
+
+static void work(struct thread_pool *pool, size_t worker) {
+    struct dc_error *err;
+
+    err = &pool->errors[worker];
+
+    for (;;) {
+        struct thread_pool_job job;
+        size_t submitted;
+
+        pthread_mutex_lock(&pool->lock);
+        submitted = pool->submitted;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (take(pool, worker, &job)) {
+            job.task(pool->env, err, pool, worker, job.arg);
+            finish(pool, err);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+
+        if (pool->pending == 0) {
+            pthread_mutex_unlock(&pool->lock);
+            return;
+        }
+
+        // a job submitted since the queues were checked means there is no need to wait
+        if (pool->submitted == submitted) {
+            pool->sleeping++;
+            pthread_cond_wait(&pool->changed, &pool->lock);
+            pool->sleeping--;
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/*
+ * The newest job from the worker's own queue, or else the oldest job from another worker's queue.
+ */
+static bool take(struct thread_pool *pool, size_t worker, struct thread_pool_job *job) {
+    for (size_t i = 0; i < pool->worker_count; i++) {
+        struct thread_pool_queue *queue;
+        bool found;
+
+        queue = &pool->queues[(worker + i) % pool->worker_count];
+        pthread_mutex_lock(&queue->lock);
+        found = queue->count > 0;
+
+        if (found && i == 0) {
+            *job = queue->jobs[(queue->first + queue->count - 1) % queue->capacity];
+            queue->count--;
+        } else if (found) {
+            *job = queue->jobs[queue->first];
+            queue->first = (queue->first + 1) % queue->capacity;
+            queue->count--;
+        }
+
+        pthread_mutex_unlock(&queue->lock);
+
+        if (found) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void finish(struct thread_pool *pool, const struct dc_error *err) {
+    pthread_mutex_lock(&pool->lock);
+    pool->pending--;
+
+    if (dc_error_has_error(err)) {
+        pool->cancelled = true;
+    }
+
+    // wake everyone up so they can see there is nothing left to do
+    if (pool->pending == 0) {
+        pthread_cond_broadcast(&pool->changed);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void grow_queue(const struct dc_posix_env *env, struct dc_error *err, struct thread_pool_queue *queue) {
+    struct thread_pool_job *jobs;
+    size_t capacity;
+
+    capacity = queue->capacity == 0 ? INITIAL_JOBS : queue->capacity * 2;
+    jobs = dc_malloc(env, err, capacity * sizeof(struct thread_pool_job));
+    if (dc_error_has_error(err)) {
+        return;
+    }
+
+    // the ring is unwrapped so the oldest job is first again
+    for (size_t i = 0; i < queue->count; i++) {
+        jobs[i] = queue->jobs[(queue->first + i) % queue->capacity];
+    }
+
+    if (queue->jobs != NULL) {
+        dc_free(env, queue->jobs, queue->capacity * sizeof(struct thread_pool_job));
+    }
+
+    queue->jobs = jobs;
+    queue->first = 0;
+    queue->capacity = capacity;
+}
@@ -0,0 +1,802 @@
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * The tracer is called from inside the dc_posix functions, so this file uses the C library directly: a
+ * dc_ call here would trace itself.
+ */
+
+// the calls a thread keeps before they are written, 64K each
+#define TRACE_RING_SIZE 4096
+
+// the functions that can be told apart, a power of 2 so the hash can wrap
+#define TRACE_CALLS 1024
+
+// the call id of a function that did not fit
+#define TRACE_UNKNOWN_CALL TRACE_CALLS
+
+#define TRACE_MAGIC "DCTB"
+#define TRACE_VERSION 1
+
+/*
+ * What a chunk of the file holds.
+ */
+enum trace_kind
+{
+    TRACE_EVENTS = 0,   // count trace_events follow
+    TRACE_NAMES = 1,    // count trace_names follow, each followed by the function and file names
+};
+
+/*
+ * Every chunk starts with one, chunks are written with one write to a file opened for appending so the
+ * threads and processes writing to it don't get mixed up.
+ */
+struct trace_chunk
+{
+    char magic[4];      // TRACE_MAGIC
+    uint16_t version;   // TRACE_VERSION
+    uint16_t kind;      // a trace_kind
+    uint32_t pid;       // the process that wrote it
+    uint32_t count;     // how many follow
+};
+
+/*
+ * One call.
+ */
+struct trace_event
+{
+    uint64_t time;      // nanoseconds since the trace was opened (CLOCK_MONOTONIC)
+    uint16_t call;      // the function's id in the process
+    uint16_t thread;    // the thread's number in the process, from 1
+    uint32_t line;      // the line it was called from
+};
+
+/*
+ * The name of a function id.
+ */
+struct trace_name
+{
+    uint16_t call;          // the id
+    uint16_t name_length;   // the function name that follows
+    uint16_t file_length;   // the file name that follows it
+    uint16_t unused;
+};
+
+/*
+ * The calls one thread has made that are not written yet. Only that thread touches it until it exits.
+ */
+struct trace_ring
+{
+    struct trace_ring *next;    // the next thread's ring
+    uint16_t thread;            // the thread's number
+    size_t count;               // the calls waiting
+    struct trace_event events[TRACE_RING_SIZE];
+};
+
+/*
+ * The names are shared by every thread: the first to call a function claims a slot for it with a compare
+ * and swap, the slot is the function's id. The functions are told apart by the address of their name.
+ */
+struct trace_log
+{
+    int fd;                                     // the trace file
+    atomic_bool open;                           // is the trace being written
+    pid_t pid;                                  // the process the rings belong to
+    struct timespec start;                      // when it was opened
+    pthread_mutex_t lock;                       // for the rings and threads
+    struct trace_ring *rings;                   // every thread's ring
+    uint16_t threads;                           // the thread numbers given out
+    _Atomic(const char *) names[TRACE_CALLS];   // the function of each id
+    _Atomic(const char *) files[TRACE_CALLS];   // the file it was first called from
+    atomic_bool replaces[TRACE_CALLS];          // is it an exec, the rings are gone if it works
+    atomic_size_t call_count;                   // the ids given out
+    size_t names_written;                       // call_count when the names were last written
+};
+
+/*
+ * A call as the decoder reads it.
+ */
+struct decoded_event
+{
+    uint64_t time;
+    uint32_t pid;
+    uint16_t call;
+    uint16_t thread;
+    uint32_t line;
+    size_t order;   // where it was in the file, the sort keeps the order of calls made at the same time
+};
+
+/*
+ * A name as the decoder reads it.
+ */
+struct decoded_name
+{
+    uint32_t pid;
+    uint16_t call;
+    char *name;
+    char *file;
+};
+
+/*
+ * How many times a function was called.
+ */
+struct decoded_count
+{
+    const char *name;
+    size_t count;
+};
+
+static void init_once(void);
+static void destroy_ring(void *arg);
+static void reset_after_fork(void);
+static struct trace_ring *create_ring(void);
+static uint16_t call_id(const char *function_name, const char *file_name);
+static void write_ring(struct trace_ring *current);
+static void write_names(void);
+static bool write_all(struct iovec *iov, int count);
+static bool read_events(FILE *in, const struct trace_chunk *chunk, struct decoded_event **events,
+                        size_t *count, size_t *size);
+static bool read_names(FILE *in, const struct trace_chunk *chunk, struct decoded_name **names, size_t *count,
+                       size_t *size);
+static const struct decoded_name *find_name(const struct decoded_name *names, size_t count, uint32_t pid,
+                                            uint16_t call);
+static void print_summary(FILE *out, const struct decoded_event *events, size_t event_count,
+                          const struct decoded_name *names, size_t name_count);
+static int compare_events(const void *a, const void *b);
+static int compare_names(const void *a, const void *b);
+static int compare_counts(const void *a, const void *b);
+
+static struct trace_log trace = {.fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER};
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+static _Thread_local struct trace_ring *ring;
+
+/**
+ * Start recording every dc_posix call made through an environment that has trace_record as its tracer
+ * into a compact binary file (decode it with dc_trace_decode). Each call is 16 bytes: when it was made,
+ * which function, and the line the tracer was called from. The records are kept in a ring per thread,
+ * without locks, and a full ring is written with one write. A child the shell forks traces into the same
+ * file, and writes its ring before it calls exec. There is one trace per shell process, so it is kept
+ * here rather than in the state.
+ *
+ * @param path the file, it is appended to.
+ * @return 0, or the errno if the file can't be opened.
+ */
+int trace_open(const char *path) {
+    pthread_once(&once, init_once);
+    trace.fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR);
+
+    if (trace.fd == -1) {
+        return errno;
+    }
+
+    for (size_t i = 0; i < TRACE_CALLS; i++) {
+        atomic_init(&trace.names[i], NULL);
+        atomic_init(&trace.files[i], NULL);
+        atomic_init(&trace.replaces[i], false);
+    }
+
+    atomic_init(&trace.call_count, 0);
+    trace.names_written = 0;
+    trace.threads = 0;
+    trace.pid = getpid();
+    clock_gettime(CLOCK_MONOTONIC, &trace.start);
+    atomic_store_explicit(&trace.open, true, memory_order_release);
+
+    return 0;
+}
+
+/**
+ * The dc_posix_tracer that records a call, it does nothing unless the trace is open. The tracer is called
+ * as the function is entered, so the result is not known.
+ *
+ * @param env the posix environment.
+ * @param file_name the file the call is in.
+ * @param function_name the function called.
+ * @param line_number the line the tracer was called from.
+ */
+void trace_record(__attribute__((unused)) const struct dc_posix_env *env, const char *file_name,
+                  const char *function_name, size_t line_number) {
+    struct trace_ring *current;
+    struct trace_event *event;
+    struct timespec now;
+    int saved_errno;
+
+    if (!atomic_load_explicit(&trace.open, memory_order_acquire)) {
+        return;
+    }
+
+    // the caller may be about to look at errno
+    saved_errno = errno;
+    current = ring;
+
+    if (current == NULL) {
+        current = create_ring();
+
+        if (current == NULL) {
+            errno = saved_errno;
+            return;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    event = &current->events[current->count];
+    event->time = (uint64_t)(now.tv_sec - trace.start.tv_sec) * 1000000000U + (uint64_t)now.tv_nsec -
+                  (uint64_t)trace.start.tv_nsec;
+    event->call = call_id(function_name, file_name);
+    event->thread = current->thread;
+    event->line = (uint32_t)line_number;
+    current->count++;
+
+    // a successful exec takes the ring with it, so it is written first
+    if (current->count == TRACE_RING_SIZE) {
+        write_ring(current);
+    } else if (event->call != TRACE_UNKNOWN_CALL &&
+               atomic_load_explicit(&trace.replaces[event->call], memory_order_relaxed)) {
+        write_ring(current);
+        write_names();
+    }
+
+    errno = saved_errno;
+}
+
+/**
+ * Write what the calling thread has recorded so far, and the names of the functions.
+ */
+void trace_flush(void) {
+    if (!atomic_load_explicit(&trace.open, memory_order_acquire)) {
+        return;
+    }
+
+    if (ring != NULL) {
+        write_ring(ring);
+    }
+
+    write_names();
+}
+
+/**
+ * Write what every thread has recorded and close the file. The other threads must have stopped tracing.
+ */
+void trace_close(void) {
+    struct trace_ring *current;
+
+    if (!atomic_load_explicit(&trace.open, memory_order_acquire)) {
+        return;
+    }
+
+    atomic_store_explicit(&trace.open, false, memory_order_release);
+    pthread_mutex_lock(&trace.lock);
+
+    while (trace.rings != NULL) {
+        current = trace.rings;
+        trace.rings = current->next;
+        write_ring(current);
+        free(current);
+    }
+
+    pthread_mutex_unlock(&trace.lock);
+    write_names();
+    ring = NULL;
+    pthread_setspecific(ring_key, NULL);
+    close(trace.fd);
+    trace.fd = -1;
+}
+
+/**
+ * Turn a trace file into text: one line per call, in the order they were made, with the time in seconds
+ * since the trace was opened, the process and thread, the function and where the tracer was called from.
+ *
+ * @param in the trace file.
+ * @param out where the text goes.
+ * @param summary print how many times each function was called instead, the most called first.
+ * @return false if the file is not a trace.
+ */
+bool trace_decode(FILE *in, FILE *out, bool summary) {
+    struct trace_chunk chunk;
+    struct decoded_event *events;
+    struct decoded_name *names;
+    size_t event_count;
+    size_t event_size;
+    size_t name_count;
+    size_t name_size;
+    bool valid;
+
+    events = NULL;
+    names = NULL;
+    event_count = 0;
+    event_size = 0;
+    name_count = 0;
+    name_size = 0;
+    valid = true;
+
+    while (valid && fread(&chunk, sizeof(chunk), 1, in) == 1) {
+        if (memcmp(chunk.magic, TRACE_MAGIC, sizeof(chunk.magic)) != 0 || chunk.version != TRACE_VERSION) {
+            valid = false;
+        } else if (chunk.kind == TRACE_EVENTS) {
+            valid = read_events(in, &chunk, &events, &event_count, &event_size);
+        } else if (chunk.kind == TRACE_NAMES) {
+            valid = read_names(in, &chunk, &names, &name_count, &name_size);
+        } else {
+            valid = false;
+        }
+    }
+
+    if (valid) {
+        qsort(events, event_count, sizeof(struct decoded_event), compare_events);
+        qsort(names, name_count, sizeof(struct decoded_name), compare_names);
+
+        if (summary) {
+            print_summary(out, events, event_count, names, name_count);
+        } else {
+            for (size_t i = 0; i < event_count; i++) {
+                const struct decoded_name *name;
+
+                name = find_name(names, name_count, events[i].pid, events[i].call);
+                fprintf(out, "%" PRIu64 ".%09" PRIu64 " %lu/%u %s %s:%lu\n",
+                        (uint64_t)(events[i].time / 1000000000U),
+                        (uint64_t)(events[i].time % 1000000000U), (unsigned long)events[i].pid,
+                        events[i].thread, name == NULL ? "?" : name->name, name == NULL ? "?" : name->file,
+                        (unsigned long)events[i].line);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < name_count; i++) {
+        free(names[i].name);
+        free(names[i].file);
+    }
+
+    free(names);
+    free(events);
+
+    return valid;
+}
+
+/*
+ * Set up what lives as long as the process: the key whose destructor writes a thread's ring when it
+ * exits, and the handler that gives a forked child rings of its own.
+ */
+static void init_once(void) {
+    pthread_key_create(&ring_key, destroy_ring);
+    pthread_atfork(NULL, NULL, reset_after_fork);
+}
+
+/*
+ * A thread that recorded calls is exiting.
+ */
+static void destroy_ring(void *arg) {
+    struct trace_ring *current;
+    struct trace_ring **link;
+
+    current = arg;
+    pthread_mutex_lock(&trace.lock);
+
+    for (link = &trace.rings; *link != NULL; link = &(*link)->next) {
+        if (*link == current) {
+            *link = current->next;
+            write_ring(current);
+            free(current);
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&trace.lock);
+    ring = NULL;
+}
+
+/*
+ * In a forked child: the calls in the ring are the parent's, who writes them, and the other threads are
+ * gone.
+ */
+static void reset_after_fork(void) {
+    if (!atomic_load_explicit(&trace.open, memory_order_relaxed)) {
+        return;
+    }
+
+    trace.pid = getpid();
+    trace.rings = ring;
+    trace.threads = ring == NULL ? 0 : 1;
+    trace.names_written = 0;
+    pthread_mutex_init(&trace.lock, NULL);
+
+    if (ring != NULL) {
+        ring->next = NULL;
+        ring->count = 0;
+        ring->thread = 1;
+    }
+}
+
+/*
+ * The calling thread's first call.
+ */
+static struct trace_ring *create_ring(void) {
+    struct trace_ring *current;
+
+    current = malloc(sizeof(struct trace_ring));
+
+    if (current == NULL) {
+        return NULL;
+    }
+
+    current->count = 0;
+    pthread_mutex_lock(&trace.lock);
+    current->thread = ++trace.threads;
+    current->next = trace.rings;
+    trace.rings = current;
+    pthread_mutex_unlock(&trace.lock);
+    pthread_setspecific(ring_key, current);
+    ring = current;
+
+    return current;
+}
+
+/*
+ * The id of a function, claimed the first time it is called. Returns TRACE_UNKNOWN_CALL if every id is
+ * taken.
+ */
+static uint16_t call_id(const char *function_name, const char *file_name) {
+    size_t hash;
+
+    hash = (size_t)(((uintptr_t)function_name >> 3U) * 0x9E3779B1U);
+
+    for (size_t i = 0; i < TRACE_CALLS; i++) {
+        size_t slot;
+        const char *found;
+
+        slot = (hash + i) & (TRACE_CALLS - 1);
+        found = atomic_load_explicit(&trace.names[slot], memory_order_acquire);
+
+        if (found == NULL) {
+            if (atomic_compare_exchange_strong(&trace.names[slot], &found, function_name)) {
+                atomic_store(&trace.files[slot], file_name);
+                atomic_store(&trace.replaces[slot], strncmp(function_name, "dc_exec", 7) == 0);
+                atomic_fetch_add(&trace.call_count, 1);
+
+                return (uint16_t)slot;
+            }
+        }
+
+        if (found == function_name) {
+            return (uint16_t)slot;
+        }
+    }
+
+    return TRACE_UNKNOWN_CALL;
+}
+
+/*
+ * Write the calls in a ring as one chunk, the ring is empty after.
+ */
+static void write_ring(struct trace_ring *current) {
+    struct trace_chunk chunk;
+    struct iovec iov[2];
+
+    if (current->count == 0) {
+        return;
+    }
+
+    memcpy(chunk.magic, TRACE_MAGIC, sizeof(chunk.magic));
+    chunk.version = TRACE_VERSION;
+    chunk.kind = TRACE_EVENTS;
+    chunk.pid = (uint32_t)trace.pid;
+    chunk.count = (uint32_t)current->count;
+    iov[0].iov_base = &chunk;
+    iov[0].iov_len = sizeof(chunk);
+    iov[1].iov_base = current->events;
+    iov[1].iov_len = current->count * sizeof(struct trace_event);
+    write_all(iov, 2);
+    current->count = 0;
+}
+
+/*
+ * Write the names of the function ids, unless none have been added since they were last written.
+ */
+static void write_names(void) {
+    struct trace_chunk chunk;
+    struct trace_name *entries;
+    struct iovec *iov;
+    size_t call_count;
+    int count;
+
+    pthread_mutex_lock(&trace.lock);
+    call_count = atomic_load(&trace.call_count);
+
+    if (call_count == trace.names_written) {
+        pthread_mutex_unlock(&trace.lock);
+        return;
+    }
+
+    entries = malloc(call_count * sizeof(struct trace_name));
+    iov = malloc((1 + call_count * 3) * sizeof(struct iovec));
+
+    if (entries == NULL || iov == NULL) {
+        pthread_mutex_unlock(&trace.lock);
+        free(entries);
+        free(iov);
+        return;
+    }
+
+    count = 1;
+    chunk.count = 0;
+
+    // one that is being claimed right now has no file yet, it is written next time
+    for (size_t i = 0; i < TRACE_CALLS && chunk.count < call_count; i++) {
+        const char *name;
+        const char *file;
+        struct trace_name *entry;
+
+        name = atomic_load(&trace.names[i]);
+        file = atomic_load(&trace.files[i]);
+
+        if (name == NULL || file == NULL) {
+            continue;
+        }
+
+        entry = &entries[chunk.count++];
+        entry->call = (uint16_t)i;
+        entry->name_length = (uint16_t)strlen(name);
+        entry->file_length = (uint16_t)strlen(file);
+        entry->unused = 0;
+        iov[count].iov_base = entry;
+        iov[count++].iov_len = sizeof(struct trace_name);
+        iov[count].iov_base = (void *)(uintptr_t)name;
+        iov[count++].iov_len = entry->name_length;
+        iov[count].iov_base = (void *)(uintptr_t)file;
+        iov[count++].iov_len = entry->file_length;
+    }
+
+    memcpy(chunk.magic, TRACE_MAGIC, sizeof(chunk.magic));
+    chunk.version = TRACE_VERSION;
+    chunk.kind = TRACE_NAMES;
+    chunk.pid = (uint32_t)trace.pid;
+    iov[0].iov_base = &chunk;
+    iov[0].iov_len = sizeof(chunk);
+
+    if (write_all(iov, count)) {
+        trace.names_written = chunk.count;
+    }
+
+    pthread_mutex_unlock(&trace.lock);
+    free(iov);
+    free(entries);
+}
+
+/*
+ * One chunk, with as few writes as it takes. A chunk of names can be more than IOV_MAX pieces, and a
+ * write can be short, in which case the rest is written on its own.
+ */
+static bool write_all(struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t written;
+        size_t left;
+
+        written = writev(trace.fd, iov, count < 1024 ? count : 1024);
+
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return false;
+        }
+
+        left = (size_t)written;
+
+        while (count > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            iov++;
+            count--;
+        }
+
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + left;
+            iov->iov_len -= left;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Read a chunk of calls onto the end of events, which grows as needed.
+ */
+static bool read_events(FILE *in, const struct trace_chunk *chunk, struct decoded_event **events,
+                        size_t *count, size_t *size) {
+    for (uint32_t i = 0; i < chunk->count; i++) {
+        struct trace_event event;
+        struct decoded_event *decoded;
+
+        if (fread(&event, sizeof(event), 1, in) != 1) {
+            return false;
+        }
+
+        if (*count == *size) {
+            struct decoded_event *grown;
+
+            *size = *size == 0 ? TRACE_RING_SIZE : *size * 2;
+            grown = realloc(*events, *size * sizeof(struct decoded_event));
+
+            if (grown == NULL) {
+                return false;
+            }
+
+            *events = grown;
+        }
+
+        decoded = &(*events)[(*count)];
+        decoded->time = event.time;
+        decoded->pid = chunk->pid;
+        decoded->call = event.call;
+        decoded->thread = event.thread;
+        decoded->line = event.line;
+        decoded->order = (*count)++;
+    }
+
+    return true;
+}
+
+/*
+ * Read a chunk of names onto the end of names, which grows as needed.
+ */
+static bool read_names(FILE *in, const struct trace_chunk *chunk, struct decoded_name **names, size_t *count,
+                       size_t *size) {
+    for (uint32_t i = 0; i < chunk->count; i++) {
+        struct trace_name entry;
+        struct decoded_name *decoded;
+
+        if (fread(&entry, sizeof(entry), 1, in) != 1) {
+            return false;
+        }
+
+        if (*count == *size) {
+            struct decoded_name *grown;
+
+            *size = *size == 0 ? TRACE_CALLS : *size * 2;
+            grown = realloc(*names, *size * sizeof(struct decoded_name));
+
+            if (grown == NULL) {
+                return false;
+            }
+
+            *names = grown;
+        }
+
+        decoded = &(*names)[*count];
+        decoded->pid = chunk->pid;
+        decoded->call = entry.call;
+        decoded->name = calloc(1, (size_t)entry.name_length + 1);
+        decoded->file = calloc(1, (size_t)entry.file_length + 1);
+        (*count)++;
+
+        if (decoded->name == NULL || decoded->file == NULL ||
+            fread(decoded->name, 1, entry.name_length, in) != entry.name_length ||
+            fread(decoded->file, 1, entry.file_length, in) != entry.file_length) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * The name of a process's function id, names is sorted. The same names are written again as more are
+ * added, any of them will do.
+ */
+static const struct decoded_name *find_name(const struct decoded_name *names, size_t count, uint32_t pid,
+                                            uint16_t call) {
+    struct decoded_name key;
+
+    key.pid = pid;
+    key.call = call;
+
+    return bsearch(&key, names, count, sizeof(struct decoded_name), compare_names);
+}
+
+/*
+ * How many times each function was called, in every process and thread, the most called first.
+ */
+static void print_summary(FILE *out, const struct decoded_event *events, size_t event_count,
+                          const struct decoded_name *names, size_t name_count) {
+    struct decoded_count *counts;
+    size_t count;
+
+    counts = calloc(name_count + 1, sizeof(struct decoded_count));
+
+    if (counts == NULL) {
+        return;
+    }
+
+    count = 0;
+
+    for (size_t i = 0; i < event_count; i++) {
+        const struct decoded_name *name;
+        const char *function_name;
+        size_t j;
+
+        name = find_name(names, name_count, events[i].pid, events[i].call);
+        function_name = name == NULL ? "?" : name->name;
+
+        j = 0;
+
+        while (j < count && strcmp(counts[j].name, function_name) != 0) {
+            j++;
+        }
+
+        if (j == count) {
+            counts[count++].name = function_name;
+        }
+
+        counts[j].count++;
+    }
+
+    qsort(counts, count, sizeof(struct decoded_count), compare_counts);
+
+    for (size_t i = 0; i < count; i++) {
+        fprintf(out, "%10zu %s\n", counts[i].count, counts[i].name);
+    }
+
+    free(counts);
+}
+
+/*
+ * By time, then by where they are in the file.
+ */
+static int compare_events(const void *a, const void *b) {
+    const struct decoded_event *first;
+    const struct decoded_event *second;
+
+    first = a;
+    second = b;
+
+    if (first->time != second->time) {
+        return first->time < second->time ? -1 : 1;
+    }
+
+    return first->order < second->order ? -1 : (first->order > second->order);
+}
+
+/*
+ * By process, then id.
+ */
+static int compare_names(const void *a, const void *b) {
+    const struct decoded_name *first;
+    const struct decoded_name *second;
+
+    first = a;
+    second = b;
+
+    if (first->pid != second->pid) {
+        return first->pid < second->pid ? -1 : 1;
+    }
+
+    return (int)first->call - (int)second->call;
+}
+
+/*
+ * The most called first, then by name.
+ */
+static int compare_counts(const void *a, const void *b) {
+    const struct decoded_count *first;
+    const struct decoded_count *second;
+
+    first = a;
+    second = b;
+
+    if (first->count != second->count) {
+        return first->count > second->count ? -1 : 1;
+    }
+
+    return strcmp(first->name, second->name);
+}
@@ -0,0 +1,40 @@
+#include "trace.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Print a trace written with dc_shell --trace=FILE: dc_trace_decode [-s] FILE, -s for how many times each
+ * function was called instead of every call.
+ */
+int main(int argc, char *argv[]) {
+    const char *path;
+    bool summary;
+    FILE *in;
+    bool valid;
+
+    summary = argc == 3 && strcmp(argv[1], "-s") == 0;
+
+    if (argc != 2 && !summary) {
+        fprintf(stderr, "usage: %s [-s] FILE\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    path = argv[argc - 1];
+    in = fopen(path, "rb");
+
+    if (in == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    valid = trace_decode(in, stdout, summary);
+    fclose(in);
+
+    if (!valid) {
+        fprintf(stderr, "%s: not a trace, or cut short\n", path);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -2,6 +2,8 @@
 #include <dc_posix/dc_string.h>
 #include "util.h"
 #include "command.h"
+#include "mem_stats.h"
+#include "posix_direct.h"
 
 static size_t count(const char *str, int c);
 
@@ -60,6 +62,7 @@ char *get_path(const struct dc_posix_env *env, struct dc_error *err)
 char **parse_path(const struct dc_posix_env *env, struct dc_error *err,
                   const char *path_str) {
     char *str = dc_strdup(env, err, path_str);
+    size_t length = strlen(path_str);
     char *state;
     char *token;
     size_t num;
@@ -69,7 +72,7 @@ char **parse_path(const struct dc_posix_env *env, struct dc_error *err,
 
     state = str;
     num = count(str, ':') + 1;
-    list = malloc((num + 1) * sizeof(char *));
+    list = dc_malloc(env, err, (num + 1) * sizeof(char *));
 
     i = 0;
 
@@ -81,100 +84,41 @@ char **parse_path(const struct dc_posix_env *env, struct dc_error *err,
     }
 
     list[i] = NULL;
-    dc_free(env, str, strlen(str));
+    // strtok_r has cut it up, so strlen would only find the first directory
+    dc_free(env, str, length + 1);
 
     //added free(state);
     return list;
 }
 
 /**
- * Reset the state for the next read, freeing any dynamically allocated memory.
+ * Reset the state for the next read, freeing the memory used by the last line.
+ * The path, prompt and max_line_length last for the whole session and are kept.
  *
  * @param env the posix environment.
  * @param err the error object
  */
 void do_reset_state(const struct dc_posix_env *env, struct dc_error *err, struct state *state) {
-    int pos;
     struct command *command;
 
-
-    state->stdin = stdin;
-    state->stdout = stdout;
-    state->stderr = stderr;
     command = state->command;
 
-    if (state->in_redirect_regex != NULL) {
-        dc_free(env, state->in_redirect_regex, sizeof(regex_t));
-        state->in_redirect_regex = NULL;
-    }
-
-    if (state->out_redirect_regex != NULL) {
-        dc_free(env, state->out_redirect_regex, sizeof(regex_t));
-        state->out_redirect_regex = NULL;
-    }
-
-    if (state->err_redirect_regex != NULL) {
-        dc_free(env, state->err_redirect_regex, sizeof(regex_t));
-        state->err_redirect_regex = NULL;
-    }
-
-    if (state->prompt != NULL) {
-        dc_free(env, state->prompt, strlen(state->prompt));
-        state->prompt = NULL;
-    }
-
     if (state->current_line != NULL) {
-        dc_free(env, state->current_line, strlen(state->current_line));
+        dc_free(env, state->current_line, strlen(state->current_line) + 1);
         state->current_line = NULL;
     }
 
     if (command != NULL) {
-        if (command->line != NULL){
-            dc_free(env, command->line, strlen(command->line));
-        }
-        if (command->command != NULL){
-            dc_free(env, command->command, strlen(command->command));
-        }
-        if (command->argv != NULL) {
-            for (int i = 0; command->argv[i]; ++i) {
-                dc_free(env, command->argv[i], strlen(command->argv[i]));
-            }
-            dc_free(env, command->argv, sizeof(char **));
-        }
-
-        if (command->stdin_file != NULL){
-            dc_free(env, command->stdin_file, strlen(command->stdin_file));
-        }
-        if (command->stdout_file != NULL){
-            dc_free(env, command->stdout_file, strlen(command->stdout_file));
-        }
-
-        if (command->stderr_file != NULL){
-            dc_free(env, command->stderr_file, strlen(command->stderr_file));
-        }
-
+        destroy_command(env, command);
         dc_free(env, command, sizeof(struct command));
     }
     state->command = NULL;
 
-    state->max_line_length = 0;
     state->current_line_length = 0;
     state->fatal_error = false;
 
-    if (state->path != NULL) {
-        pos = 0;
-        while (state->path[pos] != NULL) {
-            dc_free(env, state->path[pos], strlen(state->path[pos]));
-            ++pos;
-        }
-
-        dc_free(env, state->path, sizeof(char **));
-        state->path = NULL;
-    }
-
-
     if (err->message != NULL) {
-        dc_free(env, err->message, strlen(err->message));
+        dc_free(env, err->message, strlen(err->message) + 1);
         err->message = NULL;
     }
     if (err->file_name != NULL) {
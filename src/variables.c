@@ -0,0 +1,721 @@
+#include <dc_posix/dc_stdlib.h>
+#include <dc_posix/dc_string.h>
+#include <errno.h>
+#include <stdint.h>
+#include "mem_stats.h"
+#include "variables.h"
+
+#define INITIAL_BUCKETS 64
+#define INITIAL_ENV_CAPACITY 64
+
+static size_t hash_name(const char *name, size_t length);
+static struct variable *find(const struct variables *variables, const char *name, size_t length);
+static struct variable *find_or_add(const struct dc_posix_env *env, struct dc_error *err,
+                                    struct variables *variables, const char *name, size_t length);
+static void grow_buckets(const struct dc_posix_env *env, struct dc_error *err, struct variables *variables);
+static void set_value(const struct dc_posix_env *env, struct dc_error *err, struct variables *variables,
+                      struct variable *variable, const char *value);
+static void env_add(const struct dc_posix_env *env, struct dc_error *err, struct variables *variables,
+                    struct variable *variable);
+static void env_append(const struct dc_posix_env *env, struct dc_error *err, struct variables *variables,
+                       char *entry, struct variable *owner);
+static void env_remove(struct variables *variables, struct variable *variable);
+static bool in_env(const struct variable *variable);
+static void notify(const struct dc_posix_env *env, struct dc_error *err, const struct variables *variables,
+                   const struct variable *variable);
+static void free_variable(const struct dc_posix_env *env, struct variable *variable);
+static int compare_variables(const void *a, const void *b);
+
+/**
+ * Create an empty set of variables.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @return the variables.
+ */
+struct variables *variables_create(const struct dc_posix_env *env, struct dc_error *err) {
+    struct variables *variables;
+
+    variables = dc_malloc(env, err, sizeof(struct variables));
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    variables->buckets = dc_calloc(env, err, INITIAL_BUCKETS, sizeof(struct variable *));
+    if (dc_error_has_error(err)) {
+        dc_free(env, variables, sizeof(struct variables));
+        return NULL;
+    }
+
+    variables->envp = dc_malloc(env, err, INITIAL_ENV_CAPACITY * sizeof(char *));
+    if (dc_error_has_error(err)) {
+        dc_free(env, variables->buckets, INITIAL_BUCKETS * sizeof(struct variable *));
+        dc_free(env, variables, sizeof(struct variables));
+        return NULL;
+    }
+
+    variables->owners = dc_malloc(env, err, INITIAL_ENV_CAPACITY * sizeof(struct variable *));
+    if (dc_error_has_error(err)) {
+        dc_free(env, variables->envp, INITIAL_ENV_CAPACITY * sizeof(char *));
+        dc_free(env, variables->buckets, INITIAL_BUCKETS * sizeof(struct variable *));
+        dc_free(env, variables, sizeof(struct variables));
+        return NULL;
+    }
+
+    variables->bucket_count = INITIAL_BUCKETS;
+    variables->count = 0;
+    variables->envp[0] = NULL;
+    variables->env_count = 0;
+    variables->env_capacity = INITIAL_ENV_CAPACITY;
+    variables->listener = NULL;
+    variables->listener_data = NULL;
+
+    return variables;
+}
+
+/**
+ * Free the variables and set the pointer to NULL.
+ *
+ * @param env the posix environment.
+ * @param pvariables the variables to destroy.
+ */
+void variables_destroy(const struct dc_posix_env *env, struct variables **pvariables) {
+    struct variables *variables;
+
+    variables = *pvariables;
+
+    for (size_t i = 0; i < variables->bucket_count; i++) {
+        struct variable *variable;
+
+        variable = variables->buckets[i];
+
+        while (variable != NULL) {
+            struct variable *next;
+
+            next = variable->next;
+            free_variable(env, variable);
+            variable = next;
+        }
+    }
+
+    // the envp strings belong to the variables, which are already gone, except the ones that are not variables
+    for (size_t i = 0; i < variables->env_count; i++) {
+        if (variables->owners[i] == NULL) {
+            dc_free(env, variables->envp[i], strlen(variables->envp[i]) + 1);
+        }
+    }
+
+    dc_free(env, variables->owners, variables->env_capacity * sizeof(struct variable *));
+    dc_free(env, variables->envp, variables->env_capacity * sizeof(char *));
+    dc_free(env, variables->buckets, variables->bucket_count * sizeof(struct variable *));
+    dc_free(env, variables, sizeof(struct variables));
+    *pvariables = NULL;
+}
+
+/**
+ * Add each "name=value" string in an environment as an exported variable. An entry whose name is not a valid
+ * one (eg. a-b=1) can't be a variable, but it is kept in the envp, so the programs run still get it.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param variables the variables to add to.
+ * @param environment the NULL terminated environment (eg. environ).
+ */
+void variables_import(const struct dc_posix_env *env, struct dc_error *err, struct variables *variables,
+                      char **environment) {
+    for (size_t i = 0; environment[i] != NULL; i++) {
+        const char *equals;
+        struct variable *variable;
+
+        equals = dc_strchr(env, environment[i], '=');
+
+        // anything that is not a valid name cannot be referred to by the shell, but it is passed on as it was
+        if (equals == NULL || !variables_is_name(environment[i], (size_t) (equals - environment[i]))) {
+            char *entry;
+
+            entry = dc_strdup(env, err, environment[i]);
+            if (dc_error_has_error(err)) {
+                return;
+            }
+
+            env_append(env, err, variables, entry, NULL);
+            if (dc_error_has_error(err)) {
+                dc_free(env, entry, strlen(entry) + 1);
+                return;
+            }
+
+            continue;
+        }
+
+        variable = find_or_add(env, err, variables, environment[i], (size_t) (equals - environment[i]));
+        if (dc_error_has_error(err)) {
+            return;
+        }
+
+        variable->exported = true;
+        set_value(env, err, variables, variable, equals + 1);
+        if (dc_error_has_error(err)) {
+            return;
+        }
+    }
+}
+
+/**
+ * Set the function to call after a variable changes.
+ *
+ * @param variables the variables.
+ * @param listener the function to call, or NULL for none.
+ * @param data passed to the listener.
+ */
+void variables_set_listener(struct variables *variables, variable_listener listener, void *data) {
+    variables->listener = listener;
+    variables->listener_data = data;
+}
+
+/**
+ * Get the value of a variable.
+ *
+ * @param env the posix environment.
+ * @param variables the variables to look in.
+ * @param name the name of the variable.
+ * @return the value, or NULL if the variable is not set.
+ */
+const char *variables_get(const struct dc_posix_env *env, const struct variables *variables, const char *name) {
+    struct variable *variable;
+
+    variable = find(variables, name, dc_strlen(env, name));
+
+    if (variable == NULL) {
+        return NULL;
+    }
+
+    return variable->value;
+}
+
+/**
+ * Set the value of a variable. It stays exported if it already was.
+ * Setting a readonly variable is an EPERM error.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param variables the variables.
+ * @param name the name of the variable.
+ * @param value the value.
+ */
+void variables_set(const struct dc_posix_env *env, struct dc_error *err, struct variables *variables,
+                   const char *name, const char *value) {
+    struct variable *variable;
+
+    variable = find_or_add(env, err, variables, name, dc_strlen(env, name));
+    if (dc_error_has_error(err)) {
+        return;
+    }
+
+    if (variable->readonly) {
+        DC_ERROR_RAISE_USER(err, "readonly variable", EPERM);
+        return;
+    }
+
+    set_value(env, err, variables, variable, value);
+}
+
+/**
+ * Export a variable, optionally setting it at the same time.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param variables the variables.
+ * @param name the name of the variable.
+ * @param value the value, or NULL to keep the current value.
+ */
+void variables_export(const struct dc_posix_env *env, struct dc_error *err, struct variables *variables,
+                      const char *name, const char *value) {
+    struct variable *variable;
+
+    variable = find_or_add(env, err, variables, name, dc_strlen(env, name));
+    if (dc_error_has_error(err)) {
+        return;
+    }
+
+    if (value != NULL && variable->readonly) {
+        DC_ERROR_RAISE_USER(err, "readonly variable", EPERM);
+        return;
+    }
+
+    if (!variable->exported) {
+        variable->exported = true;
+
+        if (variable->entry != NULL) {
+            env_add(env, err, variables, variable);
+            if (dc_error_has_error(err)) {
+                return;
+            }
+        }
+    }
+
+    if (value != NULL) {
+        set_value(env, err, variables, variable, value);
+    }
+}
+
+/**
+ * Make a variable readonly, optionally setting it at the same time.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param variables the variables.
+ * @param name the name of the variable.
+ * @param value the value, or NULL to keep the current value.
+ */
+void variables_readonly(const struct dc_posix_env *env, struct dc_error *err, struct variables *variables,
+                        const char *name, const char *value) {
+    struct variable *variable;
+
+    variable = find_or_add(env, err, variables, name, dc_strlen(env, name));
+    if (dc_error_has_error(err)) {
+        return;
+    }
+
+    if (value != NULL) {
+        if (variable->readonly) {
+            DC_ERROR_RAISE_USER(err, "readonly variable", EPERM);
+            return;
+        }
+
+        set_value(env, err, variables, variable, value);
+        if (dc_error_has_error(err)) {
+            return;
+        }
+    }
+
+    variable->readonly = true;
+}
+
+/**
+ * Remove a variable. Removing a readonly variable is an EPERM error.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param variables the variables.
+ * @param name the name of the variable.
+ */
+void variables_unset(const struct dc_posix_env *env, struct dc_error *err, struct variables *variables,
+                     const char *name) {
+    size_t length;
+    struct variable **link;
+    struct variable *variable;
+
+    length = dc_strlen(env, name);
+    link = &variables->buckets[hash_name(name, length) & (variables->bucket_count - 1)];
+
+    while (*link != NULL && dc_strcmp(env, (*link)->name, name) != 0) {
+        link = &(*link)->next;
+    }
+
+    variable = *link;
+
+    if (variable == NULL) {
+        return;
+    }
+
+    if (variable->readonly) {
+        DC_ERROR_RAISE_USER(err, "readonly variable", EPERM);
+        return;
+    }
+
+    if (in_env(variable)) {
+        env_remove(variables, variable);
+    }
+
+    *link = variable->next;
+    variables->count--;
+
+    // the listener gets the name before it is freed
+    variable->value = NULL;
+    notify(env, err, variables, variable);
+    free_variable(env, variable);
+}
+
+/**
+ * Apply a "name=value" assignment.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param variables the variables.
+ * @param assignment the assignment.
+ * @param export should the variable also be exported (true = export).
+ */
+void variables_assign(const struct dc_posix_env *env, struct dc_error *err, struct variables *variables,
+                      const char *assignment, bool export) {
+    const char *equals;
+    char *name;
+    size_t length;
+
+    equals = dc_strchr(env, assignment, '=');
+
+    if (equals == NULL) {
+        DC_ERROR_RAISE_USER(err, "not an assignment", EINVAL);
+        return;
+    }
+
+    length = (size_t) (equals - assignment);
+    name = dc_strndup(env, err, assignment, length);
+    if (dc_error_has_error(err)) {
+        return;
+    }
+
+    if (export) {
+        variables_export(env, err, variables, name, equals + 1);
+    } else {
+        variables_set(env, err, variables, name, equals + 1);
+    }
+
+    dc_free(env, name, length + 1);
+}
+
+/**
+ * Get the environment to give to commands. It is owned by the variables and changes as they change.
+ *
+ * @param variables the variables.
+ * @return the NULL terminated "name=value" strings for the exported variables.
+ */
+char **variables_environ(const struct variables *variables) {
+    return variables->envp;
+}
+
+/**
+ * Is the string a valid variable name ([A-Za-z_][A-Za-z0-9_]*).
+ *
+ * @param str the string to check.
+ * @param length the number of characters of str to check.
+ * @return true if it is a name.
+ */
+bool variables_is_name(const char *str, size_t length) {
+    if (length == 0 || (str[0] >= '0' && str[0] <= '9')) {
+        return false;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        char c;
+
+        c = str[i];
+
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_')) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Is the string an assignment (a name followed by =).
+ *
+ * @param env the posix environment.
+ * @param str the string to check.
+ * @return true if it is an assignment.
+ */
+bool variables_is_assignment(const struct dc_posix_env *env, const char *str) {
+    const char *equals;
+
+    equals = dc_strchr(env, str, '=');
+
+    return equals != NULL && variables_is_name(str, (size_t) (equals - str));
+}
+
+/**
+ * Display variables as the commands that would recreate them, sorted by name.
+ *
+ * @param env the posix environment.
+ * @param err the error object.
+ * @param variables the variables.
+ * @param filter which variables to display.
+ * @param stream where to display them.
+ */
+void variables_print(const struct dc_posix_env *env, struct dc_error *err, const struct variables *variables,
+                     enum variables_filter filter, FILE *stream) {
+    struct variable **matches;
+    size_t count;
+    const char *keyword;
+
+    if (variables->count == 0) {
+        return;
+    }
+
+    matches = dc_malloc(env, err, variables->count * sizeof(struct variable *));
+    if (dc_error_has_error(err)) {
+        return;
+    }
+
+    count = 0;
+
+    for (size_t i = 0; i < variables->bucket_count; i++) {
+        for (struct variable *variable = variables->buckets[i]; variable != NULL; variable = variable->next) {
+            if ((filter == VARIABLES_EXPORTED && variable->exported) ||
+                (filter == VARIABLES_READONLY && variable->readonly)) {
+                matches[count] = variable;
+                count++;
+            }
+        }
+    }
+
+    qsort(matches, count, sizeof(struct variable *), compare_variables);
+    keyword = filter == VARIABLES_EXPORTED ? "export" : "readonly";
+
+    for (size_t i = 0; i < count; i++) {
+        if (matches[i]->value == NULL) {
+            fprintf(stream, "%s %s\n", keyword, matches[i]->name);
+        } else {
+            fprintf(stream, "%s %s=\"", keyword, matches[i]->name);
+
+            for (const char *c = matches[i]->value; *c != '\0'; c++) {
+                if (*c == '"' || *c == '\\' || *c == '$' || *c == '`') {
+                    fputc('\\', stream);
+                }
+
+                fputc(*c, stream);
+            }
+
+            fprintf(stream, "\"\n");
+        }
+    }
+
+    dc_free(env, matches, variables->count * sizeof(struct variable *));
+}
+
+static size_t hash_name(const char *name, size_t length) {
+    uint64_t hash;
+
+    // FNV-1a
+    hash = UINT64_C(14695981039346656037);
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char) name[i];
+        hash *= UINT64_C(1099511628211);
+    }
+
+    return (size_t) hash;
+}
+
+static struct variable *find(const struct variables *variables, const char *name, size_t length) {
+    struct variable *variable;
+
+    variable = variables->buckets[hash_name(name, length) & (variables->bucket_count - 1)];
+
+    while (variable != NULL) {
+        if (strncmp(variable->name, name, length) == 0 && variable->name[length] == '\0') {
+            return variable;
+        }
+
+        variable = variable->next;
+    }
+
+    return NULL;
+}
+
+static struct variable *find_or_add(const struct dc_posix_env *env, struct dc_error *err,
+                                    struct variables *variables, const char *name, size_t length) {
+    struct variable *variable;
+    size_t bucket;
+
+    variable = find(variables, name, length);
+
+    if (variable != NULL) {
+        return variable;
+    }
+
+    if (!variables_is_name(name, length)) {
+        DC_ERROR_RAISE_USER(err, "not a valid identifier", EINVAL);
+        return NULL;
+    }
+
+    // keep the chains short, at most 3 variables for every 4 buckets
+    if ((variables->count + 1) * 4 > variables->bucket_count * 3) {
+        grow_buckets(env, err, variables);
+        if (dc_error_has_error(err)) {
+            return NULL;
+        }
+    }
+
+    variable = dc_malloc(env, err, sizeof(struct variable));
+    if (dc_error_has_error(err)) {
+        return NULL;
+    }
+
+    variable->name = dc_strndup(env, err, name, length);
+    if (dc_error_has_error(err)) {
+        dc_free(env, variable, sizeof(struct variable));
+        return NULL;
+    }
+
+    variable->entry = NULL;
+    variable->value = NULL;
+    variable->exported = false;
+    variable->readonly = false;
+    variable->env_index = 0;
+
+    bucket = hash_name(name, length) & (variables->bucket_count - 1);
+    variable->next = variables->buckets[bucket];
+    variables->buckets[bucket] = variable;
+    variables->count++;
+
+    return variable;
+}
+
+static void grow_buckets(const struct dc_posix_env *env, struct dc_error *err, struct variables *variables) {
+    struct variable **buckets;
+    size_t bucket_count;
+
+    bucket_count = variables->bucket_count * 2;
+    buckets = dc_calloc(env, err, bucket_count, sizeof(struct variable *));
+    if (dc_error_has_error(err)) {
+        return;
+    }
+
+    for (size_t i = 0; i < variables->bucket_count; i++) {
+        struct variable *variable;
+
+        variable = variables->buckets[i];
+
+        while (variable != NULL) {
+            struct variable *next;
+            size_t bucket;
+
+            next = variable->next;
+            bucket = hash_name(variable->name, strlen(variable->name)) & (bucket_count - 1);
+            variable->next = buckets[bucket];
+            buckets[bucket] = variable;
+            variable = next;
+        }
+    }
+
+    dc_free(env, variables->buckets, variables->bucket_count * sizeof(struct variable *));
+    variables->buckets = buckets;
+    variables->bucket_count = bucket_count;
+}
+
+static void set_value(const struct dc_posix_env *env, struct dc_error *err, struct variables *variables,
+                      struct variable *variable, const char *value) {
+    char *entry;
+    size_t name_length;
+    size_t value_length;
+    bool listed;
+
+    listed = in_env(variable);
+    name_length = strlen(variable->name);
+    value_length = dc_strlen(env, value);
+    entry = dc_malloc(env, err, name_length + 1 + value_length + 1);
+    if (dc_error_has_error(err)) {
+        return;
+    }
+
+    dc_memcpy(env, entry, variable->name, name_length);
+    entry[name_length] = '=';
+    dc_memcpy(env, &entry[name_length + 1], value, value_length + 1);
+
+    if (variable->entry != NULL) {
+        dc_free(env, variable->entry, strlen(variable->entry) + 1);
+    }
+
+    variable->entry = entry;
+    variable->value = &entry[name_length + 1];
+
+    // an exported variable either takes over its slot or gets a new one at the end
+    if (variable->exported) {
+        if (listed) {
+            variables->envp[variable->env_index] = entry;
+        } else {
+            env_add(env, err, variables, variable);
+            if (dc_error_has_error(err)) {
+                return;
+            }
+        }
+    }
+
+    notify(env, err, variables, variable);
+}
+
+static void env_add(const struct dc_posix_env *env, struct dc_error *err, struct variables *variables,
+                    struct variable *variable) {
+    env_append(env, err, variables, variable->entry, variable);
+    if (dc_error_has_error(err)) {
+        return;
+    }
+
+    variable->env_index = variables->env_count - 1;
+}
+
+static void env_append(const struct dc_posix_env *env, struct dc_error *err, struct variables *variables,
+                       char *entry, struct variable *owner) {
+    if (variables->env_count + 1 == variables->env_capacity) {
+        char **envp;
+        struct variable **owners;
+        size_t capacity;
+
+        capacity = variables->env_capacity * 2;
+        envp = dc_realloc(env, err, variables->envp, capacity * sizeof(char *));
+        if (dc_error_has_error(err)) {
+            return;
+        }
+
+        variables->envp = envp;
+        owners = dc_realloc(env, err, variables->owners, capacity * sizeof(struct variable *));
+        if (dc_error_has_error(err)) {
+            return;
+        }
+
+        variables->owners = owners;
+        variables->env_capacity = capacity;
+    }
+
+    variables->envp[variables->env_count] = entry;
+    variables->owners[variables->env_count] = owner;
+    variables->env_count++;
+    variables->envp[variables->env_count] = NULL;
+}
+
+static void env_remove(struct variables *variables, struct variable *variable) {
+    size_t last;
+
+    // the order of the environment does not matter, so the last entry fills the hole
+    last = variables->env_count - 1;
+    variables->envp[variable->env_index] = variables->envp[last];
+    variables->owners[variable->env_index] = variables->owners[last];
+
+    if (variables->owners[variable->env_index] != NULL) {
+        variables->owners[variable->env_index]->env_index = variable->env_index;
+    }
+
+    variables->envp[last] = NULL;
+    variables->env_count = last;
+}
+
+static bool in_env(const struct variable *variable) {
+    return variable->exported && variable->entry != NULL;
+}
+
+static void notify(const struct dc_posix_env *env, struct dc_error *err, const struct variables *variables,
+                   const struct variable *variable) {
+    if (variables->listener != NULL && dc_error_has_no_error(err)) {
+        variables->listener(env, err, variable->name, variable->value, variables->listener_data);
+    }
+}
+
+static void free_variable(const struct dc_posix_env *env, struct variable *variable) {
+    if (variable->entry != NULL) {
+        dc_free(env, variable->entry, strlen(variable->entry) + 1);
+    }
+
+    dc_free(env, variable->name, strlen(variable->name) + 1);
+    dc_free(env, variable, sizeof(struct variable));
+}
+
+static int compare_variables(const void *a, const void *b) {
+    const struct variable *variable_a;
+    const struct variable *variable_b;
+
+    variable_a = *(struct variable * const *) a;
+    variable_b = *(struct variable * const *) b;
+
+    return strcmp(variable_a->name, variable_b->name);
+}
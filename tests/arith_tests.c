@@ -0,0 +1,204 @@
+#include "tests.h"
+#include "arith.h"
+#include "script.h"
+#include "shell_impl.h"
+#include <stdlib.h>
+
+static void test_arith(struct variables *variables, const char *text, int64_t expected);
+static void test_arith_error(struct variables *variables, const char *text);
+static void create_state(struct state *state);
+
+Describe(arith);
+
+static struct dc_posix_env environ;
+static struct dc_error error;
+
+BeforeEach(arith)
+{
+    dc_posix_env_init(&environ, NULL);
+    dc_error_init(&error, NULL);
+}
+
+AfterEach(arith)
+{
+    dc_error_reset(&error);
+}
+
+Ensure(arith, evaluate)
+{
+    struct variables *variables;
+
+    variables = variables_create(&environ, &error);
+    test_arith(variables, "", 0);
+    test_arith(variables, "1 + 2 * 3", 7);
+    test_arith(variables, "(1 + 2) * 3", 9);
+    test_arith(variables, "7 / 2 + 7 % 2", 4);
+    test_arith(variables, "0x1f + 010 + 9", 48);
+    test_arith(variables, "-3 - -3", 0);
+    test_arith(variables, "!0 + !7 + ~0", 0);
+    test_arith(variables, "1 << 4 | 1 & 3 ^ 2", 19);
+    test_arith(variables, "2 < 3 && 3 <= 3 && 4 >= 5 || 1 != 1", 0);
+    test_arith(variables, "1 == 1 ? 10 : 20", 10);
+    test_arith(variables, "9223372036854775807 + 1", INT64_MIN);
+    test_arith(variables, "-9223372036854775807 - 1", INT64_MIN);
+    test_arith(variables, "(-9223372036854775807 - 1) / -1", INT64_MIN);
+    test_arith(variables, "1 << 65", 2);
+    test_arith(variables, "1++2", 3);
+
+    // variables, with and without a $, and assignments
+    test_arith(variables, "x", 0);
+    test_arith(variables, "x = 5", 5);
+    test_arith(variables, "$x + ${x} + x", 15);
+    test_arith(variables, "x += 2, x *= 3", 21);
+    test_arith(variables, "x <<= 1", 42);
+    test_arith(variables, "x++ + x", 85);
+    test_arith(variables, "--x", 42);
+    assert_that(variables_get(&environ, variables, "x"), is_equal_to_string("42"));
+    test_arith(variables, "a = b = 3", 3);
+    assert_that(variables_get(&environ, variables, "a"), is_equal_to_string("3"));
+    test_arith(variables, "x == 42", 1);
+
+    // only one side of && || and ?: is evaluated
+    test_arith(variables, "0 && (y = 1)", 0);
+    test_arith(variables, "1 || (y = 1)", 1);
+    test_arith(variables, "1 ? 2 : (y = 1)", 2);
+    assert_that(variables_get(&environ, variables, "y"), is_null);
+
+    variables_set(&environ, &error, variables, "y", " -0x10 ");
+    test_arith(variables, "y", -16);
+    variables_set(&environ, &error, variables, "y", "");
+    test_arith(variables, "y", 0);
+
+    variables_destroy(&environ, &variables);
+}
+
+Ensure(arith, errors)
+{
+    struct variables *variables;
+
+    variables = variables_create(&environ, &error);
+    variables_set(&environ, &error, variables, "text", "abc");
+
+    test_arith_error(variables, "1 +");
+    test_arith_error(variables, "(1 + 2");
+    test_arith_error(variables, "1 2");
+    test_arith_error(variables, "09");
+    test_arith_error(variables, "1 ? 2");
+    test_arith_error(variables, "++1");
+    test_arith_error(variables, "1 = 2");
+    test_arith_error(variables, "${x");
+    test_arith_error(variables, "1 / 0");
+    test_arith_error(variables, "1 % (2 - 2)");
+    test_arith_error(variables, "text + 1");
+
+    variables_destroy(&environ, &variables);
+}
+
+Ensure(arith, cache)
+{
+    struct variables *variables;
+    struct arith_cache *cache;
+
+    variables = variables_create(&environ, &error);
+    cache = arith_cache_create(&environ, &error);
+
+    for (int i = 0; i < 10; i++) {
+        arith_cache_evaluate(&environ, &error, cache, variables, "i = i + 1");
+    }
+
+    assert_false(dc_error_has_error(&error));
+    assert_that(variables_get(&environ, variables, "i"), is_equal_to_string("10"));
+    assert_that(cache->misses, is_equal_to(1));
+    assert_that(cache->hits, is_equal_to(9));
+    assert_that(cache->count, is_equal_to(1));
+
+    // a bad expression is not kept
+    arith_cache_evaluate(&environ, &error, cache, variables, "i +");
+    assert_that(error.err_code, is_equal_to(EINVAL));
+    dc_error_reset(&error);
+    assert_that(cache->count, is_equal_to(1));
+
+    assert_that(arith_cache_evaluate(&environ, &error, NULL, variables, "i * 2"), is_equal_to(20));
+
+    arith_cache_destroy(&environ, &cache);
+    assert_that(cache, is_null);
+    variables_destroy(&environ, &variables);
+}
+
+Ensure(arith, needs_expansion)
+{
+    assert_false(arith_needs_expansion("x + $y * ${z_1} - 2"));
+    assert_true(arith_needs_expansion("$1 + 1"));
+    assert_true(arith_needs_expansion("$# + 1"));
+    assert_true(arith_needs_expansion("${x:-1}"));
+    assert_true(arith_needs_expansion("$(echo 1)"));
+    assert_true(arith_needs_expansion("\"1\""));
+    assert_true(arith_needs_expansion("`echo 1`"));
+}
+
+Ensure(arith, expand)
+{
+    struct state state;
+    struct script_node *script;
+
+    create_state(&state);
+    script = script_parse(&environ, &error, &state,
+                          "f() { R=$(($1 * $# + N)); }; I=0; N=0; "
+                          "while let 10-I; do I=$((I + 1)); let N+=I; done; f 3 4; S=$((`echo 2` ** 1))");
+    assert_false(dc_error_has_error(&error));
+    script_execute(&environ, &error, &state, script);
+    assert_that(error.err_code, is_equal_to(EINVAL));
+    dc_error_reset(&error);
+    assert_that(variables_get(&environ, state.variables, "I"), is_equal_to_string("10"));
+    assert_that(variables_get(&environ, state.variables, "N"), is_equal_to_string("55"));
+    assert_that(variables_get(&environ, state.variables, "R"), is_equal_to_string("61"));
+
+    // the loop's expressions were parsed once, the ones with $1 and $# every time
+    assert_that(state.script_context->arithmetic->count, is_equal_to(3));
+    assert_that(state.script_context->arithmetic->hits, is_equal_to(28));
+    script_destroy(&environ, &script);
+    destroy_state(&environ, &error, &state);
+}
+
+static void test_arith(struct variables *variables, const char *text, int64_t expected)
+{
+    struct arith_node *tree;
+
+    tree = arith_parse(&environ, &error, text);
+    assert_that(tree, is_not_null);
+    assert_that(arith_evaluate(&environ, &error, tree, variables), is_equal_to(expected));
+    assert_false(dc_error_has_error(&error));
+    arith_destroy(&environ, &tree);
+    assert_that(tree, is_null);
+}
+
+static void test_arith_error(struct variables *variables, const char *text)
+{
+    arith_cache_evaluate(&environ, &error, NULL, variables, text);
+    assert_that(error.err_code, is_equal_to(EINVAL));
+    dc_error_reset(&error);
+}
+
+static void create_state(struct state *state)
+{
+    state->stdin = stdin;
+    state->stdout = tmpfile();
+    state->stderr = tmpfile();
+    init_state(&environ, &error, state);
+    assert_false(dc_error_has_error(&error));
+    state->command = calloc(1, sizeof(struct command));
+}
+
+TestSuite *arith_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, arith, evaluate);
+    add_test_with_context(suite, arith, errors);
+    add_test_with_context(suite, arith, cache);
+    add_test_with_context(suite, arith, needs_expansion);
+    add_test_with_context(suite, arith, expand);
+
+    return suite;
+}
@@ -0,0 +1,81 @@
+#include "tests.h"
+#include "audit.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+Describe(audit);
+
+static struct dc_posix_env environ;
+static struct dc_error error;
+
+BeforeEach(audit)
+{
+    dc_posix_env_init(&environ, NULL);
+    dc_error_init(&error, NULL);
+}
+
+AfterEach(audit)
+{
+    dc_error_reset(&error);
+}
+
+Ensure(audit, command)
+{
+    struct audit_mark mark;
+    char file_name[] = "/tmp/dc_audit_XXXXXX";
+    char line[1024];
+    FILE *file;
+    int fd;
+
+    // nothing is recorded until it is opened
+    assert_false(audit_enabled());
+    audit_start(&mark);
+    audit_command(&environ, &mark, "ignored", 0);
+
+    fd = mkstemp(file_name);
+    assert_that(fd, is_not_equal_to(-1));
+    close(fd);
+    audit_open(&environ, &error, file_name);
+    assert_false(dc_error_has_error(&error));
+    assert_true(audit_enabled());
+
+    for (int i = 0; i < 2000; i++) {
+        audit_start(&mark);
+        audit_command(&environ, &mark, i == 0 ? "echo \"a\\b\"\t" : "true", i % 3);
+    }
+
+    audit_close();
+    assert_false(audit_enabled());
+
+    // every one is written, in order, even if the ring filled up
+    file = fopen(file_name, "r");
+    assert_that(fgets(line, sizeof(line), file), is_equal_to(line));
+    assert_that(line, begins_with_string("{\"time\":\"2"));
+    assert_that(line, contains_string(",\"line\":\"echo \\\"a\\\\b\\\"\\u0009\",\"exit\":0,\"duration_ms\":"));
+    assert_that(line, contains_string("\"involuntary_switches\":"));
+    assert_that(line[strlen(line) - 2], is_equal_to('}'));
+
+    for (int i = 1; i < 2000; i++) {
+        assert_that(fgets(line, sizeof(line), file), is_equal_to(line));
+    }
+
+    assert_that(line, contains_string(",\"exit\":1,"));
+    assert_that(fgets(line, sizeof(line), file), is_null);
+    fclose(file);
+    unlink(file_name);
+
+    audit_open(&environ, &error, "/nonexistent/audit.jsonl");
+    assert_true(dc_error_has_error(&error));
+    assert_false(audit_enabled());
+}
+
+TestSuite *audit_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, audit, command);
+
+    return suite;
+}
@@ -0,0 +1,162 @@
+#include "tests.h"
+#include "batch.h"
+#include <dc_util/strings.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static size_t count_lines(const char *file_name);
+
+Describe(batch);
+
+static struct dc_posix_env environ;
+static struct dc_error error;
+
+BeforeEach(batch)
+{
+    dc_posix_env_init(&environ, NULL);
+    dc_error_init(&error, NULL);
+}
+
+AfterEach(batch)
+{
+    dc_error_reset(&error);
+}
+
+Ensure(batch, split)
+{
+    char *args[] = { "aaaaaaa", "bbbbbbb", "ccccccc", "ddddddd", "eeeeeee" };
+    char *envp[] = { "A=1", NULL };
+    size_t size;
+    size_t ends[5];
+
+    size = batch_argument_size(args[0]);
+    assert_that(size, is_equal_to(8 + sizeof(char *)));
+    assert_that(batch_limit(envp, 10000), is_equal_to(10000 - 2048 - sizeof(char *) - batch_argument_size(envp[0])));
+    assert_that(batch_limit(envp, 100), is_equal_to(0));
+
+    // everything fits
+    assert_that(batch_split(args, 5, 10, 10 + 5 * size, 0, ends), is_equal_to(1));
+    assert_that(ends[0], is_equal_to(5));
+
+    // two per run, the last run gets what is left
+    assert_that(batch_split(args, 5, 10, 10 + 2 * size + 1, 0, ends), is_equal_to(3));
+    assert_that(ends[0], is_equal_to(2));
+    assert_that(ends[1], is_equal_to(4));
+    assert_that(ends[2], is_equal_to(5));
+
+    assert_that(batch_split(args, 5, 10, 10 + 5 * size, 4, ends), is_equal_to(2));
+    assert_that(ends[0], is_equal_to(4));
+
+    // an argument that is too big on its own still gets a run
+    assert_that(batch_split(args, 5, 10, 10, 0, NULL), is_equal_to(5));
+    assert_that(batch_split(args, 0, 10, 10, 0, NULL), is_equal_to(0));
+}
+
+Ensure(batch, needed)
+{
+    struct command command;
+    char *argv[] = { NULL, "-l", "aaaaaaa", "bbbbbbb", NULL };
+    char *envp[] = { NULL };
+    char **path;
+    size_t fixed;
+
+    memset(&command, 0, sizeof(struct command));
+    command.command = "ls";
+    command.argv = argv;
+    command.argc = 4;
+    command.pathname_first = 2;
+    command.pathname_end = 4;
+    path = dc_strs_to_array(&environ, &error, 2, "/usr/bin", NULL);
+
+    // "/usr/bin/ls", the "-l" and the NULL after the arguments
+    fixed = strlen("/usr/bin/") + batch_argument_size("ls") + batch_argument_size("-l") + sizeof(char *);
+    assert_false(batch_needed(&environ, &command, path, envp, 2048 + sizeof(char *) + fixed
+                                                             + 2 * batch_argument_size(argv[2])));
+    assert_true(batch_needed(&environ, &command, path, envp, 2048 + sizeof(char *) + fixed
+                                                            + 2 * batch_argument_size(argv[2]) - 1));
+
+    dc_strs_destroy_array(&environ, 2, path);
+    free(path);
+}
+
+Ensure(batch, execute)
+{
+    struct command command;
+    struct batch_options options;
+    struct batch_result result;
+    char *argv[] = { NULL, "start", "a", "b", "c", "d", "e", "end", NULL };
+    char **path;
+    char template[] = "/tmp/batchXXXXXX";
+    int fd;
+
+    fd = mkstemp(template);
+    write(fd, "old\n", 4);
+    close(fd);
+
+    memset(&command, 0, sizeof(struct command));
+    command.command = "echo";
+    command.argv = argv;
+    command.argc = 8;
+    command.stdout_file = template;
+    path = dc_strs_to_array(&environ, &error, 3, "/bin", "/usr/bin", NULL);
+
+    options.arg_max = 1024 * 1024;
+    options.max_bytes = 0;
+    options.max_args = 2;
+    options.jobs = 1;
+    options.launch = NULL;
+
+    // the output is truncated once, then every run appends its line
+    batch_execute(&environ, &error, &command, 2, 7, path, NULL, &options, &result);
+    assert_false(dc_error_has_error(&error));
+    assert_that(result.batches, is_equal_to(3));
+    assert_that(result.failures, is_equal_to(0));
+    assert_that(result.worst, is_equal_to(0));
+    assert_that(count_lines(template), is_equal_to(3));
+    assert_false(command.stdout_overwrite);
+
+    // the runs can be at the same time, the failures are added up
+    command.command = "false";
+    options.max_args = 1;
+    options.jobs = 3;
+    batch_execute(&environ, &error, &command, 2, 7, path, NULL, &options, &result);
+    assert_that(result.batches, is_equal_to(5));
+    assert_that(result.failures, is_equal_to(5));
+    assert_that(result.worst, is_equal_to(1));
+
+    dc_strs_destroy_array(&environ, 3, path);
+    free(path);
+    unlink(template);
+}
+
+static size_t count_lines(const char *file_name)
+{
+    FILE *file;
+    size_t count;
+    int c;
+
+    file = fopen(file_name, "r");
+    count = 0;
+
+    while ((c = getc(file)) != EOF) {
+        if (c == '\n') {
+            count++;
+        }
+    }
+
+    fclose(file);
+
+    return count;
+}
+
+TestSuite *batch_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, batch, split);
+    add_test_with_context(suite, batch, needed);
+    add_test_with_context(suite, batch, execute);
+
+    return suite;
+}
@@ -4,9 +4,14 @@
 #include <dc_util/filesystem.h>
 #include <dc_util/path.h>
 #include <dc_util/strings.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 static void test_builtin_cd(const char *line, const char *cmd, size_t argc, char **argv, const char *expected_dir, const char *expected_message);
+static void test_builtin_xargs(char **argv, size_t argc, const char *input, size_t input_length, int expected_exit_code, const char *expected_output);
+static void test_builtin_echo(char **argv, size_t argc, const char *expected_output);
+static bool has_line(const char *file_name);
 
 Describe(builtin);
 
@@ -65,6 +70,77 @@ Ensure(builtin, builtin_cd)
     test_builtin_cd("cd fixme\n", "cd", 2, argv, "/tmp", message);
 }
 
+Ensure(builtin, builtin_xargs)
+{
+    test_builtin_xargs((char *[]) { NULL, NULL }, 1, "a b\n'c d' e\\ f\n", sizeof("a b\n'c d' e\\ f\n") - 1, 0, "a b c d e f\n");
+    test_builtin_xargs((char *[]) { NULL, "-n", "2", "echo", "x", NULL }, 5, "a b c d e", sizeof("a b c d e") - 1, 0, "x a b\nx c d\nx e\n");
+    test_builtin_xargs((char *[]) { NULL, "-0", "-P", "1", "-n", "1", NULL }, 6, "a b\0\0c", sizeof("a b\0\0c") - 1, 0, "a b\n\nc\n");
+    test_builtin_xargs((char *[]) { NULL, "false", NULL }, 2, "a", sizeof("a") - 1, 123, "");
+    test_builtin_xargs((char *[]) { NULL, "sh", "-c", "exit 255", NULL }, 4, "a", sizeof("a") - 1, 124, "");
+    test_builtin_xargs((char *[]) { NULL, "does-not-exist", NULL }, 2, "a", sizeof("a") - 1, 127, "");
+    test_builtin_xargs((char *[]) { NULL, "-n", NULL }, 2, "a", sizeof("a") - 1, 1, "");
+}
+
+Ensure(builtin, builtin_echo)
+{
+    test_builtin_echo((char *[]) { NULL, NULL }, 1, "\n");
+    test_builtin_echo((char *[]) { NULL, "a", "b c", NULL }, 3, "a b c\n");
+    test_builtin_echo((char *[]) { NULL, "-n", "a", NULL }, 3, "a");
+    test_builtin_echo((char *[]) { NULL, "a", "-n", NULL }, 3, "a -n\n");
+}
+
+Ensure(builtin, builtin_pwd)
+{
+    struct command command;
+    char output[1024];
+    FILE *outstream;
+
+    chdir("/tmp");
+    memset(&command, 0, sizeof(struct command));
+    command.exit_code = 1;
+    memset(output, 0, sizeof(output));
+    outstream = fmemopen(output, sizeof(output), "w");
+    builtin_pwd(&environ, &error, &command, outstream, stderr);
+    assert_false(dc_error_has_error(&error));
+    assert_that(command.exit_code, is_equal_to(0));
+    assert_that(output, is_equal_to_string("/tmp\n"));
+    fclose(outstream);
+}
+
+Ensure(builtin, builtin_let)
+{
+    struct command command;
+    struct variables *variables;
+    char message[1024];
+    FILE *errstream;
+
+    variables = variables_create(&environ, &error);
+    memset(&command, 0, sizeof(struct command));
+    command.argc = 3;
+    command.argv = (char *[]) { NULL, "x = 2", "y = x * 3", NULL };
+    builtin_let(&environ, &error, &command, NULL, variables, stderr);
+    assert_that(command.exit_code, is_equal_to(0));
+    assert_that(variables_get(&environ, variables, "y"), is_equal_to_string("6"));
+
+    // the status is whether the last value is 0
+    command.argc = 2;
+    command.argv = (char *[]) { NULL, "y - 6", NULL };
+    builtin_let(&environ, &error, &command, NULL, variables, stderr);
+    assert_that(command.exit_code, is_equal_to(1));
+
+    memset(message, 0, sizeof(message));
+    errstream = fmemopen(message, sizeof(message), "w");
+    command.argv = (char *[]) { NULL, "y / 0", NULL };
+    builtin_let(&environ, &error, &command, NULL, variables, errstream);
+    fflush(errstream);
+    assert_false(dc_error_has_error(&error));
+    assert_that(command.exit_code, is_equal_to(1));
+    assert_that(message, is_equal_to_string("let: arithmetic: division by zero\n"));
+    fclose(errstream);
+
+    variables_destroy(&environ, &variables);
+}
+
 static void test_builtin_cd(const char *line, const char *cmd, size_t argc, char **argv, const char *expected_dir, const char *expected_message)
 {
     struct command command;
@@ -100,12 +176,334 @@ static void test_builtin_cd(const char *line, const char *cmd, size_t argc, char
     destroy_command(&environ, &command);
 }
 
+static void test_builtin_xargs(char **argv, size_t argc, const char *input, size_t input_length, int expected_exit_code, const char *expected_output)
+{
+    struct command command;
+    char output[1024];
+    char message[1024];
+    char template[16];
+    char **path;
+    FILE *instream;
+    FILE *errstream;
+    FILE *file;
+    size_t length;
+
+    strcpy(template, "/tmp/fileXXXXXX");
+    close(mkstemp(template));
+    memset(&command, 0, sizeof(struct command));
+    command.command = "xargs";
+    command.argc = argc;
+    command.argv = argv;
+    command.stdout_file = template;
+    path = dc_strs_to_array(&environ, &error, 3, "/bin", "/usr/bin", NULL);
+    instream = fmemopen((void *) input, input_length, "r");
+    errstream = fmemopen(message, sizeof(message), "w");
+
+    builtin_xargs(&environ, &error, &command, path, NULL, 1024 * 1024, instream, errstream);
+    assert_false(dc_error_has_error(&error));
+    assert_that(command.exit_code, is_equal_to(expected_exit_code));
+
+    memset(output, 0, sizeof(output));
+    file = fopen(template, "r");
+    length = fread(output, 1, sizeof(output) - 1, file);
+    fclose(file);
+    assert_that(length, is_equal_to(strlen(expected_output)));
+    assert_that(output, is_equal_to_string(expected_output));
+
+    fclose(instream);
+    fclose(errstream);
+    dc_strs_destroy_array(&environ, 3, path);
+    free(path);
+    unlink(template);
+}
+
+Ensure(builtin, builtin_exec)
+{
+    struct command command;
+    char file_name[] = "/tmp/dc_exec_XXXXXX";
+    char copy_name[64];
+    char text[64];
+    pid_t child;
+    int status;
+    FILE *file;
+
+    // the program takes the place of the process, so its exit code is the process's
+    child = fork();
+
+    if (child == 0) {
+        memset(&command, 0, sizeof(struct command));
+        command.command = strdup("exec");
+        command.argc = 4;
+        command.argv = (char *[]) { NULL, "sh", "-c", "exit 4", NULL };
+        builtin_exec(&environ, &error, &command, (char *[]) { "/bin", "/usr/bin", NULL }, NULL, stdout, stderr);
+        _exit(1);
+    }
+
+    assert_that(waitpid(child, &status, 0), is_equal_to(child));
+    assert_that(WEXITSTATUS(status), is_equal_to(4));
+
+    // without a command the redirections stay for what runs after it
+    assert_that(mkstemp(file_name), is_not_equal_to(-1));
+    child = fork();
+
+    if (child == 0) {
+        memset(&command, 0, sizeof(struct command));
+        command.command = "exec";
+        command.argc = 1;
+        command.redirections = (struct redirection[]) { { 1, REDIRECT_OUTPUT, file_name, -1 } };
+        command.redirection_count = 1;
+        builtin_exec(&environ, &error, &command, NULL, NULL, stdout, stderr);
+        printf("kept %d\n", command.exit_code);
+        fflush(stdout);
+        _exit(0);
+    }
+
+    assert_that(waitpid(child, &status, 0), is_equal_to(child));
+    assert_that(WEXITSTATUS(status), is_equal_to(0));
+    file = fopen(file_name, "r");
+    assert_that(fgets(text, sizeof(text), file), is_equal_to(text));
+    assert_that(text, is_equal_to_string("kept 0\n"));
+    fclose(file);
+
+    // with more than one > file the pump is started in the background, the shell stays the same process
+    sprintf(copy_name, "%s.copy", file_name);
+    child = fork();
+
+    if (child == 0) {
+        pid_t pid;
+
+        pid = getpid();
+        memset(&command, 0, sizeof(struct command));
+        command.command = "exec";
+        command.argc = 1;
+        command.redirections = (struct redirection[]) { { 1, REDIRECT_OUTPUT, file_name, -1 },
+                                                        { 1, REDIRECT_OUTPUT, copy_name, -1 } };
+        command.redirection_count = 2;
+        builtin_exec(&environ, &error, &command, NULL, NULL, stdout, stderr);
+        printf("%s %d\n", getpid() == pid ? "kept" : "moved", command.exit_code);
+        fflush(stdout);
+        _exit(0);
+    }
+
+    assert_that(waitpid(child, &status, 0), is_equal_to(child));
+    assert_true(WIFEXITED(status));
+    assert_that(WEXITSTATUS(status), is_equal_to(0));
+
+    // the pump finishes when the process that had the fd has gone
+    for (int i = 0; i < 100 && !(has_line(file_name) && has_line(copy_name)); i++) {
+        usleep(10000);
+    }
+
+    file = fopen(file_name, "r");
+    assert_that(fgets(text, sizeof(text), file), is_equal_to(text));
+    assert_that(text, is_equal_to_string("kept 0\n"));
+    fclose(file);
+    file = fopen(copy_name, "r");
+    assert_that(fgets(text, sizeof(text), file), is_equal_to(text));
+    assert_that(text, is_equal_to_string("kept 0\n"));
+    fclose(file);
+    unlink(copy_name);
+    unlink(file_name);
+}
+
+Ensure(builtin, builtin_timeout)
+{
+    struct command command;
+    char **path;
+    char message[256];
+    FILE *errstream;
+
+    path = (char *[]) { "/bin", "/usr/bin", NULL };
+    memset(&command, 0, sizeof(struct command));
+    command.command = "timeout";
+
+    command.argc = 4;
+    command.argv = (char *[]) { NULL, "5", "true", "ignored", NULL };
+    builtin_timeout(&environ, &error, &command, path, NULL, stderr);
+    assert_that(command.exit_code, is_equal_to(0));
+
+    command.argc = 4;
+    command.argv = (char *[]) { NULL, "0.1", "sleep", "5", NULL };
+    builtin_timeout(&environ, &error, &command, path, NULL, stderr);
+    assert_that(command.exit_code, is_equal_to(124));
+
+    // a program that ignores SIGTERM is killed
+    command.argc = 7;
+    command.argv = (char *[]) { NULL, "-k", "0.1", "0.1", "sh", "-c", "trap '' TERM; sleep 5", NULL };
+    builtin_timeout(&environ, &error, &command, path, NULL, stderr);
+    assert_that(command.exit_code, is_equal_to(137));
+    assert_false(dc_error_has_error(&error));
+
+    memset(message, 0, sizeof(message));
+    errstream = fmemopen(message, sizeof(message), "w");
+    command.argc = 3;
+    command.argv = (char *[]) { NULL, "soon", "true", NULL };
+    builtin_timeout(&environ, &error, &command, path, NULL, errstream);
+    assert_that(command.exit_code, is_equal_to(125));
+    fclose(errstream);
+    assert_that(message, begins_with_string("timeout: usage:"));
+}
+
+Ensure(builtin, builtin_launch)
+{
+    struct command command;
+    char **path;
+    char message[256];
+    FILE *errstream;
+
+    path = (char *[]) { "/bin", "/usr/bin", NULL };
+    memset(&command, 0, sizeof(struct command));
+
+#if defined(__linux__)
+    // the prefixes combine, the program's nice value is the shell's plus 3
+    command.command = "nice";
+    command.argc = 7;
+    command.argv = (char *[]) { NULL, "3", "ionice", "idle", "sh", "-c", "exit $(cut -d' ' -f19 /proc/self/stat)",
+                                NULL };
+    builtin_launch(&environ, &error, &command, path, NULL, stdout, stderr);
+    assert_that(command.exit_code, is_equal_to(getpriority(PRIO_PROCESS, 0) + 3));
+
+    // like nice(1) inside nice(1), the adjustments add up
+    command.command = "nice";
+    command.argc = 8;
+    command.argv = (char *[]) { NULL, "-n", "2", "nice", "3", "sh", "-c", "exit $(cut -d' ' -f19 /proc/self/stat)",
+                                NULL };
+    builtin_launch(&environ, &error, &command, path, NULL, stdout, stderr);
+    assert_that(command.exit_code, is_equal_to(getpriority(PRIO_PROCESS, 0) + 5));
+#endif
+
+    memset(message, 0, sizeof(message));
+    errstream = fmemopen(message, sizeof(message), "w");
+    command.command = "pin";
+    command.argc = 3;
+    command.argv = (char *[]) { NULL, "cpu0", "true", NULL };
+    builtin_launch(&environ, &error, &command, path, NULL, stdout, errstream);
+    assert_that(command.exit_code, is_equal_to(125));
+    fclose(errstream);
+    assert_that(message, begins_with_string("pin: usage:"));
+}
+
+Ensure(builtin, builtin_ulimit)
+{
+    struct command command;
+    struct launch limits;
+    struct rlimit shell;
+    char **path;
+    char output[256];
+    FILE *outstream;
+
+    path = (char *[]) { "/bin", "/usr/bin", NULL };
+    launch_init(&limits);
+    memset(&command, 0, sizeof(struct command));
+    command.command = "ulimit";
+
+    // the session's limits are kept, the shell's own are not changed
+    memset(output, 0, sizeof(output));
+    outstream = fmemopen(output, sizeof(output), "w");
+    command.argc = 5;
+    command.argv = (char *[]) { NULL, "-n", "32", "-S", "-n", NULL };
+    builtin_ulimit(&environ, &error, &command, &limits, path, NULL, outstream, stderr);
+    fclose(outstream);
+    assert_that(command.exit_code, is_equal_to(0));
+    assert_that(output, is_equal_to_string("32\n"));
+    assert_true(limits.limits[3].soft_set);
+    assert_true(limits.limits[3].hard_set);
+    assert_true(getrlimit(RLIMIT_NOFILE, &shell) == 0 && shell.rlim_cur != 32);
+
+    // with a command they are only for its program, on top of the session's
+    command.launch = &limits;
+    command.argc = 6;
+    command.argv = (char *[]) { NULL, "-v", "unlimited", "sh", "-c", "exit $(ulimit -n)", NULL };
+    builtin_ulimit(&environ, &error, &command, &limits, path, NULL, stdout, stderr);
+    assert_that(command.exit_code, is_equal_to(32));
+    assert_false(limits.limits[7].soft_set);
+
+    memset(output, 0, sizeof(output));
+    outstream = fmemopen(output, sizeof(output), "w");
+    command.argc = 3;
+    command.argv = (char *[]) { NULL, "-n", "-1", NULL };
+    builtin_ulimit(&environ, &error, &command, &limits, path, NULL, stdout, outstream);
+    fclose(outstream);
+    assert_that(command.exit_code, is_equal_to(1));
+    assert_that(output, is_equal_to_string("ulimit: -1: invalid number\n"));
+
+    // the other launch prefixes can follow it, and it can follow them
+    command.argc = 7;
+    command.argv = (char *[]) { NULL, "-n", "20", "nice", "sh", "-c", "exit $(ulimit -n)", NULL };
+    builtin_ulimit(&environ, &error, &command, &limits, path, NULL, stdout, stderr);
+    assert_that(command.exit_code, is_equal_to(20));
+
+    command.command = "nice";
+    command.argc = 8;
+    command.argv = (char *[]) { NULL, "2", "ulimit", "-n", "24", "sh", "-c", "exit $(ulimit -n)", NULL };
+    builtin_launch(&environ, &error, &command, path, NULL, stdout, stderr);
+    assert_that(command.exit_code, is_equal_to(24));
+
+    // as a prefix there has to be a program to limit
+    memset(output, 0, sizeof(output));
+    outstream = fmemopen(output, sizeof(output), "w");
+    command.argc = 5;
+    command.argv = (char *[]) { NULL, "2", "ulimit", "-n", "24", NULL };
+    builtin_launch(&environ, &error, &command, path, NULL, stdout, outstream);
+    fclose(outstream);
+    assert_that(command.exit_code, is_equal_to(125));
+    assert_that(output, begins_with_string("ulimit: usage:"));
+}
+
+static void test_builtin_echo(char **argv, size_t argc, const char *expected_output)
+{
+    struct command command;
+    char output[1024];
+    FILE *outstream;
+
+    memset(&command, 0, sizeof(struct command));
+    command.command = "echo";
+    command.argc = argc;
+    command.argv = argv;
+    command.exit_code = 1;
+    memset(output, 0, sizeof(output));
+    outstream = fmemopen(output, sizeof(output), "w");
+
+    builtin_echo(&environ, &error, &command, outstream);
+    assert_false(dc_error_has_error(&error));
+    assert_that(command.exit_code, is_equal_to(0));
+    assert_that(output, is_equal_to_string(expected_output));
+    fclose(outstream);
+}
+
+static bool has_line(const char *file_name)
+{
+    FILE *file;
+    char text[64];
+    bool found;
+
+    file = fopen(file_name, "r");
+
+    if(file == NULL)
+    {
+        return false;
+    }
+
+    found = fgets(text, sizeof(text), file) != NULL && strchr(text, '\n') != NULL;
+    fclose(file);
+
+    return found;
+}
+
 TestSuite *builtin_tests(void)
 {
     TestSuite *suite;
 
     suite = create_test_suite();
     add_test_with_context(suite, builtin, builtin_cd);
+    add_test_with_context(suite, builtin, builtin_xargs);
+    add_test_with_context(suite, builtin, builtin_echo);
+    add_test_with_context(suite, builtin, builtin_pwd);
+    add_test_with_context(suite, builtin, builtin_let);
+    add_test_with_context(suite, builtin, builtin_exec);
+    add_test_with_context(suite, builtin, builtin_timeout);
+    add_test_with_context(suite, builtin, builtin_launch);
+    add_test_with_context(suite, builtin, builtin_ulimit);
 
     return suite;
 }
@@ -559,6 +559,72 @@ static void expand_path(const char *expected_file, char **expanded_file)
     }
 }
 
+Ensure(command, redirections)
+{
+    struct state state;
+    struct command *command;
+
+    state.stdin = NULL;
+    state.stdout = NULL;
+    state.stderr = NULL;
+    init_state(&environ, &error, &state);
+    command = calloc(1, sizeof(struct command));
+    state.command = command;
+
+    // they are kept in the order they are written, whatever the fd
+    command->line = strdup("cmd a 3> 'x y' 2>&1 b 4<&- <>rw >| $((1<2)) $((3>2)) 10<<<word");
+    parse_command(&environ, &error, &state, command);
+    assert_false(dc_error_has_error(&error));
+    assert_that(command->argc, is_equal_to(4));
+    assert_that(command->argv[3], is_equal_to_string("1"));
+    assert_that(command->redirection_count, is_equal_to(6));
+    assert_that(command->redirections[0].fd, is_equal_to(3));
+    assert_that(command->redirections[0].type, is_equal_to(REDIRECT_OUTPUT));
+    assert_that(command->redirections[0].target, is_equal_to_string("x y"));
+    assert_that(command->redirections[1].fd, is_equal_to(2));
+    assert_that(command->redirections[1].type, is_equal_to(REDIRECT_DUPLICATE));
+    assert_that(command->redirections[1].source, is_equal_to(1));
+    assert_that(command->redirections[2].fd, is_equal_to(4));
+    assert_that(command->redirections[2].type, is_equal_to(REDIRECT_CLOSE));
+    assert_that(command->redirections[3].fd, is_equal_to(0));
+    assert_that(command->redirections[3].type, is_equal_to(REDIRECT_READ_WRITE));
+    assert_that(command->redirections[4].fd, is_equal_to(1));
+    assert_that(command->redirections[4].type, is_equal_to(REDIRECT_OUTPUT));
+    assert_that(command->redirections[4].target, is_equal_to_string("1"));
+    assert_that(command->redirections[5].fd, is_equal_to(10));
+    assert_that(command->redirections[5].type, is_equal_to(REDIRECT_HERE));
+    assert_that(command->here_document, is_equal_to_string("word\n"));
+    assert_that(command->stdout_file, is_equal_to_string("1"));
+    assert_that(command->stdin_file, is_null);
+    destroy_command(&environ, command);
+    assert_that(command->redirections, is_null);
+    assert_that(command->redirection_count, is_equal_to(0));
+
+    // a number is only the fd if it starts the word
+    command->line = strdup("echo a2>out 2 >>out");
+    parse_command(&environ, &error, &state, command);
+    assert_that(command->argc, is_equal_to(3));
+    assert_that(command->argv[1], is_equal_to_string("a2"));
+    assert_that(command->redirections[0].fd, is_equal_to(1));
+    assert_that(command->redirections[1].type, is_equal_to(REDIRECT_APPEND));
+    assert_true(command->stdout_overwrite);
+    destroy_command(&environ, command);
+
+    command->line = strdup("cat >");
+    parse_command(&environ, &error, &state, command);
+    assert_that(error.err_code, is_equal_to(EINVAL));
+    dc_error_reset(&error);
+    destroy_command(&environ, command);
+
+    command->line = strdup("cat 2>&x");
+    parse_command(&environ, &error, &state, command);
+    assert_that(error.err_code, is_equal_to(EINVAL));
+    dc_error_reset(&error);
+    destroy_command(&environ, command);
+
+    destroy_state(&environ, &error, &state);
+}
+
 Ensure(command, destroy_command)
 {
     test_destroy_command("ls");
@@ -593,6 +659,7 @@ TestSuite *command_tests(void)
 
     suite = create_test_suite();
     add_test_with_context(suite, command, parse_command);
+    add_test_with_context(suite, command, redirections);
     add_test_with_context(suite, command, destroy_command);
 
     return suite;
@@ -0,0 +1,258 @@
+#include "tests.h"
+#include "copy.h"
+#include "shell_impl.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static bool test_applies(const char *line);
+static int test_copy(const char *line, FILE *outstream, FILE *errstream, struct copy_stats *stats);
+static int test_launched_copy(const char *line, const struct launch *launch, FILE *outstream, FILE *errstream,
+                              struct copy_stats *stats);
+static void write_file(const char *file_name, const char *text);
+static void assert_file_contents(const char *file_name, const char *expected);
+
+Describe(copy);
+
+static struct dc_posix_env environ;
+static struct dc_error error;
+static char directory[] = "/tmp/dc_copy_XXXXXX";
+
+BeforeEach(copy)
+{
+    dc_posix_env_init(&environ, NULL);
+    dc_error_init(&error, NULL);
+    strcpy(directory, "/tmp/dc_copy_XXXXXX");
+    assert_that(mkdtemp(directory), is_not_null);
+    assert_that(chdir(directory), is_equal_to(0));
+}
+
+AfterEach(copy)
+{
+    dc_error_reset(&error);
+    assert_that(chdir("/tmp"), is_equal_to(0));
+}
+
+Ensure(copy, applies)
+{
+    assert_true(test_applies("cat a > b"));
+    assert_true(test_applies("cat a b >> c"));
+    assert_true(test_applies("cat < a"));
+    assert_true(test_applies("cat a - < b > c"));
+    assert_true(test_applies("< a > b"));
+    assert_true(test_applies("> b"));
+    assert_true(test_applies("A=1 2>&1"));
+
+    assert_false(test_applies("cat"));
+    assert_false(test_applies("cat -n a > b"));
+    assert_false(test_applies("cat - > b"));
+    assert_false(test_applies("cat a 2> e"));
+    assert_false(test_applies("cat a >&2"));
+    assert_false(test_applies("cat <<<word"));
+    assert_false(test_applies("ls a > b"));
+    assert_false(test_applies("A=1"));
+}
+
+Ensure(copy, execute)
+{
+    struct copy_stats stats;
+    FILE *outstream;
+    FILE *errstream;
+    char message[256];
+    char line[256];
+
+    memset(&stats, 0, sizeof(struct copy_stats));
+    outstream = tmpfile();
+    memset(message, 0, sizeof(message));
+    errstream = fmemopen(message, sizeof(message), "w");
+    write_file("a", "first\n");
+    write_file("b", "second\n");
+
+    assert_that(test_copy("< a > copy", outstream, errstream, &stats), is_equal_to(0));
+    assert_file_contents("copy", "first\n");
+
+    assert_that(test_copy("cat a - b < b >> copy", outstream, errstream, &stats), is_equal_to(0));
+    assert_file_contents("copy", "first\nfirst\nsecond\nsecond\n");
+
+    // every > file gets all of it
+    assert_that(test_copy("cat a b > copy > other", outstream, errstream, &stats), is_equal_to(0));
+    assert_file_contents("copy", "first\nsecond\n");
+    assert_file_contents("other", "first\nsecond\n");
+    assert_that(test_copy("< a >> copy > other", outstream, errstream, &stats), is_equal_to(0));
+    assert_file_contents("copy", "first\nsecond\nfirst\n");
+    assert_file_contents("other", "first\n");
+
+    // only opening the file truncates it
+    assert_that(test_copy("> copy", outstream, errstream, &stats), is_equal_to(0));
+    assert_file_contents("copy", "");
+    assert_that(test_copy("< a", outstream, errstream, &stats), is_equal_to(0));
+
+    // a missing file is skipped, the rest are still copied
+    assert_that(test_copy("cat a missing b > copy", outstream, errstream, &stats), is_equal_to(1));
+    assert_file_contents("copy", "first\nsecond\n");
+    fflush(errstream);
+    assert_that(message, is_equal_to_string("cat: missing: No such file or directory\n"));
+
+    assert_that(test_copy("cat a < missing", outstream, errstream, &stats), is_equal_to(1));
+
+    // what the shell wrote before comes first
+    fputs("shell\n", outstream);
+    assert_that(test_copy("cat b", outstream, errstream, &stats), is_equal_to(0));
+    rewind(outstream);
+    assert_that(fgets(line, sizeof(line), outstream), is_equal_to(line));
+    assert_that(line, is_equal_to_string("shell\n"));
+    assert_that(fgets(line, sizeof(line), outstream), is_equal_to(line));
+    assert_that(line, is_equal_to_string("second\n"));
+
+    assert_that(stats.commands, is_equal_to(9));
+#if defined(__linux__)
+    assert_that(stats.kernel_bytes, is_greater_than(0));
+#endif
+
+    fclose(errstream);
+    fclose(outstream);
+}
+
+Ensure(copy, limits)
+{
+    struct launch launch;
+    struct copy_stats stats;
+    FILE *outstream;
+    char big[4096];
+    struct stat info;
+
+    memset(&stats, 0, sizeof(struct copy_stats));
+    outstream = tmpfile();
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    write_file("big", big);
+
+    // ulimit -f 1: the copy is stopped at 512 bytes, as cat would be
+    launch_init(&launch);
+    assert_true(launch_parse_limit(&launch, 'f', "1", true, false));
+    assert_that(test_launched_copy("cat big > out", &launch, outstream, stderr, &stats), is_equal_to(128 + SIGXFSZ));
+    assert_that(stat("out", &info), is_equal_to(0));
+    assert_that(info.st_size, is_equal_to(512));
+    assert_that(test_launched_copy("< big > other", &launch, outstream, stderr, &stats), is_equal_to(128 + SIGXFSZ));
+    assert_that(stat("other", &info), is_equal_to(0));
+    assert_that(info.st_size, is_equal_to(512));
+
+    // what fits is copied, and the shell itself is not limited
+    assert_that(test_launched_copy("cat out > small", &launch, outstream, stderr, &stats), is_equal_to(0));
+    assert_that(stat("small", &info), is_equal_to(0));
+    assert_that(info.st_size, is_equal_to(512));
+    assert_that(test_copy("cat big > out", outstream, stderr, &stats), is_equal_to(0));
+    assert_that(stat("out", &info), is_equal_to(0));
+    assert_that(info.st_size, is_equal_to(4095));
+    assert_that(stats.commands, is_equal_to(4));
+
+    fclose(outstream);
+}
+
+Ensure(copy, copy_fd)
+{
+    struct copy_stats stats;
+    int fds[2];
+    int out;
+
+    memset(&stats, 0, sizeof(struct copy_stats));
+    assert_that(pipe(fds), is_equal_to(0));
+    assert_that(write(fds[1], "piped\n", 6), is_equal_to(6));
+    close(fds[1]);
+
+    out = open("out", O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    assert_that(copy_fd(fds[0], out, &stats), is_equal_to(0));
+    assert_that(stats.kernel_bytes + stats.buffered_bytes, is_equal_to(6));
+    close(fds[0]);
+    close(out);
+    assert_file_contents("out", "piped\n");
+
+    // a closed fd is an error, not an empty copy
+    assert_that(copy_fd(fds[0], 1, NULL), is_equal_to(EBADF));
+}
+
+static bool test_applies(const char *line)
+{
+    struct state state;
+    bool applies;
+
+    state.stdin = NULL;
+    state.stdout = NULL;
+    state.stderr = NULL;
+    init_state(&environ, &error, &state);
+    state.command = calloc(1, sizeof(struct command));
+    state.command->line = strdup(line);
+    parse_command(&environ, &error, &state, state.command);
+    assert_false(dc_error_has_error(&error));
+    applies = copy_applies(state.command);
+    destroy_state(&environ, &error, &state);
+
+    return applies;
+}
+
+static int test_copy(const char *line, FILE *outstream, FILE *errstream, struct copy_stats *stats)
+{
+    return test_launched_copy(line, NULL, outstream, errstream, stats);
+}
+
+static int test_launched_copy(const char *line, const struct launch *launch, FILE *outstream, FILE *errstream,
+                              struct copy_stats *stats)
+{
+    struct state state;
+    int exit_code;
+
+    state.stdin = NULL;
+    state.stdout = NULL;
+    state.stderr = NULL;
+    init_state(&environ, &error, &state);
+    state.command = calloc(1, sizeof(struct command));
+    state.command->line = strdup(line);
+    parse_command(&environ, &error, &state, state.command);
+    assert_true(copy_applies(state.command));
+    state.command->launch = launch;
+    copy_execute(&environ, &error, state.command, outstream, errstream, stats);
+    exit_code = state.command->exit_code;
+    destroy_state(&environ, &error, &state);
+
+    return exit_code;
+}
+
+static void write_file(const char *file_name, const char *text)
+{
+    FILE *file;
+
+    file = fopen(file_name, "w");
+    assert_that(file, is_not_null);
+    fputs(text, file);
+    fclose(file);
+}
+
+static void assert_file_contents(const char *file_name, const char *expected)
+{
+    FILE *file;
+    char contents[256];
+    size_t length;
+
+    file = fopen(file_name, "r");
+    assert_that(file, is_not_null);
+    length = fread(contents, 1, sizeof(contents) - 1, file);
+    contents[length] = '\0';
+    fclose(file);
+    assert_that(contents, is_equal_to_string(expected));
+}
+
+TestSuite *copy_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, copy, applies);
+    add_test_with_context(suite, copy, execute);
+    add_test_with_context(suite, copy, limits);
+    add_test_with_context(suite, copy, copy_fd);
+
+    return suite;
+}
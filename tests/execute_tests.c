@@ -61,6 +61,27 @@ Ensure(execute, execute)
     free(path);
 }
 
+Ensure(execute, parse_duration)
+{
+    long milliseconds;
+
+    assert_true(parse_duration("2", &milliseconds));
+    assert_that(milliseconds, is_equal_to(2000));
+    assert_true(parse_duration("0.25s", &milliseconds));
+    assert_that(milliseconds, is_equal_to(250));
+    assert_true(parse_duration("1.5m", &milliseconds));
+    assert_that(milliseconds, is_equal_to(90000));
+    assert_true(parse_duration("1h", &milliseconds));
+    assert_that(milliseconds, is_equal_to(3600000));
+    assert_true(parse_duration("0", &milliseconds));
+    assert_that(milliseconds, is_equal_to(0));
+
+    assert_false(parse_duration("", &milliseconds));
+    assert_false(parse_duration("-1", &milliseconds));
+    assert_false(parse_duration("1x", &milliseconds));
+    assert_false(parse_duration("1ss", &milliseconds));
+}
+
 static void test_execute(const char *cmd, size_t argc, char **argv, char **path, bool check_exit_code, int expected_exit_code, const char *out_file_name, const char *err_file_name)
 {
     struct command command;
@@ -80,7 +101,7 @@ static void test_execute(const char *cmd, size_t argc, char **argv, char **path,
         command.stderr_file = strdup(err_file_name);
     }
 
-    execute(&environ, &error, &command, path);
+    execute(&environ, &error, &command, path, NULL);
 
     if(check_exit_code)
     {
@@ -114,6 +135,7 @@ TestSuite *execute_tests(void)
 
     suite = create_test_suite();
     add_test_with_context(suite, execute, execute);
+    add_test_with_context(suite, execute, parse_duration);
 
     return suite;
 }
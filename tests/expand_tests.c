@@ -0,0 +1,224 @@
+#include "tests.h"
+#include "expand.h"
+#include "pathname.h"
+#include "variables.h"
+
+static void test_split(const char *line, size_t expected_count, const char **expected);
+static void test_expand(struct state *state, const char *line, size_t expected_count, const char **expected);
+
+Describe(expand);
+
+static struct dc_posix_env environ;
+static struct dc_error error;
+
+BeforeEach(expand)
+{
+    dc_posix_env_init(&environ, NULL);
+    dc_error_init(&error, NULL);
+}
+
+AfterEach(expand)
+{
+    dc_error_reset(&error);
+}
+
+Ensure(expand, split_words)
+{
+    char **words;
+    size_t count;
+
+    test_split("", 0, NULL);
+    test_split("   ", 0, NULL);
+    test_split("ls", 1, (const char *[]) { "ls" });
+    test_split("  ls  -l\t/tmp ", 3, (const char *[]) { "ls", "-l", "/tmp" });
+    test_split("echo 'a b' \"c d\"", 3, (const char *[]) { "echo", "'a b'", "\"c d\"" });
+    test_split("echo a\\ b", 2, (const char *[]) { "echo", "a\\ b" });
+    test_split("echo $(ls -l) ${X:-a b}", 3, (const char *[]) { "echo", "$(ls -l)", "${X:-a b}" });
+    test_split("echo \"$(echo \")\")\"", 2, (const char *[]) { "echo", "\"$(echo \")\")\"" });
+    test_split("echo '|' \\;", 3, (const char *[]) { "echo", "'|'", "\\;" });
+    test_split("diff <(ls a) >(wc -l)", 3, (const char *[]) { "diff", "<(ls a)", ">(wc -l)" });
+
+    words = split_words(&environ, &error, "echo 'abc", &count);
+    assert_that(words, is_null);
+    assert_that(error.err_code, is_equal_to(EINVAL));
+    dc_error_reset(&error);
+
+    words = split_words(&environ, &error, "ls | wc", &count);
+    assert_that(words, is_null);
+    assert_that(error.err_code, is_equal_to(EINVAL));
+}
+
+Ensure(expand, expand_words)
+{
+    struct state state;
+
+    memset(&state, 0, sizeof(struct state));
+    state.variables = variables_create(&environ, &error);
+    variables_set(&environ, &error, state.variables, "X", "a  b");
+    variables_set(&environ, &error, state.variables, "EMPTY", "");
+    variables_set(&environ, &error, state.variables, "HOME", "/home/user");
+    state.exit_code = 3;
+
+    test_expand(&state, "echo $X", 3, (const char *[]) { "echo", "a", "b" });
+    test_expand(&state, "echo \"$X\"", 2, (const char *[]) { "echo", "a  b" });
+    test_expand(&state, "echo '$X'", 2, (const char *[]) { "echo", "$X" });
+    test_expand(&state, "echo ${X}c", 3, (const char *[]) { "echo", "a", "bc" });
+    test_expand(&state, "echo $EMPTY $UNSET", 1, (const char *[]) { "echo" });
+    test_expand(&state, "echo \"$EMPTY\" ''", 3, (const char *[]) { "echo", "", "" });
+    test_expand(&state, "echo ${UNSET:-d e} ${X:+set}", 4, (const char *[]) { "echo", "d", "e", "set" });
+    test_expand(&state, "echo ${#X} $?", 3, (const char *[]) { "echo", "4", "3" });
+    test_expand(&state, "echo ~ ~/bin a~", 4, (const char *[]) { "echo", "/home/user", "/home/user/bin", "a~" });
+    test_expand(&state, "echo a\\ b \"\\$X\" \\\"", 4, (const char *[]) { "echo", "a b", "$X", "\"" });
+
+    // ${NAME=word} assigns the word
+    test_expand(&state, "echo ${NEW=value}", 2, (const char *[]) { "echo", "value" });
+    assert_that(variables_get(&environ, state.variables, "NEW"), is_equal_to_string("value"));
+
+    // IFS changes where the values are split
+    variables_set(&environ, &error, state.variables, "IFS", ":");
+    variables_set(&environ, &error, state.variables, "P", "/bin::/usr/bin");
+    test_expand(&state, "echo $P", 4, (const char *[]) { "echo", "/bin", "", "/usr/bin" });
+
+    variables_destroy(&environ, &state.variables);
+}
+
+Ensure(expand, assignments)
+{
+    struct state state;
+    char **words;
+    char **expanded;
+    size_t count;
+    size_t expanded_count;
+    size_t assignment_count;
+
+    memset(&state, 0, sizeof(struct state));
+    state.variables = variables_create(&environ, &error);
+    variables_set(&environ, &error, state.variables, "X", "a  b");
+    variables_set(&environ, &error, state.variables, "HOME", "/home/user");
+
+    words = split_words(&environ, &error, "A=$X B=~/bin ls C=$X", &count);
+    expanded = expand_words(&environ, &error, &state, words, count, &expanded_count, &assignment_count, NULL);
+    assert_false(dc_error_has_error(&error));
+
+    // assignments are not split, a NAME=value after the command is just an argument
+    assert_that(assignment_count, is_equal_to(2));
+    assert_that(expanded_count, is_equal_to(5));
+    assert_that(expanded[0], is_equal_to_string("A=a  b"));
+    assert_that(expanded[1], is_equal_to_string("B=/home/user/bin"));
+    assert_that(expanded[2], is_equal_to_string("ls"));
+    assert_that(expanded[3], is_equal_to_string("C=a"));
+    assert_that(expanded[4], is_equal_to_string("b"));
+    assert_that(expanded[5], is_null);
+
+    free_words(&environ, expanded, expanded_count);
+    free_words(&environ, words, count);
+    variables_destroy(&environ, &state.variables);
+}
+
+Ensure(expand, pathnames)
+{
+    struct state state;
+    char root[32];
+    char path[64];
+    char pattern[64];
+    char quoted[64];
+    char **words;
+    char **expanded;
+    size_t count;
+    size_t expanded_count;
+    size_t range[2];
+    FILE *file;
+
+    memset(&state, 0, sizeof(struct state));
+    state.pathname_cache = pathname_cache_create(&environ, &error);
+
+    strcpy(root, "/tmp/expandXXXXXX");
+    mkdtemp(root);
+    sprintf(path, "%s/b.c", root);
+    file = fopen(path, "w");
+    fclose(file);
+    sprintf(path, "%s/a.c", root);
+    file = fopen(path, "w");
+    fclose(file);
+
+    sprintf(pattern, "%s/*.c", root);
+    words = split_words(&environ, &error, pattern, &count);
+    expanded = expand_words(&environ, &error, &state, words, count, &expanded_count, NULL, NULL);
+    assert_that(expanded_count, is_equal_to(2));
+    assert_that(expanded[0], is_equal_to_string(path));
+    free_words(&environ, expanded, expanded_count);
+    free_words(&environ, words, count);
+
+    // the range is where the matches are, so a long list can be split there
+    sprintf(quoted, "ls -l %s end", pattern);
+    words = split_words(&environ, &error, quoted, &count);
+    expanded = expand_words(&environ, &error, &state, words, count, &expanded_count, NULL, range);
+    assert_that(expanded_count, is_equal_to(5));
+    assert_that(range[0], is_equal_to(2));
+    assert_that(range[1], is_equal_to(4));
+    free_words(&environ, expanded, expanded_count);
+    free_words(&environ, words, count);
+
+    // a quoted pattern is not expanded
+    sprintf(quoted, "\"%s\"", pattern);
+    words = split_words(&environ, &error, quoted, &count);
+    expanded = expand_words(&environ, &error, &state, words, count, &expanded_count, NULL, range);
+    assert_that(expanded_count, is_equal_to(1));
+    assert_that(expanded[0], is_equal_to_string(pattern));
+    assert_that(range[0], is_equal_to(range[1]));
+    free_words(&environ, expanded, expanded_count);
+    free_words(&environ, words, count);
+
+    pathname_cache_destroy(&environ, &state.pathname_cache);
+}
+
+static void test_split(const char *line, size_t expected_count, const char **expected)
+{
+    char **words;
+    size_t count;
+
+    words = split_words(&environ, &error, line, &count);
+    assert_false(dc_error_has_error(&error));
+    assert_that(count, is_equal_to(expected_count));
+
+    for (size_t i = 0; i < count; i++) {
+        assert_that(words[i], is_equal_to_string(expected[i]));
+    }
+
+    assert_that(words[count], is_null);
+    free_words(&environ, words, count);
+}
+
+static void test_expand(struct state *state, const char *line, size_t expected_count, const char **expected)
+{
+    char **words;
+    char **expanded;
+    size_t count;
+    size_t expanded_count;
+
+    words = split_words(&environ, &error, line, &count);
+    expanded = expand_words(&environ, &error, state, words, count, &expanded_count, NULL, NULL);
+    assert_false(dc_error_has_error(&error));
+    assert_that(expanded_count, is_equal_to(expected_count));
+
+    for (size_t i = 0; i < expanded_count; i++) {
+        assert_that(expanded[i], is_equal_to_string(expected[i]));
+    }
+
+    assert_that(expanded[expanded_count], is_null);
+    free_words(&environ, expanded, expanded_count);
+    free_words(&environ, words, count);
+}
+
+TestSuite *expand_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, expand, split_words);
+    add_test_with_context(suite, expand, expand_words);
+    add_test_with_context(suite, expand, assignments);
+    add_test_with_context(suite, expand, pathnames);
+
+    return suite;
+}
@@ -0,0 +1,96 @@
+#include "tests.h"
+#include "history.h"
+#include <unistd.h>
+
+Describe(history);
+
+static struct dc_posix_env environ;
+static struct dc_error error;
+
+BeforeEach(history)
+{
+    dc_posix_env_init(&environ, NULL);
+    dc_error_init(&error, NULL);
+}
+
+AfterEach(history)
+{
+    dc_error_reset(&error);
+}
+
+Ensure(history, add_and_get)
+{
+    struct history *history;
+
+    history = history_create(&environ, &error, 3, NULL);
+    assert_that(history, is_not_null);
+    assert_that(history_get(history, 0), is_null);
+
+    history_add(&environ, &error, history, "one");
+    history_add(&environ, &error, history, "");
+    history_add(&environ, &error, history, "two");
+    history_add(&environ, &error, history, "two");
+    assert_that(history->count, is_equal_to(2));
+    assert_that(history_get(history, 0), is_equal_to_string("two"));
+    assert_that(history_get(history, 1), is_equal_to_string("one"));
+    assert_that(history_get(history, 2), is_null);
+
+    // the oldest line is dropped once the history is full
+    history_add(&environ, &error, history, "three");
+    history_add(&environ, &error, history, "four");
+    assert_that(history->count, is_equal_to(3));
+    assert_that(history_get(history, 0), is_equal_to_string("four"));
+    assert_that(history_get(history, 2), is_equal_to_string("two"));
+    assert_that(history_get(history, 3), is_null);
+
+    history_destroy(&environ, &history);
+    assert_that(history, is_null);
+}
+
+Ensure(history, load_and_save)
+{
+    struct history *history;
+    char template[32];
+    int fd;
+
+    strcpy(template, "/tmp/historyXXXXXX");
+    fd = mkstemp(template);
+    write(fd, "ls\n  cd /tmp  \n\npwd\n", 20);
+    close(fd);
+
+    history = history_create(&environ, &error, 10, template);
+    assert_that(history->count, is_equal_to(0));
+    history_load(&environ, &error, history);
+    assert_false(dc_error_has_error(&error));
+    assert_that(history->count, is_equal_to(3));
+    assert_that(history_get(history, 0), is_equal_to_string("pwd"));
+    assert_that(history_get(history, 1), is_equal_to_string("cd /tmp"));
+    history_add(&environ, &error, history, "echo hi");
+    history_destroy(&environ, &history);
+
+    history = history_create(&environ, &error, 2, template);
+    history_load(&environ, &error, history);
+    assert_that(history->count, is_equal_to(2));
+    assert_that(history_get(history, 0), is_equal_to_string("echo hi"));
+    assert_that(history_get(history, 1), is_equal_to_string("pwd"));
+    history_destroy(&environ, &history);
+
+    unlink(template);
+
+    history = history_create(&environ, &error, 2, template);
+    history_load(&environ, &error, history);
+    assert_false(dc_error_has_error(&error));
+    assert_that(history->count, is_equal_to(0));
+    history_destroy(&environ, &history);
+}
+
+TestSuite *history_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, history, add_and_get);
+    add_test_with_context(suite, history, load_and_save);
+
+    return suite;
+}
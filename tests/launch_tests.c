@@ -0,0 +1,182 @@
+#include "tests.h"
+#include "launch.h"
+#include "variables.h"
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+Describe(launch);
+
+static struct dc_posix_env environ;
+static struct dc_error error;
+
+BeforeEach(launch)
+{
+    dc_posix_env_init(&environ, NULL);
+    dc_error_init(&error, NULL);
+}
+
+AfterEach(launch)
+{
+    dc_error_reset(&error);
+}
+
+Ensure(launch, parse)
+{
+    struct launch launch;
+
+    launch_init(&launch);
+    assert_false(launch_is_set(&launch));
+
+    assert_true(launch_parse_cpus(&launch, "0,2-4,9"));
+    assert_that(launch.cpus[0], is_equal_to(0x1D));
+    assert_that(launch.cpus[1], is_equal_to(0x02));
+    assert_false(launch_parse_cpus(&launch, "1-"));
+    assert_false(launch_parse_cpus(&launch, "3-2"));
+    assert_false(launch_parse_cpus(&launch, "1,,2"));
+    assert_false(launch_parse_cpus(&launch, "1024"));
+    assert_false(launch_parse_cpus(&launch, ""));
+    assert_that(launch.cpus[0], is_equal_to(0x1D));
+
+    // each adjustment adds to the ones before it, like nice nice
+    assert_true(launch_parse_nice(&launch, "10"));
+    assert_that(launch.nice, is_equal_to(10));
+    assert_true(launch_parse_nice(&launch, "-20"));
+    assert_that(launch.nice, is_equal_to(-10));
+    assert_true(launch_parse_nice(&launch, "+3"));
+    assert_that(launch.nice, is_equal_to(-7));
+    assert_false(launch_parse_nice(&launch, "20"));
+    assert_false(launch_parse_nice(&launch, "-21"));
+    assert_false(launch_parse_nice(&launch, "ten"));
+    assert_that(launch.nice, is_equal_to(-7));
+
+    for (int i = 0; i < 5; i++) {
+        launch_parse_nice(&launch, "-20");
+    }
+
+    assert_that(launch.nice, is_equal_to(-39));
+
+    assert_true(launch_parse_ionice(&launch, "idle"));
+    assert_that(launch.io_class, is_equal_to(LAUNCH_IO_IDLE));
+    assert_true(launch_parse_ionice(&launch, "best-effort:7"));
+    assert_that(launch.io_class, is_equal_to(LAUNCH_IO_BEST_EFFORT));
+    assert_that(launch.io_level, is_equal_to(7));
+    assert_true(launch_parse_ionice(&launch, "1"));
+    assert_that(launch.io_class, is_equal_to(LAUNCH_IO_REALTIME));
+    assert_that(launch.io_level, is_equal_to(4));
+    assert_false(launch_parse_ionice(&launch, "idle:1"));
+    assert_false(launch_parse_ionice(&launch, "best-effort:8"));
+    assert_false(launch_parse_ionice(&launch, "best"));
+
+    assert_true(launch_is_set(&launch));
+}
+
+Ensure(launch, limits)
+{
+    struct launch launch;
+    rlim_t value;
+
+    launch_init(&launch);
+    assert_true(launch_parse_limit(&launch, 'n', "64", true, true));
+    assert_true(launch_is_set(&launch));
+    assert_true(launch_get_limit(&launch, 'n', false, &value));
+    assert_that(value, is_equal_to(64));
+    assert_true(launch_get_limit(&launch, 'n', true, &value));
+    assert_that(value, is_equal_to(64));
+
+    // in the option's units, and only the part asked for
+    assert_true(launch_parse_limit(&launch, 'v', "2048", true, false));
+    assert_that(launch.limits[7].soft, is_equal_to(2048 * 1024));
+    assert_false(launch.limits[7].hard_set);
+    assert_true(launch_get_limit(&launch, 'v', false, &value));
+    assert_that(value, is_equal_to(2048));
+    assert_true(launch_parse_limit(&launch, 'c', "unlimited", false, true));
+    assert_that(launch.limits[0].hard, is_equal_to(RLIM_INFINITY));
+
+    assert_false(launch_parse_limit(&launch, 'x', "1", true, true));
+    assert_false(launch_parse_limit(&launch, 'n', "-1", true, true));
+    assert_false(launch_parse_limit(&launch, 'n', "1k", true, true));
+    assert_false(launch_parse_limit(&launch, 'd', "99999999999999999999", true, true));
+    assert_false(launch_get_limit(&launch, 'x', false, &value));
+    assert_that(launch_limit_description('n'), is_equal_to_string("open files"));
+    assert_that(launch_limit_description('x'), is_null);
+}
+
+Ensure(launch, defaults)
+{
+    struct variables *variables;
+    struct launch launch;
+    struct launch base;
+
+    assert_false(launch_defaults(&environ, NULL, NULL, &launch));
+
+    variables = variables_create(&environ, &error);
+    assert_false(launch_defaults(&environ, variables, NULL, &launch));
+
+    // one that does not parse is left out, the rest still apply
+    variables_set(&environ, &error, variables, "BATCH_NICE", "5");
+    variables_set(&environ, &error, variables, "BATCH_IONICE", "sometimes");
+    assert_true(launch_defaults(&environ, variables, NULL, &launch));
+    assert_true(launch.renice);
+    assert_that(launch.nice, is_equal_to(5));
+    assert_false(launch.pin);
+    assert_that(launch.io_class, is_equal_to(LAUNCH_IO_UNCHANGED));
+
+    // the command's own limits are kept
+    launch_init(&base);
+    launch_parse_limit(&base, 'n', "32", true, true);
+    assert_true(launch_defaults(&environ, variables, &base, &launch));
+    assert_true(launch.renice);
+    assert_true(launch.limits[3].soft_set);
+
+    variables_destroy(&environ, &variables);
+}
+
+Ensure(launch, apply)
+{
+    struct launch launch;
+    struct rlimit limit;
+    pid_t child;
+    int status;
+    int before;
+
+    // the process is changed for good, so it is done in a child
+    before = getpriority(PRIO_PROCESS, 0);
+    child = fork();
+
+    if (child == 0) {
+        launch_init(&launch);
+        launch_parse_nice(&launch, "2");
+        launch_parse_ionice(&launch, "best-effort:5");
+        launch_parse_limit(&launch, 'n', "16", true, false);
+#if defined(__linux__)
+        launch_parse_cpus(&launch, "0");
+#endif
+
+        if (!launch_apply(&launch, stderr)) {
+            _exit(2);
+        }
+
+        if (getrlimit(RLIMIT_NOFILE, &limit) == -1 || limit.rlim_cur != 16) {
+            _exit(1);
+        }
+
+        _exit(getpriority(PRIO_PROCESS, 0) == (before + 2 > 19 ? 19 : before + 2) ? 0 : 1);
+    }
+
+    assert_that(waitpid(child, &status, 0), is_equal_to(child));
+    assert_that(WEXITSTATUS(status), is_equal_to(0));
+}
+
+TestSuite *launch_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, launch, parse);
+    add_test_with_context(suite, launch, limits);
+    add_test_with_context(suite, launch, defaults);
+    add_test_with_context(suite, launch, apply);
+
+    return suite;
+}
@@ -0,0 +1,251 @@
+#include "tests.h"
+#include "line_editor.h"
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static void test_line_editor_read(const char *keys, size_t keys_length, struct history *history, const char *expected_line);
+static char *edit(const char *keys, size_t keys_length, struct history *history, size_t *line_size, char **output, size_t *output_size);
+static char *edit_in_pieces(const char **pieces, size_t *line_size, char **output);
+
+Describe(line_editor);
+
+static struct dc_posix_env environ;
+static struct dc_error error;
+
+BeforeEach(line_editor)
+{
+    dc_posix_env_init(&environ, NULL);
+    dc_error_init(&error, NULL);
+}
+
+AfterEach(line_editor)
+{
+    dc_error_reset(&error);
+}
+
+Ensure(line_editor, line_editor_read)
+{
+    struct history *history;
+
+    test_line_editor_read("hello\r", 6, NULL, "hello");
+    test_line_editor_read("hello\n", 6, NULL, "hello");
+    test_line_editor_read("hello", 5, NULL, "hello");
+    test_line_editor_read("abc\x1b[D\x1b[DX\r", 11, NULL, "aXbc");
+    test_line_editor_read("world\x01hello \x05!\r", 15, NULL, "hello world!");
+    test_line_editor_read("abcd\x7f\x7f\r", 7, NULL, "ab");
+    test_line_editor_read("abcd\x02\x02\x0b\r", 8, NULL, "ab");
+    test_line_editor_read("ls -al\x17\r", 8, NULL, "ls ");
+    test_line_editor_read("ls -al\x15\r", 8, NULL, "");
+    test_line_editor_read("abc\x1b[H\x1b[3~\r", 11, NULL, "bc");
+    test_line_editor_read("abc\x03", 4, NULL, "");
+    test_line_editor_read("\x04", 1, NULL, NULL);
+    test_line_editor_read("", 0, NULL, NULL);
+
+    history = history_create(&environ, &error, 10, NULL);
+    history_add(&environ, &error, history, "first");
+    history_add(&environ, &error, history, "second");
+    test_line_editor_read("\x1b[A\r", 4, history, "second");
+    test_line_editor_read("\x1b[A\x1b[A\x1b[A\r", 10, history, "first");
+    test_line_editor_read("typed\x1b[A\x1b[A\x1b[B\x1b[B\r", 18, history, "typed");
+    test_line_editor_read("\x10\x10\x0e\r", 4, history, "typed");
+    assert_that(history_get(history, 0), is_equal_to_string("typed"));
+    history_destroy(&environ, &history);
+}
+
+Ensure(line_editor, paste)
+{
+    static const char *pieces[] = {"echo \x1b[200~a\tb\x1b[20", "1~\r", NULL};
+    char keys[6000];
+    char *line;
+    char *output;
+    size_t line_size;
+    size_t output_size;
+
+    // bracketed paste with the end marker split over two reads
+    line = edit_in_pieces(pieces, &line_size, &output);
+    assert_that(line, is_equal_to_string("echo a b"));
+    free(line);
+    free(output);
+
+    memset(keys, 'x', sizeof(keys));
+    memcpy(keys, "\x1b[200~", 6);
+    memcpy(&keys[sizeof(keys) - 7], "\x1b[201~\r", 7);
+    line = edit(keys, sizeof(keys), NULL, &line_size, &output, &output_size);
+    assert_that(line_size, is_equal_to(sizeof(keys) - 13));
+    // each pasted character is echoed once, there is no redraw of the whole line per character
+    assert_that(output_size, is_less_than(sizeof(keys) + 32));
+    free(line);
+    free(output);
+}
+
+Ensure(line_editor, incremental_redraw)
+{
+    static const char *pieces[] = {"hello", "\x1b[D\x1b[DX", "\x7f", "\r", NULL};
+    char *line;
+    char *output;
+    size_t line_size;
+
+    // only the changed tail of the line is redrawn, never the prompt or the start of the line
+    line = edit_in_pieces(pieces, &line_size, &output);
+    assert_that(line, is_equal_to_string("hello"));
+    assert_that(output, is_equal_to_string("hello\x1b[2DXlo\x1b[2D\x1b[1Dlo\x1b[J\x1b[2D\x1b[2C\r\n"));
+    free(line);
+    free(output);
+}
+
+Ensure(line_editor, complete_command_or_file)
+{
+    char template[32];
+    char file[64];
+    char line[128];
+    char **completions;
+    char **path;
+    size_t count;
+
+    strcpy(template, "/tmp/completeXXXXXX");
+    mkdtemp(template);
+    sprintf(file, "%s/alpha", template);
+    close(creat(file, 0700));
+    sprintf(file, "%s/alpine", template);
+    mkdir(file, 0700);
+    sprintf(file, "%s/beta", template);
+    close(creat(file, 0600));
+
+    sprintf(line, "cat %s/al", template);
+    completions = complete_command_or_file(&environ, &error, line, 4, strlen(line), &count, NULL);
+    assert_that(count, is_equal_to(2));
+    sprintf(file, "%s/alpha", template);
+    assert_that(completions[0], is_equal_to_string(file));
+    sprintf(file, "%s/alpine/", template);
+    assert_that(completions[1], is_equal_to_string(file));
+    assert_that(completions[2], is_null);
+    line_editor_free_completions(&environ, completions, count);
+
+    // commands come from the path and must be executable
+    path = malloc(2 * sizeof(char *));
+    path[0] = template;
+    path[1] = NULL;
+    completions = complete_command_or_file(&environ, &error, "  al", 2, 4, &count, &path);
+    assert_that(count, is_equal_to(1));
+    assert_that(completions[0], is_equal_to_string("alpha"));
+    line_editor_free_completions(&environ, completions, count);
+
+    completions = complete_command_or_file(&environ, &error, "be", 0, 2, &count, &path);
+    assert_that(count, is_equal_to(0));
+    assert_that(completions[0], is_null);
+    line_editor_free_completions(&environ, completions, count);
+    free(path);
+
+    sprintf(file, "%s/alpha", template);
+    unlink(file);
+    sprintf(file, "%s/beta", template);
+    unlink(file);
+    sprintf(file, "%s/alpine", template);
+    rmdir(file);
+    rmdir(template);
+}
+
+static void test_line_editor_read(const char *keys, size_t keys_length, struct history *history, const char *expected_line)
+{
+    char *line;
+    char *output;
+    size_t line_size;
+    size_t output_size;
+
+    line = edit(keys, keys_length, history, &line_size, &output, &output_size);
+    assert_false(dc_error_has_error(&error));
+
+    if(expected_line == NULL)
+    {
+        assert_that(line, is_null);
+    }
+    else
+    {
+        assert_that(line, is_equal_to_string(expected_line));
+        assert_that(line_size, is_equal_to(strlen(expected_line)));
+    }
+
+    free(line);
+    free(output);
+}
+
+static char *edit(const char *keys, size_t keys_length, struct history *history, size_t *line_size, char **output, size_t *output_size)
+{
+    struct line_editor *editor;
+    FILE *out;
+    int fds[2];
+    char *line;
+
+    // a pipe for the keys and a file for the echo, neither is a terminal so raw mode is skipped
+    pipe(fds);
+    write(fds[1], keys, keys_length);
+    close(fds[1]);
+    out = tmpfile();
+    editor = line_editor_create(&environ, &error, fds[0], fileno(out), history);
+    line = line_editor_read(&environ, &error, editor, "$ ", line_size);
+    line_editor_destroy(&environ, &editor);
+    close(fds[0]);
+
+    *output_size = (size_t)lseek(fileno(out), 0, SEEK_END);
+    *output = calloc(1, *output_size + 1);
+    pread(fileno(out), *output, *output_size, 0);
+    fclose(out);
+
+    return line;
+}
+
+static char *edit_in_pieces(const char **pieces, size_t *line_size, char **output)
+{
+    struct line_editor *editor;
+    FILE *out;
+    int fds[2];
+    pid_t pid;
+    char *line;
+    size_t output_size;
+
+    // each piece arrives in its own read, like separate key presses
+    pipe(fds);
+    pid = fork();
+
+    if(pid == 0)
+    {
+        close(fds[0]);
+
+        for(int i = 0; pieces[i]; i++)
+        {
+            write(fds[1], pieces[i], strlen(pieces[i]));
+            usleep(100000);
+        }
+
+        _exit(0);
+    }
+
+    close(fds[1]);
+    out = tmpfile();
+    editor = line_editor_create(&environ, &error, fds[0], fileno(out), NULL);
+    line = line_editor_read(&environ, &error, editor, "$ ", line_size);
+    line_editor_destroy(&environ, &editor);
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+
+    output_size = (size_t)lseek(fileno(out), 0, SEEK_END);
+    *output = calloc(1, output_size + 1);
+    pread(fileno(out), *output, output_size, 0);
+    fclose(out);
+
+    return line;
+}
+
+TestSuite *line_editor_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, line_editor, line_editor_read);
+    add_test_with_context(suite, line_editor, paste);
+    add_test_with_context(suite, line_editor, incremental_redraw);
+    add_test_with_context(suite, line_editor, complete_command_or_file);
+
+    return suite;
+}
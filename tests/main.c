@@ -9,13 +9,31 @@ int main(int argc, char **argv)
 
     suite    = create_test_suite();
     reporter = create_text_reporter();
+    add_suite(suite, arith_tests());
+    add_suite(suite, audit_tests());
+    add_suite(suite, batch_tests());
     add_suite(suite, builtin_tests());
     add_suite(suite, command_tests());
+    add_suite(suite, copy_tests());
     add_suite(suite, execute_tests());
+    add_suite(suite, expand_tests());
+    add_suite(suite, history_tests());
     add_suite(suite, input_tests());
+    add_suite(suite, launch_tests());
+    add_suite(suite, line_editor_tests());
+    add_suite(suite, mem_stats_tests());
+    add_suite(suite, pathname_tests());
+    add_suite(suite, scan_tests());
+    add_suite(suite, script_tests());
     add_suite(suite, shell_impl_tests());
     add_suite(suite, shell_tests());
+    add_suite(suite, source_tests());
+    add_suite(suite, startup_tests());
+    add_suite(suite, substitute_tests());
+    add_suite(suite, thread_pool_tests());
+    add_suite(suite, trace_tests());
     add_suite(suite, util_tests());
+    add_suite(suite, variables_tests());
 
     if(argc > 1)
     {
@@ -0,0 +1,99 @@
+#include "tests.h"
+#include "mem_stats.h"
+#include <stdlib.h>
+#include <string.h>
+
+static char *report(void);
+
+Describe(mem_stats);
+
+static struct dc_posix_env environ;
+static struct dc_error error;
+
+BeforeEach(mem_stats)
+{
+    dc_posix_env_init(&environ, NULL);
+    dc_error_init(&error, NULL);
+}
+
+AfterEach(mem_stats)
+{
+    dc_error_reset(&error);
+    mem_stats_disable();
+}
+
+Ensure(mem_stats, count)
+{
+    char *before;
+    char *block;
+    char *string;
+    char *grown;
+    char *kept;
+    char *text;
+
+    // nothing is counted until it is enabled
+    before = dc_malloc(&environ, &error, 8);
+    assert_false(mem_stats_enabled());
+    mem_stats_enable();
+    assert_true(mem_stats_enabled());
+    dc_free(&environ, before, 8);
+
+    mem_stats_state("READ_COMMANDS");
+    block = dc_calloc(&environ, &error, 4, 25);
+    string = dc_strdup(&environ, &error, "abc");
+    grown = dc_malloc(&environ, &error, 10);
+    grown = dc_realloc(&environ, &error, grown, 1000);
+
+    mem_stats_state("EXECUTE_COMMANDS");
+    kept = dc_strndup(&environ, &error, "abcdef", 2);
+
+    // the size has to be the one it was allocated with: a string's length is one short, the block was not 8 bytes
+    dc_free(&environ, string, strlen(string));
+    dc_free(&environ, block, 8);
+    dc_free(&environ, grown, 1000);
+
+    text = report();
+    assert_that(text, begins_with_string("mem-stats: 5 allocations, 4 frees, peak 1107 bytes in 4 blocks\n"));
+    assert_that(text, contains_string("mem-stats: 1 frees of memory that was not counted"));
+    assert_that(text, contains_string("  READ_COMMANDS                "
+                                      " 4 allocations         1114 bytes          0 live\n"));
+    assert_that(text, contains_string("  EXECUTE_COMMANDS             "
+                                      " 1 allocations            3 bytes          3 live\n"));
+    assert_that(text, contains_string(" 1 times, the last given 3 for 4 bytes allocated at "));
+    assert_that(text, contains_string(" 1 times, the last given 8 for 100 bytes allocated at "));
+    assert_that(text, contains_string("mem-stats: 3 bytes in 1 blocks not freed\n  "));
+    assert_that(text, contains_string("mem_stats_tests.c:"));
+    free(text);
+
+    dc_free(&environ, kept, strlen(kept) + 1);
+    mem_stats_disable();
+    assert_false(mem_stats_enabled());
+
+    // nothing is written unless it is counting
+    text = report();
+    assert_that(text, is_equal_to_string(""));
+    free(text);
+}
+
+static char *report(void)
+{
+    FILE *stream;
+    char *text;
+    size_t size;
+
+    stream = open_memstream(&text, &size);
+    mem_stats_report(stream);
+    fclose(stream);
+
+    return text;
+}
+
+TestSuite *mem_stats_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, mem_stats, count);
+
+    return suite;
+}
@@ -0,0 +1,331 @@
+#include "tests.h"
+#include "pathname.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void make_tree(char *root);
+static void make_file(const char *root, const char *name);
+static void make_directory(const char *root, const char *name);
+static void test_expand(struct pathname_cache *cache, const char *root, const char *pattern,
+                        size_t expected_count, const char **expected);
+static void make_levels(const char *root, size_t depth);
+static void test_same(struct pathname_cache *sequential, struct pathname_cache *parallel, const char *root,
+                      const char *pattern);
+
+Describe(pathname);
+
+static struct dc_posix_env environ;
+static struct dc_error error;
+
+BeforeEach(pathname)
+{
+    dc_posix_env_init(&environ, NULL);
+    dc_error_init(&error, NULL);
+}
+
+AfterEach(pathname)
+{
+    dc_error_reset(&error);
+}
+
+Ensure(pathname, match)
+{
+    assert_true(pathname_match("*", "abc"));
+    assert_true(pathname_match("*", ""));
+    assert_true(pathname_match("a*c", "abbbc"));
+    assert_false(pathname_match("a*c", "abbb"));
+    assert_true(pathname_match("*.c", "main.c"));
+    assert_false(pathname_match("*.c", "main.h"));
+    assert_true(pathname_match("?", "a"));
+    assert_false(pathname_match("?", ""));
+    assert_true(pathname_match("[abc]", "b"));
+    assert_false(pathname_match("[abc]", "d"));
+    assert_true(pathname_match("[a-c]x", "bx"));
+    assert_true(pathname_match("[!a-c]", "d"));
+    assert_true(pathname_match("[^a-c]", "d"));
+    assert_false(pathname_match("[!a-c]", "a"));
+    assert_true(pathname_match("[]]", "]"));
+    assert_true(pathname_match("[[:digit:]]*", "1abc"));
+    assert_false(pathname_match("[[:digit:]]*", "abc"));
+    assert_true(pathname_match("\\*", "*"));
+    assert_false(pathname_match("\\*", "a"));
+
+    // an unterminated [ is just a [
+    assert_true(pathname_match("[a", "[a"));
+
+    assert_true(pathname_has_magic("*.c"));
+    assert_true(pathname_has_magic("a[bc]"));
+    assert_false(pathname_has_magic("\\*.c"));
+    assert_false(pathname_has_magic("main.c"));
+}
+
+Ensure(pathname, expand)
+{
+    struct pathname_cache *cache;
+    char root[32];
+    const char *c_files[] = { "a.c", "b.c" };
+    const char *everything[] = { "a.c", "b.c", "dir", "other" };
+    const char *directories[] = { "dir/", "other/" };
+    const char *nested[] = { "dir/d.c", "dir/sub/e.c" };
+    const char *recursive[] = { "a.c", "b.c", "dir/d.c", "dir/sub/e.c", "other/f.c" };
+    const char *hidden[] = { ".hidden" };
+    const char *bracket[] = { "a.c" };
+    const char *below[] = { "dir/", "dir/d.c", "dir/sub", "dir/sub/e.c" };
+    const char *below_dirs[] = { "dir/", "dir/sub/" };
+
+    make_tree(root);
+    cache = pathname_cache_create(&environ, &error);
+    assert_that(cache, is_not_null);
+
+    test_expand(cache, root, "*.c", 2, c_files);
+    test_expand(cache, root, "*", 4, everything);
+    test_expand(cache, root, "*/", 2, directories);
+    test_expand(cache, root, "dir/**/*.c", 2, nested);
+    test_expand(cache, root, "**/*.c", 5, recursive);
+    test_expand(cache, root, ".*", 1, hidden);
+    test_expand(cache, root, "[a]*", 1, bracket);
+    test_expand(cache, root, "*.h", 0, NULL);
+    test_expand(cache, root, "missing/*", 0, NULL);
+
+    // a trailing ** matches the directory it starts at too, as in bash with globstar
+    test_expand(cache, root, "dir/**", 4, below);
+    test_expand(cache, root, "dir/**/", 2, below_dirs);
+    test_expand(cache, root, "missing/**", 0, NULL);
+    test_expand(cache, root, "a.c/**", 0, NULL);
+
+    pathname_cache_destroy(&environ, &cache);
+    assert_that(cache, is_null);
+}
+
+Ensure(pathname, cache)
+{
+    struct pathname_cache *cache;
+    const struct directory_listing *listing;
+    char root[32];
+
+    make_tree(root);
+    cache = pathname_cache_create(&environ, &error);
+
+    // a directory is only read once until the cache is cleared
+    listing = pathname_list(&environ, &error, cache, root);
+    assert_that(listing, is_not_null);
+    assert_that(listing->count, is_equal_to(5));
+    assert_that(pathname_list(&environ, &error, cache, root), is_equal_to(listing));
+    assert_that(cache->count, is_equal_to(1));
+
+    make_file(root, "new.c");
+    assert_that(pathname_list(&environ, &error, cache, root)->count, is_equal_to(5));
+
+    pathname_cache_clear(&environ, cache);
+    assert_that(cache->count, is_equal_to(0));
+    assert_that(pathname_list(&environ, &error, cache, root)->count, is_equal_to(6));
+
+    assert_that(pathname_list(&environ, &error, cache, "/does/not/exist"), is_null);
+    assert_false(dc_error_has_error(&error));
+
+    pathname_cache_destroy(&environ, &cache);
+}
+
+Ensure(pathname, parallel)
+{
+    struct pathname_cache *sequential;
+    struct pathname_cache *parallel;
+    char root[32];
+
+    strcpy(root, "/tmp/globXXXXXX");
+    mkdtemp(root);
+    make_levels(root, 4);
+
+    sequential = pathname_cache_create(&environ, &error);
+    sequential->thread_count = 1;
+    parallel = pathname_cache_create(&environ, &error);
+    parallel->thread_count = 4;
+
+    // the threads find the matches in a different order every time, but the result is always sorted
+    test_same(sequential, parallel, root, "**/*.c");
+    test_same(sequential, parallel, root, "**");
+    test_same(sequential, parallel, root, "**/");
+    test_same(sequential, parallel, root, "**/d1/*.c");
+    test_same(sequential, parallel, root, "d0/**/d2/**/f1.c");
+
+    // the threads put what they read in the cache too, so both have read each of the 121 directories once
+    assert_that(sequential->count, is_equal_to(121));
+    assert_that(parallel->count, is_equal_to(121));
+
+    // and the next ** on the line uses it, rather than reading the tree again
+    make_file(root, "d0/d0/new.c");
+    test_same(sequential, parallel, root, "**/*.c");
+
+    pathname_cache_destroy(&environ, &sequential);
+    pathname_cache_destroy(&environ, &parallel);
+}
+
+Ensure(pathname, parallel_errors)
+{
+    struct pathname_cache *sequential;
+    struct pathname_cache *parallel;
+    struct rlimit saved;
+    struct rlimit limit;
+    char root[32];
+    char pattern[64];
+    char **matches;
+    size_t count;
+    int next_fd;
+
+    strcpy(root, "/tmp/globXXXXXX");
+    mkdtemp(root);
+    make_levels(root, 2);
+    sprintf(pattern, "%s/**/*.c", root);
+
+    sequential = pathname_cache_create(&environ, &error);
+    sequential->thread_count = 1;
+    parallel = pathname_cache_create(&environ, &error);
+    parallel->thread_count = 4;
+
+    // leave room for one more fd - enough to read one directory at a time, but not to open one inside another
+    next_fd = dup(0);
+    close(next_fd);
+    getrlimit(RLIMIT_NOFILE, &saved);
+    limit = saved;
+    limit.rlim_cur = (rlim_t) next_fd + 1;
+    setrlimit(RLIMIT_NOFILE, &limit);
+
+    matches = pathname_expand(&environ, &error, sequential, pattern, &count);
+    assert_false(dc_error_has_error(&error));
+    assert_that(count, is_equal_to(26));
+    pathname_free_matches(&environ, matches, count);
+
+    // a subtree the threads cannot open is an error, not a smaller set of matches
+    matches = pathname_expand(&environ, &error, parallel, pattern, &count);
+    setrlimit(RLIMIT_NOFILE, &saved);
+    assert_that(matches, is_null);
+    assert_that(count, is_equal_to(0));
+    assert_true(dc_error_has_error(&error));
+    assert_that(error.err_code, is_equal_to(EMFILE));
+
+    pathname_cache_destroy(&environ, &sequential);
+    pathname_cache_destroy(&environ, &parallel);
+}
+
+static void make_tree(char *root)
+{
+    strcpy(root, "/tmp/globXXXXXX");
+    mkdtemp(root);
+    make_file(root, "b.c");
+    make_file(root, "a.c");
+    make_file(root, ".hidden");
+    make_directory(root, "dir");
+    make_file(root, "dir/d.c");
+    make_directory(root, "dir/sub");
+    make_file(root, "dir/sub/e.c");
+    make_directory(root, "other");
+    make_file(root, "other/f.c");
+    make_directory(root, "other/.git");
+    make_file(root, "other/.git/g.c");
+}
+
+static void make_file(const char *root, const char *name)
+{
+    char path[256];
+    int fd;
+
+    sprintf(path, "%s/%s", root, name);
+    fd = open(path, O_CREAT | O_WRONLY, 0600);
+    close(fd);
+}
+
+static void make_directory(const char *root, const char *name)
+{
+    char path[256];
+
+    sprintf(path, "%s/%s", root, name);
+    mkdir(path, 0700);
+}
+
+static void make_levels(const char *root, size_t depth)
+{
+    char path[256];
+
+    make_file(root, "f0.c");
+    make_file(root, "f1.c");
+    make_file(root, "f2.h");
+
+    if (depth == 0) {
+        return;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        sprintf(path, "%s/d%d", root, i);
+        mkdir(path, 0700);
+        make_levels(path, depth - 1);
+    }
+}
+
+static void test_same(struct pathname_cache *sequential, struct pathname_cache *parallel, const char *root,
+                      const char *pattern)
+{
+    char full_pattern[256];
+    char **expected;
+    char **matches;
+    size_t expected_count;
+    size_t count;
+
+    sprintf(full_pattern, "%s/%s", root, pattern);
+    expected = pathname_expand(&environ, &error, sequential, full_pattern, &expected_count);
+    matches = pathname_expand(&environ, &error, parallel, full_pattern, &count);
+    assert_false(dc_error_has_error(&error));
+    assert_that(expected, is_not_null);
+    assert_that(count, is_equal_to(expected_count));
+
+    for (size_t i = 0; i < count; i++) {
+        assert_that(matches[i], is_equal_to_string(expected[i]));
+    }
+
+    pathname_free_matches(&environ, expected, expected_count);
+    pathname_free_matches(&environ, matches, count);
+}
+
+static void test_expand(struct pathname_cache *cache, const char *root, const char *pattern,
+                        size_t expected_count, const char **expected)
+{
+    char full_pattern[256];
+    char full_path[256];
+    char **matches;
+    size_t count;
+
+    sprintf(full_pattern, "%s/%s", root, pattern);
+    matches = pathname_expand(&environ, &error, cache, full_pattern, &count);
+    assert_false(dc_error_has_error(&error));
+
+    if (expected_count == 0) {
+        assert_that(matches, is_null);
+        return;
+    }
+
+    assert_that(count, is_equal_to(expected_count));
+
+    for (size_t i = 0; i < count; i++) {
+        sprintf(full_path, "%s/%s", root, expected[i]);
+        assert_that(matches[i], is_equal_to_string(full_path));
+    }
+
+    assert_that(matches[count], is_null);
+    pathname_free_matches(&environ, matches, count);
+}
+
+TestSuite *pathname_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, pathname, match);
+    add_test_with_context(suite, pathname, expand);
+    add_test_with_context(suite, pathname, cache);
+    add_test_with_context(suite, pathname, parallel);
+    add_test_with_context(suite, pathname, parallel_errors);
+
+    return suite;
+}
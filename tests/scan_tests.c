@@ -0,0 +1,122 @@
+#include "tests.h"
+#include "scan.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void assert_scans_agree(const char *line, bool every_start);
+
+Describe(scan);
+
+static enum scan_kind kind;
+
+BeforeEach(scan)
+{
+    kind = scan_get_kind();
+}
+
+AfterEach(scan)
+{
+    scan_set_kind(kind);
+}
+
+Ensure(scan, scan_special)
+{
+    assert_that(scan_special("hello", 0), is_equal_to(5));
+    assert_that(scan_special("./a.out 2>err.txt", 0), is_equal_to(7));
+    assert_that(scan_special("./a.out 2>err.txt", 8), is_equal_to(9));
+    assert_that(scan_special("a$b", 0), is_equal_to(1));
+    assert_that(scan_special("a$b", 1), is_equal_to(1));
+    assert_that(scan_special("", 0), is_equal_to(0));
+
+    // bytes past 127 are ordinary
+    assert_that(scan_special("caf\xc3\xa9;", 0), is_equal_to(5));
+}
+
+Ensure(scan, kinds_agree)
+{
+    // the parse_command lines from command_tests.c
+    static const char *lines[] = {
+        "hello",
+        "./a.out 2>err.txt",
+        "/usr/bin/ls > out.txt",
+        "./a.out < in.txt",
+        "./a.out < in.txt > out.txt",
+        "./a.out > out.txt 2>    err.txt",
+        "./a.out < in.txt > out.txt 2>err.txt",
+        "./a.out < in.txt >> out.txt 2>>err.txt",
+        "./a.out < ~/abc/in.txt >> ~/out.txt 2>>~/err.txt",
+        "a b c",
+        "foo hello evil world",
+        "foo ~/hello ~/def/evil \"world rocks\"",
+        "cmd a 3> 'x y' 2>&1 b 4<&- <>rw >| $((1<2)) $((3>2)) 10<<<word",
+    };
+    char line[SCAN_VECTOR_AFTER + 80];
+
+    assert_true(scan_set_kind(SCAN_SCALAR));
+    assert_that(scan_get_kind(), is_equal_to(SCAN_SCALAR));
+
+    for (size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+        assert_scans_agree(lines[i], true);
+    }
+
+    // every byte, only the specials stop it, past where the vectors take over
+    for (int c = 1; c < 256; c++) {
+        memset(line, 'x', SCAN_VECTOR_AFTER + 70);
+        line[SCAN_VECTOR_AFTER + 70] = '\0';
+        line[SCAN_VECTOR_AFTER + 40] = (char) c;
+        assert_scans_agree(line, false);
+    }
+
+    // one special character at every place in a line two blocks longer than the bytes done one at a time,
+    // from every alignment
+    for (size_t length = 0; length < SCAN_VECTOR_AFTER + 72; length++) {
+        for (size_t special = 0; special <= length; special++) {
+            memset(line, 'x', length);
+            line[length] = '\0';
+            line[special] = special == length ? '\0' : "|;\t\"$"[special % 5];
+            assert_scans_agree(line, false);
+        }
+    }
+}
+
+static void assert_scans_agree(const char *line, bool every_start)
+{
+    static const enum scan_kind kinds[] = {SCAN_SSE2, SCAN_AVX2};
+    size_t length;
+    char *copy;
+
+    // the copy puts the line at a different place in the block
+    length = strlen(line);
+    copy = malloc(length + 33);
+
+    for (size_t shift = 0; shift < 32; shift++) {
+        memcpy(copy + shift, line, length + 1);
+
+        for (size_t i = 0; i <= (every_start ? length : 0); i++) {
+            size_t expected;
+
+            scan_set_kind(SCAN_SCALAR);
+            expected = scan_special(copy + shift, i);
+
+            for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+                // a kind this CPU does not have is not tested
+                if (scan_set_kind(kinds[k])) {
+                    assert_that(scan_special(copy + shift, i), is_equal_to(expected));
+                }
+            }
+        }
+    }
+
+    free(copy);
+}
+
+TestSuite *scan_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, scan, scan_special);
+    add_test_with_context(suite, scan, kinds_agree);
+
+    return suite;
+}
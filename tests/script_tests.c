@@ -0,0 +1,396 @@
+#include "tests.h"
+#include "script.h"
+#include "shell_impl.h"
+#include "variables.h"
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void test_run(struct state *state, const char *text, int expected_exit_code);
+static void test_syntax_error(struct state *state, const char *text);
+static void create_state(struct state *state);
+static void assert_file_contents(const char *file_name, const char *expected);
+static bool is_running(const char *pid_file_name);
+
+Describe(script);
+
+static struct dc_posix_env environ;
+static struct dc_error error;
+
+BeforeEach(script)
+{
+    dc_posix_env_init(&environ, NULL);
+    dc_error_init(&error, NULL);
+}
+
+AfterEach(script)
+{
+    dc_error_reset(&error);
+}
+
+Ensure(script, is_complete)
+{
+    assert_true(script_is_complete(&environ, ""));
+    assert_true(script_is_complete(&environ, "ls -l"));
+    assert_true(script_is_complete(&environ, "for x in a b; do echo $x; done"));
+    assert_true(script_is_complete(&environ, "if true\nthen\n  echo yes\nfi"));
+    assert_true(script_is_complete(&environ, "f() { echo hi; }"));
+    assert_false(script_is_complete(&environ, "while true; do"));
+    assert_false(script_is_complete(&environ, "if true; then echo yes; else"));
+    assert_false(script_is_complete(&environ, "case $x in\na) echo a;;"));
+    assert_false(script_is_complete(&environ, "f() {"));
+    assert_false(script_is_complete(&environ, "echo 'abc"));
+
+    // more lines can't fix these, so they are reported now
+    assert_true(script_is_complete(&environ, "fi"));
+    assert_true(script_is_complete(&environ, "while true; done"));
+}
+
+Ensure(script, parse)
+{
+    struct state state;
+    struct script_node *node;
+
+    create_state(&state);
+
+    node = script_parse(&environ, &error, &state, "ls -l > out");
+    assert_false(dc_error_has_error(&error));
+    assert_that(node->type, is_equal_to(SCRIPT_COMMAND));
+    assert_that(node->command->line, is_equal_to_string("ls -l > out"));
+    assert_that(node->command->stdout_file, is_equal_to_string("out"));
+    assert_that(node->word_count, is_equal_to(2));
+    assert_that(node->words[1], is_equal_to_string("-l"));
+    script_destroy(&environ, &node);
+    assert_that(node, is_null);
+
+    node = script_parse(&environ, &error, &state, "a=1; echo $a # done");
+    assert_false(dc_error_has_error(&error));
+    assert_that(node->type, is_equal_to(SCRIPT_LIST));
+    assert_that(node->child_count, is_equal_to(2));
+    assert_that(node->children[1]->command->line, is_equal_to_string("echo $a"));
+    script_destroy(&environ, &node);
+
+    node = script_parse(&environ, &error, &state, "if a; then b; elif c; then d; else e; fi");
+    assert_false(dc_error_has_error(&error));
+    assert_that(node->type, is_equal_to(SCRIPT_IF));
+    assert_that(node->otherwise->type, is_equal_to(SCRIPT_IF));
+    assert_that(node->otherwise->otherwise->type, is_equal_to(SCRIPT_LIST));
+    script_destroy(&environ, &node);
+
+    node = script_parse(&environ, &error, &state, "case $x in (a|'b c') echo a;; *) echo b; esac");
+    assert_false(dc_error_has_error(&error));
+    assert_that(node->type, is_equal_to(SCRIPT_CASE));
+    assert_that(node->child_count, is_equal_to(2));
+    assert_that(node->children[0]->word_count, is_equal_to(2));
+    assert_that(node->children[0]->words[1], is_equal_to_string("'b c'"));
+    script_destroy(&environ, &node);
+
+    test_syntax_error(&state, "fi");
+    test_syntax_error(&state, "while true; done");
+    test_syntax_error(&state, "for 1x in a; do b; done");
+    test_syntax_error(&state, "if true; then a; fi b");
+    test_syntax_error(&state, "case x in a) b;; ;;");
+    test_syntax_error(&state, "while true; do");
+    destroy_state(&environ, &error, &state);
+}
+
+Ensure(script, execute)
+{
+    struct state state;
+
+    create_state(&state);
+
+    test_run(&state, "R=; for x in a b c; do R=$R$x; done", 0);
+    assert_that(variables_get(&environ, state.variables, "R"), is_equal_to_string("abc"));
+
+    // the words are expanded once, before the first iteration
+    test_run(&state, "L='1 2'; R=; for x in $L; do L=3; R=$R$x; done", 0);
+    assert_that(variables_get(&environ, state.variables, "R"), is_equal_to_string("12"));
+
+    test_run(&state, "N=; while true; do N=${N}x; case $N in xxx) break;; esac; done", 0);
+    assert_that(variables_get(&environ, state.variables, "N"), is_equal_to_string("xxx"));
+
+    test_run(&state, "N=; until true; do N=ran; done", 0);
+    assert_that(variables_get(&environ, state.variables, "N"), is_equal_to_string(""));
+
+    test_run(&state, "if false; then R=then; elif true; then R=elif; else R=else; fi", 0);
+    assert_that(variables_get(&environ, state.variables, "R"), is_equal_to_string("elif"));
+
+    test_run(&state, "if false; then R=then; fi", 0);
+    test_run(&state, "if true; then false; fi", 1);
+
+    // a quoted pattern only matches itself
+    test_run(&state, "case a* in a\\*) R=quoted;; a*) R=glob;; esac", 0);
+    assert_that(variables_get(&environ, state.variables, "R"), is_equal_to_string("quoted"));
+    test_run(&state, "case abc in a?) R=short;; \"a\"*) R=glob;; esac", 0);
+    assert_that(variables_get(&environ, state.variables, "R"), is_equal_to_string("glob"));
+
+    test_run(&state, "R=; for a in 1 2; do for b in x y z; do if test $b = y; then continue 2; fi; R=$R$a$b; done; done", 0);
+    assert_that(variables_get(&environ, state.variables, "R"), is_equal_to_string("1x2x"));
+
+    test_run(&state, "R=; for a in 1 2; do for b in x y; do break 2; done; R=no; done", 0);
+    assert_that(variables_get(&environ, state.variables, "R"), is_equal_to_string(""));
+
+    // functions are kept for the next line, with their own positional parameters
+    test_run(&state, "f() { R=$1-$#; return 4; R=after; }", 0);
+    test_run(&state, "f x y", 4);
+    assert_that(variables_get(&environ, state.variables, "R"), is_equal_to_string("x-2"));
+    assert_that(state.positional_count, is_equal_to(0));
+
+    test_run(&state, "function g { for x in a b; do return; done; }; g; R=$?", 0);
+    test_run(&state, "f() { R=redefined; }; f", 0);
+    assert_that(variables_get(&environ, state.variables, "R"), is_equal_to_string("redefined"));
+
+    test_run(&state, "return 1", 1);
+    test_run(&state, "break; R=after", 0);
+    assert_that(variables_get(&environ, state.variables, "R"), is_equal_to_string("after"));
+    test_run(&state, "for x in a; do break 0; done", 1);
+
+    destroy_state(&environ, &error, &state);
+}
+
+Ensure(script, here_document)
+{
+    struct state state;
+    struct script_node *node;
+    char file_name[] = "/tmp/dc_here_XXXXXX";
+    char line[256];
+    char *large;
+    size_t length;
+
+    assert_true(script_is_complete(&environ, "cat <<EOF\nbody\nEOF"));
+    assert_true(script_is_complete(&environ, "cat <<<word"));
+    assert_false(script_is_complete(&environ, "cat <<EOF\nbody"));
+    assert_false(script_is_complete(&environ, "cat <<EOF"));
+
+    create_state(&state);
+
+    node = script_parse(&environ, &error, &state, "cat <<'E O' > out; echo next\n$a\n\tE O\nE O\necho last");
+    assert_false(dc_error_has_error(&error));
+    assert_that(node->child_count, is_equal_to(3));
+    assert_that(node->children[0]->command->here_document, is_equal_to_string("$a\n\tE O\n"));
+    assert_false(node->children[0]->command->here_expand);
+    assert_that(node->children[0]->command->stdout_file, is_equal_to_string("out"));
+    assert_that(node->children[1]->command->here_document, is_null);
+    assert_that(node->children[2]->command->line, is_equal_to_string("echo last"));
+    script_destroy(&environ, &node);
+
+    node = script_parse(&environ, &error, &state, "cat <<-EOF\n\t\t$a \\$a '$a'\n\tEOF");
+    assert_false(dc_error_has_error(&error));
+    assert_that(node->command->here_document, is_equal_to_string("$a \\$a '$a'\n"));
+    assert_true(node->command->here_expand);
+    script_destroy(&environ, &node);
+
+    node = script_parse(&environ, &error, &state, "cat <<< \"$a b\"");
+    assert_false(dc_error_has_error(&error));
+    assert_that(node->command->here_document, is_equal_to_string("\"$a b\""));
+    assert_true(node->command->here_string);
+    script_destroy(&environ, &node);
+
+    test_syntax_error(&state, "cat <<EOF\nbody");
+
+    // the body is expanded when the command runs, each time it runs
+    assert_that(mkstemp(file_name), is_not_equal_to(-1));
+    sprintf(line, "for a in 1 2; do cat <<EOF > %s; done\n$a \\$a '$a'\nEOF", file_name);
+    test_run(&state, line, 0);
+    assert_file_contents(file_name, "2 $a '2'\n");
+
+    sprintf(line, "a=x; cat <<< \"$a  y\" > %s", file_name);
+    test_run(&state, line, 0);
+    assert_file_contents(file_name, "x  y\n");
+
+    // one that doesn't fit in a pipe
+    large = malloc(300000);
+    length = (size_t) sprintf(large, "cat <<EOF > %s\n", file_name);
+    memset(&large[length], 'x', 200000);
+    strcpy(&large[length + 200000], "\nEOF");
+    test_run(&state, large, 0);
+    free(large);
+    large = malloc(200002);
+    memset(large, 'x', 200000);
+    strcpy(&large[200000], "\n");
+    assert_file_contents(file_name, large);
+    free(large);
+
+    unlink(file_name);
+    destroy_state(&environ, &error, &state);
+}
+
+Ensure(script, redirections)
+{
+    struct state state;
+    char file_name[] = "/tmp/dc_redirect_XXXXXX";
+    char line[256];
+
+    create_state(&state);
+    assert_that(mkstemp(file_name), is_not_equal_to(-1));
+
+    // applied in order, so 2>&1 copies the file
+    sprintf(line, "sh -c 'echo out; echo err >&2' > %s 2>&1", file_name);
+    test_run(&state, line, 0);
+    assert_file_contents(file_name, "out\nerr\n");
+
+    sprintf(line, "sh -c 'echo three >&3' 3>> %s", file_name);
+    test_run(&state, line, 0);
+    assert_file_contents(file_name, "out\nerr\nthree\n");
+
+    sprintf(line, "F=%s; sh -c 'cat <&4; cat' 4< $F <<<here > $F.copy", file_name);
+    test_run(&state, line, 0);
+    sprintf(line, "%s.copy", file_name);
+    assert_file_contents(line, "out\nerr\nthree\nhere\n");
+
+    // every > file of the fd gets all of it, and the exit code is the program's
+    sprintf(line, "F=%s; sh -c 'echo fan; exit 3' > $F.copy >> $F", file_name);
+    test_run(&state, line, 3);
+    assert_file_contents(file_name, "out\nerr\nthree\nfan\n");
+    sprintf(line, "%s.copy", file_name);
+    assert_file_contents(line, "fan\n");
+    unlink(line);
+
+    unlink(file_name);
+    destroy_state(&environ, &error, &state);
+}
+
+Ensure(script, timed_fan_out)
+{
+    struct state state;
+    char file_name[] = "/tmp/dc_timed_XXXXXX";
+    char line[256];
+
+    create_state(&state);
+    assert_that(mkstemp(file_name), is_not_equal_to(-1));
+
+    // the pump of a > a > b is the pid that is timed, the program gets the SIGTERM too
+    sprintf(line, "timeout 0.3 sh -c 'echo $$; exec sleep 5' > %s > %s.copy", file_name, file_name);
+    test_run(&state, line, 124);
+    assert_false(is_running(file_name));
+
+#if defined(__linux__)
+    // and goes with the pump when that has to be killed
+    sprintf(line, "timeout -k 0.1 0.1 sh -c 'trap \"\" TERM; echo $$; exec sleep 5' > %s > %s.copy", file_name,
+            file_name);
+    test_run(&state, line, 137);
+    assert_false(is_running(file_name));
+#endif
+
+    sprintf(line, "%s.copy", file_name);
+    unlink(line);
+    unlink(file_name);
+    destroy_state(&environ, &error, &state);
+}
+
+static void test_run(struct state *state, const char *text, int expected_exit_code)
+{
+    struct script_node *node;
+    enum script_flow flow;
+
+    node = script_parse(&environ, &error, state, text);
+    assert_false(dc_error_has_error(&error));
+    flow = script_execute(&environ, &error, state, node);
+    assert_false(dc_error_has_error(&error));
+    assert_that(flow, is_equal_to(SCRIPT_NEXT));
+    assert_that(state->exit_code, is_equal_to(expected_exit_code));
+    script_destroy(&environ, &node);
+}
+
+static void test_syntax_error(struct state *state, const char *text)
+{
+    struct script_node *node;
+
+    node = script_parse(&environ, &error, state, text);
+    assert_that(node, is_null);
+    assert_that(error.err_code, is_equal_to(EINVAL));
+    dc_error_reset(&error);
+}
+
+static void create_state(struct state *state)
+{
+    state->stdin = stdin;
+    state->stdout = tmpfile();
+    state->stderr = tmpfile();
+    init_state(&environ, &error, state);
+    assert_false(dc_error_has_error(&error));
+
+    // the script's commands use the state's command
+    state->command = calloc(1, sizeof(struct command));
+}
+
+static void assert_file_contents(const char *file_name, const char *expected)
+{
+    FILE *file;
+    size_t length;
+    char *contents;
+
+    length = strlen(expected);
+    contents = calloc(length + 2, 1);
+    file = fopen(file_name, "r");
+    assert_that(file, is_not_null);
+    assert_that(fread(contents, 1, length + 1, file), is_equal_to(length));
+    fclose(file);
+    assert_that(contents, is_equal_to_string(expected));
+    free(contents);
+}
+
+/*
+ * Is the process whose pid is in the file still running, a zombie no one reaps (the pump is gone) is not.
+ * It is given a second to go, the signal is not delivered straight away.
+ */
+static bool is_running(const char *pid_file_name)
+{
+    FILE *file;
+    int pid;
+
+    file = fopen(pid_file_name, "r");
+    assert_that(file, is_not_null);
+    assert_that(fscanf(file, "%d", &pid), is_equal_to(1));
+    fclose(file);
+
+    for (int i = 0; i < 100; i++) {
+#if defined(__linux__)
+        char stat_name[64];
+        char state;
+
+        sprintf(stat_name, "/proc/%d/stat", pid);
+        file = fopen(stat_name, "r");
+
+        if (file == NULL) {
+            return false;
+        }
+
+        state = 'R';
+
+        if (fscanf(file, "%*d (%*[^)]) %c", &state) != 1) {
+            state = 'R';
+        }
+
+        fclose(file);
+
+        if (state == 'Z' || state == 'X') {
+            return false;
+        }
+#else
+        if (kill(pid, 0) == -1) {
+            return false;
+        }
+#endif
+        usleep(10000);
+    }
+
+    return true;
+}
+
+TestSuite *script_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, script, is_complete);
+    add_test_with_context(suite, script, parse);
+    add_test_with_context(suite, script, execute);
+    add_test_with_context(suite, script, here_document);
+    add_test_with_context(suite, script, redirections);
+    add_test_with_context(suite, script, timed_fan_out);
+
+    return suite;
+}
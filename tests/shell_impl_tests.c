@@ -1,3 +1,4 @@
+#include <sys/resource.h>
 #include <unistd.h>
 #include <dc_util/filesystem.h>
 #include "tests.h"
@@ -13,6 +14,8 @@ static void test_separate_commands(const char *command, const char *expected_com
 static void test_parse_commands(const char *command, const char *expected_command, size_t expected_argc);
 static void test_execute_command(const char *command, int expected_next_state, const char *expected_exit_code, const char *expected_error_message);
 static void test_handle_error(const char *current_line, bool is_fatal, int expected_error_code, const char *message, const char *expected_error_message, int expected_next_state);
+static void test_expansion_error(const char *command, bool interactive, int expected_next_state);
+static void test_glob_error(const char *format, bool interactive);
 
 Describe(shell_impl);
 
@@ -57,9 +60,6 @@ static void test_init_state(const char *expected_prompt, FILE *in, FILE *out, FI
     assert_that(state.stdin, is_equal_to(in));
     assert_that(state.stdout, is_equal_to(out));
     assert_that(state.stderr, is_equal_to(err));
-    assert_that(state.in_redirect_regex, is_not_null);
-    assert_that(state.out_redirect_regex, is_not_null);
-    assert_that(state.err_redirect_regex, is_not_null);
     assert_that(state.path, is_not_null);
     assert_that(state.prompt, is_equal_to_string(expected_prompt));
     assert_that(state.max_line_length, is_equal_to(line_length));
@@ -92,9 +92,6 @@ static void test_destroy_state(bool initial_fatal)
     assert_that(state.stdin, is_equal_to(stdin));
     assert_that(state.stdout, is_equal_to(stdout));
     assert_that(state.stderr, is_equal_to(stderr));
-    assert_that(state.in_redirect_regex, is_null);
-    assert_that(state.out_redirect_regex, is_null);
-    assert_that(state.err_redirect_regex, is_null);
     assert_that(state.prompt, is_null);
     assert_that(state.path, is_null);
     assert_that(state.max_line_length, is_equal_to(0));
@@ -138,9 +135,6 @@ static void test_reset_state(const char *expected_prompt, bool initial_fatal)
     assert_that(state.stdin, is_equal_to(stdin));
     assert_that(state.stdout, is_equal_to(stdout));
     assert_that(state.stderr, is_equal_to(stderr));
-    assert_that(state.in_redirect_regex, is_not_null);
-    assert_that(state.out_redirect_regex, is_not_null);
-    assert_that(state.err_redirect_regex, is_not_null);
     assert_that(state.prompt, is_equal_to_string(expected_prompt));
     assert_that(state.path, is_not_null);
     assert_that(state.max_line_length, is_equal_to(line_length));
@@ -328,6 +322,10 @@ Ensure(shell_impl, execute_commands)
     free(current_working_dir);
 
     test_execute_command("ls", RESET_STATE, "0\n", "");
+
+    test_execute_command("X=1 Y=2", RESET_STATE, "0\n", "");
+    test_execute_command("X=1 ls", RESET_STATE, "0\n", "");
+    test_execute_command("unset 1X", RESET_STATE, "1\n", "unset: 1X: not a valid identifier\n");
 }
 
 static void test_execute_command(const char *command, int expected_next_state, const char *expected_exit_code, const char *expected_error_message)
@@ -427,6 +425,7 @@ static void test_handle_error(const char *current_line, bool is_fatal, int expec
     memset(err_buf, 0, sizeof(err_buf));
     out_file = fmemopen(out_buf, sizeof(out_buf), "w");
     err_file = fmemopen(err_buf, sizeof(err_buf), "w");
+    state.stdin = NULL;
     state.stdout = out_file;
     state.stderr = err_file;
     init_state(&environ, &error, &state);
@@ -453,6 +452,144 @@ static void test_handle_error(const char *current_line, bool is_fatal, int expec
     dc_error_reset(&err);
 }
 
+Ensure(shell_impl, expansion_error)
+{
+    test_expansion_error("echo $((1/0))\n", true, RESET_STATE);
+    test_expansion_error("echo $((1+))\n", true, RESET_STATE);
+    test_expansion_error("echo $((1/0))\n", false, DESTROY_STATE);
+    test_expansion_error("echo $((1+))\n", false, DESTROY_STATE);
+}
+
+static void test_expansion_error(const char *command, bool interactive, int expected_next_state)
+{
+    char *in_buf;
+    char out_buf[1024];
+    char err_buf[1024];
+    FILE *in;
+    FILE *out;
+    FILE *err;
+    struct state state;
+    int next_state;
+
+    memset(out_buf, 0, sizeof(out_buf));
+    memset(err_buf, 0, sizeof(err_buf));
+    in_buf = strdup(command);
+    in = fmemopen(in_buf, strlen(in_buf) + 1, "r");
+    out = fmemopen(out_buf, sizeof(out_buf), "w");
+    err = fmemopen(err_buf, sizeof(err_buf), "w");
+    state.stdin = in;
+    state.stdout = out;
+    state.stderr = err;
+    unsetenv("PS1");
+
+    init_state(&environ, &error, &state);
+
+    next_state = read_commands(&environ, &error, &state);
+    assert_that(next_state, is_equal_to(SEPARATE_COMMANDS));
+
+    // a memory stream is never a terminal, so pretend the line was typed at one
+    state.interactive = interactive;
+
+    next_state = separate_commands(&environ, &error, &state);
+    assert_that(next_state, is_equal_to(PARSE_COMMANDS));
+
+    next_state = parse_commands(&environ, &error, &state);
+    assert_that(next_state, is_equal_to(ERROR));
+    assert_that(state.fatal_error, is_equal_to(!interactive));
+    assert_that(state.exit_code, is_equal_to(1));
+
+    next_state = handle_error(&environ, &error, &state);
+    assert_that(next_state, is_equal_to(expected_next_state));
+    fflush(err);
+    assert_that(strstr(err_buf, "internal error"), is_not_null);
+
+    if (!interactive) {
+        assert_that(state.exit_status, is_equal_to(1));
+    }
+
+    dc_error_reset(&error);
+    destroy_state(&environ, &error, &state);
+    free(in_buf);
+    fclose(in);
+    fclose(out);
+    fclose(err);
+}
+
+Ensure(shell_impl, glob_error)
+{
+    test_glob_error("echo %s/*\n", true);
+    test_glob_error("for f in %s/*; do echo $f; done\n", true);
+    test_glob_error("echo %s/*\n", false);
+    test_glob_error("for f in %s/*; do echo $f; done\n", false);
+}
+
+static void test_glob_error(const char *format, bool interactive)
+{
+    char root[32];
+    char file_name[64];
+    char line[128];
+    char out_buf[1024];
+    char err_buf[1024];
+    FILE *in;
+    FILE *out;
+    FILE *err;
+    struct state state;
+    struct rlimit saved;
+    struct rlimit limit;
+    int next_fd;
+    int next_state;
+
+    strcpy(root, "/tmp/globXXXXXX");
+    mkdtemp(root);
+    sprintf(file_name, "%s/a.c", root);
+    fclose(fopen(file_name, "w"));
+    sprintf(line, format, root);
+
+    memset(out_buf, 0, sizeof(out_buf));
+    memset(err_buf, 0, sizeof(err_buf));
+    in = fmemopen(line, strlen(line) + 1, "r");
+    out = fmemopen(out_buf, sizeof(out_buf), "w");
+    err = fmemopen(err_buf, sizeof(err_buf), "w");
+    state.stdin = in;
+    state.stdout = out;
+    state.stderr = err;
+    unsetenv("PS1");
+
+    init_state(&environ, &error, &state);
+    read_commands(&environ, &error, &state);
+    separate_commands(&environ, &error, &state);
+    state.interactive = interactive;
+
+    // no fd left to list the directory with: the glob fails, it doesn't just match nothing
+    next_fd = dup(0);
+    close(next_fd);
+    getrlimit(RLIMIT_NOFILE, &saved);
+    limit = saved;
+    limit.rlim_cur = (rlim_t) next_fd;
+    setrlimit(RLIMIT_NOFILE, &limit);
+
+    next_state = parse_commands(&environ, &error, &state);
+
+    if (next_state == EXECUTE_COMMANDS) {
+        next_state = execute_commands(&environ, &error, &state);
+    }
+
+    setrlimit(RLIMIT_NOFILE, &saved);
+    assert_that(next_state, is_equal_to(ERROR));
+    assert_that(error.err_code, is_equal_to(EMFILE));
+    assert_that(state.fatal_error, is_equal_to(!interactive));
+    assert_that(state.exit_code, is_equal_to(1));
+    assert_that(handle_error(&environ, &error, &state), is_equal_to(interactive ? RESET_STATE : DESTROY_STATE));
+
+    dc_error_reset(&error);
+    destroy_state(&environ, &error, &state);
+    fclose(in);
+    fclose(out);
+    fclose(err);
+    unlink(file_name);
+    rmdir(root);
+}
+
 TestSuite *shell_impl_tests(void)
 {
     TestSuite *suite;
@@ -467,6 +604,8 @@ TestSuite *shell_impl_tests(void)
    add_test_with_context(suite, shell_impl, execute_commands);
     add_test_with_context(suite, shell_impl, do_exit);
     add_test_with_context(suite, shell_impl, handle_error);
+    add_test_with_context(suite, shell_impl, expansion_error);
+    add_test_with_context(suite, shell_impl, glob_error);
 
     return suite;
 }
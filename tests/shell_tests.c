@@ -2,8 +2,13 @@
 #include "tests.h"
 #include "util.h"
 #include "input.h"
+#include "shell_impl.h"
 
 static void test_run_shell(const char *in, const char *expected_out, const char *expected_err);
+static void compare_runs(int last_state);
+static int go_read(const struct dc_posix_env *env, struct dc_error *err, void *arg);
+static int go_last(const struct dc_posix_env *env, struct dc_error *err, void *arg);
+static int go_exit(const struct dc_posix_env *env, struct dc_error *err, void *arg);
 
 Describe(shell);
 
@@ -41,6 +46,129 @@ Ensure(shell, run_shell)
     free(dir);
 }
 
+Ensure(shell, script_file)
+{
+    const char *script = "echo one\nnonexistent_zz\necho two\n";
+    char file_name[] = "/tmp/dc_script_XXXXXX";
+    char out_buf[1024];
+    char err_buf[1024];
+    FILE *in_file;
+    FILE *out_file;
+    FILE *err_file;
+    int fd;
+    const char *found;
+    size_t twos;
+
+    // run as dc_shell < file: the FILE has read ahead of the line being run, and a program that fails to
+    // start must not move the offset the shell shares with it back, or the shell reads the rest again at EOF
+    fd = mkstemp(file_name);
+    assert_that(fd, is_not_equal_to(-1));
+    assert_that(write(fd, script, strlen(script)), is_equal_to(strlen(script)));
+    close(fd);
+
+    memset(out_buf, 0, sizeof(out_buf));
+    memset(err_buf, 0, sizeof(err_buf));
+    in_file = fopen(file_name, "r");
+    out_file = fmemopen(out_buf, sizeof(out_buf), "w");
+    err_file = fmemopen(err_buf, sizeof(err_buf), "w");
+    assert_that(run_shell(&environ, &error, in_file, out_file, err_file), is_equal_to(0));
+    fflush(out_file);
+
+    twos = 0;
+
+    for (found = strstr(out_buf, "two\n"); found != NULL; found = strstr(found + 1, "two\n")) {
+        twos++;
+    }
+
+    assert_that(strstr(out_buf, "one\n"), is_not_null);
+    assert_that(strstr(out_buf, "127\n"), is_not_null);
+    assert_that(twos, is_equal_to(1));
+    fclose(in_file);
+    fclose(out_file);
+    fclose(err_file);
+    unlink(file_name);
+}
+
+Ensure(shell, expansion_error)
+{
+    const char *scripts[] = { "echo $((1/0))\necho after\n", "echo $((1+))\necho after\n" };
+
+    for (size_t i = 0; i < sizeof(scripts) / sizeof(scripts[0]); i++) {
+        char *in_buf;
+        char out_buf[1024];
+        char err_buf[1024];
+        FILE *in_file;
+        FILE *out_file;
+        FILE *err_file;
+
+        // a script stops at the first command that can't be expanded, and says so in its exit status
+        memset(out_buf, 0, sizeof(out_buf));
+        memset(err_buf, 0, sizeof(err_buf));
+        in_buf = strdup(scripts[i]);
+        in_file = fmemopen(in_buf, strlen(in_buf) + 1, "r");
+        out_file = fmemopen(out_buf, sizeof(out_buf), "w");
+        err_file = fmemopen(err_buf, sizeof(err_buf), "w");
+        assert_that(run_shell(&environ, &error, in_file, out_file, err_file), is_not_equal_to(0));
+        fflush(out_file);
+        fflush(err_file);
+        assert_that(strstr(out_buf, "after"), is_null);
+        assert_that(strstr(err_buf, "internal error"), is_not_null);
+        fclose(in_file);
+        fclose(out_file);
+        fclose(err_file);
+        free(in_buf);
+        dc_error_reset(&error);
+    }
+}
+
+Ensure(shell, transitions)
+{
+#define TRANSITION(from, to, perform) {from, to, perform},
+    static const struct dc_fsm_transition expected[] = {
+        SHELL_TRANSITIONS(TRANSITION)
+    };
+#undef TRANSITION
+    size_t count;
+
+    count = sizeof(expected) / sizeof(expected[0]);
+
+    // every pair is either in the list with the same function or not there at all
+    for(int from = 0; from < SHELL_STATE_COUNT; from++)
+    {
+        for(int to = 0; to < SHELL_STATE_COUNT; to++)
+        {
+            shell_perform perform;
+
+            perform = NULL;
+
+            for(size_t i = 0; i < count; i++)
+            {
+                if(expected[i].from_id == from && expected[i].to_id == to)
+                {
+                    perform = expected[i].perform;
+                }
+            }
+
+            assert_that(shell_transition(from, to), is_equal_to(perform));
+        }
+    }
+
+    assert_that(shell_transition(DC_FSM_INIT, INIT_STATE), is_equal_to(init_state));
+    assert_that(shell_transition(EXIT, DESTROY_STATE), is_equal_to(destroy_state));
+    assert_that(shell_transition(INIT_STATE, EXIT), is_null);
+    assert_that(shell_transition(-1, INIT_STATE), is_null);
+    assert_that(shell_transition(DESTROY_STATE, SHELL_STATE_COUNT), is_null);
+}
+
+Ensure(shell, dispatch_run)
+{
+    // a function that goes nowhere stops both with -1 at the same place
+    compare_runs(EXIT);
+    compare_runs(ERROR);
+    compare_runs(SHELL_STATE_COUNT + 5);
+    compare_runs(DC_FSM_EXIT);
+}
+
 static void test_run_shell(const char *in, const char *expected_out, const char *expected_err)
 {
     char *in_buf;
@@ -69,12 +197,83 @@ static void test_run_shell(const char *in, const char *expected_out, const char
     free(in_buf);
 }
 
+static void compare_runs(int last_state)
+{
+    // INIT_STATE -> READ_COMMANDS -> last_state, only READ_COMMANDS -> EXIT -> DC_FSM_EXIT goes on from there
+#define TEST_TRANSITIONS(TRANSITION)                  \
+    TRANSITION(DC_FSM_INIT, INIT_STATE, go_read)      \
+    TRANSITION(INIT_STATE, READ_COMMANDS, go_last)    \
+    TRANSITION(READ_COMMANDS, EXIT, go_exit)          \
+    TRANSITION(EXIT, DC_FSM_EXIT, NULL)
+#define TRANSITION(from, to, perform) {from, to, perform},
+    static const struct dc_fsm_transition transitions[] = {
+        TEST_TRANSITIONS(TRANSITION)
+    };
+#undef TRANSITION
+#define TRANSITION(from, to, perform) [from][to] = perform,
+    static const shell_perform dispatch[SHELL_STATE_COUNT][SHELL_STATE_COUNT] = {
+        TEST_TRANSITIONS(TRANSITION)
+    };
+#undef TRANSITION
+#undef TEST_TRANSITIONS
+    struct dc_fsm_info *fsm_info;
+    int fsm_from;
+    int fsm_to;
+    int fsm_ret;
+    int fsm_calls;
+    int direct_from;
+    int direct_to;
+    int direct_ret;
+    int direct_calls;
+
+    fsm_info = dc_fsm_info_create(&environ, &error, "test");
+    fsm_calls = last_state;
+    fsm_ret = dc_fsm_run(&environ, &error, fsm_info, &fsm_from, &fsm_to, &fsm_calls, transitions);
+    dc_fsm_info_destroy(&environ, &fsm_info);
+    dc_error_reset(&error);
+
+    direct_calls = last_state;
+    direct_ret = shell_dispatch_run(&environ, &error, dispatch, INIT_STATE, &direct_from, &direct_to, &direct_calls);
+
+    assert_that(direct_ret, is_equal_to(fsm_ret));
+    assert_that(direct_from, is_equal_to(fsm_from));
+    assert_that(direct_to, is_equal_to(fsm_to));
+    assert_that(direct_calls, is_equal_to(fsm_calls));
+    assert_that(direct_ret, is_equal_to(last_state == EXIT || last_state == DC_FSM_EXIT ? 0 : -1));
+}
+
+// each one counts itself in the high bits of arg, the low bits are the state go_last goes to
+static int go_read(const struct dc_posix_env *env, struct dc_error *err, void *arg)
+{
+    *(int *)arg += 0x100;
+
+    return READ_COMMANDS;
+}
+
+static int go_last(const struct dc_posix_env *env, struct dc_error *err, void *arg)
+{
+    *(int *)arg += 0x100;
+
+    return *(int *)arg & 0xFF;
+}
+
+static int go_exit(const struct dc_posix_env *env, struct dc_error *err, void *arg)
+{
+    *(int *)arg += 0x100;
+
+    return DC_FSM_EXIT;
+}
+
 TestSuite *shell_tests(void)
 {
     TestSuite *suite;
 
     suite = create_test_suite();
     add_test_with_context(suite, shell, run_shell);
+    add_test_with_context(suite, shell, script_file);
+    add_test_with_context(suite, shell, expansion_error);
+    add_test_with_context(suite, shell, transitions);
+    add_test_with_context(suite, shell, dispatch_run);
 
     return suite;
 }
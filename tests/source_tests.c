@@ -0,0 +1,319 @@
+#include "tests.h"
+#include "shell_impl.h"
+#include "source.h"
+#include "variables.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static void write_script(const char *file_name, const char *text);
+static void create_state(struct state *state);
+static void damage_cache_file(const char *directory);
+
+Describe(source);
+
+static struct dc_posix_env environ;
+static struct dc_error error;
+
+BeforeEach(source)
+{
+    dc_posix_env_init(&environ, NULL);
+    dc_error_init(&error, NULL);
+}
+
+AfterEach(source)
+{
+    dc_error_reset(&error);
+}
+
+Ensure(source, load)
+{
+    struct state state;
+    struct source_cache *cache;
+    struct script_node *first;
+    struct script_node *second;
+    char directory[] = "/tmp/dc_source_XXXXXX";
+    char file_name[64];
+    char cache_directory[64];
+
+    create_state(&state);
+    assert_that(mkdtemp(directory), is_not_null);
+    sprintf(file_name, "%s/lib.sh", directory);
+    sprintf(cache_directory, "%s/cache", directory);
+    write_script(file_name, "A=1\nfor x in a b; do B=$x; done\n");
+
+    cache = source_cache_create(&environ, &error);
+    first = source_cache_load(&environ, &error, cache, &state, file_name, cache_directory);
+    assert_false(dc_error_has_error(&error));
+    assert_that(first->type, is_equal_to(SCRIPT_LIST));
+    assert_that(cache->misses, is_equal_to(1));
+
+    // an unchanged file is not parsed again
+    second = source_cache_load(&environ, &error, cache, &state, file_name, cache_directory);
+    assert_that(second, is_equal_to(first));
+    assert_that(cache->hits, is_equal_to(1));
+    script_destroy(&environ, &first);
+    script_destroy(&environ, &second);
+
+    // a new shell reads what the first one saved
+    source_cache_destroy(&environ, &cache);
+    cache = source_cache_create(&environ, &error);
+    first = source_cache_load(&environ, &error, cache, &state, file_name, cache_directory);
+    assert_false(dc_error_has_error(&error));
+    assert_that(cache->disk_hits, is_equal_to(1));
+    assert_that(first->child_count, is_equal_to(2));
+    assert_that(first->children[1]->type, is_equal_to(SCRIPT_FOR));
+    assert_that(first->children[1]->body->children[0]->command->line, is_equal_to_string("B=$x"));
+    script_destroy(&environ, &first);
+
+    // a change to the file is parsed again
+    write_script(file_name, "A=2\n");
+    first = source_cache_load(&environ, &error, cache, &state, file_name, cache_directory);
+    assert_that(first->type, is_equal_to(SCRIPT_COMMAND));
+    assert_that(cache->misses, is_equal_to(1));
+    script_destroy(&environ, &first);
+
+    first = source_cache_load(&environ, &error, cache, &state, "/no/such/file", NULL);
+    assert_that(first, is_null);
+    assert_that(error.err_code, is_equal_to(ENOENT));
+    dc_error_reset(&error);
+
+    write_script(file_name, "if true; then\n");
+    first = source_cache_load(&environ, &error, cache, &state, file_name, NULL);
+    assert_that(first, is_null);
+    assert_that(error.err_code, is_equal_to(EINVAL));
+    dc_error_reset(&error);
+
+    source_cache_destroy(&environ, &cache);
+    assert_that(cache, is_null);
+    destroy_state(&environ, &error, &state);
+}
+
+Ensure(source, write_read)
+{
+    struct state state;
+    struct source_key key;
+    struct source_key other;
+    struct script_node *script;
+    struct script_node *copy;
+    FILE *file;
+    FILE *damaged;
+    long size;
+
+    create_state(&state);
+    key.device = 1;
+    key.inode = 2;
+    key.mtime_seconds = 3;
+    key.mtime_nanoseconds = 4;
+    key.size = 5;
+    other = key;
+    other.size = 6;
+
+    script = script_parse(&environ, &error, &state, "case $1 in a|b) cat < in > out;; esac; for x; do :; done; cat <<E\n$x\nE");
+    assert_false(dc_error_has_error(&error));
+
+    file = tmpfile();
+    assert_true(source_cache_write(file, "/a/b", &key, script));
+    size = ftell(file);
+
+    rewind(file);
+    copy = source_cache_read(&environ, &error, file, "/a/b", &key);
+    assert_that(copy, is_not_null);
+    assert_that(copy->children[0]->type, is_equal_to(SCRIPT_CASE));
+    assert_that(copy->children[0]->children[0]->word_count, is_equal_to(2));
+    assert_that(copy->children[0]->children[0]->body->children[0]->command->stdin_file, is_equal_to_string("in"));
+    assert_that(copy->children[0]->children[0]->body->children[0]->command->stdout_file, is_equal_to_string("out"));
+    assert_that(copy->children[0]->children[0]->body->children[0]->command->redirection_count, is_equal_to(2));
+    assert_that(copy->children[0]->children[0]->body->children[0]->command->redirections[1].type,
+                is_equal_to(REDIRECT_OUTPUT));
+    assert_that(copy->children[1]->name, is_equal_to_string("x"));
+    assert_that(copy->children[1]->words, is_null);
+    assert_that(copy->children[2]->command->here_document, is_equal_to_string("$x\n"));
+    assert_true(copy->children[2]->command->here_expand);
+    script_destroy(&environ, &copy);
+
+    // it is only good for the same file, unchanged
+    rewind(file);
+    assert_that(source_cache_read(&environ, &error, file, "/a/b", &other), is_null);
+    rewind(file);
+    assert_that(source_cache_read(&environ, &error, file, "/a/c", &key), is_null);
+
+    // a damaged file is ignored (read through a new stream, the old one has the whole file buffered)
+    assert_that(ftruncate(fileno(file), size - 3), is_equal_to(0));
+    damaged = fdopen(dup(fileno(file)), "r");
+    rewind(damaged);
+    assert_that(source_cache_read(&environ, &error, damaged, "/a/b", &key), is_null);
+    assert_false(dc_error_has_error(&error));
+
+    fclose(damaged);
+    fclose(file);
+    script_destroy(&environ, &script);
+    destroy_state(&environ, &error, &state);
+}
+
+Ensure(source, damaged)
+{
+    struct state state;
+    struct source_cache *cache;
+    struct script_node *script;
+    struct script_node *condition;
+    struct source_key key;
+    char directory[] = "/tmp/dc_source_XXXXXX";
+    char file_name[64];
+    char cache_directory[64];
+    FILE *file;
+
+    create_state(&state);
+    assert_that(mkdtemp(directory), is_not_null);
+    sprintf(file_name, "%s/lib.sh", directory);
+    sprintf(cache_directory, "%s/cache", directory);
+    write_script(file_name, "if true; then\nA=1\nfi\nfor x in a b; do B=$x; done\n");
+
+    cache = source_cache_create(&environ, &error);
+    script = source_cache_load(&environ, &error, cache, &state, file_name, cache_directory);
+    assert_that(script, is_not_null);
+    script_destroy(&environ, &script);
+    source_cache_destroy(&environ, &cache);
+
+    // a damaged file is parsed again, and saved again
+    damage_cache_file(cache_directory);
+    cache = source_cache_create(&environ, &error);
+    script = source_cache_load(&environ, &error, cache, &state, file_name, cache_directory);
+    assert_false(dc_error_has_error(&error));
+    assert_that(cache->disk_hits, is_equal_to(0));
+    assert_that(cache->misses, is_equal_to(1));
+    assert_that(script->children[0]->condition, is_not_null);
+    script_destroy(&environ, &script);
+    source_cache_destroy(&environ, &cache);
+
+    cache = source_cache_create(&environ, &error);
+    script = source_cache_load(&environ, &error, cache, &state, file_name, cache_directory);
+    assert_that(cache->disk_hits, is_equal_to(1));
+    script_destroy(&environ, &script);
+    source_cache_destroy(&environ, &cache);
+
+    // even with the right hash, an if without its condition is not read
+    key.device = 1;
+    key.inode = 2;
+    key.mtime_seconds = 3;
+    key.mtime_nanoseconds = 4;
+    key.size = 5;
+    script = script_parse(&environ, &error, &state, "if true; then A=1; fi");
+    assert_that(script->type, is_equal_to(SCRIPT_IF));
+    condition = script->condition;
+    script->condition = NULL;
+    file = tmpfile();
+    assert_true(source_cache_write(file, "/a/b", &key, script));
+    rewind(file);
+    assert_that(source_cache_read(&environ, &error, file, "/a/b", &key), is_null);
+    assert_false(dc_error_has_error(&error));
+    script->condition = condition;
+
+    fclose(file);
+    script_destroy(&environ, &script);
+    destroy_state(&environ, &error, &state);
+}
+
+Ensure(source, builtin)
+{
+    struct state state;
+    struct script_node *script;
+    char directory[] = "/tmp/dc_source_XXXXXX";
+    char file_name[64];
+    char line[128];
+
+    create_state(&state);
+    variables_set(&environ, &error, state.variables, "SOURCECACHE", "memory");
+    assert_that(mkdtemp(directory), is_not_null);
+    sprintf(file_name, "%s/lib.sh", directory);
+    write_script(file_name, "COUNT=$#\nf() { R=$1; }\nreturn 3\nR=after\n");
+
+    sprintf(line, "R=; . %s a b; f $COUNT", file_name);
+    script = script_parse(&environ, &error, &state, line);
+    assert_that(script_execute(&environ, &error, &state, script), is_equal_to(SCRIPT_NEXT));
+    assert_false(dc_error_has_error(&error));
+    assert_that(variables_get(&environ, state.variables, "R"), is_equal_to_string("2"));
+    script_destroy(&environ, &script);
+
+    sprintf(line, "source %s; R2=$?", file_name);
+    script = script_parse(&environ, &error, &state, line);
+    script_execute(&environ, &error, &state, script);
+    assert_that(variables_get(&environ, state.variables, "R2"), is_equal_to_string("3"));
+    assert_that(variables_get(&environ, state.variables, "COUNT"), is_equal_to_string("0"));
+    assert_that(state.script_context->sources->hits, is_equal_to(1));
+    script_destroy(&environ, &script);
+
+    script = script_parse(&environ, &error, &state, "source /no/such/file; R=$?");
+    script_execute(&environ, &error, &state, script);
+    assert_false(dc_error_has_error(&error));
+    assert_that(variables_get(&environ, state.variables, "R"), is_equal_to_string("1"));
+    script_destroy(&environ, &script);
+
+    destroy_state(&environ, &error, &state);
+}
+
+static void write_script(const char *file_name, const char *text)
+{
+    FILE *file;
+
+    file = fopen(file_name, "w");
+    assert_that(file, is_not_null);
+    fputs(text, file);
+    fclose(file);
+}
+
+/*
+ * Flip a byte in the middle of the one file in the directory.
+ */
+static void damage_cache_file(const char *directory)
+{
+    DIR *dir;
+    struct dirent *entry;
+    char path[256];
+    struct stat status;
+    unsigned char byte;
+    int fd;
+
+    dir = opendir(directory);
+    assert_that(dir, is_not_null);
+    path[0] = '\0';
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            sprintf(path, "%s/%s", directory, entry->d_name);
+        }
+    }
+
+    closedir(dir);
+    fd = open(path, O_RDWR);
+    assert_that(fd, is_not_equal_to(-1));
+    assert_that(fstat(fd, &status), is_equal_to(0));
+    assert_that(pread(fd, &byte, 1, status.st_size / 2), is_equal_to(1));
+    byte ^= 0xff;
+    assert_that(pwrite(fd, &byte, 1, status.st_size / 2), is_equal_to(1));
+    close(fd);
+}
+
+static void create_state(struct state *state)
+{
+    state->stdin = stdin;
+    state->stdout = tmpfile();
+    state->stderr = tmpfile();
+    init_state(&environ, &error, state);
+    assert_false(dc_error_has_error(&error));
+    state->command = calloc(1, sizeof(struct command));
+}
+
+TestSuite *source_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, source, load);
+    add_test_with_context(suite, source, write_read);
+    add_test_with_context(suite, source, damaged);
+    add_test_with_context(suite, source, builtin);
+
+    return suite;
+}
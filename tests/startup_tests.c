@@ -0,0 +1,63 @@
+#include "tests.h"
+#include "startup.h"
+#include <stdlib.h>
+
+static char *read_all(FILE *file);
+
+Describe(startup);
+
+BeforeEach(startup)
+{
+}
+
+AfterEach(startup)
+{
+}
+
+Ensure(startup, phases)
+{
+    FILE *file;
+    char *text;
+
+    file = tmpfile();
+    startup_profile_start();
+
+    // nothing is reported without --verbose
+    startup_profile_phase("settings");
+    startup_profile_enable(file);
+    startup_profile_phase("init_state");
+    startup_profile_finish("first prompt");
+    startup_profile_phase("later");
+
+    text = read_all(file);
+    assert_that(text, does_not_contain_string("settings"));
+    assert_that(text, begins_with_string("startup: init_state"));
+    assert_that(text, contains_string("\nstartup: first prompt"));
+    assert_that(text, contains_string(" ms total)\n"));
+    assert_that(text, does_not_contain_string("later"));
+    free(text);
+    fclose(file);
+}
+
+static char *read_all(FILE *file)
+{
+    char *text;
+    long size;
+
+    size = ftell(file);
+    text = calloc((size_t) size + 1, 1);
+    rewind(file);
+    assert_that(fread(text, 1, (size_t) size, file), is_equal_to(size));
+
+    return text;
+}
+
+TestSuite *startup_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, startup, phases);
+
+    return suite;
+}
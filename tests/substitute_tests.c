@@ -0,0 +1,174 @@
+#include "tests.h"
+#include "script.h"
+#include "shell_impl.h"
+#include "substitute.h"
+#include "variables.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+static void test_substitute(struct state *state, const char *text, const char *expected_output,
+                            int expected_exit_code);
+static void create_state(struct state *state);
+
+Describe(substitute);
+
+static struct dc_posix_env environ;
+static struct dc_error error;
+
+BeforeEach(substitute)
+{
+    dc_posix_env_init(&environ, NULL);
+    dc_error_init(&error, NULL);
+}
+
+AfterEach(substitute)
+{
+    dc_error_reset(&error);
+}
+
+Ensure(substitute, substitute_command)
+{
+    struct state state;
+    char *output;
+
+    create_state(&state);
+
+    // run in the shell
+    test_substitute(&state, "echo a  b", "a b", 0);
+    test_substitute(&state, "echo -n a", "a", 0);
+    test_substitute(&state, "false", "", 1);
+    test_substitute(&state, "", "", 0);
+
+    // run in a child
+    test_substitute(&state, "echo a; echo b; echo; echo", "a\nb", 0);
+    test_substitute(&state, "for x in 1 2; do echo $x; done; false", "1\n2", 1);
+    test_substitute(&state, "printf 'x\\n\\n'", "x", 0);
+    test_substitute(&state, "echo $(echo inner)", "inner", 0);
+
+    // the child's variables are its own
+    variables_set(&environ, &error, state.variables, "X", "outer");
+    test_substitute(&state, "X=inner; echo $X", "inner", 0);
+    assert_that(variables_get(&environ, state.variables, "X"), is_equal_to_string("outer"));
+
+    // the command being expanded is left alone
+    state.command->line = strdup("A=$(false)");
+    test_substitute(&state, "sh -c 'exit 3'", "", 3);
+    assert_that(state.command->line, is_equal_to_string("A=$(false)"));
+    assert_that(state.command->exit_code, is_equal_to(3));
+
+    output = substitute_command(&environ, &error, &state, "if true; then");
+    assert_that(output, is_null);
+    assert_that(error.err_code, is_equal_to(EINVAL));
+    dc_error_reset(&error);
+
+    destroy_state(&environ, &error, &state);
+}
+
+Ensure(substitute, expand)
+{
+    struct state state;
+    struct script_node *script;
+
+    create_state(&state);
+    script = script_parse(&environ, &error, &state,
+                          "A=$(echo 1 2); B=\"`echo \\`echo 3\\``\"; C=$(false); R=$?; D=$(sh -c 'exit 4')");
+    assert_false(dc_error_has_error(&error));
+    script_execute(&environ, &error, &state, script);
+    assert_false(dc_error_has_error(&error));
+    assert_that(variables_get(&environ, state.variables, "A"), is_equal_to_string("1 2"));
+    assert_that(variables_get(&environ, state.variables, "B"), is_equal_to_string("3"));
+    assert_that(variables_get(&environ, state.variables, "R"), is_equal_to_string("1"));
+    assert_that(state.exit_code, is_equal_to(4));
+    script_destroy(&environ, &script);
+    destroy_state(&environ, &error, &state);
+}
+
+Ensure(substitute, substitute_process)
+{
+    struct state state;
+    struct script_node *script;
+    char file_name[] = "/tmp/dc_process_XXXXXX";
+    char text[256];
+    char *path;
+    FILE *file;
+
+    create_state(&state);
+
+    // <(commands) is read through the path
+    path = substitute_process(&environ, &error, &state, "echo piped", true);
+    assert_false(dc_error_has_error(&error));
+    assert_that(state.command->substitution_count, is_equal_to(1));
+    file = fopen(path, "r");
+    assert_that(file, is_not_null);
+    assert_that(fgets(text, sizeof(text), file), is_equal_to(text));
+    assert_that(text, is_equal_to_string("piped\n"));
+    fclose(file);
+    free(path);
+    substitute_finish(&environ, state.command);
+    assert_that(state.command->substitution_count, is_equal_to(0));
+
+    // >(commands) reads what is written to the path, it is done once it is finished
+    assert_that(mkstemp(file_name), is_not_equal_to(-1));
+    sprintf(text, "tr a-z A-Z > %s", file_name);
+    path = substitute_process(&environ, &error, &state, text, false);
+    assert_false(dc_error_has_error(&error));
+    file = fopen(path, "w");
+    assert_that(file, is_not_null);
+    fputs("upper\n", file);
+    fclose(file);
+    free(path);
+    substitute_finish(&environ, state.command);
+    file = fopen(file_name, "r");
+    assert_that(fgets(text, sizeof(text), file), is_equal_to(text));
+    assert_that(text, is_equal_to_string("UPPER\n"));
+    fclose(file);
+    unlink(file_name);
+
+    script = script_parse(&environ, &error, &state, "A=$(cat <(echo one) <(echo two; echo three))");
+    assert_false(dc_error_has_error(&error));
+    script_execute(&environ, &error, &state, script);
+    assert_false(dc_error_has_error(&error));
+    assert_that(variables_get(&environ, state.variables, "A"), is_equal_to_string("one\ntwo\nthree"));
+    script_destroy(&environ, &script);
+
+    path = substitute_process(&environ, &error, &state, "if true; then", true);
+    assert_that(path, is_null);
+    assert_that(error.err_code, is_equal_to(EINVAL));
+    dc_error_reset(&error);
+
+    destroy_state(&environ, &error, &state);
+}
+
+static void test_substitute(struct state *state, const char *text, const char *expected_output,
+                            int expected_exit_code)
+{
+    char *output;
+
+    output = substitute_command(&environ, &error, state, text);
+    assert_false(dc_error_has_error(&error));
+    assert_that(output, is_equal_to_string(expected_output));
+    assert_that(state->exit_code, is_equal_to(expected_exit_code));
+    free(output);
+}
+
+static void create_state(struct state *state)
+{
+    state->stdin = stdin;
+    state->stdout = tmpfile();
+    state->stderr = tmpfile();
+    init_state(&environ, &error, state);
+    assert_false(dc_error_has_error(&error));
+    state->command = calloc(1, sizeof(struct command));
+}
+
+TestSuite *substitute_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, substitute, substitute_command);
+    add_test_with_context(suite, substitute, expand);
+    add_test_with_context(suite, substitute, substitute_process);
+
+    return suite;
+}
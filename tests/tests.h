@@ -4,12 +4,30 @@
 
 #include <cgreen/cgreen.h>
 
+TestSuite *arith_tests(void);
+TestSuite *audit_tests(void);
+TestSuite *batch_tests(void);
 TestSuite *builtin_tests(void);
 TestSuite *command_tests(void);
+TestSuite *copy_tests(void);
 TestSuite *execute_tests(void);
+TestSuite *expand_tests(void);
+TestSuite *history_tests(void);
 TestSuite *input_tests(void);
+TestSuite *launch_tests(void);
+TestSuite *line_editor_tests(void);
+TestSuite *mem_stats_tests(void);
+TestSuite *pathname_tests(void);
+TestSuite *scan_tests(void);
+TestSuite *script_tests(void);
 TestSuite *shell_impl_tests(void);
 TestSuite *shell_tests(void);
+TestSuite *source_tests(void);
+TestSuite *startup_tests(void);
+TestSuite *substitute_tests(void);
+TestSuite *thread_pool_tests(void);
+TestSuite *trace_tests(void);
 TestSuite *util_tests(void);
+TestSuite *variables_tests(void);
 
 #endif // LIBDC_POSIX_TESTS_H
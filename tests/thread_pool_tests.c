@@ -0,0 +1,115 @@
+#include "tests.h"
+#include "thread_pool.h"
+#include <stdatomic.h>
+
+static void count_tree(const struct dc_posix_env *env, struct dc_error *err, struct thread_pool *pool,
+                       size_t worker, void *arg);
+static void fail(const struct dc_posix_env *env, struct dc_error *err, struct thread_pool *pool,
+                 size_t worker, void *arg);
+
+Describe(thread_pool);
+
+static struct dc_posix_env environ;
+static struct dc_error error;
+static atomic_size_t visited;
+static size_t depths[16];
+
+BeforeEach(thread_pool)
+{
+    dc_posix_env_init(&environ, NULL);
+    dc_error_init(&error, NULL);
+    atomic_init(&visited, 0);
+
+    for (size_t i = 0; i < sizeof(depths) / sizeof(depths[0]); i++) {
+        depths[i] = i;
+    }
+}
+
+AfterEach(thread_pool)
+{
+    dc_error_reset(&error);
+}
+
+Ensure(thread_pool, run)
+{
+    struct thread_pool *pool;
+
+    pool = thread_pool_create(&environ, &error, 4);
+    assert_that(pool, is_not_null);
+    assert_that(pool->worker_count, is_equal_to(4));
+
+    // a binary tree 12 levels deep, each task submits its children
+    thread_pool_submit(&environ, &error, pool, 0, count_tree, &depths[12]);
+    thread_pool_run(&environ, &error, pool);
+    assert_false(dc_error_has_error(&error));
+    assert_that(atomic_load(&visited), is_equal_to(8191));
+    assert_that(pool->pending, is_equal_to(0));
+
+    // the pool can be run again
+    atomic_store(&visited, 0);
+    thread_pool_submit(&environ, &error, pool, 0, count_tree, &depths[3]);
+    thread_pool_submit(&environ, &error, pool, 0, count_tree, &depths[3]);
+    thread_pool_run(&environ, &error, pool);
+    assert_that(atomic_load(&visited), is_equal_to(30));
+
+    thread_pool_destroy(&environ, &pool);
+    assert_that(pool, is_null);
+
+    // 0 workers is one per processor
+    pool = thread_pool_create(&environ, &error, 0);
+    assert_that(pool->worker_count, is_greater_than(0));
+    thread_pool_destroy(&environ, &pool);
+}
+
+Ensure(thread_pool, failure)
+{
+    struct thread_pool *pool;
+
+    pool = thread_pool_create(&environ, &error, 3);
+    thread_pool_submit(&environ, &error, pool, 0, count_tree, &depths[4]);
+    thread_pool_submit(&environ, &error, pool, 0, fail, NULL);
+    thread_pool_run(&environ, &error, pool);
+
+    // the other tasks still run, the failure is reported once they are done
+    assert_that(atomic_load(&visited), is_equal_to(31));
+    assert_true(dc_error_has_error(&error));
+    assert_that(error.err_code, is_equal_to(EIO));
+    assert_false(thread_pool_cancelled(pool));
+
+    thread_pool_destroy(&environ, &pool);
+}
+
+static void count_tree(const struct dc_posix_env *env, struct dc_error *err, struct thread_pool *pool,
+                       size_t worker, void *arg)
+{
+    size_t depth;
+
+    depth = *(size_t *) arg;
+    atomic_fetch_add(&visited, 1);
+
+    if (depth > 0) {
+        thread_pool_submit(env, err, pool, worker, count_tree, &depths[depth - 1]);
+        thread_pool_submit(env, err, pool, worker, count_tree, &depths[depth - 1]);
+    }
+}
+
+static void fail(const struct dc_posix_env *env, struct dc_error *err, struct thread_pool *pool,
+                 size_t worker, void *arg)
+{
+    (void) env;
+    (void) pool;
+    (void) worker;
+    (void) arg;
+    DC_ERROR_RAISE_USER(err, "failed", EIO);
+}
+
+TestSuite *thread_pool_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, thread_pool, run);
+    add_test_with_context(suite, thread_pool, failure);
+
+    return suite;
+}
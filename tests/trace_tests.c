@@ -0,0 +1,161 @@
+#include "tests.h"
+#include "trace.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static void traced_call(const struct dc_posix_env *env);
+static void other_call(const struct dc_posix_env *env);
+static void *trace_thread(void *arg);
+static char *decode(const char *name, bool summary);
+
+Describe(trace);
+
+static struct dc_posix_env environ;
+static struct dc_error error;
+static char file_name[] = "/tmp/dc_trace_XXXXXX";
+
+BeforeEach(trace)
+{
+    int fd;
+
+    dc_posix_env_init(&environ, trace_record);
+    dc_error_init(&error, NULL);
+    strcpy(file_name, "/tmp/dc_trace_XXXXXX");
+    fd = mkstemp(file_name);
+    assert_that(fd, is_not_equal_to(-1));
+    close(fd);
+}
+
+AfterEach(trace)
+{
+    dc_error_reset(&error);
+    unlink(file_name);
+}
+
+Ensure(trace, record)
+{
+    pthread_t thread;
+    char *text;
+
+    // nothing is recorded until it is opened
+    traced_call(&environ);
+    assert_that(trace_open("/tmp/missing/trace"), is_equal_to(ENOENT));
+    assert_that(trace_open(file_name), is_equal_to(0));
+
+    // more than a ring holds, and a thread that writes its own when it exits
+    for (int i = 0; i < 5000; i++) {
+        traced_call(&environ);
+    }
+
+    assert_that(pthread_create(&thread, NULL, trace_thread, NULL), is_equal_to(0));
+    assert_that(pthread_join(thread, NULL), is_equal_to(0));
+    trace_close();
+    traced_call(&environ);
+
+    text = decode(file_name, true);
+    assert_that(text, is_equal_to_string("      5000 traced_call\n         3 other_call\n"));
+    free(text);
+
+    text = decode(file_name, false);
+    assert_that(text, begins_with_string("0."));
+    assert_that(text, contains_string("/1 traced_call "));
+    assert_that(text, contains_string("/2 other_call "));
+    assert_that(text, contains_string("trace_tests.c:"));
+    free(text);
+}
+
+Ensure(trace, fork)
+{
+    char expected[64];
+    pid_t child;
+    int status;
+    char *text;
+
+    assert_that(trace_open(file_name), is_equal_to(0));
+    traced_call(&environ);
+    child = fork();
+
+    // the child's calls are written when it execs, without a flush
+    if (child == 0) {
+        other_call(&environ);
+        trace_record(&environ, __FILE__, "dc_execve", __LINE__);
+        _exit(0);
+    }
+
+    assert_that(waitpid(child, &status, 0), is_equal_to(child));
+    trace_close();
+
+    text = decode(file_name, true);
+    assert_that(text, contains_string("         1 traced_call\n"));
+    assert_that(text, contains_string("         1 other_call\n"));
+    free(text);
+
+    text = decode(file_name, false);
+    snprintf(expected, sizeof(expected), "%d/1 dc_execve ", (int)child);
+    assert_that(text, contains_string(expected));
+    free(text);
+}
+
+Ensure(trace, decode)
+{
+    FILE *in;
+    FILE *out;
+
+    in = fmemopen("not a trace at all", 18, "r");
+    out = tmpfile();
+    assert_false(trace_decode(in, out, false));
+    fclose(in);
+    fclose(out);
+}
+
+static void traced_call(const struct dc_posix_env *env)
+{
+    DC_TRACE(env);
+}
+
+static void other_call(const struct dc_posix_env *env)
+{
+    DC_TRACE(env);
+}
+
+static void *trace_thread(__attribute__((unused)) void *arg)
+{
+    for (int i = 0; i < 3; i++) {
+        other_call(&environ);
+    }
+
+    return NULL;
+}
+
+static char *decode(const char *name, bool summary)
+{
+    FILE *in;
+    FILE *out;
+    char *text;
+    size_t size;
+
+    in = fopen(name, "rb");
+    assert_that(in, is_not_null);
+    out = open_memstream(&text, &size);
+    assert_true(trace_decode(in, out, summary));
+    fclose(in);
+    fclose(out);
+
+    return text;
+}
+
+TestSuite *trace_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, trace, record);
+    add_test_with_context(suite, trace, fork);
+    add_test_with_context(suite, trace, decode);
+
+    return suite;
+}
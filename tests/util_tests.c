@@ -104,9 +104,6 @@ Ensure(util, do_reset_state)
     state.stdin = stdin;
     state.stdout = stdout;
     state.stderr = stderr;
-    state.in_redirect_regex = NULL;
-    state.out_redirect_regex = NULL;
-    state.err_redirect_regex = NULL;
     state.path = NULL;
     state.prompt = NULL;
     state.max_line_length = 0;
@@ -168,9 +165,6 @@ Ensure(util, state_to_string)
     struct state state;
     char *str;
 
-    state.in_redirect_regex = NULL;
-    state.out_redirect_regex = NULL;
-    state.err_redirect_regex = NULL;
     state.path = NULL;
     state.prompt = NULL;
     state.max_line_length = 0;
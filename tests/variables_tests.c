@@ -0,0 +1,243 @@
+#include "tests.h"
+#include "variables.h"
+
+static size_t count_entries(char **envp);
+static bool has_entry(char **envp, const char *entry);
+static void count_changes(const struct dc_posix_env *env, struct dc_error *err, const char *name,
+                          const char *value, void *data);
+
+Describe(variables);
+
+static struct dc_posix_env environ;
+static struct dc_error error;
+
+BeforeEach(variables)
+{
+    dc_posix_env_init(&environ, NULL);
+    dc_error_init(&error, NULL);
+}
+
+AfterEach(variables)
+{
+    dc_error_reset(&error);
+}
+
+Ensure(variables, set_and_get)
+{
+    struct variables *variables;
+    char name[16];
+
+    variables = variables_create(&environ, &error);
+    assert_that(variables, is_not_null);
+    assert_that(variables_get(&environ, variables, "FOO"), is_null);
+
+    variables_set(&environ, &error, variables, "FOO", "1");
+    variables_set(&environ, &error, variables, "FOO", "2");
+    assert_false(dc_error_has_error(&error));
+    assert_that(variables_get(&environ, variables, "FOO"), is_equal_to_string("2"));
+
+    // not exported, so commands do not see it
+    assert_that(count_entries(variables_environ(variables)), is_equal_to(0));
+
+    // enough variables to make the table grow
+    for (int i = 0; i < 200; i++) {
+        sprintf(name, "V%d", i);
+        variables_set(&environ, &error, variables, name, name);
+    }
+
+    assert_that(variables->count, is_equal_to(201));
+    assert_that(variables_get(&environ, variables, "V0"), is_equal_to_string("V0"));
+    assert_that(variables_get(&environ, variables, "V199"), is_equal_to_string("V199"));
+
+    variables_set(&environ, &error, variables, "1BAD", "x");
+    assert_that(error.err_code, is_equal_to(EINVAL));
+
+    variables_destroy(&environ, &variables);
+    assert_that(variables, is_null);
+}
+
+Ensure(variables, export_and_unset)
+{
+    struct variables *variables;
+    char *environment[] = { "HOME=/home/user", "PATH=/bin:/usr/bin", "=odd", "NOT-A-NAME=1", NULL };
+    char **envp;
+
+    // the entries that can't be variables are still passed on to the programs
+    variables = variables_create(&environ, &error);
+    variables_import(&environ, &error, variables, environment);
+    envp = variables_environ(variables);
+    assert_that(count_entries(envp), is_equal_to(4));
+    assert_true(has_entry(envp, "HOME=/home/user"));
+    assert_true(has_entry(envp, "PATH=/bin:/usr/bin"));
+    assert_true(has_entry(envp, "=odd"));
+    assert_true(has_entry(envp, "NOT-A-NAME=1"));
+    assert_that(variables_get(&environ, variables, "NOT-A-NAME"), is_null);
+
+    // setting an exported variable replaces its entry
+    variables_set(&environ, &error, variables, "HOME", "/tmp");
+    envp = variables_environ(variables);
+    assert_that(count_entries(envp), is_equal_to(4));
+    assert_true(has_entry(envp, "HOME=/tmp"));
+
+    // exporting without a value waits for the value
+    variables_export(&environ, &error, variables, "LATER", NULL);
+    assert_that(count_entries(variables_environ(variables)), is_equal_to(4));
+    variables_set(&environ, &error, variables, "LATER", "now");
+    envp = variables_environ(variables);
+    assert_that(count_entries(envp), is_equal_to(5));
+    assert_true(has_entry(envp, "LATER=now"));
+
+    // removing the first entry moves the last one into its place
+    variables_unset(&environ, &error, variables, "HOME");
+    envp = variables_environ(variables);
+    assert_that(count_entries(envp), is_equal_to(4));
+    assert_false(has_entry(envp, "HOME=/tmp"));
+    assert_that(variables_get(&environ, variables, "HOME"), is_null);
+    variables_set(&environ, &error, variables, "LATER", "again");
+    envp = variables_environ(variables);
+    assert_that(count_entries(envp), is_equal_to(4));
+    assert_true(has_entry(envp, "LATER=again"));
+    assert_true(has_entry(envp, "PATH=/bin:/usr/bin"));
+    assert_true(has_entry(envp, "NOT-A-NAME=1"));
+
+    // one that is not a variable can be the last entry that is moved
+    variables_unset(&environ, &error, variables, "PATH");
+    variables_set(&environ, &error, variables, "LATER", "last");
+    envp = variables_environ(variables);
+    assert_that(count_entries(envp), is_equal_to(3));
+    assert_true(has_entry(envp, "NOT-A-NAME=1"));
+    assert_true(has_entry(envp, "=odd"));
+    assert_true(has_entry(envp, "LATER=last"));
+
+    variables_assign(&environ, &error, variables, "NEW=a=b", true);
+    assert_that(variables_get(&environ, variables, "NEW"), is_equal_to_string("a=b"));
+    assert_true(has_entry(variables_environ(variables), "NEW=a=b"));
+
+    variables_destroy(&environ, &variables);
+}
+
+Ensure(variables, readonly)
+{
+    struct variables *variables;
+
+    variables = variables_create(&environ, &error);
+    variables_readonly(&environ, &error, variables, "FIXED", "1");
+    assert_false(dc_error_has_error(&error));
+
+    variables_set(&environ, &error, variables, "FIXED", "2");
+    assert_that(error.err_code, is_equal_to(EPERM));
+    dc_error_reset(&error);
+
+    variables_unset(&environ, &error, variables, "FIXED");
+    assert_that(error.err_code, is_equal_to(EPERM));
+    dc_error_reset(&error);
+
+    // exporting is allowed, changing the value is not
+    variables_export(&environ, &error, variables, "FIXED", NULL);
+    assert_false(dc_error_has_error(&error));
+    assert_true(has_entry(variables_environ(variables), "FIXED=1"));
+
+    variables_destroy(&environ, &variables);
+}
+
+Ensure(variables, listener)
+{
+    struct variables *variables;
+    int changes;
+
+    changes = 0;
+    variables = variables_create(&environ, &error);
+    variables_set_listener(variables, count_changes, &changes);
+    variables_set(&environ, &error, variables, "PS1", "> ");
+    variables_export(&environ, &error, variables, "PS1", NULL);
+    variables_unset(&environ, &error, variables, "PS1");
+    variables_unset(&environ, &error, variables, "PS1");
+    assert_that(changes, is_equal_to(2));
+
+    variables_destroy(&environ, &variables);
+}
+
+Ensure(variables, names)
+{
+    assert_true(variables_is_name("FOO", 3));
+    assert_true(variables_is_name("_f00", 4));
+    assert_true(variables_is_name("FOO=1", 3));
+    assert_false(variables_is_name("", 0));
+    assert_false(variables_is_name("9A", 2));
+    assert_false(variables_is_name("A-B", 3));
+
+    assert_true(variables_is_assignment(&environ, "FOO=1"));
+    assert_true(variables_is_assignment(&environ, "FOO="));
+    assert_false(variables_is_assignment(&environ, "=1"));
+    assert_false(variables_is_assignment(&environ, "./a=b"));
+    assert_false(variables_is_assignment(&environ, "ls"));
+}
+
+Ensure(variables, print)
+{
+    struct variables *variables;
+    char out_buf[1024];
+    FILE *out;
+
+    variables = variables_create(&environ, &error);
+    variables_export(&environ, &error, variables, "B", "say \"hi\"");
+    variables_export(&environ, &error, variables, "A", "1");
+    variables_set(&environ, &error, variables, "C", "3");
+
+    memset(out_buf, 0, sizeof(out_buf));
+    out = fmemopen(out_buf, sizeof(out_buf), "w");
+    variables_print(&environ, &error, variables, VARIABLES_EXPORTED, out);
+    fclose(out);
+    assert_that(out_buf, is_equal_to_string("export A=\"1\"\nexport B=\"say \\\"hi\\\"\"\n"));
+
+    variables_destroy(&environ, &variables);
+}
+
+static size_t count_entries(char **envp)
+{
+    size_t count;
+
+    count = 0;
+
+    while (envp[count] != NULL) {
+        count++;
+    }
+
+    return count;
+}
+
+static bool has_entry(char **envp, const char *entry)
+{
+    for (size_t i = 0; envp[i] != NULL; i++) {
+        if (strcmp(envp[i], entry) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void count_changes(const struct dc_posix_env *env, struct dc_error *err, const char *name,
+                          const char *value, void *data)
+{
+    (void) env;
+    (void) err;
+    (void) name;
+    (void) value;
+    (*(int *) data)++;
+}
+
+TestSuite *variables_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, variables, set_and_get);
+    add_test_with_context(suite, variables, export_and_unset);
+    add_test_with_context(suite, variables, readonly);
+    add_test_with_context(suite, variables, listener);
+    add_test_with_context(suite, variables, names);
+    add_test_with_context(suite, variables, print);
+
+    return suite;
+}